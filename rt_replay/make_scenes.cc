@@ -0,0 +1,1067 @@
+// Copyright (c) 2022, Mohammadreza Saed, Yuan Hsi Chou, Lufei Liu, Tor M. Aamodt,
+// The University of British Columbia
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+// Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution. Neither the name of
+// The University of British Columbia nor the names of its contributors may be
+// used to endorse or promote products derived from this software without
+// specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+// Canonical synthetic scene bundles for rt_replay.
+//
+// Writes bundles in the layout of scenes/README.md without Vulkan, Mesa or a
+// captured application, so every checkout has the same fixed workloads to
+// replay. A bundle holds a two level acceleration structure in the Intel
+// GEN_RT_BVH layout the simulator traverses (the byte offsets below follow
+// the *_unpack routines in src/cuda-sim/vulkan_acceleration_structure_util.h),
+// a raygen, a miss and a closest hit shader, their shader binding tables,
+// a camera, a payload buffer and a linear RGBA8 storage image.
+//
+// Usage: make_scenes -o <scenes dir> [-r <width>x<height>] [scene ...]
+//   Without scene names every canonical scene is written, see --help.
+
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#define SBT_SIZE (64 * sizeof(uint64_t))
+#define SBT_RECORD_SIZE (8 * sizeof(uint32_t))
+
+// Every node and leaf is a multiple of a 64 byte slot
+#define SLOT_SIZE 64
+#define MAX_CHILDREN 6
+
+// GEN_RT_BVH_INTERNAL_NODE child types
+#define NODE_TYPE_INTERNAL 0
+#define NODE_TYPE_INSTANCE 1
+#define NODE_TYPE_QUAD 4
+
+// gl_shader_stage of the mesa-vulkan-sim tree
+#define STAGE_RAYGEN 8
+#define STAGE_CLOSEST_HIT 10
+#define STAGE_MISS 11
+
+// Vulkan enums, by value
+#define DESCRIPTOR_TYPE_STORAGE_IMAGE 3
+#define DESCRIPTOR_TYPE_UNIFORM_BUFFER 6
+#define DESCRIPTOR_TYPE_STORAGE_BUFFER 7
+#define DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE 1000150000
+#define FORMAT_R8G8B8A8_UNORM 37
+#define IMAGE_TILING_LINEAR 1
+#define ISL_TILING_LINEAR 0
+
+// Descriptor set 0 bindings the shaders below use
+#define BINDING_TLAS 0
+#define BINDING_IMAGE 1
+#define BINDING_PAYLOAD 2
+#define BINDING_CAMERA 3
+
+#define PAYLOAD_SIZE (4 * sizeof(float))
+
+struct vec3
+{
+    float x, y, z;
+};
+
+static vec3 make_vec3(float x, float y, float z)
+{
+    vec3 v = {x, y, z};
+    return v;
+}
+
+static vec3 operator+(vec3 a, vec3 b) { return make_vec3(a.x + b.x, a.y + b.y, a.z + b.z); }
+static vec3 operator-(vec3 a, vec3 b) { return make_vec3(a.x - b.x, a.y - b.y, a.z - b.z); }
+static vec3 operator*(vec3 a, float s) { return make_vec3(a.x * s, a.y * s, a.z * s); }
+
+static vec3 cross(vec3 a, vec3 b)
+{
+    return make_vec3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+}
+
+static vec3 normalize(vec3 a)
+{
+    float length = sqrtf(a.x * a.x + a.y * a.y + a.z * a.z);
+    return a * (1.0f / length);
+}
+
+static float component(vec3 v, int axis)
+{
+    return axis == 0 ? v.x : axis == 1 ? v.y : v.z;
+}
+
+struct aabb
+{
+    vec3 lo, hi;
+
+    aabb() : lo(make_vec3(INFINITY, INFINITY, INFINITY)), hi(make_vec3(-INFINITY, -INFINITY, -INFINITY)) {}
+
+    void grow(vec3 p)
+    {
+        lo = make_vec3(std::min(lo.x, p.x), std::min(lo.y, p.y), std::min(lo.z, p.z));
+        hi = make_vec3(std::max(hi.x, p.x), std::max(hi.y, p.y), std::max(hi.z, p.z));
+    }
+    void grow(const aabb &box)
+    {
+        grow(box.lo);
+        grow(box.hi);
+    }
+    vec3 center() const { return (lo + hi) * 0.5f; }
+};
+
+struct triangle
+{
+    vec3 p[3];
+};
+
+struct instance
+{
+    unsigned blas;
+    vec3 translation;
+};
+
+struct camera
+{
+    vec3 eye, target;
+    float fov_y;    // degrees
+};
+
+struct scene
+{
+    std::string name;
+    std::vector<std::vector<triangle> > blases;
+    std::vector<instance> instances;
+    camera view;
+};
+
+// Fixed generator so every run writes the same bundles
+struct lcg
+{
+    uint32_t state;
+
+    explicit lcg(uint32_t seed) : state(seed) {}
+
+    float next()
+    {
+        state = state * 1664525u + 1013904223u;
+        return (state >> 8) * (1.0f / (1 << 24));
+    }
+    float range(float lo, float hi) { return lo + (hi - lo) * next(); }
+};
+
+
+// Acceleration structure building
+
+static void put_u32(uint8_t *p, uint32_t v) { memcpy(p, &v, sizeof(v)); }
+static void put_u64(uint8_t *p, uint64_t v) { memcpy(p, &v, sizeof(v)); }
+static void put_float(uint8_t *p, float v) { memcpy(p, &v, sizeof(v)); }
+static void put_vec3(uint8_t *p, vec3 v) { memcpy(p, &v, sizeof(v)); }
+
+// One child of an internal node: a triangle or instance leaf, or a subtree
+struct bvh_item
+{
+    aabb bounds;
+    unsigned index;     // triangle or instance
+};
+
+class bvh_writer
+{
+public:
+    bvh_writer(unsigned leaf_type, unsigned leaf_slots) : m_leaf_type(leaf_type), m_leaf_slots(leaf_slots) {}
+
+    // Lays the structure out from slot 0: the GEN_RT_BVH header, then the root
+    // node, and every node's children in one contiguous block after it.
+    // Returns the slot of every leaf, by item index.
+    std::vector<unsigned> build(std::vector<bvh_item> items)
+    {
+        assert(!items.empty());
+        m_slots = 2;
+        m_bytes.assign(m_slots * SLOT_SIZE, 0);
+        m_leaf_slot.assign(items.size(), 0);
+
+        aabb world;
+        for (auto &item : items)
+            world.grow(item.bounds);
+
+        uint8_t *header = &m_bytes[0];
+        put_u64(header, SLOT_SIZE);     // RootNodeOffset
+        put_vec3(header + 8, world.lo);
+        put_vec3(header + 20, world.hi);
+
+        write_node(1, items);
+        return m_leaf_slot;
+    }
+
+    std::vector<uint8_t> &bytes() { return m_bytes; }
+
+private:
+    unsigned allocate(unsigned slots)
+    {
+        unsigned slot = m_slots;
+        m_slots += slots;
+        m_bytes.resize(m_slots * SLOT_SIZE, 0);
+        return slot;
+    }
+
+    // Median splits along the longest centroid axis, until there are six
+    // groups or every group is a single leaf
+    static std::vector<std::vector<bvh_item> > partition(std::vector<bvh_item> &items)
+    {
+        std::vector<std::vector<bvh_item> > groups(1, items);
+        while (groups.size() < MAX_CHILDREN)
+        {
+            unsigned largest = 0;
+            for (unsigned i = 1; i < groups.size(); i++)
+                if (groups[i].size() > groups[largest].size())
+                    largest = i;
+            if (groups[largest].size() < 2)
+                break;
+
+            std::vector<bvh_item> &group = groups[largest];
+            aabb centers;
+            for (auto &item : group)
+                centers.grow(item.bounds.center());
+            vec3 extent = centers.hi - centers.lo;
+            int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : extent.y >= extent.z ? 1 : 2;
+
+            size_t half = group.size() / 2;
+            std::nth_element(group.begin(), group.begin() + half, group.end(),
+                             [axis](const bvh_item &a, const bvh_item &b)
+                             {
+                                 float ca = component(a.bounds.center(), axis);
+                                 float cb = component(b.bounds.center(), axis);
+                                 return ca < cb || (ca == cb && a.index < b.index);
+                             });
+            std::vector<bvh_item> upper(group.begin() + half, group.end());
+            group.resize(half);
+            groups.push_back(upper);
+        }
+        return groups;
+    }
+
+    void write_node(unsigned slot, std::vector<bvh_item> &items)
+    {
+        std::vector<std::vector<bvh_item> > groups = partition(items);
+
+        std::vector<aabb> child_bounds(groups.size());
+        unsigned block_slots = 0;
+        for (unsigned i = 0; i < groups.size(); i++)
+        {
+            for (auto &item : groups[i])
+                child_bounds[i].grow(item.bounds);
+            block_slots += groups[i].size() == 1 ? m_leaf_slots : 1;
+        }
+        unsigned block = allocate(block_slots);
+
+        aabb node_bounds;
+        for (auto &bounds : child_bounds)
+            node_bounds.grow(bounds);
+
+        // GEN_RT_BVH_INTERNAL_NODE
+        uint8_t *node = &m_bytes[slot * SLOT_SIZE];
+        put_vec3(node, node_bounds.lo);                 // Origin
+        put_u32(node + 12, block - slot);               // ChildOffset, in slots
+        node[16] = NODE_TYPE_INTERNAL;                  // NodeType
+        node[21] = 0xff;                                // NodeRayMask
+
+        int exponent[3];
+        for (int axis = 0; axis < 3; axis++)
+            exponent[axis] = bounds_exponent(component(node_bounds.hi, axis) - component(node_bounds.lo, axis));
+        for (int axis = 0; axis < 3; axis++)
+            node[18 + axis] = (uint8_t)(int8_t)exponent[axis];  // ChildBoundsExponentX/Y/Z
+
+        unsigned child_slot = block;
+        for (unsigned i = 0; i < groups.size(); i++)
+        {
+            bool leaf = groups[i].size() == 1;
+            unsigned size = leaf ? m_leaf_slots : 1;
+            node[22 + i] = size | (leaf ? m_leaf_type : NODE_TYPE_INTERNAL) << 2;  // ChildSize, ChildType
+
+            for (int axis = 0; axis < 3; axis++)
+            {
+                uint8_t lo, hi;
+                quantize(component(node_bounds.lo, axis), exponent[axis],
+                         component(child_bounds[i].lo, axis), component(child_bounds[i].hi, axis), &lo, &hi);
+                node[28 + 12 * axis + i] = lo;          // ChildLower?Bound
+                node[34 + 12 * axis + i] = hi;          // ChildUpper?Bound
+            }
+
+            if (leaf)
+                m_leaf_slot[groups[i][0].index] = child_slot;
+            child_slot += size;
+        }
+
+        // Last, allocating the subtrees moves m_bytes
+        child_slot = block;
+        for (auto &group : groups)
+        {
+            if (group.size() > 1)
+                write_node(child_slot, group);
+            child_slot += group.size() == 1 ? m_leaf_slots : 1;
+        }
+    }
+
+    // Child bounds are origin + q * 2^(exponent - 8) with 8-bit q, pick the
+    // smallest exponent that spans the node
+    static int bounds_exponent(float extent)
+    {
+        if (extent <= 0)
+            return -100;
+        int exponent = (int)ceilf(log2f(extent / 255.0f)) + 8;
+        while (ldexpf(255.0f, exponent - 8) < extent)
+            exponent++;
+        return exponent;
+    }
+
+    // Rounds outwards, in the same float arithmetic set_child_bounds decodes with
+    static void quantize(float origin, int exponent, float lo, float hi, uint8_t *q_lo, uint8_t *q_hi)
+    {
+        float scale = ldexpf(1.0f, exponent - 8);
+        int qlo = std::max(0, std::min(255, (int)floorf((lo - origin) / scale)));
+        int qhi = std::max(0, std::min(255, (int)ceilf((hi - origin) / scale)));
+        while (qlo > 0 && origin + (float)qlo * scale > lo)
+            qlo--;
+        while (qhi < 255 && origin + (float)qhi * scale < hi)
+            qhi++;
+        assert(origin + (float)qlo * scale <= lo && origin + (float)qhi * scale >= hi);
+        *q_lo = qlo;
+        *q_hi = qhi;
+    }
+
+    unsigned m_leaf_type;
+    unsigned m_leaf_slots;
+    unsigned m_slots;
+    std::vector<uint8_t> m_bytes;
+    std::vector<unsigned> m_leaf_slot;
+};
+
+// One triangle per GEN_RT_BVH_QUAD_LEAF, the simulator does not pair them
+static std::vector<uint8_t> build_blas(const std::vector<triangle> &triangles)
+{
+    std::vector<bvh_item> items(triangles.size());
+    for (unsigned i = 0; i < triangles.size(); i++)
+    {
+        for (int v = 0; v < 3; v++)
+            items[i].bounds.grow(triangles[i].p[v]);
+        items[i].index = i;
+    }
+
+    bvh_writer writer(NODE_TYPE_QUAD, 1);
+    std::vector<unsigned> leaves = writer.build(items);
+    std::vector<uint8_t> &bytes = writer.bytes();
+    for (unsigned i = 0; i < triangles.size(); i++)
+    {
+        uint8_t *leaf = &bytes[leaves[i] * SLOT_SIZE];
+        leaf[3] = 0xff;                                 // GeometryRayMask
+        put_u32(leaf + 4, 1u << 30);                    // GeometryIndex 0, LeafType quad, GeometryFlags opaque
+        put_u32(leaf + 8, i);                           // PrimitiveIndex0
+        put_u32(leaf + 12, 1u << 19 | 2u << 21);        // PrimitiveIndex1Delta 0, j0 0, j1 1, j2 2
+        for (int v = 0; v < 3; v++)
+            put_vec3(leaf + 16 + 12 * v, triangles[i].p[v]);
+        put_vec3(leaf + 52, triangles[i].p[2]);         // unused fourth vertex
+    }
+    return bytes;
+}
+
+// The TLAS followed by every BLAS. Returns the BLAS offsets from the TLAS.
+static std::vector<uint64_t> build_acceleration_structure(const scene &s, std::vector<uint8_t> &bytes)
+{
+    std::vector<std::vector<uint8_t> > blases;
+    std::vector<aabb> blas_bounds;
+    for (auto &triangles : s.blases)
+    {
+        blases.push_back(build_blas(triangles));
+        aabb bounds;
+        for (auto &t : triangles)
+            for (int v = 0; v < 3; v++)
+                bounds.grow(t.p[v]);
+        blas_bounds.push_back(bounds);
+    }
+
+    std::vector<bvh_item> items(s.instances.size());
+    for (unsigned i = 0; i < s.instances.size(); i++)
+    {
+        const aabb &bounds = blas_bounds[s.instances[i].blas];
+        items[i].bounds.grow(bounds.lo + s.instances[i].translation);
+        items[i].bounds.grow(bounds.hi + s.instances[i].translation);
+        items[i].index = i;
+    }
+
+    bvh_writer writer(NODE_TYPE_INSTANCE, 2);
+    std::vector<unsigned> leaves = writer.build(items);
+    bytes = writer.bytes();
+
+    std::vector<uint64_t> blas_offsets;
+    for (auto &blas : blases)
+    {
+        blas_offsets.push_back(bytes.size());
+        bytes.insert(bytes.end(), blas.begin(), blas.end());
+    }
+
+    // GEN_RT_BVH_INSTANCE_LEAF, translation only
+    for (unsigned i = 0; i < s.instances.size(); i++)
+    {
+        uint64_t leaf_offset = (uint64_t)leaves[i] * SLOT_SIZE;
+        uint8_t *leaf = &bytes[leaf_offset];
+        uint64_t blas_offset = blas_offsets[s.instances[i].blas] - leaf_offset;
+        vec3 t = s.instances[i].translation;
+
+        leaf[3] = 0xff;                                 // GeometryRayMask
+        leaf[7] = 1 << 6;                               // LeafType culling enabled, GeometryFlags opaque
+        put_u64(leaf + 8, (blas_offset + SLOT_SIZE) & ((1ull << 48) - 1)); // StartNodeAddress, 48 bits
+        leaf[14] = 0;                                   // InstanceFlags
+        leaf[15] = 0;
+        for (int row = 0; row < 3; row++)
+        {
+            put_float(leaf + 16 + 16 * row, 1.0f);      // WorldToObject diagonal
+            put_float(leaf + 80 + 16 * row, 1.0f);      // ObjectToWorld diagonal
+        }
+        put_vec3(leaf + 52, t);                         // ObjectToWorld translation
+        put_u64(leaf + 64, blas_offset);                // BVHAddress, from the leaf
+        put_u32(leaf + 72, i);                          // InstanceID
+        put_u32(leaf + 76, i);                          // InstanceIndex
+        put_vec3(leaf + 116, t * -1.0f);                // WorldToObject translation
+    }
+    return blas_offsets;
+}
+
+
+// Canonical scenes
+
+static vec3 sphere_point(int ring, int segment, int rings, int segments)
+{
+    float theta = (float)M_PI * ring / rings;
+    float phi = 2.0f * (float)M_PI * segment / segments;
+    return make_vec3(sinf(theta) * cosf(phi), cosf(theta), sinf(theta) * sinf(phi));
+}
+
+// 8x8 instances of one UV sphere: a TLAS over many instances of a small BLAS,
+// with misses between the spheres
+static scene sphere_grid()
+{
+    scene s;
+    s.name = "sphere_grid";
+
+    const int rings = 12, segments = 24;
+    std::vector<triangle> sphere;
+    for (int ring = 0; ring < rings; ring++)
+    {
+        for (int segment = 0; segment < segments; segment++)
+        {
+            vec3 a = sphere_point(ring, segment, rings, segments);
+            vec3 b = sphere_point(ring, segment + 1, rings, segments);
+            vec3 c = sphere_point(ring + 1, segment, rings, segments);
+            vec3 d = sphere_point(ring + 1, segment + 1, rings, segments);
+            // The rings at the poles have one point, only emit the triangle that is not degenerate
+            if (ring != 0)
+                sphere.push_back({{a, b, d}});
+            if (ring != rings - 1)
+                sphere.push_back({{a, d, c}});
+        }
+    }
+    s.blases.push_back(sphere);
+
+    for (int i = 0; i < 8; i++)
+    {
+        for (int j = 0; j < 8; j++)
+        {
+            instance inst = {0, make_vec3((i - 3.5f) * 2.5f, 0.0f, (j - 3.5f) * 2.5f)};
+            s.instances.push_back(inst);
+        }
+    }
+
+    s.view.eye = make_vec3(0.0f, 9.0f, 16.0f);
+    s.view.target = make_vec3(0.0f, 0.0f, 0.0f);
+    s.view.fov_y = 45.0f;
+    return s;
+}
+
+// One height field: a single deep BLAS seen at a grazing angle, sky above the horizon
+static scene terrain()
+{
+    scene s;
+    s.name = "terrain";
+
+    const int cells = 64;
+    const float size = 20.0f;
+    std::vector<vec3> points;
+    for (int i = 0; i <= cells; i++)
+    {
+        for (int j = 0; j <= cells; j++)
+        {
+            float x = size * ((float)j / cells - 0.5f);
+            float z = size * ((float)i / cells - 0.5f);
+            float y = 1.2f * sinf(0.6f * x) * cosf(0.45f * z) + 0.4f * sinf(1.7f * x + 0.8f * z);
+            points.push_back(make_vec3(x, y, z));
+        }
+    }
+
+    std::vector<triangle> field;
+    for (int i = 0; i < cells; i++)
+    {
+        for (int j = 0; j < cells; j++)
+        {
+            vec3 a = points[i * (cells + 1) + j];
+            vec3 b = points[i * (cells + 1) + j + 1];
+            vec3 c = points[(i + 1) * (cells + 1) + j];
+            vec3 d = points[(i + 1) * (cells + 1) + j + 1];
+            field.push_back({{a, c, b}});
+            field.push_back({{b, c, d}});
+        }
+    }
+    s.blases.push_back(field);
+    s.instances.push_back({0, make_vec3(0.0f, 0.0f, 0.0f)});
+
+    s.view.eye = make_vec3(0.0f, 7.0f, 13.0f);
+    s.view.target = make_vec3(0.0f, 0.0f, -2.0f);
+    s.view.fov_y = 50.0f;
+    return s;
+}
+
+// Small triangles at random positions and orientations: overlapping child
+// boxes and little coherence between neighbouring rays
+static scene triangle_soup()
+{
+    scene s;
+    s.name = "triangle_soup";
+
+    lcg rng(12345);
+    std::vector<triangle> soup;
+    for (int i = 0; i < 4096; i++)
+    {
+        vec3 center = make_vec3(rng.range(-6.0f, 6.0f), rng.range(-6.0f, 6.0f), rng.range(-6.0f, 6.0f));
+        triangle t;
+        for (int v = 0; v < 3; v++)
+            t.p[v] = center + make_vec3(rng.range(-0.5f, 0.5f), rng.range(-0.5f, 0.5f), rng.range(-0.5f, 0.5f));
+        soup.push_back(t);
+    }
+    s.blases.push_back(soup);
+    s.instances.push_back({0, make_vec3(0.0f, 0.0f, 0.0f)});
+
+    s.view.eye = make_vec3(0.0f, 0.0f, 16.0f);
+    s.view.target = make_vec3(0.0f, 0.0f, 0.0f);
+    s.view.fov_y = 50.0f;
+    return s;
+}
+
+typedef scene (*scene_builder)();
+
+static const struct
+{
+    const char *name;
+    scene_builder build;
+} canonical_scenes[] = {
+    {"sphere_grid", sphere_grid},
+    {"terrain", terrain},
+    {"triangle_soup", triangle_soup},
+};
+
+
+// Shaders
+//
+// Written the way the Mesa backend emits them: one .reg per line, and the ray
+// tracing intrinsics only take registers or plain integers, which is all
+// scripts/generate_rt_ptxinfo.py can rewrite for ptxas. Rays are opaque, so
+// there are no any-hit calls. The hit and miss shaders leave an RGBA colour in
+// the payload buffer for the raygen shader to store.
+
+static const char *raygen_ptx = R"(.version 6.4
+.target sm_75
+.address_size 64
+
+.entry MESA_SHADER_RAYGEN_func0_main ()
+{
+	.reg .u32 %launch_x;
+	.reg .u32 %launch_y;
+	.reg .u32 %launch_z;
+	.reg .u32 %size_x;
+	.reg .u32 %size_y;
+	.reg .u32 %size_z;
+	.reg .f32 %pixel_x;
+	.reg .f32 %pixel_y;
+	.reg .f32 %width;
+	.reg .f32 %height;
+	.reg .f32 %u;
+	.reg .f32 %v;
+	.reg .b64 %camera;
+	.reg .f32 %eye_x;
+	.reg .f32 %eye_y;
+	.reg .f32 %eye_z;
+	.reg .f32 %forward_x;
+	.reg .f32 %forward_y;
+	.reg .f32 %forward_z;
+	.reg .f32 %right_x;
+	.reg .f32 %right_y;
+	.reg .f32 %right_z;
+	.reg .f32 %up_x;
+	.reg .f32 %up_y;
+	.reg .f32 %up_z;
+	.reg .f32 %dir_x;
+	.reg .f32 %dir_y;
+	.reg .f32 %dir_z;
+	.reg .u32 %ray_flags;
+	.reg .u32 %cull_mask;
+	.reg .u32 %sbt_offset;
+	.reg .u32 %sbt_stride;
+	.reg .u32 %miss_index;
+	.reg .f32 %t_min;
+	.reg .f32 %t_max;
+	.reg .b64 %tlas;
+	.reg .pred %missed;
+	.reg .b64 %payload;
+	.reg .u32 %pixel;
+	.reg .b64 %offset;
+	.reg .b64 %hit_value;
+	.reg .f32 %red;
+	.reg .f32 %green;
+	.reg .f32 %blue;
+	.reg .f32 %alpha;
+	.reg .u32 %zero;
+	.reg .b64 %image;
+
+	load_ray_launch_id %launch_x, %launch_y, %launch_z;
+	load_ray_launch_size %size_x, %size_y, %size_z;
+
+	// Pinhole camera, u right and v up, both in [-1, 1]
+	cvt.rn.f32.u32 %pixel_x, %launch_x;
+	cvt.rn.f32.u32 %pixel_y, %launch_y;
+	cvt.rn.f32.u32 %width, %size_x;
+	cvt.rn.f32.u32 %height, %size_y;
+	add.f32 %pixel_x, %pixel_x, 0f3F000000;
+	add.f32 %pixel_y, %pixel_y, 0f3F000000;
+	div.rn.f32 %u, %pixel_x, %width;
+	div.rn.f32 %v, %pixel_y, %height;
+	fma.rn.f32 %u, %u, 0f40000000, 0fBF800000;
+	fma.rn.f32 %v, %v, 0fC0000000, 0f3F800000;
+
+	// Camera: eye, forward, right and up, 16 bytes apart. Right and up are
+	// scaled to the field of view.
+	load_vulkan_descriptor %camera, 0, 3;
+	ld.global.f32 %eye_x, [%camera];
+	ld.global.f32 %eye_y, [%camera+4];
+	ld.global.f32 %eye_z, [%camera+8];
+	ld.global.f32 %forward_x, [%camera+16];
+	ld.global.f32 %forward_y, [%camera+20];
+	ld.global.f32 %forward_z, [%camera+24];
+	ld.global.f32 %right_x, [%camera+32];
+	ld.global.f32 %right_y, [%camera+36];
+	ld.global.f32 %right_z, [%camera+40];
+	ld.global.f32 %up_x, [%camera+48];
+	ld.global.f32 %up_y, [%camera+52];
+	ld.global.f32 %up_z, [%camera+56];
+	fma.rn.f32 %dir_x, %u, %right_x, %forward_x;
+	fma.rn.f32 %dir_y, %u, %right_y, %forward_y;
+	fma.rn.f32 %dir_z, %u, %right_z, %forward_z;
+	fma.rn.f32 %dir_x, %v, %up_x, %dir_x;
+	fma.rn.f32 %dir_y, %v, %up_y, %dir_y;
+	fma.rn.f32 %dir_z, %v, %up_z, %dir_z;
+
+	// gl_RayFlagsOpaqueEXT
+	mov.u32 %ray_flags, 1;
+	mov.u32 %cull_mask, 255;
+	mov.u32 %sbt_offset, 0;
+	mov.u32 %sbt_stride, 1;
+	mov.u32 %miss_index, 0;
+	mov.f32 %t_min, 0f3A83126F;
+	mov.f32 %t_max, 0f7149F2CA;
+	load_vulkan_descriptor %tlas, 0, 0;
+	trace_ray %tlas, %ray_flags, %cull_mask, %sbt_offset, %sbt_stride, %miss_index, %eye_x, %eye_y, %eye_z, %t_min, %dir_x, %dir_y, %dir_z, %t_max;
+	hit_geometry %missed;
+	@%missed bra $L_miss;
+	call_closest_hit_shader;
+	bra.uni $L_shaded;
+$L_miss:
+	call_miss_shader;
+$L_shaded:
+	end_trace_ray;
+
+	load_vulkan_descriptor %payload, 0, 2;
+	mad.lo.u32 %pixel, %launch_y, %size_x, %launch_x;
+	mul.wide.u32 %offset, %pixel, 16;
+	add.u64 %hit_value, %payload, %offset;
+	ld.global.f32 %red, [%hit_value];
+	ld.global.f32 %green, [%hit_value+4];
+	ld.global.f32 %blue, [%hit_value+8];
+	ld.global.f32 %alpha, [%hit_value+12];
+	mov.u32 %zero, 0;
+	load_vulkan_descriptor %image, 0, 1;
+	image_deref_store %image, %launch_x, %launch_y, %zero, %zero, %zero, %red, %green, %blue, %alpha;
+	ret;
+}
+)";
+
+static const char *miss_ptx = R"(.version 6.4
+.target sm_75
+.address_size 64
+
+.entry MESA_SHADER_MISS_func1_main ()
+{
+	.reg .u32 %launch_x;
+	.reg .u32 %launch_y;
+	.reg .u32 %launch_z;
+	.reg .u32 %size_x;
+	.reg .u32 %size_y;
+	.reg .u32 %size_z;
+	.reg .f32 %row;
+	.reg .f32 %height;
+	.reg .f32 %v;
+	.reg .f32 %red;
+	.reg .f32 %green;
+	.reg .f32 %blue;
+	.reg .f32 %alpha;
+	.reg .b64 %payload;
+	.reg .u32 %pixel;
+	.reg .b64 %offset;
+	.reg .b64 %hit_value;
+
+	load_ray_launch_id %launch_x, %launch_y, %launch_z;
+	load_ray_launch_size %size_x, %size_y, %size_z;
+
+	// Sky gradient, lighter towards the bottom of the image
+	cvt.rn.f32.u32 %row, %launch_y;
+	cvt.rn.f32.u32 %height, %size_y;
+	div.rn.f32 %v, %row, %height;
+	fma.rn.f32 %red, %v, 0f3E99999A, 0f3E99999A;
+	fma.rn.f32 %green, %v, 0f3E99999A, 0f3F000000;
+	mov.f32 %blue, 0f3F666666;
+	mov.f32 %alpha, 0f3F800000;
+
+	load_vulkan_descriptor %payload, 0, 2;
+	mad.lo.u32 %pixel, %launch_y, %size_x, %launch_x;
+	mul.wide.u32 %offset, %pixel, 16;
+	add.u64 %hit_value, %payload, %offset;
+	st.global.f32 [%hit_value], %red;
+	st.global.f32 [%hit_value+4], %green;
+	st.global.f32 [%hit_value+8], %blue;
+	st.global.f32 [%hit_value+12], %alpha;
+	ret;
+}
+)";
+
+static const char *closest_hit_ptx = R"(.version 6.4
+.target sm_75
+.address_size 64
+
+.entry MESA_SHADER_CLOSEST_HIT_func2_main ()
+{
+	.reg .u32 %launch_x;
+	.reg .u32 %launch_y;
+	.reg .u32 %launch_z;
+	.reg .u32 %size_x;
+	.reg .u32 %size_y;
+	.reg .u32 %size_z;
+	.reg .u32 %primitive;
+	.reg .u32 %instance;
+	.reg .u32 %hash;
+	.reg .u32 %byte;
+	.reg .f32 %t_hit;
+	.reg .f32 %fog;
+	.reg .f32 %shade;
+	.reg .f32 %red;
+	.reg .f32 %green;
+	.reg .f32 %blue;
+	.reg .f32 %alpha;
+	.reg .b64 %payload;
+	.reg .u32 %pixel;
+	.reg .b64 %offset;
+	.reg .b64 %hit_value;
+
+	load_ray_launch_id %launch_x, %launch_y, %launch_z;
+	load_ray_launch_size %size_x, %size_y, %size_z;
+	load_primitive_id %primitive;
+	load_ray_instance_custom_index %instance;
+	load_ray_t_max %t_hit;
+
+	// A flat colour per primitive and instance, darkened with distance
+	mad.lo.u32 %hash, %instance, 0x85EBCA6B, %primitive;
+	mul.lo.u32 %hash, %hash, 0x9E3779B1;
+	fma.rn.f32 %fog, %t_hit, 0f3D4CCCCD, 0f3F800000;
+	rcp.rn.f32 %fog, %fog;
+	mul.f32 %shade, %fog, 0f3B808081;
+
+	shr.u32 %byte, %hash, 24;
+	cvt.rn.f32.u32 %red, %byte;
+	fma.rn.f32 %red, %red, 0f3F400000, 0f42800000;
+	mul.f32 %red, %red, %shade;
+	shr.u32 %byte, %hash, 16;
+	and.b32 %byte, %byte, 255;
+	cvt.rn.f32.u32 %green, %byte;
+	fma.rn.f32 %green, %green, 0f3F400000, 0f42800000;
+	mul.f32 %green, %green, %shade;
+	shr.u32 %byte, %hash, 8;
+	and.b32 %byte, %byte, 255;
+	cvt.rn.f32.u32 %blue, %byte;
+	fma.rn.f32 %blue, %blue, 0f3F400000, 0f42800000;
+	mul.f32 %blue, %blue, %shade;
+	mov.f32 %alpha, 0f3F800000;
+
+	load_vulkan_descriptor %payload, 0, 2;
+	mad.lo.u32 %pixel, %launch_y, %size_x, %launch_x;
+	mul.wide.u32 %offset, %pixel, 16;
+	add.u64 %hit_value, %payload, %offset;
+	st.global.f32 [%hit_value], %red;
+	st.global.f32 [%hit_value+4], %green;
+	st.global.f32 [%hit_value+8], %blue;
+	st.global.f32 [%hit_value+12], %alpha;
+	ret;
+}
+)";
+
+
+// Bundle files
+
+static void write_file(const std::string &path, const void *data, size_t size)
+{
+    FILE *fp = fopen(path.c_str(), "wb");
+    if (!fp || fwrite(data, 1, size, fp) != size)
+    {
+        fprintf(stderr, "make_scenes: cannot write %s\n", path.c_str());
+        exit(1);
+    }
+    fclose(fp);
+}
+
+static void write_text(const std::string &path, const std::string &text)
+{
+    write_file(path, text.data(), text.size());
+}
+
+static std::string format(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+static std::string format(const char *fmt, ...)
+{
+    char buffer[256];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(buffer, sizeof(buffer), fmt, args);
+    va_end(args);
+    return buffer;
+}
+
+// Shader ID of every record, at the start of each SBT_RECORD_SIZE record
+static void write_sbt(const std::string &path, const std::vector<uint32_t> &shader_ids)
+{
+    std::vector<uint8_t> sbt(SBT_SIZE, 0);
+    for (unsigned i = 0; i < shader_ids.size(); i++)
+        put_u32(&sbt[i * SBT_RECORD_SIZE], shader_ids[i]);
+    write_file(path, sbt.data(), sbt.size());
+}
+
+static void write_bundle(const scene &s, const std::string &scenes_dir, uint32_t width, uint32_t height)
+{
+    std::string dir = scenes_dir + "/" + s.name + "/";
+    mkdir(dir.c_str(), 0755);
+
+    // Buffer file names carry their size, drop the ones of an earlier resolution
+    if (DIR *existing = opendir(dir.c_str()))
+    {
+        while (struct dirent *entry = readdir(existing))
+        {
+            std::string name = entry->d_name;
+            if (name.size() > 19 && name.compare(name.size() - 19, 19, ".vkdescrptorsetdata") == 0)
+                unlink((dir + name).c_str());
+        }
+        closedir(existing);
+    }
+
+    std::vector<uint8_t> as;
+    std::vector<uint64_t> blas_offsets = build_acceleration_structure(s, as);
+    write_file(dir + "0_0.asmain", as.data(), as.size());
+    write_text(dir + "0_0.asmetadata", format("%zu,%u,0,0,0,0,0,0,0,0", as.size(), DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE));
+    std::string blas_list;
+    for (uint64_t offset : blas_offsets)
+        blas_list += format("%llu\n", (unsigned long long)offset);
+    write_text(dir + "0_0.asblas", blas_list);
+
+    write_text(dir + "0_1.vkstorageimagemetadata",
+               format("%u,%u,%u,%u,1,1,%u,%u,%u", width, height, FORMAT_R8G8B8A8_UNORM, DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                      IMAGE_TILING_LINEAR, ISL_TILING_LINEAR, width * 4));
+
+    std::vector<uint8_t> payload((size_t)width * height * PAYLOAD_SIZE, 0);
+    write_file(dir + format("0_%u_%zu_%u.vkdescrptorsetdata", BINDING_PAYLOAD, payload.size(), DESCRIPTOR_TYPE_STORAGE_BUFFER),
+               payload.data(), payload.size());
+
+    vec3 forward = normalize(s.view.target - s.view.eye);
+    vec3 right = normalize(cross(forward, make_vec3(0.0f, 1.0f, 0.0f)));
+    vec3 up = cross(right, forward);
+    float tan_half_fov = tanf(s.view.fov_y * (float)M_PI / 360.0f);
+    vec3 basis[4] = {s.view.eye, forward, right * (tan_half_fov * width / height), up * tan_half_fov};
+    uint8_t camera[4 * 4 * sizeof(float)] = {0};
+    for (int i = 0; i < 4; i++)
+        put_vec3(camera + 16 * i, basis[i]);
+    write_file(dir + format("0_%u_%zu_%u.vkdescrptorsetdata", BINDING_CAMERA, sizeof(camera), DESCRIPTOR_TYPE_UNIFORM_BUFFER),
+               camera, sizeof(camera));
+
+    // Shader IDs are the file name suffixes, in registration order
+    write_text(dir + "MESA_SHADER_RAYGEN_0.ptx", raygen_ptx);
+    write_text(dir + "MESA_SHADER_MISS_1.ptx", miss_ptx);
+    write_text(dir + "MESA_SHADER_CLOSEST_HIT_2.ptx", closest_hit_ptx);
+    write_text(dir + "shaders.list", format("MESA_SHADER_RAYGEN_0.ptx,%u\nMESA_SHADER_MISS_1.ptx,%u\nMESA_SHADER_CLOSEST_HIT_2.ptx,%u\n",
+                                            STAGE_RAYGEN, STAGE_MISS, STAGE_CLOSEST_HIT));
+    write_sbt(dir + "0.raygensbt", std::vector<uint32_t>(1, 0));
+    write_sbt(dir + "0.misssbt", std::vector<uint32_t>(1, 1));
+    write_sbt(dir + "0.hitsbt", std::vector<uint32_t>(1, 2));
+    write_sbt(dir + "0.callablesbt", std::vector<uint32_t>());
+
+    write_text(dir + "0.callparams", format("0,%u,%u,1,0", width, height));
+
+    size_t triangles = 0;
+    for (auto &blas : s.blases)
+        triangles += blas.size();
+    printf("make_scenes: %s, %zu triangles in %zu BLAS, %zu instances, %zu byte acceleration structure, %ux%u\n",
+           s.name.c_str(), triangles, s.blases.size(), s.instances.size(), as.size(), width, height);
+}
+
+
+static void usage(FILE *fp, const char *argv0)
+{
+    fprintf(fp, "usage: %s -o <scenes dir> [-r <width>x<height>] [scene ...]\n"
+                "       %s --list\n"
+                "  -o, --output      directory the scene bundles are written under, one subdirectory each\n"
+                "  -r, --resolution  launch size and storage image size, 128x128 by default\n"
+                "  -l, --list        print the canonical scene names and exit\n"
+                "  -h, --help        print this message\n"
+                "Without scene names every canonical scene is written.\n", argv0, argv0);
+}
+
+// Matches a short or long option, taking its value from the next argument
+// or from --long=value
+static bool option_value(int argc, char **argv, int &i, const char *short_name, const char *long_name,
+                         const char *&value, bool &missing)
+{
+    const char *arg = argv[i];
+    size_t long_length = strlen(long_name);
+    if (!strncmp(arg, long_name, long_length) && arg[long_length] == '=')
+    {
+        value = arg + long_length + 1;
+        return true;
+    }
+    if (strcmp(arg, short_name) && strcmp(arg, long_name))
+        return false;
+    if (i + 1 < argc)
+        value = argv[++i];
+    else
+        missing = true;
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    const unsigned num_canonical = sizeof(canonical_scenes) / sizeof(canonical_scenes[0]);
+
+    std::string scenes_dir;
+    uint32_t width = 128, height = 128;
+    std::vector<std::string> names;
+    bool options_done = false;
+    for (int i = 1; i < argc; i++)
+    {
+        const char *option = argv[i];
+        const char *value = NULL;
+        bool missing = false;
+        if (options_done || argv[i][0] != '-' || argv[i][1] == '\0')
+            names.push_back(argv[i]);
+        else if (!strcmp(argv[i], "--"))
+            options_done = true;
+        else if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help"))
+        {
+            usage(stdout, argv[0]);
+            return 0;
+        }
+        else if (!strcmp(argv[i], "-l") || !strcmp(argv[i], "--list"))
+        {
+            for (unsigned j = 0; j < num_canonical; j++)
+                printf("%s\n", canonical_scenes[j].name);
+            return 0;
+        }
+        else if (option_value(argc, argv, i, "-o", "--output", value, missing))
+        {
+            if (missing || value[0] == '\0')
+            {
+                fprintf(stderr, "make_scenes: %s needs a directory\n", option);
+                return 1;
+            }
+            scenes_dir = value;
+        }
+        else if (option_value(argc, argv, i, "-r", "--resolution", value, missing))
+        {
+            char trailing;
+            if (missing || sscanf(value, "%ux%u%c", &width, &height, &trailing) != 2 || width == 0 || height == 0)
+            {
+                fprintf(stderr, "make_scenes: %s needs <width>x<height>, e.g. 128x128\n", option);
+                return 1;
+            }
+        }
+        else
+        {
+            fprintf(stderr, "make_scenes: unknown option %s\n", argv[i]);
+            usage(stderr, argv[0]);
+            return 1;
+        }
+    }
+    if (scenes_dir.empty())
+    {
+        fprintf(stderr, "make_scenes: no output directory, pass -o <scenes dir>\n");
+        usage(stderr, argv[0]);
+        return 1;
+    }
+
+    // Check every name before writing anything
+    std::vector<unsigned> selected;
+    for (auto &name : names)
+    {
+        unsigned i = 0;
+        while (i < num_canonical && name != canonical_scenes[i].name)
+            i++;
+        if (i == num_canonical)
+        {
+            fprintf(stderr, "make_scenes: no canonical scene %s, the scenes are", name.c_str());
+            for (unsigned j = 0; j < num_canonical; j++)
+                fprintf(stderr, " %s", canonical_scenes[j].name);
+            fprintf(stderr, "\n");
+            return 1;
+        }
+        selected.push_back(i);
+    }
+    if (selected.empty())
+    {
+        for (unsigned i = 0; i < num_canonical; i++)
+            selected.push_back(i);
+    }
+
+    if (mkdir(scenes_dir.c_str(), 0755) != 0 && errno != EEXIST)
+    {
+        fprintf(stderr, "make_scenes: cannot create %s: %s\n", scenes_dir.c_str(), strerror(errno));
+        return 1;
+    }
+    for (unsigned i : selected)
+        write_bundle(canonical_scenes[i].build(), scenes_dir, width, height);
+    return 0;
+}
@@ -0,0 +1,471 @@
+// Copyright (c) 2022, Mohammadreza Saed, Yuan Hsi Chou, Lufei Liu, Tor M. Aamodt,
+// The University of British Columbia
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+// Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution. Neither the name of
+// The University of British Columbia nor the names of its contributors may be
+// used to endorse or promote products derived from this software without
+// specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+// Offline ray tracing replay driver.
+//
+// Replays a scene bundle dumped by a Mesa run with VULKAN_SIM_DUMP_TRACE=1
+// (see scenes/README.md) through the simulator, without Vulkan, Mesa or a GPU
+// driver. The bundle holds every descriptor the launch reads, the acceleration
+// structure, the shaders and the shader binding tables of one vkCmdTraceRaysKHR.
+//
+// The simulator is opened with dlopen rather than linked, so building the
+// driver needs neither the simulator nor the Mesa tree it is compiled against.
+//
+// Usage: rt_replay <bundle dir> [-o <output dir>] [-s <simulator library>]
+//   -o  write the storage images the launch produced as <set>_<desc>.rawimage
+//   -s  the simulator, by default libcudart.so next to this executable
+
+#include <assert.h>
+#include <dirent.h>
+#include <dlfcn.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "gpgpusim_launcher_api.h"
+
+#define SBT_SIZE (64 * sizeof(uint64_t))
+
+// Image surfaces are tiled in up to 32 row high tiles
+#define IMAGE_ROW_ALIGN 32
+
+struct storage_image_output
+{
+    uint32_t setID;
+    uint32_t descID;
+    void *address;
+    uint64_t size;
+};
+
+// The launcher entry points, resolved from the simulator library
+struct simulator_api
+{
+    decltype(&gpgpusim_setExternalLauncher) setExternalLauncher;
+    decltype(&gpgpusim_allocDeviceMemory) allocDeviceMemory;
+    decltype(&gpgpusim_copyToDevice) copyToDevice;
+    decltype(&gpgpusim_registerShader) registerShader;
+    decltype(&gpgpusim_setDescriptorSetFromLauncher) setDescriptorSetFromLauncher;
+    decltype(&gpgpusim_setStorageImageFromLauncher) setStorageImageFromLauncher;
+    decltype(&gpgpusim_setTextureFromLauncher) setTextureFromLauncher;
+    decltype(&gpgpusim_allocBLAS) allocBLAS;
+    decltype(&gpgpusim_allocTLAS) allocTLAS;
+    decltype(&gpgpusim_vkCmdTraceRaysKHR) vkCmdTraceRaysKHR;
+};
+
+static std::string bundle_dir;
+static std::vector<storage_image_output> storage_images;
+static simulator_api sim;
+
+
+static bool read_file(const std::string &path, std::vector<uint8_t> &data)
+{
+    FILE *fp = fopen(path.c_str(), "rb");
+    if (!fp)
+        return false;
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    data.resize(size);
+    size_t result = size ? fread(data.data(), 1, size, fp) : 0;
+    fclose(fp);
+    return result == (size_t)size;
+}
+
+static bool read_text(const std::string &path, std::string &text)
+{
+    std::vector<uint8_t> data;
+    if (!read_file(path, data))
+        return false;
+    text.assign(data.begin(), data.end());
+    return true;
+}
+
+static std::vector<uint8_t> must_read_file(const std::string &path)
+{
+    std::vector<uint8_t> data;
+    if (!read_file(path, data))
+    {
+        fprintf(stderr, "rt_replay: cannot read %s\n", path.c_str());
+        exit(1);
+    }
+    return data;
+}
+
+static std::string must_read_text(const std::string &path)
+{
+    std::string text;
+    if (!read_text(path, text))
+    {
+        fprintf(stderr, "rt_replay: cannot read %s\n", path.c_str());
+        exit(1);
+    }
+    return text;
+}
+
+static bool ends_with(const std::string &str, const std::string &suffix)
+{
+    return str.size() >= suffix.size() && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// libcudart.so in the directory of this executable, where make rt_replay puts both
+static std::string default_simulator_path()
+{
+    char path[4096];
+    ssize_t length = readlink("/proc/self/exe", path, sizeof(path) - 1);
+    if (length <= 0)
+        return "libcudart.so";
+    path[length] = '\0';
+    std::string exe = path;
+    return exe.substr(0, exe.rfind('/') + 1) + "libcudart.so";
+}
+
+template <class Function>
+static void resolve(void *library, const char *name, Function &function)
+{
+    function = (Function)dlsym(library, name);
+    if (!function)
+    {
+        fprintf(stderr, "rt_replay: the simulator does not export %s\n", name);
+        exit(1);
+    }
+}
+
+static void load_simulator(const std::string &path)
+{
+    void *library = dlopen(path.c_str(), RTLD_NOW);
+    if (!library)
+    {
+        fprintf(stderr, "rt_replay: cannot load the simulator: %s\n", dlerror());
+        exit(1);
+    }
+    resolve(library, "gpgpusim_setExternalLauncher", sim.setExternalLauncher);
+    resolve(library, "gpgpusim_allocDeviceMemory", sim.allocDeviceMemory);
+    resolve(library, "gpgpusim_copyToDevice", sim.copyToDevice);
+    resolve(library, "gpgpusim_registerShader", sim.registerShader);
+    resolve(library, "gpgpusim_setDescriptorSetFromLauncher", sim.setDescriptorSetFromLauncher);
+    resolve(library, "gpgpusim_setStorageImageFromLauncher", sim.setStorageImageFromLauncher);
+    resolve(library, "gpgpusim_setTextureFromLauncher", sim.setTextureFromLauncher);
+    resolve(library, "gpgpusim_allocBLAS", sim.allocBLAS);
+    resolve(library, "gpgpusim_allocTLAS", sim.allocTLAS);
+    resolve(library, "gpgpusim_vkCmdTraceRaysKHR", sim.vkCmdTraceRaysKHR);
+}
+
+static void *upload(const void *data, uint64_t size)
+{
+    void *deviceAddress = sim.allocDeviceMemory(size);
+    sim.copyToDevice(deviceAddress, data, size);
+    return deviceAddress;
+}
+
+
+// <set>_<desc>_<size>_<type>.vkdescrptorsetdata: plain buffers
+static void load_buffer(const std::string &name)
+{
+    uint32_t setID, descID, size, typeNum;
+    if (sscanf(name.c_str(), "%u_%u_%u_%u", &setID, &descID, &size, &typeNum) != 4)
+        return;
+
+    std::vector<uint8_t> data = must_read_file(bundle_dir + name);
+    assert(data.size() == size);
+
+    // Host copy has to stay alive for the whole launch
+    void *address = malloc(size);
+    memcpy(address, data.data(), size);
+    sim.setDescriptorSetFromLauncher(address, upload(address, size), setID, descID);
+    printf("rt_replay: buffer %u_%u, %u bytes\n", setID, descID, size);
+}
+
+// <set>_<desc>.asmain/.asback/.asfront/.asmetadata/.asblas: acceleration structure.
+// Rebuilt as one contiguous allocation, laid out the same as the dumping run
+// relative to the top level root, so every BLAS keeps its offset from the TLAS.
+static void load_acceleration_structure(const std::string &name)
+{
+    uint32_t setID, descID;
+    if (sscanf(name.c_str(), "%u_%u", &setID, &descID) != 2)
+        return;
+    std::string base = bundle_dir + std::to_string(setID) + "_" + std::to_string(descID);
+
+    uint32_t desc_size, typeNum;
+    long long max_backwards, min_backwards, min_forwards, max_forwards, back_buffer_amount, front_buffer_amount;
+    int haveBackwards, haveForwards;
+    std::string metadata = must_read_text(base + ".asmetadata");
+    if (sscanf(metadata.c_str(), "%u,%u,%lld,%lld,%lld,%lld,%lld,%lld,%d,%d", &desc_size, &typeNum,
+               &max_backwards, &min_backwards, &min_forwards, &max_forwards,
+               &back_buffer_amount, &front_buffer_amount, &haveBackwards, &haveForwards) != 10)
+    {
+        fprintf(stderr, "rt_replay: malformed %s.asmetadata\n", base.c_str());
+        exit(1);
+    }
+
+    std::vector<uint8_t> main_part = must_read_file(base + ".asmain");
+    std::vector<uint8_t> back_part, front_part;
+    if (haveBackwards)
+        back_part = must_read_file(base + ".asback");
+    if (haveForwards)
+        front_part = must_read_file(base + ".asfront");
+
+    // Byte range covered by the structure, relative to the TLAS root
+    int64_t lo = haveBackwards ? max_backwards : 0;
+    int64_t hi = main_part.size();
+    if (haveForwards && min_forwards + (int64_t)front_part.size() > hi)
+        hi = min_forwards + front_part.size();
+    if (haveBackwards && max_backwards + (int64_t)back_part.size() > hi)
+        hi = max_backwards + back_part.size();
+
+    uint64_t total_size = hi - lo;
+    uint8_t *host = (uint8_t *)calloc(total_size, 1);
+    uint8_t *tlas = host - lo;
+    if (haveBackwards)
+        memcpy(tlas + max_backwards, back_part.data(), back_part.size());
+    if (haveForwards)
+        memcpy(tlas + min_forwards, front_part.data(), front_part.size());
+    memcpy(tlas, main_part.data(), main_part.size());
+
+    uint8_t *device = (uint8_t *)upload(host, total_size);
+    uint8_t *device_tlas = device - lo;
+
+    sim.setDescriptorSetFromLauncher(tlas, device_tlas, setID, descID);
+    sim.allocTLAS(tlas, main_part.size(), device_tlas);
+
+    std::string blas_list;
+    unsigned num_blas = 0;
+    if (read_text(base + ".asblas", blas_list))
+    {
+        const char *cursor = blas_list.c_str();
+        long long offset;
+        int consumed;
+        while (sscanf(cursor, "%lld%n", &offset, &consumed) == 1)
+        {
+            sim.allocBLAS(tlas + offset, 0, device_tlas + offset);
+            cursor += consumed;
+            num_blas++;
+        }
+    }
+    else
+    {
+        fprintf(stderr, "rt_replay: %s.asblas missing, bundle was dumped by an older simulator\n", base.c_str());
+        exit(1);
+    }
+
+    printf("rt_replay: acceleration structure %u_%u, %llu bytes, %u BLAS\n", setID, descID,
+           (unsigned long long)total_size, num_blas);
+}
+
+// <set>_<desc>.vktexturedata/.vktexturemetadata: sampled textures
+static void load_texture(const std::string &name)
+{
+    uint32_t setID, descID;
+    if (sscanf(name.c_str(), "%u_%u", &setID, &descID) != 2)
+        return;
+    std::string base = bundle_dir + std::to_string(setID) + "_" + std::to_string(descID);
+
+    uint32_t size, width, height, format, typeNum, n_planes, n_samples, tiling, isl_tiling_mode, row_pitch_B, filter;
+    std::string metadata = must_read_text(base + ".vktexturemetadata");
+    if (sscanf(metadata.c_str(), "%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u", &size, &width, &height, &format, &typeNum,
+               &n_planes, &n_samples, &tiling, &isl_tiling_mode, &row_pitch_B, &filter) != 11)
+    {
+        fprintf(stderr, "rt_replay: malformed %s.vktexturemetadata\n", base.c_str());
+        exit(1);
+    }
+
+    std::vector<uint8_t> data = must_read_file(base + ".vktexturedata");
+    void *address = malloc(data.size());
+    memcpy(address, data.data(), data.size());
+    sim.setTextureFromLauncher(address, upload(address, data.size()), setID, descID, size, width, height, format,
+                                    typeNum, n_planes, n_samples, tiling, isl_tiling_mode, row_pitch_B, filter);
+    printf("rt_replay: texture %u_%u, %ux%u\n", setID, descID, width, height);
+}
+
+// <set>_<desc>.vkstorageimagemetadata: render targets, only the layout is dumped
+static void load_storage_image(const std::string &name)
+{
+    uint32_t setID, descID;
+    if (sscanf(name.c_str(), "%u_%u", &setID, &descID) != 2)
+        return;
+    std::string base = bundle_dir + std::to_string(setID) + "_" + std::to_string(descID);
+
+    uint32_t width, height, format, typeNum, n_planes, n_samples, tiling, isl_tiling_mode, row_pitch_B;
+    std::string metadata = must_read_text(base + ".vkstorageimagemetadata");
+    if (sscanf(metadata.c_str(), "%u,%u,%u,%u,%u,%u,%u,%u,%u", &width, &height, &format, &typeNum,
+               &n_planes, &n_samples, &tiling, &isl_tiling_mode, &row_pitch_B) != 9)
+    {
+        fprintf(stderr, "rt_replay: malformed %s.vkstorageimagemetadata\n", base.c_str());
+        exit(1);
+    }
+
+    uint64_t size = (uint64_t)row_pitch_B * ((height + IMAGE_ROW_ALIGN - 1) / IMAGE_ROW_ALIGN * IMAGE_ROW_ALIGN);
+    void *address = calloc(size, 1);
+    void *deviceAddress = sim.allocDeviceMemory(size);
+    sim.setStorageImageFromLauncher(address, deviceAddress, setID, descID, width, height, format, typeNum,
+                                         n_planes, n_samples, tiling, isl_tiling_mode, row_pitch_B);
+
+    storage_image_output output = {setID, descID, address, size};
+    storage_images.push_back(output);
+    printf("rt_replay: storage image %u_%u, %ux%u\n", setID, descID, width, height);
+}
+
+// shaders.list: one "<ptx file>,<gl_shader_stage>" per line, in registration order
+static void register_shaders()
+{
+    std::string list = must_read_text(bundle_dir + "shaders.list");
+    size_t start = 0;
+    while (start < list.size())
+    {
+        size_t end = list.find('\n', start);
+        if (end == std::string::npos)
+            end = list.size();
+        std::string line = list.substr(start, end - start);
+        start = end + 1;
+
+        size_t comma = line.find(',');
+        if (comma == std::string::npos)
+            continue;
+        std::string path = bundle_dir + line.substr(0, comma);
+        uint32_t stage = strtoul(line.c_str() + comma + 1, NULL, 10);
+        sim.registerShader((char *)path.c_str(), stage);
+    }
+}
+
+static void *load_sbt(const char *extension)
+{
+    std::vector<uint8_t> data;
+    if (!read_file(bundle_dir + "0" + extension, data))
+        return NULL;
+    void *sbt = calloc(SBT_SIZE, 1);
+    memcpy(sbt, data.data(), data.size() < SBT_SIZE ? data.size() : SBT_SIZE);
+    return sbt;
+}
+
+static void write_storage_images(const std::string &output_dir)
+{
+    for (auto &image : storage_images)
+    {
+        std::string path = output_dir + "/" + std::to_string(image.setID) + "_" + std::to_string(image.descID) + ".rawimage";
+        FILE *fp = fopen(path.c_str(), "wb");
+        if (!fp)
+        {
+            fprintf(stderr, "rt_replay: cannot write %s\n", path.c_str());
+            continue;
+        }
+        fwrite(image.address, 1, image.size, fp);
+        fclose(fp);
+        printf("rt_replay: wrote %s\n", path.c_str());
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+    std::string output_dir;
+    std::string simulator_path = default_simulator_path();
+    bool usage_error = false;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-o") && i + 1 < argc)
+            output_dir = argv[++i];
+        else if (!strcmp(argv[i], "-s") && i + 1 < argc)
+            simulator_path = argv[++i];
+        else if (bundle_dir.empty())
+            bundle_dir = argv[i];
+        else
+            usage_error = true;
+    }
+    if (bundle_dir.empty() || usage_error)
+    {
+        fprintf(stderr, "usage: %s <bundle dir> [-o <output dir>] [-s <simulator library>]\n", argv[0]);
+        return 1;
+    }
+    if (!ends_with(bundle_dir, "/"))
+        bundle_dir += "/";
+
+    DIR *dir = opendir(bundle_dir.c_str());
+    if (!dir)
+    {
+        fprintf(stderr, "rt_replay: cannot open %s\n", bundle_dir.c_str());
+        return 1;
+    }
+    std::vector<std::string> names;
+    while (struct dirent *entry = readdir(dir))
+        names.push_back(entry->d_name);
+    closedir(dir);
+
+    load_simulator(simulator_path);
+
+    // Device memory lives in the simulator from here on
+    sim.setExternalLauncher(true);
+
+    for (auto &name : names)
+    {
+        if (ends_with(name, ".vkdescrptorsetdata"))
+            load_buffer(name);
+        else if (ends_with(name, ".asmetadata"))
+            load_acceleration_structure(name);
+        else if (ends_with(name, ".vktexturemetadata"))
+            load_texture(name);
+        else if (ends_with(name, ".vkstorageimagemetadata"))
+            load_storage_image(name);
+    }
+
+    register_shaders();
+
+    uint32_t is_indirect, launch_width, launch_height, launch_depth;
+    unsigned long long launch_size_addr;
+    std::string callparams = must_read_text(bundle_dir + "0.callparams");
+    if (sscanf(callparams.c_str(), "%u,%u,%u,%u,%llu", &is_indirect, &launch_width, &launch_height,
+               &launch_depth, &launch_size_addr) != 5)
+    {
+        fprintf(stderr, "rt_replay: malformed 0.callparams\n");
+        return 1;
+    }
+    // The launch size of an indirect trace lives in a buffer of the dumping process
+    if (is_indirect)
+    {
+        fprintf(stderr, "rt_replay: indirect launches cannot be replayed\n");
+        return 1;
+    }
+
+    void *raygen_sbt = load_sbt(".raygensbt");
+    void *miss_sbt = load_sbt(".misssbt");
+    void *hit_sbt = load_sbt(".hitsbt");
+    void *callable_sbt = load_sbt(".callablesbt");
+
+    printf("rt_replay: launching %ux%ux%u\n", launch_width, launch_height, launch_depth);
+    sim.vkCmdTraceRaysKHR(raygen_sbt, miss_sbt, hit_sbt, callable_sbt, false,
+                               launch_width, launch_height, launch_depth, 0);
+
+    if (!output_dir.empty())
+        write_storage_images(output_dir);
+
+    return 0;
+}
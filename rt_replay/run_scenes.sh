@@ -0,0 +1,115 @@
+#!/bin/bash
+
+# Replays every bundle in rt_replay/scenes against one configuration and
+# collects cycle counts and ray tracing statistics into a CSV, one row per scene.
+# The canonical scenes are generated by make_scenes the first time they are
+# needed, so a fresh checkout always has something to replay.
+#
+# With --check, every replayed scene's status and statistics are compared
+# against the row of the same scene in a reference CSV written earlier by this
+# script (wall_seconds is ignored), and the script fails on any difference.
+#
+# Usage: run_scenes.sh [--check <reference csv>] <config dir> <output csv> [scene ...]
+
+REFERENCE_CSV=""
+if [ "$1" == "--check" ]; then
+    if [ $# -lt 2 ] || [ ! -f "$2" ]; then
+        echo "--check needs an existing reference CSV"
+        exit 1
+    fi
+    REFERENCE_CSV=$(realpath "$2")
+    shift 2
+fi
+
+if [ $# -lt 2 ]; then
+    echo "usage: $0 [--check <reference csv>] <config dir> <output csv> [scene ...]"
+    exit 1
+fi
+
+if [ -z "$GPGPUSIM_ROOT" ] || [ -z "$SIM_LIB_DIR" ]; then
+    echo "GPGPUSIM_ROOT and SIM_LIB_DIR are not set, source setup_environment first"
+    exit 1
+fi
+
+CONFIG_DIR=$(realpath "$1")
+OUTPUT_CSV=$(realpath "$2")
+shift 2
+
+REPLAY=$GPGPUSIM_ROOT/$SIM_LIB_DIR/rt_replay
+MAKE_SCENES=$GPGPUSIM_ROOT/$SIM_LIB_DIR/make_scenes
+SIMULATOR=$GPGPUSIM_ROOT/$SIM_LIB_DIR/libcudart.so
+SCENE_DIR=$GPGPUSIM_ROOT/rt_replay/scenes
+CANONICAL_SCENES="sphere_grid terrain triangle_soup"
+STATS="gpu_tot_sim_cycle gpu_tot_sim_insn gpu_tot_ipc rt_n_total_rays rt_avg_nodes_per_ray rt_max_tree_depth"
+
+if [ ! -x "$REPLAY" ] || [ ! -x "$MAKE_SCENES" ]; then
+    echo "$REPLAY or $MAKE_SCENES not found, run make rt_replay first"
+    exit 1
+fi
+if [ ! -f "$SIMULATOR" ]; then
+    echo "$SIMULATOR not found, build the simulator first"
+    exit 1
+fi
+
+MISSING=""
+for SCENE in $CANONICAL_SCENES; do
+    if [ ! -f "$SCENE_DIR/$SCENE/shaders.list" ]; then
+        MISSING="$MISSING $SCENE"
+    fi
+done
+if [ -n "$MISSING" ]; then
+    "$MAKE_SCENES" -o "$SCENE_DIR" $MISSING || exit 1
+fi
+
+if [ $# -gt 0 ]; then
+    SCENES="$@"
+else
+    SCENES=$(ls -d $SCENE_DIR/*/ 2>/dev/null | xargs -n1 basename)
+fi
+
+echo "scene,status,wall_seconds,${STATS// /,}" > "$OUTPUT_CSV"
+
+for SCENE in $SCENES; do
+    RUN_DIR=$(mktemp -d)
+    cp -r "$CONFIG_DIR"/* "$RUN_DIR"
+
+    START=$(date +%s.%N)
+    (cd "$RUN_DIR" && "$REPLAY" "$SCENE_DIR/$SCENE" -o "$RUN_DIR" -s "$SIMULATOR" > "$RUN_DIR/replay.log" 2>&1)
+    STATUS=$?
+    END=$(date +%s.%N)
+
+    ROW="$SCENE,$STATUS,$(awk "BEGIN { print $END - $START }")"
+    for STAT in $STATS; do
+        VALUE=$(grep "^$STAT = " "$RUN_DIR/replay.log" | tail -1 | awk '{print $3}')
+        ROW="$ROW,$VALUE"
+    done
+    echo "$ROW" >> "$OUTPUT_CSV"
+    echo "$ROW"
+
+    if [ $STATUS -ne 0 ]; then
+        echo "$SCENE failed, log kept in $RUN_DIR/replay.log"
+    else
+        rm -rf "$RUN_DIR"
+    fi
+done
+
+if [ -n "$REFERENCE_CSV" ]; then
+    # Columns: scene, status, wall_seconds, statistics...
+    awk -F, '
+        NR == FNR { if (FNR == 1) split($0, header, ","); else reference[$1] = $0; next }
+        FNR == 1 { next }
+        {
+            if (!($1 in reference)) { print $1 ": not in the reference"; failed = 1; next }
+            n = split(reference[$1], expected, ",")
+            for (i = 2; i <= n || i <= NF; i++) {
+                if (i == 3) continue
+                if ($i != expected[i]) { print $1 ": " header[i] " is " $i ", reference " expected[i]; failed = 1 }
+            }
+        }
+        END { exit failed }' "$REFERENCE_CSV" "$OUTPUT_CSV"
+    if [ $? -ne 0 ]; then
+        echo "statistics differ from $REFERENCE_CSV"
+        exit 1
+    fi
+    echo "statistics match $REFERENCE_CSV"
+fi
@@ -0,0 +1,110 @@
+# Copyright (c) 2022, Mohammadreza Saed, Yuan Hsi Chou, Lufei Liu, Tor M. Aamodt,
+# The University of British Columbia
+# All rights reserved.
+
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+
+# Redistributions of source code must retain the above copyright notice, this
+# list of conditions and the following disclaimer.
+# Redistributions in binary form must reproduce the above copyright notice,
+# this list of conditions and the following disclaimer in the documentation
+# and/or other materials provided with the distribution. Neither the name of
+# The University of British Columbia nor the names of its contributors may be
+# used to endorse or promote products derived from this software without
+# specific prior written permission.
+
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+# AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+# IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+# ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+# LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+# CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+# SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+# INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+# CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+# ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+# POSSIBILITY OF SUCH DAMAGE.
+
+
+
+# Usage
+# python3 rt_trace_reader.py <file>.rtt [max rows]
+# Prints the rows of a trace written by -rt_trace_dir as CSV.
+# Import it and use read_trace() to get the columns as lists instead.
+
+import struct
+import sys
+import zlib
+
+RAW = 0
+DELTA = 1
+
+
+def read_str(f):
+    (length,) = struct.unpack("<I", f.read(4))
+    return f.read(length).decode()
+
+
+def decode_varints(data, count, pos):
+    values = []
+    for _ in range(count):
+        value = 0
+        shift = 0
+        while True:
+            byte = data[pos]
+            pos += 1
+            value |= (byte & 0x7f) << shift
+            shift += 7
+            if byte < 0x80:
+                break
+        values.append(value)
+    return values, pos
+
+
+def read_trace(path):
+    """Returns (stream name, column names, list of columns)"""
+    with open(path, "rb") as f:
+        if f.read(8) != b"GPGPURTT":
+            raise ValueError(path + " is not an RT trace")
+        (version,) = struct.unpack("<I", f.read(4))
+        if version != 1:
+            raise ValueError("unsupported RT trace version %d" % version)
+        stream = read_str(f)
+        (ncols,) = struct.unpack("<I", f.read(4))
+        encodings = []
+        names = []
+        for _ in range(ncols):
+            (encoding,) = struct.unpack("<I", f.read(4))
+            encodings.append(encoding)
+            names.append(read_str(f))
+
+        columns = [[] for _ in range(ncols)]
+        while True:
+            header = f.read(16)
+            if len(header) < 16:
+                break
+            magic, rows, raw_bytes, zbytes = struct.unpack("<4sIII", header)
+            if magic != b"RTCK":
+                raise ValueError("corrupt chunk in " + path)
+            data = zlib.decompress(f.read(zbytes))
+            assert len(data) == raw_bytes
+            pos = 0
+            for col in range(ncols):
+                values, pos = decode_varints(data, rows, pos)
+                if encodings[col] == DELTA:
+                    prev = 0
+                    for i, zigzag in enumerate(values):
+                        prev = (prev + ((zigzag >> 1) ^ -(zigzag & 1))) & 0xffffffffffffffff
+                        values[i] = prev
+                columns[col].extend(values)
+    return stream, names, columns
+
+
+if __name__ == "__main__":
+    stream, names, columns = read_trace(sys.argv[1])
+    limit = int(sys.argv[2]) if len(sys.argv) > 2 else None
+    print(",".join(names))
+    rows = len(columns[0]) if columns else 0
+    for row in range(rows if limit is None else min(rows, limit)):
+        print(",".join(str(column[row]) for column in columns))
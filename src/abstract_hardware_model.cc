@@ -34,10 +34,12 @@
 #include <iostream>
 #include <sstream>
 #include "../libcuda/gpgpu_context.h"
+#include "cuda-sim/checkpoint_image.h"
 #include "cuda-sim/cuda-sim.h"
 #include "cuda-sim/memory.h"
 #include "cuda-sim/ptx-stats.h"
 #include "cuda-sim/ptx_ir.h"
+#include "cuda-sim/vulkan_ray_tracing.h"
 #include "gpgpu-sim/gpu-sim.h"
 #include "gpgpusim_entrypoint.h"
 #include "option_parser.h"
@@ -127,7 +129,83 @@ checkpoint::checkpoint() {
     mkdir("checkpoint_files", 0777);
   }
 }
+bool checkpoint::s_use_image = false;
+bool checkpoint::s_compress_image = false;
+checkpoint_image_writer *checkpoint::s_image_writer = NULL;
+checkpoint_image_reader *checkpoint::s_image_reader = NULL;
+
+void checkpoint::set_image(bool enabled, bool compress) {
+  s_use_image = enabled;
+  s_compress_image = compress;
+}
+
+std::string checkpoint::section_name(const char *fname) {
+  std::string name(fname);
+  size_t slash = name.rfind('/');
+  if (slash != std::string::npos) name = name.substr(slash + 1);
+  size_t dot = name.rfind('.');
+  if (dot != std::string::npos) name = name.substr(0, dot);
+  return name;
+}
+
+checkpoint_image_writer *checkpoint::image_writer() {
+  if (!s_image_writer) {
+    s_image_writer = new checkpoint_image_writer();
+    if (!s_image_writer->open("checkpoint_files/checkpoint.img",
+                              s_compress_image)) {
+      printf("GPGPU-Sim: cannot create checkpoint_files/checkpoint.img\n");
+      abort();
+    }
+  }
+  return s_image_writer;
+}
+
+// Never closed: memory spaces restored from the image may point into it
+checkpoint_image_reader *checkpoint::image_reader() {
+  if (!s_image_reader) {
+    s_image_reader = new checkpoint_image_reader();
+    if (!s_image_reader->open("checkpoint_files/checkpoint.img")) {
+      printf("GPGPU-Sim: cannot read checkpoint_files/checkpoint.img\n");
+      abort();
+    }
+  }
+  return s_image_reader;
+}
+
+void checkpoint::store_blob(const char *fname,
+                            const std::vector<unsigned char> &data) {
+  bool ok = image_writer()->add_blob(section_name(fname), data.data(),
+                                     data.size());
+  assert(ok);
+}
+
+void checkpoint::flush_image() {
+  if (!s_image_writer) return;
+  bool ok = s_image_writer->flush();
+  assert(ok);
+}
+
+void checkpoint::load_blob(const char *fname,
+                           std::vector<unsigned char> &data) {
+  bool ok = image_reader()->load_blob(section_name(fname), data);
+  if (!ok) {
+    printf("GPGPU-Sim: checkpoint image has no section '%s'\n",
+           section_name(fname).c_str());
+    abort();
+  }
+}
+
 void checkpoint::load_global_mem(class memory_space *temp_mem, char *f1name) {
+  if (s_use_image) {
+    bool ok = image_reader()->load_memory(section_name(f1name), temp_mem);
+    if (!ok) {
+      printf("GPGPU-Sim: cannot restore '%s' from the checkpoint image\n",
+             section_name(f1name).c_str());
+      abort();
+    }
+    return;
+  }
+
   FILE *fp2 = fopen(f1name, "r");
   assert(fp2 != NULL);
   char line[128]; /* or other suitable maximum line size */
@@ -160,6 +238,12 @@ void checkpoint::load_global_mem(class memory_space *temp_mem, char *f1name) {
 
 void checkpoint::store_global_mem(class memory_space *mem, char *fname,
                                   char *format) {
+  if (s_use_image) {
+    bool ok = image_writer()->add_memory(section_name(fname), mem);
+    assert(ok);
+    return;
+  }
+
   FILE *fp3 = fopen(fname, "w");
   assert(fp3 != NULL);
   mem->print(format, fp3);
@@ -208,6 +292,14 @@ void gpgpu_functional_sim_config::reg_options(class OptionParser *opp) {
                          " resume from which CTA ", "0");
   option_parser_register(opp, "-checkpoint_insn_Y", OPT_INT32,
                          &checkpoint_insn_Y, " resume from which CTA ", "0");
+  option_parser_register(
+      opp, "-checkpoint_image", OPT_BOOL, &m_checkpoint_image,
+      "Checkpoint to / resume from one binary, memory-mapped image instead of "
+      "per-thread/warp text files",
+      "0");
+  option_parser_register(opp, "-checkpoint_image_compress", OPT_BOOL,
+                         &m_checkpoint_image_compress,
+                         "zlib compress checkpoint image blocks", "0");
 
   option_parser_register(
       opp, "-gpgpu_ptx_convert_to_ptxplus", OPT_BOOL, &m_ptx_convert_to_ptxplus,
@@ -249,6 +341,8 @@ gpgpu_t::gpgpu_t(const gpgpu_functional_sim_config &config, gpgpu_context *ctx)
   resume_CTA = m_function_model_config.get_resume_CTA();
   checkpoint_CTA_t = m_function_model_config.get_checkpoint_CTA_t();
   checkpoint_insn_Y = m_function_model_config.get_checkpoint_insn_Y();
+  checkpoint::set_image(m_function_model_config.get_checkpoint_image(),
+                        m_function_model_config.get_checkpoint_image_compress());
 
   // initialize texture mappings to empty
   m_NameToTextureInfo.clear();
@@ -929,6 +1023,47 @@ void warp_inst_t::track_rt_cycles(bool active) {
   }
 }
 
+unsigned long long warp_inst_t::rt_quiet_cycles() const {
+  unsigned long long cycles = (unsigned long long)-1;
+  for (unsigned i=0; i<m_config->warp_size; i++) {
+    const per_thread_info &thread = m_per_scalar_thread[i];
+    if (thread.intersection_delay == 0) continue;
+    if (!thread.RT_store_transactions.empty()) return 0;
+    cycles = std::min(cycles, (unsigned long long)thread.intersection_delay - 1);
+  }
+  return cycles;
+}
+
+unsigned warp_inst_t::rt_skip_cycles(unsigned long long cycles) {
+  assert(cycles <= rt_quiet_cycles());
+  unsigned warp_status = is_stalled() ? warp_stalled : warp_waiting;
+  unsigned n_threads = 0;
+  for (unsigned i=0; i<m_config->warp_size; i++) {
+    per_thread_info &thread = m_per_scalar_thread[i];
+    if (thread.intersection_delay > 0) {
+      thread.intersection_delay -= cycles;
+      n_threads++;
+    }
+    if (!thread_active(i)) continue;
+    // Same classification as track_rt_cycles()
+    if (thread.intersection_delay != 0) {
+      thread.status_num_cycles[warp_status][executing_op] += cycles;
+    }
+    else if (!thread.RT_mem_accesses.empty()) {
+      if (thread.RT_mem_accesses.front().status == RT_MEM_UNMARKED) {
+        thread.status_num_cycles[warp_status][awaiting_scheduling] += cycles;
+      }
+      else {
+        thread.status_num_cycles[warp_status][awaiting_mf] += cycles;
+      }
+    }
+    else {
+      thread.status_num_cycles[warp_status][trace_complete] += cycles;
+    }
+  }
+  return n_threads;
+}
+
 unsigned * warp_inst_t::get_latency_dist(unsigned i) {
   return (unsigned *)m_per_scalar_thread[i].status_num_cycles;
 }
@@ -955,7 +1090,7 @@ void warp_inst_t::set_rt_mem_store_transactions(unsigned int tid, std::vector<Me
   m_per_scalar_thread[tid].RT_store_transactions = transactions;
 }
 
-bool warp_inst_t::is_stalled() {
+bool warp_inst_t::is_stalled() const {
   // If there are still memory requests waiting to be processed, not stalled
   if (!m_next_rt_accesses_set.empty()) {
     return false;
@@ -979,7 +1114,7 @@ void warp_inst_t::set_rt_ray_properties(unsigned int tid, Ray ray) {
   m_per_scalar_thread[tid].ray_properties = ray;
 }
 
-bool warp_inst_t::rt_mem_accesses_empty() { 
+bool warp_inst_t::rt_mem_accesses_empty() const {
   bool empty = true;
   for (unsigned i = 0; i < m_config->warp_size; i++) {
     empty &= m_per_scalar_thread[i].RT_mem_accesses.empty();
@@ -988,7 +1123,7 @@ bool warp_inst_t::rt_mem_accesses_empty() {
   return empty;
 }
 
-void warp_inst_t::num_unique_mem_access(std::map<new_addr_type, unsigned> &addr_set) {
+void warp_inst_t::num_unique_mem_access(std::map<new_addr_type, unsigned> &addr_set) const {
   for (unsigned i = 0; i < m_config->warp_size; i++) {
     if (!m_per_scalar_thread[i].RT_mem_accesses.empty()) {
       RTMemoryTransactionRecord record = m_per_scalar_thread[i].RT_mem_accesses.front();
@@ -997,7 +1132,7 @@ void warp_inst_t::num_unique_mem_access(std::map<new_addr_type, unsigned> &addr_
   }
 }
 
-bool warp_inst_t::rt_intersection_delay_done() { 
+bool warp_inst_t::rt_intersection_delay_done() const {
   bool done = true;
   for (unsigned i = 0; i < m_config->warp_size; i++) {
     done &= (m_per_scalar_thread[i].intersection_delay == 0);
@@ -1005,7 +1140,7 @@ bool warp_inst_t::rt_intersection_delay_done() {
   return done;
 }
 
-unsigned warp_inst_t::get_rt_active_threads() {
+unsigned warp_inst_t::get_rt_active_threads() const {
   assert(m_per_scalar_thread_valid);
   unsigned active_threads = 0;
   for (auto it=m_per_scalar_thread.begin(); it!=m_per_scalar_thread.end(); it++) {
@@ -1154,14 +1289,17 @@ bool warp_inst_t::process_returned_mem_access(bool &mem_record_done, unsigned ti
         
         RT_DPRINTF("Thread %d collected all chunks for address 0x%x (size %d)\n", tid, mem_record.address, mem_record.size);
         RT_DPRINTF("Processing data of transaction type %d for %d cycles.\n", mem_record.type, n_delay_cycles);
-        m_per_scalar_thread[tid].RT_mem_accesses.pop_front();
-        mem_record_done = true;
 
         // Mark triangle hit to store to memory
         if (mem_record.type == TransactionType::BVH_QUAD_LEAF_HIT) {
           m_per_scalar_thread[tid].ray_intersect = true;
           RT_DPRINTF("Buffer store detected for warp %d thread %d\n", m_uid, tid);
         }
+
+        // mem_record refers to the log's front, which pop_front overwrites
+        m_per_scalar_thread[tid].RT_mem_accesses.pop_front();
+        m_rt_front_changed.set(tid);
+        mem_record_done = true;
       }
       thread_found = true;
     }
@@ -2806,9 +2944,43 @@ void simt_stack::launch(address_type start_pc, const simt_mask_t &active_mask) {
   m_stack.push_back(new_stack_entry);
 }
 
+// Fixed part of a SIMT stack entry in a checkpoint image, followed by one
+// byte per lane of the active mask
+struct simt_checkpoint_entry {
+  unsigned long long pc;
+  unsigned long long recvg_pc;
+  unsigned long long branch_div_cycle;
+  unsigned calldepth;
+  unsigned type;
+};
+
 void simt_stack::resume(char *fname) {
   reset();
 
+  if (checkpoint::use_image()) {
+    std::vector<unsigned char> data;
+    checkpoint::load_blob(fname, data);
+    size_t entry_size = sizeof(simt_checkpoint_entry) + m_warp_size;
+    assert(data.size() % entry_size == 0);
+    for (size_t pos = 0; pos < data.size(); pos += entry_size) {
+      simt_checkpoint_entry entry;
+      memcpy(&entry, &data[pos], sizeof(entry));
+      const unsigned char *mask = &data[pos + sizeof(entry)];
+
+      simt_stack_entry new_stack_entry;
+      for (unsigned j = 0; j < m_warp_size; j++)
+        new_stack_entry.m_active_mask.set(j, mask[j] != 0);
+      new_stack_entry.m_pc = entry.pc;
+      new_stack_entry.m_calldepth = entry.calldepth;
+      new_stack_entry.m_recvg_pc = entry.recvg_pc;
+      new_stack_entry.m_branch_div_cycle = entry.branch_div_cycle;
+      new_stack_entry.m_type =
+          entry.type ? STACK_ENTRY_TYPE_CALL : STACK_ENTRY_TYPE_NORMAL;
+      m_stack.push_back(new_stack_entry);
+    }
+    return;
+  }
+
   FILE *fp2 = fopen(fname, "r");
   assert(fp2 != NULL);
 
@@ -2903,6 +3075,33 @@ void simt_stack::print_checkpoint(FILE *fout) const {
   }
 }
 
+void simt_stack::store_checkpoint(char *fname) const {
+  if (!checkpoint::use_image()) {
+    FILE *fp = fopen(fname, "w");
+    assert(fp != NULL);
+    print_checkpoint(fp);
+    fclose(fp);
+    return;
+  }
+
+  std::vector<unsigned char> data;
+  for (unsigned k = 0; k < m_stack.size(); k++) {
+    const simt_stack_entry &stack_entry = m_stack[k];
+    simt_checkpoint_entry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.pc = stack_entry.m_pc;
+    entry.recvg_pc = stack_entry.m_recvg_pc;
+    entry.branch_div_cycle = stack_entry.m_branch_div_cycle;
+    entry.calldepth = stack_entry.m_calldepth;
+    entry.type = stack_entry.m_type;
+    data.insert(data.end(), (const unsigned char *)&entry,
+                (const unsigned char *)(&entry + 1));
+    for (unsigned j = 0; j < m_warp_size; j++)
+      data.push_back(stack_entry.m_active_mask.test(j) ? 1 : 0);
+  }
+  checkpoint::store_blob(fname, data);
+}
+
 void simt_stack::update(simt_mask_t &thread_done, addr_vector_t &next_pc,
                         address_type recvg_pc, op_type next_inst_op,
                         unsigned next_inst_size, address_type next_inst_pc, bool predicated) {
@@ -3050,16 +3249,35 @@ void simt_stack::update(simt_mask_t &thread_done, addr_vector_t &next_pc,
 }
 
 void core_t::execute_warp_inst_t(warp_inst_t &inst, unsigned warpId) {
+  // With -rt_trace_threads, trace_ray only queues each lane's BVH walk and
+  // the warp's walks run together after the last lane
+  bool batch_rays = inst.op == RT_CORE_OP && VulkanRayTracing::beginTraceRayBatch();
+
+  // Every active lane is at inst.pc, so they share one decoded instruction
+  const ptx_decoded_inst *decoded = NULL;
   for (unsigned t = 0; t < m_warp_size; t++) {
     if (inst.active(t)) {
       if (warpId == (unsigned(-1))) warpId = inst.warp_id();
       unsigned tid = m_warp_size * warpId + t;
-      m_thread[tid]->ptx_exec_inst(inst, t);
+      if (!decoded) decoded = &m_thread[tid]->get_decoded_inst(inst.pc);
+      m_thread[tid]->ptx_exec_inst(inst, t, *decoded);
 
       // virtual function
       checkExecutionStatusAndUpdate(inst, t, tid);
     }
   }
+
+  if (batch_rays) {
+    VulkanRayTracing::flushTraceRayBatch();
+    for (unsigned t = 0; t < m_warp_size; t++) {
+      if (!inst.active(t)) continue;
+      ptx_thread_info *thread = m_thread[m_warp_size * warpId + t];
+      if (thread->rt_trace_deferred()) {
+        thread->copy_rt_results(inst, t);
+        thread->set_rt_trace_deferred(false);
+      }
+    }
+  }
 }
 
 bool core_t::ptx_thread_done(unsigned hw_thread_id) const {
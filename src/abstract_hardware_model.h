@@ -811,6 +811,10 @@ class gpgpu_functional_sim_config {
   int get_resume_CTA() const { return resume_CTA; }
   int get_checkpoint_CTA_t() const { return checkpoint_CTA_t; }
   int get_checkpoint_insn_Y() const { return checkpoint_insn_Y; }
+  bool get_checkpoint_image() const { return m_checkpoint_image; }
+  bool get_checkpoint_image_compress() const {
+    return m_checkpoint_image_compress;
+  }
 
  private:
   // PTX options
@@ -826,6 +830,8 @@ class gpgpu_functional_sim_config {
   unsigned resume_CTA;
   unsigned checkpoint_CTA_t;
   int checkpoint_insn_Y;
+  bool m_checkpoint_image;
+  bool m_checkpoint_image_compress;
   int g_ptx_inst_debug_to_file;
   char *g_ptx_inst_debug_file;
   int g_ptx_inst_debug_thread_uid;
@@ -870,22 +876,14 @@ class gpgpu_t {
   unsigned splits_table_push_back = 0;
 
   // Tommy's RT Measurements
-  std::vector<unsigned long long> issue_cycles;
-  std::vector<unsigned long long> writeback_cycles;
-
   std::map<unsigned, std::map<new_addr_type, unsigned>> ray_node_tracker;
   std::map<new_addr_type, unsigned> global_ray_node_tracker;
   std::map<new_addr_type, new_addr_type> treelet_root_and_children;
 
-  std::map <new_addr_type, unsigned> treeletIDToRayIDMap;
-  std::map <new_addr_type, std::map <unsigned, unsigned>> per_treelet_difference_histogram;
-
   unsigned mshr_rt_merges = 0;
   unsigned mshr_all_merges = 0;
   std::map<new_addr_type, unsigned> block_addr_merge_tracker;
 
-  std::vector<std::map<new_addr_type, unsigned long long>> rt_address_cycle_pair;
-
   void *gpu_malloc(size_t size);
   void *gpu_mallocarray(size_t count);
   void gpu_memset(size_t dst_start_addr, int c, size_t count);
@@ -1069,6 +1067,7 @@ typedef std::bitset<SECTOR_CHUNCK_SIZE> mem_access_sector_mask_t;
     MA_TUP(INST_ACC_R), \
     MA_TUP(L1_WR_ALLOC_R), \
     MA_TUP(L2_WR_ALLOC_R), \
+    MA_TUP(L2_PREFETCH_R), \
     MA_TUP(NUM_MEM_ACCESS_TYPE) \
   MA_TUP_END(mem_access_type)
 
@@ -1400,6 +1399,8 @@ typedef struct RTMemoryTransactionRecord {
     }
 } RTMemoryTransactionRecord;
 
+#include "rt_mem_access_log.h"
+
 class warp_inst_t : public inst_t {
  public:
   // constructors
@@ -1426,6 +1427,12 @@ class warp_inst_t : public inst_t {
     if (m_per_scalar_thread_valid)
       m_per_scalar_thread.clear();
   }
+  // The destructor suppresses the implicit moves, which the RT unit relies on
+  // to pass warps around without copying every thread's transaction log
+  warp_inst_t(const warp_inst_t &other) = default;
+  warp_inst_t(warp_inst_t &&other) = default;
+  warp_inst_t &operator=(const warp_inst_t &other) = default;
+  warp_inst_t &operator=(warp_inst_t &&other) = default;
 
   // modifiers
   void broadcast_barrier_reduction(const active_mask_t &access_mask);
@@ -1586,7 +1593,7 @@ class warp_inst_t : public inst_t {
     return cycles > 0;
   }
 
-  bool has_dispatch_delay() { return cycles > 0; }
+  bool has_dispatch_delay() const { return cycles > 0; }
 
   void print(FILE *fout) const;
   unsigned get_uid() const { return m_uid; }
@@ -1610,7 +1617,7 @@ class warp_inst_t : public inst_t {
                                                        // of 4B each)
                                                    
     // RT variables    
-    std::deque<RTMemoryTransactionRecord> RT_mem_accesses;
+    rt_mem_access_log RT_mem_accesses;
     std::vector<MemoryStoreTransactionRecord> RT_store_transactions;
     bool ray_intersect = false;
     Ray ray_properties;
@@ -1629,35 +1636,47 @@ class warp_inst_t : public inst_t {
   void set_rt_ray_properties(unsigned int tid, Ray ray);
   bool get_rt_ray_intersect(unsigned int tid) const { return m_per_scalar_thread[tid].ray_intersect; }
   Ray get_rt_ray_properties(unsigned int tid) const { return m_per_scalar_thread[tid].ray_properties; }
-  bool rt_mem_accesses_empty();
-  bool rt_intersection_delay_done();
-  bool has_pending_writes() { return !m_pending_writes.empty(); }
-  bool rt_mem_accesses_empty(unsigned int tid) { return m_per_scalar_thread[tid].RT_mem_accesses.empty(); };
-  std::deque<RTMemoryTransactionRecord> get_RT_mem_accesses(unsigned int tid) { return m_per_scalar_thread[tid].RT_mem_accesses; }
-  bool is_stalled();
+  bool rt_mem_accesses_empty() const;
+  bool rt_intersection_delay_done() const;
+  bool has_pending_writes() const { return !m_pending_writes.empty(); }
+  bool rt_mem_accesses_empty(unsigned int tid) const { return m_per_scalar_thread[tid].RT_mem_accesses.empty(); };
+  const rt_mem_access_log &get_RT_mem_accesses(unsigned int tid) const { return m_per_scalar_thread[tid].RT_mem_accesses; }
+  bool is_stalled() const;
   void undo_rt_access(new_addr_type addr);
   void print_rt_accesses();
   void print_intersection_delay();
-  unsigned get_rt_active_threads();
+  unsigned get_rt_active_threads() const;
   std::deque<unsigned> get_rt_active_thread_list();
   unsigned long long get_thread_end_cycle(unsigned int tid) const { return m_per_scalar_thread[tid].end_cycle; }
   void set_thread_end_cycle(unsigned long long cycle);
   
   void update_next_rt_accesses();
   RTMemoryTransactionRecord get_next_rt_mem_transaction();
-  void num_unique_mem_access(std::map<new_addr_type, unsigned> &addr_set);
+  void num_unique_mem_access(std::map<new_addr_type, unsigned> &addr_set) const;
   unsigned process_returned_mem_access(const mem_fetch *mf);
   bool process_returned_mem_access(const mem_fetch *mf, unsigned tid);
   bool process_returned_mem_access(bool &mem_record_done, unsigned tid, new_addr_type addr, new_addr_type uncoalesced_base_addr);
   
   struct per_thread_info &get_thread_info(unsigned tid) { return m_per_scalar_thread[tid]; }
+  // Exchange the per-thread state with other, e.g. to copy the instruction
+  // without duplicating every thread's RT transaction log
+  void swap_thread_info(std::vector<per_thread_info> &other) { m_per_scalar_thread.swap(other); }
   void set_thread_info(unsigned tid, struct per_thread_info thread_info) { m_per_scalar_thread[tid] = thread_info; }
   void clear_thread_info(unsigned tid) { m_per_scalar_thread[tid].clear_mem_accesses(); }
   unsigned get_thread_latency(unsigned tid) const { return m_per_scalar_thread[tid].intersection_delay; }
   unsigned dec_thread_latency(std::deque<std::pair<unsigned, new_addr_type> > &store_queue);
   void track_rt_cycles(bool active);
+  // dec_thread_latency() calls that only count down, before a thread ends its
+  // intersection test or queues its stores; -1 if no thread is testing
+  unsigned long long rt_quiet_cycles() const;
+  // 'cycles' dec_thread_latency() and track_rt_cycles(false) calls within
+  // rt_quiet_cycles(), returns the threads testing in each
+  unsigned rt_skip_cycles(unsigned long long cycles);
   bool check_pending_writes(new_addr_type addr);
   unsigned mem_list_length(unsigned tid) const { return m_per_scalar_thread[tid].RT_mem_accesses.size(); }
+  const active_mask_t &get_rt_front_changed() const { return m_rt_front_changed; }
+  void set_rt_front_changed(unsigned tid) { m_rt_front_changed.set(tid); }
+  void clear_rt_front_changed() { m_rt_front_changed.reset(); }
   unsigned * get_latency_dist(unsigned i);
   
   void set_start_cycle(unsigned long long cycle) { m_start_cycle = cycle; }
@@ -1693,6 +1712,9 @@ class warp_inst_t : public inst_t {
   
   RTMemoryTransactionRecord m_current_rt_access;
 
+  // Threads whose next RT access changed since the RT unit last looked (for treelet popularity)
+  active_mask_t m_rt_front_changed;
+
   std::set<new_addr_type> m_pending_writes;
   
   // List of current memory requests awaiting response
@@ -1723,6 +1745,27 @@ class checkpoint {
   void load_global_mem(class memory_space *temp_mem, char *f1name);
   void store_global_mem(class memory_space *mem, char *fname, char *format);
   unsigned radnom;
+
+  // With -checkpoint_image, stores append a section named after fname's base
+  // name to one binary image (checkpoint_files/checkpoint.img) instead of
+  // writing a text file, and loads read it back from a single mapping
+  static void set_image(bool enabled, bool compress);
+  static bool use_image() { return s_use_image; }
+  static void store_blob(const char *fname,
+                         const std::vector<unsigned char> &data);
+  static void load_blob(const char *fname, std::vector<unsigned char> &data);
+  // Small blobs are buffered; call once a CTA's state has been stored
+  static void flush_image();
+
+ private:
+  static std::string section_name(const char *fname);
+  static class checkpoint_image_writer *image_writer();
+  static class checkpoint_image_reader *image_reader();
+
+  static bool s_use_image;
+  static bool s_compress_image;
+  static class checkpoint_image_writer *s_image_writer;
+  static class checkpoint_image_reader *s_image_reader;
 };
 
 
@@ -1993,6 +2036,7 @@ class simt_stack {
     // *NEW*
     void resume(char *fname);
     void print_checkpoint(FILE *fout) const;
+    void store_checkpoint(char *fname) const;
 
   protected:
     unsigned m_warp_id;
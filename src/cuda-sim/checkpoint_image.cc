@@ -0,0 +1,535 @@
+// Copyright (c) 2022, Mohammadreza Saed, Yuan Hsi Chou, Lufei Liu, Tor M. Aamodt,
+// The University of British Columbia
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+// Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution. Neither the name of
+// The University of British Columbia nor the names of its contributors may be
+// used to endorse or promote products derived from this software without
+// specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "checkpoint_image.h"
+#include "memory.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+static const char checkpoint_image_magic[8] = {'G', 'P', 'G', 'P', 'U', 'C', 'K', 'P'};
+
+static uint64_t align_up(uint64_t value, uint64_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+static bool all_zero(const uint8_t *data, uint64_t size)
+{
+    for (uint64_t i = 0; i < size; i++)
+    {
+        if (data[i])
+            return false;
+    }
+    return true;
+}
+
+static bool write_padding(FILE *fp, uint64_t bytes)
+{
+    static const uint8_t padding[CHECKPOINT_IMAGE_PAGE_SIZE] = {0};
+    while (bytes > 0)
+    {
+        size_t chunk = bytes < sizeof(padding) ? bytes : sizeof(padding);
+        if (fwrite(padding, 1, chunk, fp) != chunk)
+            return false;
+        bytes -= chunk;
+    }
+    return true;
+}
+
+
+bool checkpoint_image_writer::open(const std::string &path, bool compress)
+{
+    close();
+    unlink(path.c_str());
+    m_fp = fopen(path.c_str(), "wb");
+    m_compress = compress;
+    m_bytes = 0;
+    m_raw_bytes = 0;
+    return m_fp != NULL;
+}
+
+
+void checkpoint_image_writer::close()
+{
+    flush();
+    if (m_fp)
+        fclose(m_fp);
+    m_fp = NULL;
+    m_pack.clear();
+    m_pack_bytes = 0;
+}
+
+
+bool checkpoint_image_writer::add_memory(const std::string &name, const memory_space *mem)
+{
+    std::vector<std::pair<mem_addr_t, const unsigned char *> > mem_blocks;
+    mem->get_blocks(mem_blocks);
+
+    block_list blocks;
+    blocks.reserve(mem_blocks.size());
+    for (unsigned i = 0; i < mem_blocks.size(); i++)
+        blocks.push_back(std::make_pair((uint64_t)mem_blocks[i].first, (const uint8_t *)mem_blocks[i].second));
+    return add_section(name, CHECKPOINT_IMAGE_MEMORY, mem->block_size(), blocks);
+}
+
+
+bool checkpoint_image_writer::add_blob(const std::string &name, const void *data, size_t size)
+{
+    if (!m_fp || name.size() >= CHECKPOINT_IMAGE_NAME_SIZE)
+        return false;
+
+    if (size < CHECKPOINT_IMAGE_PAGE_SIZE)
+    {
+        const uint8_t *bytes = (const uint8_t *)data;
+        m_pack.push_back(std::make_pair(name, std::vector<uint8_t>(bytes, bytes + size)));
+        m_pack_bytes += size;
+        return m_pack_bytes < CHECKPOINT_IMAGE_PACK_SIZE || flush();
+    }
+
+    // Written ahead of the pack, so a buffered blob of the same name is older
+    for (unsigned i = 0; i < m_pack.size(); )
+    {
+        if (m_pack[i].first == name)
+        {
+            m_pack_bytes -= m_pack[i].second.size();
+            m_pack.erase(m_pack.begin() + i);
+        }
+        else
+            i++;
+    }
+    block_list blocks(1, std::make_pair((uint64_t)0, (const uint8_t *)data));
+    return add_section(name, CHECKPOINT_IMAGE_BLOB, size, blocks);
+}
+
+
+bool checkpoint_image_writer::deflate_payload(const uint8_t *data, uint64_t size, std::vector<uint8_t> &out) const
+{
+    uLongf bound = compressBound(size);
+    out.resize(bound);
+    if (compress2(out.data(), &bound, data, size, Z_BEST_SPEED) == Z_OK && bound < size)
+    {
+        out.resize(bound);
+        return true;
+    }
+    out.clear();
+    return false;
+}
+
+
+bool checkpoint_image_writer::flush()
+{
+    if (!m_fp || m_pack.empty())
+        return true;
+
+    checkpoint_image_section_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, checkpoint_image_magic, sizeof(header.magic));
+    header.version = CHECKPOINT_IMAGE_VERSION;
+    header.kind = CHECKPOINT_IMAGE_BLOB_PACK;
+    header.num_blocks = m_pack.size();
+
+    std::vector<checkpoint_image_packed_blob> index(m_pack.size());
+    std::string names;
+    uint64_t names_offset = sizeof(header) + index.size() * sizeof(checkpoint_image_packed_blob);
+    for (unsigned i = 0; i < m_pack.size(); i++)
+    {
+        memset(&index[i], 0, sizeof(index[i]));
+        index[i].name_offset = names_offset + names.size();
+        names.append(m_pack[i].first.c_str(), m_pack[i].first.size() + 1);
+    }
+    header.block_size = names.size();
+
+    std::vector<std::vector<uint8_t> > compressed(m_compress ? m_pack.size() : 0);
+    uint64_t offset = names_offset + names.size();
+    for (unsigned i = 0; i < m_pack.size(); i++)
+    {
+        checkpoint_image_packed_blob &entry = index[i];
+        const std::vector<uint8_t> &data = m_pack[i].second;
+        entry.size = data.size();
+        if (all_zero(data.data(), data.size()))
+        {
+            entry.flags = CHECKPOINT_IMAGE_ZERO;
+            continue;
+        }
+        entry.stored_size = data.size();
+        if (m_compress && deflate_payload(data.data(), data.size(), compressed[i]))
+        {
+            entry.stored_size = compressed[i].size();
+            entry.flags = CHECKPOINT_IMAGE_ZLIB;
+        }
+        entry.offset = align_up(offset, 8);
+        offset = entry.offset + entry.stored_size;
+    }
+    header.section_size = align_up(offset, CHECKPOINT_IMAGE_PAGE_SIZE);
+
+    bool ok = fwrite(&header, sizeof(header), 1, m_fp) == 1 &&
+              fwrite(index.data(), sizeof(checkpoint_image_packed_blob), index.size(), m_fp) == index.size() &&
+              fwrite(names.data(), 1, names.size(), m_fp) == names.size();
+
+    uint64_t written = names_offset + names.size();
+    for (unsigned i = 0; i < m_pack.size() && ok; i++)
+    {
+        const checkpoint_image_packed_blob &entry = index[i];
+        if (entry.flags & CHECKPOINT_IMAGE_ZERO)
+            continue;
+        ok = write_padding(m_fp, entry.offset - written);
+        const uint8_t *payload = (entry.flags & CHECKPOINT_IMAGE_ZLIB) ? compressed[i].data() : m_pack[i].second.data();
+        if (ok)
+            ok = fwrite(payload, 1, entry.stored_size, m_fp) == entry.stored_size;
+        written = entry.offset + entry.stored_size;
+        m_raw_bytes += entry.size;
+    }
+    if (ok)
+        ok = write_padding(m_fp, header.section_size - written) && fflush(m_fp) == 0;
+
+    m_bytes += header.section_size;
+    m_pack.clear();
+    m_pack_bytes = 0;
+    return ok;
+}
+
+
+bool checkpoint_image_writer::add_section(const std::string &name, uint32_t kind, uint64_t block_size, const block_list &blocks)
+{
+    if (!m_fp || name.size() >= CHECKPOINT_IMAGE_NAME_SIZE)
+        return false;
+
+    checkpoint_image_section_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, checkpoint_image_magic, sizeof(header.magic));
+    header.version = CHECKPOINT_IMAGE_VERSION;
+    header.kind = kind;
+    strncpy(header.name, name.c_str(), sizeof(header.name) - 1);
+    header.block_size = block_size;
+    header.num_blocks = blocks.size();
+
+    // Lay out the payloads first, compressed sizes are needed for the index
+    bool page_aligned = block_size > 0 && block_size % CHECKPOINT_IMAGE_PAGE_SIZE == 0;
+    std::vector<checkpoint_image_block> index(blocks.size());
+    std::vector<std::vector<uint8_t> > compressed(m_compress ? blocks.size() : 0);
+    uint64_t offset = sizeof(header) + blocks.size() * sizeof(checkpoint_image_block);
+    for (unsigned i = 0; i < blocks.size(); i++)
+    {
+        checkpoint_image_block &entry = index[i];
+        memset(&entry, 0, sizeof(entry));
+        entry.index = blocks[i].first;
+        if (block_size == 0 || all_zero(blocks[i].second, block_size))
+        {
+            entry.flags = CHECKPOINT_IMAGE_ZERO;
+            continue;
+        }
+
+        entry.stored_size = block_size;
+        if (m_compress && deflate_payload(blocks[i].second, block_size, compressed[i]))
+        {
+            entry.stored_size = compressed[i].size();
+            entry.flags = CHECKPOINT_IMAGE_ZLIB;
+        }
+
+        uint64_t alignment = (page_aligned && !(entry.flags & CHECKPOINT_IMAGE_ZLIB)) ? CHECKPOINT_IMAGE_PAGE_SIZE : 8;
+        entry.offset = align_up(offset, alignment);
+        offset = entry.offset + entry.stored_size;
+    }
+    header.section_size = align_up(offset, CHECKPOINT_IMAGE_PAGE_SIZE);
+
+    bool ok = fwrite(&header, sizeof(header), 1, m_fp) == 1;
+    if (ok && !index.empty())
+        ok = fwrite(index.data(), sizeof(checkpoint_image_block), index.size(), m_fp) == index.size();
+
+    uint64_t written = sizeof(header) + index.size() * sizeof(checkpoint_image_block);
+    for (unsigned i = 0; i < blocks.size() && ok; i++)
+    {
+        const checkpoint_image_block &entry = index[i];
+        if (entry.flags & CHECKPOINT_IMAGE_ZERO)
+            continue;
+        ok = write_padding(m_fp, entry.offset - written);
+        const uint8_t *payload = (entry.flags & CHECKPOINT_IMAGE_ZLIB) ? compressed[i].data() : blocks[i].second;
+        if (ok)
+            ok = fwrite(payload, 1, entry.stored_size, m_fp) == entry.stored_size;
+        written = entry.offset + entry.stored_size;
+        m_raw_bytes += block_size;
+    }
+    if (ok)
+        ok = write_padding(m_fp, header.section_size - written) && fflush(m_fp) == 0;
+
+    m_bytes += header.section_size;
+    return ok;
+}
+
+
+bool checkpoint_image_reader::open(const std::string &path)
+{
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(checkpoint_image_section_header))
+    {
+        ::close(fd);
+        return false;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    // Kept open to map memory sections privately on restore
+    m_fd = fd;
+    m_map = map;
+    m_map_size = st.st_size;
+
+    // Index the sections. A damaged tail (e.g. the checkpointing run died while
+    // appending) ends the walk, everything before it is still usable.
+    uint64_t offset = 0;
+    while (offset + sizeof(checkpoint_image_section_header) <= m_map_size)
+    {
+        const uint8_t *base = (const uint8_t *)m_map + offset;
+        const checkpoint_image_section_header *header = (const checkpoint_image_section_header *)base;
+        uint64_t index_end = sizeof(*header) + header->num_blocks * sizeof(checkpoint_image_block);
+
+        bool valid = memcmp(header->magic, checkpoint_image_magic, sizeof(header->magic)) == 0 &&
+                     header->version >= 1 && header->version <= CHECKPOINT_IMAGE_VERSION &&
+                     memchr(header->name, '\0', sizeof(header->name)) != NULL &&
+                     header->section_size % CHECKPOINT_IMAGE_PAGE_SIZE == 0 &&
+                     header->section_size <= m_map_size - offset;
+        if (valid && header->kind == CHECKPOINT_IMAGE_BLOB_PACK && header->version >= 2)
+        {
+            if (!index_pack(offset))
+                break;
+            offset += header->section_size;
+            continue;
+        }
+        valid = valid &&
+                (header->kind == CHECKPOINT_IMAGE_MEMORY || header->kind == CHECKPOINT_IMAGE_BLOB) &&
+                header->num_blocks <= header->section_size / sizeof(checkpoint_image_block) &&
+                index_end <= header->section_size;
+
+        const checkpoint_image_block *index = (const checkpoint_image_block *)(base + sizeof(*header));
+        for (uint64_t i = 0; i < header->num_blocks && valid; i++)
+        {
+            const checkpoint_image_block &block = index[i];
+            valid = (block.flags & CHECKPOINT_IMAGE_ZERO) ||
+                    (block.offset >= index_end && block.offset <= header->section_size &&
+                     block.stored_size <= header->section_size - block.offset &&
+                     ((block.flags & CHECKPOINT_IMAGE_ZLIB) || block.stored_size == header->block_size));
+        }
+        if (!valid)
+            break;
+
+        m_sections[std::make_pair(header->kind, std::string(header->name))] = offset;
+        if (header->kind == CHECKPOINT_IMAGE_BLOB)
+            m_blobs[header->name] = std::make_pair(offset, (int64_t)-1);
+        offset += header->section_size;
+    }
+
+    if (m_sections.empty() && m_blobs.empty())
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+
+void checkpoint_image_reader::close()
+{
+    for (unsigned i = 0; i < m_block_maps.size(); i++)
+        munmap(m_block_maps[i].first, m_block_maps[i].second);
+    m_block_maps.clear();
+    if (m_map)
+        munmap(m_map, m_map_size);
+    if (m_fd >= 0)
+        ::close(m_fd);
+    m_fd = -1;
+    m_map = NULL;
+    m_map_size = 0;
+    m_sections.clear();
+    m_blobs.clear();
+}
+
+
+// Checks a blob pack and indexes its blobs, later ones replacing earlier blobs
+// of the same name
+bool checkpoint_image_reader::index_pack(uint64_t offset)
+{
+    const uint8_t *base = (const uint8_t *)m_map + offset;
+    const checkpoint_image_section_header *header = (const checkpoint_image_section_header *)base;
+    uint64_t size = header->section_size;
+    if (header->num_blocks > size / sizeof(checkpoint_image_packed_blob))
+        return false;
+    uint64_t names = sizeof(*header) + header->num_blocks * sizeof(checkpoint_image_packed_blob);
+    if (names > size || header->block_size > size - names)
+        return false;
+    uint64_t names_end = names + header->block_size;
+
+    const checkpoint_image_packed_blob *index = (const checkpoint_image_packed_blob *)(base + sizeof(*header));
+    for (uint64_t i = 0; i < header->num_blocks; i++)
+    {
+        const checkpoint_image_packed_blob &blob = index[i];
+        if (blob.name_offset < names || blob.name_offset >= names_end ||
+            !memchr(base + blob.name_offset, '\0', names_end - blob.name_offset))
+            return false;
+        bool payload_ok = (blob.flags & CHECKPOINT_IMAGE_ZERO) ||
+                          (blob.offset >= names_end && blob.offset <= size &&
+                           blob.stored_size <= size - blob.offset &&
+                           ((blob.flags & CHECKPOINT_IMAGE_ZLIB) || blob.stored_size == blob.size));
+        if (!payload_ok)
+            return false;
+    }
+    for (uint64_t i = 0; i < header->num_blocks; i++)
+        m_blobs[(const char *)base + index[i].name_offset] = std::make_pair(offset, (int64_t)i);
+    return true;
+}
+
+
+const checkpoint_image_section_header *checkpoint_image_reader::find(const std::string &name, uint32_t kind) const
+{
+    auto it = m_sections.find(std::make_pair(kind, name));
+    if (it == m_sections.end())
+        return NULL;
+    return (const checkpoint_image_section_header *)((const uint8_t *)m_map + it->second);
+}
+
+
+static bool read_payload(const uint8_t *payload, uint64_t stored_size, uint32_t flags, uint8_t *out, uint64_t size)
+{
+    if (flags & CHECKPOINT_IMAGE_ZERO)
+    {
+        memset(out, 0, size);
+        return true;
+    }
+    if (flags & CHECKPOINT_IMAGE_ZLIB)
+    {
+        uLongf inflated = size;
+        return uncompress(out, &inflated, payload, stored_size) == Z_OK && inflated == size;
+    }
+    memcpy(out, payload, size);
+    return true;
+}
+
+
+bool checkpoint_image_reader::read_block(const checkpoint_image_section_header *section, const checkpoint_image_block &block, uint8_t *out) const
+{
+    return read_payload((const uint8_t *)section + block.offset, block.stored_size, block.flags, out, section->block_size);
+}
+
+
+bool checkpoint_image_reader::load_memory(const std::string &name, memory_space *mem)
+{
+    const checkpoint_image_section_header *section = find(name, CHECKPOINT_IMAGE_MEMORY);
+    if (!section)
+        return false;
+    if (section->block_size != mem->block_size())
+    {
+        printf("GPGPU-Sim: checkpoint image section \'%s\' has %llu byte blocks, memory space uses %u\n",
+               name.c_str(), (unsigned long long)section->block_size, mem->block_size());
+        return false;
+    }
+
+    const checkpoint_image_block *index = (const checkpoint_image_block *)(section + 1);
+
+    // Raw page-sized blocks are handed to the memory space in place, through a
+    // private writable mapping of this section
+    uint8_t *pages = NULL;
+    if (section->block_size % CHECKPOINT_IMAGE_PAGE_SIZE == 0)
+    {
+        bool any_raw = false;
+        for (uint64_t i = 0; i < section->num_blocks && !any_raw; i++)
+            any_raw = index[i].flags == 0;
+        if (any_raw)
+        {
+            off_t offset = (const uint8_t *)section - (const uint8_t *)m_map;
+            void *map = mmap(NULL, section->section_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, m_fd, offset);
+            if (map != MAP_FAILED)
+            {
+                m_block_maps.push_back(std::make_pair(map, (size_t)section->section_size));
+                pages = (uint8_t *)map;
+            }
+        }
+    }
+
+    std::vector<uint8_t> buffer;
+    for (uint64_t i = 0; i < section->num_blocks; i++)
+    {
+        const checkpoint_image_block &block = index[i];
+        if (block.flags & CHECKPOINT_IMAGE_ZERO)
+        {
+            mem->load_block(block.index, NULL);
+        }
+        else if (pages && block.flags == 0 && block.offset % CHECKPOINT_IMAGE_PAGE_SIZE == 0)
+        {
+            mem->map_block(block.index, pages + block.offset);
+        }
+        else
+        {
+            buffer.resize(section->block_size);
+            if (!read_block(section, block, buffer.data()))
+            {
+                printf("GPGPU-Sim: checkpoint image section \'%s\' block 0x%llx is damaged\n",
+                       name.c_str(), (unsigned long long)block.index);
+                return false;
+            }
+            mem->load_block(block.index, buffer.data());
+        }
+    }
+    return true;
+}
+
+
+bool checkpoint_image_reader::load_blob(const std::string &name, std::vector<uint8_t> &out) const
+{
+    auto it = m_blobs.find(name);
+    if (it == m_blobs.end())
+        return false;
+    const checkpoint_image_section_header *section =
+        (const checkpoint_image_section_header *)((const uint8_t *)m_map + it->second.first);
+
+    if (it->second.second >= 0)
+    {
+        const checkpoint_image_packed_blob &blob = ((const checkpoint_image_packed_blob *)(section + 1))[it->second.second];
+        out.resize(blob.size);
+        return blob.size == 0 ||
+               read_payload((const uint8_t *)section + blob.offset, blob.stored_size, blob.flags, out.data(), blob.size);
+    }
+
+    if (section->num_blocks != 1)
+        return false;
+    out.resize(section->block_size);
+    return section->block_size == 0 || read_block(section, *(const checkpoint_image_block *)(section + 1), out.data());
+}
@@ -0,0 +1,170 @@
+// Copyright (c) 2022, Mohammadreza Saed, Yuan Hsi Chou, Lufei Liu, Tor M. Aamodt,
+// The University of British Columbia
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+// Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution. Neither the name of
+// The University of British Columbia nor the names of its contributors may be
+// used to endorse or promote products derived from this software without
+// specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef CHECKPOINT_IMAGE_H
+#define CHECKPOINT_IMAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <map>
+#include <string>
+#include <vector>
+
+class memory_space;
+
+// Single-file binary checkpoint. The file is a sequence of self-contained,
+// page-aligned sections, each a header, a block index and the block payloads.
+// A memory section holds the allocated blocks of one memory_space, a blob
+// section holds an opaque byte string. Blobs smaller than a page (per-thread
+// registers, per-warp SIMT stacks) are buffered and written together as one
+// blob pack section, indexed by name, on flush() or once the buffer reaches
+// CHECKPOINT_IMAGE_PACK_SIZE. Sections are only ever appended, and when a
+// name shows up more than once the last one wins, so every store or flush
+// leaves a readable file behind.
+//
+// Uncompressed payloads of memory spaces whose block size is a multiple of the
+// page size are page-aligned, and are mapped straight into the memory space on
+// restore (copy-on-write, the file itself is never modified). Everything else
+// is copied or inflated out of the mapping.
+
+#define CHECKPOINT_IMAGE_VERSION 2
+#define CHECKPOINT_IMAGE_PAGE_SIZE 4096
+#define CHECKPOINT_IMAGE_NAME_SIZE 96
+#define CHECKPOINT_IMAGE_PACK_SIZE (1 << 20)
+
+enum checkpoint_image_section_kind {
+    CHECKPOINT_IMAGE_MEMORY = 0,
+    CHECKPOINT_IMAGE_BLOB,
+    CHECKPOINT_IMAGE_BLOB_PACK      // version 2
+};
+
+enum checkpoint_image_block_flags {
+    CHECKPOINT_IMAGE_ZLIB = 1,      // payload is zlib compressed
+    CHECKPOINT_IMAGE_ZERO = 2       // block is all zeros, no payload
+};
+
+typedef struct checkpoint_image_section_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t kind;
+    char name[CHECKPOINT_IMAGE_NAME_SIZE];
+    uint64_t block_size;    // memory: block size of the memory space, blob: payload size, pack: name table size
+    uint64_t num_blocks;    // pack: blobs
+    uint64_t section_size;  // header, index and payloads, a multiple of the page size
+} checkpoint_image_section_header;
+
+typedef struct checkpoint_image_block {
+    uint64_t index;         // block index in the memory space (address >> log2 block size)
+    uint64_t offset;        // of the payload, from the start of the section
+    uint64_t stored_size;   // payload bytes in the file
+    uint32_t flags;
+    uint32_t reserved;
+} checkpoint_image_block;
+
+// Blob pack index entry. The names follow the index, NUL terminated.
+typedef struct checkpoint_image_packed_blob {
+    uint64_t name_offset;   // from the start of the section
+    uint64_t offset;        // of the payload, from the start of the section
+    uint64_t size;          // blob bytes
+    uint64_t stored_size;   // payload bytes in the file
+    uint32_t flags;
+    uint32_t reserved;
+} checkpoint_image_packed_blob;
+
+class checkpoint_image_writer
+{
+public:
+    checkpoint_image_writer() : m_fp(NULL), m_compress(false), m_bytes(0), m_raw_bytes(0), m_pack_bytes(0) {}
+    ~checkpoint_image_writer() { close(); }
+
+    // Starts a new image. An existing file is unlinked rather than truncated so
+    // that a reader still mapping it (resume and checkpoint in one run) is unaffected.
+    bool open(const std::string &path, bool compress);
+    void close();
+    bool is_open() const { return m_fp != NULL; }
+
+    // Appends one section and flushes it. Blobs smaller than a page are only
+    // buffered for the next blob pack.
+    bool add_memory(const std::string &name, const memory_space *mem);
+    bool add_blob(const std::string &name, const void *data, size_t size);
+    // Writes the buffered blobs, if any, as one blob pack section
+    bool flush();
+
+    // File bytes and uncompressed block bytes written so far
+    uint64_t bytes() const { return m_bytes; }
+    uint64_t raw_bytes() const { return m_raw_bytes; }
+
+private:
+    typedef std::vector<std::pair<uint64_t, const uint8_t *> > block_list;
+    bool add_section(const std::string &name, uint32_t kind, uint64_t block_size, const block_list &blocks);
+    // Zlib compresses a payload if that makes it smaller
+    bool deflate_payload(const uint8_t *data, uint64_t size, std::vector<uint8_t> &out) const;
+
+    FILE *m_fp;
+    bool m_compress;
+    uint64_t m_bytes;
+    uint64_t m_raw_bytes;
+    std::vector<std::pair<std::string, std::vector<uint8_t> > > m_pack; // buffered small blobs, in store order
+    uint64_t m_pack_bytes;
+};
+
+class checkpoint_image_reader
+{
+public:
+    checkpoint_image_reader() : m_fd(-1), m_map(NULL), m_map_size(0) {}
+    ~checkpoint_image_reader() { close(); }
+
+    // Maps the file and indexes its sections. Returns false if it is missing or malformed.
+    bool open(const std::string &path);
+    // Only safe once no memory space holds blocks mapped by load_memory
+    void close();
+    bool is_open() const { return m_map != NULL; }
+
+    bool has_section(const std::string &name) const { return find(name, CHECKPOINT_IMAGE_MEMORY) || m_blobs.count(name); }
+
+    // Restores a memory section into mem, whose block size must match. Returns
+    // false if there is no such section. Every call maps the section anew, so
+    // spaces restored from the same section never see each other's writes.
+    bool load_memory(const std::string &name, memory_space *mem);
+    bool load_blob(const std::string &name, std::vector<uint8_t> &out) const;
+
+private:
+    const checkpoint_image_section_header *find(const std::string &name, uint32_t kind) const;
+    bool read_block(const checkpoint_image_section_header *section, const checkpoint_image_block &block, uint8_t *out) const;
+    bool index_pack(uint64_t offset);
+
+    int m_fd;
+    void *m_map;                                        // whole file, read only
+    size_t m_map_size;
+    std::vector<std::pair<void *, size_t> > m_block_maps; // private, writable section mappings handed to memory spaces
+    std::map<std::pair<uint32_t, std::string>, uint64_t> m_sections; // {kind, name} -> offset of the last such section
+    std::map<std::string, std::pair<uint64_t, int64_t> > m_blobs;     // name -> {section offset, pack entry or -1}
+};
+
+#endif /* CHECKPOINT_IMAGE_H */
@@ -1944,15 +1944,86 @@ int tensorcore_op(int inst_opcode) {
   else
     return 0;
 }
+
+// Warp level implementations take the warp_inst_t by value or by reference,
+// wrap them so they fit one function pointer type
+#define OP_DEF(OP, FUNC, STR, DST, CLASSIFICATION)
+#define OP_W_DEF(OP, FUNC, STR, DST, CLASSIFICATION)                      \
+  static void FUNC##_warp_exec(const ptx_instruction *pI, core_t *core, \
+                               warp_inst_t &inst) {                     \
+    FUNC(pI, core, inst);                                               \
+  }
+#include "opcodes.def"
+#undef OP_DEF
+#undef OP_W_DEF
+
+struct ptx_exec_table_entry {
+  ptx_exec_fn exec;
+  ptx_warp_exec_fn warp_exec;
+  int classification;
+};
+
+static const ptx_exec_table_entry ptx_exec_table[NUM_OPCODES] = {
+#define OP_DEF(OP, FUNC, STR, DST, CLASSIFICATION) {FUNC, NULL, CLASSIFICATION},
+#define OP_W_DEF(OP, FUNC, STR, DST, CLASSIFICATION) \
+  {NULL, FUNC##_warp_exec, CLASSIFICATION},
+#include "opcodes.def"
+#undef OP_DEF
+#undef OP_W_DEF
+};
+
+void function_info::decode_instructions() {
+  m_decoded_insts.assign(m_instr_mem_size, ptx_decoded_inst());
+  for (unsigned ii = 0; ii < m_n; ii += m_instr_mem[ii]->inst_size()) {
+    const ptx_instruction *pI = m_instr_mem[ii];
+    ptx_decoded_inst &d = m_decoded_insts[ii];
+    d.pI = pI;
+    d.exec = NULL;
+    d.warp_exec = NULL;
+    d.classification = 0;  // unknown opcodes report an execution error
+    if (pI->get_opcode() >= 0 && pI->get_opcode() < NUM_OPCODES) {
+      d.exec = ptx_exec_table[pI->get_opcode()].exec;
+      d.warp_exec = ptx_exec_table[pI->get_opcode()].warp_exec;
+      d.classification = ptx_exec_table[pI->get_opcode()].classification;
+    }
+    d.size = pI->inst_size();
+    d.has_pred = pI->has_pred();
+    d.pred_reg = NULL;
+    if (d.has_pred) {
+      // Same value get_operand_value(pred, pred, PRED_TYPE, thread, 0) returns
+      const operand_info &pred = pI->get_pred();
+      if (pred.get_double_operand_type() == 0 && pred.is_reg() &&
+          pred.get_operand_lohi() == 0)
+        d.pred_reg = pred.get_symbol();
+    }
+    d.warp_sync = tensorcore_op(pI->get_opcode());
+    d.is_exit = pI->is_exit();
+
+    std::vector<operand_info> &operands = m_instr_mem[ii]->m_operands;
+    for (unsigned o = 0; o < operands.size(); o++)
+      operands[o].resolve_plain_reg();
+  }
+}
+
+const ptx_decoded_inst &ptx_thread_info::get_decoded_inst(addr_t pc) {
+  return m_func_info->get_decoded_inst(pc);
+}
 void ptx_thread_info::ptx_exec_inst(warp_inst_t &inst, unsigned lane_id) {
+  ptx_exec_inst(inst, lane_id, get_decoded_inst(next_instr()));
+}
+
+void ptx_thread_info::ptx_exec_inst(warp_inst_t &inst, unsigned lane_id,
+                                    const ptx_decoded_inst &decoded) {
   bool skip = false;
   int op_classification = 0;
   addr_t pc = next_instr();
   assert(pc ==
          inst.pc);  // make sure timing model and functional model are in sync
-  const ptx_instruction *pI = m_func_info->get_instruction(pc);
+  const ptx_instruction *pI = decoded.pI;
+  assert(pI == m_func_info->get_instruction(pc));
+  m_exec_warp_inst = &inst;
 
-  set_npc(pc + pI->inst_size());
+  set_npc(pc + decoded.size);
 
   try {
     clearRPC();
@@ -1975,10 +2046,15 @@ void ptx_thread_info::ptx_exec_inst(warp_inst_t &inst, unsigned lane_id) {
       }
     }
 
-    if (pI->has_pred()) {
+    if (decoded.has_pred) {
       inst.set_pred();
-      const operand_info &pred = pI->get_pred();
-      ptx_reg_t pred_value = get_operand_value(pred, pred, PRED_TYPE, this, 0);
+      ptx_reg_t pred_value;
+      if (decoded.pred_reg) {
+        pred_value = get_reg(decoded.pred_reg);
+      } else {
+        const operand_info &pred = pI->get_pred();
+        pred_value = get_operand_value(pred, pred, PRED_TYPE, this, 0);
+      }
       if (pI->get_pred_mod() == -1) {
         skip = (pred_value.pred & 0x0001) ^
                pI->get_pred_neg();  // ptxplus inverts the zero flag
@@ -1991,16 +2067,7 @@ void ptx_thread_info::ptx_exec_inst(warp_inst_t &inst, unsigned lane_id) {
     if (skip) {
       inst.set_not_active(lane_id);
     } else {
-      const ptx_instruction *pI_saved = pI;
-      ptx_instruction *pJ = NULL;
-      if (pI->get_opcode() == VOTE_OP || pI->get_opcode() == ACTIVEMASK_OP) {
-        pJ = new ptx_instruction(*pI);
-        *((warp_inst_t *)pJ) = inst;  // copy active mask information
-        pI = pJ;
-      }
-
-      if (((inst_opcode == MMA_OP || inst_opcode == MMA_LD_OP ||
-            inst_opcode == MMA_ST_OP))) {
+      if (decoded.warp_sync) {
         if (inst.active_count() != MAX_WARP_SIZE) {
           printf(
               "Tensor Core operation are warp synchronous operation. All the "
@@ -2012,33 +2079,19 @@ void ptx_thread_info::ptx_exec_inst(warp_inst_t &inst, unsigned lane_id) {
       // Tensorcore is warp synchronous operation. So these instructions needs
       // to be executed only once. To make the simulation faster removing the
       // redundant tensorcore operation
-      if (!tensorcore_op(inst_opcode) ||
-          ((tensorcore_op(inst_opcode)) && (lane_id == 0))) {
-        switch (inst_opcode) {
-#define OP_DEF(OP, FUNC, STR, DST, CLASSIFICATION) \
-  case OP:                                         \
-    FUNC(pI, this);                                \
-    op_classification = CLASSIFICATION;            \
-    break;
-#define OP_W_DEF(OP, FUNC, STR, DST, CLASSIFICATION) \
-  case OP:                                           \
-    FUNC(pI, get_core(), inst);                      \
-    op_classification = CLASSIFICATION;              \
-    break;
-#include "opcodes.def"
-#undef OP_DEF
-#undef OP_W_DEF
-          default:
-            printf("Execution error: Invalid opcode (0x%x)\n",
-                   pI->get_opcode());
-            break;
+      if (!decoded.warp_sync || lane_id == 0) {
+        if (decoded.exec) {
+          decoded.exec(pI, this);
+        } else if (decoded.warp_exec) {
+          decoded.warp_exec(pI, get_core(), inst);
+        } else {
+          printf("Execution error: Invalid opcode (0x%x)\n", pI->get_opcode());
         }
+        op_classification = decoded.classification;
       }
-      delete pJ;
-      pI = pI_saved;
 
       // Run exit instruction if exit option included
-      if (pI->is_exit()) exit_impl(pI, this);
+      if (decoded.is_exit) exit_impl(pI, this);
     }
 
     const gpgpu_functional_sim_config &config = m_gpu->get_config();
@@ -2138,10 +2191,9 @@ void ptx_thread_info::ptx_exec_inst(warp_inst_t &inst, unsigned lane_id) {
     }
 
     if (pI->get_opcode() == TRACE_RAY_OP) { 
-      // Copy list of accesses to warp instruction
-      inst.set_rt_mem_transactions(lane_id, RT_transactions);
-      inst.set_rt_mem_store_transactions(lane_id, RT_store_transactions);
-      inst.set_rt_ray_properties(lane_id, m_ray);
+      // Copy list of accesses to warp instruction, deferred walks are copied
+      // by execute_warp_inst_t once they have run
+      if (!m_rt_trace_deferred) copy_rt_results(inst, lane_id);
       
       // Set memory space
       insn_space.set_type(global_space);
@@ -2424,6 +2476,15 @@ unsigned ptx_sim_init_thread(kernel_info_t &kernel,
       ->init(gpu, core, sid, hw_cta_id, hw_warp_id, tid,
              isInFunctionalSimulationMode);
   active_threads.pop_front();
+
+  cuda_sim *func_sim = gpu->gpgpu_ctx->func_sim;
+  if (func_sim->ptx_operand_benchmark) {
+    func_sim->ptx_operand_benchmark = false;
+    const unsigned n_regs[] = {16, 64, 256};
+    for (unsigned i = 0; i < sizeof(n_regs) / sizeof(n_regs[0]); i++)
+      (*thread_info)
+          ->benchmark_operands(stdout, gpu->gpgpu_ctx, n_regs[i], 1000000);
+  }
   return 1;
 }
 
@@ -2933,11 +2994,9 @@ void functionalCoreSim::execute(int inst_count, unsigned ctaid_cp) {
       char fname[2048];
       snprintf(fname, 2048, "checkpoint_files/warp_%d_%d_simt.txt", i,
                ctaid - 1);
-      FILE *fp = fopen(fname, "w");
-      assert(fp != NULL);
-      m_simt_stack[i]->print_checkpoint(fp);
-      fclose(fp);
+      m_simt_stack[i]->store_checkpoint(fname);
     }
+    checkpoint::flush_image();
   }
 }
 
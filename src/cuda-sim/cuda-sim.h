@@ -123,6 +123,9 @@ class cuda_sim {
         -1;  // used for classification stat collection purposes
     gpgpu_param_num_shaders = 0;
     g_cuda_launch_blocking = false;
+    ptx_reg_slots = true;
+    ptx_reg_slots_benchmark = false;
+    ptx_operand_benchmark = false;
     g_inst_classification_stat = NULL;
     g_inst_op_classification_stat = NULL;
     g_assemble_code_next_pc = 0;
@@ -176,6 +179,9 @@ class cuda_sim {
       g_const_name_lookup;  // indexed by hostVar
   int g_ptx_sim_mode;  // if non-zero run functional simulation only (i.e., no
                        // notion of a clock cycle)
+  bool ptx_reg_slots;  // flat register frames, see ptx_reg_frame
+  bool ptx_reg_slots_benchmark;
+  bool ptx_operand_benchmark;  // run once, on the first thread initialized
   unsigned gpgpu_param_num_shaders;
   class std::map<function_info *, rec_pts> g_rpts;
   bool g_cuda_launch_blocking;
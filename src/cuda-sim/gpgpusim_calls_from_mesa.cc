@@ -30,6 +30,7 @@
 #define GPGPUSIM_CALLS_FROM_MESA_CC
 
 #include "vulkan_ray_tracing.h"
+#include "gpgpusim_launcher_api.h"
 // #include "vulkan/anv_private.h"
 
 extern "C" void gpgpusim_setPipelineInfo(VkRayTracingPipelineCreateInfoKHR* pCreateInfos)
@@ -180,4 +181,47 @@ extern "C" void* gpgpusim_allocBuffer(void* bufferAddr, uint64_t bufferSize)
     return VulkanRayTracing::allocBuffer(bufferAddr, bufferSize);
 }
 
+// Plain C entry points for launchers built without Mesa, see gpgpusim_launcher_api.h
+extern "C" void gpgpusim_setExternalLauncher(bool enabled)
+{
+    use_external_launcher = enabled;
+}
+
+extern "C" void* gpgpusim_allocDeviceMemory(uint64_t size)
+{
+    return VulkanRayTracing::allocDeviceMemory(size);
+}
+
+extern "C" void gpgpusim_copyToDevice(void *deviceAddress, const void *data, uint64_t size)
+{
+    VulkanRayTracing::copyToDevice(deviceAddress, data, size);
+}
+
+extern "C" void gpgpusim_copyFromDevice(void *data, const void *deviceAddress, uint64_t size)
+{
+    VulkanRayTracing::copyFromDevice(data, deviceAddress, size);
+}
+
+extern "C" void gpgpusim_setDescriptorSetFromLauncher(void *address, void *deviceAddress, uint32_t setID, uint32_t descID)
+{
+    VulkanRayTracing::setDescriptorSetFromLauncher(address, deviceAddress, setID, descID);
+}
+
+extern "C" void gpgpusim_setStorageImageFromLauncher(void *address, void *deviceAddress, uint32_t setID, uint32_t descID,
+                                                     uint32_t width, uint32_t height, uint32_t format,
+                                                     uint32_t VkDescriptorTypeNum, uint32_t n_planes, uint32_t n_samples,
+                                                     uint32_t tiling, uint32_t isl_tiling_mode, uint32_t row_pitch_B)
+{
+    VulkanRayTracing::setStorageImageFromLauncher(address, deviceAddress, setID, descID, width, height, (VkFormat)format, VkDescriptorTypeNum, n_planes, n_samples, (VkImageTiling)tiling, isl_tiling_mode, row_pitch_B);
+}
+
+extern "C" void gpgpusim_setTextureFromLauncher(void *address, void *deviceAddress, uint32_t setID, uint32_t descID,
+                                                uint64_t size, uint32_t width, uint32_t height, uint32_t format,
+                                                uint32_t VkDescriptorTypeNum, uint32_t n_planes, uint32_t n_samples,
+                                                uint32_t tiling, uint32_t isl_tiling_mode, uint32_t row_pitch_B,
+                                                uint32_t filter)
+{
+    VulkanRayTracing::setTextureFromLauncher(address, deviceAddress, setID, descID, size, width, height, (VkFormat)format, VkDescriptorTypeNum, n_planes, n_samples, (VkImageTiling)tiling, isl_tiling_mode, row_pitch_B, filter);
+}
+
 #endif /* GPGPUSIM_CALLS_FROM_MESA_CC */
@@ -0,0 +1,80 @@
+// Copyright (c) 2022, Mohammadreza Saed, Yuan Hsi Chou, Lufei Liu, Tor M. Aamodt,
+// The University of British Columbia
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+// Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution. Neither the name of
+// The University of British Columbia nor the names of its contributors may be
+// used to endorse or promote products derived from this software without
+// specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef GPGPUSIM_LAUNCHER_API_H
+#define GPGPUSIM_LAUNCHER_API_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Entry points for driving ray tracing from outside Mesa, e.g. the rt_replay
+// driver feeding a dumped scene bundle. Only plain C types are used so that a
+// launcher can be built without Vulkan or Mesa headers; Vulkan enums (VkFormat,
+// VkImageTiling, gl_shader_stage) are passed as their numeric values.
+//
+// A launcher calls gpgpusim_setExternalLauncher(true) before anything else, so
+// that device memory lives in the simulator instead of behind Vulkan buffers.
+// It then uploads buffers with gpgpusim_allocDeviceMemory/gpgpusim_copyToDevice,
+// binds them with the set*FromLauncher calls, registers the shaders and calls
+// gpgpusim_vkCmdTraceRaysKHR, which returns once the launch has been simulated.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void gpgpusim_setExternalLauncher(bool enabled);
+
+void *gpgpusim_allocDeviceMemory(uint64_t size);
+void gpgpusim_copyToDevice(void *deviceAddress, const void *data, uint64_t size);
+void gpgpusim_copyFromDevice(void *data, const void *deviceAddress, uint64_t size);
+
+uint32_t gpgpusim_registerShader(char *shaderPath, uint32_t shader_type);
+
+void gpgpusim_setDescriptorSetFromLauncher(void *address, void *deviceAddress, uint32_t setID, uint32_t descID);
+void gpgpusim_setStorageImageFromLauncher(void *address, void *deviceAddress, uint32_t setID, uint32_t descID,
+                                          uint32_t width, uint32_t height, uint32_t format,
+                                          uint32_t VkDescriptorTypeNum, uint32_t n_planes, uint32_t n_samples,
+                                          uint32_t tiling, uint32_t isl_tiling_mode, uint32_t row_pitch_B);
+void gpgpusim_setTextureFromLauncher(void *address, void *deviceAddress, uint32_t setID, uint32_t descID,
+                                     uint64_t size, uint32_t width, uint32_t height, uint32_t format,
+                                     uint32_t VkDescriptorTypeNum, uint32_t n_planes, uint32_t n_samples,
+                                     uint32_t tiling, uint32_t isl_tiling_mode, uint32_t row_pitch_B,
+                                     uint32_t filter);
+
+void gpgpusim_allocBLAS(void *rootAddr, uint64_t bufferSize, void *gpgpusimAddr);
+void gpgpusim_allocTLAS(void *rootAddr, uint64_t bufferSize, void *gpgpusimAddr);
+
+void gpgpusim_vkCmdTraceRaysKHR(void *raygen_sbt, void *miss_sbt, void *hit_sbt, void *callable_sbt,
+                                bool is_indirect, uint32_t launch_width, uint32_t launch_height,
+                                uint32_t launch_depth, uint64_t launch_size_addr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* GPGPUSIM_LAUNCHER_API_H */
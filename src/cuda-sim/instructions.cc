@@ -42,6 +42,7 @@ class ptx_recognizer;
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <chrono>
 #include <cmath>
 #include <map>
 #include <sstream>
@@ -176,6 +177,121 @@ void video_mem_instruction(const ptx_instruction *pI, ptx_thread_info *thread,
 
 void sign_extend(ptx_reg_t &data, unsigned src_size, const operand_info &dst);
 
+bool ptx_reg_frame::s_slots_enabled = true;
+
+// Kept next to get_reg/set_reg so the slot lookups inline into them
+bool ptx_reg_frame::adopt(const symbol *reg) {
+  if (m_func || !s_slots_enabled || !reg->reg_slot_func()) return false;
+  m_func = reg->reg_slot_func();
+  m_slots.assign(m_func->num_reg_slots(), ptx_reg_t());
+  m_slot_defined.assign(m_func->num_reg_slots(), 0);
+  return true;
+}
+
+ptx_reg_t *ptx_reg_frame::find(const symbol *reg) {
+  if (reg->reg_slot_func() == m_func && m_func) {
+    unsigned slot = reg->reg_slot();
+    return m_slot_defined[slot] ? &m_slots[slot] : NULL;
+  }
+  if (!m_func && adopt(reg)) return NULL;
+  reg_map_t::iterator it = m_overflow.find(reg);
+  return it == m_overflow.end() ? NULL : &it->second;
+}
+
+ptx_reg_t &ptx_reg_frame::operator[](const symbol *reg) {
+  if ((reg->reg_slot_func() == m_func && m_func) || (!m_func && adopt(reg))) {
+    unsigned slot = reg->reg_slot();
+    if (!m_slot_defined[slot]) {
+      m_slot_defined[slot] = 1;
+      m_num_defined++;
+    }
+    return m_slots[slot];
+  }
+  return m_overflow[reg];
+}
+
+const ptx_reg_t *ptx_reg_frame::find(const std::string &name) const {
+  if (m_func) {
+    int slot = m_func->find_reg_slot(name);
+    if (slot >= 0 && m_slot_defined[slot]) return &m_slots[slot];
+  }
+  for (reg_map_t::const_iterator it = m_overflow.begin();
+       it != m_overflow.end(); ++it) {
+    if (it->first->name() == name) return &it->second;
+  }
+  return NULL;
+}
+
+void ptx_reg_frame::get_all(reg_map_t &regs) const {
+  regs = m_overflow;
+  for (unsigned slot = 0; slot < m_slots.size(); slot++) {
+    if (m_slot_defined[slot])
+      regs[m_func->get_reg_slot_symbol(slot)] = m_slots[slot];
+  }
+}
+
+// Operand register of the next benchmark instruction. A private generator, so
+// the benchmark leaves rand() alone.
+static unsigned benchmark_operand(unsigned long long &seed, unsigned n_regs) {
+  seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+  return (unsigned)((seed >> 33) % n_regs);
+}
+
+void ptx_reg_frame::benchmark(FILE *fp, gpgpu_context *ctx, unsigned n_regs,
+                              unsigned n_threads, unsigned n_instructions) {
+  if (n_regs == 0 || n_instructions == 0) return;
+  n_threads = (n_threads + 31) / 32 * 32;
+  if (n_threads == 0) n_threads = 32;
+
+  function_info func(0, ctx);
+  std::vector<symbol *> regs;
+  for (unsigned r = 0; r < n_regs; r++) {
+    regs.push_back(new symbol("%r", NULL, "benchmark", 4, ctx));
+    func.add_reg_slot(regs.back());
+  }
+
+  bool enabled = s_slots_enabled;
+  unsigned long long checksum = 0;
+  double ns[2];
+  for (unsigned slots = 0; slots < 2; slots++) {
+    s_slots_enabled = slots;
+    // Every register written once, as after the first few instructions
+    std::vector<ptx_reg_frame> frames(n_threads);
+    for (unsigned t = 0; t < n_threads; t++)
+      for (unsigned r = 0; r < n_regs; r++) frames[t][regs[r]].u64 = t + r;
+
+    unsigned long long seed = 1;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned i = 0; i < n_instructions; i++) {
+      const symbol *a = regs[benchmark_operand(seed, n_regs)];
+      const symbol *b = regs[benchmark_operand(seed, n_regs)];
+      const symbol *d = regs[benchmark_operand(seed, n_regs)];
+      unsigned warp = i % (n_threads / 32);
+      for (unsigned t = warp * 32; t < warp * 32 + 32; t++) {
+        ptx_reg_frame &frame = frames[t];
+        frame[d].u64 = frame.find(a)->u64 + frame.find(b)->u64;
+      }
+    }
+    auto end = std::chrono::steady_clock::now();
+    for (unsigned t = 0; t < n_threads; t++)
+      checksum += frames[t].find(regs[t % n_regs])->u64;
+    ns[slots] = std::chrono::duration<double, std::nano>(end - start).count() /
+                ((double)n_instructions * 32);
+  }
+  s_slots_enabled = enabled;
+  for (unsigned r = 0; r < n_regs; r++) delete regs[r];
+
+  // Keep the loops from being optimized away
+  volatile unsigned long long sink = checksum;
+  (void)sink;
+
+  fprintf(fp,
+          "PTX register frame benchmark (%u registers, %u threads): "
+          "reg_map_t %.1f ns, flat frame %.1f ns per thread instruction "
+          "(2 reads, 1 write)\n",
+          n_regs, n_threads, ns[0], ns[1]);
+}
+
 void ptx_thread_info::set_reg(const symbol *reg, const ptx_reg_t &value) {
   assert(reg != NULL);
   if (reg->name() == "_") return;
@@ -186,14 +302,36 @@ void ptx_thread_info::set_reg(const symbol *reg, const ptx_reg_t &value) {
   m_last_set_operand_value = value;
 }
 
+// Register checkpoint images hold, per register, the name length, the name
+// and the raw ptx_reg_t
 void ptx_thread_info::print_reg_thread(char *fname) {
+  if (checkpoint::use_image()) {
+    std::vector<unsigned char> data;
+    if (!m_regs.empty()) {
+      reg_map_t reg;
+      m_regs.back().get_all(reg);
+      for (reg_map_t::const_iterator it = reg.begin(); it != reg.end(); ++it) {
+        const std::string &name = it->first->name();
+        unsigned len = name.size();
+        data.insert(data.end(), (const unsigned char *)&len,
+                    (const unsigned char *)(&len + 1));
+        data.insert(data.end(), name.begin(), name.end());
+        data.insert(data.end(), (const unsigned char *)&it->second,
+                    (const unsigned char *)(&it->second + 1));
+      }
+    }
+    checkpoint::store_blob(fname, data);
+    return;
+  }
+
   FILE *fp = fopen(fname, "w");
   assert(fp != NULL);
 
   int size = m_regs.size();
 
   if (size > 0) {
-    reg_map_t reg = m_regs.back();
+    reg_map_t reg;
+    m_regs.back().get_all(reg);
 
     reg_map_t::const_iterator it;
     for (it = reg.begin(); it != reg.end(); ++it) {
@@ -209,6 +347,26 @@ void ptx_thread_info::print_reg_thread(char *fname) {
 }
 
 void ptx_thread_info::resume_reg_thread(char *fname, symbol_table *symtab) {
+  if (checkpoint::use_image()) {
+    std::vector<unsigned char> data;
+    checkpoint::load_blob(fname, data);
+    size_t pos = 0;
+    while (pos < data.size()) {
+      unsigned len;
+      assert(pos + sizeof(len) <= data.size());
+      memcpy(&len, &data[pos], sizeof(len));
+      pos += sizeof(len);
+      assert(pos + len + sizeof(ptx_reg_t) <= data.size());
+      std::string name((const char *)&data[pos], len);
+      pos += len;
+      ptx_reg_t value;
+      memcpy((void *)&value, &data[pos], sizeof(value));
+      pos += sizeof(value);
+      m_regs.back()[symtab->lookup(name.c_str())] = value;
+    }
+    return;
+  }
+
   FILE *fp2 = fopen(fname, "r");
   assert(fp2 != NULL);
   // m_regs.push_back( reg_map_t() );
@@ -233,8 +391,8 @@ ptx_reg_t ptx_thread_info::get_reg(const symbol *reg) {
   static bool unfound_register_warned = false;
   assert(reg != NULL);
   assert(!m_regs.empty());
-  reg_map_t::iterator regs_iter = m_regs.back().find(reg);
-  if (regs_iter == m_regs.back().end()) {
+  ptx_reg_t *value = m_regs.back().find(reg);
+  if (value == NULL) {
     assert(reg->type()->get_key().is_reg());
     const std::string &name = reg->name();
     unsigned call_uid = m_callstack.back().m_call_uid;
@@ -252,18 +410,23 @@ ptx_reg_t ptx_thread_info::get_reg(const symbol *reg) {
           file_loc.c_str(), name.c_str(), call_uid);
       unfound_register_warned = true;
     }
-    regs_iter = m_regs.back().find(reg);
+    value = m_regs.back().find(reg);
   }
-  if (m_enable_debug_trace)
-    m_debug_trace_regs_read.back()[reg] = regs_iter->second;
-  return regs_iter->second;
+  if (m_enable_debug_trace) m_debug_trace_regs_read.back()[reg] = *value;
+  return *value;
 }
 
 ptx_reg_t ptx_thread_info::get_operand_value(const operand_info &op,
-                                             operand_info dstInfo,
+                                             const operand_info &dstInfo,
                                              unsigned opType,
                                              ptx_thread_info *thread,
                                              int derefFlag) {
+  // Same value the register case below returns, without classifying the
+  // operand again for every lane
+  if (op.get_plain_reg() && opType != BB128_TYPE && opType != BB64_TYPE &&
+      opType != FF64_TYPE)
+    return get_reg(op.get_plain_reg());
+
   ptx_reg_t result, tmp;
 
   if (op.get_double_operand_type() == 0) {
@@ -483,6 +646,69 @@ ptx_reg_t ptx_thread_info::get_operand_value(const operand_info &op,
   return finalResult;
 }
 
+// Operand of the next benchmark read. A private generator, so the benchmark
+// leaves rand() alone.
+static unsigned benchmark_operand_index(unsigned long long &seed, unsigned n) {
+  seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+  return (unsigned)((seed >> 33) % n);
+}
+
+void ptx_thread_info::benchmark_operands(FILE *fp, gpgpu_context *ctx,
+                                         unsigned n_regs, unsigned n_reads) {
+  if (n_regs == 0 || n_reads == 0) return;
+  function_info func(0, ctx);
+  type_info type(NULL, type_info_key(reg_space, U32_TYPE, 0, 0, 0, 0));
+  std::vector<symbol *> regs;
+  std::vector<operand_info> classified, resolved;
+  for (unsigned r = 0; r < n_regs; r++) {
+    regs.push_back(new symbol("%r", &type, "benchmark", 4, ctx));
+    func.add_reg_slot(regs.back());
+    classified.push_back(operand_info(regs.back(), ctx));
+    resolved.push_back(classified.back());
+    resolved.back().resolve_plain_reg();
+  }
+  // The frame sizes itself to the function on the first write, so only once
+  // every register has its slot
+  m_regs.push_back(ptx_reg_frame());
+  for (unsigned r = 0; r < n_regs; r++) {
+    ptx_reg_t value;
+    value.u32 = r;
+    set_reg(regs[r], value);
+  }
+
+  unsigned long long checksum = 0, seed = 1;
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned i = 0; i < n_reads; i++) {
+    const operand_info &src = classified[benchmark_operand_index(seed, n_regs)];
+    const operand_info &dst = classified[benchmark_operand_index(seed, n_regs)];
+    checksum += get_operand_value(src, operand_info(dst), U32_TYPE, this, 1).u32;
+  }
+  seed = 1;
+  auto mid = std::chrono::steady_clock::now();
+  for (unsigned i = 0; i < n_reads; i++) {
+    const operand_info &src = resolved[benchmark_operand_index(seed, n_regs)];
+    const operand_info &dst = resolved[benchmark_operand_index(seed, n_regs)];
+    checksum += get_operand_value(src, dst, U32_TYPE, this, 1).u32;
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  m_regs.pop_back();
+  for (unsigned r = 0; r < n_regs; r++) delete regs[r];
+
+  // Keep the loops from being optimized away
+  volatile unsigned long long sink = checksum;
+  (void)sink;
+
+  double classified_ns =
+      std::chrono::duration<double, std::nano>(mid - start).count() / n_reads;
+  double resolved_ns =
+      std::chrono::duration<double, std::nano>(end - mid).count() / n_reads;
+  fprintf(fp,
+          "PTX operand benchmark (%u registers, %u reads): classified %.1f "
+          "ns, resolved at load time %.1f ns per register operand read\n",
+          n_regs, n_reads, classified_ns, resolved_ns);
+}
+
 unsigned get_operand_nbits(const operand_info &op) {
   if (op.is_reg()) {
     const symbol *sym = op.get_symbol();
@@ -536,9 +762,9 @@ void ptx_thread_info::get_vector_operand_values(const operand_info &op,
     const symbol *sym = NULL;
     sym = op.vec_symbol(idx);
     if (strcmp(sym->name().c_str(), "_") != 0) {
-      reg_map_t::iterator reg_iter = m_regs.back().find(sym);
-      assert(reg_iter != m_regs.back().end());
-      ptx_regs[idx] = reg_iter->second;
+      ptx_reg_t *value = m_regs.back().find(sym);
+      assert(value != NULL);
+      ptx_regs[idx] = *value;
     }
   }
 }
@@ -6482,6 +6708,7 @@ void vote_impl(const ptx_instruction *pI, ptx_thread_info *thread) {
   static unsigned int ballot_result;
   static std::list<ptx_thread_info *> threads_in_warp;
   static unsigned last_tid;
+  const warp_inst_t &warp = thread->exec_warp_inst();
 
   if (first_in_warp) {
     first_in_warp = false;
@@ -6490,10 +6717,10 @@ void vote_impl(const ptx_instruction *pI, ptx_thread_info *thread) {
     or_all = false;
     ballot_result = 0;
     int offset = 31;
-    while ((offset >= 0) && !pI->active(offset)) offset--;
+    while ((offset >= 0) && !warp.active(offset)) offset--;
     assert(offset >= 0);
     last_tid =
-        (thread->get_hw_tid() - (thread->get_hw_tid() % pI->warp_size())) +
+        (thread->get_hw_tid() - (thread->get_hw_tid() % warp.warp_size())) +
         offset;
   }
 
@@ -6513,7 +6740,7 @@ void vote_impl(const ptx_instruction *pI, ptx_thread_info *thread) {
 
   // vote.ballot
   if (invert ^ pred_value) {
-    int lane_id = thread->get_hw_tid() % pI->warp_size();
+    int lane_id = thread->get_hw_tid() % warp.warp_size();
     ballot_result |= (1 << lane_id);
   }
 
@@ -6556,7 +6783,8 @@ void vote_impl(const ptx_instruction *pI, ptx_thread_info *thread) {
 }
 
 void activemask_impl(const ptx_instruction *pI, ptx_thread_info *thread) {
-  active_mask_t l_activemask_bitset = pI->get_warp_active_mask();
+  active_mask_t l_activemask_bitset =
+      thread->exec_warp_inst().get_warp_active_mask();
   uint32_t l_activemask_uint =
       static_cast<uint32_t>(l_activemask_bitset.to_ulong());
 
@@ -7232,6 +7460,16 @@ void trace_ray_impl(const ptx_instruction *pI, ptx_thread_info *thread) {
   // uint32_t payload = op15_data.u64;
 
   // thread->dump_regs(stdout);
+  if (VulkanRayTracing::deferTraceRay(_topLevelAS, rayFlags, cullMask, sbtRecordOffset, sbtRecordStride, missIndex,
+                    {originX, originY, originZ},
+                    Tmin,
+                    {directionX, directionY, directionZ},
+                    Tmax,
+                    NULL,
+                    pI,
+                    thread)) {
+    return;
+  }
   if (GPGPU_Context()->the_gpgpusim->g_the_gpu->get_config().get_treelet_based_traversal()) {
     VulkanRayTracing::traceRayWithTreelets(_topLevelAS, rayFlags, cullMask, sbtRecordOffset, sbtRecordStride, missIndex,
                     {originX, originY, originZ},
@@ -28,15 +28,203 @@
 
 #include "memory.h"
 #include <stdlib.h>
+#include <algorithm>
 #include "../../libcuda/gpgpu_context.h"
 #include "../debug.h"
 #include "vulkan_ray_tracing.h"
 
+template <unsigned BSIZE>
+const typename mem_page_table<BSIZE>::leaf *mem_page_table<BSIZE>::find_leaf(
+    mem_addr_t index) const {
+  mem_addr_t page = index >> LEAF_BITS;
+  if (page >> (NODE_BITS * m_height)) return NULL;
+  const void *p = m_root;
+  for (unsigned level = m_height; level > 0 && p; level--)
+    p = ((const node *)p)
+            ->child[(page >> (NODE_BITS * (level - 1))) & (NODE_SIZE - 1)];
+  return (const leaf *)p;
+}
+
+template <unsigned BSIZE>
+typename mem_page_table<BSIZE>::leaf *mem_page_table<BSIZE>::get_leaf(
+    mem_addr_t index) {
+  mem_addr_t page = index >> LEAF_BITS;
+
+  // Grow the tree until it covers the page
+  while (page >> (NODE_BITS * m_height)) {
+    if (m_root) {
+      node *n = (node *)calloc(1, sizeof(node));
+      n->child[0] = m_root;
+      m_root = n;
+    }
+    m_height++;
+  }
+
+  void **slot = &m_root;
+  for (unsigned level = m_height; level > 0; level--) {
+    if (!*slot) *slot = calloc(1, sizeof(node));
+    slot = &((node *)*slot)
+                ->child[(page >> (NODE_BITS * (level - 1))) & (NODE_SIZE - 1)];
+  }
+  if (!*slot) {
+    leaf *l = new leaf();
+    l->slab = LARGE_PAGES ? (unsigned char *)calloc(LEAF_SIZE, BSIZE) : NULL;
+    l->contiguous = true;
+    *slot = l;
+  }
+  return (leaf *)*slot;
+}
+
+template <unsigned BSIZE>
+unsigned char *mem_page_table<BSIZE>::block_for_write(mem_addr_t index) {
+  leaf *l = get_leaf(index);
+  unsigned i = index & (LEAF_SIZE - 1);
+  if (!l->blocks[i]) {
+    l->blocks[i] = LARGE_PAGES ? l->slab + (size_t)i * BSIZE
+                               : (unsigned char *)calloc(1, BSIZE);
+    m_num_blocks++;
+  }
+  return l->blocks[i];
+}
+
+template <unsigned BSIZE>
+void mem_page_table<BSIZE>::read(mem_addr_t addr, size_t length,
+                                 unsigned char *data) const {
+  const mem_addr_t leaf_bytes = (mem_addr_t)LEAF_SIZE * BSIZE;
+  while (length > 0) {
+    mem_addr_t index = addr / BSIZE;
+    size_t leaf_offset = addr & (leaf_bytes - 1);
+    size_t nbytes = std::min((size_t)(leaf_bytes - leaf_offset), length);
+
+    const leaf *l = find_leaf(index);
+    if (!l) {
+      memset(data, 0, nbytes);
+    } else if (l->slab && l->contiguous) {
+      // absent blocks of a slab are still zero
+      memcpy(data, l->slab + leaf_offset, nbytes);
+    } else {
+      for (size_t done = 0; done < nbytes;) {
+        unsigned offset = (addr + done) & (BSIZE - 1);
+        size_t tx_bytes = std::min((size_t)(BSIZE - offset), nbytes - done);
+        const unsigned char *b =
+            l->blocks[((addr + done) / BSIZE) & (LEAF_SIZE - 1)];
+        if (b)
+          memcpy(data + done, b + offset, tx_bytes);
+        else
+          memset(data + done, 0, tx_bytes);
+        done += tx_bytes;
+      }
+    }
+
+    addr += nbytes;
+    data += nbytes;
+    length -= nbytes;
+  }
+}
+
+template <unsigned BSIZE>
+void mem_page_table<BSIZE>::write(mem_addr_t addr, size_t length,
+                                  const unsigned char *data) {
+  const mem_addr_t leaf_bytes = (mem_addr_t)LEAF_SIZE * BSIZE;
+  while (length > 0) {
+    mem_addr_t index = addr / BSIZE;
+    size_t leaf_offset = addr & (leaf_bytes - 1);
+    size_t nbytes = std::min((size_t)(leaf_bytes - leaf_offset), length);
+
+    leaf *l = get_leaf(index);
+    mem_addr_t last = (addr + nbytes - 1) / BSIZE;
+    for (mem_addr_t b = index; b <= last; b++) block_for_write(b);
+
+    if (l->slab && l->contiguous) {
+      memcpy(l->slab + leaf_offset, data, nbytes);
+    } else {
+      for (size_t done = 0; done < nbytes;) {
+        unsigned offset = (addr + done) & (BSIZE - 1);
+        size_t tx_bytes = std::min((size_t)(BSIZE - offset), nbytes - done);
+        memcpy(l->blocks[((addr + done) / BSIZE) & (LEAF_SIZE - 1)] + offset,
+               data + done, tx_bytes);
+        done += tx_bytes;
+      }
+    }
+
+    addr += nbytes;
+    data += nbytes;
+    length -= nbytes;
+  }
+}
+
+template <unsigned BSIZE>
+void mem_page_table<BSIZE>::map_block(mem_addr_t index, unsigned char *data) {
+  leaf *l = get_leaf(index);
+  unsigned i = index & (LEAF_SIZE - 1);
+  if (!l->blocks[i])
+    m_num_blocks++;
+  else if (!LARGE_PAGES && !l->mapped.test(i))
+    free(l->blocks[i]);
+  l->blocks[i] = data;
+  l->mapped.set(i);
+  l->contiguous = false;
+}
+
+template <unsigned BSIZE>
+void mem_page_table<BSIZE>::collect_blocks(
+    const void *p, unsigned height, mem_addr_t first_page,
+    std::vector<std::pair<mem_addr_t, const unsigned char *> > &blocks) const {
+  if (!p) return;
+  if (height == 0) {
+    const leaf *l = (const leaf *)p;
+    for (unsigned i = 0; i < LEAF_SIZE; i++)
+      if (l->blocks[i])
+        blocks.push_back(
+            std::make_pair((first_page << LEAF_BITS) + i, l->blocks[i]));
+    return;
+  }
+  const node *n = (const node *)p;
+  for (unsigned c = 0; c < NODE_SIZE; c++)
+    collect_blocks(n->child[c], height - 1,
+                   first_page + ((mem_addr_t)c << (NODE_BITS * (height - 1))),
+                   blocks);
+}
+
+template <unsigned BSIZE>
+void mem_page_table<BSIZE>::get_blocks(
+    std::vector<std::pair<mem_addr_t, const unsigned char *> > &blocks) const {
+  blocks.clear();
+  blocks.reserve(m_num_blocks);
+  collect_blocks(m_root, m_height, 0, blocks);
+}
+
+template <unsigned BSIZE>
+void mem_page_table<BSIZE>::free_subtree(void *p, unsigned height) {
+  if (!p) return;
+  if (height == 0) {
+    leaf *l = (leaf *)p;
+    if (LARGE_PAGES) {
+      free(l->slab);
+    } else {
+      for (unsigned i = 0; i < LEAF_SIZE; i++)
+        if (!l->mapped.test(i)) free(l->blocks[i]);
+    }
+    delete l;
+    return;
+  }
+  node *n = (node *)p;
+  for (unsigned c = 0; c < NODE_SIZE; c++) free_subtree(n->child[c], height - 1);
+  free(n);
+}
+
+template <unsigned BSIZE>
+void mem_page_table<BSIZE>::clear() {
+  free_subtree(m_root, m_height);
+  m_root = NULL;
+  m_height = 0;
+  m_num_blocks = 0;
+}
+
 template <unsigned BSIZE>
 memory_space_impl<BSIZE>::memory_space_impl(std::string name,
                                             unsigned hash_size) {
   m_name = name;
-  MEM_MAP_RESIZE(hash_size);
 
   m_log2_block_size = -1;
   for (unsigned n = 0, mask = 1; mask != 0; mask <<= 1, n++) {
@@ -51,7 +239,8 @@ memory_space_impl<BSIZE>::memory_space_impl(std::string name,
 template <unsigned BSIZE>
 void memory_space_impl<BSIZE>::write_only(mem_addr_t offset, mem_addr_t index,
                                           size_t length, const void *data) {
-  m_data[index].write(offset, length, (const unsigned char *)data);
+  assert(offset + length <= BSIZE);
+  memcpy(m_data.block_for_write(index) + offset, data, length);
 }
 
 template <unsigned BSIZE>
@@ -71,37 +260,14 @@ void memory_space_impl<BSIZE>::write(mem_addr_t addr, size_t length,
     }
   }
   else {
-    mem_addr_t index = addr >> m_log2_block_size;
-
-    if ((addr + length) <= (index + 1) * BSIZE) {
+    unsigned offset = addr & (BSIZE - 1);
+    if (offset + length <= BSIZE) {
       // fast route for intra-block access
-      unsigned offset = addr & (BSIZE - 1);
-      unsigned nbytes = length;
-      m_data[index].write(offset, nbytes, (const unsigned char *)data);
+      memcpy(m_data.block_for_write(addr >> m_log2_block_size) + offset, data,
+             length);
     } else {
-      // slow route for inter-block access
-      unsigned nbytes_remain = length;
-      unsigned src_offset = 0;
-      mem_addr_t current_addr = addr;
-
-      while (nbytes_remain > 0) {
-        unsigned offset = current_addr & (BSIZE - 1);
-        mem_addr_t page = current_addr >> m_log2_block_size;
-        mem_addr_t access_limit = offset + nbytes_remain;
-        if (access_limit > BSIZE) {
-          access_limit = BSIZE;
-        }
-
-        size_t tx_bytes = access_limit - offset;
-        m_data[page].write(offset, tx_bytes,
-                          &((const unsigned char *)data)[src_offset]);
-
-        // advance pointers
-        src_offset += tx_bytes;
-        current_addr += tx_bytes;
-        nbytes_remain -= tx_bytes;
-      }
-      assert(nbytes_remain == 0);
+      // slow route for inter-block access, one copy per large page
+      m_data.write(addr, length, (const unsigned char *)data);
     }
     if (!m_watchpoints.empty()) {
       std::map<unsigned, mem_addr_t>::iterator i;
@@ -116,34 +282,6 @@ void memory_space_impl<BSIZE>::write(mem_addr_t addr, size_t length,
   }
 }
 
-template <unsigned BSIZE>
-void memory_space_impl<BSIZE>::read_single_block(mem_addr_t blk_idx,
-                                                 mem_addr_t addr, size_t length,
-                                                 void *data) const {
-  if ((addr + length) > (blk_idx + 1) * BSIZE) {
-    printf(
-        "GPGPU-Sim PTX: ERROR * access to memory \'%s\' is unaligned : "
-        "addr=0x%x, length=%zu\n",
-        m_name.c_str(), addr, length);
-    printf(
-        "GPGPU-Sim PTX: (addr+length)=0x%lx > 0x%x=(index+1)*BSIZE, "
-        "index=0x%x, BSIZE=0x%x\n",
-        (addr + length), (blk_idx + 1) * BSIZE, blk_idx, BSIZE);
-    throw 1;
-  }
-  typename map_t::const_iterator i = m_data.find(blk_idx);
-  if (i == m_data.end()) {
-    for (size_t n = 0; n < length; n++)
-      ((unsigned char *)data)[n] = (unsigned char)0;
-    // printf("GPGPU-Sim PTX:  WARNING reading %zu bytes from unititialized
-    // memory at address 0x%x in space %s\n", length, addr, m_name.c_str() );
-  } else {
-    unsigned offset = addr & (BSIZE - 1);
-    unsigned nbytes = length;
-    i->second.read(offset, nbytes, (unsigned char *)data);
-  }
-}
-
 template <unsigned BSIZE>
 void* memory_space_impl<BSIZE>::find_vulkan_buffer(mem_addr_t addr) const {
   mem_addr_t index = addr & ~(VULKAN_ADDR_BLK - 1);
@@ -174,45 +312,37 @@ void memory_space_impl<BSIZE>::read(mem_addr_t addr, size_t length,
     }
   }
   else {
-    mem_addr_t index = addr >> m_log2_block_size;
-    if ((addr + length) <= (index + 1) * BSIZE) {
+    unsigned offset = addr & (BSIZE - 1);
+    if (offset + length <= BSIZE) {
       // fast route for intra-block access
-      read_single_block(index, addr, length, data);
+      const unsigned char *block = m_data.block(addr >> m_log2_block_size);
+      if (block)
+        memcpy(data, block + offset, length);
+      else
+        memset(data, 0, length);
     } else {
-      // slow route for inter-block access
-      unsigned nbytes_remain = length;
-      unsigned dst_offset = 0;
-      mem_addr_t current_addr = addr;
-
-      while (nbytes_remain > 0) {
-        unsigned offset = current_addr & (BSIZE - 1);
-        mem_addr_t page = current_addr >> m_log2_block_size;
-        mem_addr_t access_limit = offset + nbytes_remain;
-        if (access_limit > BSIZE) {
-          access_limit = BSIZE;
-        }
-
-        size_t tx_bytes = access_limit - offset;
-        read_single_block(page, current_addr, tx_bytes,
-                          &((unsigned char *)data)[dst_offset]);
-
-        // advance pointers
-        dst_offset += tx_bytes;
-        current_addr += tx_bytes;
-        nbytes_remain -= tx_bytes;
-      }
-      assert(nbytes_remain == 0);
+      // slow route for inter-block access, one copy per large page
+      m_data.read(addr, length, (unsigned char *)data);
     }
   }
 }
 
 template <unsigned BSIZE>
 void memory_space_impl<BSIZE>::print(const char *format, FILE *fout) const {
-  typename map_t::const_iterator i_page;
+  std::vector<std::pair<mem_addr_t, const unsigned char *> > blocks;
+  m_data.get_blocks(blocks);
 
-  for (i_page = m_data.begin(); i_page != m_data.end(); ++i_page) {
-    fprintf(fout, "%s %08x:", m_name.c_str(), i_page->first);
-    i_page->second.print(format, fout);
+  for (unsigned b = 0; b < blocks.size(); b++) {
+    fprintf(fout, "%s %08llx:", m_name.c_str(),
+            (unsigned long long)blocks[b].first);
+    const unsigned int *i_data = (const unsigned int *)blocks[b].second;
+    for (int d = 0; d < (BSIZE / sizeof(unsigned int)); d++) {
+      fprintf(fout, "\n");
+      fprintf(fout, format, i_data[d]);
+      fprintf(fout, " ");
+    }
+    fprintf(fout, "\n");
+    fflush(fout);
   }
 }
 
@@ -232,6 +362,32 @@ void memory_space_impl<BSIZE>::bind_vulkan_buffer(void* bufferAddr, unsigned buf
   }
 }
 
+template <unsigned BSIZE>
+void memory_space_impl<BSIZE>::get_blocks(
+    std::vector<std::pair<mem_addr_t, const unsigned char *> > &blocks) const {
+  m_data.get_blocks(blocks);
+}
+
+template <unsigned BSIZE>
+void memory_space_impl<BSIZE>::load_block(mem_addr_t index, const void *data) {
+  unsigned char *block = m_data.block_for_write(index);
+  if (data)
+    memcpy(block, data, BSIZE);
+  else
+    memset(block, 0, BSIZE);
+}
+
+template <unsigned BSIZE>
+void memory_space_impl<BSIZE>::map_block(mem_addr_t index,
+                                         unsigned char *data) {
+  m_data.map_block(index, data);
+}
+
+template class mem_page_table<32>;
+template class mem_page_table<64>;
+template class mem_page_table<8192>;
+template class mem_page_table<16 * 1024>;
+
 template class memory_space_impl<32>;
 template class memory_space_impl<64>;
 template class memory_space_impl<8192>;
@@ -244,6 +400,117 @@ void g_print_memory_space(memory_space *mem, const char *format = "%08x",
 
 #ifdef UNIT_TEST
 
+#include <unistd.h>
+#include <chrono>
+#include <unordered_map>
+#include "checkpoint_image.h"
+
+// The block hash map memory_space_impl used before the page table, kept here
+// as the baseline for the node fetch benchmark
+template <unsigned BSIZE>
+class hashed_blocks {
+ public:
+  ~hashed_blocks() {
+    for (auto &b : m_blocks) free(b.second);
+  }
+  void write(mem_addr_t addr, size_t length, const unsigned char *data) {
+    for (size_t done = 0; done < length;) {
+      unsigned offset = (addr + done) % BSIZE;
+      size_t n = std::min((size_t)(BSIZE - offset), length - done);
+      unsigned char *&b = m_blocks[(addr + done) / BSIZE];
+      if (!b) b = (unsigned char *)calloc(1, BSIZE);
+      memcpy(b + offset, data + done, n);
+      done += n;
+    }
+  }
+  void read(mem_addr_t addr, size_t length, unsigned char *data) const {
+    for (size_t done = 0; done < length;) {
+      unsigned offset = (addr + done) % BSIZE;
+      size_t n = std::min((size_t)(BSIZE - offset), length - done);
+      auto b = m_blocks.find((addr + done) / BSIZE);
+      if (b == m_blocks.end())
+        memset(data + done, 0, n);
+      else
+        memcpy(data + done, b->second + offset, n);
+      done += n;
+    }
+  }
+
+ private:
+  std::unordered_map<mem_addr_t, unsigned char *> m_blocks;
+};
+
+template <class MEM>
+static double node_fetches_per_sec(const MEM &mem,
+                                   const std::vector<mem_addr_t> &fetches,
+                                   unsigned node_size, unsigned passes) {
+  unsigned char node[256];
+  unsigned long long checksum = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned pass = 0; pass < passes; pass++) {
+    for (mem_addr_t addr : fetches) {
+      mem.read(addr, node_size, node);
+      checksum += node[0];
+    }
+  }
+  auto end = std::chrono::steady_clock::now();
+  volatile unsigned long long sink = checksum;
+  (void)sink;
+  double seconds = std::chrono::duration<double>(end - start).count();
+  return seconds > 0.0 ? (double)fetches.size() * passes / seconds : 0.0;
+}
+
+// Node fetch throughput of global memory (8KB blocks) against the old block
+// hash map, on a BVH image (e.g. a <set>_<desc>.asmain from an rt_replay
+// bundle) or a synthetic 32MB one when no file is given. Fetches follow random
+// root to leaf paths of a 6-wide tree laid out breadth first.
+static void benchmark_node_fetch(const char *bvh_file) {
+  const unsigned node_size = 64;
+  const unsigned passes = 8;
+  const mem_addr_t base = 0xC0000000;
+
+  std::vector<unsigned char> image;
+  if (bvh_file) {
+    FILE *fp = fopen(bvh_file, "rb");
+    if (!fp) {
+      printf("Cannot open %s\n", bvh_file);
+      return;
+    }
+    fseek(fp, 0, SEEK_END);
+    image.resize(ftell(fp));
+    fseek(fp, 0, SEEK_SET);
+    if (fread(image.data(), 1, image.size(), fp) != image.size())
+      image.clear();
+    fclose(fp);
+  } else {
+    image.resize(32 * 1024 * 1024);
+    for (size_t i = 0; i < image.size(); i++) image[i] = i * 2654435761u >> 24;
+  }
+  unsigned num_nodes = image.size() / node_size;
+  if (num_nodes == 0) return;
+
+  memory_space_impl<8192> table("global", 64 * 1024);
+  hashed_blocks<8192> hashed;
+  table.write(base, image.size(), image.data(), NULL, NULL);
+  hashed.write(base, image.size(), image.data());
+
+  std::vector<mem_addr_t> fetches;
+  unsigned seed = 1;
+  while (fetches.size() < 4 * 1024 * 1024) {
+    for (unsigned node = 0; node < num_nodes;) {
+      fetches.push_back(base + (mem_addr_t)node * node_size);
+      seed = seed * 1103515245 + 12345;
+      node = node * 6 + 1 + (seed >> 16) % 6;
+    }
+  }
+
+  double table_rate = node_fetches_per_sec(table, fetches, node_size, passes);
+  double hashed_rate = node_fetches_per_sec(hashed, fetches, node_size, passes);
+  printf("Node fetch benchmark (%u nodes): block hash map %.0f fetches/s, "
+         "page table %.0f fetches/s\n",
+         num_nodes, hashed_rate, table_rate);
+}
+
 int main(int argc, char *argv[]) {
   int errors_found = 0;
   memory_space *mem = new memory_space_impl<32>("test", 4);
@@ -276,6 +543,152 @@ int main(int argc, char *argv[]) {
     }
   }
 
+  // page table: accesses spanning blocks and large pages, far apart pages,
+  // blocks mapped from elsewhere inside a large page
+  {
+    memory_space *global = new memory_space_impl<8192>("global", 4);
+    std::vector<unsigned char> buf(5 * 1024 * 1024), out(buf.size());
+    for (size_t i = 0; i < buf.size(); i++) buf[i] = i * 2654435761u >> 24;
+    const mem_addr_t spans[] = {0, 0x1ff000, 0xC0000ff0, 0x7ffffffffff000ull};
+    for (mem_addr_t base : spans) {
+      global->write(base, buf.size(), buf.data(), NULL, NULL);
+      global->read(base, out.size(), out.data());
+      unsigned char zeros[64], probe[64];
+      global->read(base + buf.size(), 64, probe);
+      memset(zeros, 0, 64);
+      if (out != buf || memcmp(probe, zeros, 64)) {
+        errors_found = 1;
+        printf("ERROR ** page table span at 0x%llx\n",
+               (unsigned long long)base);
+      }
+    }
+
+    std::vector<unsigned char> page(8192, 0x5a);
+    global->map_block(0xC0002000 / 8192, page.data());
+    global->read(0xC0002000 - 16, 32, out.data());
+    if (memcmp(out.data(), &buf[0x1000], 16) ||
+        memcmp(out.data() + 16, page.data(), 16)) {
+      errors_found = 1;
+      printf("ERROR ** page table mapped block\n");
+    }
+
+    std::vector<std::pair<mem_addr_t, const unsigned char *> > blocks;
+    global->get_blocks(blocks);
+    for (unsigned i = 1; i < blocks.size(); i++)
+      if (blocks[i - 1].first >= blocks[i].first) errors_found = 1;
+    delete global;
+  }
+
+  // checkpoint image round trip: page sized blocks are mapped back, small and
+  // compressed blocks are copied, all-zero blocks carry no payload
+  for (int compress = 0; compress < 2; compress++) {
+    memory_space *pages = new memory_space_impl<8192>("pages", 4);
+    memory_space *words = new memory_space_impl<32>("words", 4);
+    for (unsigned i = 0; i < 16 * 1024; i++) {
+      unsigned val = i * 2654435761u;
+      pages->write_only((i * 4) % 8192, (i * 4) / 8192 * 3, 4, &val);
+      words->write_only((i * 4) % 32, (i * 4) / 32, 4, &val);
+    }
+    pages->load_block(100, NULL);
+    std::vector<unsigned char> blob(1000, 7);
+
+    checkpoint_image_writer writer;
+    writer.open("memory_unit_test.img", compress);
+    writer.add_memory("pages", pages);
+    writer.add_blob("blob", blob.data(), blob.size());
+    writer.add_memory("words", words);
+    writer.close();
+
+    checkpoint_image_reader reader;
+    memory_space *pages2 = new memory_space_impl<8192>("pages", 4);
+    memory_space *words2 = new memory_space_impl<32>("words", 4);
+    std::vector<unsigned char> blob2;
+    if (!reader.open("memory_unit_test.img") ||
+        !reader.load_memory("pages", pages2) ||
+        !reader.load_memory("words", words2) ||
+        !reader.load_blob("blob", blob2) || blob2 != blob ||
+        reader.load_memory("words", pages2)) {
+      errors_found = 1;
+      printf("ERROR ** checkpoint image (compress=%d) sections\n", compress);
+    }
+
+    memory_space *orig[2] = {pages, words};
+    memory_space *restored[2] = {pages2, words2};
+    for (unsigned m = 0; m < 2; m++) {
+      std::vector<std::pair<mem_addr_t, const unsigned char *> > a, b;
+      orig[m]->get_blocks(a);
+      restored[m]->get_blocks(b);
+      bool same = a.size() == b.size();
+      for (unsigned i = 0; same && i < a.size(); i++)
+        same = a[i].first == b[i].first &&
+               memcmp(a[i].second, b[i].second, orig[m]->block_size()) == 0;
+      if (!same) {
+        errors_found = 1;
+        printf("ERROR ** checkpoint image (compress=%d) space %u differs\n",
+               compress, m);
+      }
+    }
+
+    // mapped blocks are copy-on-write, the image itself stays unchanged
+    unsigned val = 0xdeadbeef;
+    pages2->write_only(0, 0, 4, &val);
+    memory_space *pages3 = new memory_space_impl<8192>("pages", 4);
+    reader.load_memory("pages", pages3);
+    std::vector<std::pair<mem_addr_t, const unsigned char *> > c;
+    pages3->get_blocks(c);
+    if (c.empty() || memcmp(c[0].second, &val, 4) == 0) {
+      errors_found = 1;
+      printf("ERROR ** checkpoint image (compress=%d) written through\n",
+             compress);
+    }
+    unlink("memory_unit_test.img");
+  }
+
+  // small blobs share blob pack sections, the last blob of a name wins
+  for (int compress = 0; compress < 2; compress++) {
+    std::vector<std::vector<unsigned char> > blobs(300);
+    for (unsigned i = 0; i < blobs.size(); i++)
+      for (unsigned j = 0; j < 40 + i % 200; j++)
+        blobs[i].push_back((unsigned char)(i * 31 + j * (compress ? 0 : 7)));
+    std::vector<unsigned char> large(3 * 4096, 5), empty, zeros(64, 0);
+
+    checkpoint_image_writer writer;
+    writer.open("memory_unit_test.img", compress);
+    char name[64];
+    for (unsigned i = 0; i < blobs.size(); i++) {
+      snprintf(name, sizeof(name), "thread_%u_0_reg", i);
+      writer.add_blob(name, blobs[i].data(), blobs[i].size());
+      if (i == 150) writer.flush();
+    }
+    writer.add_blob("thread_7_0_reg", zeros.data(), zeros.size());
+    writer.add_blob("warp_0_0_simt", blobs[0].data(), blobs[0].size());
+    writer.add_blob("warp_0_0_simt", large.data(), large.size());
+    writer.add_blob("empty", empty.data(), empty.size());
+    writer.close();
+    uint64_t bytes = writer.bytes();
+
+    checkpoint_image_reader reader;
+    bool ok = reader.open("memory_unit_test.img");
+    std::vector<unsigned char> out;
+    for (unsigned i = 0; ok && i < blobs.size(); i++) {
+      snprintf(name, sizeof(name), "thread_%u_0_reg", i);
+      ok = reader.load_blob(name, out) && out == (i == 7 ? zeros : blobs[i]);
+    }
+    ok = ok && reader.load_blob("warp_0_0_simt", out) && out == large &&
+         reader.load_blob("empty", out) && out.empty() &&
+         reader.has_section("thread_0_0_reg") &&
+         !reader.load_blob("thread_300_0_reg", out);
+    // two packs and one page-sized blob, not a section per blob
+    if (!ok || bytes > 32 * 4096) {
+      errors_found = 1;
+      printf("ERROR ** checkpoint image (compress=%d) blob pack, %llu bytes\n",
+             compress, (unsigned long long)bytes);
+    }
+    unlink("memory_unit_test.img");
+  }
+
+  benchmark_node_fetch(argc > 1 ? argv[1] : NULL);
+
   if (errors_found) {
     printf("SUMMARY:  ERRORS FOUND\n");
   } else {
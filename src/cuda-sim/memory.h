@@ -32,19 +32,15 @@
 #include "../abstract_hardware_model.h"
 
 #include "../tr1_hash_map.h"
-#define mem_map tr1_hash_map
-#if tr1_hash_map_ismap == 1
-#define MEM_MAP_RESIZE(hash_size)
-#else
-#define MEM_MAP_RESIZE(hash_size) (m_data.rehash(hash_size))
-#endif
 
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <bitset>
 #include <map>
 #include <string>
+#include <vector>
 
 typedef address_type mem_addr_t;
 
@@ -52,42 +48,90 @@ typedef address_type mem_addr_t;
 #define VULKAN_ADDR_BLK 16
 #define VULKAN_ADDR_LOG2_BLK 4
 
+// Bytes covered by one leaf of the page table when blocks are page sized
+#define MEM_LARGE_PAGE_SIZE (2 * 1024 * 1024)
+
+template <unsigned N>
+struct mem_log2 {
+  static const unsigned value = 1 + mem_log2<N / 2>::value;
+};
+template <>
+struct mem_log2<1> {
+  static const unsigned value = 0;
+};
+
+// Block storage of a memory space: a radix tree over the block index. The tree
+// grows upwards as higher addresses are touched, interior nodes have 512
+// children and each leaf holds the block pointers of one page.
+//
+// With page sized blocks (4KB and up) a leaf covers a 2MB large page backed by
+// one contiguous slab, so accesses that span blocks within a large page are a
+// single memcpy. The slab comes from calloc, which maps it lazily, so only the
+// touched blocks cost memory. Small blocks (per-thread local memory) use 64
+// block leaves with blocks allocated one at a time, keeping idle spaces cheap.
+//
+// Blocks that were never written are absent and read as zeros. A block can
+// also be pointed at memory owned elsewhere (map_block), e.g. a page of a
+// privately mapped checkpoint image, which has to outlive the table.
 template <unsigned BSIZE>
-class mem_storage {
+class mem_page_table {
  public:
-  mem_storage(const mem_storage &another) {
-    m_data = (unsigned char *)calloc(1, BSIZE);
-    memcpy(m_data, another.m_data, BSIZE);
+  static const bool LARGE_PAGES = BSIZE >= 4096;
+  static const unsigned LEAF_BITS =
+      LARGE_PAGES && BSIZE < MEM_LARGE_PAGE_SIZE
+          ? mem_log2<MEM_LARGE_PAGE_SIZE / BSIZE>::value
+          : 6;
+  static const unsigned LEAF_SIZE = 1u << LEAF_BITS;
+  static const unsigned NODE_BITS = 9;
+  static const unsigned NODE_SIZE = 1u << NODE_BITS;
+
+  mem_page_table() : m_root(NULL), m_height(0), m_num_blocks(0) {}
+  ~mem_page_table() { clear(); }
+
+  // NULL if the block was never written
+  const unsigned char *block(mem_addr_t index) const {
+    const leaf *l = find_leaf(index);
+    return l ? l->blocks[index & (LEAF_SIZE - 1)] : NULL;
   }
-  mem_storage() { m_data = (unsigned char *)calloc(1, BSIZE); }
-  ~mem_storage() { free(m_data); }
+  // Allocates the block (zero filled) on first use
+  unsigned char *block_for_write(mem_addr_t index);
 
-  void write(unsigned offset, size_t length, const unsigned char *data) {
-    assert(offset + length <= BSIZE);
-    memcpy(m_data + offset, data, length);
-  }
-
-  void read(unsigned offset, size_t length, unsigned char *data) const {
-    assert(offset + length <= BSIZE);
-    memcpy(data, m_data + offset, length);
-  }
+  void read(mem_addr_t addr, size_t length, unsigned char *data) const;
+  void write(mem_addr_t addr, size_t length, const unsigned char *data);
 
-  void print(const char *format, FILE *fout) const {
-    unsigned int *i_data = (unsigned int *)m_data;
-    for (int d = 0; d < (BSIZE / sizeof(unsigned int)); d++) {
-      if (d % 1 == 0) {
-        fprintf(fout, "\n");
-      }
-      fprintf(fout, format, i_data[d]);
-      fprintf(fout, " ");
-    }
-    fprintf(fout, "\n");
-    fflush(fout);
-  }
+  void map_block(mem_addr_t index, unsigned char *data);
+  unsigned num_blocks() const { return m_num_blocks; }
+  // Present blocks in block index order
+  void get_blocks(
+      std::vector<std::pair<mem_addr_t, const unsigned char *> > &blocks)
+      const;
+  void clear();
 
  private:
-  unsigned m_nbytes;
-  unsigned char *m_data;
+  mem_page_table(const mem_page_table &);
+  mem_page_table &operator=(const mem_page_table &);
+
+  struct leaf {
+    unsigned char *blocks[LEAF_SIZE];
+    unsigned char *slab;  // LEAF_SIZE * BSIZE bytes, large pages only
+    bool contiguous;      // no block of this leaf has been mapped elsewhere
+    std::bitset<LEAF_SIZE> mapped;
+  };
+  struct node {
+    void *child[NODE_SIZE];
+  };
+
+  const leaf *find_leaf(mem_addr_t index) const;
+  leaf *get_leaf(mem_addr_t index);
+  void free_subtree(void *p, unsigned height);
+  void collect_blocks(
+      const void *p, unsigned height, mem_addr_t first_page,
+      std::vector<std::pair<mem_addr_t, const unsigned char *> > &blocks)
+      const;
+
+  void *m_root;       // a leaf when m_height is 0
+  unsigned m_height;  // interior levels above the leaves
+  unsigned m_num_blocks;
 };
 
 class ptx_thread_info;
@@ -104,6 +148,16 @@ class memory_space {
   virtual void print(const char *format, FILE *fout) const = 0;
   virtual void set_watch(addr_t addr, unsigned watchpoint) = 0;
   virtual void bind_vulkan_buffer(void* bufferAddr, unsigned bufferSize, void* devPtr) = 0;
+
+  // Block level access for checkpoint images: the allocated blocks in block
+  // index order, and restoring a block either from a copy of its contents
+  // (NULL for all zeros) or by pointing it at memory that outlives this space
+  virtual unsigned block_size() const = 0;
+  virtual void get_blocks(
+      std::vector<std::pair<mem_addr_t, const unsigned char *> > &blocks)
+      const = 0;
+  virtual void load_block(mem_addr_t index, const void *data) = 0;
+  virtual void map_block(mem_addr_t index, unsigned char *data) = 0;
 };
 
 template <unsigned BSIZE>
@@ -121,14 +175,17 @@ class memory_space_impl : public memory_space {
   virtual void set_watch(addr_t addr, unsigned watchpoint);
   virtual void bind_vulkan_buffer(void* bufferAddr, unsigned bufferSize, void* devPtr);
 
+  virtual unsigned block_size() const { return BSIZE; }
+  virtual void get_blocks(
+      std::vector<std::pair<mem_addr_t, const unsigned char *> > &blocks) const;
+  virtual void load_block(mem_addr_t index, const void *data);
+  virtual void map_block(mem_addr_t index, unsigned char *data);
+
  private:
-  void read_single_block(mem_addr_t blk_idx, mem_addr_t addr, size_t length,
-                         void *data) const;
   void* find_vulkan_buffer(mem_addr_t addr) const;
   std::string m_name;
   unsigned m_log2_block_size;
-  typedef mem_map<mem_addr_t, mem_storage<BSIZE> > map_t;
-  map_t m_data;
+  mem_page_table<BSIZE> m_data;
   std::map<unsigned, mem_addr_t> m_watchpoints;
   std::map<void*, void*> m_vulkan_address_map;
 };
@@ -648,6 +648,7 @@ void function_info::do_pdom() {
     // printf("########## decoding line %d\n", pI->source_line());
     pI->pre_decode();
   }
+  decode_instructions();
   printf("GPGPU-Sim PTX: ... done pre-decoding instructions for \'%s\'.\n",
          m_name.c_str());
   fflush(stdout);
@@ -188,6 +188,8 @@ class symbol {
     m_is_func_addr = false;
     m_reg_num_valid = false;
     m_function = NULL;
+    m_reg_slot_func = NULL;
+    m_reg_slot = (unsigned)-1;
     m_reg_num = (unsigned)-1;
     m_arch_reg_num = (unsigned)-1;
     m_address = (unsigned)-1;
@@ -217,6 +219,14 @@ class symbol {
     m_reg_num = regno;
     m_arch_reg_num = arch_regno;
   }
+  // Index into the flat register frame of the function declaring this
+  // register, see function_info::add_reg_slot
+  void set_reg_slot(const function_info *func, unsigned slot) {
+    m_reg_slot_func = func;
+    m_reg_slot = slot;
+  }
+  const function_info *reg_slot_func() const { return m_reg_slot_func; }
+  unsigned reg_slot() const { return m_reg_slot; }
 
   void set_address(addr_t addr) {
     m_address_valid = true;
@@ -295,6 +305,8 @@ class symbol {
   unsigned m_reg_num;
   unsigned m_arch_reg_num;
   bool m_reg_num_valid;
+  const function_info *m_reg_slot_func;  // NULL if not slot indexed
+  unsigned m_reg_slot;
 
   std::list<operand_info> m_initializer;
 };
@@ -761,6 +773,7 @@ class operand_info {
     m_is_return_var = 0;
     m_is_non_arch_reg = 0;
     m_vector_reg_dim_mod = -1;
+    m_plain_reg = NULL;
   }
   void make_memory_operand() { m_type = memory_t; }
   void set_return() { m_is_return_var = true; }
@@ -961,6 +974,17 @@ class operand_info {
   addr_t get_const_mem_offset() const { return m_const_mem_offset; }
   bool is_non_arch_reg() const { return m_is_non_arch_reg; }
 
+  // The register read by get_operand_value when the operand is a register
+  // with no offset, half select or negation, NULL otherwise. Resolved once at
+  // load time by function_info::decode_instructions.
+  void resolve_plain_reg() {
+    m_plain_reg = NULL;
+    if (m_double_operand_type == 0 && m_addr_space == undefined_space &&
+        m_operand_lohi == 0 && !m_operand_neg && is_reg())
+      m_plain_reg = m_value.m_symbolic;
+  }
+  const symbol *get_plain_reg() const { return m_plain_reg; }
+
  private:
   gpgpu_context *gpgpu_ctx;
   unsigned m_uid;
@@ -993,6 +1017,7 @@ class operand_info {
   bool m_is_non_arch_reg;
 
   int m_vector_reg_dim_mod;
+  const symbol *m_plain_reg;
 
   unsigned get_uid();
 };
@@ -1360,6 +1385,25 @@ class param_info {
   memory_space_t m_ptr_space;
 };
 
+class core_t;
+typedef void (*ptx_exec_fn)(const ptx_instruction *pI, ptx_thread_info *thread);
+typedef void (*ptx_warp_exec_fn)(const ptx_instruction *pI, core_t *core,
+                                 warp_inst_t &inst);
+
+// What ptx_thread_info::ptx_exec_inst needs from an instruction, resolved once
+// per function (function_info::decode_instructions) instead of per lane
+struct ptx_decoded_inst {
+  const ptx_instruction *pI;
+  ptx_exec_fn exec;            // per thread implementation from opcodes.def
+  ptx_warp_exec_fn warp_exec;  // OP_W_DEF implementations, exec is NULL
+  int classification;
+  unsigned size;
+  bool has_pred;
+  const symbol *pred_reg;  // plain predicate register, NULL needs get_operand_value
+  bool warp_sync;          // tensor core op, executed by lane 0 only
+  bool is_exit;
+};
+
 class function_info {
  public:
   function_info(int entry_point, gpgpu_context *ctx);
@@ -1423,6 +1467,13 @@ class function_info {
   unsigned get_function_size() { return m_instructions.size(); }
 
   void ptx_assemble();
+  void decode_instructions();
+  const ptx_decoded_inst &get_decoded_inst(unsigned PC) {
+    if (m_decoded_insts.empty()) decode_instructions();
+    unsigned index = PC - m_start_PC;
+    assert(index < m_decoded_insts.size() && m_decoded_insts[index].pI);
+    return m_decoded_insts[index];
+  }
 
   unsigned ptx_get_inst_op(ptx_thread_info *thread);
   void add_param(const char *name, struct param_t value) {
@@ -1446,6 +1497,26 @@ class function_info {
   }
   bool has_return() const { return m_return_var_sym != NULL; }
   const symbol *get_return_var() const { return m_return_var_sym; }
+
+  // Registers declared by this function get dense slot indices at load time,
+  // so a call frame can hold them in a flat array (see ptx_reg_frame)
+  void add_reg_slot(symbol *reg) {
+    reg->set_reg_slot(this, m_reg_slot_symbols.size());
+    m_reg_slot_by_name.insert(
+        std::make_pair(reg->name(), (unsigned)m_reg_slot_symbols.size()));
+    m_reg_slot_symbols.push_back(reg);
+  }
+  unsigned num_reg_slots() const { return m_reg_slot_symbols.size(); }
+  const symbol *get_reg_slot_symbol(unsigned slot) const {
+    assert(slot < m_reg_slot_symbols.size());
+    return m_reg_slot_symbols[slot];
+  }
+  // Slot of the first register declared with this name, -1 if there is none
+  int find_reg_slot(const std::string &name) const {
+    std::map<std::string, unsigned>::const_iterator it =
+        m_reg_slot_by_name.find(name);
+    return it == m_reg_slot_by_name.end() ? -1 : (int)it->second;
+  }
   const ptx_instruction *get_instruction(unsigned PC) const {
     unsigned index = PC - m_start_PC;
     if (index < m_instr_mem_size) return m_instr_mem[index];
@@ -1552,6 +1623,7 @@ char* readfile(const std::string filename) {
   bool pdom_done;  // flag to check whether pdom is completed or not
   std::string m_name;
   ptx_instruction **m_instr_mem;
+  std::vector<ptx_decoded_inst> m_decoded_insts;  // indexed like m_instr_mem
   unsigned m_start_PC;
   unsigned m_instr_mem_size;
   std::map<std::string, param_t> m_kernel_params;
@@ -1559,6 +1631,8 @@ char* readfile(const std::string filename) {
   std::vector<std::pair<size_t, unsigned> > m_param_configs;
   const symbol *m_return_var_sym;
   std::vector<const symbol *> m_args;
+  std::vector<const symbol *> m_reg_slot_symbols;
+  std::map<std::string, unsigned> m_reg_slot_by_name;
   std::list<ptx_instruction *> m_instructions;
   std::vector<basic_block_t *> m_basic_blocks;
   std::list<std::pair<unsigned, unsigned> > m_back_edges;
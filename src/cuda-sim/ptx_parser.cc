@@ -385,6 +385,8 @@ void ptx_recognizer::add_identifier(const char *identifier, int array_dim,
         arch_regnum = 0;
       }
       g_last_symbol->set_regno(regnum, arch_regnum);
+      if (g_func_info && g_current_symbol_table != g_global_symbol_table)
+        g_func_info->add_reg_slot(g_last_symbol);
     } break;
     case shared_space:
       printf("GPGPU-Sim PTX: allocating shared region for \"%s\" ", identifier);
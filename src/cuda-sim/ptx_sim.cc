@@ -176,7 +176,7 @@ ptx_thread_info::ptx_thread_info(kernel_info_t &kernel) : m_kernel(kernel) {
   m_hw_sid = -1;
   m_last_dram_callback.function = NULL;
   m_last_dram_callback.instruction = NULL;
-  m_regs.push_back(reg_map_t());
+  m_regs.push_back(ptx_reg_frame());
   m_debug_trace_regs_modified.push_back(reg_map_t());
   m_debug_trace_regs_read.push_back(reg_map_t());
   m_callstack.push_back(stack_entry());
@@ -187,6 +187,8 @@ ptx_thread_info::ptx_thread_info(kernel_info_t &kernel) : m_kernel(kernel) {
   m_local_mem_stack_pointer = 0;
   m_gpu = NULL;
   m_last_set_operand_value = ptx_reg_t();
+  m_exec_warp_inst = NULL;
+  m_rt_trace_deferred = false;
   
   RT_thread_data = new Vulkan_RT_thread_data;
 }
@@ -418,7 +420,7 @@ void ptx_thread_info::callstack_push(unsigned pc, unsigned rpc,
   assert(m_func_info != NULL);
   m_callstack.push_back(stack_entry(m_symbol_table, m_func_info, pc, rpc,
                                     return_var_src, return_var_dst, call_uid));
-  m_regs.push_back(reg_map_t());
+  m_regs.push_back(ptx_reg_frame());
   m_debug_trace_regs_modified.push_back(reg_map_t());
   m_debug_trace_regs_read.push_back(reg_map_t());
   m_local_mem_stack_pointer += m_func_info->local_mem_framesize();
@@ -512,14 +514,14 @@ bool ptx_thread_info::callstack_pop_plus() {
 
 void ptx_thread_info::dump_callstack() const {
   std::list<stack_entry>::const_iterator c = m_callstack.begin();
-  std::list<reg_map_t>::const_iterator r = m_regs.begin();
+  std::list<ptx_reg_frame>::const_iterator r = m_regs.begin();
 
   printf("\n\n");
   printf("Call stack for thread uid = %u (sc=%u, hwtid=%u)\n", m_uid, m_hw_sid,
          m_hw_tid);
   while (c != m_callstack.end() && r != m_regs.end()) {
     const stack_entry &c_e = *c;
-    const reg_map_t &regs = *r;
+    const ptx_reg_frame &regs = *r;
     if (!c_e.m_valid) {
       printf("  <entry>                              #regs = %zu\n",
              regs.size());
@@ -558,8 +560,10 @@ void ptx_thread_info::dump_regs(FILE *fp) {
   if (m_regs.back().empty()) return;
   fprintf(fp, "Register File Contents:\n");
   fflush(fp);
+  reg_map_t regs;
+  m_regs.back().get_all(regs);
   reg_map_t::const_iterator r;
-  for (r = m_regs.back().begin(); r != m_regs.back().end(); ++r) {
+  for (r = regs.begin(); r != regs.end(); ++r) {
     const symbol *sym = r->first;
     ptx_reg_t value = r->second;
     std::string name = sym->name();
@@ -570,14 +574,9 @@ void ptx_thread_info::dump_regs(FILE *fp) {
 ptx_reg_t ptx_thread_info::get_reg(std::string regName) {
   assert(!m_regs.empty());
   assert(!m_regs.back().empty());
-  reg_map_t::const_iterator r;
-  for (r = m_regs.back().begin(); r != m_regs.back().end(); ++r) {
-    const symbol *sym = r->first;
-    ptx_reg_t value = r->second;
-    std::string name = sym->name();
-    if(name == regName)
-      return value;
-  }
+  const ptx_reg_t *value = m_regs.back().find(regName);
+  assert(value != NULL);
+  return value ? *value : ptx_reg_t();
 }
 
 void ptx_thread_info::dump_modifiedregs(FILE *fp) {
@@ -40,6 +40,7 @@
 #include <map>
 #include <set>
 #include <string>
+#include <vector>
 
 #include "memory.h"
 
@@ -190,6 +191,7 @@ class ptx_warp_info {
 };
 
 class symbol;
+struct ptx_decoded_inst;
 
 struct stack_entry {
   stack_entry() {
@@ -225,6 +227,52 @@ struct stack_entry {
   unsigned m_call_uid;
 };
 
+// Register values of one call frame. Registers of the function the frame
+// belongs to live in a flat array indexed by symbol::reg_slot(); anything
+// else (registers of another function sharing the frame in ptxplus mode,
+// non-register symbols) falls back to a hash map. The frame adopts the
+// function of the first slot indexed register it sees.
+class ptx_reg_frame {
+ public:
+  typedef tr1_hash_map<const symbol *, ptx_reg_t> reg_map_t;
+
+  ptx_reg_frame() : m_func(NULL), m_num_defined(0) {}
+
+  // NULL if the register has not been written in this frame
+  ptx_reg_t *find(const symbol *reg);
+  // By register name, without building the whole map
+  const ptx_reg_t *find(const std::string &name) const;
+  // Value-initializes the register if it has not been written yet
+  ptx_reg_t &operator[](const symbol *reg);
+
+  unsigned size() const { return m_num_defined + m_overflow.size(); }
+  bool empty() const { return size() == 0; }
+
+  // Every defined register as a map, for the debug and checkpoint paths
+  void get_all(reg_map_t &regs) const;
+
+  // -ptx_reg_slots, off keeps every register in the hash map
+  static void set_slots_enabled(bool enabled) { s_slots_enabled = enabled; }
+
+  // Times register reads and writes through flat frames against reg_map_t
+  // alone: n_threads frames of a function with n_regs registers, every
+  // instruction reading two registers and writing a third in each thread of
+  // a warp, as get_reg/set_reg do
+  static void benchmark(FILE *fp, gpgpu_context *ctx, unsigned n_regs,
+                        unsigned n_threads, unsigned n_instructions);
+
+ private:
+  bool adopt(const symbol *reg);
+
+  const function_info *m_func;
+  std::vector<ptx_reg_t> m_slots;
+  std::vector<unsigned char> m_slot_defined;
+  unsigned m_num_defined;
+  reg_map_t m_overflow;
+
+  static bool s_slots_enabled;
+};
+
 class ptx_version {
  public:
   ptx_version() {
@@ -308,15 +356,32 @@ class ptx_thread_info {
 
   void ptx_fetch_inst(inst_t &inst) const;
   void ptx_exec_inst(warp_inst_t &inst, unsigned lane_id);
+  // Same, with the decoded instruction at next_instr() looked up by the caller
+  // so a warp can share one lookup across its lanes
+  void ptx_exec_inst(warp_inst_t &inst, unsigned lane_id,
+                     const ptx_decoded_inst &decoded);
+  const ptx_decoded_inst &get_decoded_inst(addr_t pc);
+  // Warp instruction being executed, for the warp wide opcodes (vote, activemask)
+  const warp_inst_t &exec_warp_inst() const {
+    assert(m_exec_warp_inst);
+    return *m_exec_warp_inst;
+  }
 
   const ptx_version &get_ptx_version() const;
   void set_reg(const symbol *reg, const ptx_reg_t &value);
   void print_reg_thread(char *fname);
   void resume_reg_thread(char *fname, symbol_table *symtab);
   ptx_reg_t get_reg(const symbol *reg);
-  ptx_reg_t get_operand_value(const operand_info &op, operand_info dstInfo,
+  ptx_reg_t get_operand_value(const operand_info &op,
+                              const operand_info &dstInfo,
                               unsigned opType, ptx_thread_info *thread,
                               int derefFlag);
+  // Times n_reads register operand reads through get_operand_value, for a
+  // function with n_regs registers, resolved at load time against classified
+  // on every read with the destination copied, as before. Runs in a scratch
+  // call frame pushed on this thread.
+  void benchmark_operands(FILE *fp, gpgpu_context *ctx, unsigned n_regs,
+                          unsigned n_reads);
   void set_operand_value(const operand_info &dst, const ptx_reg_t &data,
                          unsigned type, ptx_thread_info *thread,
                          const ptx_instruction *pI);
@@ -491,6 +556,14 @@ class ptx_thread_info {
   void set_txl_transactions(ImageMemoryTransactionRecord transactions);
   void add_ray_intersect() { m_num_ray_intersections += 1; }
   void add_ray_properties(Ray ray) { m_ray = ray; }
+  // trace_ray queued this thread's walk, its results reach the warp instruction once the batch is flushed
+  void set_rt_trace_deferred(bool deferred) { m_rt_trace_deferred = deferred; }
+  bool rt_trace_deferred() const { return m_rt_trace_deferred; }
+  void copy_rt_results(warp_inst_t &inst, unsigned lane_id) {
+    inst.set_rt_mem_transactions(lane_id, RT_transactions);
+    inst.set_rt_mem_store_transactions(lane_id, RT_store_transactions);
+    inst.set_rt_ray_properties(lane_id, m_ray);
+  }
 
  public:
   addr_t m_last_effective_address;
@@ -544,16 +617,18 @@ class ptx_thread_info {
   std::list<stack_entry> m_callstack;
   unsigned m_local_mem_stack_pointer;
 
-  typedef tr1_hash_map<const symbol *, ptx_reg_t> reg_map_t;
-  std::list<reg_map_t> m_regs;
+  typedef ptx_reg_frame::reg_map_t reg_map_t;
+  std::list<ptx_reg_frame> m_regs;
   std::list<reg_map_t> m_debug_trace_regs_modified;
   std::list<reg_map_t> m_debug_trace_regs_read;
   bool m_enable_debug_trace;
 
   std::stack<class operand_info, std::vector<operand_info> > m_breakaddrs;
+  const warp_inst_t *m_exec_warp_inst;
   
   unsigned m_num_ray_intersections;
   Ray m_ray;
+  bool m_rt_trace_deferred;
 };
 
 addr_t generic_to_local(unsigned smid, unsigned hwtid, addr_t addr);
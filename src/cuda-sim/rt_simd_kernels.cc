@@ -0,0 +1,601 @@
+// Copyright (c) 2022, Mohammadreza Saed, Yuan Hsi Chou, Lufei Liu, Tor M. Aamodt,
+// The University of British Columbia
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+// Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution. Neither the name of
+// The University of British Columbia nor the names of its contributors may be
+// used to endorse or promote products derived from this software without
+// specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "rt_simd_kernels.h"
+#include "../gpgpu-sim/vector-math.h"
+
+#include <math.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define RT_SIMD_X86 1
+#include <immintrin.h>
+#else
+#define RT_SIMD_X86 0
+#endif
+
+const unsigned rt_simd_kernels::LANES;
+rt_simd_isa rt_simd_kernels::s_isa = RT_SIMD_SCALAR;
+bool rt_simd_kernels::s_check = false;
+
+bool mt_ray_triangle_test(float3 p0, float3 p1, float3 p2, float3 origin, float3 direction, float *thit)
+{
+    // Moller Trumbore algorithm (from scratchapixel.com)
+    float3 v0v1 = p1 - p0;
+    float3 v0v2 = p2 - p0;
+    float3 pvec = cross(direction, v0v2);
+    float det = dot(v0v1, pvec);
+
+    float idet = 1 / det;
+
+    float3 tvec = origin - p0;
+    float u = dot(tvec, pvec) * idet;
+
+    if (u < 0 || u > 1) return false;
+
+    float3 qvec = cross(tvec, v0v1);
+    float v = dot(direction, qvec) * idet;
+
+    if (v < 0 || (u + v) > 1) return false;
+
+    *thit = dot(v0v2, qvec) * idet;
+    return true;
+}
+
+// Same NaN behaviour as the MIN/MAX macros in vulkan_ray_tracing.h, and as minps/maxps
+static inline float rt_min(float a, float b) { return a < b ? a : b; }
+static inline float rt_max(float a, float b) { return a > b ? a : b; }
+
+
+static unsigned ray_box_test_scalar(const rt_child_bounds &b, unsigned lane_mask, float3 idir, float3 origin,
+                                    float tmin, float tmax, float *thit)
+{
+    unsigned hits = 0;
+    for (unsigned i = 0; i < rt_simd_kernels::LANES; i++)
+    {
+        if (!(lane_mask & (1u << i)))
+            continue;
+
+        // get_t_bound, then magic_max7 / magic_min7
+        float lo_x = (b.lo_x[i] - origin.x) * idir.x;
+        float lo_y = (b.lo_y[i] - origin.y) * idir.y;
+        float lo_z = (b.lo_z[i] - origin.z) * idir.z;
+        float hi_x = (b.hi_x[i] - origin.x) * idir.x;
+        float hi_y = (b.hi_y[i] - origin.y) * idir.y;
+        float hi_z = (b.hi_z[i] - origin.z) * idir.z;
+
+        float t_enter = rt_max(rt_min(lo_x, hi_x), tmin);
+        t_enter = rt_max(rt_min(lo_y, hi_y), t_enter);
+        t_enter = rt_max(rt_min(lo_z, hi_z), t_enter);
+        float t_exit = rt_min(rt_max(lo_x, hi_x), tmax);
+        t_exit = rt_min(rt_max(lo_y, hi_y), t_exit);
+        t_exit = rt_min(rt_max(lo_z, hi_z), t_exit);
+
+        thit[i] = t_enter;
+        if (t_enter <= t_exit)
+            hits |= 1u << i;
+    }
+    return hits;
+}
+
+static unsigned ray_triangle_test_scalar(const rt_triangle_batch &t, unsigned lane_mask, float3 origin, float3 dir,
+                                         float *thit)
+{
+    unsigned hits = 0;
+    for (unsigned i = 0; i < rt_simd_kernels::LANES; i++)
+    {
+        if (!(lane_mask & (1u << i)))
+            continue;
+
+        // Operand order follows cross() and dot() in vector-math.cc
+        float e1_x = t.p1_x[i] - t.p0_x[i], e1_y = t.p1_y[i] - t.p0_y[i], e1_z = t.p1_z[i] - t.p0_z[i];
+        float e2_x = t.p2_x[i] - t.p0_x[i], e2_y = t.p2_y[i] - t.p0_y[i], e2_z = t.p2_z[i] - t.p0_z[i];
+        float p_x = dir.y * e2_z - dir.z * e2_y;
+        float p_y = dir.z * e2_x - dir.x * e2_z;
+        float p_z = dir.x * e2_y - dir.y * e2_x;
+        float det = e1_x * p_x + e1_y * p_y + e1_z * p_z;
+        float idet = 1 / det;
+
+        float t_x = origin.x - t.p0_x[i], t_y = origin.y - t.p0_y[i], t_z = origin.z - t.p0_z[i];
+        float u = (t_x * p_x + t_y * p_y + t_z * p_z) * idet;
+        if (u < 0 || u > 1)
+            continue;
+
+        float q_x = t_y * e1_z - t_z * e1_y;
+        float q_y = t_z * e1_x - t_x * e1_z;
+        float q_z = t_x * e1_y - t_y * e1_x;
+        float v = (dir.x * q_x + dir.y * q_y + dir.z * q_z) * idet;
+        if (v < 0 || (u + v) > 1)
+            continue;
+
+        thit[i] = (e2_x * q_x + e2_y * q_y + e2_z * q_z) * idet;
+        hits |= 1u << i;
+    }
+    return hits;
+}
+
+
+#if RT_SIMD_X86
+// Two 4-wide halves, the second one skipped for nodes with at most four children
+__attribute__((target("sse2")))
+static unsigned ray_box_test_sse(const rt_child_bounds &b, unsigned lane_mask, float3 idir, float3 origin,
+                                 float tmin, float tmax, float *thit)
+{
+    const __m128 o_x = _mm_set1_ps(origin.x), o_y = _mm_set1_ps(origin.y), o_z = _mm_set1_ps(origin.z);
+    const __m128 i_x = _mm_set1_ps(idir.x), i_y = _mm_set1_ps(idir.y), i_z = _mm_set1_ps(idir.z);
+    const __m128 t_min = _mm_set1_ps(tmin), t_max = _mm_set1_ps(tmax);
+
+    unsigned hits = 0;
+    for (unsigned base = 0; base < rt_simd_kernels::LANES; base += 4)
+    {
+        if (!((lane_mask >> base) & 0xf))
+            continue;
+
+        __m128 lo_x = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(b.lo_x + base), o_x), i_x);
+        __m128 lo_y = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(b.lo_y + base), o_y), i_y);
+        __m128 lo_z = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(b.lo_z + base), o_z), i_z);
+        __m128 hi_x = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(b.hi_x + base), o_x), i_x);
+        __m128 hi_y = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(b.hi_y + base), o_y), i_y);
+        __m128 hi_z = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(b.hi_z + base), o_z), i_z);
+
+        __m128 t_enter = _mm_max_ps(_mm_min_ps(lo_x, hi_x), t_min);
+        t_enter = _mm_max_ps(_mm_min_ps(lo_y, hi_y), t_enter);
+        t_enter = _mm_max_ps(_mm_min_ps(lo_z, hi_z), t_enter);
+        __m128 t_exit = _mm_min_ps(_mm_max_ps(lo_x, hi_x), t_max);
+        t_exit = _mm_min_ps(_mm_max_ps(lo_y, hi_y), t_exit);
+        t_exit = _mm_min_ps(_mm_max_ps(lo_z, hi_z), t_exit);
+
+        _mm_storeu_ps(thit + base, t_enter);
+        hits |= (unsigned)_mm_movemask_ps(_mm_cmple_ps(t_enter, t_exit)) << base;
+    }
+    return hits & lane_mask;
+}
+
+__attribute__((target("sse2")))
+static unsigned ray_triangle_test_sse(const rt_triangle_batch &t, unsigned lane_mask, float3 origin, float3 dir,
+                                      float *thit)
+{
+    const __m128 d_x = _mm_set1_ps(dir.x), d_y = _mm_set1_ps(dir.y), d_z = _mm_set1_ps(dir.z);
+    const __m128 o_x = _mm_set1_ps(origin.x), o_y = _mm_set1_ps(origin.y), o_z = _mm_set1_ps(origin.z);
+    const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+
+    unsigned hits = 0;
+    for (unsigned base = 0; base < rt_simd_kernels::LANES; base += 4)
+    {
+        if (!((lane_mask >> base) & 0xf))
+            continue;
+
+        __m128 p0_x = _mm_loadu_ps(t.p0_x + base), p0_y = _mm_loadu_ps(t.p0_y + base), p0_z = _mm_loadu_ps(t.p0_z + base);
+        __m128 e1_x = _mm_sub_ps(_mm_loadu_ps(t.p1_x + base), p0_x);
+        __m128 e1_y = _mm_sub_ps(_mm_loadu_ps(t.p1_y + base), p0_y);
+        __m128 e1_z = _mm_sub_ps(_mm_loadu_ps(t.p1_z + base), p0_z);
+        __m128 e2_x = _mm_sub_ps(_mm_loadu_ps(t.p2_x + base), p0_x);
+        __m128 e2_y = _mm_sub_ps(_mm_loadu_ps(t.p2_y + base), p0_y);
+        __m128 e2_z = _mm_sub_ps(_mm_loadu_ps(t.p2_z + base), p0_z);
+
+        __m128 p_x = _mm_sub_ps(_mm_mul_ps(d_y, e2_z), _mm_mul_ps(d_z, e2_y));
+        __m128 p_y = _mm_sub_ps(_mm_mul_ps(d_z, e2_x), _mm_mul_ps(d_x, e2_z));
+        __m128 p_z = _mm_sub_ps(_mm_mul_ps(d_x, e2_y), _mm_mul_ps(d_y, e2_x));
+        __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1_x, p_x), _mm_mul_ps(e1_y, p_y)), _mm_mul_ps(e1_z, p_z));
+        __m128 idet = _mm_div_ps(one, det);
+
+        __m128 t_x = _mm_sub_ps(o_x, p0_x), t_y = _mm_sub_ps(o_y, p0_y), t_z = _mm_sub_ps(o_z, p0_z);
+        __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(t_x, p_x), _mm_mul_ps(t_y, p_y)), _mm_mul_ps(t_z, p_z)), idet);
+
+        __m128 q_x = _mm_sub_ps(_mm_mul_ps(t_y, e1_z), _mm_mul_ps(t_z, e1_y));
+        __m128 q_y = _mm_sub_ps(_mm_mul_ps(t_z, e1_x), _mm_mul_ps(t_x, e1_z));
+        __m128 q_z = _mm_sub_ps(_mm_mul_ps(t_x, e1_y), _mm_mul_ps(t_y, e1_x));
+        __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(d_x, q_x), _mm_mul_ps(d_y, q_y)), _mm_mul_ps(d_z, q_z)), idet);
+        __m128 dist = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2_x, q_x), _mm_mul_ps(e2_y, q_y)), _mm_mul_ps(e2_z, q_z)), idet);
+
+        __m128 miss = _mm_or_ps(_mm_or_ps(_mm_cmplt_ps(u, zero), _mm_cmpgt_ps(u, one)),
+                                _mm_or_ps(_mm_cmplt_ps(v, zero), _mm_cmpgt_ps(_mm_add_ps(u, v), one)));
+        unsigned lane_hits = (~(unsigned)_mm_movemask_ps(miss) & 0xf & (lane_mask >> base));
+        if (lane_hits)
+        {
+            float lane_dist[4];
+            _mm_storeu_ps(lane_dist, dist);
+            for (unsigned i = 0; i < 4; i++)
+                if (lane_hits & (1u << i))
+                    thit[base + i] = lane_dist[i];
+            hits |= lane_hits << base;
+        }
+    }
+    return hits;
+}
+
+__attribute__((target("avx2")))
+static unsigned ray_box_test_avx2(const rt_child_bounds &b, unsigned lane_mask, float3 idir, float3 origin,
+                                  float tmin, float tmax, float *thit)
+{
+    const __m256 o_x = _mm256_set1_ps(origin.x), o_y = _mm256_set1_ps(origin.y), o_z = _mm256_set1_ps(origin.z);
+    const __m256 i_x = _mm256_set1_ps(idir.x), i_y = _mm256_set1_ps(idir.y), i_z = _mm256_set1_ps(idir.z);
+
+    __m256 lo_x = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(b.lo_x), o_x), i_x);
+    __m256 lo_y = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(b.lo_y), o_y), i_y);
+    __m256 lo_z = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(b.lo_z), o_z), i_z);
+    __m256 hi_x = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(b.hi_x), o_x), i_x);
+    __m256 hi_y = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(b.hi_y), o_y), i_y);
+    __m256 hi_z = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(b.hi_z), o_z), i_z);
+
+    __m256 t_enter = _mm256_max_ps(_mm256_min_ps(lo_x, hi_x), _mm256_set1_ps(tmin));
+    t_enter = _mm256_max_ps(_mm256_min_ps(lo_y, hi_y), t_enter);
+    t_enter = _mm256_max_ps(_mm256_min_ps(lo_z, hi_z), t_enter);
+    __m256 t_exit = _mm256_min_ps(_mm256_max_ps(lo_x, hi_x), _mm256_set1_ps(tmax));
+    t_exit = _mm256_min_ps(_mm256_max_ps(lo_y, hi_y), t_exit);
+    t_exit = _mm256_min_ps(_mm256_max_ps(lo_z, hi_z), t_exit);
+
+    _mm256_storeu_ps(thit, t_enter);
+    return (unsigned)_mm256_movemask_ps(_mm256_cmp_ps(t_enter, t_exit, _CMP_LE_OQ)) & lane_mask;
+}
+
+__attribute__((target("avx2")))
+static unsigned ray_triangle_test_avx2(const rt_triangle_batch &t, unsigned lane_mask, float3 origin, float3 dir,
+                                       float *thit)
+{
+    const __m256 d_x = _mm256_set1_ps(dir.x), d_y = _mm256_set1_ps(dir.y), d_z = _mm256_set1_ps(dir.z);
+    const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+
+    __m256 p0_x = _mm256_loadu_ps(t.p0_x), p0_y = _mm256_loadu_ps(t.p0_y), p0_z = _mm256_loadu_ps(t.p0_z);
+    __m256 e1_x = _mm256_sub_ps(_mm256_loadu_ps(t.p1_x), p0_x);
+    __m256 e1_y = _mm256_sub_ps(_mm256_loadu_ps(t.p1_y), p0_y);
+    __m256 e1_z = _mm256_sub_ps(_mm256_loadu_ps(t.p1_z), p0_z);
+    __m256 e2_x = _mm256_sub_ps(_mm256_loadu_ps(t.p2_x), p0_x);
+    __m256 e2_y = _mm256_sub_ps(_mm256_loadu_ps(t.p2_y), p0_y);
+    __m256 e2_z = _mm256_sub_ps(_mm256_loadu_ps(t.p2_z), p0_z);
+
+    __m256 p_x = _mm256_sub_ps(_mm256_mul_ps(d_y, e2_z), _mm256_mul_ps(d_z, e2_y));
+    __m256 p_y = _mm256_sub_ps(_mm256_mul_ps(d_z, e2_x), _mm256_mul_ps(d_x, e2_z));
+    __m256 p_z = _mm256_sub_ps(_mm256_mul_ps(d_x, e2_y), _mm256_mul_ps(d_y, e2_x));
+    __m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1_x, p_x), _mm256_mul_ps(e1_y, p_y)), _mm256_mul_ps(e1_z, p_z));
+    __m256 idet = _mm256_div_ps(one, det);
+
+    __m256 t_x = _mm256_sub_ps(_mm256_set1_ps(origin.x), p0_x);
+    __m256 t_y = _mm256_sub_ps(_mm256_set1_ps(origin.y), p0_y);
+    __m256 t_z = _mm256_sub_ps(_mm256_set1_ps(origin.z), p0_z);
+    __m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(t_x, p_x), _mm256_mul_ps(t_y, p_y)), _mm256_mul_ps(t_z, p_z)), idet);
+
+    __m256 q_x = _mm256_sub_ps(_mm256_mul_ps(t_y, e1_z), _mm256_mul_ps(t_z, e1_y));
+    __m256 q_y = _mm256_sub_ps(_mm256_mul_ps(t_z, e1_x), _mm256_mul_ps(t_x, e1_z));
+    __m256 q_z = _mm256_sub_ps(_mm256_mul_ps(t_x, e1_y), _mm256_mul_ps(t_y, e1_x));
+    __m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(d_x, q_x), _mm256_mul_ps(d_y, q_y)), _mm256_mul_ps(d_z, q_z)), idet);
+    __m256 dist = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2_x, q_x), _mm256_mul_ps(e2_y, q_y)), _mm256_mul_ps(e2_z, q_z)), idet);
+
+    __m256 miss = _mm256_or_ps(_mm256_or_ps(_mm256_cmp_ps(u, zero, _CMP_LT_OQ), _mm256_cmp_ps(u, one, _CMP_GT_OQ)),
+                               _mm256_or_ps(_mm256_cmp_ps(v, zero, _CMP_LT_OQ),
+                                            _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_GT_OQ)));
+    unsigned hits = ~(unsigned)_mm256_movemask_ps(miss) & lane_mask & 0xff;
+    if (hits)
+    {
+        float lane_dist[8];
+        _mm256_storeu_ps(lane_dist, dist);
+        for (unsigned i = 0; i < rt_simd_kernels::LANES; i++)
+            if (hits & (1u << i))
+                thit[i] = lane_dist[i];
+    }
+    return hits;
+}
+
+#define RT_SIMD_SSE_BOX ray_box_test_sse
+#define RT_SIMD_SSE_TRIANGLE ray_triangle_test_sse
+#define RT_SIMD_AVX2_BOX ray_box_test_avx2
+#define RT_SIMD_AVX2_TRIANGLE ray_triangle_test_avx2
+#else
+#define RT_SIMD_SSE_BOX ray_box_test_scalar
+#define RT_SIMD_SSE_TRIANGLE ray_triangle_test_scalar
+#define RT_SIMD_AVX2_BOX ray_box_test_scalar
+#define RT_SIMD_AVX2_TRIANGLE ray_triangle_test_scalar
+#endif
+
+const rt_simd_kernels::ray_box_fn rt_simd_kernels::s_ray_box_test[RT_SIMD_NUM_ISAS] = {
+    ray_box_test_scalar, RT_SIMD_SSE_BOX, RT_SIMD_AVX2_BOX};
+const rt_simd_kernels::ray_triangle_fn rt_simd_kernels::s_ray_triangle_test[RT_SIMD_NUM_ISAS] = {
+    ray_triangle_test_scalar, RT_SIMD_SSE_TRIANGLE, RT_SIMD_AVX2_TRIANGLE};
+
+
+rt_simd_isa rt_simd_kernels::detect()
+{
+#if RT_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return RT_SIMD_AVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return RT_SIMD_SSE;
+#endif
+    return RT_SIMD_SCALAR;
+}
+
+rt_simd_isa rt_simd_kernels::select(int requested)
+{
+    rt_simd_isa best = detect();
+    if (requested < 0 || requested > (int)best)
+        s_isa = best;
+    else
+        s_isa = (rt_simd_isa)requested;
+    return s_isa;
+}
+
+const char *rt_simd_kernels::isa_name(rt_simd_isa isa)
+{
+    switch (isa)
+    {
+    case RT_SIMD_SCALAR: return "scalar";
+    case RT_SIMD_SSE: return "sse";
+    case RT_SIMD_AVX2: return "avx2";
+    default: return "unknown";
+    }
+}
+
+
+// Small deterministic generator so the self test is reproducible
+static unsigned self_test_rand(unsigned long long &state)
+{
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return (unsigned)(state >> 32);
+}
+
+static float self_test_float(unsigned long long &state, float lo, float hi)
+{
+    return lo + (hi - lo) * (self_test_rand(state) / 4294967296.0f);
+}
+
+static float3 self_test_float3(float x, float y, float z)
+{
+    float3 v;
+    v.x = x;
+    v.y = y;
+    v.z = z;
+    return v;
+}
+
+static float3 self_test_idir(float3 dir)
+{
+    // Same clamping as calculate_idir
+    const float ooeps = exp2f(-80.0f);
+    float3 idir;
+    idir.x = 1.0f / (fabsf(dir.x) > ooeps ? dir.x : copysignf(ooeps, dir.x));
+    idir.y = 1.0f / (fabsf(dir.y) > ooeps ? dir.y : copysignf(ooeps, dir.y));
+    idir.z = 1.0f / (fabsf(dir.z) > ooeps ? dir.z : copysignf(ooeps, dir.z));
+    return idir;
+}
+
+bool rt_simd_kernels::self_test(FILE *fp, unsigned n_tests)
+{
+    if (n_tests == 0)
+        return true;
+
+    // Random rays against random boxes and triangles around the origin. Every
+    // 8th ray is axis aligned and every 16th triangle degenerate.
+    std::vector<float3> origins(n_tests), dirs(n_tests);
+    std::vector<rt_child_bounds> boxes(n_tests);
+    std::vector<rt_triangle_batch> tris(n_tests);
+    std::vector<unsigned> masks(n_tests);
+    unsigned long long state = 0x9e3779b97f4a7c15ull;
+    for (unsigned n = 0; n < n_tests; n++)
+    {
+        origins[n] = self_test_float3(self_test_float(state, -2, 2), self_test_float(state, -2, 2), self_test_float(state, -2, 2));
+        dirs[n] = self_test_float3(self_test_float(state, -1, 1), self_test_float(state, -1, 1), self_test_float(state, -1, 1));
+        if (n % 8 == 0)
+        {
+            unsigned axis = self_test_rand(state) % 3;
+            dirs[n] = self_test_float3(axis == 0 ? 1.0f : 0.0f, axis == 1 ? -1.0f : 0.0f, axis == 2 ? 1.0f : 0.0f);
+        }
+
+        float *box_lanes[6] = {boxes[n].lo_x, boxes[n].lo_y, boxes[n].lo_z, boxes[n].hi_x, boxes[n].hi_y, boxes[n].hi_z};
+        for (unsigned i = 0; i < LANES; i++)
+        {
+            for (unsigned axis = 0; axis < 3; axis++)
+            {
+                float a = self_test_float(state, -3, 3);
+                float b = self_test_float(state, -3, 3);
+                box_lanes[axis][i] = a < b ? a : b;
+                box_lanes[axis + 3][i] = a < b ? b : a;
+            }
+        }
+
+        float *tri_lanes[9] = {tris[n].p0_x, tris[n].p0_y, tris[n].p0_z, tris[n].p1_x, tris[n].p1_y,
+                               tris[n].p1_z, tris[n].p2_x, tris[n].p2_y, tris[n].p2_z};
+        for (unsigned i = 0; i < LANES; i++)
+        {
+            for (unsigned c = 0; c < 9; c++)
+                tri_lanes[c][i] = self_test_float(state, -3, 3);
+            if ((n * LANES + i) % 16 == 0)
+            {
+                for (unsigned c = 0; c < 3; c++)
+                    tri_lanes[c + 6][i] = tri_lanes[c + 3][i];
+            }
+        }
+        masks[n] = self_test_rand(state) % 2 ? 0x3f : (self_test_rand(state) & 0xff);
+    }
+
+    // Scalar results are the reference
+    std::vector<unsigned> ref_box_hits(n_tests), ref_tri_hits(n_tests);
+    std::vector<float> ref_box_thit(n_tests * LANES), ref_tri_thit(n_tests * LANES);
+    for (unsigned n = 0; n < n_tests; n++)
+    {
+        float3 idir = self_test_idir(dirs[n]);
+        ref_box_hits[n] = ray_box_test_scalar(boxes[n], masks[n], idir, origins[n], 0.0f, 10.0f, &ref_box_thit[n * LANES]);
+        ref_tri_hits[n] = ray_triangle_test_scalar(tris[n], masks[n], origins[n], dirs[n], &ref_tri_thit[n * LANES]);
+    }
+
+    bool all_match = true;
+    rt_simd_isa best = detect();
+    for (int isa = RT_SIMD_SCALAR; isa <= (int)best; isa++)
+    {
+        unsigned long long mismatches = 0;
+        unsigned long long checksum = 0;
+        float box_thit[LANES], tri_thit[LANES];
+
+        auto start = std::chrono::steady_clock::now();
+        for (unsigned n = 0; n < n_tests; n++)
+        {
+            float3 idir = self_test_idir(dirs[n]);
+            unsigned box_hits = s_ray_box_test[isa](boxes[n], masks[n], idir, origins[n], 0.0f, 10.0f, box_thit);
+            unsigned tri_hits = s_ray_triangle_test[isa](tris[n], masks[n], origins[n], dirs[n], tri_thit);
+            checksum += box_hits + tri_hits;
+
+            bool match = box_hits == ref_box_hits[n] && tri_hits == ref_tri_hits[n];
+            for (unsigned i = 0; match && i < LANES; i++)
+            {
+                if ((masks[n] & (1u << i)) && memcmp(&box_thit[i], &ref_box_thit[n * LANES + i], sizeof(float)))
+                    match = false;
+                if ((tri_hits & (1u << i)) && memcmp(&tri_thit[i], &ref_tri_thit[n * LANES + i], sizeof(float)))
+                    match = false;
+            }
+            if (!match)
+                mismatches++;
+        }
+        auto end = std::chrono::steady_clock::now();
+
+        double seconds = std::chrono::duration<double>(end - start).count();
+        fprintf(fp, "rt_simd_self_test[%s] = %llu mismatches in %u node tests (%.1f Mtests/sec, checksum %llu)\n",
+                isa_name((rt_simd_isa)isa), mismatches, n_tests, seconds > 0.0 ? n_tests / seconds / 1e6 : 0.0,
+                checksum);
+        all_match &= mismatches == 0;
+    }
+    return all_match;
+}
+
+#ifdef UNIT_TEST
+
+// Every ISA against the scalar mt_ray_triangle_test, lane by lane. Besides
+// random triangles it covers rays through a vertex and along an edge,
+// rays parallel to the triangle and degenerate triangles.
+
+static void unit_test_set_lane(rt_triangle_batch &tris, unsigned lane, float3 p0, float3 p1, float3 p2)
+{
+    tris.p0_x[lane] = p0.x; tris.p0_y[lane] = p0.y; tris.p0_z[lane] = p0.z;
+    tris.p1_x[lane] = p1.x; tris.p1_y[lane] = p1.y; tris.p1_z[lane] = p1.z;
+    tris.p2_x[lane] = p2.x; tris.p2_y[lane] = p2.y; tris.p2_z[lane] = p2.z;
+}
+
+// Counts the lanes that differ from the scalar test in errors, and returns the lanes hit
+static unsigned unit_test_batch(const rt_triangle_batch &tris, unsigned lane_mask, float3 origin, float3 dir,
+                                unsigned &errors)
+{
+    float thit[rt_simd_kernels::LANES];
+    unsigned hits = rt_simd_kernels::ray_triangle_test(tris, lane_mask, origin, dir, thit);
+    unsigned lanes_hit = 0;
+    for (unsigned i = 0; i < rt_simd_kernels::LANES; i++)
+    {
+        bool hit = (hits >> i) & 1;
+        lanes_hit += hit;
+        if (!(lane_mask & (1u << i)))
+        {
+            if (hit)
+                errors++;
+            continue;
+        }
+
+        float3 p0 = self_test_float3(tris.p0_x[i], tris.p0_y[i], tris.p0_z[i]);
+        float3 p1 = self_test_float3(tris.p1_x[i], tris.p1_y[i], tris.p1_z[i]);
+        float3 p2 = self_test_float3(tris.p2_x[i], tris.p2_y[i], tris.p2_z[i]);
+        float scalar_thit = 0;
+        bool scalar_hit = mt_ray_triangle_test(p0, p1, p2, origin, dir, &scalar_thit);
+        if (hit != scalar_hit || (hit && memcmp(&thit[i], &scalar_thit, sizeof(float)) != 0))
+        {
+            if (errors == 0)
+                printf("%s: lane %u hit %d/%d thit %a/%a\n", rt_simd_kernels::isa_name(rt_simd_kernels::isa()), i,
+                       hit, scalar_hit, thit[i], scalar_thit);
+            errors++;
+        }
+    }
+    return lanes_hit;
+}
+
+int main(int argc, char *argv[])
+{
+    const unsigned n_tests = 100000;
+    int errors_found = 0;
+
+    rt_simd_isa best = rt_simd_kernels::detect();
+    for (int isa = RT_SIMD_SCALAR; isa <= (int)best; isa++)
+    {
+        rt_simd_kernels::select(isa);
+        unsigned long long state = 0x9e3779b97f4a7c15ull;
+        unsigned errors = 0, lanes_hit = 0;
+
+        for (unsigned n = 0; n < n_tests; n++)
+        {
+            float3 origin = self_test_float3(self_test_float(state, -2, 2), self_test_float(state, -2, 2), self_test_float(state, -2, 2));
+            float3 dir = self_test_float3(self_test_float(state, -1, 1), self_test_float(state, -1, 1), self_test_float(state, -1, 1));
+            if (n % 8 == 0)
+            {
+                unsigned axis = self_test_rand(state) % 3;
+                dir = self_test_float3(axis == 0 ? 1.0f : 0.0f, axis == 1 ? -1.0f : 0.0f, axis == 2 ? 1.0f : 0.0f);
+            }
+
+            rt_triangle_batch tris;
+            for (unsigned i = 0; i < rt_simd_kernels::LANES; i++)
+            {
+                float3 p[3];
+                for (unsigned v = 0; v < 3; v++)
+                    p[v] = self_test_float3(self_test_float(state, -3, 3), self_test_float(state, -3, 3), self_test_float(state, -3, 3));
+
+                switch (i)
+                {
+                case 1: // Ray through p0
+                    p[0] = self_test_float3(origin.x + 2 * dir.x, origin.y + 2 * dir.y, origin.z + 2 * dir.z);
+                    break;
+                case 2: // Ray along the p0-p1 edge
+                    p[0] = self_test_float3(origin.x + dir.x, origin.y + dir.y, origin.z + dir.z);
+                    p[1] = self_test_float3(origin.x + 3 * dir.x, origin.y + 3 * dir.y, origin.z + 3 * dir.z);
+                    break;
+                case 3: // Parallel to the ray, det is 0
+                    p[1] = self_test_float3(p[0].x + dir.x, p[0].y + dir.y, p[0].z + dir.z);
+                    p[2] = self_test_float3(p[0].x - 2 * dir.x, p[0].y - 2 * dir.y, p[0].z - 2 * dir.z);
+                    break;
+                case 4: // Degenerate, p1 == p2
+                    p[2] = p[1];
+                    break;
+                }
+                unit_test_set_lane(tris, i, p[0], p[1], p[2]);
+            }
+
+            // All six children, a random subset, and nodes with few children
+            unsigned lane_mask = n % 3 == 0 ? 0x3f : n % 3 == 1 ? (self_test_rand(state) & 0xff) : (1u << (n % 6)) - 1;
+            lanes_hit += unit_test_batch(tris, lane_mask, origin, dir, errors);
+        }
+
+        printf("%s: %u batches, %u lanes hit, %u lanes differ from mt_ray_triangle_test\n",
+               rt_simd_kernels::isa_name((rt_simd_isa)isa), n_tests, lanes_hit, errors);
+        errors_found += errors;
+    }
+
+    if (errors_found)
+        printf("FAILED\n");
+    else
+        printf("PASSED\n");
+    return errors_found ? 1 : 0;
+}
+
+#endif
@@ -0,0 +1,118 @@
+// Copyright (c) 2022, Mohammadreza Saed, Yuan Hsi Chou, Lufei Liu, Tor M. Aamodt,
+// The University of British Columbia
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+// Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution. Neither the name of
+// The University of British Columbia nor the names of its contributors may be
+// used to endorse or promote products derived from this software without
+// specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef RT_SIMD_KERNELS_H
+#define RT_SIMD_KERNELS_H
+
+#include <stdio.h>
+#include "vector_types.h"
+
+// Instruction sets the functional intersection kernels are built for
+enum rt_simd_isa {
+    RT_SIMD_SCALAR = 0,
+    RT_SIMD_SSE,
+    RT_SIMD_AVX2,
+    RT_SIMD_NUM_ISAS
+};
+
+// Decoded child boxes of one BVH internal node, one lane per child. Lanes past
+// the node's six children are padding so a full 8-wide register can be loaded.
+struct rt_child_bounds {
+    float lo_x[8], lo_y[8], lo_z[8];
+    float hi_x[8], hi_y[8], hi_z[8];
+};
+
+// Up to eight triangles, one lane each
+struct rt_triangle_batch {
+    float p0_x[8], p0_y[8], p0_z[8];
+    float p1_x[8], p1_y[8], p1_z[8];
+    float p2_x[8], p2_y[8], p2_z[8];
+};
+
+// Scalar Moller-Trumbore ray-triangle test, VulkanRayTracing::mt_ray_triangle_test.
+// The kernels below are checked against it.
+bool mt_ray_triangle_test(float3 p0, float3 p1, float3 p2, float3 origin, float3 direction, float *thit);
+
+// Ray-box slab test and Moller-Trumbore ray-triangle test used by the
+// functional traversal, evaluated for all lanes at once. Every ISA performs the
+// same float operations in the same order as ray_box_test and
+// mt_ray_triangle_test, so hits and hit distances match the
+// scalar code bit for bit. The widest ISA the host supports is picked at
+// startup unless -rt_simd_isa asks for a narrower one.
+class rt_simd_kernels
+{
+public:
+    static const unsigned LANES = 8;
+
+    // Best ISA this host supports
+    static rt_simd_isa detect();
+    // requested < 0 picks the best supported, otherwise the requested ISA
+    // clamped to what the host supports. Returns the ISA in use.
+    static rt_simd_isa select(int requested);
+    static rt_simd_isa isa() { return s_isa; }
+    static const char *isa_name(rt_simd_isa isa);
+
+    // When set, the traversal compares every kernel result to the scalar tests
+    // (-rt_simd_check)
+    static void set_check(bool check) { s_check = check; }
+    static bool check() { return s_check; }
+
+    // Bit i of the result is set if lane i of lane_mask hits. thit[i] gets the
+    // slab entry distance of every lane in lane_mask, hit or not, like
+    // ray_box_test.
+    static unsigned ray_box_test(const rt_child_bounds &bounds, unsigned lane_mask, float3 idir, float3 origin,
+                                 float tmin, float tmax, float thit[LANES])
+    {
+        return s_ray_box_test[s_isa](bounds, lane_mask, idir, origin, tmin, tmax, thit);
+    }
+
+    // Bit i of the result is set if triangle i of lane_mask is hit. thit[i] is
+    // only written for hits, like mt_ray_triangle_test.
+    static unsigned ray_triangle_test(const rt_triangle_batch &tris, unsigned lane_mask, float3 origin, float3 direction,
+                                      float thit[LANES])
+    {
+        return s_ray_triangle_test[s_isa](tris, lane_mask, origin, direction, thit);
+    }
+
+    // Runs n_tests random boxes and triangles (plus axis aligned and
+    // degenerate cases) through every supported ISA, reports mismatches
+    // against the scalar kernels and tests per second. Returns true if all
+    // ISAs agree.
+    static bool self_test(FILE *fp, unsigned n_tests);
+
+private:
+    typedef unsigned (*ray_box_fn)(const rt_child_bounds &, unsigned, float3, float3, float, float, float *);
+    typedef unsigned (*ray_triangle_fn)(const rt_triangle_batch &, unsigned, float3, float3, float *);
+
+    static rt_simd_isa s_isa;
+    static bool s_check;
+    static const ray_box_fn s_ray_box_test[RT_SIMD_NUM_ISAS];
+    static const ray_triangle_fn s_ray_triangle_test[RT_SIMD_NUM_ISAS];
+};
+
+#endif /* RT_SIMD_KERNELS_H */
@@ -0,0 +1,197 @@
+// Copyright (c) 2022, Mohammadreza Saed, Yuan Hsi Chou, Lufei Liu, Tor M. Aamodt,
+// The University of British Columbia
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+// Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution. Neither the name of
+// The University of British Columbia nor the names of its contributors may be
+// used to endorse or promote products derived from this software without
+// specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "treelet_cache.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char treelet_cache_magic[8] = {'T', 'R', 'E', 'E', 'L', 'E', 'T', 'C'};
+
+// Size in bytes of one record of each section
+static const size_t treelet_cache_record_size[TREELET_CACHE_NUM_SECTIONS] = {
+    sizeof(treelet_cache_list),
+    sizeof(treelet_cache_node),
+    sizeof(treelet_cache_list),
+    sizeof(treelet_cache_node),
+    sizeof(treelet_cache_pair),
+    sizeof(treelet_cache_pair),
+    sizeof(uint8_t),
+};
+
+
+void treelet_cache_writer::add_treelet(const treelet_cache_node &root, const std::vector<treelet_cache_node> &nodes)
+{
+    treelet_cache_list list = {root, m_treelet_nodes.size(), nodes.size()};
+    m_treelets.push_back(list);
+    m_treelet_nodes.insert(m_treelet_nodes.end(), nodes.begin(), nodes.end());
+}
+
+
+void treelet_cache_writer::add_children(const treelet_cache_node &root, const std::vector<treelet_cache_node> &children)
+{
+    treelet_cache_list list = {root, m_child_nodes.size(), children.size()};
+    m_child_lists.push_back(list);
+    m_child_nodes.insert(m_child_nodes.end(), children.begin(), children.end());
+}
+
+
+void treelet_cache_writer::add_metadata_idx(uint64_t root, uint64_t idx)
+{
+    treelet_cache_pair pair = {root, idx};
+    m_metadata_idx.push_back(pair);
+}
+
+
+void treelet_cache_writer::add_remap(uint64_t original, uint64_t layout_offset)
+{
+    treelet_cache_pair pair = {original, layout_offset};
+    m_remap.push_back(pair);
+}
+
+
+bool treelet_cache_writer::write(const std::string &path, const treelet_cache_key &key) const
+{
+    const void *data[TREELET_CACHE_NUM_SECTIONS] = {
+        m_treelets.data(), m_treelet_nodes.data(), m_child_lists.data(), m_child_nodes.data(),
+        m_metadata_idx.data(), m_remap.data(), m_index_blob.data()};
+    const uint64_t count[TREELET_CACHE_NUM_SECTIONS] = {
+        m_treelets.size(), m_treelet_nodes.size(), m_child_lists.size(), m_child_nodes.size(),
+        m_metadata_idx.size(), m_remap.size(), m_index_blob.size()};
+
+    treelet_cache_file_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, treelet_cache_magic, sizeof(header.magic));
+    header.version = TREELET_CACHE_VERSION;
+    header.header_size = sizeof(header);
+    header.key = key;
+    header.layout_base = m_layout_base;
+    header.layout_size = m_layout_size;
+
+    uint64_t offset = (sizeof(header) + 7) & ~7ULL;
+    for (unsigned s = 0; s < TREELET_CACHE_NUM_SECTIONS; s++)
+    {
+        header.sections[s].offset = offset;
+        header.sections[s].count = count[s];
+        offset = (offset + count[s] * treelet_cache_record_size[s] + 7) & ~7ULL;
+    }
+
+    char tmp_suffix[32];
+    snprintf(tmp_suffix, sizeof(tmp_suffix), ".tmp.%d", (int)getpid());
+    std::string tmp_path = path + tmp_suffix;
+
+    FILE *fp = fopen(tmp_path.c_str(), "wb");
+    if (!fp)
+        return false;
+
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+    static const uint8_t padding[8] = {0};
+    uint64_t written = sizeof(header);
+    for (unsigned s = 0; s < TREELET_CACHE_NUM_SECTIONS && ok; s++)
+    {
+        ok = fwrite(padding, 1, header.sections[s].offset - written, fp) == header.sections[s].offset - written;
+        written = header.sections[s].offset;
+
+        size_t bytes = count[s] * treelet_cache_record_size[s];
+        if (ok && bytes)
+            ok = fwrite(data[s], 1, bytes, fp) == bytes;
+        written += bytes;
+    }
+    ok = (fclose(fp) == 0) && ok;
+
+    if (ok)
+        ok = rename(tmp_path.c_str(), path.c_str()) == 0;
+    if (!ok)
+        unlink(tmp_path.c_str());
+    return ok;
+}
+
+
+bool treelet_cache_reader::open(const std::string &path, const treelet_cache_key &key)
+{
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(treelet_cache_file_header))
+    {
+        ::close(fd);
+        return false;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+        return false;
+
+    m_map = map;
+    m_map_size = st.st_size;
+    m_header = (const treelet_cache_file_header *)map;
+
+    bool valid = memcmp(m_header->magic, treelet_cache_magic, sizeof(m_header->magic)) == 0 &&
+                 m_header->version == TREELET_CACHE_VERSION &&
+                 m_header->header_size == sizeof(treelet_cache_file_header) &&
+                 memcmp(&m_header->key, &key, sizeof(key)) == 0;
+
+    for (unsigned s = 0; s < TREELET_CACHE_NUM_SECTIONS && valid; s++)
+    {
+        const treelet_cache_section_entry &entry = m_header->sections[s];
+        valid = (entry.offset % 8) == 0 && entry.offset <= m_map_size &&
+                entry.count <= (m_map_size - entry.offset) / treelet_cache_record_size[s];
+    }
+
+    // Node runs must stay inside their node arrays
+    for (unsigned s = TREELET_CACHE_TREELETS; s <= TREELET_CACHE_CHILD_LISTS && valid; s += 2)
+    {
+        treelet_cache_array<treelet_cache_list> lists = array<treelet_cache_list>(s);
+        uint64_t n_nodes = m_header->sections[s + 1].count;
+        for (uint64_t i = 0; i < lists.size() && valid; i++)
+            valid = lists[i].begin <= n_nodes && lists[i].count <= n_nodes - lists[i].begin;
+    }
+
+    if (!valid)
+        close();
+    return valid;
+}
+
+
+void treelet_cache_reader::close()
+{
+    if (m_map)
+        munmap(m_map, m_map_size);
+    m_map = NULL;
+    m_map_size = 0;
+    m_header = NULL;
+}
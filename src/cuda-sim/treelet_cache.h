@@ -0,0 +1,194 @@
+// Copyright (c) 2022, Mohammadreza Saed, Yuan Hsi Chou, Lufei Liu, Tor M. Aamodt,
+// The University of British Columbia
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+// Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution. Neither the name of
+// The University of British Columbia nor the names of its contributors may be
+// used to endorse or promote products derived from this software without
+// specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef TREELET_CACHE_H
+#define TREELET_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// On-disk cache of the treelet partition of an acceleration structure, so that
+// runs over the same scene (e.g. a config sweep) skip treelet formation. The
+// file is a fixed header followed by flat arrays of the records below, and is
+// memory-mapped when read back. Addresses are device addresses, exactly as
+// stored in the VulkanRayTracing treelet tables.
+
+#define TREELET_CACHE_VERSION 2 // 2: packed layout keeps the gaps of shared nodes again
+#define TREELET_CACHE_HASH_SEED 0xcbf29ce484222325ULL
+
+// FNV-1a, used to fingerprint the BVH nodes
+inline uint64_t treelet_cache_hash(uint64_t hash, const void *data, size_t size)
+{
+    const uint8_t *bytes = (const uint8_t *)data;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// Everything a cached partition depends on. A file is only used if its key matches exactly.
+typedef struct treelet_cache_key {
+    uint64_t as_hash;                 // node contents reachable from the TLAS, incl. BLAS device addresses
+    uint64_t tlas_device_addr;
+    int32_t max_treelet_size;
+    uint32_t remap_to_treelet_layout;
+    uint32_t treelet_remap_stride;
+    uint32_t treelet_layout;          // -treelet_layout strategy, 0 (packed) in caches written before it existed
+} treelet_cache_key;
+
+typedef struct treelet_cache_node {
+    uint64_t addr;
+    int32_t size;
+    uint8_t top_level;
+    uint8_t leaf;
+    uint8_t is_blas_root;
+    uint8_t reserved;
+} treelet_cache_node;
+
+// A root node and a run of treelet_cache_nodes belonging to it
+typedef struct treelet_cache_list {
+    treelet_cache_node root;
+    uint64_t begin;
+    uint64_t count;
+} treelet_cache_list;
+
+typedef struct treelet_cache_pair {
+    uint64_t first;
+    uint64_t second;
+} treelet_cache_pair;
+
+// Read-only view of one array in a mapped cache file
+template <class T>
+class treelet_cache_array
+{
+public:
+    treelet_cache_array() : m_data(NULL), m_size(0) {}
+    treelet_cache_array(const T *data, uint64_t size) : m_data(data), m_size(size) {}
+
+    const T *begin() const { return m_data; }
+    const T *end() const { return m_data + m_size; }
+    uint64_t size() const { return m_size; }
+    const T &operator[](uint64_t i) const { return m_data[i]; }
+
+private:
+    const T *m_data;
+    uint64_t m_size;
+};
+
+enum treelet_cache_section {
+    TREELET_CACHE_TREELETS = 0,     // treelet_cache_list, <treelet root, nodes in this treelet>
+    TREELET_CACHE_TREELET_NODES,    // treelet_cache_node
+    TREELET_CACHE_CHILD_LISTS,      // treelet_cache_list, <treelet root, child treelets>
+    TREELET_CACHE_CHILD_NODES,      // treelet_cache_node
+    TREELET_CACHE_METADATA_IDX,     // treelet_cache_pair, <treelet root, metadata index>
+    TREELET_CACHE_REMAP,            // treelet_cache_pair, <original node, offset into the treelet layout BVH>
+    TREELET_CACHE_INDEX,            // serialized treelet_index
+    TREELET_CACHE_NUM_SECTIONS
+};
+
+typedef struct treelet_cache_section_entry {
+    uint64_t offset;    // from the start of the file, 8 byte aligned
+    uint64_t count;     // number of records
+} treelet_cache_section_entry;
+
+typedef struct treelet_cache_file_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    treelet_cache_key key;
+    uint64_t layout_base;   // treelet layout BVH allocation, 0 if not remapped
+    uint64_t layout_size;
+    treelet_cache_section_entry sections[TREELET_CACHE_NUM_SECTIONS];
+} treelet_cache_file_header;
+
+class treelet_cache_writer
+{
+public:
+    treelet_cache_writer() : m_layout_base(0), m_layout_size(0) {}
+
+    void add_treelet(const treelet_cache_node &root, const std::vector<treelet_cache_node> &nodes);
+    void add_children(const treelet_cache_node &root, const std::vector<treelet_cache_node> &children);
+    void add_metadata_idx(uint64_t root, uint64_t idx);
+    void add_remap(uint64_t original, uint64_t layout_offset);
+    void set_layout(uint64_t base, uint64_t size) { m_layout_base = base; m_layout_size = size; }
+    std::vector<uint8_t> &index_blob() { return m_index_blob; }
+
+    // Writes to a temporary file and renames it into place, so concurrent runs never see a partial file
+    bool write(const std::string &path, const treelet_cache_key &key) const;
+
+private:
+    std::vector<treelet_cache_list> m_treelets;
+    std::vector<treelet_cache_node> m_treelet_nodes;
+    std::vector<treelet_cache_list> m_child_lists;
+    std::vector<treelet_cache_node> m_child_nodes;
+    std::vector<treelet_cache_pair> m_metadata_idx;
+    std::vector<treelet_cache_pair> m_remap;
+    std::vector<uint8_t> m_index_blob;
+    uint64_t m_layout_base;
+    uint64_t m_layout_size;
+};
+
+class treelet_cache_reader
+{
+public:
+    treelet_cache_reader() : m_map(NULL), m_map_size(0), m_header(NULL) {}
+    ~treelet_cache_reader() { close(); }
+
+    // Maps the file and validates it against key. Returns false if it is missing, stale or malformed.
+    bool open(const std::string &path, const treelet_cache_key &key);
+    void close();
+
+    treelet_cache_array<treelet_cache_list> treelets() const { return array<treelet_cache_list>(TREELET_CACHE_TREELETS); }
+    treelet_cache_array<treelet_cache_node> treelet_nodes() const { return array<treelet_cache_node>(TREELET_CACHE_TREELET_NODES); }
+    treelet_cache_array<treelet_cache_list> child_lists() const { return array<treelet_cache_list>(TREELET_CACHE_CHILD_LISTS); }
+    treelet_cache_array<treelet_cache_node> child_nodes() const { return array<treelet_cache_node>(TREELET_CACHE_CHILD_NODES); }
+    treelet_cache_array<treelet_cache_pair> metadata_idx() const { return array<treelet_cache_pair>(TREELET_CACHE_METADATA_IDX); }
+    treelet_cache_array<treelet_cache_pair> remap() const { return array<treelet_cache_pair>(TREELET_CACHE_REMAP); }
+    treelet_cache_array<uint8_t> index_blob() const { return array<uint8_t>(TREELET_CACHE_INDEX); }
+
+    uint64_t layout_base() const { return m_header->layout_base; }
+    uint64_t layout_size() const { return m_header->layout_size; }
+
+private:
+    template <class T>
+    treelet_cache_array<T> array(unsigned section) const
+    {
+        const treelet_cache_section_entry &entry = m_header->sections[section];
+        return treelet_cache_array<T>((const T *)((const uint8_t *)m_map + entry.offset), entry.count);
+    }
+
+    void *m_map;
+    size_t m_map_size;
+    const treelet_cache_file_header *m_header;
+};
+
+#endif /* TREELET_CACHE_H */
@@ -0,0 +1,234 @@
+// Copyright (c) 2022, Mohammadreza Saed, Yuan Hsi Chou, Lufei Liu, Tor M. Aamodt,
+// The University of British Columbia
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+// Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution. Neither the name of
+// The University of British Columbia nor the names of its contributors may be
+// used to endorse or promote products derived from this software without
+// specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "treelet_index.h"
+
+#include <algorithm>
+#include <chrono>
+#include <string.h>
+
+// Direct-mapped table may be at most this many times larger than the node count
+#define TREELET_INDEX_MAX_DIRECT_EXPANSION 4
+#define TREELET_INDEX_MIN_DIRECT_ENTRIES (1 << 16)
+
+const unsigned treelet_index::INVALID_ID;
+
+
+void treelet_index::clear()
+{
+    m_built = false;
+    m_roots.clear();
+    m_node_offsets.clear();
+    m_nodes.clear();
+    m_child_offsets.clear();
+    m_children.clear();
+    m_node_addrs.clear();
+    m_node_treelet.clear();
+    m_node_root_treelet.clear();
+    m_base_addr = NULL;
+    m_direct_span = 0;
+    m_direct_mask = 0;
+    m_direct_shift = 0;
+    m_direct_table.clear();
+}
+
+
+unsigned treelet_index::sorted_node_id(const uint8_t* addr) const
+{
+    auto it = std::lower_bound(m_node_addrs.begin(), m_node_addrs.end(), addr);
+    if (it == m_node_addrs.end() || *it != addr)
+        return INVALID_ID;
+    return it - m_node_addrs.begin();
+}
+
+
+void treelet_index::finalize(std::vector<std::pair<uint8_t*, unsigned> > &node_assignments)
+{
+    // Dense node IDs are the rank of the address
+    m_node_addrs.reserve(node_assignments.size());
+    for (auto assignment : node_assignments)
+        m_node_addrs.push_back(assignment.first);
+    std::sort(m_node_addrs.begin(), m_node_addrs.end());
+    m_node_addrs.erase(std::unique(m_node_addrs.begin(), m_node_addrs.end()), m_node_addrs.end());
+
+    m_node_treelet.assign(m_node_addrs.size(), INVALID_ID);
+    m_node_root_treelet.assign(m_node_addrs.size(), INVALID_ID);
+    for (auto assignment : node_assignments)
+        m_node_treelet[sorted_node_id(assignment.first)] = assignment.second;
+    for (unsigned treelet = 0; treelet < m_roots.size(); treelet++)
+        m_node_root_treelet[sorted_node_id(m_roots[treelet])] = treelet;
+
+    // Use a direct-mapped table when the nodes are packed closely enough
+    if (!m_node_addrs.empty())
+    {
+        m_base_addr = m_node_addrs.front();
+        uintptr_t span = (uintptr_t)m_node_addrs.back() - (uintptr_t)m_base_addr;
+
+        // Largest power of two all node offsets are aligned to
+        uintptr_t offset_bits = 0;
+        for (auto addr : m_node_addrs)
+            offset_bits |= (uintptr_t)addr - (uintptr_t)m_base_addr;
+        unsigned shift = 0;
+        while (offset_bits && !(offset_bits & ((uintptr_t)1 << shift)))
+            shift++;
+
+        uint64_t entries = ((uint64_t)span >> shift) + 1;
+        uint64_t max_entries = std::max((uint64_t)m_node_addrs.size() * TREELET_INDEX_MAX_DIRECT_EXPANSION,
+                                        (uint64_t)TREELET_INDEX_MIN_DIRECT_ENTRIES);
+        if (entries <= max_entries)
+        {
+            m_direct_shift = shift;
+            m_direct_mask = ((uintptr_t)1 << shift) - 1;
+            m_direct_span = span + 1;
+            m_direct_table.assign(entries, INVALID_ID);
+            for (unsigned id = 0; id < m_node_addrs.size(); id++)
+                m_direct_table[((uintptr_t)m_node_addrs[id] - (uintptr_t)m_base_addr) >> shift] = id;
+        }
+    }
+
+    m_built = true;
+}
+
+
+double treelet_index::benchmark(unsigned passes) const
+{
+    if (m_node_addrs.empty() || passes == 0)
+        return 0.0;
+
+    unsigned long long checksum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned pass = 0; pass < passes; pass++)
+    {
+        for (auto addr : m_node_addrs)
+            checksum += node_treelet(addr);
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    // Keep the loop from being optimized away
+    volatile unsigned long long sink = checksum;
+    (void)sink;
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+    double lookups = (double)m_node_addrs.size() * passes;
+    return seconds > 0.0 ? lookups / seconds : 0.0;
+}
+
+
+template <class T>
+static void serialize_value(std::vector<uint8_t> &out, const T &value)
+{
+    const uint8_t *bytes = (const uint8_t *)&value;
+    out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+template <class T>
+static void serialize_vector(std::vector<uint8_t> &out, const std::vector<T> &vec)
+{
+    serialize_value(out, (uint64_t)vec.size());
+    const uint8_t *bytes = (const uint8_t *)vec.data();
+    out.insert(out.end(), bytes, bytes + vec.size() * sizeof(T));
+}
+
+template <class T>
+static bool deserialize_value(const uint8_t *&cursor, const uint8_t *end, T &value)
+{
+    if ((size_t)(end - cursor) < sizeof(T))
+        return false;
+    memcpy(&value, cursor, sizeof(T));
+    cursor += sizeof(T);
+    return true;
+}
+
+template <class T>
+static bool deserialize_vector(const uint8_t *&cursor, const uint8_t *end, std::vector<T> &vec)
+{
+    uint64_t size;
+    if (!deserialize_value(cursor, end, size) || size > (uint64_t)(end - cursor) / sizeof(T))
+        return false;
+    vec.resize(size);
+    memcpy(vec.data(), cursor, size * sizeof(T));
+    cursor += size * sizeof(T);
+    return true;
+}
+
+
+void treelet_index::serialize(std::vector<uint8_t> &out) const
+{
+    out.clear();
+    serialize_vector(out, m_roots);
+    serialize_vector(out, m_node_offsets);
+    serialize_vector(out, m_nodes);
+    serialize_vector(out, m_child_offsets);
+    serialize_vector(out, m_children);
+    serialize_vector(out, m_node_addrs);
+    serialize_vector(out, m_node_treelet);
+    serialize_vector(out, m_node_root_treelet);
+    serialize_value(out, m_base_addr);
+    serialize_value(out, m_direct_span);
+    serialize_value(out, m_direct_mask);
+    serialize_value(out, m_direct_shift);
+    serialize_vector(out, m_direct_table);
+}
+
+
+bool treelet_index::deserialize(const uint8_t *data, size_t size)
+{
+    clear();
+
+    const uint8_t *cursor = data;
+    const uint8_t *end = data + size;
+    bool ok = deserialize_vector(cursor, end, m_roots) &&
+              deserialize_vector(cursor, end, m_node_offsets) &&
+              deserialize_vector(cursor, end, m_nodes) &&
+              deserialize_vector(cursor, end, m_child_offsets) &&
+              deserialize_vector(cursor, end, m_children) &&
+              deserialize_vector(cursor, end, m_node_addrs) &&
+              deserialize_vector(cursor, end, m_node_treelet) &&
+              deserialize_vector(cursor, end, m_node_root_treelet) &&
+              deserialize_value(cursor, end, m_base_addr) &&
+              deserialize_value(cursor, end, m_direct_span) &&
+              deserialize_value(cursor, end, m_direct_mask) &&
+              deserialize_value(cursor, end, m_direct_shift) &&
+              deserialize_vector(cursor, end, m_direct_table) &&
+              cursor == end;
+
+    // Cheap consistency checks so a damaged image can't index out of bounds
+    ok = ok && m_node_offsets.size() == m_roots.size() + 1 && m_child_offsets.size() == m_roots.size() + 1 &&
+         m_node_offsets.back() == m_nodes.size() && m_child_offsets.back() == m_children.size() &&
+         m_node_treelet.size() == m_node_addrs.size() && m_node_root_treelet.size() == m_node_addrs.size();
+    for (unsigned i = 0; ok && i < m_direct_table.size(); i++)
+        ok = m_direct_table[i] == INVALID_ID || m_direct_table[i] < m_node_addrs.size();
+
+    if (!ok)
+    {
+        clear();
+        return false;
+    }
+    m_built = true;
+    return true;
+}
@@ -0,0 +1,215 @@
+// Copyright (c) 2022, Mohammadreza Saed, Yuan Hsi Chou, Lufei Liu, Tor M. Aamodt,
+// The University of British Columbia
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+// Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution. Neither the name of
+// The University of British Columbia nor the names of its contributors may be
+// used to endorse or promote products derived from this software without
+// specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef TREELET_INDEX_H
+#define TREELET_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <assert.h>
+#include <map>
+#include <vector>
+
+// A BVH node as seen by the timing model: just where it lives and how big it is
+typedef struct treelet_node {
+    uint8_t* addr;
+    int size;
+} treelet_node;
+
+// Read-only view over a contiguous run of nodes inside the treelet index
+class treelet_node_span
+{
+public:
+    treelet_node_span() : m_begin(NULL), m_end(NULL) {}
+    treelet_node_span(const treelet_node *begin, const treelet_node *end) : m_begin(begin), m_end(end) {}
+
+    const treelet_node *begin() const { return m_begin; }
+    const treelet_node *end() const { return m_end; }
+    unsigned size() const { return m_end - m_begin; }
+    bool empty() const { return m_begin == m_end; }
+    const treelet_node &operator[](unsigned i) const { return m_begin[i]; }
+
+private:
+    const treelet_node *m_begin;
+    const treelet_node *m_end;
+};
+
+// Flat, allocation-free lookup tables for the treelet partition produced by
+// createTreelets. Every node address gets a dense node ID (its rank in the
+// sorted address array), treelets are numbered in root address order (the same
+// order the std::map based tables iterate in), and the member nodes and child
+// treelets of each treelet are stored as CSR arrays.
+//
+// Node addresses are resolved with a direct-mapped table when the BVH is dense
+// enough in address space, otherwise with a binary search over the sorted
+// address array.
+class treelet_index
+{
+public:
+    static const unsigned INVALID_ID = (unsigned)-1;
+
+    treelet_index() { clear(); }
+
+    void clear();
+
+    // roots: <treelet root, nodes in this treelet>, child_map: <treelet root, child treelets>.
+    // Entries only need .addr and .size so this works on the StackEntry maps directly.
+    template <class TreeletMap>
+    void build(const TreeletMap &roots, const TreeletMap &child_map);
+
+    bool built() const { return m_built; }
+    unsigned num_treelets() const { return m_roots.size(); }
+    unsigned num_nodes() const { return m_node_addrs.size(); }
+
+    // Dense node ID of an address, INVALID_ID if the address is not a BVH node
+    unsigned node_id(const uint8_t* addr) const
+    {
+        if (!m_direct_table.empty()) {
+            uintptr_t offset = (uintptr_t)addr - (uintptr_t)m_base_addr;
+            if (offset >= m_direct_span || (offset & m_direct_mask))
+                return INVALID_ID;
+            return m_direct_table[offset >> m_direct_shift];
+        }
+        return sorted_node_id(addr);
+    }
+
+    // Treelet ID that a node belongs to, INVALID_ID if unknown
+    unsigned node_treelet(const uint8_t* addr) const
+    {
+        unsigned id = node_id(addr);
+        return id == INVALID_ID ? INVALID_ID : m_node_treelet[id];
+    }
+
+    // Treelet ID whose root is at addr, INVALID_ID if addr is not a treelet root
+    unsigned root_treelet(const uint8_t* addr) const
+    {
+        unsigned id = node_id(addr);
+        return id == INVALID_ID ? INVALID_ID : m_node_root_treelet[id];
+    }
+
+    bool is_root(const uint8_t* addr) const { return root_treelet(addr) != INVALID_ID; }
+
+    uint8_t* root_addr(unsigned treelet) const
+    {
+        assert(treelet < m_roots.size());
+        return m_roots[treelet];
+    }
+
+    treelet_node_span treelet_nodes(unsigned treelet) const
+    {
+        if (treelet == INVALID_ID) return treelet_node_span();
+        assert(treelet < m_roots.size());
+        return treelet_node_span(m_nodes.data() + m_node_offsets[treelet], m_nodes.data() + m_node_offsets[treelet + 1]);
+    }
+
+    treelet_node_span treelet_children(unsigned treelet) const
+    {
+        if (treelet == INVALID_ID) return treelet_node_span();
+        assert(treelet < m_roots.size());
+        return treelet_node_span(m_children.data() + m_child_offsets[treelet], m_children.data() + m_child_offsets[treelet + 1]);
+    }
+
+    // Convenience lookups keyed by treelet root address, empty if addr is not a root
+    treelet_node_span treelet_nodes(const uint8_t* root) const { return treelet_nodes(root_treelet(root)); }
+    treelet_node_span treelet_children(const uint8_t* root) const { return treelet_children(root_treelet(root)); }
+
+    // Times node->treelet lookups over every indexed node, returns lookups per second
+    double benchmark(unsigned passes) const;
+
+    // Byte image of the tables, so the treelet cache can store the index as is
+    void serialize(std::vector<uint8_t> &out) const;
+    bool deserialize(const uint8_t *data, size_t size);
+
+private:
+    unsigned sorted_node_id(const uint8_t* addr) const;
+    void finalize(std::vector<std::pair<uint8_t*, unsigned> > &node_assignments);
+
+    bool m_built;
+
+    // Treelets, indexed by treelet ID
+    std::vector<uint8_t*> m_roots;
+    std::vector<unsigned> m_node_offsets;
+    std::vector<treelet_node> m_nodes;
+    std::vector<unsigned> m_child_offsets;
+    std::vector<treelet_node> m_children;
+
+    // Nodes, indexed by node ID
+    std::vector<uint8_t*> m_node_addrs;
+    std::vector<unsigned> m_node_treelet;
+    std::vector<unsigned> m_node_root_treelet;
+
+    // Direct-mapped address -> node ID table
+    uint8_t* m_base_addr;
+    uintptr_t m_direct_span;
+    uintptr_t m_direct_mask;
+    unsigned m_direct_shift;
+    std::vector<unsigned> m_direct_table;
+};
+
+
+template <class TreeletMap>
+void treelet_index::build(const TreeletMap &roots, const TreeletMap &child_map)
+{
+    clear();
+
+    // <node, treelet> in the same order buildNodeToRootMap visits them, so a
+    // node that shows up in several treelets resolves to the last one
+    std::vector<std::pair<uint8_t*, unsigned> > node_assignments;
+
+    m_node_offsets.push_back(0);
+    m_child_offsets.push_back(0);
+    for (const auto &root : roots)
+    {
+        unsigned treelet = m_roots.size();
+        m_roots.push_back(root.first);
+
+        node_assignments.push_back(std::make_pair(root.first, treelet));
+        for (const auto &node : root.second)
+        {
+            treelet_node entry = {node.addr, node.size};
+            m_nodes.push_back(entry);
+            node_assignments.push_back(std::make_pair(node.addr, treelet));
+        }
+        m_node_offsets.push_back(m_nodes.size());
+
+        auto children = child_map.find(root.first);
+        if (children != child_map.end())
+        {
+            for (const auto &child : children->second)
+            {
+                treelet_node entry = {child.addr, child.size};
+                m_children.push_back(entry);
+            }
+        }
+        m_child_offsets.push_back(m_children.size());
+    }
+
+    finalize(node_assignments);
+}
+
+#endif /* TREELET_INDEX_H */
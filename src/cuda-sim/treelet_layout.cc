@@ -0,0 +1,572 @@
+// Copyright (c) 2022, Mohammadreza Saed, Yuan Hsi Chou, Lufei Liu, Tor M. Aamodt,
+// The University of British Columbia
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+// Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution. Neither the name of
+// The University of British Columbia nor the names of its contributors may be
+// used to endorse or promote products derived from this software without
+// specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "treelet_layout.h"
+
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+
+// Spread strategies reserve this many times the lines they place, so every
+// channel and bank keeps free lines to pick from however the mapping hashes
+#define TREELET_LAYOUT_REGION_SLACK 2
+
+
+static uint64_t align_up(uint64_t value, uint64_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+
+// The original layout: treelets back to back, each in a max_treelet_size +
+// stride slot. A node already placed with an earlier treelet (a shared BLAS)
+// still takes its bytes in this slot, leaving a gap, and the region is sized
+// without the strides, exactly as the layout was before placement strategies.
+// With a stride the last slots run past the region; they are only addresses,
+// no data is written there.
+class packed_placement : public treelet_placement
+{
+public:
+    uint64_t region_size(const treelet_layout &layout) const
+    {
+        return (uint64_t)layout.treelets().size() * layout.max_treelet_size();
+    }
+
+    void place(treelet_layout &layout, uint8_t* base)
+    {
+        uint64_t slot = layout.max_treelet_size() + layout.stride();
+        for (unsigned i = 0; i < layout.treelets().size(); i++)
+        {
+            const treelet_layout::layout_treelet &treelet = layout.treelets()[i];
+            uint8_t* addr = base + i * slot;
+            for (unsigned n = 0; n < treelet.nodes.size(); n++)
+            {
+                addr += treelet.skipped[n];
+                layout.map_node(treelet.nodes[n], addr);
+                addr += treelet.nodes[n].size;
+            }
+        }
+    }
+};
+
+
+// Like packed, but a treelet's nodes close up over the ones placed with an
+// earlier treelet, and the region covers the strides
+class packed_compact_placement : public treelet_placement
+{
+public:
+    uint64_t region_size(const treelet_layout &layout) const
+    {
+        return (uint64_t)layout.treelets().size() * (layout.max_treelet_size() + layout.stride());
+    }
+
+    void place(treelet_layout &layout, uint8_t* base)
+    {
+        uint64_t slot = layout.max_treelet_size() + layout.stride();
+        for (unsigned i = 0; i < layout.treelets().size(); i++)
+        {
+            uint8_t* addr = base + i * slot;
+            for (const treelet_node &node : layout.treelets()[i].nodes)
+            {
+                layout.map_node(node, addr);
+                addr += node.size;
+            }
+        }
+    }
+};
+
+
+// Nodes of a treelet packed first fit, in order, into line sized groups. A
+// node bigger than a line is left out and placed on its own.
+typedef struct line_group {
+    std::vector<unsigned> nodes; // indices into layout_treelet::nodes
+    unsigned bytes;
+} line_group;
+
+static void pack_lines(const treelet_layout::layout_treelet &treelet, unsigned line_size,
+                       std::vector<line_group> &groups, std::vector<unsigned> &oversized)
+{
+    groups.clear();
+    oversized.clear();
+    for (unsigned i = 0; i < treelet.nodes.size(); i++)
+    {
+        unsigned size = treelet.nodes[i].size;
+        if (size > line_size)
+        {
+            oversized.push_back(i);
+            continue;
+        }
+
+        unsigned g = 0;
+        while (g < groups.size() && groups[g].bytes + size > line_size)
+            g++;
+        if (g == groups.size())
+        {
+            groups.push_back(line_group());
+            groups.back().bytes = 0;
+        }
+        groups[g].nodes.push_back(i);
+        groups[g].bytes += size;
+    }
+}
+
+
+// Shared by the strategies that place line by line: the region's lines
+// bucketed by (bank, row) per channel as the address mapping decodes them,
+// and how many lines each channel and bank has been given so far. Nodes too
+// big for a line go contiguously after the pool.
+class spread_placement : public treelet_placement
+{
+public:
+    uint64_t region_size(const treelet_layout &layout) const
+    {
+        uint64_t lines, oversized_bytes;
+        count(layout, lines, oversized_bytes);
+        // One more line so the pool can start line aligned inside the allocation
+        return (lines * TREELET_LAYOUT_REGION_SLACK + 1) * layout.geometry().line_size + oversized_bytes;
+    }
+
+    void place(treelet_layout &layout, uint8_t* base)
+    {
+        const treelet_layout_geometry &geometry = layout.geometry();
+        unsigned line_size = geometry.line_size;
+
+        uint64_t lines, oversized_bytes;
+        count(layout, lines, oversized_bytes);
+        uint64_t pool_lines = lines * TREELET_LAYOUT_REGION_SLACK;
+        uint64_t begin = align_up((uint64_t)base, line_size);
+
+        m_n_channels = geometry.n_channels;
+        m_n_banks = geometry.n_banks;
+        m_free.assign(m_n_channels, bucket_map());
+        m_cursor.assign(m_n_channels, bucket_key(0, 0));
+        m_channel_free.assign(m_n_channels, 0);
+        m_channel_load.assign(m_n_channels, 0);
+        m_bank_free.assign(m_n_channels * m_n_banks, 0);
+        m_bank_load.assign(m_n_channels * m_n_banks, 0);
+        // Highest address first so lines are taken in address order from the back
+        for (uint64_t l = pool_lines; l > 0; l--)
+        {
+            uint64_t addr = begin + (l - 1) * line_size;
+            treelet_layout_location loc = geometry.decode(addr);
+            assert(loc.channel < m_n_channels && loc.bank < m_n_banks);
+            m_free[loc.channel][bucket_key(loc.bank, loc.row)].push_back(addr);
+            m_channel_free[loc.channel]++;
+            m_bank_free[loc.channel * m_n_banks + loc.bank]++;
+        }
+
+        uint8_t* tail = (uint8_t*)(begin + pool_lines * line_size);
+        std::vector<line_group> groups;
+        std::vector<unsigned> oversized;
+        std::vector<uint64_t> line_addrs;
+        for (unsigned t = 0; t < layout.treelets().size(); t++)
+        {
+            const treelet_layout::layout_treelet &treelet = layout.treelets()[t];
+            pack_lines(treelet, line_size, groups, oversized);
+
+            line_addrs.clear();
+            choose_lines(t, groups.size(), line_addrs);
+            assert(line_addrs.size() == groups.size());
+            for (unsigned g = 0; g < groups.size(); g++)
+            {
+                uint8_t* addr = (uint8_t*)line_addrs[g];
+                for (unsigned i : groups[g].nodes)
+                {
+                    layout.map_node(treelet.nodes[i], addr);
+                    addr += treelet.nodes[i].size;
+                }
+            }
+            for (unsigned i : oversized)
+            {
+                layout.map_node(treelet.nodes[i], tail);
+                tail += align_up(treelet.nodes[i].size, line_size);
+            }
+        }
+        assert(tail <= base + region_size(layout));
+    }
+
+protected:
+    typedef std::pair<unsigned, unsigned> bucket_key; // (bank, row)
+    typedef std::map<bucket_key, std::vector<uint64_t> > bucket_map;
+
+    // Line addresses for the n_lines line groups of treelet, in group order
+    virtual void choose_lines(unsigned treelet, unsigned n_lines, std::vector<uint64_t> &lines) = 0;
+
+    // The min(n_lines, channels) channels with free lines that were given the
+    // fewest lines so far. Ties rotate with the treelet so equal treelets
+    // don't all start on channel 0.
+    void pick_channels(unsigned treelet, unsigned n_lines, std::vector<unsigned> &channels) const
+    {
+        channels.clear();
+        for (unsigned c = 0; c < m_n_channels; c++)
+        {
+            if (m_channel_free[c] > 0)
+                channels.push_back(c);
+        }
+        unsigned rotate = treelet % m_n_channels;
+        std::sort(channels.begin(), channels.end(), [&](unsigned a, unsigned b) {
+            if (m_channel_load[a] != m_channel_load[b])
+                return m_channel_load[a] < m_channel_load[b];
+            return (a + m_n_channels - rotate) % m_n_channels < (b + m_n_channels - rotate) % m_n_channels;
+        });
+        if (channels.size() > n_lines)
+            channels.resize(n_lines);
+        assert(!channels.empty() || n_lines == 0);
+    }
+
+    // Least loaded channel that still has free lines
+    unsigned any_channel() const
+    {
+        unsigned best = m_n_channels;
+        for (unsigned c = 0; c < m_n_channels; c++)
+        {
+            if (m_channel_free[c] > 0 && (best == m_n_channels || m_channel_load[c] < m_channel_load[best]))
+                best = c;
+        }
+        assert(best < m_n_channels);
+        return best;
+    }
+
+    uint64_t take_line(unsigned channel, bucket_map::iterator bucket)
+    {
+        uint64_t addr = bucket->second.back();
+        unsigned bank = bucket->first.first;
+        bucket->second.pop_back();
+        if (bucket->second.empty())
+            m_free[channel].erase(bucket);
+
+        m_channel_free[channel]--;
+        m_channel_load[channel]++;
+        m_bank_free[channel * m_n_banks + bank]--;
+        m_bank_load[channel * m_n_banks + bank]++;
+        return addr;
+    }
+
+    unsigned m_n_channels;
+    unsigned m_n_banks;
+    std::vector<bucket_map> m_free;         // per channel, free lines by (bank, row)
+    std::vector<bucket_key> m_cursor;       // per channel, the row the last treelet filled from
+    std::vector<uint64_t> m_channel_free;
+    std::vector<uint64_t> m_channel_load;
+    std::vector<uint64_t> m_bank_free;      // per (channel, bank)
+    std::vector<uint64_t> m_bank_load;
+
+private:
+    static void count(const treelet_layout &layout, uint64_t &lines, uint64_t &oversized_bytes)
+    {
+        unsigned line_size = layout.geometry().line_size;
+        std::vector<line_group> groups;
+        std::vector<unsigned> oversized;
+        lines = 0;
+        oversized_bytes = 0;
+        for (const auto &treelet : layout.treelets())
+        {
+            pack_lines(treelet, line_size, groups, oversized);
+            lines += groups.size();
+            for (unsigned i : oversized)
+                oversized_bytes += align_up(treelet.nodes[i].size, line_size);
+        }
+    }
+};
+
+
+// Channel parallelism first, then row buffer hits: a treelet's lines go round
+// robin over the least loaded channels, and the lines that share a channel
+// come from one (bank, row) so they are fetched with a single activation.
+class channel_rows_placement : public spread_placement
+{
+protected:
+    void choose_lines(unsigned treelet, unsigned n_lines, std::vector<uint64_t> &lines)
+    {
+        pick_channels(treelet, n_lines, m_channels);
+        lines.assign(n_lines, 0);
+        unsigned n_channels = m_channels.size();
+        for (unsigned k = 0; k < n_channels; k++)
+        {
+            // Groups k, k + n_channels, ... share this channel. Take them from
+            // the first row at or after the cursor that holds them all, else
+            // from the cursor's row onwards.
+            unsigned channel = m_channels[k];
+            unsigned g = k;
+            while (g < n_lines)
+            {
+                unsigned needed = (n_lines - g + n_channels - 1) / n_channels;
+                if (m_channel_free[channel] == 0)
+                    channel = any_channel();
+                bucket_map::iterator bucket = find_bucket(channel, needed);
+                m_cursor[channel] = bucket->first;
+
+                unsigned take = std::min<size_t>(needed, bucket->second.size());
+                for (unsigned i = 0; i < take; i++, g += n_channels)
+                    lines[g] = take_line(channel, bucket); // erases the bucket only on its last line
+            }
+        }
+    }
+
+private:
+    bucket_map::iterator find_bucket(unsigned channel, unsigned needed)
+    {
+        bucket_map &free = m_free[channel];
+        assert(!free.empty());
+        bucket_map::iterator start = free.lower_bound(m_cursor[channel]);
+        if (start == free.end())
+            start = free.begin();
+
+        bucket_map::iterator it = start;
+        do
+        {
+            if (it->second.size() >= needed)
+                return it;
+            if (++it == free.end())
+                it = free.begin();
+        } while (it != start);
+        return start;
+    }
+
+    std::vector<unsigned> m_channels;
+};
+
+
+// Channel and bank parallelism: a treelet's lines go round robin over the
+// least loaded channels, and within a channel each line goes to the bank this
+// treelet has used least, so the lines of a channel are fetched from
+// different banks in parallel rather than from one row.
+class channel_banks_placement : public spread_placement
+{
+protected:
+    void choose_lines(unsigned treelet, unsigned n_lines, std::vector<uint64_t> &lines)
+    {
+        pick_channels(treelet, n_lines, m_channels);
+        m_used.clear();
+        lines.assign(n_lines, 0);
+        for (unsigned g = 0; g < n_lines; g++)
+        {
+            unsigned channel = m_channels[g % m_channels.size()];
+            if (m_channel_free[channel] == 0)
+                channel = any_channel();
+
+            unsigned best = m_n_banks;
+            for (unsigned b = 0; b < m_n_banks; b++)
+            {
+                unsigned idx = channel * m_n_banks + b;
+                if (m_bank_free[idx] == 0)
+                    continue;
+                if (best == m_n_banks)
+                {
+                    best = b;
+                    continue;
+                }
+                unsigned best_idx = channel * m_n_banks + best;
+                if (m_used[idx] != m_used[best_idx] ? m_used[idx] < m_used[best_idx] : m_bank_load[idx] < m_bank_load[best_idx])
+                    best = b;
+            }
+            assert(best < m_n_banks);
+
+            bucket_map::iterator bucket = m_free[channel].lower_bound(bucket_key(best, 0));
+            assert(bucket != m_free[channel].end() && bucket->first.first == best);
+            m_used[channel * m_n_banks + best]++;
+            lines[g] = take_line(channel, bucket);
+        }
+    }
+
+private:
+    std::vector<unsigned> m_channels;
+    std::map<unsigned, unsigned> m_used; // lines of this treelet per (channel, bank)
+};
+
+
+template <class T>
+static treelet_placement *create_placement()
+{
+    return new T();
+}
+
+// Strategies selectable with -treelet_layout. To evaluate a new one, derive
+// from treelet_placement (or spread_placement) and add a line here.
+static const treelet_layout_strategy treelet_layout_strategies[] = {
+    {"packed", "treelets back to back in max_treelet_size + treelet_remap_stride slots", create_placement<packed_placement>},
+    {"channel_rows", "a treelet's lines spread over the least loaded channels, lines sharing a channel kept in one DRAM row", create_placement<channel_rows_placement>},
+    {"channel_banks", "a treelet's lines spread over the least loaded channels and over different banks within a channel", create_placement<channel_banks_placement>},
+    {"packed_compact", "as packed, without the gaps nodes shared with an earlier treelet leave", create_placement<packed_compact_placement>},
+};
+
+
+treelet_layout::treelet_layout(const treelet_layout_geometry &geometry, unsigned max_treelet_size, unsigned stride)
+    : m_geometry(geometry), m_max_treelet_size(max_treelet_size), m_stride(stride), m_placement(NULL)
+{
+    assert(m_geometry.n_channels > 0 && m_geometry.n_banks > 0 && m_geometry.line_size > 0);
+}
+
+
+treelet_layout::~treelet_layout()
+{
+    delete m_placement;
+}
+
+
+uint64_t treelet_layout::plan(unsigned strategy)
+{
+    delete m_placement;
+    m_placement = strategy_info(strategy).create();
+    return m_placement->region_size(*this);
+}
+
+
+void treelet_layout::place(uint8_t* base)
+{
+    assert(m_placement != NULL);
+    m_mapping.clear();
+    m_placement->place(*this, base);
+}
+
+
+void treelet_layout::map_node(const treelet_node &node, uint8_t* addr)
+{
+    bool inserted = m_mapping.insert(std::make_pair(node.addr, addr)).second;
+    assert(inserted);
+}
+
+
+unsigned treelet_layout::num_strategies()
+{
+    return sizeof(treelet_layout_strategies) / sizeof(treelet_layout_strategies[0]);
+}
+
+
+const treelet_layout_strategy &treelet_layout::strategy_info(unsigned strategy)
+{
+    assert(strategy < num_strategies());
+    return treelet_layout_strategies[strategy];
+}
+
+
+int treelet_layout::find_strategy(const char *name)
+{
+    for (unsigned i = 0; i < num_strategies(); i++)
+    {
+        if (strcmp(treelet_layout_strategies[i].name, name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+
+unsigned treelet_layout::resolve_strategy(const char *name)
+{
+    if (name == NULL || name[0] == '\0')
+        return 0;
+
+    int strategy = find_strategy(name);
+    if (strategy < 0)
+    {
+        printf("GPGPU-Sim uArch: error: unknown -treelet_layout %s, available strategies:\n", name);
+        for (unsigned i = 0; i < num_strategies(); i++)
+            printf("\t%-20s %s\n", treelet_layout_strategies[i].name, treelet_layout_strategies[i].description);
+        abort();
+    }
+    return strategy;
+}
+
+
+treelet_layout_load treelet_layout::treelet_load(const treelet_node &root, const std::vector<treelet_node> &nodes,
+                                                 const treelet_layout_geometry &geometry)
+{
+    std::set<uint64_t> lines;
+    auto add_lines = [&](const treelet_node &node) {
+        uint64_t end = (uint64_t)node.addr + node.size;
+        for (uint64_t line = (uint64_t)node.addr / geometry.line_size * geometry.line_size; line < end; line += geometry.line_size)
+            lines.insert(line);
+    };
+    add_lines(root);
+    for (const treelet_node &node : nodes)
+        add_lines(node);
+
+    treelet_layout_load load;
+    load.lines = lines.size();
+    load.channels = 0;
+    load.max_channel_lines = 0;
+    load.channel_lines.assign(geometry.n_channels, 0);
+
+    std::set<std::pair<unsigned, std::pair<unsigned, unsigned> > > rows;
+    for (uint64_t line : lines)
+    {
+        treelet_layout_location loc = geometry.decode(line);
+        assert(loc.channel < geometry.n_channels);
+        if (load.channel_lines[loc.channel]++ == 0)
+            load.channels++;
+        load.max_channel_lines = std::max(load.max_channel_lines, load.channel_lines[loc.channel]);
+        rows.insert(std::make_pair(loc.channel, std::make_pair(loc.bank, loc.row)));
+    }
+    load.activations = rows.size();
+    return load;
+}
+
+
+void treelet_layout::print_report(const std::vector<treelet_layout_load> &loads, const std::vector<uint8_t*> &roots,
+                                  const treelet_layout_geometry &geometry, const char *strategy, FILE *fp, const char *dump_path)
+{
+    unsigned long long lines = 0, channels = 0, max_channel_lines = 0, ideal_channel_lines = 0, activations = 0;
+    std::vector<unsigned long long> channel_lines(geometry.n_channels, 0);
+    for (const treelet_layout_load &load : loads)
+    {
+        lines += load.lines;
+        channels += load.channels;
+        max_channel_lines += load.max_channel_lines;
+        ideal_channel_lines += (load.lines + geometry.n_channels - 1) / geometry.n_channels;
+        activations += load.activations;
+        for (unsigned c = 0; c < geometry.n_channels; c++)
+            channel_lines[c] += load.channel_lines[c];
+    }
+
+    double n = loads.empty() ? 1.0 : (double)loads.size();
+    fprintf(fp, "Treelet layout %s: %zu treelets, %u channels, %u banks\n", strategy, loads.size(), geometry.n_channels, geometry.n_banks);
+    fprintf(fp, "Treelet layout per treelet: lines %.2f, channels %.2f, busiest channel lines %.2f (ideal %.2f), row activations %.2f, row hits %.2f\n",
+            lines / n, channels / n, max_channel_lines / n, ideal_channel_lines / n, activations / n, (lines - activations) / n);
+    fprintf(fp, "Treelet layout channel lines:");
+    for (unsigned c = 0; c < geometry.n_channels; c++)
+        fprintf(fp, " %llu", channel_lines[c]);
+    fprintf(fp, "\n");
+
+    if (dump_path == NULL || dump_path[0] == '\0')
+        return;
+    FILE *dump = fopen(dump_path, "w");
+    if (dump == NULL)
+    {
+        printf("Could not write treelet layout report %s\n", dump_path);
+        return;
+    }
+    fprintf(dump, "root,lines,channels,busiest_channel_lines,row_activations,channel_lines\n");
+    for (unsigned i = 0; i < loads.size(); i++)
+    {
+        fprintf(dump, "%p,%u,%u,%u,%u,", roots[i], loads[i].lines, loads[i].channels, loads[i].max_channel_lines, loads[i].activations);
+        for (unsigned c = 0; c < geometry.n_channels; c++)
+            fprintf(dump, c ? " %u" : "%u", loads[i].channel_lines[c]);
+        fprintf(dump, "\n");
+    }
+    fclose(dump);
+}
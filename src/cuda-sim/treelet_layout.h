@@ -0,0 +1,210 @@
+// Copyright (c) 2022, Mohammadreza Saed, Yuan Hsi Chou, Lufei Liu, Tor M. Aamodt,
+// The University of British Columbia
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+// Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution. Neither the name of
+// The University of British Columbia nor the names of its contributors may be
+// used to endorse or promote products derived from this software without
+// specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef TREELET_LAYOUT_H
+#define TREELET_LAYOUT_H
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <functional>
+#include <map>
+#include <set>
+#include <vector>
+
+#include "treelet_index.h"
+
+// Where the memory system sends one address
+typedef struct treelet_layout_location {
+    unsigned channel;
+    unsigned bank;
+    unsigned row;
+} treelet_layout_location;
+
+// DRAM organization a layout is planned against. decode is the simulator's
+// configured address mapping, so placements see the same IPOLY/PAE/custom
+// hashing the memory partitions do.
+typedef struct treelet_layout_geometry {
+    unsigned n_channels;
+    unsigned n_banks;
+    unsigned line_size; // placement unit, one L2 line
+    std::function<treelet_layout_location(uint64_t addr)> decode;
+} treelet_layout_geometry;
+
+class treelet_layout;
+
+// Placement strategy plugged into treelet_layout. A strategy says how big a
+// region it needs for the added treelets, then maps every node into the
+// region once it is allocated.
+class treelet_placement
+{
+public:
+    virtual ~treelet_placement() {}
+    virtual uint64_t region_size(const treelet_layout &layout) const = 0;
+    virtual void place(treelet_layout &layout, uint8_t* base) = 0;
+};
+
+// One entry of the placement strategy registry (see treelet_layout.cc)
+typedef struct treelet_layout_strategy {
+    const char *name;
+    const char *description;
+    treelet_placement *(*create)();
+} treelet_layout_strategy;
+
+// Per treelet DRAM load of fetching the whole treelet at once
+typedef struct treelet_layout_load {
+    unsigned lines;              // L2 lines the treelet's nodes touch
+    unsigned channels;           // channels those lines land on
+    unsigned max_channel_lines;  // lines on the busiest channel, the part of the fetch that serializes
+    unsigned activations;        // distinct (channel, bank, row), lines - activations are row buffer hits
+    std::vector<unsigned> channel_lines;
+} treelet_layout_load;
+
+// Plans where the remapped treelet BVH puts each node. Treelets are added in
+// the order remapBVHToTreeletLayout walks them, a strategy from the registry
+// sizes and fills the layout region, and mapping() then holds the original ->
+// layout address of every node.
+class treelet_layout
+{
+public:
+    typedef struct layout_treelet {
+        treelet_node root;
+        std::vector<treelet_node> nodes; // root first, nodes placed with an earlier treelet left out
+        std::vector<uint64_t> skipped;   // per node, bytes of left out nodes walked just before it
+    } layout_treelet;
+
+    treelet_layout(const treelet_layout_geometry &geometry, unsigned max_treelet_size, unsigned stride);
+    ~treelet_layout();
+
+    // A node already placed with an earlier treelet keeps that placement
+    // (the same BLAS reached from several instance leaves)
+    template <class Entry>
+    void add_treelet(const Entry &root, const std::vector<Entry> &nodes);
+
+    // Region bytes the strategy needs, then the placement into [base, base + size)
+    uint64_t plan(unsigned strategy);
+    void place(uint8_t* base);
+
+    const treelet_layout_geometry &geometry() const { return m_geometry; }
+    unsigned max_treelet_size() const { return m_max_treelet_size; }
+    unsigned stride() const { return m_stride; }
+    const std::vector<layout_treelet> &treelets() const { return m_treelets; }
+    const std::map<uint8_t*, uint8_t*> &mapping() const { return m_mapping; }
+
+    // For strategies
+    void map_node(const treelet_node &node, uint8_t* addr);
+
+    // Registry
+    static unsigned num_strategies();
+    static const treelet_layout_strategy &strategy_info(unsigned strategy);
+    static int find_strategy(const char *name);
+    // Resolves a strategy name, listing the choices and aborting if it is unknown
+    static unsigned resolve_strategy(const char *name);
+
+    // Whole-treelet DRAM load of already placed treelets. roots: <treelet
+    // root, nodes in this treelet> in layout addresses, like treelet_index::build.
+    template <class TreeletMap>
+    static void report(const TreeletMap &roots, const treelet_layout_geometry &geometry, const char *strategy,
+                       FILE *fp, const char *dump_path);
+
+private:
+    static treelet_layout_load treelet_load(const treelet_node &root, const std::vector<treelet_node> &nodes,
+                                            const treelet_layout_geometry &geometry);
+    static void print_report(const std::vector<treelet_layout_load> &loads, const std::vector<uint8_t*> &roots,
+                             const treelet_layout_geometry &geometry, const char *strategy, FILE *fp, const char *dump_path);
+
+    treelet_layout_geometry m_geometry;
+    unsigned m_max_treelet_size;
+    unsigned m_stride;
+
+    std::vector<layout_treelet> m_treelets;
+    std::set<uint8_t*> m_added;
+    std::map<uint8_t*, uint8_t*> m_mapping;
+
+    treelet_placement *m_placement;
+
+    treelet_layout(const treelet_layout &);
+    treelet_layout &operator=(const treelet_layout &);
+};
+
+
+template <class Entry>
+void treelet_layout::add_treelet(const Entry &root, const std::vector<Entry> &nodes)
+{
+    layout_treelet treelet;
+    treelet.root.addr = root.addr;
+    treelet.root.size = root.size;
+
+    bool root_added = m_added.insert(root.addr).second;
+    assert(root_added);
+    (void)root_added;
+    treelet.nodes.push_back(treelet.root);
+    treelet.skipped.push_back(0);
+    uint64_t skipped = 0;
+    for (const auto &node : nodes)
+    {
+        if (node.addr == root.addr)
+            continue;
+        if (m_added.insert(node.addr).second)
+        {
+            treelet_node entry = {node.addr, node.size};
+            treelet.nodes.push_back(entry);
+            treelet.skipped.push_back(skipped);
+            skipped = 0;
+        }
+        else
+            skipped += node.size;
+    }
+    m_treelets.push_back(treelet);
+}
+
+
+template <class TreeletMap>
+void treelet_layout::report(const TreeletMap &roots, const treelet_layout_geometry &geometry, const char *strategy,
+                            FILE *fp, const char *dump_path)
+{
+    std::vector<treelet_layout_load> loads;
+    std::vector<uint8_t*> root_addrs;
+    std::vector<treelet_node> nodes;
+    for (const auto &root : roots)
+    {
+        nodes.clear();
+        for (const auto &node : root.second)
+        {
+            treelet_node entry = {node.addr, node.size};
+            nodes.push_back(entry);
+        }
+        treelet_node root_node = {root.first.addr, root.first.size};
+        loads.push_back(treelet_load(root_node, nodes, geometry));
+        root_addrs.push_back(root.first.addr);
+    }
+    print_report(loads, root_addrs, geometry, strategy, fp, dump_path);
+}
+
+#endif /* TREELET_LAYOUT_H */
@@ -41,6 +41,7 @@
 #include "lvp_acceleration_structure.h"
 #include "gpgpusim_bvh.h"
 #endif
+#include "rt_simd_kernels.h"
 typedef struct float4x4 {
   float m[4][4];
 
@@ -507,6 +508,69 @@ inline void set_child_bounds(struct GEN_RT_BVH_INTERNAL_NODE *node, int child, f
    hi->z = node->Origin.Z + ldexpf(node->ChildUpperZBound[child], node->ChildBoundsExponentZ - 8);
 }
 
+// Decodes all six child boxes for the SIMD slab test, padding lanes are zeroed.
+// Returns the mask of children that are present. An 8-bit bound times a power
+// of two is exact, so this gives the same bits as set_child_bounds.
+inline unsigned set_children_bounds(struct GEN_RT_BVH_INTERNAL_NODE *node, rt_child_bounds *bounds)
+{
+   float scale_x = ldexpf(1.0f, node->ChildBoundsExponentX - 8);
+   float scale_y = ldexpf(1.0f, node->ChildBoundsExponentY - 8);
+   float scale_z = ldexpf(1.0f, node->ChildBoundsExponentZ - 8);
+
+   unsigned child_mask = 0;
+   for (int child = 0; child < 6; child++)
+   {
+      bounds->lo_x[child] = node->Origin.X + (float)node->ChildLowerXBound[child] * scale_x;
+      bounds->lo_y[child] = node->Origin.Y + (float)node->ChildLowerYBound[child] * scale_y;
+      bounds->lo_z[child] = node->Origin.Z + (float)node->ChildLowerZBound[child] * scale_z;
+
+      bounds->hi_x[child] = node->Origin.X + (float)node->ChildUpperXBound[child] * scale_x;
+      bounds->hi_y[child] = node->Origin.Y + (float)node->ChildUpperYBound[child] * scale_y;
+      bounds->hi_z[child] = node->Origin.Z + (float)node->ChildUpperZBound[child] * scale_z;
+
+      if (node->ChildSize[child] > 0)
+         child_mask |= 1u << child;
+   }
+   for (int lane = 6; lane < (int)rt_simd_kernels::LANES; lane++)
+   {
+      bounds->lo_x[lane] = bounds->lo_y[lane] = bounds->lo_z[lane] = 0.0f;
+      bounds->hi_x[lane] = bounds->hi_y[lane] = bounds->hi_z[lane] = 0.0f;
+   }
+   return child_mask;
+}
+
+// Gathers the triangles of the quad leaves among the children in child_mask for
+// the batched ray-triangle test, other lanes are zeroed. Returns the children
+// that are quad leaves.
+inline unsigned set_children_triangles(struct GEN_RT_BVH_INTERNAL_NODE *node, uint8_t *node_addr, unsigned child_mask, rt_triangle_batch *tris)
+{
+   unsigned quad_mask = 0;
+   uint8_t *child_addr = node_addr + (node->ChildOffset * 64);
+   for (int child = 0; child < (int)rt_simd_kernels::LANES; child++)
+   {
+      struct GEN_RT_BVH_VEC3 p[3] = {};
+      if (child < 6 && (child_mask & (1u << child)) && node->ChildType[child] != NODE_TYPE_INTERNAL)
+      {
+         struct GEN_RT_BVH_PRIMITIVE_LEAF_DESCRIPTOR leaf_descriptor;
+         uint8_t *data = GEN_RT_BVH_PRIMITIVE_LEAF_DESCRIPTOR_unpack(&leaf_descriptor, child_addr);
+         if (leaf_descriptor.LeafType == TYPE_QUAD)
+         {
+            // Skip PrimitiveIndex0 and PrimitiveIndex1Delta, the first three of the quad vertices
+            data += 8;
+            for (int i = 0; i < 3; i++)
+               data = GEN_RT_BVH_VEC3_unpack(&p[i], data);
+            quad_mask |= 1u << child;
+         }
+      }
+      tris->p0_x[child] = p[0].X; tris->p0_y[child] = p[0].Y; tris->p0_z[child] = p[0].Z;
+      tris->p1_x[child] = p[1].X; tris->p1_y[child] = p[1].Y; tris->p1_z[child] = p[1].Z;
+      tris->p2_x[child] = p[2].X; tris->p2_y[child] = p[2].Y; tris->p2_z[child] = p[2].Z;
+      if (child < 6)
+         child_addr += node->ChildSize[child] * 64;
+   }
+   return quad_mask;
+}
+
 
 // struct RT_BVH_VEC3 {
 //    float                                X;
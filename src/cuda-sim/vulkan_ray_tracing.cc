@@ -34,6 +34,11 @@
 #include <string>
 #include <fstream>
 #include <cmath>
+#include <chrono>
+#include <set>
+#include <thread>
+#include <unordered_map>
+#include <string.h>
 #define BOOST_FILESYSTEM_VERSION 3
 #define BOOST_FILESYSTEM_NO_DEPRECATED 
 #include <boost/filesystem.hpp>
@@ -55,6 +60,7 @@ namespace fs = boost::filesystem;
 #include "../../libcuda/gpgpu_context.h"
 #include "../../libcuda/cuda_api_object.h"
 #include "../gpgpu-sim/gpu-sim.h"
+#include "../gpgpu-sim/sim_thread_pool.h"
 #include "../cuda-sim/ptx_loader.h"
 #include "../cuda-sim/cuda-sim.h"
 #include "../cuda-sim/ptx_ir.h"
@@ -118,14 +124,15 @@ void* VulkanRayTracing::tlas_addr;
 bool VulkanRayTracing::dumped = false;
 
 bool use_external_launcher = false;
-const bool dump_trace = false;
+// Dump a replayable scene bundle (AS, descriptors, SBT, shader list) to $MESA_ROOT/gpgpusimShaders/
+const bool dump_trace = getenv("VULKAN_SIM_DUMP_TRACE") != NULL;
 
 // Treelets
 std::map<StackEntry, std::vector<StackEntry>> VulkanRayTracing::treelet_roots;
 std::map<uint8_t*, std::vector<StackEntry>> VulkanRayTracing::treelet_roots_addr_only;
 std::map<StackEntry, std::vector<StackEntry>> VulkanRayTracing::treelet_child_map;
 std::map<uint8_t*, std::vector<StackEntry>> VulkanRayTracing::treelet_addr_only_child_map;
-std::map<uint8_t*, uint8_t*> VulkanRayTracing::node_map_addr_only;
+treelet_index VulkanRayTracing::flat_treelet_index;
 
 std::map<uint8_t*, StackEntry> VulkanRayTracing::parent_map; // map <node, it's parent>
 std::map<uint8_t*, std::vector<StackEntry>> VulkanRayTracing::children_map; // map <node, it's children>
@@ -137,6 +144,7 @@ void* VulkanRayTracing::treelet_metadata;
 std::map<uint8_t*, unsigned> VulkanRayTracing::treelet_addr_to_metadata_idx;
 unsigned VulkanRayTracing::per_treelet_metadata_size;
 uint8_t* VulkanRayTracing::treelet_layout_bvh;
+uint64_t VulkanRayTracing::treelet_layout_bvh_size;
 std::map<uint8_t*, uint8_t*> VulkanRayTracing::original_bvh_to_treelet_bvh_mapping;
 
 
@@ -256,6 +264,70 @@ bool ray_box_test(float3 low, float3 high, float3 idirection, float3 origin, flo
     return (min <= max);
 }
 
+// Slab tests every child of an internal node in one go with the SIMD kernels.
+// Bit i of the result is set if child i is hit, thit[i] as from ray_box_test.
+unsigned ray_children_test(struct GEN_RT_BVH_INTERNAL_NODE *node, float3 idirection, float3 origin, float tmin, float tmax, float thit[rt_simd_kernels::LANES])
+{
+    rt_child_bounds bounds;
+    unsigned child_mask = set_children_bounds(node, &bounds);
+    unsigned hits = rt_simd_kernels::ray_box_test(bounds, child_mask, idirection, origin, tmin, tmax, thit);
+
+    if (rt_simd_kernels::check())
+    {
+        for (int i = 0; i < 6; i++)
+        {
+            if (!(child_mask & (1u << i)))
+                continue;
+
+            float3 lo, hi;
+            float scalar_thit;
+            set_child_bounds(node, i, &lo, &hi);
+            bool scalar_hit = ray_box_test(lo, hi, idirection, origin, tmin, tmax, scalar_thit);
+            if (scalar_hit != (bool)((hits >> i) & 1) || memcmp(&scalar_thit, &thit[i], sizeof(float)) != 0)
+            {
+                printf("GPGPU-Sim: %s ray-box test disagrees with scalar for child %d: hit %d/%d, thit %a/%a\n",
+                       rt_simd_kernels::isa_name(rt_simd_kernels::isa()), i, (hits >> i) & 1, scalar_hit, thit[i], scalar_thit);
+                abort();
+            }
+        }
+    }
+    return hits;
+}
+
+// Moller-Trumbore tests the triangles of every quad leaf in child_mask in one
+// go. tested gets the children that are quad leaves, bit i of the result is set
+// if child i is hit and thit[i] is then as from mt_ray_triangle_test.
+unsigned ray_leaf_children_test(struct GEN_RT_BVH_INTERNAL_NODE *node, uint8_t *node_addr, unsigned child_mask, Ray ray, unsigned &tested, float thit[rt_simd_kernels::LANES])
+{
+    rt_triangle_batch tris;
+    tested = set_children_triangles(node, node_addr, child_mask, &tris);
+    if (!tested)
+        return 0;
+    unsigned hits = rt_simd_kernels::ray_triangle_test(tris, tested, ray.get_origin(), ray.get_direction(), thit);
+
+    if (rt_simd_kernels::check())
+    {
+        for (int i = 0; i < 6; i++)
+        {
+            if (!(tested & (1u << i)))
+                continue;
+
+            float3 p0 = {tris.p0_x[i], tris.p0_y[i], tris.p0_z[i]};
+            float3 p1 = {tris.p1_x[i], tris.p1_y[i], tris.p1_z[i]};
+            float3 p2 = {tris.p2_x[i], tris.p2_y[i], tris.p2_z[i]};
+            float scalar_thit = 0;
+            bool scalar_hit = mt_ray_triangle_test(p0, p1, p2, ray.get_origin(), ray.get_direction(), &scalar_thit);
+            if (scalar_hit != (bool)((hits >> i) & 1) || (scalar_hit && memcmp(&scalar_thit, &thit[i], sizeof(float)) != 0))
+            {
+                printf("GPGPU-Sim: %s ray-triangle test disagrees with scalar for child %d: hit %d/%d, thit %a/%a\n",
+                       rt_simd_kernels::isa_name(rt_simd_kernels::isa()), i, (hits >> i) & 1, scalar_hit, thit[i], scalar_thit);
+                abort();
+            }
+        }
+    }
+    return hits;
+}
+
 
 
 std::ofstream print_tree;
@@ -461,43 +533,75 @@ bool VulkanRayTracing::isTreeletRoot(StackEntry node)
 
 bool VulkanRayTracing::isTreeletRoot(uint8_t* addr)
 {
-    return treelet_roots_addr_only.count(addr);
+    return flat_treelet_index.is_root(addr);
 }
 
 
 uint8_t* VulkanRayTracing::addrToTreeletID(uint8_t* addr) // returns the treelet ID/address that a node belongs to
 {
-    assert(node_map_addr_only.count(addr));
-    return node_map_addr_only[addr];
+    unsigned treelet = flat_treelet_index.node_treelet(addr);
+    assert(treelet != treelet_index::INVALID_ID);
+    return flat_treelet_index.root_addr(treelet);
+}
+
+
+// Where remapBVHToTreeletLayout put the node at device address addr. Walks
+// run in parallel under -rt_trace_threads, so this must not insert into the
+// mapping the way operator[] does: an address that has no entry (a treelet
+// root taken from other_treelet_stack is a host address) gives NULL, which is
+// what operator[] returned for it.
+uint8_t* VulkanRayTracing::treeletLayoutAddr(uint8_t* addr)
+{
+    std::map<uint8_t*, uint8_t*>::const_iterator it = original_bvh_to_treelet_bvh_mapping.find(addr);
+    return it == original_bvh_to_treelet_bvh_mapping.end() ? NULL : it->second;
 }
 
 
 void VulkanRayTracing::buildNodeToRootMap()
 {
-    std::map<uint8_t*, uint8_t*> node_map; // map <node, it's treelet root>
+    flat_treelet_index.build(treelet_roots_addr_only, treelet_addr_only_child_map);
+    printf("Treelet index: %u nodes in %u treelets\n", flat_treelet_index.num_nodes(), flat_treelet_index.num_treelets());
+
+    if (GPGPU_Context()->the_gpgpusim->g_the_gpu->get_m_cluster()[0]->get_m_core()[0]->get_config()->treelet_index_benchmark)
+        benchmarkTreeletIndex();
+}
+
+
+// Checks the flat treelet index against the std::map tables it was built from and reports lookup throughput of both
+void VulkanRayTracing::benchmarkTreeletIndex()
+{
+    const unsigned passes = 16;
 
+    std::map<uint8_t*, uint8_t*> node_map; // map <node, it's treelet root>
     for (auto root : treelet_roots_addr_only)
     {
-        node_map[root.first] = root.first; // add the root to the node map;
+        node_map[root.first] = root.first;
         for (auto node : root.second)
-        {
-            node_map[node.addr] = root.first; // add the nodes to the node map
-        }
+            node_map[node.addr] = root.first;
     }
 
-    node_map_addr_only = node_map;
-}
-
+    for (auto node : node_map)
+    {
+        assert(addrToTreeletID(node.first) == node.second);
+        assert(isTreeletRoot(node.first) == (treelet_roots_addr_only.count(node.first) != 0));
+    }
+    for (auto root : treelet_roots_addr_only)
+        assert(flat_treelet_index.treelet_nodes(root.first).size() == root.second.size());
 
-std::vector<StackEntry> VulkanRayTracing::treeletIDToChildren(StackEntry treelet_root) // returns child treelet IDs of a given treelet
-{
-    return treelet_child_map[treelet_root];
-}
+    unsigned long long checksum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned pass = 0; pass < passes; pass++)
+    {
+        for (auto node : node_map)
+            checksum += (uintptr_t)node_map.find(node.first)->second;
+    }
+    auto end = std::chrono::steady_clock::now();
+    double map_seconds = std::chrono::duration<double>(end - start).count();
+    double map_lookups_per_sec = map_seconds > 0.0 ? (double)node_map.size() * passes / map_seconds : 0.0;
 
+    double flat_lookups_per_sec = flat_treelet_index.benchmark(passes);
 
-std::vector<StackEntry> VulkanRayTracing::treeletIDToChildren(uint8_t* treelet_root) // returns child treelet IDs of a given treelet
-{
-    return treelet_addr_only_child_map[treelet_root];
+    printf("Treelet index benchmark (checksum %llu): std::map %.0f lookups/s, flat index %.0f lookups/s\n", checksum, map_lookups_per_sec, flat_lookups_per_sec);
 }
 
 
@@ -820,7 +924,8 @@ void VulkanRayTracing::createTreeletsBottomUp(VkAccelerationStructureKHR _topLev
 }
 
 
-void VulkanRayTracing::createTreelets(VkAccelerationStructureKHR _topLevelAS, int64_t device_offset, int maxBytesPerTreelet)
+// Reference builder: a single greedy walk over one FIFO of pending treelet roots
+void VulkanRayTracing::formTreeletsSequential(VkAccelerationStructureKHR _topLevelAS, int64_t device_offset, int maxBytesPerTreelet, treelet_partition &partition)
 {
     unsigned total_bvh_size = 0;
     int remaining_bytes = maxBytesPerTreelet;
@@ -1308,7 +1413,6 @@ void VulkanRayTracing::createTreelets(VkAccelerationStructureKHR _topLevelAS, in
     }
 
     // Remove dupes in completed_treelet_roots_addr_only
-    unsigned metadata_id = 0;
     for (auto root_node : completed_treelet_roots_addr_only)
     {
         std::vector <StackEntry> dupe_free_node_list;
@@ -1328,9 +1432,6 @@ void VulkanRayTracing::createTreelets(VkAccelerationStructureKHR _topLevelAS, in
                 dupe_free_node_list.push_back(root_node.second[i]);
         }
         completed_treelet_roots_addr_only[root_node.first] = dupe_free_node_list;
-
-        treelet_addr_to_metadata_idx[root_node.first] = metadata_id;
-        metadata_id++;
     }
 
     // Remove dupes in completed_treelet_roots
@@ -1355,13 +1456,356 @@ void VulkanRayTracing::createTreelets(VkAccelerationStructureKHR _topLevelAS, in
         completed_treelet_roots[root_node.first] = dupe_free_node_list;
     }
 
+    partition.roots.swap(completed_treelet_roots);
+    partition.roots_addr_only.swap(completed_treelet_roots_addr_only);
+    partition.child_map.swap(treelet_root_child_map);
+    partition.addr_only_child_map.swap(treelet_root_addr_only_child_map);
+    partition.total_bvh_size = total_bvh_size;
+}
+
+
+// One treelet of the parallel builder. The root and frontier stay in host
+// addresses since they are where later walks start, nodes and children are in
+// device addresses like the tables formTreeletsSequential fills.
+struct formed_treelet {
+    StackEntry root;
+    std::vector<StackEntry> nodes;     // duplicates removed, first occurrence order
+    std::vector<StackEntry> children;  // frontier minus its first entry, as formTreeletsSequential records them
+    std::vector<StackEntry> frontier;  // nodes that did not fit, each one is the root of a later treelet
+    unsigned bytes;                    // what this treelet adds to the total BVH size
+};
+
+// Bytes a stack entry needs before the greedy walk takes it. Instance leaves are read together with the BLAS header.
+static int treelet_entry_bytes(const StackEntry &entry)
+{
+    return entry.topLevel && entry.leaf ? GEN_RT_BVH_INSTANCE_LEAF_length * 4 + GEN_RT_BVH_length * 4 : entry.size;
+}
+
+static StackEntry treelet_device_entry(StackEntry entry, int64_t device_offset, const std::map<void*, void*> &blas_addr_map)
+{
+    if (entry.isBlasRoot) {
+        auto blas = blas_addr_map.find((void*)entry.addr);
+        assert(blas != blas_addr_map.end());
+        entry.addr = (uint8_t*)blas->second;
+    }
+    else {
+        entry.addr += device_offset;
+    }
+    return entry;
+}
+
+// The inner loop of formTreeletsSequential for a single treelet: takes nodes in
+// FIFO order from 'start' while the next one fits. Nothing carries over from one
+// treelet to the next except the pending roots, so treelets are independent of
+// each other and can be formed on any thread. SAH values are not computed since
+// the sequential builder never reads them.
+static void grow_treelet(formed_treelet &treelet, const StackEntry &start, int remaining_bytes, std::vector<StackEntry> &host_nodes,
+                         int64_t device_offset, const std::map<void*, void*> &blas_addr_map)
+{
+    std::vector<StackEntry> stack;
+    size_t stack_head = 0;
+    StackEntry next_node = start;
+
+    while (true)
+    {
+        uint8_t *node_addr = next_node.addr;
+        if (next_node.topLevel && !next_node.leaf) // top level internal node
+        {
+            struct GEN_RT_BVH_INTERNAL_NODE node;
+            GEN_RT_BVH_INTERNAL_NODE_unpack(&node, node_addr);
+            remaining_bytes -= GEN_RT_BVH_INTERNAL_NODE_length * 4;
+            assert(remaining_bytes >= 0);
+            treelet.bytes += GEN_RT_BVH_INTERNAL_NODE_length * 4;
+            host_nodes.push_back(next_node);
+
+            uint8_t *child_addr = node_addr + (node.ChildOffset * 64);
+            for (int i = 0; i < 6; i++)
+            {
+                if (node.ChildSize[i] > 0)
+                {
+                    if (node.ChildType[i] != NODE_TYPE_INTERNAL)
+                    {
+                        assert(node.ChildType[i] == NODE_TYPE_INSTANCE);
+                        stack.push_back(StackEntry(child_addr, true, true, GEN_RT_BVH_INSTANCE_LEAF_length * 4));
+                    }
+                    else
+                        stack.push_back(StackEntry(child_addr, true, false, GEN_RT_BVH_INTERNAL_NODE_length * 4));
+                }
+                child_addr += node.ChildSize[i] * 64;
+            }
+        }
+        else if (next_node.topLevel && next_node.leaf) // top level leaf node
+        {
+            GEN_RT_BVH_INSTANCE_LEAF instanceLeaf;
+            GEN_RT_BVH_INSTANCE_LEAF_unpack(&instanceLeaf, node_addr);
+            remaining_bytes -= GEN_RT_BVH_INSTANCE_LEAF_length * 4;
+            assert(remaining_bytes >= 0);
+            treelet.bytes += GEN_RT_BVH_INSTANCE_LEAF_length * 4;
+            host_nodes.push_back(next_node);
+
+            assert(instanceLeaf.BVHAddress != NULL);
+            uint8_t *blas_addr = node_addr + instanceLeaf.BVHAddress;
+            GEN_RT_BVH botLevelASAddr;
+            GEN_RT_BVH_unpack(&botLevelASAddr, blas_addr);
+            assert(blas_addr_map.find((void*)blas_addr) != blas_addr_map.end());
+            remaining_bytes -= GEN_RT_BVH_length * 4;
+            host_nodes.push_back(StackEntry(blas_addr, true, true, GEN_RT_BVH_length * 4, true));
+            assert(remaining_bytes >= 0);
+            treelet.bytes += GEN_RT_BVH_length * 4;
+
+            stack.push_back(StackEntry(blas_addr + botLevelASAddr.RootNodeOffset, false, false, GEN_RT_BVH_INTERNAL_NODE_length * 4));
+        }
+        else if (!next_node.topLevel && !next_node.leaf) // bottom level internal node
+        {
+            struct GEN_RT_BVH_INTERNAL_NODE node;
+            GEN_RT_BVH_INTERNAL_NODE_unpack(&node, node_addr);
+            remaining_bytes -= GEN_RT_BVH_INTERNAL_NODE_length * 4;
+            assert(remaining_bytes >= 0);
+            treelet.bytes += GEN_RT_BVH_INTERNAL_NODE_length * 4;
+            host_nodes.push_back(next_node);
+
+            uint8_t *child_addr = node_addr + (node.ChildOffset * 64);
+            for (int i = 0; i < 6; i++)
+            {
+                if (node.ChildSize[i] > 0)
+                {
+                    if (node.ChildType[i] != NODE_TYPE_INTERNAL)
+                        stack.push_back(StackEntry(child_addr, false, true, GEN_RT_BVH_length * 4));
+                    else
+                        stack.push_back(StackEntry(child_addr, false, false, GEN_RT_BVH_INTERNAL_NODE_length * 4));
+                }
+                child_addr += node.ChildSize[i] * 64;
+            }
+        }
+        else // bottom level leaf node
+        {
+            struct GEN_RT_BVH_PRIMITIVE_LEAF_DESCRIPTOR leaf_descriptor;
+            GEN_RT_BVH_PRIMITIVE_LEAF_DESCRIPTOR_unpack(&leaf_descriptor, node_addr);
+            host_nodes.push_back(next_node);
+
+            int leaf_bytes = leaf_descriptor.LeafType == TYPE_QUAD ? GEN_RT_BVH_QUAD_LEAF_length * 4 : GEN_RT_BVH_PROCEDURAL_LEAF_length * 4;
+            remaining_bytes -= leaf_bytes;
+            assert(remaining_bytes >= 0);
+            treelet.bytes += leaf_bytes;
+        }
+
+        if (stack_head == stack.size() || remaining_bytes - treelet_entry_bytes(stack[stack_head]) < 0)
+            break;
+        next_node = stack[stack_head++];
+    }
+
+    // Whatever is left on the stack becomes later treelet roots
+    treelet.frontier.assign(stack.begin() + stack_head, stack.end());
+    for (size_t i = 1; i < treelet.frontier.size(); i++)
+        treelet.children.push_back(treelet_device_entry(treelet.frontier[i], device_offset, blas_addr_map));
+
+    std::set<uint8_t*> seen;
+    for (auto node : host_nodes)
+    {
+        StackEntry device_node = treelet_device_entry(node, device_offset, blas_addr_map);
+        if (seen.insert(device_node.addr).second)
+            treelet.nodes.push_back(device_node);
+    }
+}
+
+
+// Forms the same partition as formTreeletsSequential. Every treelet depends only
+// on its root, so the pending queue is worked off in rounds: all roots found in
+// one round are grown in parallel into their own slot of a flat array, and the
+// next round is their frontiers in queue order. A root that is reached again
+// (a BLAS shared by several instances) is grown once; the sequential builder
+// regrows it to the same result each time, which only shows up in the BVH size.
+void VulkanRayTracing::formTreeletsParallel(VkAccelerationStructureKHR _topLevelAS, int64_t device_offset, int maxBytesPerTreelet, unsigned n_threads, treelet_partition &partition)
+{
+    std::vector<formed_treelet> treelets;
+    std::unordered_map<uint8_t*, unsigned> treelet_ids; // <host root address, index into treelets>
+
+    treelets.push_back(formed_treelet());
+    treelets[0].root = StackEntry((uint8_t*)_topLevelAS, true, false, GEN_RT_BVH_length * 4);
+    treelets[0].bytes = 0;
+    treelet_ids[treelets[0].root.addr] = 0;
+
+    std::vector<unsigned> round(1, 0);
+    sim_thread_pool pool(n_threads);
+    while (!round.empty())
+    {
+        pool.run(round.size(), [&](unsigned t) {
+            formed_treelet &treelet = treelets[round[t]];
+            std::vector<StackEntry> host_nodes;
+            if (round[t] == 0)
+            {
+                // The TLAS header opens the first treelet, the walk starts at the TLAS root node
+                GEN_RT_BVH topBVH;
+                GEN_RT_BVH_unpack(&topBVH, (uint8_t*)_topLevelAS);
+                host_nodes.push_back(treelet.root);
+                treelet.bytes = GEN_RT_BVH_length * 4;
+                StackEntry top_root((uint8_t*)_topLevelAS + topBVH.RootNodeOffset, true, false, GEN_RT_BVH_INTERNAL_NODE_length * 4);
+                grow_treelet(treelet, top_root, maxBytesPerTreelet - GEN_RT_BVH_length * 4, host_nodes, device_offset, blas_addr_map);
+            }
+            else
+            {
+                treelet.bytes = 0;
+                grow_treelet(treelet, treelet.root, maxBytesPerTreelet, host_nodes, device_offset, blas_addr_map);
+            }
+        });
+
+        std::vector<unsigned> next_round;
+        for (unsigned id : round)
+        {
+            for (size_t i = 0; i < treelets[id].frontier.size(); i++)
+            {
+                const StackEntry &root = treelets[id].frontier[i];
+                if (treelet_ids.insert(std::make_pair(root.addr, (unsigned)treelets.size())).second)
+                {
+                    next_round.push_back(treelets.size());
+                    treelets.push_back(formed_treelet());
+                    treelets.back().root = treelets[id].frontier[i];
+                }
+            }
+        }
+        round.swap(next_round);
+    }
+
+    // Merge the flat array into the treelet maps
+    for (auto &treelet : treelets)
+    {
+        StackEntry root = treelet_device_entry(treelet.root, device_offset, blas_addr_map);
+        partition.roots[root] = treelet.nodes;
+        partition.roots_addr_only[root.addr] = treelet.nodes;
+        partition.child_map[root] = treelet.children;
+        partition.addr_only_child_map[root.addr] = treelet.children;
+    }
+
+    // The sequential builder counts a treelet once per time it is queued, i.e. the
+    // BVH size is the size of the treelet tree with shared subtrees expanded.
+    // Summed bottom up over the treelet DAG, in unsigned like total_bvh_size.
+    std::vector<unsigned> subtree_bytes(treelets.size(), 0);
+    std::vector<char> state(treelets.size(), 0); // 0 = not visited, 1 = children pending, 2 = done
+    std::vector<unsigned> dfs(1, 0);
+    while (!dfs.empty())
+    {
+        unsigned id = dfs.back();
+        if (state[id] == 0)
+        {
+            state[id] = 1;
+            for (auto &root : treelets[id].frontier)
+            {
+                unsigned child = treelet_ids[root.addr];
+                if (state[child] == 0)
+                    dfs.push_back(child);
+            }
+            continue;
+        }
+
+        dfs.pop_back();
+        if (state[id] == 2)
+            continue;
+        unsigned bytes = treelets[id].bytes;
+        for (auto &root : treelets[id].frontier)
+            bytes += subtree_bytes[treelet_ids[root.addr]];
+        subtree_bytes[id] = bytes;
+        state[id] = 2;
+    }
+    partition.total_bvh_size = subtree_bytes[0];
+}
+
+
+static bool sameTreeletLists(const std::vector<StackEntry> &a, const std::vector<StackEntry> &b)
+{
+    if (a.size() != b.size())
+        return false;
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        if (!(a[i] == b[i]) || a[i].size != b[i].size || a[i].isBlasRoot != b[i].isBlasRoot)
+            return false;
+    }
+    return true;
+}
+
+template <class TreeletMap>
+static bool sameTreeletMaps(const TreeletMap &a, const TreeletMap &b)
+{
+    if (a.size() != b.size())
+        return false;
+    for (auto ia = a.begin(), ib = b.begin(); ia != a.end(); ++ia, ++ib)
+    {
+        if (ia->first < ib->first || ib->first < ia->first || !sameTreeletLists(ia->second, ib->second))
+            return false;
+    }
+    return true;
+}
+
+static bool sameTreeletPartitions(const treelet_partition &a, const treelet_partition &b)
+{
+    return a.total_bvh_size == b.total_bvh_size &&
+           sameTreeletMaps(a.roots, b.roots) && sameTreeletMaps(a.roots_addr_only, b.roots_addr_only) &&
+           sameTreeletMaps(a.child_map, b.child_map) && sameTreeletMaps(a.addr_only_child_map, b.addr_only_child_map);
+}
+
+
+// Times the sequential builder against the parallel one at 1, 2, 4, ... threads up to the host's hardware threads (or -treelet_build_threads if higher)
+void VulkanRayTracing::benchmarkTreeletBuild(VkAccelerationStructureKHR _topLevelAS, int64_t device_offset, int maxBytesPerTreelet)
+{
+    const shader_core_config *config = GPGPU_Context()->the_gpgpusim->g_the_gpu->get_m_cluster()[0]->get_m_core()[0]->get_config();
+    unsigned max_threads = std::max(std::max(std::thread::hardware_concurrency(), 1u), config->treelet_build_threads);
+
+    treelet_partition reference;
+    auto start = std::chrono::steady_clock::now();
+    formTreeletsSequential(_topLevelAS, device_offset, maxBytesPerTreelet, reference);
+    double sequential_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("Treelet build benchmark: sequential %.3f s, %zu treelets\n", sequential_seconds, reference.roots.size());
+
+    for (unsigned n_threads = 1; ; n_threads = std::min(n_threads * 2, max_threads))
+    {
+        treelet_partition partition;
+        start = std::chrono::steady_clock::now();
+        formTreeletsParallel(_topLevelAS, device_offset, maxBytesPerTreelet, n_threads, partition);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        bool same = sameTreeletPartitions(reference, partition);
+        printf("Treelet build benchmark: %u threads %.3f s (%.2fx sequential)%s\n", n_threads, seconds,
+               seconds > 0.0 ? sequential_seconds / seconds : 0.0, same ? "" : ", PARTITION DIFFERS");
+        assert(same);
+
+        if (n_threads == max_threads)
+            break;
+    }
+}
+
+
+void VulkanRayTracing::createTreelets(VkAccelerationStructureKHR _topLevelAS, int64_t device_offset, int maxBytesPerTreelet)
+{
+    const shader_core_config *config = GPGPU_Context()->the_gpgpusim->g_the_gpu->get_m_cluster()[0]->get_m_core()[0]->get_config();
+    if (config->treelet_build_benchmark)
+        benchmarkTreeletBuild(_topLevelAS, device_offset, maxBytesPerTreelet);
+
+    unsigned n_threads = config->treelet_build_threads ? config->treelet_build_threads : std::max(std::thread::hardware_concurrency(), 1u);
+    treelet_partition partition;
+    if (n_threads > 1)
+        formTreeletsParallel(_topLevelAS, device_offset, maxBytesPerTreelet, n_threads, partition);
+    else
+        formTreeletsSequential(_topLevelAS, device_offset, maxBytesPerTreelet, partition);
+    installTreelets(partition, maxBytesPerTreelet);
+}
+
+
+void VulkanRayTracing::installTreelets(treelet_partition &partition, int maxBytesPerTreelet)
+{
     std::cout << "Treelet formation done" << std::endl;
-    treelet_roots = completed_treelet_roots;
-    treelet_roots_addr_only = completed_treelet_roots_addr_only;
+    treelet_roots.swap(partition.roots);
+    treelet_roots_addr_only.swap(partition.roots_addr_only);
 
-    treelet_child_map = treelet_root_child_map; // not used
-    treelet_addr_only_child_map = treelet_root_addr_only_child_map; // not used
-    std::cout << "Total BVH Size: " << total_bvh_size << " bytes" << std::endl;
+    treelet_addr_to_metadata_idx.clear();
+    unsigned metadata_id = 0;
+    for (auto root_node : treelet_roots_addr_only)
+    {
+        treelet_addr_to_metadata_idx[root_node.first] = metadata_id;
+        metadata_id++;
+    }
+
+    treelet_child_map.swap(partition.child_map); // not used
+    treelet_addr_only_child_map.swap(partition.addr_only_child_map); // not used
+    std::cout << "Total BVH Size: " << partition.total_bvh_size << " bytes" << std::endl;
     std::cout << "Treelet Size: " << maxBytesPerTreelet << " bytes" << std::endl;
     std::cout << "Treelet Count: " << treelet_roots_addr_only.size() << std::endl;
 
@@ -1410,6 +1854,7 @@ void VulkanRayTracing::createTreelets(VkAccelerationStructureKHR _topLevelAS, in
         treelet_roots = remapped_treelet_roots;
         treelet_roots_addr_only = remapped_treelet_roots_addr_only;
         printf("Finished remapping the treelet_root maps\n");
+        reportTreeletLayout();
     }
 
     buildNodeToRootMap();
@@ -1472,40 +1917,297 @@ void VulkanRayTracing::createTreelets(VkAccelerationStructureKHR _topLevelAS, in
 
 void VulkanRayTracing::remapBVHToTreeletLayout()
 {
-    uint64_t treelet_remap_stride = (uint64_t)GPGPU_Context()->the_gpgpusim->g_the_gpu->get_m_cluster()[0]->get_m_core()[0]->get_config()->treelet_remap_stride;
-
-    treelet_layout_bvh = (uint8_t*)gpgpusim_malloc(treelet_roots_addr_only.size() * GPGPU_Context()->the_gpgpusim->g_the_gpu->get_config().max_treelet_size);
-    assert(treelet_layout_bvh != NULL);
+    const shader_core_config *config = GPGPU_Context()->the_gpgpusim->g_the_gpu->get_m_cluster()[0]->get_m_core()[0]->get_config();
+    unsigned strategy = treelet_layout::resolve_strategy(config->treelet_layout_name);
     assert(treelet_roots.size() == treelet_roots_addr_only.size());
 
-    uint64_t i = 0;
+    treelet_layout layout(treeletLayoutGeometry(), GPGPU_Context()->the_gpgpusim->g_the_gpu->get_config().max_treelet_size, config->treelet_remap_stride);
     for (auto root : treelet_roots)
+        layout.add_treelet(root.first, root.second);
+
+    treelet_layout_bvh_size = layout.plan(strategy);
+    treelet_layout_bvh = (uint8_t*)gpgpusim_malloc(treelet_layout_bvh_size);
+    assert(treelet_layout_bvh != NULL);
+    layout.place(treelet_layout_bvh);
+
+    for (auto mapping : layout.mapping())
     {
-        uint8_t* new_treelet_root_addr = treelet_layout_bvh + i * (GPGPU_Context()->the_gpgpusim->g_the_gpu->get_config().max_treelet_size + treelet_remap_stride);
-        if (i > 0)
-            assert(new_treelet_root_addr > treelet_layout_bvh);
-        assert(original_bvh_to_treelet_bvh_mapping.count(root.first.addr) == 0);
+        assert(original_bvh_to_treelet_bvh_mapping.count(mapping.first) == 0);
+        original_bvh_to_treelet_bvh_mapping[mapping.first] = mapping.second;
+    }
+    printf("Done remapping BVH to treelet layout (%s)\n", treelet_layout::strategy_info(strategy).name);
+}
 
-        original_bvh_to_treelet_bvh_mapping[root.first.addr] = new_treelet_root_addr;
-        uint8_t* new_node_addr = new_treelet_root_addr + root.first.size;
 
-        for (auto node : root.second)
+// The DRAM organization and address mapping the memory partitions use
+treelet_layout_geometry VulkanRayTracing::treeletLayoutGeometry()
+{
+    const memory_config *mem_config = GPGPU_Context()->the_gpgpusim->g_the_gpu->getMemoryConfig();
+
+    treelet_layout_geometry geometry;
+    geometry.n_channels = mem_config->m_n_mem;
+    geometry.n_banks = mem_config->nbk;
+    geometry.line_size = MAX_MEMORY_ACCESS_SIZE;
+    geometry.decode = [mem_config](uint64_t addr) {
+        addrdec_t tlx;
+        mem_config->m_address_mapping.addrdec_tlx(addr, &tlx);
+        treelet_layout_location loc = {tlx.chip, tlx.bk, tlx.row};
+        return loc;
+    };
+    return geometry;
+}
+
+
+// Expected DRAM load of fetching each remapped treelet whole
+void VulkanRayTracing::reportTreeletLayout()
+{
+    const shader_core_config *config = GPGPU_Context()->the_gpgpusim->g_the_gpu->get_m_cluster()[0]->get_m_core()[0]->get_config();
+    unsigned strategy = treelet_layout::resolve_strategy(config->treelet_layout_name);
+    treelet_layout::report(treelet_roots, treeletLayoutGeometry(), treelet_layout::strategy_info(strategy).name, stdout,
+                           config->treelet_layout_report);
+}
+
+
+// Forms treelets, or restores them from -treelet_cache_dir if this acceleration structure was partitioned with the same options before
+void VulkanRayTracing::formTreelets(VkAccelerationStructureKHR _topLevelAS, int64_t device_offset, int maxBytesPerTreelet)
+{
+    const shader_core_config *config = GPGPU_Context()->the_gpgpusim->g_the_gpu->get_m_cluster()[0]->get_m_core()[0]->get_config();
+    if (config->treelet_cache_dir == NULL || config->treelet_cache_dir[0] == '\0')
+    {
+        createTreelets(_topLevelAS, device_offset, maxBytesPerTreelet);
+        return;
+    }
+
+    treelet_cache_key key;
+    memset(&key, 0, sizeof(key));
+    key.as_hash = hashAccelerationStructure(_topLevelAS, device_offset);
+    key.tlas_device_addr = (uint64_t)_topLevelAS + device_offset;
+    key.max_treelet_size = maxBytesPerTreelet;
+    key.remap_to_treelet_layout = config->remap_to_treelet_layout;
+    key.treelet_remap_stride = config->remap_to_treelet_layout ? config->treelet_remap_stride : 0;
+    key.treelet_layout = config->remap_to_treelet_layout ? treelet_layout::resolve_strategy(config->treelet_layout_name) : 0;
+
+    // Packed layouts keep the file names they had before -treelet_layout
+    std::string layout_suffix;
+    if (config->remap_to_treelet_layout)
+    {
+        layout_suffix = "_remap";
+        if (key.treelet_layout != 0)
+            layout_suffix += std::string("_") + treelet_layout::strategy_info(key.treelet_layout).name;
+    }
+    char filename[160];
+    snprintf(filename, sizeof(filename), "treelets_%016llx_%d%s.bin", (unsigned long long)key.as_hash, maxBytesPerTreelet,
+             layout_suffix.c_str());
+    std::string path = std::string(config->treelet_cache_dir) + "/" + filename;
+
+    if (loadTreeletCache(path, key))
+        return;
+
+    createTreelets(_topLevelAS, device_offset, maxBytesPerTreelet);
+    saveTreeletCache(path, key);
+}
+
+
+// FNV-1a over every node reachable from the TLAS. The treelet tables hold device addresses, so the BLAS device addresses are folded in too.
+uint64_t VulkanRayTracing::hashAccelerationStructure(VkAccelerationStructureKHR _topLevelAS, int64_t device_offset)
+{
+    uint64_t hash = TREELET_CACHE_HASH_SEED;
+    uint64_t tlas_device_addr = (uint64_t)_topLevelAS + device_offset;
+    hash = treelet_cache_hash(hash, &tlas_device_addr, sizeof(tlas_device_addr));
+
+    GEN_RT_BVH topBVH;
+    GEN_RT_BVH_unpack(&topBVH, (uint8_t*)_topLevelAS);
+    hash = treelet_cache_hash(hash, (uint8_t*)_topLevelAS, GEN_RT_BVH_length * 4);
+
+    std::set<uint8_t*> visited_blas;
+    std::vector<StackEntry> stack;
+    stack.push_back(StackEntry((uint8_t*)_topLevelAS + topBVH.RootNodeOffset, true, false));
+
+    while (!stack.empty())
+    {
+        StackEntry node = stack.back();
+        stack.pop_back();
+
+        if (!node.leaf)
         {
-            if (node.addr != root.first.addr) {
-                assert(new_node_addr <= new_treelet_root_addr + (i+1) * (GPGPU_Context()->the_gpgpusim->g_the_gpu->get_config().max_treelet_size + treelet_remap_stride));
-                // The assert below triggers when the same blas addr appear in multiple treelets.
-                // To solve this problem i need to finish forming the current treelet when encouvering a top level leaf node.
-                // For now the my hack is to just not add this node to the treelet bvh map with the condition in the if statement when adding new nodes.
-                // assert(original_bvh_to_treelet_bvh_mapping.count(node.addr) == 0); 
-                assert(new_node_addr > treelet_layout_bvh);
-                if (original_bvh_to_treelet_bvh_mapping.count(node.addr) == 0)
-                    original_bvh_to_treelet_bvh_mapping[node.addr] = new_node_addr;
-                new_node_addr += (node.size);
+            struct GEN_RT_BVH_INTERNAL_NODE internal;
+            GEN_RT_BVH_INTERNAL_NODE_unpack(&internal, node.addr);
+            hash = treelet_cache_hash(hash, node.addr, GEN_RT_BVH_INTERNAL_NODE_length * 4);
+
+            uint8_t *child_addr = node.addr + (internal.ChildOffset * 64);
+            for (int i = 0; i < 6; i++)
+            {
+                if (internal.ChildSize[i] > 0)
+                    stack.push_back(StackEntry(child_addr, node.topLevel, internal.ChildType[i] != NODE_TYPE_INTERNAL));
+                child_addr += internal.ChildSize[i] * 64;
             }
-        }   
-        i++;
+        }
+        else if (node.topLevel)
+        {
+            GEN_RT_BVH_INSTANCE_LEAF instanceLeaf;
+            GEN_RT_BVH_INSTANCE_LEAF_unpack(&instanceLeaf, node.addr);
+            hash = treelet_cache_hash(hash, node.addr, GEN_RT_BVH_INSTANCE_LEAF_length * 4);
+
+            uint8_t *blas = node.addr + instanceLeaf.BVHAddress;
+            assert(blas_addr_map.find((void*)blas) != blas_addr_map.end());
+            uint64_t blas_device_addr = (uint64_t)blas_addr_map[(void*)blas];
+            hash = treelet_cache_hash(hash, &blas_device_addr, sizeof(blas_device_addr));
+
+            if (visited_blas.insert(blas).second)
+            {
+                GEN_RT_BVH botLevelASAddr;
+                GEN_RT_BVH_unpack(&botLevelASAddr, blas);
+                hash = treelet_cache_hash(hash, blas, GEN_RT_BVH_length * 4);
+                stack.push_back(StackEntry(blas + botLevelASAddr.RootNodeOffset, false, false));
+            }
+        }
+        else
+        {
+            struct GEN_RT_BVH_PRIMITIVE_LEAF_DESCRIPTOR leaf_descriptor;
+            GEN_RT_BVH_PRIMITIVE_LEAF_DESCRIPTOR_unpack(&leaf_descriptor, node.addr);
+            if (leaf_descriptor.LeafType == TYPE_QUAD)
+                hash = treelet_cache_hash(hash, node.addr, GEN_RT_BVH_QUAD_LEAF_length * 4);
+            else
+                hash = treelet_cache_hash(hash, node.addr, GEN_RT_BVH_PROCEDURAL_LEAF_length * 4);
+        }
+    }
+    return hash;
+}
+
+
+static treelet_cache_node toTreeletCacheNode(const StackEntry &entry)
+{
+    treelet_cache_node node;
+    memset(&node, 0, sizeof(node));
+    node.addr = (uint64_t)entry.addr;
+    node.size = entry.size;
+    node.top_level = entry.topLevel;
+    node.leaf = entry.leaf;
+    node.is_blas_root = entry.isBlasRoot;
+    return node;
+}
+
+
+static std::vector<treelet_cache_node> toTreeletCacheNodes(const std::vector<StackEntry> &entries)
+{
+    std::vector<treelet_cache_node> nodes;
+    nodes.reserve(entries.size());
+    for (auto entry : entries)
+        nodes.push_back(toTreeletCacheNode(entry));
+    return nodes;
+}
+
+
+// Shifts addresses inside the cached treelet layout BVH allocation by delta, leaves others alone
+static uint8_t* rebaseTreeletCacheAddr(uint64_t addr, uint64_t layout_base, uint64_t layout_size, int64_t delta)
+{
+    if (addr >= layout_base && addr - layout_base < layout_size)
+        addr += delta;
+    return (uint8_t*)addr;
+}
+
+
+static StackEntry fromTreeletCacheNode(const treelet_cache_node &node, uint64_t layout_base, uint64_t layout_size, int64_t delta)
+{
+    return StackEntry(rebaseTreeletCacheAddr(node.addr, layout_base, layout_size, delta), node.top_level, node.leaf, node.size, node.is_blas_root);
+}
+
+
+void VulkanRayTracing::saveTreeletCache(const std::string &path, const treelet_cache_key &key)
+{
+    treelet_cache_writer writer;
+
+    for (auto root : treelet_roots)
+        writer.add_treelet(toTreeletCacheNode(root.first), toTreeletCacheNodes(root.second));
+    for (auto root : treelet_child_map)
+        writer.add_children(toTreeletCacheNode(root.first), toTreeletCacheNodes(root.second));
+    for (auto root : treelet_addr_to_metadata_idx)
+        writer.add_metadata_idx((uint64_t)root.first, root.second);
+
+    if (key.remap_to_treelet_layout)
+    {
+        writer.set_layout((uint64_t)treelet_layout_bvh, treelet_layout_bvh_size);
+        for (auto mapping : original_bvh_to_treelet_bvh_mapping)
+            writer.add_remap((uint64_t)mapping.first, (uint64_t)mapping.second - (uint64_t)treelet_layout_bvh);
+    }
+
+    flat_treelet_index.serialize(writer.index_blob());
+
+    if (writer.write(path, key))
+        printf("Saved treelet cache %s\n", path.c_str());
+    else
+        printf("Could not write treelet cache %s\n", path.c_str());
+}
+
+
+bool VulkanRayTracing::loadTreeletCache(const std::string &path, const treelet_cache_key &key)
+{
+    treelet_cache_reader reader;
+    if (!reader.open(path, key))
+        return false;
+
+    // The layout BVH is allocated just as remapBVHToTreeletLayout would, so later allocations land where they would without the cache
+    int64_t delta = 0;
+    if (key.remap_to_treelet_layout)
+    {
+        treelet_layout_bvh_size = reader.layout_size();
+        treelet_layout_bvh = (uint8_t*)gpgpusim_malloc(treelet_layout_bvh_size);
+        assert(treelet_layout_bvh != NULL);
+        delta = (uint64_t)treelet_layout_bvh - reader.layout_base();
     }
-    printf("Done remapping BVH to treelet layout\n");
+    uint64_t layout_base = reader.layout_base();
+    uint64_t layout_size = reader.layout_size();
+
+    treelet_roots.clear();
+    treelet_roots_addr_only.clear();
+    treelet_cache_array<treelet_cache_node> treelet_nodes = reader.treelet_nodes();
+    for (auto list : reader.treelets())
+    {
+        std::vector<StackEntry> nodes;
+        nodes.reserve(list.count);
+        for (uint64_t i = list.begin; i < list.begin + list.count; i++)
+            nodes.push_back(fromTreeletCacheNode(treelet_nodes[i], layout_base, layout_size, delta));
+
+        StackEntry root = fromTreeletCacheNode(list.root, layout_base, layout_size, delta);
+        treelet_roots.emplace_hint(treelet_roots.end(), root, nodes);
+        treelet_roots_addr_only.emplace_hint(treelet_roots_addr_only.end(), root.addr, nodes);
+    }
+
+    treelet_child_map.clear();
+    treelet_addr_only_child_map.clear();
+    treelet_cache_array<treelet_cache_node> child_nodes = reader.child_nodes();
+    for (auto list : reader.child_lists())
+    {
+        std::vector<StackEntry> children;
+        children.reserve(list.count);
+        for (uint64_t i = list.begin; i < list.begin + list.count; i++)
+            children.push_back(fromTreeletCacheNode(child_nodes[i], layout_base, layout_size, delta));
+
+        StackEntry root = fromTreeletCacheNode(list.root, layout_base, layout_size, delta);
+        treelet_child_map.emplace_hint(treelet_child_map.end(), root, children);
+        treelet_addr_only_child_map.emplace_hint(treelet_addr_only_child_map.end(), root.addr, children);
+    }
+
+    treelet_addr_to_metadata_idx.clear();
+    for (auto pair : reader.metadata_idx())
+        treelet_addr_to_metadata_idx.emplace_hint(treelet_addr_to_metadata_idx.end(), (uint8_t*)pair.first, (unsigned)pair.second);
+
+    original_bvh_to_treelet_bvh_mapping.clear();
+    for (auto pair : reader.remap())
+        original_bvh_to_treelet_bvh_mapping.emplace_hint(original_bvh_to_treelet_bvh_mapping.end(), (uint8_t*)pair.first, treelet_layout_bvh + pair.second);
+
+    // The stored index is only valid if the layout BVH landed at the same address
+    treelet_cache_array<uint8_t> index_blob = reader.index_blob();
+    if (delta != 0 || !flat_treelet_index.deserialize(index_blob.begin(), index_blob.size()))
+        flat_treelet_index.build(treelet_roots_addr_only, treelet_addr_only_child_map);
+
+    printf("Loaded treelet cache %s\n", path.c_str());
+    std::cout << "Treelet Size: " << key.max_treelet_size << " bytes" << std::endl;
+    std::cout << "Treelet Count: " << treelet_roots_addr_only.size() << std::endl;
+    printf("Treelet index: %u nodes in %u treelets\n", flat_treelet_index.num_nodes(), flat_treelet_index.num_treelets());
+    if (key.remap_to_treelet_layout)
+        reportTreeletLayout();
+    return true;
 }
 
 
@@ -1531,7 +2233,8 @@ void VulkanRayTracing::traceRayWithTreelets(VkAccelerationStructureKHR _topLevel
                    float Tmax,
                    int payload,
                    const ptx_instruction *pI,
-                   ptx_thread_info *thread)
+                   ptx_thread_info *thread,
+                   trace_ray_effects *deferred)
 {
     // std::cout << "traceRayWithTreelets" << std::endl;
     // printf("## calling trceRay function. rayFlags = %d, cullMask = %d, sbtRecordOffset = %d, sbtRecordStride = %d, missIndex = %d, origin = (%f, %f, %f), Tmin = %f, direction = (%f, %f, %f), Tmax = %f, payload = %d\n",
@@ -1592,7 +2295,7 @@ void VulkanRayTracing::traceRayWithTreelets(VkAccelerationStructureKHR _topLevel
     // Form Treelets
     if (!treeletsFormed)
     {
-        createTreelets(_topLevelAS, device_offset, GPGPU_Context()->the_gpgpusim->g_the_gpu->get_config().max_treelet_size); // 48*1024 aila2010 paper
+        formTreelets(_topLevelAS, device_offset, GPGPU_Context()->the_gpgpusim->g_the_gpu->get_config().max_treelet_size); // 48*1024 aila2010 paper
         treeletsFormed = true;
 
         // Malloc Treelet Metadata
@@ -1625,7 +2328,10 @@ void VulkanRayTracing::traceRayWithTreelets(VkAccelerationStructureKHR _topLevel
     //     assert(topLevelAS_first == _topLevelAS);
     // }
 
-    Traversal_data traversal_data;
+    // Shared state is only touched through the effects, right away unless the walk was deferred
+    trace_ray_effects immediate_effects;
+    trace_ray_effects &effects = deferred ? *deferred : immediate_effects;
+    Traversal_data &traversal_data = effects.traversal_data;
 
     traversal_data.ray_world_direction = direction;
     traversal_data.ray_world_origin = origin;
@@ -1650,21 +2356,19 @@ void VulkanRayTracing::traceRayWithTreelets(VkAccelerationStructureKHR _topLevel
     bool terminateOnFirstHit = rayFlags & SpvRayFlagsTerminateOnFirstHitKHRMask;
     bool skipClosestHitShader = rayFlags & SpvRayFlagsSkipClosestHitShaderKHRMask;
 
-    std::vector<MemoryTransactionRecord> transactions;
-    std::vector<MemoryStoreTransactionRecord> store_transactions;
+    std::vector<MemoryTransactionRecord> &transactions = effects.transactions;
 
     gpgpu_context *ctx = GPGPU_Context();
 
-    if (terminateOnFirstHit) ctx->func_sim->g_n_anyhit_rays++;
-    else ctx->func_sim->g_n_closesthit_rays++;
+    effects.anyhit_ray = terminateOnFirstHit;
 
     unsigned total_nodes_accessed = 0;
     std::map<uint8_t*, unsigned> tree_level_map;
     
 	// Create ray
-    rayCount++; // ray id starts from 1
+    if (!deferred) effects.ray_id = ++rayCount; // ray id starts from 1, deferred rays get theirs in lane order
 	Ray ray;
-	ray.make_ray(origin, direction, Tmin, Tmax, rayCount);
+	ray.make_ray(origin, direction, Tmin, Tmax, effects.ray_id);
     thread->add_ray_properties(ray);
 
 	// Set thit to max
@@ -1680,11 +2384,11 @@ void VulkanRayTracing::traceRayWithTreelets(VkAccelerationStructureKHR _topLevel
     GEN_RT_BVH topBVH; //TODO: test hit with world before traversal
     GEN_RT_BVH_unpack(&topBVH, (uint8_t*)_topLevelAS);
     if (remap_to_treelet_layout) {
-        transactions.push_back(MemoryTransactionRecord(original_bvh_to_treelet_bvh_mapping[(uint8_t*)((uint64_t)_topLevelAS + device_offset)], GEN_RT_BVH_length * 4, TransactionType::BVH_STRUCTURE));
+        transactions.push_back(MemoryTransactionRecord(treeletLayoutAddr((uint8_t*)((uint64_t)_topLevelAS + device_offset)), GEN_RT_BVH_length * 4, TransactionType::BVH_STRUCTURE));
     } else {
         transactions.push_back(MemoryTransactionRecord((uint8_t*)((uint64_t)_topLevelAS + device_offset), GEN_RT_BVH_length * 4, TransactionType::BVH_STRUCTURE));
     }
-    ctx->func_sim->g_rt_mem_access_type[static_cast<int>(TransactionType::BVH_STRUCTURE)]++;
+    effects.mem_access_type[static_cast<int>(TransactionType::BVH_STRUCTURE)]++;
     
     uint8_t* topRootAddr = (uint8_t*)_topLevelAS + topBVH.RootNodeOffset;
 
@@ -1726,8 +2430,8 @@ void VulkanRayTracing::traceRayWithTreelets(VkAccelerationStructureKHR _topLevel
             if (remap_to_treelet_layout) {
                 // printf("remapped curr_treelet = 0x%x\n", original_bvh_to_treelet_bvh_mapping[current_treelet_root]);
                 // printf("remapped child addr = 0x%x\n", original_bvh_to_treelet_bvh_mapping[topRootAddr + device_offset]);
-                curr_treelet = original_bvh_to_treelet_bvh_mapping[current_treelet_root];
-                child_treelet = addrToTreeletID(original_bvh_to_treelet_bvh_mapping[topRootAddr + device_offset]);
+                curr_treelet = treeletLayoutAddr(current_treelet_root);
+                child_treelet = addrToTreeletID(treeletLayoutAddr(topRootAddr + device_offset));
             } else {
                 curr_treelet = current_treelet_root;
                 child_treelet = addrToTreeletID(topRootAddr + device_offset);
@@ -1761,11 +2465,11 @@ void VulkanRayTracing::traceRayWithTreelets(VkAccelerationStructureKHR _topLevel
             struct GEN_RT_BVH_INTERNAL_NODE node;
             GEN_RT_BVH_INTERNAL_NODE_unpack(&node, current_node.addr);
             if (remap_to_treelet_layout) {
-                transactions.push_back(MemoryTransactionRecord(original_bvh_to_treelet_bvh_mapping[(uint8_t*)((uint64_t)current_node.addr + device_offset)], GEN_RT_BVH_INTERNAL_NODE_length * 4, TransactionType::BVH_INTERNAL_NODE));
+                transactions.push_back(MemoryTransactionRecord(treeletLayoutAddr((uint8_t*)((uint64_t)current_node.addr + device_offset)), GEN_RT_BVH_INTERNAL_NODE_length * 4, TransactionType::BVH_INTERNAL_NODE));
             } else {
                 transactions.push_back(MemoryTransactionRecord((uint8_t*)((uint64_t)current_node.addr + device_offset), GEN_RT_BVH_INTERNAL_NODE_length * 4, TransactionType::BVH_INTERNAL_NODE));
             }
-            ctx->func_sim->g_rt_mem_access_type[static_cast<int>(TransactionType::BVH_INTERNAL_NODE)]++;
+            effects.mem_access_type[static_cast<int>(TransactionType::BVH_INTERNAL_NODE)]++;
             total_nodes_accessed++;
 
             if (debugTraversal)
@@ -1778,22 +2482,23 @@ void VulkanRayTracing::traceRayWithTreelets(VkAccelerationStructureKHR _topLevel
             }
 
             bool child_hit[6];
-            float thit[6];
+            float thit[rt_simd_kernels::LANES];
+            float3 idir = calculate_idir(ray.get_direction()); //TODO: this works wierd if one of ray dimensions is 0
+            unsigned box_hits = ray_children_test(&node, idir, ray.get_origin(), ray.get_tmin(), ray.get_tmax(), thit);
             for(int i = 0; i < 6; i++)
             {
                 if (node.ChildSize[i] > 0)
                 {
-                    float3 idir = calculate_idir(ray.get_direction()); //TODO: this works wierd if one of ray dimensions is 0
-                    float3 lo, hi;
-                    set_child_bounds(&node, i, &lo, &hi);
-
-                    child_hit[i] = ray_box_test(lo, hi, idir, ray.get_origin(), ray.get_tmin(), ray.get_tmax(), thit[i]);
+                    child_hit[i] = (box_hits >> i) & 1;
                     if(child_hit[i] && thit[i] >= min_thit)
                         child_hit[i] = false;
 
                     
                     if (debugTraversal)
                     {
+                        float3 lo, hi;
+                        set_child_bounds(&node, i, &lo, &hi);
+
                         if(child_hit[i])
                             traversalFile << "hit child number " << i << ", ";
                         else
@@ -1822,8 +2527,8 @@ void VulkanRayTracing::traceRayWithTreelets(VkAccelerationStructureKHR _topLevel
                         uint8_t* child_treelet;
                         
                         if (remap_to_treelet_layout) {
-                            curr_treelet = original_bvh_to_treelet_bvh_mapping[current_treelet_root];
-                            child_treelet = addrToTreeletID(original_bvh_to_treelet_bvh_mapping[child_addr + device_offset]);
+                            curr_treelet = treeletLayoutAddr(current_treelet_root);
+                            child_treelet = addrToTreeletID(treeletLayoutAddr(child_addr + device_offset));
                         } else {
                             curr_treelet = current_treelet_root;
                             child_treelet = addrToTreeletID(child_addr + device_offset);
@@ -1843,8 +2548,8 @@ void VulkanRayTracing::traceRayWithTreelets(VkAccelerationStructureKHR _topLevel
                         uint8_t* child_treelet;
                         
                         if (remap_to_treelet_layout) {
-                            curr_treelet = original_bvh_to_treelet_bvh_mapping[current_treelet_root];
-                            child_treelet = addrToTreeletID(original_bvh_to_treelet_bvh_mapping[child_addr + device_offset]);
+                            curr_treelet = treeletLayoutAddr(current_treelet_root);
+                            child_treelet = addrToTreeletID(treeletLayoutAddr(child_addr + device_offset));
                         } else {
                             curr_treelet = current_treelet_root;
                             child_treelet = addrToTreeletID(child_addr + device_offset);
@@ -1880,11 +2585,11 @@ void VulkanRayTracing::traceRayWithTreelets(VkAccelerationStructureKHR _topLevel
             GEN_RT_BVH_INSTANCE_LEAF instanceLeaf;
             GEN_RT_BVH_INSTANCE_LEAF_unpack(&instanceLeaf, leaf_addr);
             if (remap_to_treelet_layout) {
-                transactions.push_back(MemoryTransactionRecord(original_bvh_to_treelet_bvh_mapping[(uint8_t*)((uint64_t)leaf_addr + device_offset)], GEN_RT_BVH_INSTANCE_LEAF_length * 4, TransactionType::BVH_INSTANCE_LEAF));
+                transactions.push_back(MemoryTransactionRecord(treeletLayoutAddr((uint8_t*)((uint64_t)leaf_addr + device_offset)), GEN_RT_BVH_INSTANCE_LEAF_length * 4, TransactionType::BVH_INSTANCE_LEAF));
             } else {
                 transactions.push_back(MemoryTransactionRecord((uint8_t*)((uint64_t)leaf_addr + device_offset), GEN_RT_BVH_INSTANCE_LEAF_length * 4, TransactionType::BVH_INSTANCE_LEAF));
             }
-            ctx->func_sim->g_rt_mem_access_type[static_cast<int>(TransactionType::BVH_INSTANCE_LEAF)]++;
+            effects.mem_access_type[static_cast<int>(TransactionType::BVH_INSTANCE_LEAF)]++;
             total_nodes_accessed++;
 
 
@@ -1908,11 +2613,11 @@ void VulkanRayTracing::traceRayWithTreelets(VkAccelerationStructureKHR _topLevel
             int64_t blas_offset = (uint64_t)blas_addr_map[(void*)botLevelRootAddr] - (uint64_t)botLevelRootAddr;
 
             if (remap_to_treelet_layout) {
-                transactions.push_back(MemoryTransactionRecord(original_bvh_to_treelet_bvh_mapping[(uint8_t*)((uint64_t)leaf_addr + instanceLeaf.BVHAddress + blas_offset)], GEN_RT_BVH_length * 4, TransactionType::BVH_STRUCTURE));
+                transactions.push_back(MemoryTransactionRecord(treeletLayoutAddr((uint8_t*)((uint64_t)leaf_addr + instanceLeaf.BVHAddress + blas_offset)), GEN_RT_BVH_length * 4, TransactionType::BVH_STRUCTURE));
             } else {
                 transactions.push_back(MemoryTransactionRecord((uint8_t*)((uint64_t)leaf_addr + instanceLeaf.BVHAddress + blas_offset), GEN_RT_BVH_length * 4, TransactionType::BVH_STRUCTURE));
             }
-            ctx->func_sim->g_rt_mem_access_type[static_cast<int>(TransactionType::BVH_STRUCTURE)]++;
+            effects.mem_access_type[static_cast<int>(TransactionType::BVH_STRUCTURE)]++;
 
             if (debugTraversal)
             {
@@ -1929,8 +2634,8 @@ void VulkanRayTracing::traceRayWithTreelets(VkAccelerationStructureKHR _topLevel
             uint8_t* child_treelet;
             
             if (remap_to_treelet_layout) {
-                curr_treelet = original_bvh_to_treelet_bvh_mapping[current_treelet_root];
-                child_treelet = addrToTreeletID(original_bvh_to_treelet_bvh_mapping[botLevelRootAddr + device_offset]);
+                curr_treelet = treeletLayoutAddr(current_treelet_root);
+                child_treelet = addrToTreeletID(treeletLayoutAddr(botLevelRootAddr + device_offset));
             } else {
                 curr_treelet = current_treelet_root;
                 child_treelet = addrToTreeletID(botLevelRootAddr + device_offset);
@@ -1959,11 +2664,11 @@ void VulkanRayTracing::traceRayWithTreelets(VkAccelerationStructureKHR _topLevel
             struct GEN_RT_BVH_INTERNAL_NODE node;
             GEN_RT_BVH_INTERNAL_NODE_unpack(&node, node_addr);
             if (remap_to_treelet_layout) {
-                transactions.push_back(MemoryTransactionRecord(original_bvh_to_treelet_bvh_mapping[(uint8_t*)((uint64_t)node_addr + device_offset)], GEN_RT_BVH_INTERNAL_NODE_length * 4, TransactionType::BVH_INTERNAL_NODE));
+                transactions.push_back(MemoryTransactionRecord(treeletLayoutAddr((uint8_t*)((uint64_t)node_addr + device_offset)), GEN_RT_BVH_INTERNAL_NODE_length * 4, TransactionType::BVH_INTERNAL_NODE));
             } else {
                 transactions.push_back(MemoryTransactionRecord((uint8_t*)((uint64_t)node_addr + device_offset), GEN_RT_BVH_INTERNAL_NODE_length * 4, TransactionType::BVH_INTERNAL_NODE));
             }
-            ctx->func_sim->g_rt_mem_access_type[static_cast<int>(TransactionType::BVH_INTERNAL_NODE)]++;
+            effects.mem_access_type[static_cast<int>(TransactionType::BVH_INTERNAL_NODE)]++;
             total_nodes_accessed++;
 
             if (debugTraversal)
@@ -1976,21 +2681,22 @@ void VulkanRayTracing::traceRayWithTreelets(VkAccelerationStructureKHR _topLevel
             }
 
             bool child_hit[6];
-            float thit[6];
+            float thit[rt_simd_kernels::LANES];
+            float3 idir = calculate_idir(current_node.objectRay.get_direction()); //TODO: this works wierd if one of ray dimensions is 0
+            unsigned box_hits = ray_children_test(&node, idir, current_node.objectRay.get_origin(), current_node.objectRay.get_tmin(), current_node.objectRay.get_tmax(), thit);
             for(int i = 0; i < 6; i++)
             {
                 if (node.ChildSize[i] > 0)
                 {
-                    float3 idir = calculate_idir(current_node.objectRay.get_direction()); //TODO: this works wierd if one of ray dimensions is 0
-                    float3 lo, hi;
-                    set_child_bounds(&node, i, &lo, &hi);
-
-                    child_hit[i] = ray_box_test(lo, hi, idir, current_node.objectRay.get_origin(), current_node.objectRay.get_tmin(), current_node.objectRay.get_tmax(), thit[i]);
+                    child_hit[i] = (box_hits >> i) & 1;
                     if(child_hit[i] && thit[i] >= min_thit * current_node.worldToObject_tMultiplier)
                         child_hit[i] = false;
 
                     if (debugTraversal)
                     {
+                        float3 lo, hi;
+                        set_child_bounds(&node, i, &lo, &hi);
+
                         if(child_hit[i])
                             traversalFile << "hit child number " << i << ", ";
                         else
@@ -2003,6 +2709,16 @@ void VulkanRayTracing::traceRayWithTreelets(VkAccelerationStructureKHR _topLevel
                     child_hit[i] = false;
             }
 
+            // The quad leaves among the hit children are tested together now, and
+            // each one picks up its result when it is popped
+            unsigned leaf_mask = 0;
+            for(int i = 0; i < 6; i++)
+                if(child_hit[i])
+                    leaf_mask |= 1u << i;
+            unsigned leaf_tested;
+            float leaf_thit[rt_simd_kernels::LANES];
+            unsigned leaf_hits = ray_leaf_children_test(&node, node_addr, leaf_mask, current_node.objectRay, leaf_tested, leaf_thit);
+
             uint8_t *child_addr = node_addr + (node.ChildOffset * 64);
             for(int i = 0; i < 6; i++)
             {
@@ -2019,17 +2735,26 @@ void VulkanRayTracing::traceRayWithTreelets(VkAccelerationStructureKHR _topLevel
                         uint8_t* child_treelet;
                         
                         if (remap_to_treelet_layout) {
-                            curr_treelet = original_bvh_to_treelet_bvh_mapping[current_treelet_root];
-                            child_treelet = addrToTreeletID(original_bvh_to_treelet_bvh_mapping[child_addr + device_offset]);
+                            curr_treelet = treeletLayoutAddr(current_treelet_root);
+                            child_treelet = addrToTreeletID(treeletLayoutAddr(child_addr + device_offset));
                         } else {
                             curr_treelet = current_treelet_root;
                             child_treelet = addrToTreeletID(child_addr + device_offset);
                         }
 
+                        StackEntry leaf_entry(child_addr, false, true, current_node.worldToObject_tMultiplier, current_node.instanceLeaf, current_node.worldToObjectMatrix, current_node.objectToWorldMatrix, current_node.objectRay);
+                        if (leaf_tested & (1u << i))
+                        {
+                            leaf_entry.triangleTested = true;
+                            leaf_entry.triangleHit = (leaf_hits >> i) & 1;
+                            if (leaf_entry.triangleHit)
+                                leaf_entry.triangleThit = leaf_thit[i];
+                        }
+
                         if (curr_treelet == child_treelet)
-                            current_treelet_stack.push_front(StackEntry(child_addr, false, true, current_node.worldToObject_tMultiplier, current_node.instanceLeaf, current_node.worldToObjectMatrix, current_node.objectToWorldMatrix, current_node.objectRay));
+                            current_treelet_stack.push_front(leaf_entry);
                         else
-                            other_treelet_stack.push_front(StackEntry(child_addr, false, true, current_node.worldToObject_tMultiplier, current_node.instanceLeaf, current_node.worldToObjectMatrix, current_node.objectToWorldMatrix, current_node.objectRay));
+                            other_treelet_stack.push_front(leaf_entry);
                         assert(tree_level_map.find(node_addr) != tree_level_map.end());
                         tree_level_map[child_addr] = tree_level_map[node_addr] + 1;
                     }
@@ -2040,8 +2765,8 @@ void VulkanRayTracing::traceRayWithTreelets(VkAccelerationStructureKHR _topLevel
                         uint8_t* child_treelet;
                         
                         if (remap_to_treelet_layout) {
-                            curr_treelet = original_bvh_to_treelet_bvh_mapping[current_treelet_root];
-                            child_treelet = addrToTreeletID(original_bvh_to_treelet_bvh_mapping[child_addr + device_offset]);
+                            curr_treelet = treeletLayoutAddr(current_treelet_root);
+                            child_treelet = addrToTreeletID(treeletLayoutAddr(child_addr + device_offset));
                         } else {
                             curr_treelet = current_treelet_root;
                             child_treelet = addrToTreeletID(child_addr + device_offset);
@@ -2077,11 +2802,11 @@ void VulkanRayTracing::traceRayWithTreelets(VkAccelerationStructureKHR _topLevel
             struct GEN_RT_BVH_PRIMITIVE_LEAF_DESCRIPTOR leaf_descriptor;
             GEN_RT_BVH_PRIMITIVE_LEAF_DESCRIPTOR_unpack(&leaf_descriptor, leaf_addr);
             if (remap_to_treelet_layout) {
-                transactions.push_back(MemoryTransactionRecord(original_bvh_to_treelet_bvh_mapping[(uint8_t*)((uint64_t)leaf_addr + device_offset)], GEN_RT_BVH_PRIMITIVE_LEAF_DESCRIPTOR_length * 4, TransactionType::BVH_PRIMITIVE_LEAF_DESCRIPTOR));
+                transactions.push_back(MemoryTransactionRecord(treeletLayoutAddr((uint8_t*)((uint64_t)leaf_addr + device_offset)), GEN_RT_BVH_PRIMITIVE_LEAF_DESCRIPTOR_length * 4, TransactionType::BVH_PRIMITIVE_LEAF_DESCRIPTOR));
             } else {
                 transactions.push_back(MemoryTransactionRecord((uint8_t*)((uint64_t)leaf_addr + device_offset), GEN_RT_BVH_PRIMITIVE_LEAF_DESCRIPTOR_length * 4, TransactionType::BVH_PRIMITIVE_LEAF_DESCRIPTOR));
             }
-            ctx->func_sim->g_rt_mem_access_type[static_cast<int>(TransactionType::BVH_PRIMITIVE_LEAF_DESCRIPTOR)]++;
+            effects.mem_access_type[static_cast<int>(TransactionType::BVH_PRIMITIVE_LEAF_DESCRIPTOR)]++;
 
             if (leaf_descriptor.LeafType == TYPE_QUAD)
             {
@@ -2101,9 +2826,9 @@ void VulkanRayTracing::traceRayWithTreelets(VkAccelerationStructureKHR _topLevel
                     p[i].z = leaf.QuadVertex[i].Z;
                 }
 
-                // Triangle intersection algorithm
-                float thit;
-                bool hit = VulkanRayTracing::mt_ray_triangle_test(p[0], p[1], p[2], current_node.objectRay, &thit);
+                // Triangle intersection algorithm, unless it ran with the siblings
+                float thit = current_node.triangleThit;
+                bool hit = current_node.triangleTested ? current_node.triangleHit : VulkanRayTracing::mt_ray_triangle_test(p[0], p[1], p[2], current_node.objectRay, &thit);
 
                 assert(leaf.PrimitiveIndex1Delta == 0);
 
@@ -2141,11 +2866,11 @@ void VulkanRayTracing::traceRayWithTreelets(VkAccelerationStructureKHR _topLevel
                     min_thit_object = thit;
                     thread->add_ray_intersect();
                     if (remap_to_treelet_layout) {
-                        transactions.push_back(MemoryTransactionRecord(original_bvh_to_treelet_bvh_mapping[(uint8_t*)((uint64_t)leaf_addr + device_offset)], GEN_RT_BVH_QUAD_LEAF_length * 4, TransactionType::BVH_QUAD_LEAF_HIT));
+                        transactions.push_back(MemoryTransactionRecord(treeletLayoutAddr((uint8_t*)((uint64_t)leaf_addr + device_offset)), GEN_RT_BVH_QUAD_LEAF_length * 4, TransactionType::BVH_QUAD_LEAF_HIT));
                     } else {
                         transactions.push_back(MemoryTransactionRecord((uint8_t*)((uint64_t)leaf_addr + device_offset), GEN_RT_BVH_QUAD_LEAF_length * 4, TransactionType::BVH_QUAD_LEAF_HIT));
                     }
-                    ctx->func_sim->g_rt_mem_access_type[static_cast<int>(TransactionType::BVH_QUAD_LEAF_HIT)]++;
+                    effects.mem_access_type[static_cast<int>(TransactionType::BVH_QUAD_LEAF_HIT)]++;
                     total_nodes_accessed++;
 
                     if(terminateOnFirstHit)
@@ -2156,11 +2881,11 @@ void VulkanRayTracing::traceRayWithTreelets(VkAccelerationStructureKHR _topLevel
                 }
                 else {
                     if (remap_to_treelet_layout) {
-                        transactions.push_back(MemoryTransactionRecord(original_bvh_to_treelet_bvh_mapping[(uint8_t*)((uint64_t)leaf_addr + device_offset)], GEN_RT_BVH_QUAD_LEAF_length * 4, TransactionType::BVH_QUAD_LEAF));
+                        transactions.push_back(MemoryTransactionRecord(treeletLayoutAddr((uint8_t*)((uint64_t)leaf_addr + device_offset)), GEN_RT_BVH_QUAD_LEAF_length * 4, TransactionType::BVH_QUAD_LEAF));
                     } else {
                         transactions.push_back(MemoryTransactionRecord((uint8_t*)((uint64_t)leaf_addr + device_offset), GEN_RT_BVH_QUAD_LEAF_length * 4, TransactionType::BVH_QUAD_LEAF));
                     }
-                    ctx->func_sim->g_rt_mem_access_type[static_cast<int>(TransactionType::BVH_QUAD_LEAF)]++;
+                    effects.mem_access_type[static_cast<int>(TransactionType::BVH_QUAD_LEAF)]++;
                     total_nodes_accessed++;
                 }
                 if (debugTraversal)
@@ -2173,33 +2898,17 @@ void VulkanRayTracing::traceRayWithTreelets(VkAccelerationStructureKHR _topLevel
                 struct GEN_RT_BVH_PROCEDURAL_LEAF leaf;
                 GEN_RT_BVH_PROCEDURAL_LEAF_unpack(&leaf, leaf_addr);
                 if (remap_to_treelet_layout) {
-                    transactions.push_back(MemoryTransactionRecord(original_bvh_to_treelet_bvh_mapping[(uint8_t*)((uint64_t)leaf_addr + device_offset)], GEN_RT_BVH_PROCEDURAL_LEAF_length * 4, TransactionType::BVH_PROCEDURAL_LEAF));
+                    transactions.push_back(MemoryTransactionRecord(treeletLayoutAddr((uint8_t*)((uint64_t)leaf_addr + device_offset)), GEN_RT_BVH_PROCEDURAL_LEAF_length * 4, TransactionType::BVH_PROCEDURAL_LEAF));
                 } else {
                     transactions.push_back(MemoryTransactionRecord((uint8_t*)((uint64_t)leaf_addr + device_offset), GEN_RT_BVH_PROCEDURAL_LEAF_length * 4, TransactionType::BVH_PROCEDURAL_LEAF));
                 }
-                ctx->func_sim->g_rt_mem_access_type[static_cast<int>(TransactionType::BVH_PROCEDURAL_LEAF)]++;
+                effects.mem_access_type[static_cast<int>(TransactionType::BVH_PROCEDURAL_LEAF)]++;
                 total_nodes_accessed++;
 
                 uint32_t hit_group_index = current_node.instanceLeaf.InstanceContributionToHitGroupIndex;
 
                 warp_intersection_table* table = intersection_table[thread->get_ctaid().x][thread->get_ctaid().y];
-                auto intersectionTransactions = table->add_intersection(hit_group_index, thread->get_tid().x, leaf.PrimitiveIndex[0], current_node.instanceLeaf.InstanceID, pI, thread); // TODO: switch these to device addresses
-                
-                // transactions.insert(transactions.end(), intersectionTransactions.first.begin(), intersectionTransactions.first.end());
-                for(auto & newTransaction : intersectionTransactions.first)
-                {
-                    bool found = false;
-                    for(auto & transaction : transactions)
-                        if(transaction.address == newTransaction.address)
-                        {
-                            found = true;
-                            break;
-                        }
-                    if(!found)
-                        transactions.push_back(newTransaction);
-
-                }
-                store_transactions.insert(store_transactions.end(), intersectionTransactions.second.begin(), intersectionTransactions.second.end());
+                effects.add_intersection(table, hit_group_index, leaf.PrimitiveIndex[0], current_node.instanceLeaf.InstanceID); // TODO: switch these to device addresses
             }
         }
         else
@@ -2211,7 +2920,6 @@ void VulkanRayTracing::traceRayWithTreelets(VkAccelerationStructureKHR _topLevel
     if (min_thit < ray.dir_tmax.w)
     {
         traversal_data.hit_geometry = true;
-        ctx->func_sim->g_rt_num_hits++;
         traversal_data.closest_hit.geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR;
         traversal_data.closest_hit.geometry_index = closest_leaf.LeafDescriptor.GeometryIndex;
         traversal_data.closest_hit.primitive_index = closest_leaf.PrimitiveIndex0;
@@ -2235,7 +2943,6 @@ void VulkanRayTracing::traceRayWithTreelets(VkAccelerationStructureKHR _topLevel
         //closest_objectRay.at(min_thit_object);
         float3 barycentric = Barycentric(object_intersection_point, p[0], p[1], p[2]);
         traversal_data.closest_hit.barycentric_coordinates = barycentric;
-        thread->RT_thread_data->set_hitAttribute(barycentric, pI, thread);
 
         // store_transactions.push_back(MemoryStoreTransactionRecord(&traversal_data, sizeof(traversal_data), StoreTransactionType::Traversal_Results));
     }
@@ -2244,32 +2951,15 @@ void VulkanRayTracing::traceRayWithTreelets(VkAccelerationStructureKHR _topLevel
         traversal_data.hit_geometry = false;
     }
 
-    memory_space *mem = thread->get_global_memory();
-    Traversal_data* device_traversal_data = (Traversal_data*) VulkanRayTracing::gpgpusim_alloc(sizeof(Traversal_data));
-    mem->write(device_traversal_data, sizeof(Traversal_data), &traversal_data, thread, pI);
-    thread->RT_thread_data->traversal_data.push_back(device_traversal_data);
-    
-    thread->set_rt_transactions(transactions);
-    thread->set_rt_store_transactions(store_transactions);
-
-    // rayCount++; // ray id starts from 1
-    printf("RayID,%d", rayCount);
-    for (auto transaction : transactions)
-    {
-        printf(",0x%x", VulkanRayTracing::addrToTreeletID((uint8_t*)transaction.address));
-        accessedDataSize += transaction.size;
-    }
-    printf("\n");
+    // The ray's treelet trace is printed with the final transactions, when the effects are applied
+    effects.log_treelets = true;
 
     if (debugTraversal)
     {
         traversalFile.close();
     }
 
-    if (total_nodes_accessed > ctx->func_sim->g_max_nodes_per_ray) {
-        ctx->func_sim->g_max_nodes_per_ray = total_nodes_accessed;
-    }
-    ctx->func_sim->g_tot_nodes_per_ray += total_nodes_accessed;
+    effects.nodes_accessed = total_nodes_accessed;
 
     unsigned level = 0;
     for (auto it=tree_level_map.begin(); it!=tree_level_map.end(); it++) {
@@ -2277,9 +2967,10 @@ void VulkanRayTracing::traceRayWithTreelets(VkAccelerationStructureKHR _topLevel
             level = it->second;
         }
     }
-    if (level > ctx->func_sim->g_max_tree_depth) {
-        ctx->func_sim->g_max_tree_depth = level;
-    }
+    effects.tree_depth = level;
+
+    if (!deferred)
+        applyTraceRayEffects(effects, pI, thread);
 
     // Print out the transactions
     std::ofstream memoryTransactionsFile;
@@ -2318,7 +3009,8 @@ void VulkanRayTracing::traceRay(VkAccelerationStructureKHR _topLevelAS,
                    float Tmax,
                    int payload,
                    const ptx_instruction *pI,
-                   ptx_thread_info *thread)
+                   ptx_thread_info *thread,
+                   trace_ray_effects *deferred)
 {
     // printf("## calling trceRay function. rayFlags = %d, cullMask = %d, sbtRecordOffset = %d, sbtRecordStride = %d, missIndex = %d, origin = (%f, %f, %f), Tmin = %f, direction = (%f, %f, %f), Tmax = %f, payload = %d\n",
     //         rayFlags, cullMask, sbtRecordOffset, sbtRecordStride, missIndex, origin.x, origin.y, origin.z, Tmin, direction.x, direction.y, direction.z, Tmax, payload);
@@ -2363,7 +3055,7 @@ void VulkanRayTracing::traceRay(VkAccelerationStructureKHR _topLevelAS,
     // Form Treelets
     if (!treeletsFormed)
     {
-        createTreelets(_topLevelAS, device_offset, GPGPU_Context()->the_gpgpusim->g_the_gpu->get_config().max_treelet_size); // 48*1024 aila2010 paper
+        formTreelets(_topLevelAS, device_offset, GPGPU_Context()->the_gpgpusim->g_the_gpu->get_config().max_treelet_size); // 48*1024 aila2010 paper
         treeletsFormed = true;
     }
 
@@ -2383,7 +3075,10 @@ void VulkanRayTracing::traceRay(VkAccelerationStructureKHR _topLevelAS,
     //     assert(topLevelAS_first == _topLevelAS);
     // }
 
-    Traversal_data traversal_data;
+    // Shared state is only touched through the effects, right away unless the walk was deferred
+    trace_ray_effects immediate_effects;
+    trace_ray_effects &effects = deferred ? *deferred : immediate_effects;
+    Traversal_data &traversal_data = effects.traversal_data;
 
     traversal_data.n_all_hits = 0;
     traversal_data.ray_world_direction = direction;
@@ -2412,21 +3107,19 @@ void VulkanRayTracing::traceRay(VkAccelerationStructureKHR _topLevelAS,
     bool skipClosestHitShader = rayFlags & SpvRayFlagsSkipClosestHitShaderKHRMask;
     bool skipAnyHitShader = rayFlags & SpvRayFlagsOpaqueKHRMask;
 
-    std::vector<MemoryTransactionRecord> transactions;
-    std::vector<MemoryStoreTransactionRecord> store_transactions;
+    std::vector<MemoryTransactionRecord> &transactions = effects.transactions;
 
     gpgpu_context *ctx = GPGPU_Context();
 
-    if (terminateOnFirstHit) ctx->func_sim->g_n_anyhit_rays++;
-    else ctx->func_sim->g_n_closesthit_rays++;
+    effects.anyhit_ray = terminateOnFirstHit;
 
     unsigned total_nodes_accessed = 0;
     std::map<uint8_t*, unsigned> tree_level_map;
     
 	// Create ray
-    rayCount++; // ray id starts from 1
+    if (!deferred) effects.ray_id = ++rayCount; // ray id starts from 1, deferred rays get theirs in lane order
 	Ray ray;
-	ray.make_ray(origin, direction, Tmin, Tmax, rayCount);
+	ray.make_ray(origin, direction, Tmin, Tmax, effects.ray_id);
     thread->add_ray_properties(ray);
 
 	// Set thit to max
@@ -2442,11 +3135,11 @@ void VulkanRayTracing::traceRay(VkAccelerationStructureKHR _topLevelAS,
     GEN_RT_BVH topBVH; //TODO: test hit with world before traversal
     GEN_RT_BVH_unpack(&topBVH, (uint8_t*)_topLevelAS);
     if (remap_to_treelet_layout) {
-        transactions.push_back(MemoryTransactionRecord(original_bvh_to_treelet_bvh_mapping[(uint8_t*)((uint64_t)_topLevelAS + device_offset)], GEN_RT_BVH_length * 4, TransactionType::BVH_STRUCTURE));
+        transactions.push_back(MemoryTransactionRecord(treeletLayoutAddr((uint8_t*)((uint64_t)_topLevelAS + device_offset)), GEN_RT_BVH_length * 4, TransactionType::BVH_STRUCTURE));
     } else {
         transactions.push_back(MemoryTransactionRecord((uint8_t*)((uint64_t)_topLevelAS + device_offset), GEN_RT_BVH_length * 4, TransactionType::BVH_STRUCTURE));
     }
-    ctx->func_sim->g_rt_mem_access_type[static_cast<int>(TransactionType::BVH_STRUCTURE)]++;
+    effects.mem_access_type[static_cast<int>(TransactionType::BVH_STRUCTURE)]++;
 
     uint8_t* topRootAddr = (uint8_t*)_topLevelAS + topBVH.RootNodeOffset;
 
@@ -2507,11 +3200,11 @@ void VulkanRayTracing::traceRay(VkAccelerationStructureKHR _topLevelAS,
             struct GEN_RT_BVH_INTERNAL_NODE node;
             GEN_RT_BVH_INTERNAL_NODE_unpack(&node, node_addr);
             if (remap_to_treelet_layout) {
-                transactions.push_back(MemoryTransactionRecord(original_bvh_to_treelet_bvh_mapping[(uint8_t*)((uint64_t)node_addr + device_offset)], GEN_RT_BVH_INTERNAL_NODE_length * 4, TransactionType::BVH_INTERNAL_NODE));
+                transactions.push_back(MemoryTransactionRecord(treeletLayoutAddr((uint8_t*)((uint64_t)node_addr + device_offset)), GEN_RT_BVH_INTERNAL_NODE_length * 4, TransactionType::BVH_INTERNAL_NODE));
             } else {
                 transactions.push_back(MemoryTransactionRecord((uint8_t*)((uint64_t)node_addr + device_offset), GEN_RT_BVH_INTERNAL_NODE_length * 4, TransactionType::BVH_INTERNAL_NODE));
             }
-            ctx->func_sim->g_rt_mem_access_type[static_cast<int>(TransactionType::BVH_INTERNAL_NODE)]++;
+            effects.mem_access_type[static_cast<int>(TransactionType::BVH_INTERNAL_NODE)]++;
             total_nodes_accessed++;
 
             if (debugTraversal)
@@ -2524,22 +3217,23 @@ void VulkanRayTracing::traceRay(VkAccelerationStructureKHR _topLevelAS,
             }
 
             bool child_hit[6];
-            float thit[6];
+            float thit[rt_simd_kernels::LANES];
+            float3 idir = calculate_idir(ray.get_direction()); //TODO: this works wierd if one of ray dimensions is 0
+            unsigned box_hits = ray_children_test(&node, idir, ray.get_origin(), ray.get_tmin(), ray.get_tmax(), thit);
             for(int i = 0; i < 6; i++)
             {
                 if (node.ChildSize[i] > 0)
                 {
-                    float3 idir = calculate_idir(ray.get_direction()); //TODO: this works wierd if one of ray dimensions is 0
-                    float3 lo, hi;
-                    set_child_bounds(&node, i, &lo, &hi);
-
-                    child_hit[i] = ray_box_test(lo, hi, idir, ray.get_origin(), ray.get_tmin(), ray.get_tmax(), thit[i]);
+                    child_hit[i] = (box_hits >> i) & 1;
                     if(child_hit[i] && thit[i] >= min_thit)
                         child_hit[i] = false;
 
                     
                     if (debugTraversal)
                     {
+                        float3 lo, hi;
+                        set_child_bounds(&node, i, &lo, &hi);
+
                         if(child_hit[i])
                             traversalFile << "hit child number " << i << ", ";
                         else
@@ -2612,11 +3306,11 @@ void VulkanRayTracing::traceRay(VkAccelerationStructureKHR _topLevelAS,
             GEN_RT_BVH_INSTANCE_LEAF instanceLeaf;
             GEN_RT_BVH_INSTANCE_LEAF_unpack(&instanceLeaf, leaf_addr);
             if (remap_to_treelet_layout) {
-                transactions.push_back(MemoryTransactionRecord(original_bvh_to_treelet_bvh_mapping[(uint8_t*)((uint64_t)leaf_addr + device_offset)], GEN_RT_BVH_INSTANCE_LEAF_length * 4, TransactionType::BVH_INSTANCE_LEAF));
+                transactions.push_back(MemoryTransactionRecord(treeletLayoutAddr((uint8_t*)((uint64_t)leaf_addr + device_offset)), GEN_RT_BVH_INSTANCE_LEAF_length * 4, TransactionType::BVH_INSTANCE_LEAF));
             } else {
                 transactions.push_back(MemoryTransactionRecord((uint8_t*)((uint64_t)leaf_addr + device_offset), GEN_RT_BVH_INSTANCE_LEAF_length * 4, TransactionType::BVH_INSTANCE_LEAF));
             }
-            ctx->func_sim->g_rt_mem_access_type[static_cast<int>(TransactionType::BVH_INSTANCE_LEAF)]++;
+            effects.mem_access_type[static_cast<int>(TransactionType::BVH_INSTANCE_LEAF)]++;
             total_nodes_accessed++;
 
 
@@ -2640,11 +3334,11 @@ void VulkanRayTracing::traceRay(VkAccelerationStructureKHR _topLevelAS,
             device_offset = (uint64_t)blas_addr_map[(void*)botLevelRootAddr] - (uint64_t)botLevelRootAddr;
 
             if (remap_to_treelet_layout) {
-                transactions.push_back(MemoryTransactionRecord(original_bvh_to_treelet_bvh_mapping[(uint8_t*)(botLevelRootAddr + device_offset)], GEN_RT_BVH_length * 4, TransactionType::BVH_STRUCTURE));
+                transactions.push_back(MemoryTransactionRecord(treeletLayoutAddr((uint8_t*)(botLevelRootAddr + device_offset)), GEN_RT_BVH_length * 4, TransactionType::BVH_STRUCTURE));
             } else {
                 transactions.push_back(MemoryTransactionRecord((uint8_t*)(botLevelRootAddr + device_offset), GEN_RT_BVH_length * 4, TransactionType::BVH_STRUCTURE));
             }
-            ctx->func_sim->g_rt_mem_access_type[static_cast<int>(TransactionType::BVH_STRUCTURE)]++;
+            effects.mem_access_type[static_cast<int>(TransactionType::BVH_STRUCTURE)]++;
 
             if (debugTraversal)
             {
@@ -2695,11 +3389,11 @@ void VulkanRayTracing::traceRay(VkAccelerationStructureKHR _topLevelAS,
                     struct GEN_RT_BVH_INTERNAL_NODE node;
                     GEN_RT_BVH_INTERNAL_NODE_unpack(&node, node_addr);
                     if (remap_to_treelet_layout) {
-                        transactions.push_back(MemoryTransactionRecord(original_bvh_to_treelet_bvh_mapping[(uint8_t*)((uint64_t)node_addr + device_offset)], GEN_RT_BVH_INTERNAL_NODE_length * 4, TransactionType::BVH_INTERNAL_NODE));
+                        transactions.push_back(MemoryTransactionRecord(treeletLayoutAddr((uint8_t*)((uint64_t)node_addr + device_offset)), GEN_RT_BVH_INTERNAL_NODE_length * 4, TransactionType::BVH_INTERNAL_NODE));
                     } else {
                         transactions.push_back(MemoryTransactionRecord((uint8_t*)((uint64_t)node_addr + device_offset), GEN_RT_BVH_INTERNAL_NODE_length * 4, TransactionType::BVH_INTERNAL_NODE));
                     }
-                    ctx->func_sim->g_rt_mem_access_type[static_cast<int>(TransactionType::BVH_INTERNAL_NODE)]++;
+                    effects.mem_access_type[static_cast<int>(TransactionType::BVH_INTERNAL_NODE)]++;
                     total_nodes_accessed++;
 
                     if (debugTraversal)
@@ -2712,21 +3406,22 @@ void VulkanRayTracing::traceRay(VkAccelerationStructureKHR _topLevelAS,
                     }
 
                     bool child_hit[6];
-                    float thit[6];
+                    float thit[rt_simd_kernels::LANES];
+                    float3 idir = calculate_idir(objectRay.get_direction()); //TODO: this works wierd if one of ray dimensions is 0
+                    unsigned box_hits = ray_children_test(&node, idir, objectRay.get_origin(), objectRay.get_tmin(), objectRay.get_tmax(), thit);
                     for(int i = 0; i < 6; i++)
                     {
                         if (node.ChildSize[i] > 0)
                         {
-                            float3 idir = calculate_idir(objectRay.get_direction()); //TODO: this works wierd if one of ray dimensions is 0
-                            float3 lo, hi;
-                            set_child_bounds(&node, i, &lo, &hi);
-
-                            child_hit[i] = ray_box_test(lo, hi, idir, objectRay.get_origin(), objectRay.get_tmin(), objectRay.get_tmax(), thit[i]);
+                            child_hit[i] = (box_hits >> i) & 1;
                             if(child_hit[i] && thit[i] >= min_thit * worldToObject_tMultiplier)
                                 child_hit[i] = false;
 
                             if (debugTraversal)
                             {
+                                float3 lo, hi;
+                                set_child_bounds(&node, i, &lo, &hi);
+
                                 if(child_hit[i])
                                     traversalFile << "hit child number " << i << ", ";
                                 else
@@ -2739,6 +3434,16 @@ void VulkanRayTracing::traceRay(VkAccelerationStructureKHR _topLevelAS,
                             child_hit[i] = false;
                     }
 
+                    // The quad leaves among the hit children are tested together now, and
+                    // each one picks up its result when it is popped
+                    unsigned leaf_mask = 0;
+                    for(int i = 0; i < 6; i++)
+                        if(child_hit[i])
+                            leaf_mask |= 1u << i;
+                    unsigned leaf_tested;
+                    float leaf_thit[rt_simd_kernels::LANES];
+                    unsigned leaf_hits = ray_leaf_children_test(&node, node_addr, leaf_mask, objectRay, leaf_tested, leaf_thit);
+
                     uint8_t *child_addr = node_addr + (node.ChildOffset * 64);
                     for(int i = 0; i < 6; i++)
                     {
@@ -2752,6 +3457,13 @@ void VulkanRayTracing::traceRay(VkAccelerationStructureKHR _topLevelAS,
                             if(node.ChildType[i] != NODE_TYPE_INTERNAL)
                             {
                                 stack.push_back(StackEntry(child_addr, false, true));
+                                if (leaf_tested & (1u << i))
+                                {
+                                    stack.back().triangleTested = true;
+                                    stack.back().triangleHit = (leaf_hits >> i) & 1;
+                                    if (stack.back().triangleHit)
+                                        stack.back().triangleThit = leaf_thit[i];
+                                }
                                 assert(tree_level_map.find(node_addr) != tree_level_map.end());
                                 tree_level_map[child_addr] = tree_level_map[node_addr] + 1;
                             }
@@ -2789,15 +3501,18 @@ void VulkanRayTracing::traceRay(VkAccelerationStructureKHR _topLevelAS,
                 while(!stack.empty() && !stack.back().topLevel && stack.back().leaf)
                 {
                     uint8_t* leaf_addr = stack.back().addr;
+                    bool triangle_tested = stack.back().triangleTested;
+                    bool triangle_hit = stack.back().triangleHit;
+                    float triangle_thit = stack.back().triangleThit;
                     stack.pop_back();
                     struct GEN_RT_BVH_PRIMITIVE_LEAF_DESCRIPTOR leaf_descriptor;
                     GEN_RT_BVH_PRIMITIVE_LEAF_DESCRIPTOR_unpack(&leaf_descriptor, leaf_addr);
                     if (remap_to_treelet_layout) {
-                        transactions.push_back(MemoryTransactionRecord(original_bvh_to_treelet_bvh_mapping[(uint8_t*)((uint64_t)leaf_addr + device_offset)], GEN_RT_BVH_PRIMITIVE_LEAF_DESCRIPTOR_length * 4, TransactionType::BVH_PRIMITIVE_LEAF_DESCRIPTOR));
+                        transactions.push_back(MemoryTransactionRecord(treeletLayoutAddr((uint8_t*)((uint64_t)leaf_addr + device_offset)), GEN_RT_BVH_PRIMITIVE_LEAF_DESCRIPTOR_length * 4, TransactionType::BVH_PRIMITIVE_LEAF_DESCRIPTOR));
                     } else {
                         transactions.push_back(MemoryTransactionRecord((uint8_t*)((uint64_t)leaf_addr + device_offset), GEN_RT_BVH_PRIMITIVE_LEAF_DESCRIPTOR_length * 4, TransactionType::BVH_PRIMITIVE_LEAF_DESCRIPTOR));
                     }
-                    ctx->func_sim->g_rt_mem_access_type[static_cast<int>(TransactionType::BVH_PRIMITIVE_LEAF_DESCRIPTOR)]++;
+                    effects.mem_access_type[static_cast<int>(TransactionType::BVH_PRIMITIVE_LEAF_DESCRIPTOR)]++;
 
                     if (leaf_descriptor.LeafType == TYPE_QUAD)
                     {
@@ -2817,9 +3532,9 @@ void VulkanRayTracing::traceRay(VkAccelerationStructureKHR _topLevelAS,
                             p[i].z = leaf.QuadVertex[i].Z;
                         }
 
-                        // Triangle intersection algorithm
-                        float thit;
-                        bool hit = VulkanRayTracing::mt_ray_triangle_test(p[0], p[1], p[2], objectRay, &thit);
+                        // Triangle intersection algorithm, unless it ran with the siblings
+                        float thit = triangle_thit;
+                        bool hit = triangle_tested ? triangle_hit : VulkanRayTracing::mt_ray_triangle_test(p[0], p[1], p[2], objectRay, &thit);
 
                         assert(leaf.PrimitiveIndex1Delta == 0);
 
@@ -2859,11 +3574,11 @@ void VulkanRayTracing::traceRay(VkAccelerationStructureKHR _topLevelAS,
                             min_thit_object = thit;
                             thread->add_ray_intersect();
                             if (remap_to_treelet_layout) {
-                                transactions.push_back(MemoryTransactionRecord(original_bvh_to_treelet_bvh_mapping[(uint8_t*)((uint64_t)leaf_addr + device_offset)], GEN_RT_BVH_QUAD_LEAF_length * 4, TransactionType::BVH_QUAD_LEAF_HIT));
+                                transactions.push_back(MemoryTransactionRecord(treeletLayoutAddr((uint8_t*)((uint64_t)leaf_addr + device_offset)), GEN_RT_BVH_QUAD_LEAF_length * 4, TransactionType::BVH_QUAD_LEAF_HIT));
                             } else {
                                 transactions.push_back(MemoryTransactionRecord((uint8_t*)((uint64_t)leaf_addr + device_offset), GEN_RT_BVH_QUAD_LEAF_length * 4, TransactionType::BVH_QUAD_LEAF_HIT));
                             }
-                            ctx->func_sim->g_rt_mem_access_type[static_cast<int>(TransactionType::BVH_QUAD_LEAF_HIT)]++;
+                            effects.mem_access_type[static_cast<int>(TransactionType::BVH_QUAD_LEAF_HIT)]++;
                             total_nodes_accessed++;
 
                             if (!skipAnyHitShader) {
@@ -2871,27 +3586,10 @@ void VulkanRayTracing::traceRay(VkAccelerationStructureKHR _topLevelAS,
                                 warp_intersection_table* table = anyhit_table[thread->get_ctaid().x][thread->get_ctaid().y];
                                 
                                 uint32_t hit_group_index = instanceLeaf.InstanceContributionToHitGroupIndex;
-                                auto intersectionTransactions = table->add_intersection(hit_group_index, thread->get_tid().x, leaf.PrimitiveIndex0, instanceLeaf.InstanceID, pI, thread); // TODO: switch these to device addresses
-
-                                for(auto & newTransaction : intersectionTransactions.first)
-                                {
-                                    bool found = false;
-                                    for(auto & transaction : transactions)
-                                        if(transaction.address == newTransaction.address)
-                                        {
-                                            found = true;
-                                            break;
-                                        }
-                                    if(!found)
-                                        transactions.push_back(newTransaction);
-
-                                }
-                                store_transactions.insert(store_transactions.end(), intersectionTransactions.second.begin(), intersectionTransactions.second.end());
+                                trace_ray_effects::intersection_event &intersection = effects.add_intersection(table, hit_group_index, leaf.PrimitiveIndex0, instanceLeaf.InstanceID); // TODO: switch these to device addresses
 
                                 VSIM_DPRINTF("gpgpusim: Storing triangle intersection HitAttributes for anyhit shader\n");
 
-                                ctx->func_sim->g_rt_num_any_hits++;
-
                                 Hit_data anyhit_hit_attributes;
                                 anyhit_hit_attributes.geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR;
                                 anyhit_hit_attributes.geometry_index = leaf.LeafDescriptor.GeometryIndex;
@@ -2920,11 +3618,8 @@ void VulkanRayTracing::traceRay(VkAccelerationStructureKHR _topLevelAS,
 
                                 VSIM_DPRINTF("gpgpusim: Ray hit geomID %d primID %d at (%5.3f, %5.3f, %5.3f) with t = %5.3f\n", anyhit_hit_attributes.geometry_index, anyhit_hit_attributes.primitive_index, barycentric.x, barycentric.y, barycentric.z, thit);
 
-                                // Allocate memory to store hit attributes
-                                memory_space *mem = thread->get_global_memory();
-                                Hit_data* device_hit_attributes = (Hit_data*) VulkanRayTracing::gpgpusim_alloc(sizeof(Hit_data));
-                                mem->write(device_hit_attributes, sizeof(Hit_data), &anyhit_hit_attributes, thread, pI);
-                                thread->RT_thread_data->all_hit_data.push_back(device_hit_attributes);
+                                // Memory to store hit attributes is allocated when the effects are applied
+                                intersection.set_hit_data(anyhit_hit_attributes);
 
                                 traversal_data.n_all_hits++;
                             }
@@ -2936,11 +3631,11 @@ void VulkanRayTracing::traceRay(VkAccelerationStructureKHR _topLevelAS,
                         }
                         else {
                             if (remap_to_treelet_layout) {
-                                transactions.push_back(MemoryTransactionRecord(original_bvh_to_treelet_bvh_mapping[(uint8_t*)((uint64_t)leaf_addr + device_offset)], GEN_RT_BVH_QUAD_LEAF_length * 4, TransactionType::BVH_QUAD_LEAF));
+                                transactions.push_back(MemoryTransactionRecord(treeletLayoutAddr((uint8_t*)((uint64_t)leaf_addr + device_offset)), GEN_RT_BVH_QUAD_LEAF_length * 4, TransactionType::BVH_QUAD_LEAF));
                             } else {
                                 transactions.push_back(MemoryTransactionRecord((uint8_t*)((uint64_t)leaf_addr + device_offset), GEN_RT_BVH_QUAD_LEAF_length * 4, TransactionType::BVH_QUAD_LEAF));
                             }
-                            ctx->func_sim->g_rt_mem_access_type[static_cast<int>(TransactionType::BVH_QUAD_LEAF)]++;
+                            effects.mem_access_type[static_cast<int>(TransactionType::BVH_QUAD_LEAF)]++;
                             total_nodes_accessed++;
                         }
                         if (debugTraversal)
@@ -2954,33 +3649,17 @@ void VulkanRayTracing::traceRay(VkAccelerationStructureKHR _topLevelAS,
                         struct GEN_RT_BVH_PROCEDURAL_LEAF leaf;
                         GEN_RT_BVH_PROCEDURAL_LEAF_unpack(&leaf, leaf_addr);
                         if (remap_to_treelet_layout) {
-                            transactions.push_back(MemoryTransactionRecord(original_bvh_to_treelet_bvh_mapping[(uint8_t*)((uint64_t)leaf_addr + device_offset)], GEN_RT_BVH_PROCEDURAL_LEAF_length * 4, TransactionType::BVH_PROCEDURAL_LEAF));
+                            transactions.push_back(MemoryTransactionRecord(treeletLayoutAddr((uint8_t*)((uint64_t)leaf_addr + device_offset)), GEN_RT_BVH_PROCEDURAL_LEAF_length * 4, TransactionType::BVH_PROCEDURAL_LEAF));
                         } else {
                             transactions.push_back(MemoryTransactionRecord((uint8_t*)((uint64_t)leaf_addr + device_offset), GEN_RT_BVH_PROCEDURAL_LEAF_length * 4, TransactionType::BVH_PROCEDURAL_LEAF));
                         }
-                        ctx->func_sim->g_rt_mem_access_type[static_cast<int>(TransactionType::BVH_PROCEDURAL_LEAF)]++;
+                        effects.mem_access_type[static_cast<int>(TransactionType::BVH_PROCEDURAL_LEAF)]++;
                         total_nodes_accessed++;
 
                         uint32_t hit_group_index = instanceLeaf.InstanceContributionToHitGroupIndex;
 
                         warp_intersection_table* table = intersection_table[thread->get_ctaid().x][thread->get_ctaid().y];
-                        auto intersectionTransactions = table->add_intersection(hit_group_index, thread->get_tid().x, leaf.PrimitiveIndex[0], instanceLeaf.InstanceID, pI, thread); // TODO: switch these to device addresses
-                        
-                        // transactions.insert(transactions.end(), intersectionTransactions.first.begin(), intersectionTransactions.first.end());
-                        for(auto & newTransaction : intersectionTransactions.first)
-                        {
-                            bool found = false;
-                            for(auto & transaction : transactions)
-                                if(transaction.address == newTransaction.address)
-                                {
-                                    found = true;
-                                    break;
-                                }
-                            if(!found)
-                                transactions.push_back(newTransaction);
-
-                        }
-                        store_transactions.insert(store_transactions.end(), intersectionTransactions.second.begin(), intersectionTransactions.second.end());
+                        effects.add_intersection(table, hit_group_index, leaf.PrimitiveIndex[0], instanceLeaf.InstanceID); // TODO: switch these to device addresses
                     }
                 }
             }
@@ -2990,7 +3669,6 @@ void VulkanRayTracing::traceRay(VkAccelerationStructureKHR _topLevelAS,
     if (min_thit < ray.dir_tmax.w)
     {
         traversal_data.hit_geometry = true;
-        ctx->func_sim->g_rt_num_hits++;
         traversal_data.closest_hit.geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR;
         traversal_data.closest_hit.geometry_index = closest_leaf.LeafDescriptor.GeometryIndex;
         traversal_data.closest_hit.primitive_index = closest_leaf.PrimitiveIndex0;
@@ -3005,7 +3683,6 @@ void VulkanRayTracing::traceRay(VkAccelerationStructureKHR _topLevelAS,
 
         VSIM_DPRINTF("gpgpusim: Ray hit geomID %d primID %d\n", traversal_data.closest_hit.geometry_index, traversal_data.closest_hit.primitive_index);
         VSIM_DPRINTF("gpgpusim: Ray [%d] awaiting %d anyhit shader calls\n", thread->get_uid(), traversal_data.n_all_hits);
-        assert(thread->RT_thread_data->all_hit_data.size() == traversal_data.n_all_hits);
         float3 p[3];
         for(int i = 0; i < 3; i++)
         {
@@ -3017,7 +3694,6 @@ void VulkanRayTracing::traceRay(VkAccelerationStructureKHR _topLevelAS,
         //closest_objectRay.at(min_thit_object);
         float3 barycentric = Barycentric(object_intersection_point, p[0], p[1], p[2]);
         traversal_data.closest_hit.barycentric_coordinates = barycentric;
-        thread->RT_thread_data->set_hitAttribute(barycentric, pI, thread);
 
         // store_transactions.push_back(MemoryStoreTransactionRecord(&traversal_data, sizeof(traversal_data), StoreTransactionType::Traversal_Results));
     }
@@ -3032,13 +3708,6 @@ void VulkanRayTracing::traceRay(VkAccelerationStructureKHR _topLevelAS,
         traversal_data.hit_geometry = false;
     }
 
-    memory_space *mem = thread->get_global_memory();
-    Traversal_data* device_traversal_data = (Traversal_data*) VulkanRayTracing::gpgpusim_alloc(sizeof(Traversal_data));
-    mem->write(device_traversal_data, sizeof(Traversal_data), &traversal_data, thread, pI);
-    thread->RT_thread_data->traversal_data.push_back(device_traversal_data);
-    
-    thread->set_rt_transactions(transactions);
-    thread->set_rt_store_transactions(store_transactions);
 
     // rayCount++; // ray id starts from 1
     // printf("RayID,%d", rayCount);
@@ -3054,10 +3723,7 @@ void VulkanRayTracing::traceRay(VkAccelerationStructureKHR _topLevelAS,
         traversalFile.close();
     }
 
-    if (total_nodes_accessed > ctx->func_sim->g_max_nodes_per_ray) {
-        ctx->func_sim->g_max_nodes_per_ray = total_nodes_accessed;
-    }
-    ctx->func_sim->g_tot_nodes_per_ray += total_nodes_accessed;
+    effects.nodes_accessed = total_nodes_accessed;
 
     unsigned level = 0;
     for (auto it=tree_level_map.begin(); it!=tree_level_map.end(); it++) {
@@ -3065,9 +3731,10 @@ void VulkanRayTracing::traceRay(VkAccelerationStructureKHR _topLevelAS,
             level = it->second;
         }
     }
-    if (level > ctx->func_sim->g_max_tree_depth) {
-        ctx->func_sim->g_max_tree_depth = level;
-    }
+    effects.tree_depth = level;
+
+    if (!deferred)
+        applyTraceRayEffects(effects, pI, thread);
 
     RT_DPRINTF("Traversal: \n");
     for (auto t : transactions) {
@@ -3075,6 +3742,204 @@ void VulkanRayTracing::traceRay(VkAccelerationStructureKHR _topLevelAS,
     }
 }
 
+// Performs what a traceRay walk recorded, in the order the walk reached it
+void VulkanRayTracing::applyTraceRayEffects(trace_ray_effects &effects, const ptx_instruction *pI, ptx_thread_info *thread)
+{
+    gpgpu_context *ctx = GPGPU_Context();
+    memory_space *mem = thread->get_global_memory();
+    Traversal_data &traversal_data = effects.traversal_data;
+
+    if (effects.anyhit_ray) ctx->func_sim->g_n_anyhit_rays++;
+    else ctx->func_sim->g_n_closesthit_rays++;
+    for (int i = 0; i < static_cast<int>(TransactionType::UNDEFINED); i++)
+        ctx->func_sim->g_rt_mem_access_type[i] += effects.mem_access_type[i];
+
+    // Intersection table loads go in where the walk found the intersection, unless the ray already loaded that address
+    std::vector<MemoryTransactionRecord> transactions;
+    std::vector<MemoryStoreTransactionRecord> store_transactions;
+    size_t walk_pos = 0;
+    for (auto &intersection : effects.intersections)
+    {
+        transactions.insert(transactions.end(), effects.transactions.begin() + walk_pos, effects.transactions.begin() + intersection.transaction_pos);
+        walk_pos = intersection.transaction_pos;
+
+        auto intersectionTransactions = intersection.table->add_intersection(intersection.hit_group_index, thread->get_tid().x, intersection.primitive_index, intersection.instance_index, pI, thread);
+        for(auto & newTransaction : intersectionTransactions.first)
+        {
+            bool found = false;
+            for(auto & transaction : transactions)
+                if(transaction.address == newTransaction.address)
+                {
+                    found = true;
+                    break;
+                }
+            if(!found)
+                transactions.push_back(newTransaction);
+        }
+        store_transactions.insert(store_transactions.end(), intersectionTransactions.second.begin(), intersectionTransactions.second.end());
+
+        if (intersection.store_hit_data)
+        {
+            ctx->func_sim->g_rt_num_any_hits++;
+
+            // Allocate memory to store hit attributes
+            Hit_data* device_hit_attributes = (Hit_data*) VulkanRayTracing::gpgpusim_alloc(sizeof(Hit_data));
+            mem->write(device_hit_attributes, sizeof(Hit_data), &intersection.hit_data, thread, pI);
+            thread->RT_thread_data->all_hit_data.push_back(device_hit_attributes);
+        }
+    }
+    transactions.insert(transactions.end(), effects.transactions.begin() + walk_pos, effects.transactions.end());
+
+    if (traversal_data.hit_geometry)
+    {
+        ctx->func_sim->g_rt_num_hits++;
+        assert(thread->RT_thread_data->all_hit_data.size() == traversal_data.n_all_hits);
+        thread->RT_thread_data->set_hitAttribute(traversal_data.closest_hit.barycentric_coordinates, pI, thread);
+    }
+
+    Traversal_data* device_traversal_data = (Traversal_data*) VulkanRayTracing::gpgpusim_alloc(sizeof(Traversal_data));
+    mem->write(device_traversal_data, sizeof(Traversal_data), &traversal_data, thread, pI);
+    thread->RT_thread_data->traversal_data.push_back(device_traversal_data);
+
+    thread->set_rt_transactions(transactions);
+    thread->set_rt_store_transactions(store_transactions);
+
+    if (effects.log_treelets)
+    {
+        printf("RayID,%d", effects.ray_id);
+        for (auto transaction : transactions)
+        {
+            printf(",0x%x", VulkanRayTracing::addrToTreeletID((uint8_t*)transaction.address));
+            accessedDataSize += transaction.size;
+        }
+        printf("\n");
+    }
+
+    if (effects.nodes_accessed > ctx->func_sim->g_max_nodes_per_ray) {
+        ctx->func_sim->g_max_nodes_per_ray = effects.nodes_accessed;
+    }
+    ctx->func_sim->g_tot_nodes_per_ray += effects.nodes_accessed;
+    if (effects.tree_depth > ctx->func_sim->g_max_tree_depth) {
+        ctx->func_sim->g_max_tree_depth = effects.tree_depth;
+    }
+}
+
+
+// A traceRay call queued by deferTraceRay
+typedef struct deferred_trace_ray {
+    VkAccelerationStructureKHR topLevelAS;
+    uint rayFlags;
+    uint cullMask;
+    uint sbtRecordOffset;
+    uint sbtRecordStride;
+    uint missIndex;
+    float3 origin;
+    float Tmin;
+    float3 direction;
+    float Tmax;
+    int payload;
+    const ptx_instruction *pI;
+    ptx_thread_info *thread;
+    trace_ray_effects effects;
+} deferred_trace_ray;
+
+static bool trace_ray_batch_open = false;
+static std::vector<deferred_trace_ray> trace_ray_batch; // in lane order
+static sim_thread_pool *trace_ray_pool = NULL;
+
+static void runTraceRay(deferred_trace_ray &ray, bool with_treelets, trace_ray_effects *deferred)
+{
+    if (with_treelets)
+        VulkanRayTracing::traceRayWithTreelets(ray.topLevelAS, ray.rayFlags, ray.cullMask, ray.sbtRecordOffset, ray.sbtRecordStride, ray.missIndex,
+                                               ray.origin, ray.Tmin, ray.direction, ray.Tmax, ray.payload, ray.pI, ray.thread, deferred);
+    else
+        VulkanRayTracing::traceRay(ray.topLevelAS, ray.rayFlags, ray.cullMask, ray.sbtRecordOffset, ray.sbtRecordStride, ray.missIndex,
+                                   ray.origin, ray.Tmin, ray.direction, ray.Tmax, ray.payload, ray.pI, ray.thread, deferred);
+}
+
+// Called before a warp executes a trace_ray, returns false if walks aren't batched (-rt_trace_threads 1)
+bool VulkanRayTracing::beginTraceRayBatch()
+{
+    const shader_core_config *config = GPGPU_Context()->the_gpgpusim->g_the_gpu->get_m_cluster()[0]->get_m_core()[0]->get_config();
+    unsigned n_threads = config->rt_trace_threads ? config->rt_trace_threads : std::max(std::thread::hardware_concurrency(), 1u);
+    if (n_threads <= 1)
+        return false;
+
+    if (!trace_ray_pool)
+        trace_ray_pool = new sim_thread_pool(n_threads);
+    assert(trace_ray_batch.empty());
+    trace_ray_batch_open = true;
+    return true;
+}
+
+// Queues the walk if a batch is open, the thread's results are ready after flushTraceRayBatch
+bool VulkanRayTracing::deferTraceRay(VkAccelerationStructureKHR _topLevelAS,
+                   uint rayFlags,
+                   uint cullMask,
+                   uint sbtRecordOffset,
+                   uint sbtRecordStride,
+                   uint missIndex,
+                   float3 origin,
+                   float Tmin,
+                   float3 direction,
+                   float Tmax,
+                   int payload,
+                   const ptx_instruction *pI,
+                   ptx_thread_info *thread)
+{
+    if (!trace_ray_batch_open)
+        return false;
+
+    trace_ray_batch.push_back(deferred_trace_ray());
+    deferred_trace_ray &ray = trace_ray_batch.back();
+    ray.topLevelAS = _topLevelAS;
+    ray.rayFlags = rayFlags;
+    ray.cullMask = cullMask;
+    ray.sbtRecordOffset = sbtRecordOffset;
+    ray.sbtRecordStride = sbtRecordStride;
+    ray.missIndex = missIndex;
+    ray.origin = origin;
+    ray.Tmin = Tmin;
+    ray.direction = direction;
+    ray.Tmax = Tmax;
+    ray.payload = payload;
+    ray.pI = pI;
+    ray.thread = thread;
+    thread->set_rt_trace_deferred(true);
+    return true;
+}
+
+// Walks the queued rays on the worker threads, then applies their effects in lane order
+void VulkanRayTracing::flushTraceRayBatch()
+{
+    trace_ray_batch_open = false;
+    if (trace_ray_batch.empty())
+        return;
+
+    bool with_treelets = GPGPU_Context()->the_gpgpusim->g_the_gpu->get_config().get_treelet_based_traversal();
+
+    // The first rays also form treelets, find the world bounds and dump the
+    // trace, and debugTraversal writes one file for every ray, so those run
+    // one at a time like they would without batching
+    bool serial = !treeletsFormed || !GPGPU_Context()->func_sim->g_rt_world_set || (dump_trace && !dumped) || debugTraversal;
+    if (serial)
+    {
+        for (auto &ray : trace_ray_batch)
+            runTraceRay(ray, with_treelets, NULL);
+    }
+    else
+    {
+        for (auto &ray : trace_ray_batch)
+            ray.effects.ray_id = ++rayCount;
+        trace_ray_pool->run(trace_ray_batch.size(), [&](unsigned i) {
+            runTraceRay(trace_ray_batch[i], with_treelets, &trace_ray_batch[i].effects);
+        });
+        for (auto &ray : trace_ray_batch)
+            applyTraceRayEffects(ray.effects, ray.pI, ray.thread);
+    }
+    trace_ray_batch.clear();
+}
+
 void VulkanRayTracing::endTraceRay(const ptx_instruction *pI, ptx_thread_info *thread)
 {
     assert(thread->RT_thread_data->traversal_data.size() > 0);
@@ -3088,26 +3953,7 @@ void VulkanRayTracing::endTraceRay(const ptx_instruction *pI, ptx_thread_info *t
 
 bool VulkanRayTracing::mt_ray_triangle_test(float3 p0, float3 p1, float3 p2, Ray ray_properties, float* thit)
 {
-    // Moller Trumbore algorithm (from scratchapixel.com)
-    float3 v0v1 = p1 - p0;
-    float3 v0v2 = p2 - p0;
-    float3 pvec = cross(ray_properties.get_direction(), v0v2);
-    float det = dot(v0v1, pvec);
-
-    float idet = 1 / det;
-
-    float3 tvec = ray_properties.get_origin() - p0;
-    float u = dot(tvec, pvec) * idet;
-
-    if (u < 0 || u > 1) return false;
-
-    float3 qvec = cross(tvec, v0v1);
-    float v = dot(ray_properties.get_direction(), qvec) * idet;
-
-    if (v < 0 || (u + v) > 1) return false;
-
-    *thit = dot(v0v2, qvec) * idet;
-    return true;
+    return ::mt_ray_triangle_test(p0, p1, p2, ray_properties.get_origin(), ray_properties.get_direction(), thit);
 }
 
 float3 VulkanRayTracing::Barycentric(float3 p, float3 a, float3 b, float3 c)
@@ -3340,6 +4186,21 @@ uint32_t VulkanRayTracing::registerShaders(char * shaderPath, gl_shader_stage sh
 
     VulkanRayTracing::shaders.push_back(shader);
 
+    // Shader list of the dumped bundle, in registration order: <ptx file>,<gl_shader_stage>
+    if (dump_trace)
+    {
+        static bool shader_list_started = false;
+        char shader_list_filename[200];
+        snprintf(shader_list_filename, sizeof(shader_list_filename), "%s%s", mesa_root, "gpgpusimShaders/shaders.list");
+        FILE *fp = fopen(shader_list_filename, shader_list_started ? "a" : "w");
+        if (fp)
+        {
+            fprintf(fp, "%s,%d\n", fullfilename.c_str(), (int)shaderType);
+            fclose(fp);
+        }
+        shader_list_started = true;
+    }
+
     return shader.ID;
 
     // if (itr.find("RAYGEN") != std::string::npos)
@@ -4531,6 +5392,13 @@ void VulkanRayTracing::dump_descriptor_set_for_AS(uint32_t setID, uint32_t descI
                                                             haveForwards);
         fclose(fp);
 
+        // BLAS roots, as byte offsets from the top level root, so a launcher can rebuild blas_addr_map
+        snprintf(fullPath, sizeof(fullPath), "%s%s%d_%d.asblas", mesa_root, filePath, setID, descID);
+        fp = fopen(fullPath, "w+");
+        for (auto mapping : blas_addr_map)
+            fprintf(fp, "%lld\n", (long long)((uint64_t)mapping.first - (uint64_t)address));
+        fclose(fp);
+
         
         // uint64_t total_size = (desc_size + backwards_range + forward_range);
         // uint64_t chunk_size = 1024*1024*20; // 20MB chunks
@@ -4898,6 +5766,29 @@ void VulkanRayTracing::allocTLAS(void* rootAddr, uint64_t bufferSize, void* gpgp
     tlas_addr = gpgpusimAddr;
 }
 
+void* VulkanRayTracing::allocDeviceMemory(uint64_t size)
+{
+    gpgpu_context *ctx = GPGPU_Context();
+    CUctx_st *context = GPGPUSim_Context(ctx);
+    void* devPtr = context->get_device()->get_gpgpu()->gpu_malloc(size);
+    assert(devPtr);
+    return devPtr;
+}
+
+void VulkanRayTracing::copyToDevice(void* deviceAddress, const void* data, uint64_t size)
+{
+    gpgpu_context *ctx = GPGPU_Context();
+    CUctx_st *context = GPGPUSim_Context(ctx);
+    context->get_device()->get_gpgpu()->memcpy_to_gpu((size_t)deviceAddress, data, size);
+}
+
+void VulkanRayTracing::copyFromDevice(void* data, const void* deviceAddress, uint64_t size)
+{
+    gpgpu_context *ctx = GPGPU_Context();
+    CUctx_st *context = GPGPUSim_Context(ctx);
+    context->get_device()->get_gpgpu()->memcpy_from_gpu(data, (size_t)deviceAddress, size);
+}
+
 void VulkanRayTracing::findOffsetBounds(int64_t &max_backwards, int64_t &min_backwards, int64_t &min_forwards, int64_t &max_forwards, VkAccelerationStructureKHR _topLevelAS)
 {
     // uint64_t current_min_backwards = 0;
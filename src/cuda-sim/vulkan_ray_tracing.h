@@ -39,6 +39,9 @@
 #endif
 
 #include "intersection_table.h"
+#include "treelet_index.h"
+#include "treelet_cache.h"
+#include "treelet_layout.h"
 #include "compiler/spirv/spirv.h"
 
 // #include "ptx_ir.h"
@@ -190,6 +193,12 @@ typedef struct StackEntry {
     float4x4 objectToWorldMatrix;
     Ray objectRay;
 
+    // Quad leaves only: ray-triangle result from testing the leaf together
+    // with its siblings when the parent was visited
+    bool triangleTested = false;
+    bool triangleHit = false;
+    float triangleThit = 0;
+
     StackEntry() {}
     StackEntry(uint8_t* addr, bool topLevel, bool leaf): addr(addr), topLevel(topLevel), leaf(leaf) {}
     StackEntry(uint8_t* addr, bool topLevel, bool leaf, int size): addr(addr), topLevel(topLevel), leaf(leaf), size(size) {}
@@ -207,6 +216,15 @@ typedef struct StackEntry {
     }
 } StackEntry;
 
+// Treelet tables produced by one treelet formation pass, in device addresses, before they are installed into VulkanRayTracing
+typedef struct treelet_partition {
+    std::map<StackEntry, std::vector<StackEntry>> roots;
+    std::map<uint8_t*, std::vector<StackEntry>> roots_addr_only;
+    std::map<StackEntry, std::vector<StackEntry>> child_map;
+    std::map<uint8_t*, std::vector<StackEntry>> addr_only_child_map;
+    unsigned total_bvh_size;
+} treelet_partition;
+
 // For launcher
 typedef struct storage_image_metadata
 {
@@ -244,6 +262,8 @@ typedef struct texture_metadata
     VkFilter filter;
 } texture_metadata;
 
+struct trace_ray_effects; // vulkan_rt_thread_data.h
+
 
 #if defined(MESA_USE_INTEL_DRIVER)
 #define DESCRIPTOR_SET_STRUCT anv_descriptor_set
@@ -301,7 +321,7 @@ public:
     static std::map<uint8_t*, std::vector<StackEntry>> treelet_roots_addr_only; // <address, vector of children that belong to this treelet>, just to look up if an address is a treelet root node or not
     static std::map<StackEntry, std::vector<StackEntry>> treelet_child_map; // Key: a treelet root node; Value: vector of child treelets of this treelet node
     static std::map<uint8_t*, std::vector<StackEntry>> treelet_addr_only_child_map; // Key: a treelet root node address; Value: vector of child treelets of this treelet node
-    static std::map<uint8_t*, uint8_t*> node_map_addr_only;
+    static treelet_index flat_treelet_index; // flat node -> treelet lookup tables built from the maps above, used by the timing model
 
     static std::map<uint8_t*, StackEntry> parent_map; // map <node, it's parent>
     static std::map<uint8_t*, std::vector<StackEntry>> children_map; // map <node, it's children>
@@ -313,6 +333,7 @@ public:
     static std::map<uint8_t*, unsigned> treelet_addr_to_metadata_idx; // labels each treelet so it can find the corresponding treelet metadata in the malloc'd memory
     static unsigned per_treelet_metadata_size;
     static uint8_t* treelet_layout_bvh; // address where I will malloc the packed bvh
+    static uint64_t treelet_layout_bvh_size;
     static std::map<uint8_t*, uint8_t*> original_bvh_to_treelet_bvh_mapping; // stores the address mappings of the addresses of the original BVH to a treelet layout BVH
 
     static unsigned accessedDataSize;
@@ -339,7 +360,8 @@ public:
                        float Tmax,
                        int payload,
                        const ptx_instruction *pI,
-                       ptx_thread_info *thread);
+                       ptx_thread_info *thread,
+                       trace_ray_effects *deferred = NULL);
     static void traceRayWithTreelets( // called by raygen shader
                        VkAccelerationStructureKHR _topLevelAS,
     				   uint rayFlags,
@@ -353,8 +375,27 @@ public:
                        float Tmax,
                        int payload,
                        const ptx_instruction *pI,
-                       ptx_thread_info *thread);
+                       ptx_thread_info *thread,
+                       trace_ray_effects *deferred = NULL);
     static void endTraceRay(const ptx_instruction *pI, ptx_thread_info *thread);
+
+    // Per warp batching of traceRay walks (-rt_trace_threads), driven by core_t::execute_warp_inst_t
+    static bool beginTraceRayBatch();
+    static bool deferTraceRay(VkAccelerationStructureKHR _topLevelAS,
+                              uint rayFlags,
+                              uint cullMask,
+                              uint sbtRecordOffset,
+                              uint sbtRecordStride,
+                              uint missIndex,
+                              float3 origin,
+                              float Tmin,
+                              float3 direction,
+                              float Tmax,
+                              int payload,
+                              const ptx_instruction *pI,
+                              ptx_thread_info *thread);
+    static void flushTraceRayBatch();
+    static void applyTraceRayEffects(trace_ray_effects &effects, const ptx_instruction *pI, ptx_thread_info *thread);
     
     static void load_descriptor(const ptx_instruction *pI, ptx_thread_info *thread);
 
@@ -427,17 +468,30 @@ public:
     static void parentPointerPass(VkAccelerationStructureKHR _topLevelAS, int64_t device_offset);
     static void createTreelets(VkAccelerationStructureKHR _topLevelAS, int64_t device_offset, int maxBytesPerTreelet);
     static void createTreeletsBottomUp(VkAccelerationStructureKHR _topLevelAS, int64_t device_offset, int maxBytesPerTreelet);
+    static void formTreeletsSequential(VkAccelerationStructureKHR _topLevelAS, int64_t device_offset, int maxBytesPerTreelet, treelet_partition &partition);
+    static void formTreeletsParallel(VkAccelerationStructureKHR _topLevelAS, int64_t device_offset, int maxBytesPerTreelet, unsigned n_threads, treelet_partition &partition);
+    static void installTreelets(treelet_partition &partition, int maxBytesPerTreelet);
+    static void benchmarkTreeletBuild(VkAccelerationStructureKHR _topLevelAS, int64_t device_offset, int maxBytesPerTreelet);
     static void remapBVHToTreeletLayout();
+    static treelet_layout_geometry treeletLayoutGeometry();
+    static void reportTreeletLayout();
+    static void formTreelets(VkAccelerationStructureKHR _topLevelAS, int64_t device_offset, int maxBytesPerTreelet);
+    static uint64_t hashAccelerationStructure(VkAccelerationStructureKHR _topLevelAS, int64_t device_offset);
+    static bool loadTreeletCache(const std::string &path, const treelet_cache_key &key);
+    static void saveTreeletCache(const std::string &path, const treelet_cache_key &key);
     static float calculateSAH(float3 lo, float3 hi);
     static bool isTreeletRoot(StackEntry node);
     static bool isTreeletRoot(uint8_t* addr);
     static uint8_t* addrToTreeletID(uint8_t* addr);
-    static std::vector<StackEntry> treeletIDToChildren(StackEntry treelet_root);
-    static std::vector<StackEntry> treeletIDToChildren(uint8_t* treelet_root);
+    static uint8_t* treeletLayoutAddr(uint8_t* addr);
     static void buildNodeToRootMap();
+    static void benchmarkTreeletIndex();
     static void allocBLAS(void* rootAddr, uint64_t bufferSize, void* gpgpusimAddr);
     static void allocTLAS(void* rootAddr, uint64_t bufferSize, void* gpgpusimAddr);
     static void* allocBuffer(void* bufferAddr, uint64_t bufferSize);
+    static void* allocDeviceMemory(uint64_t size);
+    static void copyToDevice(void* deviceAddress, const void* data, uint64_t size);
+    static void copyFromDevice(void* data, const void* deviceAddress, uint64_t size);
     static void findOffsetBounds(int64_t &max_backwards, int64_t &min_backwards, int64_t &min_forwards, int64_t &max_forwards, VkAccelerationStructureKHR _topLevelAS);
     static void* gpgpusim_alloc(uint32_t size);
     static void* gpgpusim_malloc(uint32_t size);
@@ -57,6 +57,56 @@ typedef struct Traversal_data {
     uint32_t missIndex;
 } Traversal_data;
 
+// Everything a traceRay call does to state shared between threads: stats,
+// the warp intersection tables and allocations in device memory. The BVH walk
+// only records these and applyTraceRayEffects performs them, so the walks of a
+// warp's threads can run concurrently and still leave exactly what a serial
+// run would.
+typedef struct trace_ray_effects {
+    typedef struct intersection_event {
+        warp_intersection_table* table;
+        uint32_t hit_group_index;
+        uint32_t primitive_index;
+        uint32_t instance_index;
+        size_t transaction_pos; // walk transactions recorded before this intersection
+        bool store_hit_data; // anyhit shader input, written to device memory after the table entry
+        Hit_data hit_data;
+
+        void set_hit_data(const Hit_data &data) {
+            store_hit_data = true;
+            hit_data = data;
+        }
+    } intersection_event;
+
+    unsigned ray_id;
+    bool anyhit_ray;
+    unsigned mem_access_type[static_cast<int>(TransactionType::UNDEFINED)];
+    unsigned nodes_accessed;
+    unsigned tree_depth;
+    bool log_treelets; // print the treelets the ray visited
+
+    std::vector<MemoryTransactionRecord> transactions; // walk transactions, without intersection table loads
+    std::vector<intersection_event> intersections;
+    Traversal_data traversal_data;
+
+    trace_ray_effects() : ray_id(0), anyhit_ray(false), nodes_accessed(0), tree_depth(0), log_treelets(false), traversal_data() {
+        for (int i = 0; i < static_cast<int>(TransactionType::UNDEFINED); i++)
+            mem_access_type[i] = 0;
+    }
+
+    intersection_event &add_intersection(warp_intersection_table* table, uint32_t hit_group_index, uint32_t primitive_index, uint32_t instance_index) {
+        intersection_event intersection;
+        intersection.table = table;
+        intersection.hit_group_index = hit_group_index;
+        intersection.primitive_index = primitive_index;
+        intersection.instance_index = instance_index;
+        intersection.transaction_pos = transactions.size();
+        intersection.store_hit_data = false;
+        intersections.push_back(intersection);
+        return intersections.back();
+    }
+} trace_ray_effects;
+
 
 typedef struct Vulkan_RT_thread_data {
     std::vector<variable_decleration_entry> variable_decleration_table;
@@ -158,6 +158,19 @@ class fifo_pipeline {
     return (m_max_len && m_length + size - 1 >= m_max_len);
   }
   bool empty() const { return m_head == NULL; }
+  // true if any slot holds data rather than a delay bubble
+  bool has_data() const {
+    for (fifo_data<T>* ddp = m_head; ddp; ddp = ddp->m_next)
+      if (ddp->m_data) return true;
+    return false;
+  }
+  // slots ahead of the first data entry, the length if there is none
+  unsigned get_data_depth() const {
+    unsigned depth = 0;
+    for (fifo_data<T>* ddp = m_head; ddp && !ddp->m_data; ddp = ddp->m_next)
+      depth++;
+    return depth;
+  }
   unsigned get_n_element() const { return m_n_element; }
   unsigned get_length() const { return m_length; }
   unsigned get_max_len() const { return m_max_len; }
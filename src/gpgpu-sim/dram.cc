@@ -550,6 +550,187 @@ void dram_t::cycle() {
 #endif
 }
 
+unsigned long long dram_t::quiet_cycles() const {
+#ifdef DRAM_VISUALIZE
+  return 0;
+#endif
+  if (!returnq->empty() || !mrqq->empty() || rwq->full()) return 0;
+  unsigned long long horizon = (unsigned long long)-1;
+  if (rwq->has_data()) horizon = rwq->get_data_depth();
+
+  // first cycle each bank's command could issue
+  bool idle_banks = false;
+  for (unsigned j = 0; j < m_config->nbk; j++) {
+    const bank_t *b = bk[j];
+    if (!b->mrq) {
+      idle_banks = true;
+      continue;
+    }
+    unsigned grp = get_bankgrp_number(j);
+    unsigned ready;
+    if (b->state == BANK_IDLE)
+      ready = std::max(RRDc, std::max(b->RPc, b->RCc));
+    else if (b->curr_row != b->mrq->row)
+      ready = std::max(std::max(b->RASc, b->WTPc),
+                       std::max(b->RTPc, bkgrp[grp]->RTPLc));
+    else if (b->mrq->rw == READ)
+      ready = std::max(std::max(CCDc, b->RCDc),
+                       std::max(bkgrp[grp]->CCDLc, WTRc));
+    else
+      ready = std::max(std::max(CCDc, b->RCDWRc),
+                       std::max(bkgrp[grp]->CCDLc, RTWc));
+    if (ready < horizon) horizon = ready;
+  }
+
+  // a bank without a request asks the scheduler every cycle
+  if (idle_banks && m_frfcfs_scheduler) {
+    if (m_frfcfs_scheduler->recording()) return 0;
+    enum memory_mode once = m_frfcfs_scheduler->mode_after(1);
+    enum memory_mode twice = m_frfcfs_scheduler->mode_after(2);
+    for (unsigned j = 0; j < m_config->nbk; j++) {
+      if (!bk[j]->mrq && (m_frfcfs_scheduler->has_request(j, once) ||
+                          m_frfcfs_scheduler->has_request(j, twice)))
+        return 0;
+    }
+  }
+  return horizon;
+}
+
+// Cycles t in [lo, hi) with from <= t < to
+static unsigned long long ticks_in(unsigned long long lo, unsigned long long hi,
+                                   unsigned long long from,
+                                   unsigned long long to) {
+  if (from > lo) lo = from;
+  if (to < hi) hi = to;
+  return hi > lo ? hi - lo : 0;
+}
+
+#define SUB2ZERO(x, n) x = ((x) > (n)) ? (x) - (n) : 0;
+
+void dram_t::skip_cycles(unsigned long long cycles, unsigned long long stamp) {
+  assert(cycles <= quiet_cycles());
+  if (!cycles) return;
+
+  unsigned nreqs = que_length();
+  if (nreqs > max_mrqs) max_mrqs = nreqs;
+  ave_mrqs += nreqs * cycles;
+  ave_mrqs_partial += nreqs * cycles;
+
+  // nothing issues, so the banks holding a request stay the same throughout
+  unsigned memory_pending = 0;
+  unsigned memory_pending_rw = 0;
+  unsigned read_blp_rw = 0;
+  unsigned write_blp_rw = 0;
+  std::bitset<8> bnkgrp_rw_found;
+  unsigned idle_banks = 0;
+  unsigned active = std::max(std::max(CCDc, RRDc), std::max(RTWc, WTRc));
+  for (unsigned j = 0; j < m_config->nbk; j++) {
+    const bank_t *b = bk[j];
+    if (!b->mrq) {
+      idle_banks++;
+      unsigned t = std::max(std::max(b->RCDc, b->RASc),
+                            std::max(std::max(b->RCc, b->RPc), b->RCDWRc));
+      if (t > active) active = t;
+      continue;
+    }
+    b->mrq->data->set_status(IN_PARTITION_DRAM, stamp);
+    memory_pending++;
+    if (b->state == BANK_ACTIVE && b->curr_row == b->mrq->row) {
+      memory_pending_rw++;
+      if (b->mrq->rw == READ)
+        read_blp_rw++;
+      else if (b->mrq->rw == WRITE)
+        write_blp_rw++;
+      bnkgrp_rw_found.set(get_bankgrp_number(j));
+    }
+  }
+
+  banks_1time += memory_pending * cycles;
+  banks_time_rw += memory_pending_rw * cycles;
+  bkgrp_parallsim_rw += bnkgrp_rw_found.count() * cycles;
+  if (memory_pending > 0) {
+    banks_acess_total += cycles;
+    banks_acess_total_after += cycles;
+  }
+  if (memory_pending_rw > 0) {
+    for (unsigned long long c = 0; c < cycles; c++)
+      write_to_read_ratio_blp_rw_average +=
+          (double)write_blp_rw / (write_blp_rw + read_blp_rw);
+    banks_access_rw_total += cycles;
+  }
+
+  n_nop += cycles;
+  n_nop_partial += cycles;
+  n_cmd += cycles;
+  n_cmd_partial += cycles;
+  unsigned long long busy =
+      memory_pending ? cycles : std::min<unsigned long long>(cycles, active);
+  n_activity += busy;
+  n_activity_partial += busy;
+  for (unsigned j = 0; j < m_config->nbk; j++)
+    if (!bk[j]->mrq) bk[j]->n_idle += cycles;
+
+  // the bus counts as used while CCDc runs down, as wasted or idle after
+  unsigned long long used = std::min<unsigned long long>(cycles, CCDc);
+  util_bw += used;
+  if (memory_pending_rw) {
+    wasted_bw_col += cycles - used;
+    for (unsigned j = 0; j < m_config->nbk; j++) {
+      const bank_t *b = bk[j];
+      if (!b->mrq || b->state != BANK_ACTIVE || b->curr_row != b->mrq->row)
+        continue;
+      unsigned grp = get_bankgrp_number(j);
+      unsigned CCDLc = bkgrp[grp]->CCDLc;
+      CCDLc_limit += ticks_in(used, cycles, 0, CCDLc);
+      if (b->mrq->rw == READ) {
+        RCDc_limit += ticks_in(used, cycles, 0, b->RCDc);
+        WTRc_limit += ticks_in(used, cycles, 0, WTRc);
+        CCDLc_limit_alone += ticks_in(used, cycles, WTRc, CCDLc);
+        WTRc_limit_alone += ticks_in(used, cycles, CCDLc, WTRc);
+      } else if (b->mrq->rw == WRITE) {
+        RCDWRc_limit += ticks_in(used, cycles, 0, b->RCDWRc);
+        RTWc_limit += ticks_in(used, cycles, 0, RTWc);
+        CCDLc_limit_alone += ticks_in(used, cycles, RTWc, CCDLc);
+        RTWc_limit_alone += ticks_in(used, cycles, CCDLc, RTWc);
+      }
+    }
+  } else if (memory_pending) {
+    wasted_bw_row += cycles - used;
+  } else {
+    idle_bw += cycles - used;
+  }
+
+  SUB2ZERO(RRDc, cycles);
+  SUB2ZERO(CCDc, cycles);
+  SUB2ZERO(RTWc, cycles);
+  SUB2ZERO(WTRc, cycles);
+  for (unsigned j = 0; j < m_config->nbk; j++) {
+    SUB2ZERO(bk[j]->RCDc, cycles);
+    SUB2ZERO(bk[j]->RASc, cycles);
+    SUB2ZERO(bk[j]->RCc, cycles);
+    SUB2ZERO(bk[j]->RPc, cycles);
+    SUB2ZERO(bk[j]->RCDWRc, cycles);
+    SUB2ZERO(bk[j]->WTPc, cycles);
+    SUB2ZERO(bk[j]->RTPc, cycles);
+  }
+  for (unsigned j = 0; j < m_config->nbkgrp; j++) {
+    SUB2ZERO(bkgrp[j]->CCDLc, cycles);
+    SUB2ZERO(bkgrp[j]->RTPLc, cycles);
+  }
+
+  // one update_mode() per bank without a request, each cycle
+  if (m_frfcfs_scheduler && idle_banks) {
+    unsigned long long calls = cycles * idle_banks;
+    m_frfcfs_scheduler->update_mode();
+    if (!(calls & 1)) m_frfcfs_scheduler->update_mode();
+  }
+
+  // bubbles ahead of the first data entry drain out
+  unsigned long long pops =
+      std::min<unsigned long long>(cycles, rwq->get_length());
+  for (unsigned long long c = 0; c < pops; c++) rwq->pop();
+}
+
 bool dram_t::issue_col_command(int j) {
   bool issued = false;
   unsigned grp = get_bankgrp_number(j);
@@ -870,7 +1051,7 @@ void dram_t::set_dram_power_stats(unsigned &cmd, unsigned &activity,
   req = n_req;
 }
 
-unsigned dram_t::get_bankgrp_number(unsigned i) {
+unsigned dram_t::get_bankgrp_number(unsigned i) const {
   if (m_config->dram_bnkgrp_indexing_policy == HIGHER_BITS) {  // higher bits
     return i >> m_config->bk_tag_length;
   } else if (m_config->dram_bnkgrp_indexing_policy ==
@@ -52,6 +52,11 @@ class dram_req_t {
  public:
   dram_req_t(class mem_fetch *data, unsigned banks,
              unsigned dram_bnk_indexing_policy, class gpgpu_sim *gpu);
+  // Just a bank and row, for replaying a recorded FR-FCFS request stream
+  dram_req_t(unsigned bank, unsigned row_)
+      : row(row_), col(0), bk(bank), nbytes(0), txbytes(0), dqbytes(0),
+        age(0), timestamp(0), rw(0), addr(0), insertion_time(0), data(NULL),
+        m_gpu(NULL) {}
 
   unsigned int row;
   unsigned int col;
@@ -127,6 +132,12 @@ class dram_t {
 
   void push(class mem_fetch *data);
   void cycle();
+  // cycle()s from now on that issue no command and take nothing out of the
+  // data pipeline, so only timing counters and stats move; 0 if the next
+  // one must be stepped
+  unsigned long long quiet_cycles() const;
+  // 'cycles' cycle()s within quiet_cycles(), the last one at 'stamp'
+  void skip_cycles(unsigned long long cycles, unsigned long long stamp);
   void dram_log(int task);
 
   class memory_partition_unit *m_memory_partition_unit;
@@ -146,7 +157,7 @@ class dram_t {
   bank_t **bk;
   unsigned int prio;
 
-  unsigned get_bankgrp_number(unsigned i);
+  unsigned get_bankgrp_number(unsigned i) const;
 
   void scheduler_fifo();
   void scheduler_frfcfs();
@@ -32,6 +32,266 @@
 #include "gpu-sim.h"
 #include "mem_latency_stat.h"
 
+#define FRFCFS_NODE_CHUNK 64
+#define FRFCFS_MIN_ROW_BINS 16
+
+frfcfs_node_pool::~frfcfs_node_pool() {
+  for (unsigned i = 0; i < m_chunks.size(); i++) delete[] m_chunks[i];
+}
+
+void frfcfs_node_pool::grow() {
+  frfcfs_node *chunk = new frfcfs_node[FRFCFS_NODE_CHUNK];
+  m_chunks.push_back(chunk);
+  for (unsigned i = 0; i < FRFCFS_NODE_CHUNK; i++) release(&chunk[i]);
+}
+
+frfcfs_node *frfcfs_node_pool::alloc() {
+  if (m_free == NULL) grow();
+  frfcfs_node *node = m_free;
+  m_free = node->newer;
+  return node;
+}
+
+void frfcfs_node_pool::release(frfcfs_node *node) {
+  node->req = NULL;
+  node->newer = m_free;
+  m_free = node;
+}
+
+frfcfs_bank_queue::frfcfs_bank_queue()
+    : m_oldest(NULL),
+      m_newest(NULL),
+      m_size(0),
+      m_n_rows(0),
+      m_mask(0),
+      m_shift(0),
+      m_draining(false),
+      m_draining_row(0) {
+  resize_table(FRFCFS_MIN_ROW_BINS);
+}
+
+void frfcfs_bank_queue::resize_table(unsigned slots) {
+  std::vector<row_bin> old;
+  old.swap(m_bins);
+  row_bin empty = {0, NULL, NULL};
+  m_bins.assign(slots, empty);
+  m_mask = slots - 1;
+  m_shift = 32;
+  while (slots > 1) {
+    slots >>= 1;
+    m_shift--;
+  }
+  for (unsigned i = 0; i < old.size(); i++) {
+    if (old[i].oldest == NULL) continue;
+    unsigned slot = slot_of(old[i].row);
+    while (m_bins[slot].oldest != NULL) slot = (slot + 1) & m_mask;
+    m_bins[slot] = old[i];
+  }
+}
+
+int frfcfs_bank_queue::find(unsigned row) const {
+  for (unsigned slot = slot_of(row);; slot = (slot + 1) & m_mask) {
+    if (m_bins[slot].oldest == NULL) return -1;
+    if (m_bins[slot].row == row) return slot;
+  }
+}
+
+// Slot of row's bin, claiming a free one if the row has no pending requests
+unsigned frfcfs_bank_queue::insert(unsigned row) {
+  int found = find(row);
+  if (found >= 0) return found;
+  if (2 * (m_n_rows + 1) > m_bins.size()) resize_table(2 * m_bins.size());
+  unsigned slot = slot_of(row);
+  while (m_bins[slot].oldest != NULL) slot = (slot + 1) & m_mask;
+  m_bins[slot].row = row;
+  m_n_rows++;
+  return slot;
+}
+
+// Backward shift deletion, so lookups never have to skip tombstones
+void frfcfs_bank_queue::erase(unsigned slot) {
+  m_n_rows--;
+  unsigned hole = slot;
+  for (unsigned next = (hole + 1) & m_mask; m_bins[next].oldest != NULL;
+       next = (next + 1) & m_mask) {
+    unsigned home = slot_of(m_bins[next].row);
+    // Move the entry back unless its home lies cyclically in (hole, next]
+    if (((next - home) & m_mask) >= ((next - hole) & m_mask)) {
+      m_bins[hole] = m_bins[next];
+      hole = next;
+    }
+  }
+  m_bins[hole].oldest = NULL;
+  m_bins[hole].newest = NULL;
+}
+
+void frfcfs_bank_queue::push(frfcfs_node *node) {
+  node->newer = NULL;
+  node->older = m_newest;
+  if (m_newest)
+    m_newest->newer = node;
+  else
+    m_oldest = node;
+  m_newest = node;
+  m_size++;
+
+  row_bin &bin = m_bins[insert(node->row)];
+  node->row_newer = NULL;
+  node->row_older = bin.newest;
+  if (bin.newest)
+    bin.newest->row_newer = node;
+  else
+    bin.oldest = node;
+  bin.newest = node;
+}
+
+void frfcfs_bank_queue::remove(frfcfs_node *node) {
+  if (node->older)
+    node->older->newer = node->newer;
+  else
+    m_oldest = node->newer;
+  if (node->newer)
+    node->newer->older = node->older;
+  else
+    m_newest = node->older;
+  m_size--;
+
+  int slot = find(node->row);
+  assert(slot >= 0);
+  row_bin &bin = m_bins[slot];
+  if (node->row_older)
+    node->row_older->row_newer = node->row_newer;
+  else
+    bin.oldest = node->row_newer;
+  if (node->row_newer)
+    node->row_newer->row_older = node->row_older;
+  else
+    bin.newest = node->row_older;
+  if (bin.oldest == NULL) erase(slot);
+}
+
+// The list and map based FR-FCFS scheduler, kept to check the pooled one
+// against: it sees the same requests and must pick the same one every time.
+class frfcfs_reference {
+ public:
+  frfcfs_reference(const memory_config *config)
+      : m_config(config),
+        m_num_pending(0),
+        m_num_write_pending(0),
+        m_mode(READ_MODE),
+        m_queue(config->nbk),
+        m_bins(config->nbk),
+        m_last_row(config->nbk, (req_list *)NULL),
+        m_write_queue(config->nbk),
+        m_write_bins(config->nbk),
+        m_last_write_row(config->nbk, (req_list *)NULL),
+        m_prefetch_queue(config->nbk),
+        m_prefetch_bins(config->nbk) {}
+
+  void add_req(dram_req_t *req, enum frfcfs_class cls) {
+    if (cls == FRFCFS_WRITE) {
+      m_num_write_pending++;
+      m_write_queue[req->bk].push_front(req);
+      m_write_bins[req->bk][req->row].push_front(
+          m_write_queue[req->bk].begin());
+    } else if (cls == FRFCFS_LOW_PRIORITY) {
+      m_num_pending++;
+      m_prefetch_queue[req->bk].push_front(req);
+      m_prefetch_bins[req->bk][req->row].push_front(
+          m_prefetch_queue[req->bk].begin());
+    } else {
+      m_num_pending++;
+      m_queue[req->bk].push_front(req);
+      m_bins[req->bk][req->row].push_front(m_queue[req->bk].begin());
+    }
+  }
+
+  void update_mode() {
+    if (m_config->seperate_write_queue_enabled) {
+      if (m_mode == READ_MODE &&
+          m_num_write_pending >= m_config->write_high_watermark) {
+        m_mode = WRITE_MODE;
+      } else if (m_mode == WRITE_MODE &&
+                 m_num_write_pending < m_config->write_low_watermark) {
+        m_mode = READ_MODE;
+      }
+    }
+  }
+
+  enum memory_mode mode() const { return m_mode; }
+
+  dram_req_t *schedule(unsigned bank, unsigned curr_row, bool &rowhit) {
+    std::vector<std::list<dram_req_t *> > &queue =
+        m_mode == WRITE_MODE ? m_write_queue : m_queue;
+    std::vector<row_map> &bins = m_mode == WRITE_MODE ? m_write_bins : m_bins;
+    std::vector<req_list *> &last_row =
+        m_mode == WRITE_MODE ? m_last_write_row : m_last_row;
+
+    rowhit = true;
+    if (last_row[bank] == NULL) {
+      if (queue[bank].empty())
+        return m_mode == READ_MODE ? schedule_prefetch(bank, curr_row, rowhit)
+                                   : NULL;
+      row_map::iterator bin_ptr = bins[bank].find(curr_row);
+      if (bin_ptr == bins[bank].end()) {
+        bin_ptr = bins[bank].find(queue[bank].back()->row);
+        assert(bin_ptr != bins[bank].end());
+        rowhit = false;
+      }
+      last_row[bank] = &(bin_ptr->second);
+    }
+    std::list<dram_req_t *>::iterator next = last_row[bank]->back();
+    dram_req_t *req = *next;
+    last_row[bank]->pop_back();
+    queue[bank].erase(next);
+    if (last_row[bank]->empty()) {
+      bins[bank].erase(req->row);
+      last_row[bank] = NULL;
+    }
+    if (m_mode == WRITE_MODE)
+      m_num_write_pending--;
+    else
+      m_num_pending--;
+    return req;
+  }
+
+ private:
+  typedef std::list<std::list<dram_req_t *>::iterator> req_list;
+  typedef std::map<unsigned, req_list> row_map;
+
+  // Open row hit, else the oldest prefetch, one request at a time
+  dram_req_t *schedule_prefetch(unsigned bank, unsigned curr_row,
+                                bool &rowhit) {
+    if (m_prefetch_queue[bank].empty()) return NULL;
+    row_map::iterator bin_ptr = m_prefetch_bins[bank].find(curr_row);
+    if (bin_ptr == m_prefetch_bins[bank].end()) {
+      bin_ptr = m_prefetch_bins[bank].find(m_prefetch_queue[bank].back()->row);
+      assert(bin_ptr != m_prefetch_bins[bank].end());
+      rowhit = false;
+    }
+    std::list<dram_req_t *>::iterator next = bin_ptr->second.back();
+    dram_req_t *req = *next;
+    bin_ptr->second.pop_back();
+    m_prefetch_queue[bank].erase(next);
+    if (bin_ptr->second.empty()) m_prefetch_bins[bank].erase(bin_ptr);
+    m_num_pending--;
+    return req;
+  }
+
+  const memory_config *m_config;
+  unsigned m_num_pending;
+  unsigned m_num_write_pending;
+  enum memory_mode m_mode;
+  std::vector<std::list<dram_req_t *> > m_queue;
+  std::vector<row_map> m_bins;
+  std::vector<req_list *> m_last_row;
+  std::vector<std::list<dram_req_t *> > m_write_queue;
+  std::vector<row_map> m_write_bins;
+  std::vector<req_list *> m_last_write_row;
+  std::vector<std::list<dram_req_t *> > m_prefetch_queue;
+  std::vector<row_map> m_prefetch_bins;
+};
+
 frfcfs_scheduler::frfcfs_scheduler(const memory_config *config, dram_t *dm,
                                    memory_stats_t *stats) {
   m_config = config;
@@ -39,51 +299,102 @@ frfcfs_scheduler::frfcfs_scheduler(const memory_config *config, dram_t *dm,
   m_num_pending = 0;
   m_num_write_pending = 0;
   m_dram = dm;
-  m_queue = new std::list<dram_req_t *>[m_config->nbk];
-  m_bins = new std::map<
-      unsigned, std::list<std::list<dram_req_t *>::iterator> >[m_config->nbk];
-  m_last_row =
-      new std::list<std::list<dram_req_t *>::iterator> *[m_config->nbk];
+  m_queue.resize(m_config->nbk);
+  if (m_config->seperate_write_queue_enabled)
+    m_write_queue.resize(m_config->nbk);
+  if (m_config->l2_treelet_prefetch &&
+      m_config->l2_treelet_prefetch_dram_low_priority)
+    m_prefetch_queue.resize(m_config->nbk);
   curr_row_service_time = new unsigned[m_config->nbk];
   row_service_timestamp = new unsigned[m_config->nbk];
   for (unsigned i = 0; i < m_config->nbk; i++) {
-    m_queue[i].clear();
-    m_bins[i].clear();
-    m_last_row[i] = NULL;
     curr_row_service_time[i] = 0;
     row_service_timestamp[i] = 0;
   }
-  if (m_config->seperate_write_queue_enabled) {
-    m_write_queue = new std::list<dram_req_t *>[m_config->nbk];
-    m_write_bins = new std::map<
-        unsigned, std::list<std::list<dram_req_t *>::iterator> >[m_config->nbk];
-    m_last_write_row =
-        new std::list<std::list<dram_req_t *>::iterator> *[m_config->nbk];
-
-    for (unsigned i = 0; i < m_config->nbk; i++) {
-      m_write_queue[i].clear();
-      m_write_bins[i].clear();
-      m_last_write_row[i] = NULL;
+  m_mode = READ_MODE;
+  m_reference =
+      m_config->gpgpu_dram_sched_check ? new frfcfs_reference(config) : NULL;
+
+  m_trace = NULL;
+  m_trace_next_id = 0;
+  if (m_config->gpgpu_dram_sched_trace && m_config->gpgpu_dram_sched_trace[0]) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%s.%u", m_config->gpgpu_dram_sched_trace,
+             dram_id());
+    m_trace = fopen(path, "w");
+    if (m_trace == NULL) {
+      printf("GPGPU-Sim uArch: cannot open DRAM scheduler trace %s\n", path);
+      abort();
     }
+    fprintf(m_trace, "frfcfs %u %u %u %u %u %u\n", m_config->nbk,
+            m_config->seperate_write_queue_enabled ? 1 : 0,
+            m_config->write_high_watermark, m_config->write_low_watermark,
+            m_config->gpgpu_frfcfs_dram_sched_queue_size,
+            m_config->gpgpu_frfcfs_dram_write_queue_size);
   }
-  m_mode = READ_MODE;
 }
 
-void frfcfs_scheduler::add_req(dram_req_t *req) {
-  if (m_config->seperate_write_queue_enabled && req->data->is_write()) {
+frfcfs_scheduler::~frfcfs_scheduler() {
+  delete[] curr_row_service_time;
+  delete[] row_service_timestamp;
+  delete m_reference;
+  if (m_trace) fclose(m_trace);
+}
+
+unsigned frfcfs_scheduler::dram_id() const { return m_dram ? m_dram->id : 0; }
+
+enum frfcfs_class frfcfs_scheduler::classify(const dram_req_t *req) const {
+  if (m_config->seperate_write_queue_enabled && req->data->get_is_write())
+    return FRFCFS_WRITE;
+  // L2 treelet prefetches are only served to a bank with no demand read
+  // pending (-l2_treelet_prefetch_dram_low_priority)
+  if (m_config->l2_treelet_prefetch &&
+      m_config->l2_treelet_prefetch_dram_low_priority &&
+      req->data->get_access_type() == L2_PREFETCH_R)
+    return FRFCFS_LOW_PRIORITY;
+  return FRFCFS_DEMAND;
+}
+
+void frfcfs_scheduler::add_req(dram_req_t *req, enum frfcfs_class cls) {
+  frfcfs_node *node = m_pool.alloc();
+  node->req = req;
+  node->row = req->row;
+  node->cls = cls;
+  if (cls == FRFCFS_WRITE) {
     assert(m_num_write_pending < m_config->gpgpu_frfcfs_dram_write_queue_size);
     m_num_write_pending++;
-    m_write_queue[req->bk].push_front(req);
-    std::list<dram_req_t *>::iterator ptr = m_write_queue[req->bk].begin();
-    m_write_bins[req->bk][req->row].push_front(ptr);  // newest reqs to the
-                                                      // front
+    m_write_queue[req->bk].push(node);
   } else {
     assert(m_num_pending < m_config->gpgpu_frfcfs_dram_sched_queue_size);
     m_num_pending++;
-    m_queue[req->bk].push_front(req);
-    std::list<dram_req_t *>::iterator ptr = m_queue[req->bk].begin();
-    m_bins[req->bk][req->row].push_front(ptr);  // newest reqs to the front
+    if (cls == FRFCFS_LOW_PRIORITY)
+      m_prefetch_queue[req->bk].push(node);
+    else
+      m_queue[req->bk].push(node);
   }
+  if (m_reference) m_reference->add_req(req, cls);
+  if (m_trace) trace_add(req, cls);
+}
+
+// "a <bank> <row> <class>" per request, ids implied by the order
+void frfcfs_scheduler::trace_add(const dram_req_t *req,
+                                 enum frfcfs_class cls) {
+  m_trace_ids[req] = m_trace_next_id++;
+  fprintf(m_trace, "a %u %u %u\n", req->bk, req->row, (unsigned)cls);
+}
+
+// "s <bank> <open row> <picked id or -1> <row hit>" per schedule() call
+void frfcfs_scheduler::trace_pick(unsigned bank, unsigned curr_row,
+                                  const dram_req_t *req, bool rowhit) {
+  long long id = -1;
+  if (req) {
+    std::map<const dram_req_t *, unsigned long long>::iterator i =
+        m_trace_ids.find(req);
+    assert(i != m_trace_ids.end());
+    id = i->second;
+    m_trace_ids.erase(i);
+  }
+  fprintf(m_trace, "s %u %u %lld %u\n", bank, curr_row, id, rowhit ? 1 : 0);
 }
 
 void frfcfs_scheduler::data_collection(unsigned int bank) {
@@ -106,55 +417,136 @@ void frfcfs_scheduler::data_collection(unsigned int bank) {
   m_stats->num_activates[m_dram->id][bank]++;
 }
 
-dram_req_t *frfcfs_scheduler::schedule(unsigned bank, unsigned curr_row) {
-  // row
-  bool rowhit = true;
-  std::list<dram_req_t *> *m_current_queue = m_queue;
-  std::map<unsigned, std::list<std::list<dram_req_t *>::iterator> >
-      *m_current_bins = m_bins;
-  std::list<std::list<dram_req_t *>::iterator> **m_current_last_row =
-      m_last_row;
-
+// Switch between draining reads and writes
+enum memory_mode frfcfs_scheduler::next_mode(enum memory_mode mode) const {
   if (m_config->seperate_write_queue_enabled) {
-    if (m_mode == READ_MODE &&
+    if (mode == READ_MODE &&
         ((m_num_write_pending >= m_config->write_high_watermark)
          // || (m_queue[bank].empty() && !m_write_queue[bank].empty())
          )) {
-      m_mode = WRITE_MODE;
-    } else if (m_mode == WRITE_MODE &&
+      return WRITE_MODE;
+    } else if (mode == WRITE_MODE &&
                ((m_num_write_pending < m_config->write_low_watermark)
                 //  || (!m_queue[bank].empty() && m_write_queue[bank].empty())
                 )) {
-      m_mode = READ_MODE;
+      return READ_MODE;
     }
   }
+  return mode;
+}
+
+void frfcfs_scheduler::update_mode() {
+  m_mode = next_mode(m_mode);
+  if (m_reference) m_reference->update_mode();
+}
+
+// With nothing scheduled the pending counts stay put, so the mode settles
+// or flips back and forth after the first call
+enum memory_mode frfcfs_scheduler::mode_after(unsigned long long calls) const {
+  if (calls == 0) return m_mode;
+  enum memory_mode once = next_mode(m_mode);
+  return (calls & 1) ? once : next_mode(once);
+}
+
+bool frfcfs_scheduler::has_request(unsigned bank, enum memory_mode mode) const {
+  const frfcfs_bank_queue &queue =
+      mode == WRITE_MODE ? m_write_queue[bank] : m_queue[bank];
+  if (!queue.empty() || queue.draining()) return true;
+  return mode == READ_MODE && !m_prefetch_queue.empty() &&
+         !m_prefetch_queue[bank].empty();
+}
 
-  if (m_mode == WRITE_MODE) {
-    m_current_queue = m_write_queue;
-    m_current_bins = m_write_bins;
-    m_current_last_row = m_last_write_row;
+// Oldest low priority request to the open row, else the oldest one. They
+// are not drained row by row: a demand read arriving meanwhile goes first.
+frfcfs_node *frfcfs_scheduler::pick_low_priority(unsigned bank,
+                                                 unsigned curr_row,
+                                                 bool &rowhit) {
+  if (m_prefetch_queue.empty() || m_prefetch_queue[bank].empty()) return NULL;
+  frfcfs_bank_queue &queue = m_prefetch_queue[bank];
+  frfcfs_node *node = queue.oldest_in_row(curr_row);
+  if (node == NULL) {
+    node = queue.oldest();
+    rowhit = false;
   }
+  return node;
+}
 
-  if (m_current_last_row[bank] == NULL) {
-    if (m_current_queue[bank].empty()) return NULL;
-
-    std::map<unsigned, std::list<std::list<dram_req_t *>::iterator> >::iterator
-        bin_ptr = m_current_bins[bank].find(curr_row);
-    if (bin_ptr == m_current_bins[bank].end()) {
-      dram_req_t *req = m_current_queue[bank].back();
-      bin_ptr = m_current_bins[bank].find(req->row);
-      assert(bin_ptr !=
-             m_current_bins[bank].end());  // where did the request go???
-      m_current_last_row[bank] = &(bin_ptr->second);
-      data_collection(bank);
-      rowhit = false;
+dram_req_t *frfcfs_scheduler::pop(unsigned bank, unsigned curr_row,
+                                  bool &rowhit) {
+  rowhit = true;
+
+  update_mode();
+
+  frfcfs_bank_queue &queue =
+      m_mode == WRITE_MODE ? m_write_queue[bank] : m_queue[bank];
+
+  bool ref_rowhit = false;
+  dram_req_t *ref_req =
+      m_reference ? m_reference->schedule(bank, curr_row, ref_rowhit) : NULL;
+
+  frfcfs_bank_queue *from = &queue;
+  frfcfs_node *node;
+  if (queue.draining()) {
+    node = queue.oldest_in_row(queue.draining_row());
+    assert(node != NULL);  // the row is dropped once its last request is
+                           // served
+  } else {
+    if (queue.empty()) {
+      node = m_mode == READ_MODE ? pick_low_priority(bank, curr_row, rowhit)
+                                 : NULL;
+      if (node == NULL) {
+        if (m_reference &&
+            (ref_req != NULL || m_reference->mode() != m_mode)) {
+          printf("GPGPU-Sim uArch: DRAM(%u) bank %u: FR-FCFS scheduler found "
+                 "no request, reference picked one\n",
+                 dram_id(), bank);
+          abort();
+        }
+        return NULL;
+      }
+      from = &m_prefetch_queue[bank];
     } else {
-      m_current_last_row[bank] = &(bin_ptr->second);
-      rowhit = true;
+      // Oldest request to the open row first, else the oldest request overall
+      node = queue.oldest_in_row(curr_row);
+      if (node == NULL) {
+        node = queue.oldest();
+        rowhit = false;
+      }
+      queue.drain(node->row);
     }
   }
-  std::list<dram_req_t *>::iterator next = m_current_last_row[bank]->back();
-  dram_req_t *req = (*next);
+  dram_req_t *req = node->req;
+
+  if (m_reference && (req != ref_req || rowhit != ref_rowhit ||
+                      m_reference->mode() != m_mode)) {
+    printf("GPGPU-Sim uArch: DRAM(%u) bank %u: FR-FCFS scheduler picked "
+           "row %u (%s, %s mode), reference picked row %u (%s, %s mode)\n",
+           dram_id(), bank, req->row, rowhit ? "hit" : "miss",
+           m_mode == WRITE_MODE ? "write" : "read",
+           ref_req ? ref_req->row : 0, ref_rowhit ? "hit" : "miss",
+           m_reference->mode() == WRITE_MODE ? "write" : "read");
+    abort();
+  }
+
+  from->remove(node);
+  if (from->oldest_in_row(node->row) == NULL) from->stop_draining();
+  if (node->cls == FRFCFS_WRITE) {
+    assert(m_num_write_pending != 0);
+    m_num_write_pending--;
+  } else {
+    assert(m_num_pending != 0);
+    m_num_pending--;
+  }
+  m_pool.release(node);
+  return req;
+}
+
+dram_req_t *frfcfs_scheduler::schedule(unsigned bank, unsigned curr_row) {
+  bool rowhit;
+  dram_req_t *req = pop(bank, curr_row, rowhit);
+  if (m_trace) trace_pick(bank, curr_row, req, rowhit);
+  if (req == NULL) return NULL;
+  if (!rowhit) data_collection(bank);
 
   // rowblp stats
   m_dram->access_num++;
@@ -174,33 +566,20 @@ dram_req_t *frfcfs_scheduler::schedule(unsigned bank, unsigned curr_row) {
 
   m_stats->concurrent_row_access[m_dram->id][bank]++;
   m_stats->row_access[m_dram->id][bank]++;
-  m_current_last_row[bank]->pop_back();
-
-  m_current_queue[bank].erase(next);
-  if (m_current_last_row[bank]->empty()) {
-    m_current_bins[bank].erase(req->row);
-    m_current_last_row[bank] = NULL;
-  }
 #ifdef DEBUG_FAST_IDEAL_SCHED
-  if (req)
-    printf("%08u : DRAM(%u) scheduling memory request to bank=%u, row=%u\n",
-           (unsigned)gpu_sim_cycle, m_dram->id, req->bk, req->row);
+  printf("%08u : DRAM(%u) scheduling memory request to bank=%u, row=%u\n",
+         (unsigned)gpu_sim_cycle, m_dram->id, req->bk, req->row);
 #endif
 
-  if (m_config->seperate_write_queue_enabled && req->data->is_write()) {
-    assert(req != NULL && m_num_write_pending != 0);
-    m_num_write_pending--;
-  } else {
-    assert(req != NULL && m_num_pending != 0);
-    m_num_pending--;
-  }
-
   return req;
 }
 
 void frfcfs_scheduler::print(FILE *fp) {
   for (unsigned b = 0; b < m_config->nbk; b++) {
-    printf(" %u: queue length = %u\n", b, (unsigned)m_queue[b].size());
+    fprintf(fp, " %u: queue length = %u", b, m_queue[b].size());
+    if (!m_prefetch_queue.empty())
+      fprintf(fp, ", low priority = %u", m_prefetch_queue[b].size());
+    fprintf(fp, "\n");
   }
 }
 
@@ -256,3 +635,149 @@ void dram_t::scheduler_frfcfs() {
     }
   }
 }
+
+#ifdef UNIT_TEST
+
+#include <set>
+
+// Replay driver. Feeds request streams recorded with -gpgpu_dram_sched_trace
+// to the pooled scheduler with the list based reference attached, which
+// aborts on any difference between the two, and also compares every pick
+// with the one the simulator recorded. Without a trace it runs a random
+// stream mixing row hits, writes and low priority requests.
+
+static memory_config *replay_config(unsigned nbk, bool write_queue,
+                                    unsigned high, unsigned low,
+                                    unsigned queue_size,
+                                    unsigned write_queue_size) {
+  memory_config *config = new memory_config(NULL);
+  config->nbk = nbk;
+  config->seperate_write_queue_enabled = write_queue;
+  config->write_high_watermark = high;
+  config->write_low_watermark = low;
+  config->gpgpu_frfcfs_dram_sched_queue_size = queue_size;
+  config->gpgpu_frfcfs_dram_write_queue_size = write_queue_size;
+  config->l2_treelet_prefetch = true;
+  config->l2_treelet_prefetch_dram_low_priority = true;
+  config->gpgpu_dram_sched_check = true;
+  config->gpgpu_dram_sched_trace = NULL;
+  return config;
+}
+
+// Returns the number of picks that differ from the recorded ones
+static unsigned replay_trace(FILE *fp, const char *name) {
+  unsigned nbk, write_queue, high, low, queue_size, write_queue_size;
+  if (fscanf(fp, "frfcfs %u %u %u %u %u %u", &nbk, &write_queue, &high, &low,
+             &queue_size, &write_queue_size) != 6) {
+    printf("%s: not an FR-FCFS scheduler trace\n", name);
+    return 1;
+  }
+  memory_config *config = replay_config(nbk, write_queue, high, low,
+                                        queue_size, write_queue_size);
+  frfcfs_scheduler *sched = new frfcfs_scheduler(config, NULL, NULL);
+
+  std::vector<dram_req_t *> reqs;
+  unsigned long long picks = 0;
+  unsigned mismatches = 0;
+  char op;
+  while (fscanf(fp, " %c", &op) == 1) {
+    if (op == 'a') {
+      unsigned bank, row, cls;
+      if (fscanf(fp, "%u %u %u", &bank, &row, &cls) != 3) break;
+      dram_req_t *req = new dram_req_t(bank, row);
+      req->addr = reqs.size();
+      reqs.push_back(req);
+      sched->add_req(req, (enum frfcfs_class)cls);
+    } else if (op == 's') {
+      unsigned bank, row, hit;
+      long long id;
+      if (fscanf(fp, "%u %u %lld %u", &bank, &row, &id, &hit) != 4) break;
+      bool rowhit;
+      dram_req_t *req = sched->pop(bank, row, rowhit);
+      long long picked = req ? (long long)req->addr : -1;
+      if (picked != id || (req && rowhit != (hit != 0))) {
+        if (mismatches < 10)
+          printf("%s: pick %llu on bank %u: recorded %lld (%s), replayed "
+                 "%lld (%s)\n",
+                 name, picks, bank, id, hit ? "hit" : "miss", picked,
+                 rowhit ? "hit" : "miss");
+        mismatches++;
+      }
+      picks++;
+    } else {
+      printf("%s: unknown record '%c'\n", name, op);
+      mismatches++;
+      break;
+    }
+  }
+  printf("%s: %zu requests, %llu picks, %u differ from the recording\n", name,
+         reqs.size(), picks, mismatches);
+
+  delete sched;
+  delete config;
+  for (unsigned i = 0; i < reqs.size(); i++) delete reqs[i];
+  return mismatches;
+}
+
+// Random requests over a few rows per bank, scheduled the way dram_t does:
+// a bank picks whenever it is free and keeps the row it last served open
+static void replay_random(unsigned seed, bool write_queue) {
+  const unsigned nbk = 16, steps = 200000;
+  memory_config *config = replay_config(nbk, write_queue, 24, 12, 64, 32);
+  frfcfs_scheduler *sched = new frfcfs_scheduler(config, NULL, NULL);
+
+  std::vector<unsigned> open_row(nbk, 0);
+  std::set<dram_req_t *> pending;
+  unsigned long long added = 0, served = 0, hits = 0;
+  srand(seed);
+  for (unsigned step = 0; step < steps; step++) {
+    for (unsigned n = rand() % 3; n > 0; n--) {
+      enum frfcfs_class cls = (enum frfcfs_class)(rand() % 3);
+      if (cls == FRFCFS_WRITE && !write_queue) cls = FRFCFS_DEMAND;
+      if (cls == FRFCFS_WRITE ? sched->num_write_pending() >= 32
+                              : sched->num_pending() >= 64)
+        continue;
+      dram_req_t *req = new dram_req_t(rand() % nbk, rand() % 6);
+      pending.insert(req);
+      sched->add_req(req, cls);
+      added++;
+    }
+    unsigned bank = rand() % nbk;
+    bool rowhit;
+    dram_req_t *req = sched->pop(bank, open_row[bank], rowhit);
+    if (req) {
+      open_row[bank] = req->row;
+      served++;
+      if (rowhit) hits++;
+      pending.erase(req);
+      delete req;
+    }
+  }
+  printf("random stream %u (%s write queue): %llu requests, %llu served, "
+         "%llu row hits, no difference from the reference\n",
+         seed, write_queue ? "separate" : "no", added, served, hits);
+
+  delete sched;
+  delete config;
+  for (dram_req_t *req : pending) delete req;
+}
+
+int main(int argc, char *argv[]) {
+  unsigned mismatches = 0;
+  if (argc < 2) {
+    for (unsigned seed = 1; seed <= 4; seed++)
+      replay_random(seed, seed % 2 == 0);
+  }
+  for (int i = 1; i < argc; i++) {
+    FILE *fp = fopen(argv[i], "r");
+    if (fp == NULL) {
+      printf("Cannot open %s\n", argv[i]);
+      return 1;
+    }
+    mismatches += replay_trace(fp, argv[i]);
+    fclose(fp);
+  }
+  return mismatches ? 1 : 0;
+}
+
+#endif
@@ -31,6 +31,7 @@
 
 #include <list>
 #include <map>
+#include <vector>
 #include "dram.h"
 #include "gpu-misc.h"
 #include "gpu-sim.h"
@@ -38,36 +39,157 @@
 
 enum memory_mode { READ_MODE = 0, WRITE_MODE };
 
+// Queue a request waits in
+enum frfcfs_class {
+  FRFCFS_DEMAND = 0,    // reads, and writes without a separate write queue
+  FRFCFS_WRITE,         // -dram_seperate_write_queue_enable
+  FRFCFS_LOW_PRIORITY,  // -l2_treelet_prefetch_dram_low_priority
+  NUM_FRFCFS_CLASSES
+};
+
+// A request waiting in the FR-FCFS scheduler. Nodes come from the scheduler's
+// pool and are linked in place into their bank's age list and their row's bin.
+struct frfcfs_node {
+  dram_req_t *req;
+  unsigned row;
+  enum frfcfs_class cls;
+  frfcfs_node *older, *newer;          // bank queue, oldest first
+  frfcfs_node *row_older, *row_newer;  // row bin, oldest first
+};
+
+// Fixed size frfcfs_node blocks carved out of chunks and recycled through a
+// free list. A scheduler is only ever stepped by one thread at a time.
+class frfcfs_node_pool {
+ public:
+  frfcfs_node_pool() : m_free(NULL) {}
+  ~frfcfs_node_pool();
+
+  frfcfs_node *alloc();
+  void release(frfcfs_node *node);
+
+ private:
+  void grow();
+
+  frfcfs_node *m_free;  // linked through 'newer'
+  std::vector<frfcfs_node *> m_chunks;
+};
+
+// Pending requests of one bank in one mode. The age list gives the oldest
+// request for a row miss, and per row bins, found through an open addressing
+// table keyed by row, give the oldest request to the open row, both in
+// constant (expected) time and without allocating once the table has grown.
+class frfcfs_bank_queue {
+ public:
+  frfcfs_bank_queue();
+
+  bool empty() const { return m_oldest == NULL; }
+  unsigned size() const { return m_size; }
+  frfcfs_node *oldest() const { return m_oldest; }
+  // Oldest pending request to row, NULL if there is none
+  frfcfs_node *oldest_in_row(unsigned row) const {
+    int slot = find(row);
+    return slot < 0 ? NULL : m_bins[slot].oldest;
+  }
+
+  void push(frfcfs_node *node);  // as the newest request
+  void remove(frfcfs_node *node);
+
+  // Row the scheduler keeps serving until none of its requests are left
+  bool draining() const { return m_draining; }
+  unsigned draining_row() const { return m_draining_row; }
+  void drain(unsigned row) {
+    m_draining = true;
+    m_draining_row = row;
+  }
+  void stop_draining() { m_draining = false; }
+
+ private:
+  struct row_bin {
+    unsigned row;
+    frfcfs_node *oldest;  // NULL for a free slot
+    frfcfs_node *newest;
+  };
+
+  unsigned slot_of(unsigned row) const {
+    return (unsigned)((row * 2654435769u) >> m_shift) & m_mask;
+  }
+  int find(unsigned row) const;
+  unsigned insert(unsigned row);
+  void erase(unsigned slot);
+  void resize_table(unsigned slots);
+
+  frfcfs_node *m_oldest;
+  frfcfs_node *m_newest;
+  unsigned m_size;
+
+  std::vector<row_bin> m_bins;
+  unsigned m_n_rows;  // bins in use
+  unsigned m_mask;
+  unsigned m_shift;
+
+  bool m_draining;
+  unsigned m_draining_row;
+};
+
 class frfcfs_scheduler {
  public:
   frfcfs_scheduler(const memory_config *config, dram_t *dm,
                    memory_stats_t *stats);
-  void add_req(dram_req_t *req);
+  ~frfcfs_scheduler();
+  enum frfcfs_class classify(const dram_req_t *req) const;
+  void add_req(dram_req_t *req) { add_req(req, classify(req)); }
+  void add_req(dram_req_t *req, enum frfcfs_class cls);
   void data_collection(unsigned bank);
   dram_req_t *schedule(unsigned bank, unsigned curr_row);
+  // The pick of schedule() without the DRAM stats: the next request for
+  // bank, taken out of the scheduler. Replays call it without a dram_t.
+  dram_req_t *pop(unsigned bank, unsigned curr_row, bool &rowhit);
+  void update_mode();
+  // The mode the next 'calls' update_mode() calls leave the scheduler in
+  enum memory_mode mode_after(unsigned long long calls) const;
+  // True if schedule(bank, ...) in mode would find a request
+  bool has_request(unsigned bank, enum memory_mode mode) const;
+  // -gpgpu_dram_sched_check or -gpgpu_dram_sched_trace see every call
+  bool recording() const { return m_reference || m_trace; }
   void print(FILE *fp);
   unsigned num_pending() const { return m_num_pending; }
   unsigned num_write_pending() const { return m_num_write_pending; }
 
  private:
+  frfcfs_node *pick_low_priority(unsigned bank, unsigned curr_row,
+                                 bool &rowhit);
+  enum memory_mode next_mode(enum memory_mode mode) const;
+  unsigned dram_id() const;
+  void trace_add(const dram_req_t *req, enum frfcfs_class cls);
+  void trace_pick(unsigned bank, unsigned curr_row, const dram_req_t *req,
+                  bool rowhit);
+
   const memory_config *m_config;
   dram_t *m_dram;
   unsigned m_num_pending;
   unsigned m_num_write_pending;
-  std::list<dram_req_t *> *m_queue;
-  std::map<unsigned, std::list<std::list<dram_req_t *>::iterator> > *m_bins;
-  std::list<std::list<dram_req_t *>::iterator> **m_last_row;
+  std::vector<frfcfs_bank_queue> m_queue;
+  std::vector<frfcfs_bank_queue> m_write_queue;
+  // Low priority reads, only served to a bank with no demand read pending.
+  // They are counted in m_num_pending.
+  std::vector<frfcfs_bank_queue> m_prefetch_queue;
+  frfcfs_node_pool m_pool;
   unsigned *curr_row_service_time;  // one set of variables for each bank.
   unsigned *row_service_timestamp;  // tracks when scheduler began servicing
                                     // current row
 
-  std::list<dram_req_t *> *m_write_queue;
-  std::map<unsigned, std::list<std::list<dram_req_t *>::iterator> >
-      *m_write_bins;
-  std::list<std::list<dram_req_t *>::iterator> **m_last_write_row;
-
   enum memory_mode m_mode;
   memory_stats_t *m_stats;
+
+  // The list and map based scheduler this one replaced, fed the same
+  // requests and checked against every pick (-gpgpu_dram_sched_check)
+  class frfcfs_reference *m_reference;
+
+  // -gpgpu_dram_sched_trace: every request and pick, for the replay driver
+  // at the end of dram_sched.cc
+  FILE *m_trace;
+  unsigned long long m_trace_next_id;
+  std::map<const dram_req_t *, unsigned long long> m_trace_ids;
 };
 
 #endif
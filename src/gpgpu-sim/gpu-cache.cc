@@ -34,6 +34,15 @@
 #include "stat-tool.h"
 #include "../../libcuda/gpgpu_context.h"
 
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define TAG_MATCH_X86 1
+#include <immintrin.h>
+#else
+#define TAG_MATCH_X86 0
+#endif
+
 // used to allocate memory that is large enough to adapt the changes in cache
 // size across kernels
 
@@ -167,6 +176,62 @@ unsigned l2_cache_config::set_index(new_addr_type addr) const {
   return cache_config::set_index(part_addr);
 }
 
+// Bit w of the result is set if tags[w] == tag, for up to 64 ways
+static unsigned long long match_tags_scalar(const new_addr_type *tags,
+                                            unsigned ways, new_addr_type tag) {
+  unsigned long long matches = 0;
+  for (unsigned w = 0; w < ways; w++)
+    matches |= (unsigned long long)(tags[w] == tag) << w;
+  return matches;
+}
+
+#if TAG_MATCH_X86
+__attribute__((target("sse4.1")))
+static unsigned long long match_tags_sse(const new_addr_type *tags,
+                                         unsigned ways, new_addr_type tag) {
+  const __m128i key = _mm_set1_epi64x(tag);
+  unsigned long long matches = 0;
+  unsigned w = 0;
+  for (; w + 2 <= ways; w += 2) {
+    __m128i eq = _mm_cmpeq_epi64(
+        _mm_loadu_si128((const __m128i *)(tags + w)), key);
+    matches |= (unsigned long long)_mm_movemask_pd(_mm_castsi128_pd(eq)) << w;
+  }
+  if (w < ways) matches |= match_tags_scalar(tags + w, ways - w, tag) << w;
+  return matches;
+}
+
+__attribute__((target("avx2")))
+static unsigned long long match_tags_avx2(const new_addr_type *tags,
+                                          unsigned ways, new_addr_type tag) {
+  const __m256i key = _mm256_set1_epi64x(tag);
+  unsigned long long matches = 0;
+  unsigned w = 0;
+  for (; w + 4 <= ways; w += 4) {
+    __m256i eq = _mm256_cmpeq_epi64(
+        _mm256_loadu_si256((const __m256i *)(tags + w)), key);
+    matches |= (unsigned long long)_mm256_movemask_pd(_mm256_castsi256_pd(eq))
+               << w;
+  }
+  if (w < ways) matches |= match_tags_sse(tags + w, ways - w, tag) << w;
+  return matches;
+}
+#endif
+
+typedef unsigned long long (*match_tags_fn)(const new_addr_type *, unsigned,
+                                            new_addr_type);
+
+static match_tags_fn select_match_tags() {
+#if TAG_MATCH_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) return match_tags_avx2;
+  if (__builtin_cpu_supports("sse4.1")) return match_tags_sse;
+#endif
+  return match_tags_scalar;
+}
+
+static const match_tags_fn s_match_tags = select_match_tags();
+
 tag_array::~tag_array() {
   unsigned cache_lines_num = m_config.get_max_num_lines();
   for (unsigned i = 0; i < cache_lines_num; ++i) delete m_lines[i];
@@ -214,6 +279,11 @@ void tag_array::init(int core_id, int type_id) {
   m_type_id = type_id;
   is_used = false;
   m_dirty = 0;
+
+  unsigned cache_lines_num = m_config.get_max_num_lines();
+  m_state.resize(cache_lines_num);
+  for (unsigned i = 0; i < cache_lines_num; ++i)
+    m_lines[i]->bind_state(&m_state, i);
 }
 
 void tag_array::add_pending_line(mem_fetch *mf) {
@@ -249,6 +319,34 @@ enum cache_request_status tag_array::probe(new_addr_type addr, unsigned &idx,
   unsigned set_index = m_config.set_index(addr);
   new_addr_type tag = m_config.tag(addr);
 
+  if (m_config.m_tag_store == LINE_TAG_STORE)
+    return probe_lines(set_index, tag, idx, mask, is_write);
+
+  unsigned line_idx = idx;
+  enum cache_request_status status =
+      probe_state(set_index, tag, idx, mask, is_write);
+  if (m_config.m_tag_store == CHECKED_TAG_STORE) {
+    enum cache_request_status line_status =
+        probe_lines(set_index, tag, line_idx, mask, is_write);
+    if (line_status != status ||
+        (status != RESERVATION_FAIL && line_idx != idx)) {
+      fprintf(stderr,
+              "GPGPU-Sim uArch: tag array probe mismatch (core %d, type %d, "
+              "set %u, tag 0x%llx): lines %s idx %u, tag arrays %s idx %u\n",
+              m_core_id, m_type_id, set_index, tag,
+              cache_request_status_str(line_status), line_idx,
+              cache_request_status_str(status), idx);
+      abort();
+    }
+  }
+  return status;
+}
+
+enum cache_request_status tag_array::probe_lines(unsigned set_index,
+                                                 new_addr_type tag,
+                                                 unsigned &idx,
+                                                 mem_access_sector_mask_t mask,
+                                                 bool is_write) const {
   unsigned invalid_line = (unsigned)-1;
   unsigned valid_line = (unsigned)-1;
   unsigned long long valid_timestamp = (unsigned)-1;
@@ -329,6 +427,85 @@ enum cache_request_status tag_array::probe(new_addr_type addr, unsigned &idx,
   return MISS;
 }
 
+// probe_lines over m_state: the tags of a set are compared all at once and
+// only the status words of matching ways are decoded
+enum cache_request_status tag_array::probe_state(unsigned set_index,
+                                                 new_addr_type tag,
+                                                 unsigned &idx,
+                                                 mem_access_sector_mask_t mask,
+                                                 bool is_write) const {
+  unsigned assoc = m_config.m_assoc;
+  unsigned first = set_index * assoc;
+  unsigned sector = tag_array_state::sector_index(mask);
+
+  // check for hit or pending hit, in way order
+  for (unsigned base = 0; base < assoc; base += 64) {
+    unsigned ways = std::min(assoc - base, 64u);
+    unsigned long long matches =
+        s_match_tags(&m_state.tag[first + base], ways, tag);
+    for (; matches; matches &= matches - 1) {
+      unsigned index = first + base + __builtin_ctzll(matches);
+      unsigned bits = m_state.status[index];
+      switch (tag_array_state::sector_status(bits, sector)) {
+        case RESERVED:
+          idx = index;
+          return HIT_RESERVED;
+        case VALID:
+          idx = index;
+          return HIT;
+        case MODIFIED:
+          idx = index;
+          return is_write || tag_array_state::sector_readable(bits, sector)
+                     ? HIT
+                     : SECTOR_MISS;
+        case INVALID:
+          if (!tag_array_state::is_invalid_line(bits)) {
+            idx = index;
+            return SECTOR_MISS;
+          }
+          break;
+      }
+    }
+  }
+
+  // Replacement candidate, as in probe_lines
+  unsigned invalid_line = (unsigned)-1;
+  unsigned valid_line = (unsigned)-1;
+  unsigned long long valid_timestamp = (unsigned)-1;
+  bool all_reserved = true;
+  float dirty_line_percentage =
+      ((float)m_dirty / (m_config.m_nset * m_config.m_assoc)) * 100;
+  bool evict_modified = dirty_line_percentage >= m_config.m_wr_percent;
+  const std::vector<unsigned long long> &timestamps =
+      m_config.m_replacement_policy == LRU ? m_state.last_access_time
+                                           : m_state.alloc_time;
+  for (unsigned index = first; index < first + assoc; index++) {
+    unsigned bits = m_state.status[index];
+    if (tag_array_state::is_reserved_line(bits)) continue;
+    if (tag_array_state::is_modified_line(bits) && !evict_modified) continue;
+    all_reserved = false;
+    if (tag_array_state::is_invalid_line(bits)) {
+      invalid_line = index;
+    } else if (timestamps[index] < valid_timestamp) {
+      valid_timestamp = timestamps[index];
+      valid_line = index;
+    }
+  }
+  if (all_reserved) {
+    assert(m_config.m_alloc_policy == ON_MISS);
+    return RESERVATION_FAIL;
+  }
+
+  if (invalid_line != (unsigned)-1) {
+    idx = invalid_line;
+  } else if (valid_line != (unsigned)-1) {
+    idx = valid_line;
+  } else
+    abort();
+
+  return MISS;
+}
+
 enum cache_request_status tag_array::access(new_addr_type addr, unsigned time,
                                             unsigned &idx, mem_fetch *mf) {
   bool wb = false;
@@ -412,35 +589,12 @@ void tag_array::fill(new_addr_type addr, unsigned time,
   // assert(status==MISS||status==SECTOR_MISS); // MSHR should have prevented
   // redundant memory request
   if (status == MISS) {
-    if (m_lines[idx]->get_line_fill_source() == PREFETCH && m_core_id >= 0 && m_type_id == 0) { // m_core_id >= 0 means its L1 cache, m_type_id == 0 for data cache
-      // This part evicts the prefetch cache block
-      // Find the most recent prefetch request that filled this cache block
-      std::map<new_addr_type, std::vector<prefetch_block_info>>&prefetch_request_tracker = GPGPU_Context()->the_gpgpusim->g_the_gpu->get_m_cluster()[m_core_id]->get_m_core()[0]->get_m_rt_unit()->prefetch_request_tracker;
-      // new_addr_type prefetch_addr = mf->get_uncoalesced_addr();
-      // new_addr_type mshr_addr = m_config.mshr_addr(prefetch_addr);
-      // unsigned most_recent_fill_time = 0;
-      // assert(prefetch_request_tracker.count(mshr_addr));
-      // if (prefetch_request_tracker.count(mshr_addr)) {
-      //   for (auto &prefetch_info : prefetch_request_tracker[mshr_addr]) {
-      //     if (m_lines[idx]->get_sector_fill_mf_request_uid(mask) == prefetch_info.mf_request_uid) { // TODO: record the mf that fills the cacheline in the cache_block for ease of checking the entry
-      //       assert(prefetch_info.fill_index == idx);
-      //       assert(m_config.block_addr(prefetch_info.m_prefetch_request_addr) == m_lines[idx]->m_block_addr);
-      //       prefetch_info.evict_time = GPGPU_Context()->the_gpgpusim->g_the_gpu->gpu_sim_cycle + GPGPU_Context()->the_gpgpusim->g_the_gpu->gpu_tot_sim_cycle;
-      //     }
-      //   }
-      // }
-
-      // std::vector<prefetch_block_info> &prefetch_request_tracker = GPGPU_Context()->the_gpgpusim->g_the_gpu->get_m_cluster()[m_core_id]->get_m_core()[0]->get_m_rt_unit()->prefetch_request_tracker;
-      unsigned most_recent_fill_time = 0;
-      for (auto &addr_vec : prefetch_request_tracker) {
-        for (auto &prefetch_info : addr_vec.second) {
-          if (m_lines[idx]->get_sector_fill_mf_request_uid(mask) == prefetch_info.mf_request_uid) { // TODO: record the mf that fills the cacheline in the cache_block for ease of checking the entry
-            assert(prefetch_info.fill_index == idx);
-            assert(m_config.block_addr(prefetch_info.m_prefetch_request_addr) == m_lines[idx]->m_block_addr);
-            prefetch_info.evict_time = GPGPU_Context()->the_gpgpusim->g_the_gpu->gpu_sim_cycle + GPGPU_Context()->the_gpgpusim->g_the_gpu->gpu_tot_sim_cycle;
-          }
-        }
-      }
+    if (m_core_id >= 0 && m_type_id == 0) { // m_core_id >= 0 means its L1 cache, m_type_id == 0 for data cache
+      // This part evicts every prefetch resident on the line
+      rt_unit *rt = GPGPU_Context()->the_gpgpusim->g_the_gpu->get_m_cluster()[m_core_id]->get_m_core()[0]->get_m_rt_unit();
+      rt->prefetch_tracker.line_evicted(idx, GPGPU_Context()->the_gpgpusim->g_the_gpu->gpu_sim_cycle + GPGPU_Context()->the_gpgpusim->g_the_gpu->gpu_tot_sim_cycle);
+      if (m_lines[idx]->get_line_fill_source() == PREFETCH)
+        rt->prefetch_evicted(m_lines[idx]->m_block_addr);
     }
     
     m_lines[idx]->allocate(m_config.tag(addr), m_config.block_addr(addr), time,
@@ -451,33 +605,9 @@ void tag_array::fill(new_addr_type addr, unsigned time,
 
     if (m_lines[idx]->get_sector_fill_source(mask) == PREFETCH  && m_core_id >= 0 && m_type_id == 0) {
       // This part evicts the prefetch cache block
-      // Find the most recent prefetch request that filled this cache block
-      std::map<new_addr_type, std::vector<prefetch_block_info>>&prefetch_request_tracker = GPGPU_Context()->the_gpgpusim->g_the_gpu->get_m_cluster()[m_core_id]->get_m_core()[0]->get_m_rt_unit()->prefetch_request_tracker;
-      // new_addr_type prefetch_addr = mf->get_uncoalesced_addr();
-      // new_addr_type mshr_addr = m_config.mshr_addr(prefetch_addr);
-      // unsigned most_recent_fill_time = 0;
-      // assert(prefetch_request_tracker.count(mshr_addr));
-      // if (prefetch_request_tracker.count(mshr_addr)) {
-      //   for (auto &prefetch_info : prefetch_request_tracker[mshr_addr]) {
-      //     if (m_lines[idx]->get_sector_fill_mf_request_uid(mask) == prefetch_info.mf_request_uid) { // TODO: record the mf that fills the cacheline in the cache_block for ease of checking the entry
-      //       assert(prefetch_info.fill_index == idx);
-      //       assert(m_config.block_addr(prefetch_info.m_prefetch_request_addr) == m_lines[idx]->m_block_addr);
-      //       prefetch_info.evict_time = GPGPU_Context()->the_gpgpusim->g_the_gpu->gpu_sim_cycle + GPGPU_Context()->the_gpgpusim->g_the_gpu->gpu_tot_sim_cycle;
-      //     }
-      //   }
-      // }
-
-      // std::vector<prefetch_block_info> &prefetch_request_tracker = GPGPU_Context()->the_gpgpusim->g_the_gpu->get_m_cluster()[m_core_id]->get_m_core()[0]->get_m_rt_unit()->prefetch_request_tracker;
-      unsigned most_recent_fill_time = 0;
-      for (auto &addr_vec : prefetch_request_tracker) {
-        for (auto &prefetch_info : addr_vec.second) {
-          if (m_lines[idx]->get_sector_fill_mf_request_uid(mask) == prefetch_info.mf_request_uid) { // TODO: record the mf that fills the cacheline in the cache_block for ease of checking the entry
-            assert(prefetch_info.fill_index == idx);
-            assert(m_config.block_addr(prefetch_info.m_prefetch_request_addr) == m_lines[idx]->m_block_addr);
-            prefetch_info.evict_time = GPGPU_Context()->the_gpgpusim->g_the_gpu->gpu_sim_cycle + GPGPU_Context()->the_gpgpusim->g_the_gpu->gpu_tot_sim_cycle;
-          }
-        }
-      }
+      rt_unit *rt = GPGPU_Context()->the_gpgpusim->g_the_gpu->get_m_cluster()[m_core_id]->get_m_core()[0]->get_m_rt_unit();
+      rt->prefetch_tracker.evicted(idx, m_lines[idx]->get_sector_fill_mf_request_uid(mask), GPGPU_Context()->the_gpgpusim->g_the_gpu->gpu_sim_cycle + GPGPU_Context()->the_gpgpusim->g_the_gpu->gpu_tot_sim_cycle);
+      rt->prefetch_evicted(m_lines[idx]->m_block_addr);
     }
 
     ((sector_cache_block *)m_lines[idx])->allocate_sector(time, mask);
@@ -492,23 +622,9 @@ void tag_array::fill(new_addr_type addr, unsigned time,
     m_dirty++;
   }
 
-  if (mf && mf->isprefetch()) {
-    std::map<new_addr_type, std::vector<prefetch_block_info>>&prefetch_request_tracker = GPGPU_Context()->the_gpgpusim->g_the_gpu->get_m_cluster()[m_core_id]->get_m_core()[0]->get_m_rt_unit()->prefetch_request_tracker;
-    new_addr_type prefetch_addr = mf->get_uncoalesced_addr();
-    new_addr_type mshr_addr = m_config.mshr_addr(prefetch_addr);
-    assert(prefetch_request_tracker.count(mshr_addr));
-    if (prefetch_request_tracker.count(mshr_addr)) {
-      for (auto &prefetch_info : prefetch_request_tracker[mshr_addr]) {
-        prefetch_info.fill_index = idx;
-      }
-    }
-
-    // std::vector<prefetch_block_info> &prefetch_request_tracker = GPGPU_Context()->the_gpgpusim->g_the_gpu->get_m_cluster()[m_core_id]->get_m_core()[0]->get_m_rt_unit()->prefetch_request_tracker;
-    // for (auto &prefetch_info : prefetch_request_tracker) {
-    //   if (prefetch_info.mf_request_uid == mf->get_request_uid()) {
-    //     prefetch_info.fill_index = idx;
-    //   }
-    // }
+  if (mf && mf->isprefetch() && m_core_id >= 0 && m_type_id == 0) {
+    rt_unit *rt = GPGPU_Context()->the_gpgpusim->g_the_gpu->get_m_cluster()[m_core_id]->get_m_core()[0]->get_m_rt_unit();
+    rt->prefetch_tracker.line_filled(mf->get_request_uid(), idx, time);
   }
 }
 
@@ -1143,6 +1259,10 @@ void cache_stats::sample_cache_port_utility(bool data_port_busy,
   }
 }
 
+void cache_stats::sample_idle_cache_ports(unsigned long long cycles) {
+  m_cache_port_available_cycles += cycles;
+}
+
 baseline_cache::bandwidth_management::bandwidth_management(cache_config &config)
     : m_config(config) {
   m_data_port_occupied_cycles = 0;
@@ -1227,6 +1347,20 @@ void baseline_cache::cycle() {
   m_bandwidth_management.replenish_port_bandwidth();
 }
 
+bool baseline_cache::idle() const {
+  if (!m_bandwidth_management.data_port_free() ||
+      !m_bandwidth_management.fill_port_free())
+    return false;
+  if (m_miss_queue.empty()) return true;
+  const mem_fetch *mf = m_miss_queue.front();
+  return m_memport->full(mf->size(), mf->get_is_write());
+}
+
+void baseline_cache::cycle_idle(unsigned long long cycles) {
+  assert(idle());
+  m_stats.sample_idle_cache_ports(cycles);
+}
+
 /// Interface for response from lower memory level (model bandwidth restictions
 /// in caller)
 void baseline_cache::fill(mem_fetch *mf, unsigned time) {
@@ -1953,112 +2087,23 @@ enum cache_request_status data_cache::access(new_addr_type addr, mem_fetch *mf,
   // Update prefetch metadata after every raytracing mf cache access (L1 Cache)
   if (mf->israytrace() && !mf->isprefetch() && cache_index != (unsigned)-1) { // if cache_index == (unsigned)-1, it means reservation fail
     if (m_tag_array->get_m_core_id() >= 0 && m_tag_array->get_m_type_id() == 0) {
-      // if (m_tag_array->get_m_lines()[cache_index]->get_sector_fill_source(mf->get_access_sector_mask()) == PREFETCH) {
-        std::map<new_addr_type, std::vector<prefetch_block_info>> &prefetch_request_tracker_map = GPGPU_Context()->the_gpgpusim->g_the_gpu->get_m_cluster()[m_tag_array->get_m_core_id()]->get_m_core()[0]->get_m_rt_unit()->prefetch_request_tracker;
-        //std::vector<prefetch_block_info> &prefetch_request_tracker = GPGPU_Context()->the_gpgpusim->g_the_gpu->get_m_cluster()[m_tag_array->get_m_core_id()]->get_m_core()[0]->get_m_rt_unit()->prefetch_request_tracker;
-        if (access_status == HIT) {
-          if (m_tag_array->get_m_lines()[cache_index]->get_sector_fill_source(mf->get_access_sector_mask()) == PREFETCH) {
-            new_addr_type mshr_addr = m_config.mshr_addr(mf->get_uncoalesced_addr());
-            bool found = false;
-            if (prefetch_request_tracker_map.count(m_config.mshr_addr(mshr_addr)))
-              found = true;
-            
-            assert(found);
-            if (found) {
-              std::vector<prefetch_block_info> &prefetch_request_tracker = prefetch_request_tracker_map[mshr_addr];
-              if (m_tag_array->get_m_lines()[cache_index]->get_sector_fill_source(mf->get_access_sector_mask()) == PREFETCH) {
-                // Find the most recent prefetch entry that fills this cache block
-                // unsigned most_recent_fill_time = 0;
-                // int max_prefetch_index = -1;
-                // for (int i = 0; i < prefetch_request_tracker.size(); i++) {
-                //   if (prefetch_request_tracker[i].prefetch_fill_time > most_recent_fill_time) { // Find most recent fill time
-                //     most_recent_fill_time = prefetch_request_tracker[i].prefetch_fill_time;
-                //     max_prefetch_index = i;
-                //   }
-                // }
-                int max_prefetch_index = -1;
-                for (int i = 0; i < prefetch_request_tracker.size(); i++) {
-                  if (prefetch_request_tracker[i].mf_request_uid == m_tag_array->get_m_lines()[cache_index]->get_sector_fill_mf_request_uid(mf->get_access_sector_mask())) {
-                    max_prefetch_index = i;
-                    break;
-                  }
-                }
-                assert(max_prefetch_index != -1);
-                if (max_prefetch_index != -1) {
-                  prefetch_request_tracker[max_prefetch_index].times_accessed++;
-                  prefetch_request_tracker[max_prefetch_index].last_accessed_time_by_demand_load = time;
-                  if (prefetch_request_tracker[max_prefetch_index].effectiveness == UNCLASSIFIED) {
-                    prefetch_request_tracker[max_prefetch_index].effectiveness = TIMELY;
-                    prefetch_request_tracker[max_prefetch_index].cycle_classified = time;
-                  }
-                  if (prefetch_request_tracker[max_prefetch_index].effectiveness == TIMELY)
-                    prefetch_request_tracker[max_prefetch_index].times_classified_as_first_classification++;
-                  prefetch_request_tracker[max_prefetch_index].total_times_classified++;
-                }
-              }
-            }
-          }
-        }
-        else if (access_status == HIT_RESERVED) {
-          new_addr_type mshr_addr = m_config.mshr_addr(mf->get_uncoalesced_addr());
-          bool found = false;
-          if (prefetch_request_tracker_map.count(m_config.mshr_addr(mshr_addr)))
-            found = true;
-          
-          if (found) {
-            std::vector<prefetch_block_info> &prefetch_request_tracker = prefetch_request_tracker_map[mshr_addr];
-            // Find prefetch request with largest issue time but no fill time
-            unsigned most_recent_issue_time = 0;
-            int max_prefetch_index = -1;
-            for (int i = 0; i < prefetch_request_tracker.size(); i++) {
-              if (prefetch_request_tracker[i].prefetch_fill_time == 0) { // Match MSHR address
-                if (prefetch_request_tracker[i].prefetch_issue_time > most_recent_issue_time) { // Find most recent issue time
-                  most_recent_issue_time = prefetch_request_tracker[i].prefetch_issue_time;
-                  max_prefetch_index = i;
-                }
-              }
-            }
-            if (max_prefetch_index != -1) {
-              if (prefetch_request_tracker[max_prefetch_index].effectiveness == UNCLASSIFIED) {
-                prefetch_request_tracker[max_prefetch_index].effectiveness = LATE;
-                prefetch_request_tracker[max_prefetch_index].cycle_classified = time;
-              }
-              if (prefetch_request_tracker[max_prefetch_index].effectiveness == LATE)
-                prefetch_request_tracker[max_prefetch_index].times_classified_as_first_classification++;
-              prefetch_request_tracker[max_prefetch_index].total_times_classified++;
-            }
-          }
-        }
-        else if (access_status == MISS || access_status == SECTOR_MISS) {
-          new_addr_type mshr_addr = m_config.mshr_addr(mf->get_uncoalesced_addr());
-          bool found = false;
-          if (prefetch_request_tracker_map.count(m_config.mshr_addr(mshr_addr)))
-            found = true;
-          
-          if (found) {
-            std::vector<prefetch_block_info> &prefetch_request_tracker = prefetch_request_tracker_map[mshr_addr];
-            // Find most recent evicted prefetch
-            unsigned most_recent_evict_time = 0;
-            int max_prefetch_index = -1;
-            for (int i = 0; i < prefetch_request_tracker.size(); i++) {
-              if (prefetch_request_tracker[i].evict_time > most_recent_evict_time) { // Find most recent evict time
-                most_recent_evict_time = prefetch_request_tracker[i].evict_time;
-                max_prefetch_index = i;
-              }
-            }
-            if (max_prefetch_index != -1) {
-              if (prefetch_request_tracker[max_prefetch_index].effectiveness == UNCLASSIFIED) {
-                prefetch_request_tracker[max_prefetch_index].effectiveness = TOO_EARLY;
-                prefetch_request_tracker[max_prefetch_index].cycle_classified = time;
-              }
-              if (prefetch_request_tracker[max_prefetch_index].effectiveness == TOO_EARLY)
-                prefetch_request_tracker[max_prefetch_index].times_classified_as_first_classification++;
-              prefetch_request_tracker[max_prefetch_index].total_times_classified++;
-            }
-          }
+      rt_prefetch_tracker &prefetch_tracker = GPGPU_Context()->the_gpgpusim->g_the_gpu->get_m_cluster()[m_tag_array->get_m_core_id()]->get_m_core()[0]->get_m_rt_unit()->prefetch_tracker;
+      new_addr_type mshr_addr = m_config.mshr_addr(mf->get_uncoalesced_addr());
+      if (access_status == HIT) {
+        // Prefetch that filled this sector was used in time
+        if (m_tag_array->get_m_lines()[cache_index]->get_sector_fill_source(mf->get_access_sector_mask()) == PREFETCH) {
+          prefetch_tracker.demand_hit(cache_index, m_tag_array->get_m_lines()[cache_index]->get_sector_fill_mf_request_uid(mf->get_access_sector_mask()), time);
         }
-        // else // reservation fail
-      // }
+      }
+      else if (access_status == HIT_RESERVED) {
+        // Prefetch with largest issue time but no fill time was late
+        prefetch_tracker.demand_hit_reserved(mshr_addr, time);
+      }
+      else if (access_status == MISS || access_status == SECTOR_MISS) {
+        // Most recently evicted prefetch was too early
+        prefetch_tracker.demand_miss(mshr_addr, time);
+      }
+      // else // reservation fail
     }
   }
 
@@ -2099,21 +2144,9 @@ enum cache_request_status data_cache::access(new_addr_type addr, mem_fetch *mf,
   }
 
   // Case where prefetch hits in cache (due to demand load or previous prefetch), classify as TOO_LATE
-  if (mf->isprefetch() && access_status == HIT && m_tag_array->get_m_lines()[cache_index]->get_line_fill_source() == DEMAND_LOAD) {
-    std::map<new_addr_type, std::vector<prefetch_block_info>> &prefetch_request_tracker_map = GPGPU_Context()->the_gpgpusim->g_the_gpu->get_m_cluster()[mf->get_sid()]->get_m_core()[0]->get_m_rt_unit()->prefetch_request_tracker;
-    bool found = false;
-    new_addr_type mshr_addr = m_config.mshr_addr(mf->get_uncoalesced_addr());
-    for (auto &prefetch_info : prefetch_request_tracker_map[mshr_addr]) {
-      if (prefetch_info.mf_request_uid == mf->get_request_uid()) {
-        if (prefetch_info.effectiveness != UNCLASSIFIED) {
-          prefetch_info.cycle_classified = time;
-          prefetch_info.effectiveness = TOO_LATE;
-        }
-        found = true;
-        break;
-      }
-    }
-    assert(found);
+  // (RT unit prefetches only, L2 treelet prefetches are not tracked per core)
+  if (mf->isprefetch() && mf->israytrace() && access_status == HIT && m_tag_array->get_m_lines()[cache_index]->get_line_fill_source() == DEMAND_LOAD) {
+    GPGPU_Context()->the_gpgpusim->g_the_gpu->get_m_cluster()[mf->get_sid()]->get_m_core()[0]->get_m_rt_unit()->prefetch_tracker.prefetch_hit_demand_line(mf->get_request_uid(), time);
   }
 
   // Don't think im using this at all
@@ -2261,6 +2294,13 @@ void tex_cache::cycle() {
   }
 }
 
+bool tex_cache::idle() const {
+  if (!m_request_fifo.empty()) return false;
+  if (m_fragment_fifo.empty() || m_result_fifo.full()) return true;
+  const fragment_entry &e = m_fragment_fifo.peek();
+  return e.m_miss && !m_rob.peek(m_rob.next_pop_index()).m_ready;
+}
+
 /// Place returning cache block into reorder buffer
 void tex_cache::fill(mem_fetch *mf, unsigned time, bool perfect_mem) {
   if (m_config.m_mshr_type == SECTOR_TEX_FIFO && !perfect_mem) {
@@ -2324,3 +2364,207 @@ void tex_cache::display_state(FILE *fp) const {
   }
 }
 /******************************************************************************************************************************************/
+
+#ifdef UNIT_TEST
+
+// Random tag array workout. After every step each line's tag_array_state
+// entry has to agree with the line object, and probe_state with probe_lines
+// for a handful of addresses mapping to the same few sets.
+
+class tag_array_test : public tag_array {
+ public:
+  tag_array_test(cache_config &config) : tag_array(config, -1, 0) {}
+
+  void mark_used() { is_used = true; }
+  void set_dirty(unsigned dirty) { m_dirty = dirty; }
+
+  // Returns the number of fields m_state has wrong
+  unsigned check_state(unsigned step) {
+    unsigned errors = 0;
+    for (unsigned i = 0; i < m_config.get_num_lines(); i++) {
+      cache_block_t *line = m_lines[i];
+      unsigned bits = m_state.status[i];
+      bool same = m_state.tag[i] == line->m_tag &&
+                  m_state.last_access_time[i] ==
+                      line->get_last_access_time() &&
+                  m_state.alloc_time[i] == line->get_alloc_time() &&
+                  tag_array_state::is_invalid_line(bits) ==
+                      line->is_invalid_line() &&
+                  tag_array_state::is_reserved_line(bits) ==
+                      line->is_reserved_line() &&
+                  tag_array_state::is_modified_line(bits) ==
+                      line->is_modified_line();
+      for (unsigned s = 0; s < SECTOR_CHUNCK_SIZE; s++) {
+        mem_access_sector_mask_t mask;
+        mask.set(s);
+        same = same &&
+               tag_array_state::sector_status(bits, s) ==
+                   line->get_status(mask) &&
+               tag_array_state::sector_readable(bits, s) ==
+                   line->is_readable(mask);
+      }
+      if (!same) {
+        if (!errors)
+          printf("step %u: line %u state 0x%x does not match the line\n",
+                 step, i, bits);
+        errors++;
+      }
+    }
+    return errors;
+  }
+
+  // Returns 1 if the two probes disagree on addr
+  unsigned check_probe(unsigned step, new_addr_type addr,
+                       mem_access_sector_mask_t mask, bool is_write) {
+    unsigned set_index = m_config.set_index(addr);
+    new_addr_type tag = m_config.tag(addr);
+    unsigned line_idx = (unsigned)-1, state_idx = (unsigned)-1;
+    enum cache_request_status line_status =
+        probe_lines(set_index, tag, line_idx, mask, is_write);
+    enum cache_request_status state_status =
+        probe_state(set_index, tag, state_idx, mask, is_write);
+    if (line_status == state_status &&
+        (line_status == RESERVATION_FAIL || line_idx == state_idx))
+      return 0;
+    printf("step %u: probe of 0x%llx: lines %s idx %u, state %s idx %u\n",
+           step, addr, cache_request_status_str(line_status), line_idx,
+           cache_request_status_str(state_status), state_idx);
+    return 1;
+  }
+};
+
+// Returns the number of mismatches. Lines are only ever left reserved with
+// allocate on miss, like in the caches themselves.
+static unsigned tag_array_random(const char *config_string, bool on_miss,
+                                 unsigned wr_percent, unsigned seed) {
+  const unsigned steps = 50000, tags = 24;
+  cache_config config;
+  config.m_config_string = strdup(config_string);
+  config.init(config.m_config_string, FuncCachePreferNone);
+  config.m_wr_percent = wr_percent;
+  tag_array_test tags_under_test(config);
+  bool sector = config_string[0] == 'S';
+  unsigned lines = config.get_num_lines();
+  unsigned set_bytes = config.get_line_sz() * config.get_nset();
+
+  srand(seed);
+  unsigned state_errors = 0, probe_errors = 0, time = 1;
+  for (unsigned step = 0; step < steps && !state_errors; step++) {
+    new_addr_type addr = (new_addr_type)(rand() % tags) * set_bytes +
+                         (rand() % 2) * config.get_line_sz() +
+                         rand() % config.get_line_sz();
+    mem_access_sector_mask_t mask;
+    if (sector)
+      mask.set(rand() % SECTOR_CHUNCK_SIZE);
+    else
+      mask.set();
+    cache_block_t *line = tags_under_test.get_block(rand() % lines);
+    time += rand() % 3;
+
+    switch (rand() % 16) {
+      case 0:
+      case 1:
+      case 2:
+      case 3: {  // reserve on a miss, as access does
+        unsigned idx;
+        enum cache_request_status status =
+            tags_under_test.probe(addr, idx, mask, false);
+        if (!on_miss)
+          break;
+        else if (status == MISS)
+          tags_under_test.get_block(idx)->allocate(
+              config.tag(addr), config.block_addr(addr), time, mask);
+        else if (status == SECTOR_MISS && sector)
+          ((sector_cache_block *)tags_under_test.get_block(idx))
+              ->allocate_sector(time, mask);
+        tags_under_test.mark_used();
+        break;
+      }
+      case 4:
+      case 5:
+      case 6:
+      case 7: {
+        unsigned idx;
+        bool is_write = rand() % 2;
+        enum cache_request_status status =
+            tags_under_test.probe(addr, idx, mask, is_write);
+        if (status != RESERVATION_FAIL && (sector || status != SECTOR_MISS))
+          tags_under_test.fill(addr, time, mask, mem_access_byte_mask_t(),
+                               is_write);
+        break;
+      }
+      case 8:
+        line->set_modified_on_fill(rand() % 2, mask);
+        line->set_readable_on_fill(rand() % 2, mask);
+        break;
+      case 9:
+      case 10: {
+        static const enum cache_block_state unreserved[] = {INVALID, VALID,
+                                                            MODIFIED};
+        line->set_status(on_miss ? (enum cache_block_state)(rand() % 4)
+                                 : unreserved[rand() % 3],
+                         mask);
+        break;
+      }
+      case 11:
+        line->set_last_access_time(time - rand() % 8, mask);
+        break;
+      case 12:
+        line->set_m_readable(rand() % 2, mask);
+        break;
+      case 13:
+        tags_under_test.set_dirty(rand() % (lines + 1));
+        break;
+      case 14:
+        if (rand() % 64 == 0) tags_under_test.flush();
+        break;
+      case 15:
+        if (rand() % 256 == 0) tags_under_test.invalidate();
+        break;
+    }
+
+    state_errors += tags_under_test.check_state(step);
+    for (unsigned p = 0; p < 4 && probe_errors < 10; p++) {
+      new_addr_type probe_addr =
+          (new_addr_type)(rand() % tags) * set_bytes +
+          (rand() % 2) * config.get_line_sz() +
+          (rand() % SECTOR_CHUNCK_SIZE) * SECTOR_SIZE;
+      mem_access_sector_mask_t probe_mask;
+      if (sector)
+        probe_mask.set(probe_addr % config.get_line_sz() / SECTOR_SIZE);
+      else
+        probe_mask.set();
+      probe_errors +=
+          tags_under_test.check_probe(step, probe_addr, probe_mask, rand() % 2);
+    }
+  }
+
+  printf("%s, %u%% dirty: %u state, %u probe mismatches\n", config_string,
+         wr_percent, state_errors, probe_errors);
+  free(config.m_config_string);
+  return state_errors + probe_errors;
+}
+
+int main() {
+  struct {
+    const char *config;
+    bool on_miss;
+  } configs[] = {
+      {"N:4:128:8,L:B:m:N:L,A:32:8,8:0,32", true},
+      {"N:4:128:6,F:T:f:N:L,A:32:8,8:0,32", false},
+      {"S:4:128:8,L:B:m:N:L,A:32:8,8:0,32", true},
+      {"S:4:128:16,F:T:f:N:L,A:32:8,8:0,32", false},
+      {"S:2:128:72,L:B:m:N:L,A:32:8,8:0,32", true},  // more than 64 ways
+  };
+  unsigned mismatches = 0;
+  for (unsigned c = 0; c < sizeof(configs) / sizeof(configs[0]); c++) {
+    mismatches += tag_array_random(configs[c].config, configs[c].on_miss, 0,
+                                   c + 1);
+    mismatches += tag_array_random(configs[c].config, configs[c].on_miss, 30,
+                                   c + 1);
+  }
+  printf("%s\n", mismatches ? "FAILED" : "PASSED");
+  return mismatches ? 1 : 0;
+}
+
+#endif
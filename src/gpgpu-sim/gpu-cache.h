@@ -95,41 +95,6 @@ struct evicted_block_info {
   }
 };
 
-
-struct prefetch_block_info {
-  unsigned mf_request_uid;
-  new_addr_type m_prefetch_request_addr;
-  new_addr_type m_block_addr; // use block addr to match entries (MSHR address)
-  unsigned prefetch_generation_time;
-  unsigned prefetch_issue_time;
-  unsigned prefetch_fill_time;
-  unsigned fill_index;
-  unsigned evict_time;
-  unsigned last_accessed_time_by_demand_load; // last access time by a non prefetch mf
-  unsigned times_accessed; // times accessed by a non prefetch mf
-  prefetch_request_effectiveness effectiveness;
-  unsigned times_classified_as_first_classification;
-  unsigned total_times_classified;
-  unsigned cycle_classified;
-
-  prefetch_block_info() {
-    mf_request_uid = 0;
-    m_prefetch_request_addr = 0;
-    m_block_addr = 0;
-    prefetch_generation_time = 0;
-    prefetch_issue_time = 0;
-    prefetch_fill_time = 0;
-    fill_index = (unsigned)-1;
-    evict_time = 0;
-    last_accessed_time_by_demand_load = 0;
-    times_accessed = 0;
-    effectiveness = UNCLASSIFIED;
-    times_classified_as_first_classification = 0;
-    total_times_classified = 0;
-    cycle_classified = 0;
-  }
-};
-
 struct cache_event {
   enum cache_event_type m_cache_event_type;
   evicted_block_info m_evicted_block;  // if it was write_back event, fill the
@@ -148,10 +113,81 @@ struct cache_event {
 
 const char *cache_request_status_str(enum cache_request_status status);
 
+// What tag_array::probe reads of every line of a tag array, one array per field
+// and indexed like tag_array::m_lines, so the ways of a set sit next to each
+// other. Lines write their own entry whenever their tag, status, readable bits
+// or replacement timestamps change.
+struct tag_array_state {
+  static_assert(INVALID == 0 && RESERVED == 1 && VALID == 2 && MODIFIED == 3,
+                "status bits assume this encoding");
+  static_assert(3 * SECTOR_CHUNCK_SIZE <= 32, "status bits do not fit");
+
+  void resize(unsigned lines) {
+    tag.resize(lines);
+    status.resize(lines);
+    last_access_time.resize(lines);
+    alloc_time.resize(lines);
+  }
+  void set(unsigned idx, new_addr_type line_tag, unsigned line_status,
+           unsigned long long line_last_access_time,
+           unsigned long long line_alloc_time) {
+    tag[idx] = line_tag;
+    status[idx] = line_status;
+    last_access_time[idx] = line_last_access_time;
+    alloc_time[idx] = line_alloc_time;
+  }
+
+  // Status word: the cache_block_state of sector i in bits 2i and 2i+1, then
+  // its readable bit in bit 2 * SECTOR_CHUNCK_SIZE + i
+  static unsigned sector_bits(unsigned sector, enum cache_block_state state,
+                              bool readable) {
+    return (unsigned)state << (2 * sector) |
+           (unsigned)readable << (2 * SECTOR_CHUNCK_SIZE + sector);
+  }
+  static unsigned sector_index(mem_access_sector_mask_t mask) {
+    return mask.any() ? __builtin_ctzl(mask.to_ulong()) : 0;
+  }
+  static enum cache_block_state sector_status(unsigned bits, unsigned sector) {
+    return (enum cache_block_state)(bits >> (2 * sector) & 3);
+  }
+  static bool sector_readable(unsigned bits, unsigned sector) {
+    return bits >> (2 * SECTOR_CHUNCK_SIZE + sector) & 1;
+  }
+  // Low bit of every sector's status
+  static unsigned low_bits() {
+    unsigned low = 0;
+    for (unsigned i = 0; i < SECTOR_CHUNCK_SIZE; i++) low |= 1u << (2 * i);
+    return low;
+  }
+  static bool is_invalid_line(unsigned bits) {
+    return (bits & (low_bits() | low_bits() << 1)) == 0;
+  }
+  static bool is_reserved_line(unsigned bits) {  // any sector 01
+    return (bits & ~(bits >> 1) & low_bits()) != 0;
+  }
+  static bool is_modified_line(unsigned bits) {  // any sector 11
+    return (bits & (bits >> 1) & low_bits()) != 0;
+  }
+
+  std::vector<new_addr_type> tag;
+  std::vector<unsigned> status;
+  std::vector<unsigned long long> last_access_time;
+  std::vector<unsigned long long> alloc_time;
+};
+
 struct cache_block_t {
   cache_block_t() {
     m_tag = 0;
     m_block_addr = 0;
+    m_state = NULL;
+    m_state_idx = 0;
+  }
+
+  // Entry idx of state follows this line from now on
+  void bind_state(tag_array_state *state, unsigned idx) {
+    m_state = state;
+    m_state_idx = idx;
+    publish_state();
   }
 
   virtual void allocate(new_addr_type tag, new_addr_type block_addr,
@@ -198,6 +234,13 @@ struct cache_block_t {
 
   new_addr_type m_tag;
   new_addr_type m_block_addr;
+
+ protected:
+  // Writes this line's tag_array_state entry, if it has one
+  virtual void publish_state() = 0;
+
+  tag_array_state *m_state;
+  unsigned m_state_idx;
 };
 
 struct line_cache_block : public cache_block_t {
@@ -225,6 +268,7 @@ struct line_cache_block : public cache_block_t {
     m_set_modified_on_fill = false;
     m_set_readable_on_fill = false;
     m_set_byte_mask_on_fill = false;
+    publish_state();
   }
   void fill(unsigned time, mem_access_sector_mask_t sector_mask, mem_access_byte_mask_t byte_mask, mem_fetch *mf = nullptr) {
     // if(!m_ignore_on_fill_status)
@@ -247,6 +291,7 @@ struct line_cache_block : public cache_block_t {
         m_fill_mf_request_uid = mf->get_request_uid();
       }
     }
+    publish_state();
   }
   virtual bool is_invalid_line() { return m_status == INVALID; }
   virtual bool is_valid_line() { return m_status == VALID; }
@@ -260,6 +305,7 @@ struct line_cache_block : public cache_block_t {
   virtual void set_status(enum cache_block_state status,
                           mem_access_sector_mask_t sector_mask) {
     m_status = status;
+    publish_state();
   }
   virtual void set_byte_mask(mem_fetch *mf) {
     m_dirty_byte_mask = m_dirty_byte_mask | mf->get_access_byte_mask();
@@ -281,6 +327,7 @@ struct line_cache_block : public cache_block_t {
   virtual void set_last_access_time(unsigned long long time,
                                     mem_access_sector_mask_t sector_mask) {
     m_last_access_time = time;
+    publish_state();
   }
   virtual unsigned long long get_alloc_time() { return m_alloc_time; }
   virtual void set_ignore_on_fill(bool m_ignore,
@@ -304,6 +351,7 @@ struct line_cache_block : public cache_block_t {
   virtual void set_m_readable(bool readable,
                               mem_access_sector_mask_t sector_mask) {
     m_readable = readable;
+    publish_state();
   }
   virtual bool is_readable(mem_access_sector_mask_t sector_mask) {
     return m_readable;
@@ -316,6 +364,16 @@ struct line_cache_block : public cache_block_t {
   virtual unsigned get_line_fill_mf_request_uid() { return m_fill_mf_request_uid; }
   virtual unsigned get_sector_fill_mf_request_uid(mem_access_sector_mask_t sector_mask) { return m_fill_mf_request_uid; }
 
+ protected:
+  // The one status repeated in every sector
+  virtual void publish_state() {
+    if (!m_state) return;
+    unsigned bits = 0;
+    for (unsigned i = 0; i < SECTOR_CHUNCK_SIZE; ++i)
+      bits |= tag_array_state::sector_bits(i, m_status, m_readable);
+    m_state->set(m_state_idx, m_tag, bits, m_last_access_time, m_alloc_time);
+  }
+
  private:
   unsigned long long m_alloc_time;
   unsigned long long m_last_access_time;
@@ -384,6 +442,7 @@ struct sector_cache_block : public cache_block_t {
     m_line_alloc_time = time;  // only set this for the first allocated sector
     m_line_last_access_time = time;
     m_line_fill_time = 0;
+    publish_state();
   }
 
   void allocate_sector(unsigned time, mem_access_sector_mask_t sector_mask) {
@@ -411,6 +470,7 @@ struct sector_cache_block : public cache_block_t {
     // set line stats
     m_line_last_access_time = time;
     m_line_fill_time = 0;
+    publish_state();
   }
 
   virtual void fill(unsigned time, mem_access_sector_mask_t sector_mask, mem_access_byte_mask_t byte_mask, mem_fetch *mf = nullptr) {
@@ -443,6 +503,7 @@ struct sector_cache_block : public cache_block_t {
         m_line_fill_mf_request_uid = mf->get_request_uid();
       }
     }
+    publish_state();
   }
   virtual bool is_invalid_line() {
     // all the sectors should be invalid
@@ -478,6 +539,7 @@ struct sector_cache_block : public cache_block_t {
                           mem_access_sector_mask_t sector_mask) {
     unsigned sidx = get_sector_index(sector_mask);
     m_status[sidx] = status;
+    publish_state();
   }
 
   virtual void set_byte_mask(mem_fetch *mf) {
@@ -506,6 +568,7 @@ struct sector_cache_block : public cache_block_t {
 
     m_last_sector_access_time[sidx] = time;
     m_line_last_access_time = time;
+    publish_state();
   }
 
   virtual unsigned long long get_alloc_time() { return m_line_alloc_time; }
@@ -534,6 +597,7 @@ struct sector_cache_block : public cache_block_t {
                               mem_access_sector_mask_t sector_mask) {
     unsigned sidx = get_sector_index(sector_mask);
     m_readable[sidx] = readable;
+    publish_state();
   }
 
   virtual bool is_readable(mem_access_sector_mask_t sector_mask) {
@@ -565,6 +629,15 @@ struct sector_cache_block : public cache_block_t {
     return m_sector_fill_mf_request_uid[sidx]; 
   }
 
+ protected:
+  virtual void publish_state() {
+    if (!m_state) return;
+    unsigned bits = 0;
+    for (unsigned i = 0; i < SECTOR_CHUNCK_SIZE; ++i)
+      bits |= tag_array_state::sector_bits(i, m_status[i], m_readable[i]);
+    m_state->set(m_state_idx, m_tag, bits, m_line_last_access_time,
+                 m_line_alloc_time);
+  }
 
  private:
   unsigned m_sector_alloc_time[SECTOR_CHUNCK_SIZE];
@@ -595,6 +668,12 @@ struct sector_cache_block : public cache_block_t {
 
 enum replacement_policy_t { LRU, FIFO };
 
+// How tag_array::probe looks up a set. LINE_TAG_STORE asks every line object,
+// ARRAY_TAG_STORE only reads the tag_array_state arrays, comparing all tags of
+// the set at once, and CHECKED_TAG_STORE runs both and aborts if they ever
+// disagree.
+enum tag_store_t { LINE_TAG_STORE = 0, ARRAY_TAG_STORE, CHECKED_TAG_STORE };
+
 enum write_policy_t {
   READ_ONLY,
   WRITE_BACK,
@@ -647,17 +726,21 @@ class cache_config {
     m_set_index_function = LINEAR_SET_FUNCTION;
     m_is_streaming = false;
     m_wr_percent = 0;
+    m_tag_store = LINE_TAG_STORE;
   }
   void init(char *config, FuncCache status) {
     cache_status = status;
     assert(config);
-    char ct, rp, wp, ap, mshr_type, wap, sif;
+    char ct, rp, wp, ap, mshr_type, wap, sif, ts = 'L';
 
+    // Optional last field: tag store, L = line objects, A = tag arrays,
+    // C = tag arrays checked against the line objects
     int ntok =
-        sscanf(config, "%c:%u:%u:%u,%c:%c:%c:%c:%c,%c:%u:%u,%u:%u,%u", &ct,
+        sscanf(config, "%c:%u:%u:%u,%c:%c:%c:%c:%c,%c:%u:%u,%u:%u,%u,%c", &ct,
                &m_nset, &m_line_sz, &m_assoc, &rp, &wp, &ap, &wap, &sif,
                &mshr_type, &m_mshr_entries, &m_mshr_max_merge,
-               &m_miss_queue_size, &m_result_fifo_entries, &m_data_port_width);
+               &m_miss_queue_size, &m_result_fifo_entries, &m_data_port_width,
+               &ts);
 
     if (ntok < 12) {
       if (!strcmp(config, "none")) {
@@ -791,6 +874,19 @@ class cache_config {
       default:
         exit_parse_error();
     }
+    switch (ts) {
+      case 'L':
+        m_tag_store = LINE_TAG_STORE;
+        break;
+      case 'A':
+        m_tag_store = ARRAY_TAG_STORE;
+        break;
+      case 'C':
+        m_tag_store = CHECKED_TAG_STORE;
+        break;
+      default:
+        exit_parse_error();
+    }
 
     // detect invalid configuration
     if ((m_alloc_policy == ON_FILL || m_alloc_policy == STREAMING) and
@@ -952,6 +1048,7 @@ class cache_config {
       m_alloc_policy;  // 'm' = allocate on miss, 'f' = allocate on fill
   enum mshr_config_t m_mshr_type;
   enum cache_type m_cache_type;
+  enum tag_store_t m_tag_store;
 
   write_allocate_policy_t
       m_write_alloc_policy;  // 'W' = Write allocate, 'N' = No write allocate
@@ -1074,10 +1171,22 @@ class tag_array {
             cache_block_t **new_lines);
   void init(int core_id, int type_id);
 
+  // Probe through the line objects (LINE_TAG_STORE) or through m_state
+  // (ARRAY_TAG_STORE), the same result either way
+  enum cache_request_status probe_lines(unsigned set_index, new_addr_type tag,
+                                        unsigned &idx,
+                                        mem_access_sector_mask_t mask,
+                                        bool is_write) const;
+  enum cache_request_status probe_state(unsigned set_index, new_addr_type tag,
+                                        unsigned &idx,
+                                        mem_access_sector_mask_t mask,
+                                        bool is_write) const;
+
  protected:
   cache_config &m_config;
 
   cache_block_t **m_lines; /* nbanks x nset x assoc lines in total */
+  tag_array_state m_state;  // kept up to date by the lines themselves
 
   unsigned m_access;
   unsigned m_miss;
@@ -1321,6 +1430,7 @@ class cache_stats {
   void get_sub_stats_pw(struct cache_sub_stats_pw &css) const;
 
   void sample_cache_port_utility(bool data_port_busy, bool fill_port_busy);
+  void sample_idle_cache_ports(unsigned long long cycles);
 
   unsigned g_rt_cold_miss = 0;
   unsigned g_rt_miss = 0;
@@ -1394,6 +1504,11 @@ class baseline_cache : public cache_t {
                                            std::list<cache_event> &events) = 0;
   /// Sends next request to lower level of memory
   void cycle();
+  /// Nothing the memory port takes and both ports free, so cycle() only
+  /// samples the ports
+  bool idle() const;
+  /// Same as 'cycles' calls to cycle() while idle()
+  void cycle_idle(unsigned long long cycles);
   /// Interface for response from lower memory level (model bandwidth
   /// restictions in caller)
   void fill(mem_fetch *mf, unsigned time);
@@ -1426,6 +1541,17 @@ class baseline_cache : public cache_t {
     return m_mshrs.num_entries();
   }
 
+  // Whether addr's sector is already valid in the cache or pending in an MSHR
+  bool sector_present(new_addr_type addr) const {
+    unsigned idx;
+    mem_access_sector_mask_t mask;
+    mask.set((addr & (m_config.get_line_sz() - 1)) / SECTOR_SIZE);
+    enum cache_request_status status =
+        m_tag_array->probe(addr, idx, mask, false, true);
+    return status == HIT || status == HIT_RESERVED ||
+           m_mshrs.probe(m_config.mshr_addr(addr));
+  }
+
   // Stat collection
   const cache_stats &get_stats() const { return m_stats; }
   unsigned get_stats(enum mem_access_type *access_type,
@@ -1862,6 +1988,8 @@ class tex_cache : public cache_t {
                                    unsigned time,
                                    std::list<cache_event> &events);
   void cycle();
+  /// Nothing cycle() can send or move to the result fifo
+  bool idle() const;
   /// Place returning cache block into reorder buffer
   void fill(mem_fetch *mf, unsigned time, bool perfect_mem);
   /// Are any (accepted) accesses that had to wait for memory now ready? (does
@@ -48,6 +48,7 @@
 #include "gpu-cache.h"
 #include "gpu-misc.h"
 #include "icnt_wrapper.h"
+#include "l2_treelet_prefetcher.h"
 #include "l2cache.h"
 #include "shader.h"
 #include "stat-tool.h"
@@ -58,8 +59,10 @@
 #include "../cuda-sim/cuda_device_runtime.h"
 #include "../cuda-sim/ptx-stats.h"
 #include "../cuda-sim/ptx_ir.h"
+#include "../cuda-sim/rt_simd_kernels.h"
 #include "../debug.h"
 #include "../gpgpusim_entrypoint.h"
+#include "../stream_manager.h"
 #include "../statwrapper.h"
 #include "../trace.h"
 #include "mem_latency_stat.h"
@@ -232,6 +235,41 @@ void memory_config::reg_options(class OptionParser *opp) {
 
   option_parser_register(opp, "-l2_ideal", OPT_BOOL, &l2_ideal,
                          "Use a ideal L2 cache that always hit", "0");
+  option_parser_register(opp, "-l2_treelet_prefetch", OPT_BOOL,
+                         &l2_treelet_prefetch,
+                         "Prefetch the rest of a treelet into L2 when an RT "
+                         "fetch of its root reaches L2",
+                         "0");
+  option_parser_register(opp, "-l2_treelet_prefetch_queue_size", OPT_UINT32,
+                         &l2_treelet_prefetch_queue_size,
+                         "Sectors each L2 sub partition can hold waiting to "
+                         "be prefetched, more are dropped",
+                         "256");
+  option_parser_register(opp, "-l2_treelet_prefetch_max_inflight", OPT_UINT32,
+                         &l2_treelet_prefetch_max_inflight,
+                         "Prefetched sectors each L2 sub partition can have "
+                         "waiting on DRAM",
+                         "16");
+  option_parser_register(opp, "-l2_treelet_prefetch_recent_roots", OPT_UINT32,
+                         &l2_treelet_prefetch_recent_roots,
+                         "Recently prefetched treelet roots each L2 sub "
+                         "partition ignores",
+                         "16");
+  option_parser_register(opp, "-l2_treelet_prefetch_demand_first", OPT_BOOL,
+                         &l2_treelet_prefetch_demand_first,
+                         "Only inject L2 treelet prefetches on cycles without "
+                         "a demand access waiting for L2",
+                         "1");
+  option_parser_register(opp, "-l2_treelet_prefetch_dram_reserve", OPT_UINT32,
+                         &l2_treelet_prefetch_dram_reserve,
+                         "L2-to-DRAM queue entries injected L2 treelet "
+                         "prefetches leave free for demand misses",
+                         "2");
+  option_parser_register(opp, "-l2_treelet_prefetch_dram_low_priority",
+                         OPT_BOOL, &l2_treelet_prefetch_dram_low_priority,
+                         "FR-FCFS only schedules an L2 treelet prefetch to a "
+                         "bank with no demand read pending",
+                         "1");
   option_parser_register(opp, "-gpgpu_cache:dl2", OPT_CSTR,
                          &m_L2_config.m_config_string,
                          "unified banked L2 data cache config "
@@ -299,6 +337,16 @@ void memory_config::reg_options(class OptionParser *opp) {
                          "Seperate_Write_Queue_Enable", "0");
   option_parser_register(opp, "-dram_write_queue_size", OPT_CSTR,
                          &write_queue_size_opt, "Write_Queue_Size", "32:28:16");
+  option_parser_register(
+      opp, "-gpgpu_dram_sched_check", OPT_BOOL, &gpgpu_dram_sched_check,
+      "check every FR-FCFS DRAM scheduler pick against the original list "
+      "based scheduler and abort on a mismatch (default = off)",
+      "0");
+  option_parser_register(
+      opp, "-gpgpu_dram_sched_trace", OPT_CSTR, &gpgpu_dram_sched_trace,
+      "record every FR-FCFS DRAM scheduler request and pick to <file>.<dram "
+      "id>, for the replay driver in dram_sched.cc (default = none)",
+      "");
   option_parser_register(
       opp, "-dram_elimnate_rw_turnaround", OPT_BOOL, &elimnate_rw_turnaround,
       "elimnate_rw_turnaround i.e set tWTR and tRTW = 0", "0");
@@ -426,6 +474,10 @@ void shader_core_config::reg_options(class OptionParser *opp) {
       opp, "-max_prefetch_queue_size", OPT_UINT32, &m_max_prefetch_queue_size,
       "max_prefetch_queue_size",
       "500");
+  option_parser_register(
+      opp, "-rt_prefetch_drop_resident", OPT_BOOL, &m_rt_prefetch_drop_resident,
+      "drop queued prefetches whose sector is already in the RT cache or pending in its MSHRs",
+      "0");
   option_parser_register(
       opp, "-treelet_sort", OPT_UINT32, &m_treelet_sort,
       "sort threads in treelet order",
@@ -442,6 +494,11 @@ void shader_core_config::reg_options(class OptionParser *opp) {
       opp, "-m_lee_micro_prefetcher", OPT_BOOL, &m_lee_micro_prefetcher,
       "micro2010 lee prefetcher impl",
       "0");
+  option_parser_register(
+      opp, "-rt_prefetcher", OPT_CSTR, &m_rt_prefetcher_name,
+      "RT unit prefetch policy (none, treelet_popular, treelet_threshold, treelet_partial, treelet_tail, lee_micro10), "
+      "empty picks one from -treelet_prefetch/-treelet_prefetch_heuristic/-m_lee_micro_prefetcher",
+      "");
   option_parser_register(
       opp, "-load_treelet_metadata", OPT_BOOL, &load_treelet_metadata,
       "load_treelet_metadata",
@@ -462,10 +519,46 @@ void shader_core_config::reg_options(class OptionParser *opp) {
       opp, "-treelet_remap_stride", OPT_UINT32, &treelet_remap_stride,
       "separates the treelet nodes by a stride to for load balancing according to the DRAM partition stride",
       "0");
+  option_parser_register(
+      opp, "-treelet_layout", OPT_CSTR, &treelet_layout_name,
+      "where -remap_to_treelet_layout places treelet nodes: packed (back to back, spaced by -treelet_remap_stride, as the original layout), channel_rows or channel_banks (spread over DRAM channels by the configured address mapping), or packed_compact (packed without the gaps of shared nodes)",
+      "packed");
+  option_parser_register(
+      opp, "-treelet_layout_report", OPT_CSTR, &treelet_layout_report,
+      "file to write the per channel DRAM lines of every remapped treelet to (empty = summary only)",
+      "");
   option_parser_register(
       opp, "-prefetch_delay", OPT_UINT32, &prefetch_delay,
       "prefetch_delay",
       "32");
+  option_parser_register(
+      opp, "-treelet_index_benchmark", OPT_BOOL, &treelet_index_benchmark,
+      "verify the flat treelet index against the treelet maps and report lookups per second after treelet formation",
+      "0");
+  option_parser_register(
+      opp, "-treelet_build_threads", OPT_UINT32, &treelet_build_threads,
+      "host threads used to form treelets (1 = the sequential builder, 0 = one per hardware thread), the partition is identical for any value",
+      "1");
+  option_parser_register(
+      opp, "-treelet_build_benchmark", OPT_BOOL, &treelet_build_benchmark,
+      "time treelet formation with the sequential builder and the parallel builder at 1, 2, 4, ... threads, and check they form the same treelets",
+      "0");
+  option_parser_register(
+      opp, "-rt_trace_threads", OPT_UINT32, &rt_trace_threads,
+      "host threads that run the functional BVH walks of a warp's trace_ray lanes (1 = one lane at a time, 0 = one per hardware thread), results are identical for any value",
+      "1");
+  option_parser_register(
+      opp, "-treelet_cache_dir", OPT_CSTR, &treelet_cache_dir,
+      "directory to save and reuse treelet partitions in, keyed by acceleration structure contents and treelet options (empty = off)",
+      "");
+  option_parser_register(
+      opp, "-rt_simd_isa", OPT_INT32, &rt_simd_isa,
+      "instruction set for the functional ray-box/ray-triangle tests (-1 = best supported, 0 = scalar, 1 = SSE, 2 = AVX2)",
+      "-1");
+  option_parser_register(
+      opp, "-rt_simd_check", OPT_BOOL, &rt_simd_check,
+      "self test the SIMD intersection kernels at startup and check every traversal box and triangle test against the scalar code",
+      "0");
   option_parser_register(opp, "-gpgpu_cache:il1", OPT_CSTR,
                          &m_L1I_config.m_config_string,
                          "shader L1 instruction cache config "
@@ -818,6 +911,32 @@ void gpgpu_sim_config::reg_options(option_parser_t opp) {
                          "Minimum number of seconds between simulation "
                          "liveness messages (0 = always print)",
                          "1");
+  option_parser_register(opp, "-gpgpu_idle_fast_forward", OPT_BOOL,
+                         &gpgpu_idle_fast_forward,
+                         "Skip ahead to the next cycle in which a core, L2 "
+                         "slice, DRAM channel or the interconnect changes "
+                         "state (results are unchanged)",
+                         "0");
+  option_parser_register(opp, "-gpgpu_mem_fetch_pool", OPT_BOOL,
+                         &gpgpu_mem_fetch_pool,
+                         "Allocate mem_fetch objects from per-thread free "
+                         "lists instead of the heap",
+                         "1");
+  option_parser_register(opp, "-gpgpu_mem_fetch_pool_benchmark", OPT_BOOL,
+                         &gpgpu_mem_fetch_pool_benchmark,
+                         "Time mem_fetch pool against heap allocation at "
+                         "startup",
+                         "0");
+  option_parser_register(opp, "-rt_trace_dir", OPT_CSTR, &rt_trace_dir,
+                         "Directory to stream RT warp issue/writeback, RT "
+                         "access and treelet/ray events to, as compressed "
+                         "binary traces (empty = off)",
+                         "");
+  option_parser_register(opp, "-rt_trace_chunk_rows", OPT_UINT32,
+                         &rt_trace_chunk_rows,
+                         "Events per RT trace chunk, each stream buffers two "
+                         "chunks",
+                         "65536");
   option_parser_register(opp, "-gpgpu_compute_capability_major", OPT_UINT32,
                          &gpgpu_compute_capability_major,
                          "Major compute capability version number", "7");
@@ -843,6 +962,21 @@ void gpgpu_sim_config::reg_options(option_parser_t opp) {
       opp, "-gpgpu_ptx_sim_mode", OPT_INT32,
       &(gpgpu_ctx->func_sim->g_ptx_sim_mode),
       "Select between Performance (default) or Functional simulation (1)", "0");
+  option_parser_register(
+      opp, "-ptx_reg_slots", OPT_BOOL, &(gpgpu_ctx->func_sim->ptx_reg_slots),
+      "Keep each function's PTX registers in a flat per-frame array indexed "
+      "at load time instead of a hash map (1=on (default), 0=off)",
+      "1");
+  option_parser_register(
+      opp, "-ptx_reg_slots_benchmark", OPT_BOOL,
+      &(gpgpu_ctx->func_sim->ptx_reg_slots_benchmark),
+      "Time flat PTX register frames against the hash map at startup", "0");
+  option_parser_register(
+      opp, "-ptx_operand_benchmark", OPT_BOOL,
+      &(gpgpu_ctx->func_sim->ptx_operand_benchmark),
+      "Time register operand reads resolved at load time against classified "
+      "ones on the first thread launched",
+      "0");
   option_parser_register(opp, "-gpgpu_clock_domains", OPT_CSTR,
                          &gpgpu_clock_domains,
                          "Clock Domain Frequencies in MhZ {<Core Clock>:<ICNT "
@@ -1133,6 +1267,37 @@ gpgpu_sim::gpgpu_sim(const gpgpu_sim_config &config, gpgpu_context *ctx)
   icnt_create(m_shader_config->n_simt_clusters,
               m_memory_config->m_n_mem_sub_partition);
 
+  m_idle_cycles_skipped = 0;
+  m_busy_cycles_skipped = 0;
+
+  mem_fetch_pool::set_enabled(m_config.gpgpu_mem_fetch_pool);
+  ptx_reg_frame::set_slots_enabled(gpgpu_ctx->func_sim->ptx_reg_slots);
+  if (gpgpu_ctx->func_sim->ptx_reg_slots_benchmark) {
+    const unsigned n_regs[] = {16, 64, 256};
+    for (unsigned i = 0; i < sizeof(n_regs) / sizeof(n_regs[0]); i++)
+      ptx_reg_frame::benchmark(stdout, gpgpu_ctx, n_regs[i],
+                               m_shader_config->n_thread_per_shader, 1000000);
+  }
+  if (m_config.gpgpu_mem_fetch_pool_benchmark)
+    mem_fetch_pool::benchmark(stdout, 1000000,
+                              m_shader_config->m_max_prefetch_queue_size *
+                                  m_shader_config->num_shader());
+
+  m_rt_warps_issued = 0;
+  m_rt_issue_cycle_sum = 0;
+  m_rt_warps_written_back = 0;
+  m_rt_writeback_cycle_sum = 0;
+  open_rt_traces();
+
+  rt_simd_isa isa = rt_simd_kernels::select(m_shader_config->rt_simd_isa);
+  printf("GPGPU-Sim uArch: functional ray tracing kernels use %s\n",
+         rt_simd_kernels::isa_name(isa));
+  rt_simd_kernels::set_check(m_shader_config->rt_simd_check);
+  if (m_shader_config->rt_simd_check && !rt_simd_kernels::self_test(stdout, 1000000)) {
+    printf("GPGPU-Sim uArch: ERROR ** SIMD intersection kernels disagree with the scalar code\n");
+    abort();
+  }
+
   time_vector_create(NUM_MEM_REQ_STAT);
   fprintf(stdout,
           "GPGPU-Sim uArch: performance model initialization complete.\n");
@@ -1531,6 +1696,63 @@ void gpgpu_sim::clear_executed_kernel_info() {
   m_executed_kernel_names.clear();
   m_executed_kernel_uids.clear();
 }
+void gpgpu_sim::open_rt_traces() {
+  if (!m_config.rt_trace_dir || !m_config.rt_trace_dir[0]) return;
+
+  typedef rt_trace_sink::column column;
+  const rt_trace_sink::column_encoding RAW = rt_trace_sink::RAW;
+  const rt_trace_sink::column_encoding DELTA = rt_trace_sink::DELTA;
+  std::vector<column> warp_columns = {{"cycle", DELTA}, {"sid", RAW}, {"warp_uid", DELTA}};
+  std::vector<column> access_columns = {
+      {"cycle", DELTA}, {"sid", RAW}, {"warp_uid", DELTA}, {"addr", DELTA}, {"size", RAW}, {"type", RAW}};
+  std::vector<column> treelet_columns = {{"cycle", DELTA}, {"sid", RAW}, {"treelet", RAW}, {"ray_id", DELTA}};
+
+  std::string dir = m_config.rt_trace_dir;
+  unsigned rows = m_config.rt_trace_chunk_rows ? m_config.rt_trace_chunk_rows : 1;
+  bool ok = m_rt_issue_trace.open(dir + "/rt_warp_issue.rtt", "rt_warp_issue", warp_columns, rows) &&
+            m_rt_writeback_trace.open(dir + "/rt_warp_writeback.rtt", "rt_warp_writeback", warp_columns, rows) &&
+            m_rt_access_trace.open(dir + "/rt_access.rtt", "rt_access", access_columns, rows) &&
+            m_rt_treelet_ray_trace.open(dir + "/rt_treelet_ray.rtt", "rt_treelet_ray", treelet_columns, rows);
+  if (!ok) {
+    printf("GPGPU-Sim: WARNING cannot create RT traces in %s, RT tracing disabled\n", m_config.rt_trace_dir);
+    m_rt_issue_trace.close();
+    m_rt_writeback_trace.close();
+    m_rt_access_trace.close();
+    m_rt_treelet_ray_trace.close();
+  }
+}
+
+void gpgpu_sim::rt_warp_issued(unsigned sid, unsigned warp_uid) {
+  m_rt_warps_issued++;
+  m_rt_issue_cycle_sum += gpu_sim_cycle;
+  if (m_rt_issue_trace.is_open()) {
+    unsigned long long row[] = {gpu_tot_sim_cycle + gpu_sim_cycle, sid, warp_uid};
+    m_rt_issue_trace.append(row);
+  }
+}
+
+void gpgpu_sim::rt_warp_written_back(unsigned sid, unsigned warp_uid) {
+  m_rt_warps_written_back++;
+  m_rt_writeback_cycle_sum += gpu_sim_cycle;
+  if (m_rt_writeback_trace.is_open()) {
+    unsigned long long row[] = {gpu_tot_sim_cycle + gpu_sim_cycle, sid, warp_uid};
+    m_rt_writeback_trace.append(row);
+  }
+}
+
+void gpgpu_sim::rt_access_issued(unsigned sid, unsigned warp_uid, new_addr_type addr, unsigned size,
+                                 unsigned type) {
+  if (!m_rt_access_trace.is_open()) return;
+  unsigned long long row[] = {gpu_tot_sim_cycle + gpu_sim_cycle, sid, warp_uid, addr, size, type};
+  m_rt_access_trace.append(row);
+}
+
+void gpgpu_sim::rt_treelet_ray_access(unsigned sid, new_addr_type treelet, unsigned ray_id) {
+  if (!m_rt_treelet_ray_trace.is_open()) return;
+  unsigned long long row[] = {gpu_tot_sim_cycle + gpu_sim_cycle, sid, treelet, ray_id};
+  m_rt_treelet_ray_trace.append(row);
+}
+
 void gpgpu_sim::gpu_print_stat() {
   FILE *statfout = stdout;
 
@@ -1636,7 +1858,24 @@ void gpgpu_sim::gpu_print_stat() {
     fprintf(statfout, "%d ", m_cluster[i]->get_m_core()[0]->get_m_rt_unit()->l2_cache_rt_pending_hits);
     trace_ray_total_l2_pending_hits += m_cluster[i]->get_m_core()[0]->get_m_rt_unit()->l2_cache_rt_pending_hits;
   }
-  fprintf(statfout, "%d\n\n", trace_ray_total_l2_pending_hits);
+  fprintf(statfout, "%d\n", trace_ray_total_l2_pending_hits);
+
+  if (m_memory_config->l2_treelet_prefetch) {
+    l2_treelet_prefetch_stats treelet_prefetch;
+    for (unsigned i = 0; i < m_memory_config->m_n_mem_sub_partition; i++) {
+      const l2_treelet_prefetcher *prefetcher =
+          m_memory_sub_partition[i]->get_treelet_prefetcher();
+      if (prefetcher) treelet_prefetch += prefetcher->get_stats();
+    }
+    fprintf(statfout,
+            "L2 TREELET PREFETCH: triggers=%llu queued=%llu duplicates=%llu "
+            "dropped=%llu issued=%llu redundant=%llu completed=%llu\n",
+            treelet_prefetch.triggers, treelet_prefetch.queued,
+            treelet_prefetch.duplicates, treelet_prefetch.dropped,
+            treelet_prefetch.issued, treelet_prefetch.redundant,
+            treelet_prefetch.completed);
+  }
+  fprintf(statfout, "\n");
 
   // Usual output
   std::string kernel_info_str = executed_kernel_info_string();
@@ -1651,6 +1890,14 @@ void gpgpu_sim::gpu_print_stat() {
                                        (gpu_tot_sim_cycle + gpu_sim_cycle));
   fprintf(statfout, "gpu_tot_issued_cta = %lld\n",
          gpu_tot_issued_cta + m_total_cta_launched);
+  if (m_config.gpgpu_idle_fast_forward) {
+    fprintf(statfout, "gpu_tot_idle_cycles_skipped = %llu\n",
+            m_idle_cycles_skipped);
+    fprintf(statfout, "gpu_tot_busy_cycles_skipped = %llu\n",
+            m_busy_cycles_skipped);
+  }
+  if (m_config.gpgpu_mem_fetch_pool) mem_fetch_pool::print_stats(statfout);
+  rt_mem_access_log::print_stats(statfout);
   fprintf(statfout, "gpu_occupancy = %.4f%% \n", gpu_occupancy.get_occ_fraction() * 100);
   fprintf(statfout, "gpu_tot_occupancy = %.4f%% \n",
          (gpu_occupancy + gpu_tot_occupancy).get_occ_fraction() * 100);
@@ -1730,14 +1977,23 @@ void gpgpu_sim::gpu_print_stat() {
   // shader_print_l1_miss_stat( stdout );
 
   // Tommy's RT Measurements
-  unsigned long long trace_ray_inst_latency = 0;
-  assert(writeback_cycles.size() == issue_cycles.size());
-  for (unsigned i = 0; i < writeback_cycles.size(); i++)
-  {
-    trace_ray_inst_latency += writeback_cycles[i] - issue_cycles[i];
-  }
+  assert(m_rt_warps_written_back == m_rt_warps_issued);
+  unsigned long long trace_ray_inst_latency = m_rt_writeback_cycle_sum - m_rt_issue_cycle_sum;
   fprintf(statfout, "trace_ray_inst_latency = %lld\n", trace_ray_inst_latency);
-  fprintf(statfout, "avg_trace_ray_inst_latency = %lld\n", trace_ray_inst_latency/writeback_cycles.size());
+  fprintf(statfout, "avg_trace_ray_inst_latency = %lld\n",
+          m_rt_warps_written_back ? trace_ray_inst_latency / m_rt_warps_written_back : 0);
+  if (m_rt_issue_trace.is_open()) {
+    rt_trace_sink *traces[] = {&m_rt_issue_trace, &m_rt_writeback_trace,
+                               &m_rt_access_trace, &m_rt_treelet_ray_trace};
+    unsigned long long rows = 0, bytes = 0;
+    for (rt_trace_sink *trace : traces) {
+      trace->flush();
+      rows += trace->rows();
+      bytes += trace->bytes_written();
+    }
+    fprintf(statfout, "rt_trace_events = %llu\n", rows);
+    fprintf(statfout, "rt_trace_bytes = %llu\n", bytes);
+  }
 
   fprintf(statfout, "mshr_rt_merges = %d\n", mshr_rt_merges);
   fprintf(statfout, "mshr_all_merges = %d\n", mshr_all_merges);
@@ -1750,50 +2006,45 @@ void gpgpu_sim::gpu_print_stat() {
   std::vector<unsigned> total_prefetch_effectiveness = {0, 0, 0, 0, 0};
   std::vector<unsigned> prefetch_effectiveness_per_cluster; // TOO_LATE:{0,0,0...,0,0}, LATE:{0,0,0,0,0},....
   for(int n=0; n < m_config.num_cluster() * 5; n++) prefetch_effectiveness_per_cluster.push_back((unsigned)0);
+  std::vector<std::vector<unsigned>> policy_effectiveness(rt_prefetcher::num_policies(), std::vector<unsigned>(5, 0));
+  std::vector<unsigned> policy_prefetches(rt_prefetcher::num_policies(), 0);
+  std::vector<unsigned> policy_demand_misses(rt_prefetcher::num_policies(), 0);
 
+  unsigned prefetches_evicted_unused = 0;
   for (unsigned i = 0; i < m_config.num_cluster(); i++) {
-    std::map<new_addr_type, std::vector<prefetch_block_info>> prefetch_request_tracker = m_cluster[i]->get_m_core()[0]->get_m_rt_unit()->prefetch_request_tracker;
-    for (auto &vec : prefetch_request_tracker) {
-      // Scan once and see if that address has any entries that were classified which means they were 'accessed' before
-      bool accessed = false;
-      for (auto &info : vec.second) {
-        if (info.effectiveness != UNCLASSIFIED && info.effectiveness != NEVER_USED) {
-          accessed = true;
-        }
-      }
-
-      // If it has been accessed before, then label all the ones that weren't classifed as TOO_LATE
-      if (accessed) {
-        for (auto &prefetch_info : vec.second) {
-          if (prefetch_info.effectiveness == UNCLASSIFIED) {
-            unclassified_but_accessed++;
-            // prefetch_info.effectiveness = TOO_LATE;
-            continue;
-          }
-          total_prefetch_effectiveness[prefetch_info.effectiveness]++;
-          prefetch_effectiveness_per_cluster[i + prefetch_info.effectiveness * m_config.num_cluster()]++;
-        }
-      }
-      else { // If never accessed, then label as NEVER_USED
-        for (auto &prefetch_info : vec.second) {
-          if (prefetch_info.effectiveness == UNCLASSIFIED) {
-            prefetch_info.effectiveness = NEVER_USED;
-          }
-          total_prefetch_effectiveness[prefetch_info.effectiveness]++;
-          prefetch_effectiveness_per_cluster[i + prefetch_info.effectiveness * m_config.num_cluster()]++;
-        }
-      }
+    // A block that no demand access used counts its prefetches as NEVER_USED,
+    // the tracker keeps the ones left unclassified in a used block apart
+    const rt_prefetch_tracker &prefetch_tracker = m_cluster[i]->get_m_core()[0]->get_m_rt_unit()->prefetch_tracker;
+    policy_demand_misses[m_shader_config->m_rt_prefetcher_policy] += m_cluster[i]->get_m_core()[0]->get_m_rt_unit()->get_trace_ray_misses();
+    for (unsigned p = 0; p < rt_prefetcher::num_policies(); p++) {
+      policy_prefetches[p] += prefetch_tracker.prefetches(p);
+      unclassified_but_accessed += prefetch_tracker.unclassified_but_accessed(p);
+      for (unsigned e = 0; e < 5; e++)
+        policy_effectiveness[p][e] += prefetch_tracker.effectiveness(p, (prefetch_request_effectiveness)e);
+    }
+    for (unsigned e = 0; e < 5; e++) {
+      unsigned count = prefetch_tracker.effectiveness((prefetch_request_effectiveness)e);
+      total_prefetch_effectiveness[e] += count;
+      prefetch_effectiveness_per_cluster[i + e * m_config.num_cluster()] += count;
     }
-    // std::vector<prefetch_block_info> prefetch_request_tracker = m_cluster[i]->get_m_core()[0]->get_m_rt_unit()->prefetch_request_tracker;
-    // for (auto &prefetch_info : prefetch_request_tracker) {
-    //   if (prefetch_info.effectiveness == UNCLASSIFIED) {
-    //     prefetch_info.effectiveness = NEVER_USED;
-    //   }
-    //   total_prefetch_effectiveness[prefetch_info.effectiveness]++;
-    //   prefetch_effectiveness_per_cluster[i + prefetch_info.effectiveness * m_config.num_cluster()]++;
-    // }
+    prefetches_evicted_unused += prefetch_tracker.evicted_unused();
   }
   fprintf(statfout, "unclassified_but_accessed=%d\n", unclassified_but_accessed);
+  fprintf(statfout, "prefetches_evicted_unused=%d\n", prefetches_evicted_unused);
+  fprintf(statfout, "\n");
+
+  // accuracy: used (TIMELY or LATE) / issued, coverage: used / (used + remaining demand misses), timeliness: TIMELY / used
+  fprintf(statfout, "RT prefetcher policies: [Policy, Prefetches, TOO_LATE, LATE, TIMELY, TOO_EARLY, NEVER_USED, Accuracy, Coverage, Timeliness]\n");
+  for (unsigned p = 0; p < rt_prefetcher::num_policies(); p++) {
+    if (policy_prefetches[p] == 0 && p != m_shader_config->m_rt_prefetcher_policy) continue;
+    unsigned used = policy_effectiveness[p][TIMELY] + policy_effectiveness[p][LATE];
+    double accuracy = policy_prefetches[p] ? (double)used / (double)policy_prefetches[p] : 0.0;
+    double coverage = (used + policy_demand_misses[p]) ? (double)used / (double)(used + policy_demand_misses[p]) : 0.0;
+    double timeliness = used ? (double)policy_effectiveness[p][TIMELY] / (double)used : 0.0;
+    fprintf(statfout, "%s %u ", rt_prefetcher::policy_info(p).name, policy_prefetches[p]);
+    for (unsigned e = 0; e < 5; e++) fprintf(statfout, "%u ", policy_effectiveness[p][e]);
+    fprintf(statfout, "%f %f %f\n", accuracy, coverage, timeliness);
+  }
   fprintf(statfout, "\n");
 
   fprintf(statfout, "prefetch_treelet_switches: [Clusters 0, ..., N, Total Sum]\n");
@@ -1869,6 +2120,47 @@ void gpgpu_sim::gpu_print_stat() {
 
   fprintf(statfout, "\n");
 
+  fprintf(statfout, "Prefetches Deduplicated: [Clusters 0, ..., N, Total Sum]\n");
+  unsigned total_prefetches_deduplicated = 0;
+  for (int i = 0; i < m_config.num_cluster(); i++) {
+    fprintf(statfout, "%d ", m_cluster[i]->get_m_core()[0]->get_m_rt_unit()->get_prefetches_deduplicated());
+    total_prefetches_deduplicated += m_cluster[i]->get_m_core()[0]->get_m_rt_unit()->get_prefetches_deduplicated();
+  }
+  fprintf(statfout, "%d\n", total_prefetches_deduplicated);
+
+  fprintf(statfout, "\n");
+
+  fprintf(statfout, "Prefetches Dropped Queue Full: [Clusters 0, ..., N, Total Sum]\n");
+  unsigned total_prefetches_dropped_queue_full = 0;
+  for (int i = 0; i < m_config.num_cluster(); i++) {
+    fprintf(statfout, "%d ", m_cluster[i]->get_m_core()[0]->get_m_rt_unit()->get_prefetches_dropped_queue_full());
+    total_prefetches_dropped_queue_full += m_cluster[i]->get_m_core()[0]->get_m_rt_unit()->get_prefetches_dropped_queue_full();
+  }
+  fprintf(statfout, "%d\n", total_prefetches_dropped_queue_full);
+
+  fprintf(statfout, "\n");
+
+  fprintf(statfout, "Prefetches Dropped Resident: [Clusters 0, ..., N, Total Sum]\n");
+  unsigned total_prefetches_dropped_resident = 0;
+  for (int i = 0; i < m_config.num_cluster(); i++) {
+    fprintf(statfout, "%d ", m_cluster[i]->get_m_core()[0]->get_m_rt_unit()->get_prefetches_dropped_resident());
+    total_prefetches_dropped_resident += m_cluster[i]->get_m_core()[0]->get_m_rt_unit()->get_prefetches_dropped_resident();
+  }
+  fprintf(statfout, "%d\n", total_prefetches_dropped_resident);
+
+  fprintf(statfout, "\n");
+
+  fprintf(statfout, "Max Prefetch Queue Occupancy: [Clusters 0, ..., N, Max]\n");
+  unsigned max_prefetch_queue_occupancy = 0;
+  for (int i = 0; i < m_config.num_cluster(); i++) {
+    unsigned occupancy = m_cluster[i]->get_m_core()[0]->get_m_rt_unit()->get_max_prefetch_queue_occupancy();
+    fprintf(statfout, "%d ", occupancy);
+    if (occupancy > max_prefetch_queue_occupancy) max_prefetch_queue_occupancy = occupancy;
+  }
+  fprintf(statfout, "%d\n", max_prefetch_queue_occupancy);
+
+  fprintf(statfout, "\n");
+
   fprintf(statfout, "total_demand_load_mf_lat: [Clusters 0, ..., N, Total Sum]\n");
   unsigned total_demand_load_mf_lat = 0;
   for (int i = 0; i < m_config.num_cluster(); i++) {
@@ -2563,8 +2855,237 @@ void gpgpu_sim::issue_block2core() {
 unsigned long long g_single_step =
     0;  // set this in gdb to single step the pipeline
 
+// Update performance counters for DRAM
+void gpgpu_sim::update_dram_power_stats(unsigned i) {
+  m_memory_partition_unit[i]->set_dram_power_stats(
+      m_power_stats->pwr_mem_stat->n_cmd[CURRENT_STAT_IDX][i],
+      m_power_stats->pwr_mem_stat->n_activity[CURRENT_STAT_IDX][i],
+      m_power_stats->pwr_mem_stat->n_nop[CURRENT_STAT_IDX][i],
+      m_power_stats->pwr_mem_stat->n_act[CURRENT_STAT_IDX][i],
+      m_power_stats->pwr_mem_stat->n_pre[CURRENT_STAT_IDX][i],
+      m_power_stats->pwr_mem_stat->n_rd[CURRENT_STAT_IDX][i],
+      m_power_stats->pwr_mem_stat->n_wr[CURRENT_STAT_IDX][i],
+      m_power_stats->pwr_mem_stat->n_wr_WB[CURRENT_STAT_IDX][i],
+      m_power_stats->pwr_mem_stat->n_req[CURRENT_STAT_IDX][i]);
+}
+
+// Core cycles before gpu_sim_cycle next reaches a multiple of period
+static unsigned long long cycles_before_multiple(unsigned long long cycle,
+                                                 unsigned long long period) {
+  return period - 1 - cycle % period;
+}
+
+// Core cycles before issue_block2core() could start a CTA or select a
+// kernel, while kernels count down their launch latency
+unsigned long long gpgpu_sim::cta_quiet_cycles() {
+  unsigned long long cycles = -1;
+  bool selectable = false;  // select_kernel() would hand out a kernel
+  for (unsigned n = 0; n < m_running_kernels.size(); n++) {
+    kernel_info_t *kernel = m_running_kernels[n];
+    if (!kernel || kernel->no_more_ctas_to_run()) continue;
+    if (hit_max_cta_count()) return 0;
+    if (kernel->m_kernel_TB_latency)
+      cycles = std::min(cycles,
+                        (unsigned long long)kernel->m_kernel_TB_latency);
+    else
+      selectable = true;
+  }
+
+  if (m_shader_config->gpgpu_concurrent_kernel_sm) {
+    // every core asks select_kernel() every cycle
+    if (selectable) return 0;
+  } else {
+    for (unsigned i = 0; i < m_shader_config->n_simt_clusters; i++)
+      if (!m_cluster[i]->cta_quiet(selectable)) return 0;
+  }
+  return cycles;
+}
+
+// Core cycles whose work in cycle() only counts down and adds to per-cycle
+// stats, 0 if the next one must be stepped. Cycles with periodic work (stat
+// sampling, deadlock and timeout checks, intermittent stats, cycle limit) are
+// left to cycle().
+unsigned long long gpgpu_sim::core_quiet_cycles() {
+  unsigned long long now = gpu_sim_cycle + gpu_tot_sim_cycle;
+  unsigned long long cycles = cycles_before_multiple(
+      gpu_sim_cycle, m_config.gpu_stat_sample_freq);
+  cycles = std::min(cycles, cycles_before_multiple(gpu_sim_cycle, 300000));
+  if (m_config.gpu_intermittent_stats)
+    cycles = std::min(cycles,
+                      cycles_before_multiple(
+                          gpu_sim_cycle, m_config.gpu_intermittent_stats_freq));
+  if (m_config.gpu_max_cycle_opt) {
+    if (now + 1 >= m_config.gpu_max_cycle_opt) return 0;
+    cycles = std::min(cycles, m_config.gpu_max_cycle_opt - now - 1);
+  }
+  // shader_core_ctx::cycle() checks for timeouts every 10000 cycles
+  if (m_shader_config->model != POST_DOMINATOR &&
+      m_shader_config->rec_time_out > 0)
+    cycles = std::min(cycles, (10000 - now % 10000) % 10000);
+  if (!cycles) return 0;
+
+  cycles = std::min(cycles, cta_quiet_cycles());
+  if (!cycles) return 0;
+
+  bool more_cta_left = get_more_cta_left();
+  for (unsigned i = 0; i < m_shader_config->n_simt_clusters; i++) {
+    bool cores_cycled = m_cluster[i]->get_not_completed() || more_cta_left;
+    cycles = std::min(cycles, m_cluster[i]->quiet_cycles(cores_cycled));
+    if (!cycles) return 0;
+  }
+  return cycles;
+}
+
+// Advance every clock domain to the first edge at which a core, L2 slice,
+// DRAM channel or the interconnect changes state, applying the statistics
+// the skipped edges would have recorded. Returns false if the next edge has
+// to be stepped.
+bool gpgpu_sim::fast_forward() {
+  if (m_config.gpgpu_flush_l1_cache || m_config.gpgpu_flush_l2_cache ||
+      m_memory_config->simple_dram_model || g_interactive_debugger_enabled ||
+      g_single_step)
+    return false;
+#ifdef GPGPUSIM_POWER_MODEL
+  if (m_config.g_power_simulation_enabled) return false;
+#endif
+#if (CUDART_VERSION >= 5000)
+  if (!gpgpu_ctx->device_runtime->g_cuda_device_launch_op.empty())
+    return false;
+#endif
+  // the stream manager runs between cycles, a queued operation has to see
+  // the same cycle it would have without skipping
+  if (gpgpu_ctx->the_gpgpusim->g_stream_manager &&
+      gpgpu_ctx->the_gpgpusim->g_stream_manager->has_ready_operation())
+    return false;
+
+  // Horizon of each domain, in its own clock edges or as the core cycle an
+  // edge must not reach
+  if (icnt_busy()) return false;
+  unsigned long long l2_deadline = -1;
+  for (unsigned i = 0; i < m_memory_config->m_n_mem_sub_partition; i++)
+    if (!m_memory_sub_partition[i]->cache_quiet(l2_deadline)) return false;
+  unsigned long long dram_limit = -1, dram_deadline = -1;
+  for (unsigned i = 0; i < m_memory_config->m_n_mem; i++) {
+    unsigned long long cycles =
+        m_memory_partition_unit[i]->dram_quiet_cycles(dram_deadline);
+    dram_limit = std::min(dram_limit, cycles);
+    if (!dram_limit) return false;
+  }
+  unsigned long long core_limit = core_quiet_cycles();
+  if (!core_limit) return false;
+
+  // Walk the clock domains exactly as cycle() does, up to the first edge
+  // that would change something
+  unsigned long long now = gpu_sim_cycle + gpu_tot_sim_cycle;
+  unsigned long long core_ticks = 0, icnt_ticks = 0, dram_ticks = 0,
+                     l2_ticks = 0;
+  unsigned long long dram_stamp = 0;
+  double start_time[4] = {core_time, icnt_time, dram_time, l2_time};
+  while (true) {
+    double edge_time[4] = {core_time, icnt_time, dram_time, l2_time};
+    int clock_mask = next_clock_domain();
+    // cycle() hands the ICNT, DRAM and L2 edges the count before the core's
+    unsigned long long edge = now + core_ticks;
+    if (((clock_mask & CORE) && core_ticks == core_limit) ||
+        ((clock_mask & DRAM) &&
+         (dram_ticks == dram_limit || edge >= dram_deadline)) ||
+        ((clock_mask & L2) && edge >= l2_deadline)) {
+      core_time = edge_time[0];
+      icnt_time = edge_time[1];
+      dram_time = edge_time[2];
+      l2_time = edge_time[3];
+      break;
+    }
+    if (clock_mask & ICNT) icnt_ticks++;
+    if (clock_mask & DRAM) {
+      dram_ticks++;
+      dram_stamp = edge;
+    }
+    if (clock_mask & L2) l2_ticks++;
+    if (clock_mask & CORE) core_ticks++;
+  }
+  if (!core_ticks) {
+    core_time = start_time[0];
+    icnt_time = start_time[1];
+    dram_time = start_time[2];
+    l2_time = start_time[3];
+    return false;
+  }
+
+  if (icnt_ticks) icnt_transfer_idle(icnt_ticks);
+
+  if (dram_ticks) {
+    for (unsigned i = 0; i < m_memory_config->m_n_mem; i++) {
+      m_memory_partition_unit[i]->dram_skip_cycles(dram_ticks, dram_stamp);
+      update_dram_power_stats(i);
+    }
+  }
+
+  if (l2_ticks) {
+    m_power_stats->pwr_mem_stat->l2_cache_stats[CURRENT_STAT_IDX].clear();
+    for (unsigned i = 0; i < m_memory_config->m_n_mem_sub_partition; i++) {
+      if (m_memory_sub_partition[i]->full(SECTOR_CHUNCK_SIZE))
+        gpu_stall_dramfull += l2_ticks;
+      m_memory_sub_partition[i]->cache_skip_cycles(l2_ticks);
+      m_memory_sub_partition[i]->accumulate_L2cache_stats(
+          m_power_stats->pwr_mem_stat->l2_cache_stats[CURRENT_STAT_IDX]);
+    }
+  }
+
+  m_power_stats->pwr_mem_stat->core_cache_stats[CURRENT_STAT_IDX].clear();
+  bool more_cta_left = get_more_cta_left();
+  bool sm_work = false;  // some SM waits on memory or intersection tests
+  std::vector<unsigned> n_active_sms;
+  unsigned long long warp_slot_filled = 0, theoretical_warp_slots = 0;
+  for (unsigned i = 0; i < m_shader_config->n_simt_clusters; i++) {
+    if (m_cluster[i]->get_not_completed()) sm_work = true;
+    bool cores_cycled = m_cluster[i]->get_not_completed() || more_cta_left;
+    m_cluster[i]->skip_cycles(core_ticks, cores_cycled);
+    if (cores_cycled) n_active_sms.push_back(m_cluster[i]->get_n_active_sms());
+    m_cluster[i]->get_icnt_stats(
+        m_power_stats->pwr_mem_stat->n_simt_to_mem[CURRENT_STAT_IDX][i],
+        m_power_stats->pwr_mem_stat->n_mem_to_simt[CURRENT_STAT_IDX][i]);
+    m_cluster[i]->get_cache_stats(
+        m_power_stats->pwr_mem_stat->core_cache_stats[CURRENT_STAT_IDX]);
+    m_cluster[i]->get_current_occupancy(warp_slot_filled,
+                                        theoretical_warp_slots);
+  }
+  gpu_occupancy.aggregate_warp_slot_filled += warp_slot_filled * core_ticks;
+  gpu_occupancy.aggregate_theoretical_warp_slots +=
+      theoretical_warp_slots * core_ticks;
+  for (unsigned n = 0; n < m_running_kernels.size(); n++) {
+    kernel_info_t *kernel = m_running_kernels[n];
+    if (kernel)
+      kernel->m_kernel_TB_latency -=
+          std::min((unsigned long long)kernel->m_kernel_TB_latency, core_ticks);
+  }
+
+  // The float sums take the same steps they would cycle by cycle
+  float temp = 0;
+  for (unsigned i = 0; i < m_shader_config->num_shader(); i++) {
+    temp += m_shader_stats->m_pipeline_duty_cycle[i];
+  }
+  temp = temp / m_shader_config->num_shader();
+  for (unsigned long long c = 0; c < core_ticks; c++) {
+    for (unsigned i = 0; i < n_active_sms.size(); i++)
+      *active_sms += n_active_sms[i];
+    *average_pipeline_duty_cycle = ((*average_pipeline_duty_cycle) + temp);
+    gpu_sim_cycle++;
+    try_snap_shot(gpu_sim_cycle);
+    spill_log_to_file(stdout, 0, gpu_sim_cycle);
+  }
+
+  if (sm_work)
+    m_busy_cycles_skipped += core_ticks;
+  else
+    m_idle_cycles_skipped += core_ticks;
+  return true;
+}
+
 void gpgpu_sim::cycle() {
-  int clock_mask = next_clock_domain();
+  // A fast-forward already advanced every domain, nothing else to do
+  bool fast_forwarded = m_config.gpgpu_idle_fast_forward && fast_forward();
+  int clock_mask = fast_forwarded ? 0 : next_clock_domain();
 
   if (clock_mask & CORE) {
     // shader core loading (pop from ICNT into core) follows CORE clock
@@ -2604,17 +3125,7 @@ void gpgpu_sim::cycle() {
       else
         m_memory_partition_unit[i]
             ->dram_cycle();  // Issue the dram command (scheduler + delay model)
-      // Update performance counters for DRAM
-      m_memory_partition_unit[i]->set_dram_power_stats(
-          m_power_stats->pwr_mem_stat->n_cmd[CURRENT_STAT_IDX][i],
-          m_power_stats->pwr_mem_stat->n_activity[CURRENT_STAT_IDX][i],
-          m_power_stats->pwr_mem_stat->n_nop[CURRENT_STAT_IDX][i],
-          m_power_stats->pwr_mem_stat->n_act[CURRENT_STAT_IDX][i],
-          m_power_stats->pwr_mem_stat->n_pre[CURRENT_STAT_IDX][i],
-          m_power_stats->pwr_mem_stat->n_rd[CURRENT_STAT_IDX][i],
-          m_power_stats->pwr_mem_stat->n_wr[CURRENT_STAT_IDX][i],
-          m_power_stats->pwr_mem_stat->n_wr_WB[CURRENT_STAT_IDX][i],
-          m_power_stats->pwr_mem_stat->n_req[CURRENT_STAT_IDX][i]);
+      update_dram_power_stats(i);
     }
   }
 
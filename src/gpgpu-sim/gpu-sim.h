@@ -40,6 +40,7 @@
 #include "../trace.h"
 #include "addrdec.h"
 #include "gpu-cache.h"
+#include "rt_trace_sink.h"
 #include "shader.h"
 
 // constants for statistics printouts
@@ -283,6 +284,15 @@ class memory_config {
   char *gpgpu_dram_timing_opt;
   char *gpgpu_L2_queue_config;
   bool l2_ideal;
+
+  // L2 side treelet prefetcher
+  bool l2_treelet_prefetch;
+  unsigned l2_treelet_prefetch_queue_size;
+  unsigned l2_treelet_prefetch_max_inflight;
+  unsigned l2_treelet_prefetch_recent_roots;
+  bool l2_treelet_prefetch_demand_first;
+  unsigned l2_treelet_prefetch_dram_reserve;
+  bool l2_treelet_prefetch_dram_low_priority;
   unsigned gpgpu_frfcfs_dram_sched_queue_size;
   unsigned gpgpu_dram_return_queue_size;
   enum dram_ctrl_t scheduler_type;
@@ -351,6 +361,8 @@ class memory_config {
   unsigned gpgpu_frfcfs_dram_write_queue_size;
   unsigned write_high_watermark;
   unsigned write_low_watermark;
+  bool gpgpu_dram_sched_check;  // check FR-FCFS picks against the reference
+  char *gpgpu_dram_sched_trace;  // record FR-FCFS requests and picks
   bool m_perf_sim_memcpy;
   bool simple_dram_model;
 
@@ -476,6 +488,17 @@ class gpgpu_sim_config : public power_config,
   unsigned int gpgpu_compute_capability_minor;
   unsigned long long liveness_message_freq;
 
+  // skip to the next cycle in which any unit changes state
+  bool gpgpu_idle_fast_forward;
+
+  // mem_fetch allocation
+  bool gpgpu_mem_fetch_pool;
+  bool gpgpu_mem_fetch_pool_benchmark;
+
+  // RT event streams
+  char *rt_trace_dir;
+  unsigned rt_trace_chunk_rows;
+
   friend class gpgpu_sim;
 };
 
@@ -608,6 +631,11 @@ class gpgpu_sim : public gpgpu_t {
    */
   const memory_config *getMemoryConfig();
 
+  //! Get an L2 sub partition by its global ID
+  class memory_sub_partition *get_memory_sub_partition(unsigned id) const {
+    return m_memory_sub_partition[id];
+  }
+
   //! Get shader core SIMT cluster
   /*!
    * Returning the cluster of of the shader core, used by the functional
@@ -625,11 +653,25 @@ class gpgpu_sim : public gpgpu_t {
 
   simt_core_cluster** get_m_cluster() { return m_cluster; }
 
+  // RT unit events. The warp timeline feeds avg_trace_ray_inst_latency, and
+  // every event is also streamed to -rt_trace_dir when that is set.
+  void rt_warp_issued(unsigned sid, unsigned warp_uid);
+  void rt_warp_written_back(unsigned sid, unsigned warp_uid);
+  bool rt_access_tracing() const { return m_rt_access_trace.is_open(); }
+  void rt_access_issued(unsigned sid, unsigned warp_uid, new_addr_type addr,
+                        unsigned size, unsigned type);
+  void rt_treelet_ray_access(unsigned sid, new_addr_type treelet,
+                             unsigned ray_id);
+
  private:
   // clocks
   void reinit_clock_domains(void);
   int next_clock_domain(void);
   void issue_block2core();
+  void update_dram_power_stats(unsigned i);
+  unsigned long long cta_quiet_cycles();
+  unsigned long long core_quiet_cycles();
+  bool fast_forward();
   void print_dram_stats(FILE *fout) const;
   void shader_print_runtime_stat(FILE *fout);
   void shader_print_l1_miss_stat(FILE *fout) const;
@@ -645,6 +687,20 @@ class gpgpu_sim : public gpgpu_t {
   class simt_core_cluster **m_cluster;
   class memory_partition_unit **m_memory_partition_unit;
   class memory_sub_partition **m_memory_sub_partition;
+  // Core cycles skipped by -gpgpu_idle_fast_forward with no SM work, and
+  // with SMs waiting on memory or intersection tests
+  unsigned long long m_idle_cycles_skipped;
+  unsigned long long m_busy_cycles_skipped;
+
+  void open_rt_traces();
+  unsigned long long m_rt_warps_issued;
+  unsigned long long m_rt_issue_cycle_sum;
+  unsigned long long m_rt_warps_written_back;
+  unsigned long long m_rt_writeback_cycle_sum;
+  rt_trace_sink m_rt_issue_trace;
+  rt_trace_sink m_rt_writeback_trace;
+  rt_trace_sink m_rt_access_trace;
+  rt_trace_sink m_rt_treelet_ray_trace;
 
   std::vector<kernel_info_t *> m_running_kernels;
   unsigned m_last_issued_kernel;
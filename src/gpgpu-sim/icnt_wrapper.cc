@@ -38,6 +38,7 @@ icnt_has_buffer_p icnt_has_buffer;
 icnt_push_p icnt_push;
 icnt_pop_p icnt_pop;
 icnt_transfer_p icnt_transfer;
+icnt_transfer_idle_p icnt_transfer_idle;
 icnt_busy_p icnt_busy;
 icnt_display_stats_p icnt_display_stats;
 icnt_display_overall_stats_p icnt_display_overall_stats;
@@ -76,6 +77,11 @@ static void* intersim2_pop(unsigned output) {
 
 static void intersim2_transfer() { g_icnt_interface->Advance(); }
 
+static void intersim2_transfer_idle(unsigned long long cycles) {
+  // routers keep internal state even when idle, so step them one by one
+  for (unsigned long long i = 0; i < cycles; i++) g_icnt_interface->Advance();
+}
+
 static bool intersim2_busy() { return g_icnt_interface->Busy(); }
 
 static void intersim2_display_stats() { g_icnt_interface->DisplayStats(); }
@@ -116,6 +122,10 @@ static void* LocalInterconnect_pop(unsigned output) {
 
 static void LocalInterconnect_transfer() { g_localicnt_interface->Advance(); }
 
+static void LocalInterconnect_transfer_idle(unsigned long long cycles) {
+  g_localicnt_interface->AdvanceIdle(cycles);
+}
+
 static bool LocalInterconnect_busy() { return g_localicnt_interface->Busy(); }
 
 static void LocalInterconnect_display_stats() {
@@ -171,6 +181,7 @@ void icnt_wrapper_init() {
       icnt_push = intersim2_push;
       icnt_pop = intersim2_pop;
       icnt_transfer = intersim2_transfer;
+      icnt_transfer_idle = intersim2_transfer_idle;
       icnt_busy = intersim2_busy;
       icnt_display_stats = intersim2_display_stats;
       icnt_display_overall_stats = intersim2_display_overall_stats;
@@ -185,6 +196,7 @@ void icnt_wrapper_init() {
       icnt_push = LocalInterconnect_push;
       icnt_pop = LocalInterconnect_pop;
       icnt_transfer = LocalInterconnect_transfer;
+      icnt_transfer_idle = LocalInterconnect_transfer_idle;
       icnt_busy = LocalInterconnect_busy;
       icnt_display_stats = LocalInterconnect_display_stats;
       icnt_display_overall_stats = LocalInterconnect_display_overall_stats;
@@ -40,6 +40,7 @@ typedef void (*icnt_push_p)(unsigned input, unsigned output, void* data,
                             unsigned int size);
 typedef void* (*icnt_pop_p)(unsigned output);
 typedef void (*icnt_transfer_p)();
+typedef void (*icnt_transfer_idle_p)(unsigned long long cycles);
 typedef bool (*icnt_busy_p)();
 typedef void (*icnt_drain_p)();
 typedef void (*icnt_display_stats_p)();
@@ -53,6 +54,7 @@ extern icnt_has_buffer_p icnt_has_buffer;
 extern icnt_push_p icnt_push;
 extern icnt_pop_p icnt_pop;
 extern icnt_transfer_p icnt_transfer;
+extern icnt_transfer_idle_p icnt_transfer_idle;  // icnt_transfer() 'cycles' times on an idle network
 extern icnt_busy_p icnt_busy;
 extern icnt_drain_p icnt_drain;
 extern icnt_display_stats_p icnt_display_stats;
@@ -0,0 +1,104 @@
+// Copyright (c) 2022, Mohammadreza Saed, Yuan Hsi Chou, Lufei Liu, Tor M. Aamodt,
+// The University of British Columbia
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+// Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution. Neither the name of
+// The University of British Columbia nor the names of its contributors may be
+// used to endorse or promote products derived from this software without
+// specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "l2_treelet_prefetcher.h"
+
+#include <algorithm>
+#include "../cuda-sim/vulkan_ray_tracing.h"
+#include "gpu-sim.h"
+
+l2_treelet_prefetch_stats &l2_treelet_prefetch_stats::operator+=(
+    const l2_treelet_prefetch_stats &other) {
+  triggers += other.triggers;
+  queued += other.queued;
+  duplicates += other.duplicates;
+  dropped += other.dropped;
+  issued += other.issued;
+  redundant += other.redundant;
+  completed += other.completed;
+  return *this;
+}
+
+l2_treelet_prefetcher::l2_treelet_prefetcher(const memory_config *config)
+    : m_queue_size(config->l2_treelet_prefetch_queue_size),
+      m_max_inflight(config->l2_treelet_prefetch_max_inflight),
+      m_inflight(0),
+      m_recent_roots(config->l2_treelet_prefetch_recent_roots, 0),
+      m_recent_next(0) {}
+
+bool l2_treelet_prefetcher::observe_root(new_addr_type addr) {
+  if (!VulkanRayTracing::isTreeletRoot((uint8_t *)addr)) return false;
+  if (std::find(m_recent_roots.begin(), m_recent_roots.end(), addr) !=
+      m_recent_roots.end())
+    return false;
+
+  if (!m_recent_roots.empty()) {
+    m_recent_roots[m_recent_next] = addr;
+    m_recent_next = (m_recent_next + 1) % m_recent_roots.size();
+  }
+  m_stats.triggers++;
+  return true;
+}
+
+void l2_treelet_prefetcher::treelet_sectors(
+    new_addr_type root, std::vector<new_addr_type> &sectors) {
+  sectors.clear();
+  treelet_node_span nodes =
+      VulkanRayTracing::flat_treelet_index.treelet_nodes((uint8_t *)root);
+  for (const treelet_node &node : nodes) {
+    new_addr_type begin =
+        (new_addr_type)node.addr & ~(new_addr_type)(SECTOR_SIZE - 1);
+    new_addr_type end = (new_addr_type)node.addr + node.size;
+    for (new_addr_type addr = begin; addr < end; addr += SECTOR_SIZE) {
+      if (sectors.empty() || sectors.back() != addr) sectors.push_back(addr);
+    }
+  }
+}
+
+bool l2_treelet_prefetcher::enqueue(new_addr_type addr, unsigned sid,
+                                    unsigned tpc) {
+  if (m_queued_addrs.count(addr)) {
+    m_stats.duplicates++;
+    return false;
+  }
+  if (m_queue.size() >= m_queue_size) {
+    m_stats.dropped++;
+    return false;
+  }
+
+  request req = {addr, sid, tpc};
+  m_queue.push_back(req);
+  m_queued_addrs.insert(addr);
+  m_stats.queued++;
+  return true;
+}
+
+void l2_treelet_prefetcher::pop_front() {
+  m_queued_addrs.erase(m_queue.front().addr);
+  m_queue.pop_front();
+}
@@ -0,0 +1,116 @@
+// Copyright (c) 2022, Mohammadreza Saed, Yuan Hsi Chou, Lufei Liu, Tor M. Aamodt,
+// The University of British Columbia
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+// Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution. Neither the name of
+// The University of British Columbia nor the names of its contributors may be
+// used to endorse or promote products derived from this software without
+// specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef L2_TREELET_PREFETCHER_INCLUDED
+#define L2_TREELET_PREFETCHER_INCLUDED
+
+#include "../abstract_hardware_model.h"
+
+#include <deque>
+#include <unordered_set>
+#include <vector>
+
+class memory_config;
+
+struct l2_treelet_prefetch_stats {
+  unsigned long long triggers;    // treelet roots that started a prefetch
+  unsigned long long queued;      // sectors accepted into a queue
+  unsigned long long duplicates;  // sectors already waiting in the queue
+  unsigned long long dropped;     // sectors rejected by a full queue
+  unsigned long long issued;      // sectors that missed in L2 and went to DRAM
+  unsigned long long redundant;   // sectors that already hit in L2
+  unsigned long long completed;   // issued sectors filled into L2
+
+  l2_treelet_prefetch_stats() { clear(); }
+  void clear() {
+    triggers = queued = duplicates = dropped = issued = redundant = completed = 0;
+  }
+  l2_treelet_prefetch_stats &operator+=(const l2_treelet_prefetch_stats &other);
+};
+
+// Per L2 sub partition queue of BVH sectors to pull from DRAM. A demand RT
+// fetch of a treelet root seen by any sub partition queues every sector of
+// that treelet at the sub partition owning its address; each sub partition
+// then issues its own queue into L2 as a read that fills the line and is
+// dropped instead of being returned to the interconnect.
+class l2_treelet_prefetcher {
+ public:
+  struct request {
+    new_addr_type addr;  // 32B sector address
+    unsigned sid;        // core and cluster of the triggering fetch, so the
+    unsigned tpc;        // DRAM latency stats have somewhere to account it
+  };
+
+  l2_treelet_prefetcher(const memory_config *config);
+
+  // Called with each demand RT fetch reaching this sub partition. Returns true
+  // if addr is a treelet root that has not triggered a prefetch recently.
+  bool observe_root(new_addr_type addr);
+
+  // Sector addresses covering every node of the treelet rooted at root
+  static void treelet_sectors(new_addr_type root,
+                              std::vector<new_addr_type> &sectors);
+
+  bool enqueue(new_addr_type addr, unsigned sid, unsigned tpc);
+  bool empty() const { return m_queue.empty(); }
+  const request &front() const { return m_queue.front(); }
+  void pop_front();
+
+  bool can_issue() const { return m_inflight < m_max_inflight; }
+  void issued() {
+    m_inflight++;
+    m_stats.issued++;
+  }
+  void redundant() { m_stats.redundant++; }
+  void completed() {
+    assert(m_inflight > 0);
+    m_inflight--;
+    m_stats.completed++;
+  }
+
+  // No sectors waiting and none in flight
+  bool idle() const { return m_queue.empty() && m_inflight == 0; }
+
+  const l2_treelet_prefetch_stats &get_stats() const { return m_stats; }
+
+ private:
+  unsigned m_queue_size;
+  unsigned m_max_inflight;
+  unsigned m_inflight;
+
+  std::deque<request> m_queue;
+  std::unordered_set<new_addr_type> m_queued_addrs;
+
+  // Treelet roots that triggered a prefetch lately, oldest overwritten first
+  std::vector<new_addr_type> m_recent_roots;
+  unsigned m_recent_next;
+
+  l2_treelet_prefetch_stats m_stats;
+};
+
+#endif
@@ -41,6 +41,7 @@
 #include "gpu-cache.h"
 #include "gpu-sim.h"
 #include "histogram.h"
+#include "l2_treelet_prefetcher.h"
 #include "l2cache.h"
 #include "l2cache_trace.h"
 #include "mem_fetch.h"
@@ -212,7 +213,8 @@ void memory_partition_unit::visualizer_print(gzFile visualizer_file) const {
 }
 
 // determine whether a given subpartition can issue to DRAM
-bool memory_partition_unit::can_issue_to_dram(int inner_sub_partition_id) {
+bool memory_partition_unit::can_issue_to_dram(
+    int inner_sub_partition_id) const {
   int spid = inner_sub_partition_id;
   bool sub_partition_contention = m_sub_partition[spid]->dram_L2_queue_full();
   bool has_dram_resource = m_arbitration_metadata.has_credits(spid);
@@ -373,6 +375,42 @@ void memory_partition_unit::dram_cycle() {
   }
 }
 
+unsigned long long memory_partition_unit::dram_quiet_cycles(
+    unsigned long long &deadline) const {
+  unsigned long long horizon = m_dram->quiet_cycles();
+  if (!horizon) return 0;  // also covers the return queue
+
+  // the sub partition the arbitration picks has to find the DRAM full
+  int last_issued_partition = m_arbitration_metadata.last_borrower();
+  for (unsigned p = 0; p < m_config->m_n_sub_partition_per_memory_channel;
+       p++) {
+    int spid = (p + last_issued_partition + 1) %
+               m_config->m_n_sub_partition_per_memory_channel;
+    if (!m_sub_partition[spid]->L2_dram_queue_empty() &&
+        can_issue_to_dram(spid)) {
+      mem_fetch *mf = m_sub_partition[spid]->L2_dram_queue_top();
+      if (!m_dram->full(mf->get_is_write())) return 0;
+      break;
+    }
+  }
+
+  if (!m_dram_latency_queue.empty()) {
+    const dram_delay_t &d = m_dram_latency_queue.front();
+    if (!m_dram->full(d.req->get_is_write())) {
+      if (m_gpu->gpu_sim_cycle + m_gpu->gpu_tot_sim_cycle >= d.ready_cycle)
+        return 0;
+      deadline = std::min(deadline, d.ready_cycle);
+    }
+  }
+  return horizon;
+}
+
+void memory_partition_unit::dram_skip_cycles(unsigned long long cycles,
+                                             unsigned long long stamp) {
+  m_dram->skip_cycles(cycles, stamp);
+  for (unsigned long long c = 0; c < cycles; c++) m_dram->dram_log(SAMPLELOG);
+}
+
 void memory_partition_unit::set_done(mem_fetch *mf) {
   unsigned global_spid = mf->get_sub_partition_id();
   int spid = global_sub_partition_id_to_local_id(global_spid);
@@ -448,6 +486,12 @@ memory_sub_partition::memory_sub_partition(unsigned sub_partition_id,
   m_dram_L2_queue = new fifo_pipeline<mem_fetch>("dram-to-L2", 0, dram_L2);
   m_L2_icnt_queue = new fifo_pipeline<mem_fetch>("L2-to-icnt", 0, L2_icnt);
   wb_addr = -1;
+
+  // Prefetched lines have to land in L2, so only when it caches everything
+  m_treelet_prefetcher = NULL;
+  if (m_config->l2_treelet_prefetch && !m_config->m_L2_config.disabled() &&
+      !m_config->m_L2_texure_only)
+    m_treelet_prefetcher = new l2_treelet_prefetcher(config);
 }
 
 memory_sub_partition::~memory_sub_partition() {
@@ -457,6 +501,7 @@ memory_sub_partition::~memory_sub_partition() {
   delete m_L2_icnt_queue;
   delete m_L2cache;
   delete m_L2interface;
+  delete m_treelet_prefetcher;
 }
 
 void memory_sub_partition::cache_cycle(unsigned cycle) {
@@ -464,9 +509,13 @@ void memory_sub_partition::cache_cycle(unsigned cycle) {
   if (!m_config->m_L2_config.disabled()) {
     if (m_L2cache->access_ready() && !m_L2_icnt_queue->full()) {
       mem_fetch *mf = m_L2cache->next_access();
-      if (mf->get_access_type() !=
-          L2_WR_ALLOC_R) {  // Don't pass write allocate read request back to
-                            // upper level cache
+      if (mf->get_access_type() == L2_PREFETCH_R) {
+        // Treelet prefetch is done once the line is in L2
+        m_treelet_prefetcher->completed();
+        delete mf;
+      } else if (mf->get_access_type() !=
+                 L2_WR_ALLOC_R) {  // Don't pass write allocate read request
+                                   // back to upper level cache
         mf->set_reply();
         mf->set_status(IN_PARTITION_L2_TO_ICNT_QUEUE,
                        m_gpu->gpu_sim_cycle + m_gpu->gpu_tot_sim_cycle);
@@ -529,6 +578,8 @@ void memory_sub_partition::cache_cycle(unsigned cycle) {
         bool read_sent = was_read_sent(events);
         MEM_SUBPART_DPRINTF("Probing L2 cache Address=%llx, status=%u\n",
                             mf->get_addr(), status);
+        if (m_treelet_prefetcher && status != RESERVATION_FAIL)
+          treelet_prefetch(mf);
 
         if (status == HIT) {
           if (!write_sent) {
@@ -581,6 +632,9 @@ void memory_sub_partition::cache_cycle(unsigned cycle) {
     }
   }
 
+  // treelet prefetches use what the demand accesses left of the L2 port
+  if (m_treelet_prefetcher) treelet_prefetch_cycle();
+
   // ROP delay queue
   if (!m_rop.empty() && (cycle >= m_rop.front().ready_cycle) &&
       !m_icnt_L2_queue->full()) {
@@ -592,6 +646,94 @@ void memory_sub_partition::cache_cycle(unsigned cycle) {
   }
 }
 
+bool memory_sub_partition::cache_quiet(unsigned long long &deadline) const {
+  if (!m_icnt_L2_queue->empty() || !m_dram_L2_queue->empty() ||
+      !m_L2_icnt_queue->empty())
+    return false;
+  if (m_treelet_prefetcher && !m_treelet_prefetcher->empty() &&
+      m_treelet_prefetcher->can_issue())
+    return false;
+  if (!m_config->m_L2_config.disabled() &&
+      (m_L2cache->access_ready() || !m_L2cache->idle()))
+    return false;
+  if (!m_rop.empty()) deadline = std::min(deadline, m_rop.front().ready_cycle);
+  return true;
+}
+
+void memory_sub_partition::cache_skip_cycles(unsigned long long cycles) {
+  if (!m_config->m_L2_config.disabled()) m_L2cache->cycle_idle(cycles);
+}
+
+void memory_sub_partition::treelet_prefetch(const mem_fetch *mf) {
+  if (!mf->israytrace() || mf->isprefetch() || mf->get_is_write()) return;
+  if (!m_treelet_prefetcher->observe_root(mf->get_uncoalesced_base_addr()))
+    return;
+
+  // Each sector goes to the queue of the sub partition that owns it
+  l2_treelet_prefetcher::treelet_sectors(mf->get_uncoalesced_base_addr(),
+                                         m_treelet_sectors);
+  for (new_addr_type addr : m_treelet_sectors) {
+    addrdec_t tlx;
+    m_config->m_address_mapping.addrdec_tlx(addr, &tlx);
+    m_gpu->get_memory_sub_partition(tlx.sub_partition)
+        ->treelet_prefetch_enqueue(addr, mf->get_sid(), mf->get_tpc());
+  }
+}
+
+bool memory_sub_partition::treelet_prefetch_enqueue(new_addr_type addr,
+                                                    unsigned sid,
+                                                    unsigned tpc) {
+  return m_treelet_prefetcher &&
+         m_treelet_prefetcher->enqueue(addr, sid, tpc);
+}
+
+void memory_sub_partition::treelet_prefetch_cycle() {
+  if (m_treelet_prefetcher->empty() || !m_treelet_prefetcher->can_issue())
+    return;
+  if (m_config->l2_treelet_prefetch_demand_first && !m_icnt_L2_queue->empty())
+    return;
+  // leave L2-to-DRAM queue entries for demand misses (0 is unbounded)
+  unsigned dram_queue_max = m_L2_dram_queue->get_max_len();
+  if (dram_queue_max && m_L2_dram_queue->get_length() +
+                                m_config->l2_treelet_prefetch_dram_reserve >=
+                            dram_queue_max)
+    return;
+  if (!m_L2cache->data_port_free()) return;
+
+  const l2_treelet_prefetcher::request &req = m_treelet_prefetcher->front();
+  unsigned sector = (req.addr % MAX_MEMORY_ACCESS_SIZE) / SECTOR_SIZE;
+  mem_access_byte_mask_t byte_mask;
+  for (unsigned k = sector * SECTOR_SIZE; k < (sector + 1) * SECTOR_SIZE; k++)
+    byte_mask.set(k);
+  mem_fetch *mf = m_mf_allocator->alloc(
+      req.addr, L2_PREFETCH_R, active_mask_t(), byte_mask,
+      mem_access_sector_mask_t().set(sector), SECTOR_SIZE, false,
+      m_gpu->gpu_sim_cycle + m_gpu->gpu_tot_sim_cycle, -1, req.sid, req.tpc,
+      NULL);
+  mf->set_prefetch();
+  assert(mf->get_sub_partition_id() == m_id);
+
+  std::list<cache_event> events;
+  enum cache_request_status status = m_L2cache->access(
+      mf->get_addr(), mf, m_gpu->gpu_sim_cycle + m_gpu->gpu_tot_sim_cycle,
+      events);
+  MEM_SUBPART_DPRINTF("Treelet prefetch L2 Address=%llx, status=%u\n",
+                      mf->get_addr(), status);
+
+  if (status == RESERVATION_FAIL) {
+    // L2 cache lock-up: will try again next cycle
+    delete mf;
+    return;
+  }
+  if (status == HIT) {
+    m_treelet_prefetcher->redundant();
+    delete mf;
+  } else {
+    m_treelet_prefetcher->issued();
+  }
+  m_treelet_prefetcher->pop_front();
+}
+
 bool memory_sub_partition::full() const { return m_icnt_L2_queue->full(); }
 
 bool memory_sub_partition::full(unsigned size) const {
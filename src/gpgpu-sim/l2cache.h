@@ -81,6 +81,13 @@ class memory_partition_unit {
   void dram_cycle();
   void simple_dram_model_cycle();
 
+  // dram_cycle()s from now on that only advance the DRAM timing and stats,
+  // 0 if the next one must be stepped. 'deadline' is lowered to the cycle
+  // the head of the latency queue is due at the DRAM.
+  unsigned long long dram_quiet_cycles(unsigned long long &deadline) const;
+  // 'cycles' dram_cycle()s within dram_quiet_cycles(), the last at 'stamp'
+  void dram_skip_cycles(unsigned long long cycles, unsigned long long stamp);
+
   void set_done(mem_fetch *mf);
 
   void visualizer_print(gzFile visualizer_file) const;
@@ -145,7 +152,7 @@ class memory_partition_unit {
   arbitration_metadata m_arbitration_metadata;
 
   // determine wheither a given subpartition can issue to DRAM
-  bool can_issue_to_dram(int inner_sub_partition_id);
+  bool can_issue_to_dram(int inner_sub_partition_id) const;
 
   // model DRAM access scheduler latency (fixed latency between L2 and DRAM)
   struct dram_delay_t {
@@ -169,6 +176,11 @@ class memory_sub_partition {
 
   void cache_cycle(unsigned cycle);
 
+  // cache_cycle() only samples the L2 ports until the head of the ROP queue
+  // is due at 'deadline', which this lowers; false if it must be stepped
+  bool cache_quiet(unsigned long long &deadline) const;
+  void cache_skip_cycles(unsigned long long cycles);  // within cache_quiet()
+
   bool full() const;
   bool full(unsigned size) const;
   void push(class mem_fetch *mf, unsigned long long clock_cycle);
@@ -205,6 +217,12 @@ class memory_sub_partition {
     m_memcpy_cycle_offset += 1;
   }
 
+  // interface to the L2 treelet prefetcher, NULL when it is disabled
+  bool treelet_prefetch_enqueue(new_addr_type addr, unsigned sid, unsigned tpc);
+  const class l2_treelet_prefetcher *get_treelet_prefetcher() const {
+    return m_treelet_prefetcher;
+  }
+
  private:
   // data
   unsigned m_id;  //< the global sub partition ID
@@ -234,6 +252,11 @@ class memory_sub_partition {
 
   std::set<mem_fetch *> m_request_tracker;
 
+  class l2_treelet_prefetcher *m_treelet_prefetcher;
+  std::vector<new_addr_type> m_treelet_sectors;  // scratch for treelet_prefetch()
+  void treelet_prefetch(const mem_fetch *mf);
+  void treelet_prefetch_cycle();
+
   friend class L2interface;
 
   std::vector<mem_fetch *> breakdown_request_to_sector_requests(mem_fetch *mf);
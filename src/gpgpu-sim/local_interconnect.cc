@@ -269,6 +269,20 @@ void xbar_router::iSLIP_Advance() {
   cycles++;
 }
 
+void xbar_router::Advance_Idle(unsigned long long n) {
+  assert(!Busy());
+  if (verbose) {
+    // keep the per cycle trace
+    for (unsigned long long i = 0; i < n; i++) Advance();
+    return;
+  }
+
+  // An empty router only moves its round robin pointer and cycle count
+  if (arbit_type == NAIVE_RR)
+    next_node_id = (next_node_id + n % total_nodes) % total_nodes;
+  cycles += n;
+}
+
 bool xbar_router::Busy() const {
   for (unsigned i = 0; i < total_nodes; ++i) {
     if (!in_buffers[i].empty()) return true;
@@ -357,6 +371,12 @@ void LocalInterconnect::Advance() {
   }
 }
 
+void LocalInterconnect::AdvanceIdle(unsigned long long cycles) {
+  for (unsigned i = 0; i < n_subnets; ++i) {
+    net[i]->Advance_Idle(cycles);
+  }
+}
+
 bool LocalInterconnect::Busy() const {
   for (unsigned i = 0; i < n_subnets; ++i) {
     if (net[i]->Busy()) return true;
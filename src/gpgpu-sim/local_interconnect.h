@@ -59,6 +59,8 @@ class xbar_router {
             unsigned int size);
   void* Pop(unsigned ouput_deviceID);
   void Advance();
+  // Same as calling Advance() 'cycles' times while the router is empty
+  void Advance_Idle(unsigned long long cycles);
 
   bool Busy() const;
   bool Has_Buffer_In(unsigned input_deviceID, unsigned size,
@@ -120,6 +122,7 @@ class LocalInterconnect {
             unsigned int size);
   void* Pop(unsigned ouput_deviceID);
   void Advance();
+  void AdvanceIdle(unsigned long long cycles);
   bool Busy() const;
   bool HasBuffer(unsigned deviceID, unsigned int size) const;
   void DisplayStats() const;
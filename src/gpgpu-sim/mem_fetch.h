@@ -32,6 +32,7 @@
 #include <bitset>
 #include "../abstract_hardware_model.h"
 #include "addrdec.h"
+#include "mem_fetch_pool.h"
 
 enum mf_type {
   READ_REQUEST = 0,
@@ -59,6 +60,10 @@ class mem_fetch {
             mem_fetch *original_mf = NULL, mem_fetch *original_wr_mf = NULL);
   ~mem_fetch();
 
+  // Storage comes from the calling thread's mem_fetch_pool
+  static void *operator new(size_t size) { return mem_fetch_pool::allocate(size); }
+  static void operator delete(void *ptr) { mem_fetch_pool::deallocate(ptr); }
+
   void set_status(enum mem_fetch_status status, unsigned long long cycle);
   void set_reply() {
     assert(m_access.get_type() != L1_WRBK_ACC &&
@@ -0,0 +1,219 @@
+// Copyright (c) 2022, Mohammadreza Saed, Yuan Hsi Chou, Lufei Liu, Tor M. Aamodt,
+// The University of British Columbia
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+// Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution. Neither the name of
+// The University of British Columbia nor the names of its contributors may be
+// used to endorse or promote products derived from this software without
+// specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "mem_fetch_pool.h"
+
+#include <assert.h>
+#include <chrono>
+#include <new>
+#include <string.h>
+
+#include "mem_fetch.h"
+
+#define MEM_FETCH_POOL_BLOCKS_PER_CHUNK 1024
+
+const size_t mem_fetch_pool::HEADER_SIZE;
+bool mem_fetch_pool::s_enabled = true;
+pthread_mutex_t mem_fetch_pool::s_registry_lock = PTHREAD_MUTEX_INITIALIZER;
+std::vector<mem_fetch_pool *> mem_fetch_pool::s_registry;
+thread_local mem_fetch_pool *mem_fetch_pool::s_local = NULL;
+
+mem_fetch_pool::mem_fetch_pool(size_t block_size, unsigned blocks_per_chunk)
+    : m_returned(NULL) {
+  m_block_size = (block_size + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1);
+  m_blocks_per_chunk = blocks_per_chunk;
+  m_free = NULL;
+  m_allocs = 0;
+  m_reused = 0;
+  m_frees = 0;
+  m_remote_frees = 0;
+  m_high_water = 0;
+}
+
+mem_fetch_pool *mem_fetch_pool::local() {
+  if (s_local == NULL) {
+    // Never deleted, other threads may still hold (and free) its blocks
+    s_local = new mem_fetch_pool(sizeof(mem_fetch), MEM_FETCH_POOL_BLOCKS_PER_CHUNK);
+    pthread_mutex_lock(&s_registry_lock);
+    s_registry.push_back(s_local);
+    pthread_mutex_unlock(&s_registry_lock);
+  }
+  return s_local;
+}
+
+void mem_fetch_pool::grow() {
+  size_t stride = HEADER_SIZE + m_block_size;
+  char *chunk = (char *)::operator new(stride * m_blocks_per_chunk);
+  m_chunks.push_back(chunk);
+  for (unsigned i = m_blocks_per_chunk; i > 0; i--) {
+    block *b = (block *)(chunk + (i - 1) * stride);
+    b->owner = this;
+    b->next = m_free;
+    m_free = b;
+  }
+}
+
+void *mem_fetch_pool::alloc() {
+  if (m_free == NULL) {
+    m_free = m_returned.exchange(NULL, std::memory_order_acquire);
+    for (block *b = m_free; b != NULL; b = b->next) m_remote_frees++;
+  }
+  if (m_free != NULL) {
+    m_reused++;
+  } else {
+    grow();
+  }
+
+  block *b = m_free;
+  m_free = b->next;
+  m_allocs++;
+  unsigned long long live = m_allocs - m_frees - m_remote_frees;
+  if (live > m_high_water) m_high_water = live;
+  return (char *)b + HEADER_SIZE;
+}
+
+void mem_fetch_pool::free_local(block *b) {
+  b->next = m_free;
+  m_free = b;
+  m_frees++;
+}
+
+void mem_fetch_pool::free(block *b) {
+  if (this == s_local) {
+    free_local(b);
+  } else {
+    block *head = m_returned.load(std::memory_order_relaxed);
+    do {
+      b->next = head;
+    } while (!m_returned.compare_exchange_weak(head, b, std::memory_order_release,
+                                               std::memory_order_relaxed));
+  }
+}
+
+void *mem_fetch_pool::allocate(size_t size) {
+  if (s_enabled && size <= sizeof(mem_fetch)) return local()->alloc();
+
+  block *b = (block *)::operator new(HEADER_SIZE + size);
+  b->owner = NULL;
+  return (char *)b + HEADER_SIZE;
+}
+
+void mem_fetch_pool::deallocate(void *ptr) {
+  if (ptr == NULL) return;
+  block *b = (block *)((char *)ptr - HEADER_SIZE);
+  if (b->owner == NULL) {
+    ::operator delete(b);
+  } else {
+    b->owner->free(b);
+  }
+}
+
+void mem_fetch_pool::get_stats(stats &total) {
+  memset(&total, 0, sizeof(total));
+  pthread_mutex_lock(&s_registry_lock);
+  for (auto pool : s_registry) {
+    total.allocs += pool->m_allocs;
+    total.reused += pool->m_reused;
+    total.remote_frees += pool->m_remote_frees;
+    total.live += pool->m_allocs - pool->m_frees - pool->m_remote_frees;
+    total.high_water += pool->m_high_water;
+    total.reserved_bytes += (unsigned long long)pool->m_chunks.size() * pool->m_blocks_per_chunk *
+                            (HEADER_SIZE + pool->m_block_size);
+  }
+  pthread_mutex_unlock(&s_registry_lock);
+}
+
+void mem_fetch_pool::print_stats(FILE *fp) {
+  stats total;
+  get_stats(total);
+  fprintf(fp, "mem_fetch_pool_allocs = %llu\n", total.allocs);
+  fprintf(fp, "mem_fetch_pool_reused = %llu\n", total.reused);
+  fprintf(fp, "mem_fetch_pool_remote_frees = %llu\n", total.remote_frees);
+  fprintf(fp, "mem_fetch_pool_live = %llu\n", total.live);
+  fprintf(fp, "mem_fetch_pool_high_water = %llu\n", total.high_water);
+  fprintf(fp, "mem_fetch_pool_reserved_bytes = %llu\n", total.reserved_bytes);
+}
+
+// Slot of the in flight request that retires next. A private generator, so
+// the benchmark leaves rand() alone.
+static unsigned benchmark_victim(unsigned long long &seed, size_t in_flight) {
+  seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+  return (unsigned)((seed >> 33) % in_flight);
+}
+
+void mem_fetch_pool::benchmark(FILE *fp, unsigned n_requests, unsigned in_flight) {
+  if (n_requests == 0) return;
+  if (in_flight == 0) in_flight = 1;
+  std::vector<char *> window;
+  unsigned long long checksum = 0, seed = 1;
+
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned i = 0; i < n_requests; i++) {
+    char *p = (char *)::operator new(sizeof(mem_fetch));
+    memset(p, i, sizeof(mem_fetch));
+    if (window.size() < in_flight) {
+      window.push_back(p);
+      continue;
+    }
+    char *&victim = window[benchmark_victim(seed, in_flight)];
+    checksum += victim[0];
+    ::operator delete(victim);
+    victim = p;
+  }
+  for (auto p : window) ::operator delete(p);
+  window.clear();
+  seed = 1;
+  auto mid = std::chrono::steady_clock::now();
+
+  mem_fetch_pool pool(sizeof(mem_fetch), MEM_FETCH_POOL_BLOCKS_PER_CHUNK);
+  for (unsigned i = 0; i < n_requests; i++) {
+    char *p = (char *)pool.alloc();
+    memset(p, i, sizeof(mem_fetch));
+    if (window.size() < in_flight) {
+      window.push_back(p);
+      continue;
+    }
+    char *&victim = window[benchmark_victim(seed, in_flight)];
+    checksum += victim[0];
+    pool.free_local((block *)(victim - HEADER_SIZE));
+    victim = p;
+  }
+  auto end = std::chrono::steady_clock::now();
+  for (auto chunk : pool.m_chunks) ::operator delete(chunk);
+
+  // Keep the loops from being optimized away
+  volatile unsigned long long sink = checksum;
+  (void)sink;
+
+  double heap_ns = std::chrono::duration<double, std::nano>(mid - start).count() / n_requests;
+  double pool_ns = std::chrono::duration<double, std::nano>(end - mid).count() / n_requests;
+  fprintf(fp,
+          "mem_fetch pool benchmark (%u requests, %u in flight, %zu B each): "
+          "heap %.1f ns/request, pool %.1f ns/request, pool high-water %llu\n",
+          n_requests, in_flight, sizeof(mem_fetch), heap_ns, pool_ns, pool.m_high_water);
+}
@@ -0,0 +1,106 @@
+// Copyright (c) 2022, Mohammadreza Saed, Yuan Hsi Chou, Lufei Liu, Tor M. Aamodt,
+// The University of British Columbia
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+// Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution. Neither the name of
+// The University of British Columbia nor the names of its contributors may be
+// used to endorse or promote products derived from this software without
+// specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef MEM_FETCH_POOL_INCLUDED
+#define MEM_FETCH_POOL_INCLUDED
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <atomic>
+#include <vector>
+
+// Free-list allocator behind mem_fetch::operator new/delete. Each host thread
+// allocates from its own pool, so the common path takes no lock. A block freed by a thread other than the one that
+// allocated it is pushed onto its owner's lock-free return stack and picked up
+// the next time the owner's free list runs dry. Chunks are never handed back
+// to the system, a pool only grows to its high-water mark.
+class mem_fetch_pool {
+ public:
+  struct stats {
+    unsigned long long allocs;      // blocks handed out
+    unsigned long long reused;      // ... of which came from a free list
+    unsigned long long remote_frees;  // blocks freed by another thread
+    unsigned long long live;        // blocks not yet freed, or freed by another thread but not yet reclaimed
+    unsigned long long high_water;  // peak live blocks (summed over pools)
+    unsigned long long reserved_bytes;
+  };
+
+  static void *allocate(size_t size);
+  static void deallocate(void *ptr);
+
+  // When disabled, new blocks come straight from the heap (-gpgpu_mem_fetch_pool)
+  static void set_enabled(bool enabled) { s_enabled = enabled; }
+  static bool enabled() { return s_enabled; }
+
+  // Totals over every thread's pool. Only call between parallel phases.
+  static void get_stats(stats &total);
+  static void print_stats(FILE *fp);
+
+  // Times n_requests mem_fetch sized allocations against the heap, with the
+  // allocation pattern of a GPU whose prefetch queues are full: in_flight
+  // requests outstanding, each written in full like the mem_fetch
+  // constructor does, and retired in random order as replies come back from
+  // different channels. Uses a private pool.
+  static void benchmark(FILE *fp, unsigned n_requests, unsigned in_flight);
+
+ private:
+  struct block {
+    mem_fetch_pool *owner;  // NULL for blocks that came from the heap
+    block *next;
+  };
+  // Keep the payload max_align_t aligned
+  static const size_t HEADER_SIZE = (sizeof(block) + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1);
+
+  mem_fetch_pool(size_t block_size, unsigned blocks_per_chunk);
+
+  static mem_fetch_pool *local();
+  void *alloc();
+  void free(block *b);  // from whichever thread
+  void free_local(block *b);  // from the owning thread
+  void grow();
+
+  size_t m_block_size;  // payload only
+  unsigned m_blocks_per_chunk;
+  block *m_free;
+  std::atomic<block *> m_returned;  // freed by other threads
+  std::vector<char *> m_chunks;
+
+  unsigned long long m_allocs;
+  unsigned long long m_reused;
+  unsigned long long m_frees;
+  unsigned long long m_remote_frees;  // drained from m_returned
+  unsigned long long m_high_water;
+
+  static bool s_enabled;
+  static pthread_mutex_t s_registry_lock;
+  static std::vector<mem_fetch_pool *> s_registry;
+  static thread_local mem_fetch_pool *s_local;
+};
+
+#endif
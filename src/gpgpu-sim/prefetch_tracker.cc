@@ -0,0 +1,265 @@
+// Copyright (c) 2022, Mohammadreza Saed, Yuan Hsi Chou, Lufei Liu, Tor M. Aamodt,
+// The University of British Columbia
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+// Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution. Neither the name of
+// The University of British Columbia nor the names of its contributors may be
+// used to endorse or promote products derived from this software without
+// specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "prefetch_tracker.h"
+
+#include <assert.h>
+
+rt_prefetch_tracker::block_iter rt_prefetch_tracker::block_of(const prefetch_block_info &info) {
+  block_iter it = m_blocks.find(info.m_block_addr);
+  assert(it != m_blocks.end());
+  return it;
+}
+
+void rt_prefetch_tracker::set_accessed(block_usage &usage) {
+  if (usage.accessed) return;
+  for (unsigned policy = 0; policy < usage.unclassified.size(); policy++) {
+    slot(m_unclassified_unused, policy) -= usage.unclassified[policy];
+    slot(m_unclassified_accessed, policy) += usage.unclassified[policy];
+  }
+  usage.unclassified.clear();
+  usage.accessed = true;
+}
+
+// An unclassified prefetch of an accessed block was classified
+void rt_prefetch_tracker::unclassified_done(block_usage &usage, unsigned policy) {
+  set_accessed(usage);
+  slot(m_unclassified_accessed, policy)--;
+}
+
+void rt_prefetch_tracker::classify(prefetch_block_info &info, block_entry &block, prefetch_request_effectiveness e, unsigned time) {
+  if (info.effectiveness == UNCLASSIFIED) {
+    unclassified_done(*block.usage, info.policy);
+    slot(m_classified[e], info.policy)++;
+    info.effectiveness = e;
+    info.cycle_classified = time;
+  }
+  if (info.effectiveness == e)
+    info.times_classified_as_first_classification++;
+  info.total_times_classified++;
+}
+
+// The record can no longer be classified except as its block's last eviction.
+// Its result stays in the aggregates; the block goes once nothing refers to it.
+void rt_prefetch_tracker::retire(record &rec) {
+  block_iter it = block_of(rec.info);
+  block_entry &block = it->second;
+  block.unfilled.erase(std::make_pair(rec.info.prefetch_issue_time, -(int)rec.pos));
+  assert(block.live > 0);
+  block.live--;
+  if (block.live == 0 && !block.last_evict_unclassified)
+    m_blocks.erase(it);
+}
+
+void rt_prefetch_tracker::evict(record &rec, unsigned cycle) {
+  block_entry &block = block_of(rec.info)->second;
+  if (rec.info.times_accessed == 0)
+    m_evicted_unused++;
+  rec.info.evict_time = cycle;
+
+  // Most recent eviction, the earliest issued prefetch on ties
+  if (cycle > block.last_evict_time ||
+      (cycle != 0 && cycle == block.last_evict_time && rec.pos < block.last_evict_pos)) {
+    block.last_evict_time = cycle;
+    block.last_evict_pos = rec.pos;
+    block.last_evict_policy = rec.info.policy;
+    block.last_evict_unclassified = rec.info.effectiveness == UNCLASSIFIED;
+  }
+  retire(rec);
+}
+
+void rt_prefetch_tracker::issued(const prefetch_block_info &info) {
+  assert(m_in_flight.find(info.mf_request_uid) == m_in_flight.end());
+  block_entry &block = m_blocks[info.m_block_addr];
+  if (!block.usage) block.usage = &m_usage[info.m_block_addr];
+
+  record &rec = m_in_flight[info.mf_request_uid];
+  rec.info = info;
+  rec.pos = block.issued++;
+  block.last_issued_uid = info.mf_request_uid;
+  block.live++;
+  if (info.prefetch_fill_time == 0)
+    block.unfilled[std::make_pair(info.prefetch_issue_time, -(int)rec.pos)] = info.mf_request_uid;
+
+  slot(m_prefetches, info.policy)++;
+  if (info.effectiveness == UNCLASSIFIED) {
+    if (block.usage->accessed)
+      slot(m_unclassified_accessed, info.policy)++;
+    else {
+      slot(m_unclassified_unused, info.policy)++;
+      slot(block.usage->unclassified, info.policy)++;
+    }
+  }
+  else
+    slot(m_classified[info.effectiveness], info.policy)++;
+}
+
+void rt_prefetch_tracker::discard_last(new_addr_type block_addr) {
+  auto block_it = m_blocks.find(block_addr);
+  assert(block_it != m_blocks.end() && block_it->second.issued > 0);
+  block_entry &block = block_it->second;
+
+  auto it = m_in_flight.find(block.last_issued_uid);
+  assert(it != m_in_flight.end() && it->second.pos == block.issued - 1);
+  const prefetch_block_info &info = it->second.info;
+  // Never reached the cache, so nothing could have classified or evicted it
+  assert(info.effectiveness == UNCLASSIFIED && info.evict_time == 0);
+
+  slot(m_prefetches, info.policy)--;
+  if (block.usage->accessed)
+    slot(m_unclassified_accessed, info.policy)--;
+  else {
+    slot(m_unclassified_unused, info.policy)--;
+    slot(block.usage->unclassified, info.policy)--;
+  }
+  block.issued--;
+
+  retire(it->second);
+  m_in_flight.erase(it);
+}
+
+void rt_prefetch_tracker::filled(unsigned uid, new_addr_type addr, unsigned issue_time, unsigned cycle) {
+  auto it = m_in_flight.find(uid);
+  if (it == m_in_flight.end()) return;
+  record &rec = it->second;
+  if (rec.info.m_prefetch_request_addr != addr || rec.info.prefetch_issue_time != issue_time) return;
+
+  rec.info.prefetch_fill_time = cycle;
+  retire(rec);
+  m_in_flight.erase(it);
+}
+
+void rt_prefetch_tracker::line_filled(unsigned uid, unsigned idx, unsigned time) {
+  auto it = m_in_flight.find(uid);
+  if (it == m_in_flight.end()) return;
+  record &rec = it->second;
+
+  if (rec.info.prefetch_fill_time == 0 && time != 0)
+    block_of(rec.info)->second.unfilled.erase(std::make_pair(rec.info.prefetch_issue_time, -(int)rec.pos));
+  rec.info.prefetch_fill_time = time;
+  m_lines[idx].push_back(rec);
+  m_in_flight.erase(it);
+}
+
+bool rt_prefetch_tracker::evicted(unsigned idx, unsigned uid, unsigned cycle) {
+  auto line = m_lines.find(idx);
+  if (line == m_lines.end()) return false;
+  std::vector<record> &resident = line->second;
+  for (unsigned i = 0; i < resident.size(); i++) {
+    if (resident[i].info.mf_request_uid != uid) continue;
+    evict(resident[i], cycle);
+    resident[i] = resident.back();
+    resident.pop_back();
+    if (resident.empty()) m_lines.erase(line);
+    return true;
+  }
+  return false;
+}
+
+void rt_prefetch_tracker::line_evicted(unsigned idx, unsigned cycle) {
+  auto line = m_lines.find(idx);
+  if (line == m_lines.end()) return;
+  for (record &rec : line->second)
+    evict(rec, cycle);
+  m_lines.erase(line);
+}
+
+void rt_prefetch_tracker::demand_hit(unsigned idx, unsigned fill_uid, unsigned time) {
+  auto line = m_lines.find(idx);
+  assert(line != m_lines.end());
+  if (line == m_lines.end()) return;
+
+  for (record &rec : line->second) {
+    if (rec.info.mf_request_uid != fill_uid) continue;
+    rec.info.times_accessed++;
+    rec.info.last_accessed_time_by_demand_load = time;
+    classify(rec.info, block_of(rec.info)->second, TIMELY, time);
+    return;
+  }
+  assert(0 && "demand hit on a sector no tracked prefetch filled");
+}
+
+void rt_prefetch_tracker::demand_hit_reserved(new_addr_type block_addr, unsigned time) {
+  auto it = m_blocks.find(block_addr);
+  if (it == m_blocks.end()) return;
+  block_entry &block = it->second;
+
+  // Latest issued prefetch that has not been filled yet
+  if (block.unfilled.empty() || block.unfilled.rbegin()->first.first == 0) return;
+  auto rec = m_in_flight.find(block.unfilled.rbegin()->second);
+  assert(rec != m_in_flight.end());
+  classify(rec->second.info, block, LATE, time);
+}
+
+void rt_prefetch_tracker::demand_miss(new_addr_type block_addr, unsigned time) {
+  auto it = m_blocks.find(block_addr);
+  if (it == m_blocks.end()) return;
+  block_entry &block = it->second;
+
+  // Most recently evicted prefetch, retired with only its policy and status kept
+  if (block.last_evict_time == 0 || !block.last_evict_unclassified) return;
+  unclassified_done(*block.usage, block.last_evict_policy);
+  slot(m_classified[TOO_EARLY], block.last_evict_policy)++;
+  block.last_evict_unclassified = false;
+  if (block.live == 0)
+    m_blocks.erase(it);
+}
+
+void rt_prefetch_tracker::prefetch_hit_demand_line(unsigned uid, unsigned time) {
+  auto it = m_in_flight.find(uid);
+  assert(it != m_in_flight.end());
+  if (it == m_in_flight.end()) return;
+
+  prefetch_block_info &info = it->second.info;
+  if (info.effectiveness != UNCLASSIFIED) {
+    slot(m_classified[info.effectiveness], info.policy)--;
+    slot(m_classified[TOO_LATE], info.policy)++;
+    info.cycle_classified = time;
+    info.effectiveness = TOO_LATE;
+  }
+}
+
+size_t rt_prefetch_tracker::live() const {
+  size_t count = m_in_flight.size();
+  for (const auto &line : m_lines) count += line.second.size();
+  return count;
+}
+
+unsigned rt_prefetch_tracker::effectiveness(unsigned policy, prefetch_request_effectiveness e) const {
+  assert(e <= NEVER_USED);
+  if (e == NEVER_USED) return get(m_unclassified_unused, policy);
+  return get(m_classified[e], policy);
+}
+
+unsigned rt_prefetch_tracker::effectiveness(prefetch_request_effectiveness e) const {
+  assert(e <= NEVER_USED);
+  const std::vector<unsigned> &counts = e == NEVER_USED ? m_unclassified_unused : m_classified[e];
+  unsigned total = 0;
+  for (unsigned count : counts) total += count;
+  return total;
+}
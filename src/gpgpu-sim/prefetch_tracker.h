@@ -0,0 +1,190 @@
+// Copyright (c) 2022, Mohammadreza Saed, Yuan Hsi Chou, Lufei Liu, Tor M. Aamodt,
+// The University of British Columbia
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+// Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution. Neither the name of
+// The University of British Columbia nor the names of its contributors may be
+// used to endorse or promote products derived from this software without
+// specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef PREFETCH_TRACKER_INCLUDED
+#define PREFETCH_TRACKER_INCLUDED
+
+#include "../abstract_hardware_model.h"
+
+#include <map>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+struct prefetch_block_info {
+  unsigned mf_request_uid;
+  new_addr_type m_prefetch_request_addr;
+  new_addr_type m_block_addr; // use block addr to match entries (MSHR address)
+  unsigned prefetch_generation_time;
+  unsigned prefetch_issue_time;
+  unsigned prefetch_fill_time;
+  unsigned evict_time;
+  unsigned last_accessed_time_by_demand_load; // last access time by a non prefetch mf
+  unsigned times_accessed; // times accessed by a non prefetch mf
+  prefetch_request_effectiveness effectiveness;
+  unsigned times_classified_as_first_classification;
+  unsigned total_times_classified;
+  unsigned cycle_classified;
+  unsigned policy; // rt_prefetcher registry index of the policy that generated it
+
+  prefetch_block_info() {
+    mf_request_uid = 0;
+    m_prefetch_request_addr = 0;
+    m_block_addr = 0;
+    prefetch_generation_time = 0;
+    prefetch_issue_time = 0;
+    prefetch_fill_time = 0;
+    evict_time = 0;
+    last_accessed_time_by_demand_load = 0;
+    times_accessed = 0;
+    effectiveness = UNCLASSIFIED;
+    times_classified_as_first_classification = 0;
+    total_times_classified = 0;
+    cycle_classified = 0;
+    policy = 0;
+  }
+};
+
+// Lifecycle of every prefetch an RT unit issued, from issue through fill,
+// demand hits and eviction from the L1. A record lives only while its
+// prefetch can still be classified: keyed by request UID while it is in
+// flight, then by the L1 line it filled (lines remember the UID of the
+// prefetch that filled each sector) until that line or sector is replaced.
+// A prefetch that never fills a line -- one that hit at issue or was merged
+// into another MSHR entry -- retires when it returns. Live state is bounded
+// by the outstanding prefetches and the L1 lines, not by the run length.
+//
+// Blocks group records by MSHR block address in issue order and keep the
+// candidates the demand classification rules pick from: the latest issued
+// prefetch still in flight and the most recently evicted one. A block is
+// dropped once it has no live records and its last evicted prefetch was
+// classified.
+//
+// Classification results are kept in running per-policy counters. A block
+// that no demand access ever classified reports its prefetches as NEVER_USED;
+// in a block that was used, the ones left unclassified are reported
+// separately, the same way the end-of-run pass over the records used to. The
+// only per-block state kept for the whole run is that usage summary.
+class rt_prefetch_tracker {
+ public:
+  rt_prefetch_tracker() : m_evicted_unused(0) {}
+
+  void issued(const prefetch_block_info &info);
+  // Undo the latest issue for block_addr after a reservation fail
+  void discard_last(new_addr_type block_addr);
+  // The prefetch returned. Retires it unless it filled an L1 line.
+  void filled(unsigned uid, new_addr_type addr, unsigned issue_time, unsigned cycle);
+  // Prefetch uid was filled into L1 line idx
+  void line_filled(unsigned uid, unsigned idx, unsigned time);
+  // The sector of L1 line idx that prefetch uid filled is being replaced.
+  // Returns false if uid is not resident on the line.
+  bool evicted(unsigned idx, unsigned uid, unsigned cycle);
+  // L1 line idx is being replaced, with every prefetch resident on it
+  void line_evicted(unsigned idx, unsigned cycle);
+
+  // Demand accesses to block_addr. A hit names the line and the prefetch that
+  // filled the sector.
+  void demand_hit(unsigned idx, unsigned fill_uid, unsigned time);
+  void demand_hit_reserved(new_addr_type block_addr, unsigned time);
+  void demand_miss(new_addr_type block_addr, unsigned time);
+  // Prefetch uid hit a line a demand load brought in
+  void prefetch_hit_demand_line(unsigned uid, unsigned time);
+
+  bool tracks(new_addr_type block_addr) const { return m_blocks.count(block_addr) != 0; }
+  // Records still in flight or resident in the L1
+  size_t live() const;
+
+  // Aggregates over every prefetch issued so far
+  unsigned prefetches(unsigned policy) const { return get(m_prefetches, policy); }
+  // TOO_LATE, LATE, TIMELY, TOO_EARLY or NEVER_USED
+  unsigned effectiveness(unsigned policy, prefetch_request_effectiveness e) const;
+  unsigned effectiveness(prefetch_request_effectiveness e) const;
+  unsigned unclassified_but_accessed(unsigned policy) const { return get(m_unclassified_accessed, policy); }
+  // Prefetched lines evicted before any demand access hit them
+  unsigned evicted_unused() const { return m_evicted_unused; }
+
+ private:
+  struct record {
+    prefetch_block_info info;
+    unsigned pos; // index in its block's issue order
+  };
+
+  struct block_usage {
+    bool accessed;                       // a demand access classified one of its prefetches
+    std::vector<unsigned> unclassified;  // per policy, until the block is accessed
+
+    block_usage() : accessed(false) {}
+  };
+
+  struct block_entry {
+    std::map<std::pair<unsigned, int>, unsigned> unfilled; // {issue time, -pos} -> uid, last is the latest issue
+    unsigned issued;                     // prefetches issued to the block, the next pos
+    unsigned last_issued_uid;
+    unsigned live;                       // records in flight or resident
+    unsigned last_evict_time;
+    unsigned last_evict_pos;
+    unsigned last_evict_policy;
+    bool last_evict_unclassified;        // the most recently evicted prefetch can still be TOO_EARLY
+    block_usage *usage;
+
+    block_entry()
+        : issued(0), last_issued_uid(0), live(0), last_evict_time(0), last_evict_pos(0),
+          last_evict_policy(0), last_evict_unclassified(false), usage(NULL) {}
+  };
+
+  typedef std::unordered_map<new_addr_type, block_entry>::iterator block_iter;
+
+  block_iter block_of(const prefetch_block_info &info);
+  void classify(prefetch_block_info &info, block_entry &block, prefetch_request_effectiveness e, unsigned time);
+  void unclassified_done(block_usage &usage, unsigned policy);
+  void set_accessed(block_usage &usage);
+  void evict(record &rec, unsigned cycle);
+  void retire(record &rec);
+
+  static unsigned get(const std::vector<unsigned> &counts, unsigned policy) {
+    return policy < counts.size() ? counts[policy] : 0;
+  }
+  static unsigned &slot(std::vector<unsigned> &counts, unsigned policy) {
+    if (policy >= counts.size()) counts.resize(policy + 1, 0);
+    return counts[policy];
+  }
+
+  std::unordered_map<unsigned, record> m_in_flight;           // request uid -> record
+  std::unordered_map<unsigned, std::vector<record> > m_lines; // L1 line -> records resident on it
+  std::unordered_map<new_addr_type, block_entry> m_blocks;    // MSHR block address -> its live prefetches
+  std::unordered_map<new_addr_type, block_usage> m_usage;     // MSHR block address -> usage, for the run
+
+  std::vector<unsigned> m_prefetches;             // per policy
+  std::vector<unsigned> m_classified[NEVER_USED]; // per effectiveness, per policy
+  std::vector<unsigned> m_unclassified_accessed;  // unclassified, in a block that was used
+  std::vector<unsigned> m_unclassified_unused;    // unclassified, in a block never used
+  unsigned m_evicted_unused;
+};
+
+#endif
@@ -1,6 +1,12 @@
 #include "ray_coherency_engine.h"
 #include "../../libcuda/gpgpu_context.h"
 
+#include <algorithm>
+
+#define COHERENCE_POOL_TABLE_MIN_SIZE 64
+
+const unsigned ray_coherence_engine::NO_PACKET;
+
 
 ray_coherence_engine::ray_coherence_engine(unsigned sid, struct ray_coherence_config config, coherence_stats *stats, shader_core_ctx *core) {
   m_core = core;
@@ -11,6 +17,16 @@ ray_coherence_engine::ray_coherence_engine(unsigned sid, struct ray_coherence_co
   m_stats = stats;
   m_schedule_packet_id = 0;
 
+  m_total_rays = 0;
+  m_num_ray_pool_rays = 0;
+  m_num_scheduled_rays = 0;
+  m_last_insertion_cycle = 0;
+
+  m_pool_table.assign(COHERENCE_POOL_TABLE_MIN_SIZE, 0);
+  m_active_pool_packets = 0;
+  m_size_buckets.resize(1);
+  m_largest_bucket = 0;
+
   m_scheduled_packets.resize(m_config.max_packets);
 }
 
@@ -20,11 +36,92 @@ void ray_coherence_engine::set_world(float3 min, float3 max) {
   world_max = max;
 }
 
-void ray_coherence_engine::insert(warp_inst_t inst) {
+unsigned ray_coherence_engine::alloc_ray(const coherence_ray &ray) {
+  if (m_free_rays.empty()) {
+    m_rays.push_back(ray);
+    return m_rays.size() - 1;
+  }
+  unsigned index = m_free_rays.back();
+  m_free_rays.pop_back();
+  m_rays[index] = ray;
+  return index;
+}
+
+void ray_coherence_engine::free_ray(unsigned index) {
+  m_rays[index].RT_mem_accesses.clear();
+  m_free_rays.push_back(index);
+}
+
+static inline unsigned pool_table_slot(ray_hash hash, unsigned mask) {
+  // Hashes are narrow bit fields, spread them over the table
+  return (unsigned)((hash * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+}
+
+unsigned ray_coherence_engine::find_pool_packet(ray_hash hash) const {
+  unsigned mask = m_pool_table.size() - 1;
+  for (unsigned slot = pool_table_slot(hash, mask); m_pool_table[slot] != 0; slot = (slot + 1) & mask) {
+    unsigned packet = m_pool_table[slot] - 1;
+    if (m_pool_packets[packet].hash == hash) return packet;
+  }
+  return NO_PACKET;
+}
+
+void ray_coherence_engine::grow_pool_table() {
+  m_pool_table.assign(m_pool_table.size() * 2, 0);
+  unsigned mask = m_pool_table.size() - 1;
+  for (unsigned packet = 0; packet < m_pool_packets.size(); packet++) {
+    unsigned slot = pool_table_slot(m_pool_packets[packet].hash, mask);
+    while (m_pool_table[slot] != 0) slot = (slot + 1) & mask;
+    m_pool_table[slot] = packet + 1;
+  }
+}
+
+unsigned ray_coherence_engine::get_pool_packet(ray_hash hash) {
+  unsigned packet = find_pool_packet(hash);
+  if (packet != NO_PACKET) return packet;
+
+  COHERENCE_DPRINTF("Shader %d: New coherence packet created for hash 0x%llx\n", m_sid, hash);
+  packet = m_pool_packets.size();
+  pool_packet new_packet;
+  new_packet.hash = hash;
+  new_packet.ready_rays = 0;
+  m_pool_packets.push_back(new_packet);
+  m_stats->total_packets++;
+
+  // Keep the table at most half full
+  if (m_pool_packets.size() * 2 > m_pool_table.size()) {
+    grow_pool_table();
+  }
+  else {
+    unsigned mask = m_pool_table.size() - 1;
+    unsigned slot = pool_table_slot(hash, mask);
+    while (m_pool_table[slot] != 0) slot = (slot + 1) & mask;
+    m_pool_table[slot] = packet + 1;
+  }
+  return packet;
+}
+
+// Move a pool packet to the bucket of its current size
+void ray_coherence_engine::resize_pool_packet(unsigned packet, unsigned old_size) {
+  pool_packet &entry = m_pool_packets[packet];
+  unsigned new_size = entry.rays.size();
+  if (new_size == old_size) return;
+
+  std::pair<ray_hash, unsigned> key(entry.hash, packet);
+  if (old_size > 0) m_size_buckets[old_size].erase(key);
+  if (new_size > 0) {
+    if (new_size >= m_size_buckets.size()) m_size_buckets.resize(new_size + 1);
+    m_size_buckets[new_size].insert(key);
+    if (new_size > m_largest_bucket) m_largest_bucket = new_size;
+  }
+  while (m_largest_bucket > 0 && m_size_buckets[m_largest_bucket].empty()) m_largest_bucket--;
+}
+
+void ray_coherence_engine::insert(warp_inst_t &inst) {
   assert(!inst.empty());
 
   m_last_insertion_cycle = GPGPU_Context()->the_gpgpusim->g_the_gpu->gpu_tot_sim_cycle + GPGPU_Context()->the_gpgpusim->g_the_gpu->gpu_sim_cycle;
-  COHERENCE_DPRINTF("Shader %d: New warp inserted (%ld)\n", m_sid, m_last_insertion_cycle);
+  COHERENCE_DPRINTF("Shader %d: New warp inserted (%llu)\n", m_sid, m_last_insertion_cycle);
   
   unsigned num_rays = 0;
 
@@ -33,7 +130,8 @@ void ray_coherence_engine::insert(warp_inst_t inst) {
     if (inst.rt_mem_accesses_empty(i)) continue;
 
     // Create ray
-    coherence_ray ray;
+    unsigned index = alloc_ray(coherence_ray());
+    coherence_ray &ray = m_rays[index];
     ray.origin_thread_id = i;
     ray.origin_warp_uid = inst.get_uid();
     ray.ray_properties = inst.get_thread_info(i).ray_properties;
@@ -44,14 +142,17 @@ void ray_coherence_engine::insert(warp_inst_t inst) {
     ray_hash hash = get_ray_hash(ray.ray_properties);
 
     // Add ray to pool
-    if (m_ray_pool.find(hash) == m_ray_pool.end()) {
-      COHERENCE_DPRINTF("Shader %d: New coherence packet created for hash 0x%x\n", m_sid, hash);
-      coherence_packet packet;
-      m_ray_pool[hash] = packet;
-      m_stats->total_packets++;
+    unsigned packet = get_pool_packet(hash);
+    pool_packet &entry = m_pool_packets[packet];
+    entry.rays.push_back(index);
+    resize_pool_packet(packet, entry.rays.size() - 1);
+
+    // Pool rays are not touched until they are scheduled, so readiness only changes here
+    if (is_ready(ray)) {
+      if (entry.ready_rays == 0) m_active_pool_packets++;
+      entry.ready_rays++;
     }
 
-    m_ray_pool[hash].push_back(ray);
     m_total_rays++;
     m_stats->total_rays++;
     num_rays++;
@@ -64,39 +165,38 @@ void ray_coherence_engine::insert(warp_inst_t inst) {
   }
 }
 
-bool ray_coherence_engine::is_empty(coherence_packet packet) {
-  for (auto it=packet.cbegin(); it!=packet.cend(); it++) {
-    coherence_ray ray = *it;
-    if (!ray.empty()) {
+bool ray_coherence_engine::is_ready(const coherence_ray &ray) const {
+  return !ray.RT_mem_accesses.empty() && ray.RT_mem_accesses.front().status == RT_MEM_UNMARKED && ray.latency_delay == 0;
+}
+
+bool ray_coherence_engine::is_empty(const coherence_packet &packet) const {
+  for (unsigned index : packet) {
+    if (!m_rays[index].RT_mem_accesses.empty()) {
       return false;
     }
   }
   return true;
 }
 
-bool ray_coherence_engine::is_stalled() {
+bool ray_coherence_engine::is_stalled() const {
   // Check all the coherence packets
-  for (auto i=m_scheduled_packets.cbegin(); i!=m_scheduled_packets.cend(); i++) {
-    coherence_packet packet = *i;
+  for (const coherence_packet &packet : m_scheduled_packets) {
     if (!is_stalled(packet)) return false;
   }
   // Stalled
   return true;
 }
 
-bool ray_coherence_engine::is_stalled(const coherence_packet packet) {
+bool ray_coherence_engine::is_stalled(const coherence_packet &packet) const {
   // Check all the rays
-  for (auto it=packet.cbegin(); it!=packet.cend(); it++) {
-    coherence_ray ray = *it;
-    if (!ray.empty()) {
-      if (ray.next_status() == RT_MEM_UNMARKED && ray.latency_delay == 0) return false;
-    }
+  for (unsigned index : packet) {
+    if (is_ready(m_rays[index])) return false;
   }
   // Stalled
   return true;
 }
 
-bool ray_coherence_engine::check_scheduled() {
+bool ray_coherence_engine::check_scheduled() const {
   for (unsigned i=0; i<m_config.max_packets; i++) {
     if (!m_scheduled_packets[i].empty()) return true;
   }
@@ -104,7 +204,7 @@ bool ray_coherence_engine::check_scheduled() {
   return false;
 }
 
-bool ray_coherence_engine::scheduled_full() {
+bool ray_coherence_engine::scheduled_full() const {
   for (unsigned i=0; i<m_config.max_packets; i++) {
     if (m_scheduled_packets[i].empty()) return false;
   }
@@ -141,36 +241,33 @@ void ray_coherence_engine::cycle() {
   if (m_active) {
     m_stats->active_cycles++;
 
-    // Check all the coherence packets
-    unsigned active_packets = 0;
-    for (auto i=m_ray_pool.cbegin(); i!=m_ray_pool.cend(); i++) {
-      ray_hash hash = i->first;
-      coherence_packet packet = i->second;
-      if (!is_stalled(packet) && !is_empty(packet)) {
-        active_packets++;
-      }
-    }
-    m_stats->average_stat(coherence_stats_type::ACTIVE_PACKETS, active_packets);
+    // Pool packets that are neither stalled nor empty
+    m_stats->average_stat(coherence_stats_type::ACTIVE_PACKETS, m_active_pool_packets);
 
     // Schedule packets
-    if (m_num_ray_pool_rays > 0) {
-      for (unsigned i=0; i<m_config.max_packets; i++) {
-        // If there is an empty packet, fill it
-        if (m_scheduled_packets[i].empty()) {
-          // Find largest packet
-          ray_hash hash;
-          coherence_packet *selected_packet = get_largest_packet(hash);
-          COHERENCE_DPRINTF("Shader %d: Scheduling new packet [%d] with 0x%x\n", m_sid, i, hash);
-
-          // Move rays (schedule)
-          for (unsigned r=0; r<m_config.warp_size; r++) {
-            if (selected_packet->empty()) break;
-            m_scheduled_packets[i].push_back(selected_packet->front());
-            selected_packet->pop_front();
-            m_num_scheduled_rays++;
-            m_num_ray_pool_rays--;
+    for (unsigned i=0; i<m_config.max_packets && m_num_ray_pool_rays > 0; i++) {
+      // If there is an empty packet, fill it
+      if (m_scheduled_packets[i].empty()) {
+        // Find largest packet
+        pool_packet *selected_packet = get_largest_packet();
+        unsigned packet = selected_packet - m_pool_packets.data();
+        unsigned old_size = selected_packet->rays.size();
+        COHERENCE_DPRINTF("Shader %d: Scheduling new packet [%d] with 0x%llx\n", m_sid, i, selected_packet->hash);
+
+        // Move rays (schedule)
+        for (unsigned r=0; r<m_config.warp_size; r++) {
+          if (selected_packet->rays.empty()) break;
+          unsigned index = selected_packet->rays.front();
+          if (is_ready(m_rays[index])) {
+            selected_packet->ready_rays--;
+            if (selected_packet->ready_rays == 0) m_active_pool_packets--;
           }
+          m_scheduled_packets[i].push_back(index);
+          selected_packet->rays.pop_front();
+          m_num_scheduled_rays++;
+          m_num_ray_pool_rays--;
         }
+        resize_pool_packet(packet, old_size);
       }
     }
 
@@ -179,17 +276,11 @@ void ray_coherence_engine::cycle() {
   assert(m_num_ray_pool_rays + m_num_scheduled_rays == m_total_rays);
 }
 
-coherence_packet * ray_coherence_engine::get_largest_packet(ray_hash &hash) {
-  // Find the largest coherence packet
-  unsigned largest_packet = 0;
-  for (auto it=m_ray_pool.cbegin(); it!=m_ray_pool.cend(); it++) {
-    if (it->second.size() > largest_packet) {
-      hash = it->first;
-      largest_packet = it->second.size();
-    }
-  }
-
-  return &m_ray_pool[hash];
+ray_coherence_engine::pool_packet * ray_coherence_engine::get_largest_packet() {
+  // Largest coherence packet, lowest hash on ties
+  assert(m_largest_bucket > 0);
+  unsigned packet = m_size_buckets[m_largest_bucket].begin()->second;
+  return &m_pool_packets[packet];
 }
 
 unsigned ray_coherence_engine::schedule_next_warp() {
@@ -200,34 +291,37 @@ unsigned ray_coherence_engine::schedule_next_warp() {
     m_schedule_packet_id = (m_schedule_packet_id + 1) % m_config.max_packets;
   }
   COHERENCE_DPRINTF("Shader %d: Scheduling next access (packet %d ", m_sid, m_schedule_packet_id);
-  coherence_packet &selected_packet = m_scheduled_packets[m_schedule_packet_id];
+  const coherence_packet &selected_packet = m_scheduled_packets[m_schedule_packet_id];
 
   // Choose the most common request
-  // map (addr, size)->occurrences
-  std::map<addr_size_pair, unsigned> requests;
+  // (addr, size)->occurrences, at most a warp's worth so a flat list is enough
+  std::vector<std::pair<addr_size_pair, unsigned> > requests;
   // Gather all the addresses
-  for (auto it=selected_packet.cbegin(); it!=selected_packet.cend(); it++) {
-    coherence_ray ray = *it;
+  for (unsigned index : selected_packet) {
+    const coherence_ray &ray = m_rays[index];
 
-    if (!ray.empty()) {
+    if (!ray.RT_mem_accesses.empty()) {
       // Check if address is already in progress or ray is not ready yet
-      if (ray.next_status() != RT_MEM_AWAITING && ray.latency_delay == 0) {
-        addr_size_pair request = addr_size_pair(ray.next_access().address, ray.next_access().size);
-        if (requests.find(request) == requests.end()) {
-          requests[request] = 0;
+      const RTMemoryTransactionRecord &next = ray.RT_mem_accesses.front();
+      if (next.status != RT_MEM_AWAITING && ray.latency_delay == 0) {
+        addr_size_pair request = addr_size_pair(next.address, next.size);
+        unsigned r = 0;
+        while (r < requests.size() && requests[r].first != request) r++;
+        if (r == requests.size()) {
+          requests.push_back(std::make_pair(request, 0));
         }
-        requests[request]++;
+        requests[r].second++;
       }
     }
   }
 
   assert(!requests.empty());
 
-  // Find the most common
+  // Find the most common, lowest (addr, size) on ties
   unsigned occurrences = 0;
   addr_size_pair next_request;
   for (auto it=requests.cbegin(); it!=requests.cend(); it++) {
-    if (it->second > occurrences) {
+    if (it->second > occurrences || (it->second == occurrences && it->first < next_request)) {
       occurrences = it->second;
       next_request = it->first;
     }
@@ -235,17 +329,18 @@ unsigned ray_coherence_engine::schedule_next_warp() {
 
   m_stats->average_stat(coherence_stats_type::COALESCED_REQUESTS, occurrences);
 
-  COHERENCE_DPRINTF("addr 0x%x size %d ", next_request.first, next_request.second);
+  COHERENCE_DPRINTF("addr 0x%llx size %d ", next_request.first, next_request.second);
 
 
   // Find thread
-  for (auto it=selected_packet.cbegin(); it!=selected_packet.cend(); it++) {
-    coherence_ray ray = *it;
-    if (!ray.empty() && ray.latency_delay == 0) {
-      if (ray.next_access().address == next_request.first && ray.next_access().size == next_request.second) {
+  for (unsigned index : selected_packet) {
+    const coherence_ray &ray = m_rays[index];
+    if (!ray.RT_mem_accesses.empty() && ray.latency_delay == 0) {
+      const RTMemoryTransactionRecord &next = ray.RT_mem_accesses.front();
+      if (next.address == next_request.first && next.size == next_request.second) {
         m_active_thread = ray.origin_thread_id;
         m_active_warp = ray.origin_warp_uid;
-        m_active_record = ray.next_access();
+        m_active_record = next;
 
         COHERENCE_DPRINTF("warp %d thread %d)\n", m_active_warp, m_active_thread);
         return m_active_warp;
@@ -255,10 +350,18 @@ unsigned ray_coherence_engine::schedule_next_warp() {
   assert(0);
 }
 
+void ray_coherence_engine::add_mshr_entry(new_addr_type addr, unsigned packet_id) {
+  COHERENCE_DPRINTF("Shader %d: Inserting MSHR entry for packet %d at addr 0x%llx\n", m_sid, packet_id, addr);
+  std::vector<unsigned> &packets = m_request_mshr[addr];
+  auto it = std::lower_bound(packets.begin(), packets.end(), packet_id);
+  if (it == packets.end() || *it != packet_id) packets.insert(it, packet_id);
+}
+
 RTMemoryTransactionRecord ray_coherence_engine::get_next_access() {
   coherence_packet &selected_packet = m_scheduled_packets[m_schedule_packet_id];
   // Mark memory record status
-  for (coherence_ray &ray : selected_packet) {
+  for (unsigned index : selected_packet) {
+    coherence_ray &ray = m_rays[index];
     if (!ray.empty()) {
       if (ray.next_addr() == m_active_record.address &&
           ray.next_access().size == m_active_record.size &&
@@ -270,24 +373,14 @@ RTMemoryTransactionRecord ray_coherence_engine::get_next_access() {
   }
 
   // Mark request as sent
-  if (m_request_mshr.find(m_active_record.address) == m_request_mshr.end()) {
-    std::set<unsigned> outstanding_packets;
-    m_request_mshr[m_active_record.address] = outstanding_packets;
-  }
-  COHERENCE_DPRINTF("Shader %d: Inserting MSHR entry for packet %d at addr 0x%x\n", m_sid, m_schedule_packet_id, m_active_record.address);
-  m_request_mshr[m_active_record.address].insert(m_schedule_packet_id);
+  add_mshr_entry(m_active_record.address, m_schedule_packet_id);
 
   // Create MSHR for chunks
   if (m_active_record.size > 32) {
     COHERENCE_DPRINTF("Shader %d: Memory request > 32B. Inserting MSHR entries\n", m_sid);
     // Create the memory chunks and push to mem_access_q
     for (unsigned i=1; i<((m_active_record.size+31)/32); i++) {
-      if (m_request_mshr.find(m_active_record.address + (i * 32)) == m_request_mshr.end()) {
-        std::set<unsigned> outstanding_packets;
-        m_request_mshr[m_active_record.address + (i * 32)] = outstanding_packets;
-      }
-      COHERENCE_DPRINTF("Shader %d: Inserting MSHR entry for packet %d at addr 0x%x\n", m_sid, m_schedule_packet_id, m_active_record.address + (i * 32));
-      m_request_mshr[m_active_record.address + (i * 32)].insert(m_schedule_packet_id);
+      add_mshr_entry(m_active_record.address + (i * 32), m_schedule_packet_id);
     }
   }
 
@@ -299,33 +392,37 @@ void ray_coherence_engine::undo_access(new_addr_type addr) {
   // Assume that this was the most recent request
   assert(m_active_record.address == addr);
   
-  for (coherence_ray &ray : selected_packet) {
+  for (unsigned index : selected_packet) {
+    coherence_ray &ray = m_rays[index];
     if (!ray.empty()) {
       if (ray.next_addr() == m_active_record.address &&
           ray.next_access().size == m_active_record.size &&
           ray.RT_mem_accesses.front().status == RT_MEM_AWAITING) {
         ray.RT_mem_accesses.front().status = RT_MEM_UNMARKED;
-        COHERENCE_DPRINTF("Shader %d: Undo mem awaiting for warp &d thread %d\n", m_sid, ray.origin_warp_uid, ray.origin_thread_id);
+        COHERENCE_DPRINTF("Shader %d: Undo mem awaiting for warp %d thread %d\n", m_sid, ray.origin_warp_uid, ray.origin_thread_id);
       }
     }
   }
 
   // Remove the most recent hash from the MSHR
-  assert(m_request_mshr.find(addr) != m_request_mshr.end());
-  assert(m_request_mshr[addr].erase(m_schedule_packet_id) > 0);
-  COHERENCE_DPRINTF("Shader %d: Undoing MSHR entry for packet %d at addr 0x%x\n", m_sid, m_schedule_packet_id, addr);
+  auto entry = m_request_mshr.find(addr);
+  assert(entry != m_request_mshr.end());
+  std::vector<unsigned> &packets = entry->second;
+  auto it = std::lower_bound(packets.begin(), packets.end(), m_schedule_packet_id);
+  assert(it != packets.end() && *it == m_schedule_packet_id);
+  packets.erase(it);
+  COHERENCE_DPRINTF("Shader %d: Undoing MSHR entry for packet %d at addr 0x%llx\n", m_sid, m_schedule_packet_id, addr);
 }
 
 void ray_coherence_engine::process_response(mem_fetch *mf, std::map<unsigned, warp_inst_t *> &m_current_warps, warp_inst_t *pipe_reg) {
   new_addr_type uncoalesced_addr = mf->get_uncoalesced_addr();
   new_addr_type uncoalesced_base_addr = mf->get_uncoalesced_base_addr();
-  COHERENCE_DPRINTF("Shader %d: Processing memory response for addr 0x%x\n", m_sid, uncoalesced_addr);
+  COHERENCE_DPRINTF("Shader %d: Processing memory response for addr 0x%llx\n", m_sid, uncoalesced_addr);
 
-  unsigned found = 0;
-  
-  if (m_request_mshr.find(uncoalesced_addr) != m_request_mshr.end()) {
-    std::set<unsigned> packets = m_request_mshr[uncoalesced_addr];
-    COHERENCE_DPRINTF("Shader %d: Found %d MSHR ray coherency packets for addr 0x%x\n", m_sid, packets.size(), uncoalesced_addr);
+  auto entry = m_request_mshr.find(uncoalesced_addr);
+  if (entry != m_request_mshr.end()) {
+    const std::vector<unsigned> &packets = entry->second;
+    COHERENCE_DPRINTF("Shader %d: Found %zu MSHR ray coherency packets for addr 0x%llx\n", m_sid, packets.size(), uncoalesced_addr);
 
     // Mark memory response for all hashes
     for (unsigned p : packets) {
@@ -333,7 +430,8 @@ void ray_coherence_engine::process_response(mem_fetch *mf, std::map<unsigned, wa
       coherence_packet &packet = m_scheduled_packets[p];
       
       // Go through each ray in the packet
-      for (coherence_ray &ray : packet) {
+      for (unsigned index : packet) {
+        coherence_ray &ray = m_rays[index];
         if (!ray.empty() && ray.latency_delay == 0) {
           unsigned thread_id = ray.origin_thread_id;
           unsigned warp_uid = ray.origin_warp_uid;
@@ -358,35 +456,31 @@ void ray_coherence_engine::process_response(mem_fetch *mf, std::map<unsigned, wa
     }
 
     // Remove address from MSHR 
-    m_request_mshr.erase(uncoalesced_addr);
+    m_request_mshr.erase(entry);
   }
   if (is_stalled()) m_active = false;
 }
 
 void ray_coherence_engine::dec_thread_latency() {
   for (unsigned i=0; i<m_config.max_packets; i++) {
-    unsigned index = 0;
-    std::deque<unsigned> index_list;
     coherence_packet &packet = m_scheduled_packets[i];
-    for (coherence_ray &ray : packet) {
+
+    // Compact the packet in place, dropping completed rays
+    unsigned kept = 0;
+    for (unsigned r=0; r<packet.size(); r++) {
+      unsigned index = packet[r];
+      coherence_ray &ray = m_rays[index];
       if (ray.latency_delay > 0) ray.latency_delay--;
       else if (ray.empty()) {
         COHERENCE_DPRINTF("Shader %d: Ray (w%d:t%d) complete!\n", m_sid, ray.origin_warp_uid, ray.origin_thread_id);
-        index_list.push_back(index);
+        free_ray(index);
+        m_num_scheduled_rays--;
+        m_total_rays--;
+        continue;
       }
-      index++;
-    }
-
-    // Delete completed rays
-    index = 0;
-    for (auto iter=index_list.begin(); iter!=index_list.end(); iter++) {
-      unsigned delete_index = *iter;
-      unsigned adjusted_index = delete_index - index;
-      packet.erase(packet.begin() + adjusted_index);
-      index++;
-      m_num_scheduled_rays--;
-      m_total_rays--;
+      packet[kept++] = index;
     }
+    packet.resize(kept);
   }
 }
 
@@ -510,15 +604,42 @@ ray_hash ray_coherence_engine::get_ray_hash(const Ray &ray) {
   }
 }
 
+void ray_coherence_engine::sorted_pool_packets(std::vector<unsigned> &packets) const {
+  // Pool packets in hash order, for stable debug output
+  packets.resize(m_pool_packets.size());
+  for (unsigned i=0; i<packets.size(); i++) packets[i] = i;
+  std::sort(packets.begin(), packets.end(), [this](unsigned a, unsigned b) {
+    return m_pool_packets[a].hash < m_pool_packets[b].hash;
+  });
+}
+
+static void print_request_mshr(const std::unordered_map<new_addr_type, std::vector<unsigned> > &mshr, FILE *fout) {
+  std::vector<new_addr_type> addrs;
+  for (auto it=mshr.begin(); it!=mshr.end(); it++) addrs.push_back(it->first);
+  std::sort(addrs.begin(), addrs.end());
+
+  fprintf(fout, "Outstanding requests:\n");
+  for (new_addr_type addr : addrs) {
+    fprintf(fout, "[0x%llx]\t", addr);
+    for (unsigned i : mshr.at(addr)) {
+      fprintf(fout, "%d\t", i);
+    }
+    fprintf(fout, "\n");
+  }
+}
+
 void ray_coherence_engine::print(FILE *fout) {
   fprintf(fout, "\nRAY_COHERENCE_ENGINE: (%sactive)\n", m_active ? "" : "in");
 
   fprintf(fout, "Rays (%d/%d):\n", m_total_rays, m_num_ray_pool_rays);
-  for (auto it=m_ray_pool.begin(); it!=m_ray_pool.end(); it++) {
-    ray_hash hash = it->first;
-    fprintf(fout, "[0x%x] (%d)\t", hash, is_stalled(it->second));
-    for (coherence_ray ray : it->second) {
-      if (!ray.empty())
+  std::vector<unsigned> packets;
+  sorted_pool_packets(packets);
+  for (unsigned p : packets) {
+    const pool_packet &entry = m_pool_packets[p];
+    fprintf(fout, "[0x%llx] (%d)\t", entry.hash, is_stalled(entry.rays));
+    for (unsigned index : entry.rays) {
+      const coherence_ray &ray = m_rays[index];
+      if (!ray.RT_mem_accesses.empty())
         fprintf(fout, "w%d:t%d\t", ray.origin_warp_uid, ray.origin_thread_id);
     }
     fprintf(fout, "\n");
@@ -528,34 +649,30 @@ void ray_coherence_engine::print(FILE *fout) {
   for (unsigned i=0; i<m_config.max_packets; i++) {
     if (i == m_schedule_packet_id) fprintf(fout, "*");
     fprintf(fout, "[%d] (%d)\t", i, is_stalled(m_scheduled_packets[i]));
-    for (coherence_ray ray : m_scheduled_packets[i]) {
-      if (!ray.empty())
+    for (unsigned index : m_scheduled_packets[i]) {
+      const coherence_ray &ray = m_rays[index];
+      if (!ray.RT_mem_accesses.empty())
         fprintf(fout, "w%d:t%d\t", ray.origin_warp_uid, ray.origin_thread_id);
     }
     fprintf(fout, "\n");
   }
 
-  fprintf(fout, "Outstanding requests:\n");
-  for (auto it=m_request_mshr.begin(); it!=m_request_mshr.end(); it++) {
-    fprintf(fout, "[0x%x]\t", it->first);
-    for (unsigned i : it->second) {
-      fprintf(fout, "%d\t", i);
-    }
-    fprintf(fout, "\n");
-  }
+  print_request_mshr(m_request_mshr, fout);
 }
 
 void ray_coherence_engine::print(ray_hash &hash, FILE *fout) {
-  if (m_ray_pool.find(hash)!=m_ray_pool.end()) {
-    print(m_ray_pool[hash], fout);
+  unsigned packet = find_pool_packet(hash);
+  if (packet != NO_PACKET) {
+    print(m_pool_packets[packet].rays, fout);
   }
   else {
-    fprintf(fout, "0x%x not found!\n", hash);
+    fprintf(fout, "0x%llx not found!\n", hash);
   }
 }
 
 void ray_coherence_engine::print(coherence_packet &packet, FILE *fout) const {
-  for (coherence_ray ray : packet) {
+  for (unsigned index : packet) {
+    coherence_ray ray = m_rays[index];
     ray.print(fout);
   }
 }
@@ -564,10 +681,12 @@ void ray_coherence_engine::print_full(FILE *fout) {
   fprintf(fout, "\nRAY_COHERENCE_ENGINE: (%sactive)\n", m_active ? "" : "in");
 
   fprintf(fout, "Rays (%d):\n", m_total_rays);
-  for (auto it=m_ray_pool.begin(); it!=m_ray_pool.end(); it++) {
-    ray_hash hash = it->first;
-    fprintf(fout, "Hash [0x%x] (%s)\n", hash, is_stalled(it->second) ? "s" : " ");
-    print(it->second, fout);
+  std::vector<unsigned> packets;
+  sorted_pool_packets(packets);
+  for (unsigned p : packets) {
+    pool_packet &entry = m_pool_packets[p];
+    fprintf(fout, "Hash [0x%llx] (%s)\n", entry.hash, is_stalled(entry.rays) ? "s" : " ");
+    print(entry.rays, fout);
   }
 
   fprintf(fout, "Scheduled Packets:\n");
@@ -577,14 +696,7 @@ void ray_coherence_engine::print_full(FILE *fout) {
     print(m_scheduled_packets[i], fout);
   }
 
-  fprintf(fout, "Outstanding requests:\n");
-  for (auto it=m_request_mshr.begin(); it!=m_request_mshr.end(); it++) {
-    fprintf(fout, "[0x%x]\t", it->first);
-    for (unsigned i : it->second) {
-      fprintf(fout, "%d\t", i);
-    }
-    fprintf(fout, "\n");
-  }
+  print_request_mshr(m_request_mshr, fout);
 }
 
 void ray_coherence_engine::print_stats(FILE *fout) {
@@ -596,9 +708,9 @@ void coherence_stats::print(FILE *fout) {
   fprintf(fout, "coherence_packets = %d\n", total_packets);
   fprintf(fout, "total_rays = %d\n", total_rays);
   fprintf(fout, "max_coherence_rays = %d\n", max_rays);
-  fprintf(fout, "active_cycles = %d\n", active_cycles);
-  fprintf(fout, "stalled_cycles = %d\n", stalled_cycles);
-  fprintf(fout, "total_cycles = %d\n", total_cycles);
+  fprintf(fout, "active_cycles = %llu\n", active_cycles);
+  fprintf(fout, "stalled_cycles = %llu\n", stalled_cycles);
+  fprintf(fout, "total_cycles = %llu\n", total_cycles);
   fprintf(fout, "activate_by_rays = %d\n", activate_by_rays);
   fprintf(fout, "activate_by_timer = %d\n", activate_by_timer);
 
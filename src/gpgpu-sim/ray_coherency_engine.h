@@ -3,6 +3,8 @@
 
 #include "../abstract_hardware_model.h"
 #include <cmath>
+#include <set>
+#include <unordered_map>
 #include "vector-math.h"
 
 typedef uint64_t(*HashFunc)(const Ray&, const float3&, const float3&);
@@ -10,7 +12,7 @@ typedef uint64_t(*HashFunc)(const Ray&, const float3&, const float3&);
 
 struct {
   Ray ray_properties;
-  std::deque<RTMemoryTransactionRecord> RT_mem_accesses;
+  rt_mem_access_log RT_mem_accesses;
   unsigned origin_warp_uid;
   unsigned origin_thread_id;
   unsigned latency_delay;
@@ -21,7 +23,7 @@ struct {
   void print(FILE* fout) {
     fprintf(fout, "\t[%d:%d] [%d]- ", origin_warp_uid, origin_thread_id, latency_delay);
     for (RTMemoryTransactionRecord record : RT_mem_accesses) {
-      fprintf(fout, "0x%x (%d-%s-<%s>)\t", record.address, record.size, record.status == RT_MEM_AWAITING ? "A" : "U", record.mem_chunks.to_string().c_str()); 
+      fprintf(fout, "0x%llx (%d-%s-<%s>)\t", record.address, record.size, record.status == RT_MEM_AWAITING ? "A" : "U", record.mem_chunks.to_string().c_str()); 
     }
     fprintf(fout, "\n");
   }
@@ -40,7 +42,8 @@ struct {
 } typedef coherence_ray;
 
 typedef std::pair<new_addr_type, unsigned> addr_size_pair;
-typedef std::deque<coherence_ray> coherence_packet;
+// Indices into the engine's ray store
+typedef std::deque<unsigned> coherence_packet;
 typedef unsigned long long ray_hash;
 
 enum class coherence_stats_type {
@@ -88,7 +91,7 @@ class ray_coherence_engine {
     ~ray_coherence_engine();
     
     void cycle();
-    void insert(warp_inst_t new_warp);
+    void insert(warp_inst_t &new_warp);
     unsigned schedule_next_warp();
     RTMemoryTransactionRecord get_next_access();
     void undo_access(new_addr_type addr);
@@ -116,13 +119,36 @@ class ray_coherence_engine {
     unsigned m_num_scheduled_rays;
     unsigned long long m_last_insertion_cycle;
 
-    // map [hash]->[group of rays]
-    std::map<ray_hash, coherence_packet> m_ray_pool;
+    // Every ray in the engine, pool or scheduled. Packets refer to rays by
+    // index so moving a ray between packets never copies its access log.
+    std::deque<coherence_ray> m_rays;
+    std::vector<unsigned> m_free_rays;
+
+    static const unsigned NO_PACKET = (unsigned)-1;
+
+    // A group of rays with the same hash waiting to be scheduled
+    struct pool_packet {
+      ray_hash hash;
+      coherence_packet rays;
+      unsigned ready_rays; // rays whose next access can issue now
+    };
+
+    // Ray pool: packets are found by hash through an open addressing table
+    // (packet index + 1, 0 is a free slot) and are never removed, so the
+    // packet index of a hash stays valid.
+    std::vector<pool_packet> m_pool_packets;
+    std::vector<unsigned> m_pool_table;
+    unsigned m_active_pool_packets; // pool packets with ready rays
+
+    // Pool packets bucketed by size, for picking the largest in O(1). Within
+    // a bucket the lowest hash goes first.
+    std::vector<std::set<std::pair<ray_hash, unsigned> > > m_size_buckets;
+    unsigned m_largest_bucket;
 
     std::vector<coherence_packet> m_scheduled_packets;
 
-    // map [addr]->[set of hashes (coherence_packets)]
-    std::map<new_addr_type, std::set<unsigned> > m_request_mshr;
+    // map [addr]->[sorted scheduled packet ids]
+    std::unordered_map<new_addr_type, std::vector<unsigned> > m_request_mshr;
 
     float3 world_min;
     float3 world_max;
@@ -137,13 +163,24 @@ class ray_coherence_engine {
     unsigned m_active_thread;
     RTMemoryTransactionRecord m_active_record;
 
-    bool is_empty(coherence_packet packet);
-    bool is_stalled();
-    bool is_stalled(coherence_packet packet);
-    bool check_scheduled();
-    bool scheduled_full();
+    bool is_ready(const coherence_ray &ray) const;
+    bool is_empty(const coherence_packet &packet) const;
+    bool is_stalled() const;
+    bool is_stalled(const coherence_packet &packet) const;
+    bool check_scheduled() const;
+    bool scheduled_full() const;
+
+    unsigned alloc_ray(const coherence_ray &ray);
+    void free_ray(unsigned index);
+
+    unsigned find_pool_packet(ray_hash hash) const;
+    unsigned get_pool_packet(ray_hash hash);
+    void grow_pool_table();
+    void resize_pool_packet(unsigned packet, unsigned old_size);
+    void sorted_pool_packets(std::vector<unsigned> &packets) const;
+    void add_mshr_entry(new_addr_type addr, unsigned packet_id);
 
-    coherence_packet * get_largest_packet(ray_hash &hash);
+    pool_packet * get_largest_packet();
     unsigned long long compute_index(ray_hash hash, unsigned num_bits) const;
     ray_hash get_ray_hash(const Ray &ray);
 
@@ -0,0 +1,193 @@
+// Copyright (c) 2022, Mohammadreza Saed, Yuan Hsi Chou, Lufei Liu, Tor M. Aamodt,
+// The University of British Columbia
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+// Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution. Neither the name of
+// The University of British Columbia nor the names of its contributors may be
+// used to endorse or promote products derived from this software without
+// specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "rt_prefetch_queue.h"
+
+#include <assert.h>
+
+rt_prefetch_queue::rt_prefetch_queue() {
+  m_block_size = SECTOR_SIZE;
+  m_capacity = 32;
+  m_head = 0;
+  m_tail = 0;
+  m_live = 0;
+  m_duplicates = 0;
+  m_dropped = 0;
+  m_max_live = 0;
+  m_ring.resize(64);
+}
+
+void rt_prefetch_queue::init(unsigned block_size, unsigned capacity) {
+  assert(block_size > 0 && (block_size & (block_size - 1)) == 0);
+  m_block_size = block_size;
+  m_capacity = capacity;
+
+  // Twice the capacity, so a compaction always frees at least half the ring
+  unsigned ring_size = 64;
+  while (ring_size < 2 * capacity) ring_size <<= 1;
+  m_ring.assign(ring_size, slot());
+  clear();
+}
+
+void rt_prefetch_queue::clear() {
+  for (uint64_t seq = m_head; seq != m_tail; seq++) at(seq).valid = false;
+  m_head = 0;
+  m_tail = 0;
+  m_live = 0;
+  m_blocks.clear();
+  m_treelets.clear();
+}
+
+void rt_prefetch_queue::insert(uint64_t seq, const rt_prefetch_entry &entry) {
+  slot &s = at(seq);
+  s.entry = entry;
+  s.valid = true;
+  m_blocks[block_addr(entry.addr)] = seq;
+  if (entry.treelet != NULL) {
+    treelet_entries &treelet = m_treelets[entry.treelet];
+    treelet.live++;
+    treelet.seqs.push_back(seq);
+    if (treelet.seqs.size() > 2 * treelet.live) trim(entry.treelet, treelet);
+  }
+  m_live++;
+  if (m_live > m_max_live) m_max_live = m_live;
+}
+
+void rt_prefetch_queue::erase(uint64_t seq) {
+  slot &s = at(seq);
+  assert(s.valid);
+  s.valid = false;
+  m_blocks.erase(block_addr(s.entry.addr));
+  if (s.entry.treelet != NULL) {
+    auto it = m_treelets.find(s.entry.treelet);
+    assert(it != m_treelets.end() && it->second.live > 0);
+    if (--it->second.live == 0) m_treelets.erase(it);
+  }
+  m_live--;
+}
+
+// Drop the sequence numbers of a treelet's entries that were popped or
+// cancelled, so the list stays proportional to its live entries
+void rt_prefetch_queue::trim(uint8_t* treelet, treelet_entries &entries) {
+  unsigned kept = 0;
+  for (auto seq : entries.seqs) {
+    if (seq - m_head >= m_tail - m_head) continue;  // outside the live window
+    const slot &s = at(seq);
+    if (s.valid && s.entry.treelet == treelet) entries.seqs[kept++] = seq;
+  }
+  entries.seqs.resize(kept);
+}
+
+bool rt_prefetch_queue::can_push(const rt_prefetch_entry &entry) {
+  if (contains(entry.addr)) {
+    m_duplicates++;
+    return false;
+  }
+  if (full()) {
+    m_dropped++;
+    return false;
+  }
+  return true;
+}
+
+void rt_prefetch_queue::make_room() {
+  if (m_tail - m_head < m_ring.size()) return;
+
+  // Squeeze out the holes. There are at most m_capacity live entries, which
+  // is half the ring or less.
+  assert(m_live < m_ring.size());
+  std::vector<slot> old_ring;
+  old_ring.swap(m_ring);
+  uint64_t old_head = m_head, old_tail = m_tail;
+  size_t old_mask = old_ring.size() - 1;
+
+  m_ring.assign(old_ring.size(), slot());
+  m_head = 0;
+  m_tail = 0;
+  m_live = 0;
+  m_blocks.clear();
+  m_treelets.clear();
+  for (uint64_t seq = old_head; seq != old_tail; seq++) {
+    const slot &s = old_ring[seq & old_mask];
+    if (s.valid) insert(m_tail++, s.entry);
+  }
+}
+
+const rt_prefetch_entry &rt_prefetch_queue::front() {
+  assert(!empty());
+  while (!at(m_head).valid) m_head++;
+  return at(m_head).entry;
+}
+
+void rt_prefetch_queue::pop_front() {
+  front();
+  erase(m_head);
+  m_head++;
+  if (m_live == 0) m_head = m_tail;
+}
+
+bool rt_prefetch_queue::push_back(const rt_prefetch_entry &entry) {
+  if (!can_push(entry)) return false;
+  make_room();
+  insert(m_tail++, entry);
+  return true;
+}
+
+bool rt_prefetch_queue::push_front(const rt_prefetch_entry &entry) {
+  if (!can_push(entry)) return false;
+  make_room();
+  insert(--m_head, entry);
+  return true;
+}
+
+bool rt_prefetch_queue::cancel(new_addr_type addr) {
+  auto it = m_blocks.find(block_addr(addr));
+  if (it == m_blocks.end()) return false;
+  erase(it->second);
+  return true;
+}
+
+unsigned rt_prefetch_queue::flush_treelet(uint8_t* treelet) {
+  auto it = m_treelets.find(treelet);
+  if (it == m_treelets.end()) return 0;
+
+  // Copy out, erase() drops the map entry once the last live one goes
+  std::vector<uint64_t> seqs;
+  seqs.swap(it->second.seqs);
+
+  unsigned flushed = 0;
+  for (auto seq : seqs) {
+    if (seq - m_head >= m_tail - m_head) continue;  // outside the live window
+    slot &s = at(seq);
+    if (!s.valid || s.entry.treelet != treelet) continue;
+    erase(seq);
+    flushed++;
+  }
+  assert(m_treelets.find(treelet) == m_treelets.end());
+  return flushed;
+}
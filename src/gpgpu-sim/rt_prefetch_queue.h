@@ -0,0 +1,119 @@
+// Copyright (c) 2022, Mohammadreza Saed, Yuan Hsi Chou, Lufei Liu, Tor M. Aamodt,
+// The University of British Columbia
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+// Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution. Neither the name of
+// The University of British Columbia nor the names of its contributors may be
+// used to endorse or promote products derived from this software without
+// specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef RT_PREFETCH_QUEUE_INCLUDED
+#define RT_PREFETCH_QUEUE_INCLUDED
+
+#include "../abstract_hardware_model.h"
+
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+struct rt_prefetch_entry {
+  new_addr_type addr;         // 32B chunk to fetch
+  new_addr_type base_addr;    // node (or metadata block) the chunk belongs to
+  unsigned generation_cycle;  // when the prefetcher queued it
+  uint8_t* treelet;           // treelet root the entry was queued for, NULL if none
+};
+
+// FIFO of pending RT prefetches. Entries live in a power of two ring indexed by
+// a running sequence number and are also hashed by their MSHR block address,
+// so duplicate suppression and cancelling the prefetch a demand access made
+// redundant are O(1) instead of a scan of the queue. Entries removed from the
+// middle are left as holes and skipped when they reach the front. The queue
+// holds at most 'capacity' live entries and rejects pushes beyond that; the
+// ring is twice that size and compacted when the holes reach its end.
+class rt_prefetch_queue {
+ public:
+  rt_prefetch_queue();
+
+  // block_size: MSHR granularity (cache_config::mshr_addr), capacity: most live entries
+  void init(unsigned block_size, unsigned capacity);
+
+  bool empty() const { return m_live == 0; }
+  bool full() const { return m_live >= m_capacity; }
+  unsigned size() const { return m_live; }
+  bool contains(new_addr_type addr) const { return m_blocks.count(block_addr(addr)) != 0; }
+
+  // Oldest live entry
+  const rt_prefetch_entry &front();
+  void pop_front();
+
+  // Returns false (and drops the entry) if its block is already queued or the
+  // queue is full
+  bool push_back(const rt_prefetch_entry &entry);
+  // Put an entry that could not be issued back at the head
+  bool push_front(const rt_prefetch_entry &entry);
+
+  // Drop the queued prefetch for addr's block, returns whether there was one
+  bool cancel(new_addr_type addr);
+  // Drop every entry queued for treelet, returns how many
+  unsigned flush_treelet(uint8_t* treelet);
+  void clear();
+
+  unsigned duplicates() const { return m_duplicates; }
+  unsigned dropped() const { return m_dropped; }
+  unsigned max_size() const { return m_max_live; }
+
+ private:
+  struct slot {
+    rt_prefetch_entry entry;
+    bool valid;
+  };
+
+  new_addr_type block_addr(new_addr_type addr) const { return addr & ~(new_addr_type)(m_block_size - 1); }
+  slot &at(uint64_t seq) { return m_ring[seq & (m_ring.size() - 1)]; }
+  void insert(uint64_t seq, const rt_prefetch_entry &entry);
+  void erase(uint64_t seq);
+  bool can_push(const rt_prefetch_entry &entry);
+  void make_room();
+
+  unsigned m_block_size;
+  unsigned m_capacity;
+  std::vector<slot> m_ring;
+  uint64_t m_head;  // sequence number of the front slot
+  uint64_t m_tail;  // one past the last slot
+  unsigned m_live;
+
+  struct treelet_entries {
+    unsigned live;
+    std::vector<uint64_t> seqs;  // may include entries already popped or cancelled
+  };
+  void trim(uint8_t* treelet, treelet_entries &entries);
+
+  std::unordered_map<new_addr_type, uint64_t> m_blocks;     // block addr -> sequence number
+  std::unordered_map<uint8_t*, treelet_entries> m_treelets;
+
+  unsigned m_duplicates;
+  unsigned m_dropped;  // pushes rejected because the queue was full
+  unsigned m_max_live;
+};
+
+#endif
@@ -0,0 +1,419 @@
+// Copyright (c) 2022, Mohammadreza Saed, Yuan Hsi Chou, Lufei Liu, Tor M. Aamodt,
+// The University of British Columbia
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+// Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution. Neither the name of
+// The University of British Columbia nor the names of its contributors may be
+// used to endorse or promote products derived from this software without
+// specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "rt_prefetcher.h"
+
+#include <string.h>
+#include <map>
+
+#include "../../libcuda/gpgpu_context.h"
+#include "../cuda-sim/vulkan_ray_tracing.h"
+#include "gpu-sim.h"
+#include "shader.h"
+
+
+const char *rt_prefetcher::name() const { return policy_info(m_policy).name; }
+
+unsigned rt_prefetcher::sid() const { return m_unit->m_sid; }
+
+unsigned long long rt_prefetcher::sim_cycle() const {
+  return GPGPU_Context()->the_gpgpusim->g_the_gpu->gpu_sim_cycle;
+}
+
+unsigned long long rt_prefetcher::tot_cycle() const {
+  return m_unit->m_core->get_gpu()->gpu_sim_cycle +
+         m_unit->m_core->get_gpu()->gpu_tot_sim_cycle;
+}
+
+bool rt_prefetcher::has_warps() const { return !m_unit->m_current_warps.empty(); }
+
+const treelet_popularity &rt_prefetcher::popularity() const {
+  m_unit->sync_treelet_popularity();
+  return m_unit->m_treelet_popularity;
+}
+
+unsigned rt_prefetcher::queue_size() const { return m_unit->m_prefetch_queue.size(); }
+
+unsigned rt_prefetcher::flush_treelet(uint8_t* treelet) {
+  if (treelet == NULL) return 0;
+  return m_unit->m_prefetch_queue.flush_treelet(treelet);
+}
+
+bool rt_prefetcher::push_chunk(new_addr_type addr, new_addr_type base_addr, uint8_t* treelet) {
+  rt_prefetch_entry entry = {addr, base_addr, (unsigned)tot_cycle(), treelet};
+  return m_unit->m_prefetch_queue.push_back(entry);
+}
+
+void rt_prefetcher::queue_chunk(new_addr_type addr, new_addr_type base_addr, uint8_t* treelet) {
+  if (push_chunk(addr, base_addr, treelet)) m_unit->prefetches_added_to_queue++;
+}
+
+void rt_prefetcher::queue_node(new_addr_type addr, unsigned size, uint8_t* treelet) {
+  TOMMY_DPRINTF("Shader %u: %uB request at 0x%llx added chunks at cycle %llu ", sid(), size, addr, sim_cycle());
+  for (unsigned i=0; i<((size+31)/32); i++) {
+    queue_chunk(addr + (i * 32), addr, treelet);
+    TOMMY_DPRINTF("0x%llx, ", addr + (i * 32));
+  }
+  TOMMY_DPRINTF("\n");
+}
+
+void rt_prefetcher::queue_treelet_metadata(uint8_t* node_addr, uint8_t* treelet) {
+  new_addr_type metadata_offset = (new_addr_type)(VulkanRayTracing::treelet_addr_to_metadata_idx[node_addr] * VulkanRayTracing::per_treelet_metadata_size);
+  new_addr_type metadata_addr = (new_addr_type)(VulkanRayTracing::treelet_metadata) + metadata_offset;
+  m_unit->prefetch_metadata_added++;
+  for (unsigned i=0; i<(VulkanRayTracing::per_treelet_metadata_size/32); i++) {
+    push_chunk((new_addr_type)(metadata_addr + i * 32), metadata_addr, treelet);
+  }
+}
+
+
+// Treelet prefetchers: every cycle pick the treelet most threads' next access
+// falls in and queue (part of) it. Subclasses only decide whether and how much.
+class treelet_prefetcher : public rt_prefetcher {
+ public:
+  treelet_prefetcher(rt_unit *unit, const shader_core_config *config, unsigned policy)
+      : rt_prefetcher(unit, config, policy) {
+    m_last_prefetched_treelet = NULL;
+    m_last_prefetched_second_treelet = NULL;
+    m_last_rejected_treelet = NULL;
+    m_timestamp_of_last_treelet = 0;
+  }
+
+  virtual void cycle(rt_prefetch_phase phase);
+  virtual uint8_t* focus_treelet() const { return m_last_prefetched_treelet; }
+
+ protected:
+  struct treelet_request {
+    uint8_t* root;
+    unsigned num_nodes;  // whole treelet unless select() trims it
+    bool from_tail;      // take the last num_nodes nodes instead of the first
+  };
+
+  // Decide whether to prefetch request.root this cycle. top_treelet is its
+  // key in threads.
+  virtual bool select(rt_prefetch_phase phase, const popularity_histogram &threads,
+                      int top_treelet, treelet_request &request) = 0;
+
+  static double share(const popularity_histogram &threads, int treelet) {
+    if (threads.total() == 0) return 0.0;
+    return static_cast<double>(threads.count(treelet)) / static_cast<double>(threads.total());
+  }
+
+  uint8_t* m_last_prefetched_treelet;
+  uint8_t* m_last_prefetched_second_treelet;
+  uint8_t* m_last_rejected_treelet;
+  unsigned m_timestamp_of_last_treelet;
+
+ private:
+  void prefetch_treelet(rt_prefetch_phase phase, const treelet_request &request);
+  void prefetch_second_treelet(const popularity_histogram &threads, uint8_t* root);
+};
+
+void treelet_prefetcher::cycle(rt_prefetch_phase phase) {
+  // For each threads's first access, find the most popular treelet
+  const treelet_popularity &treelets = popularity();
+  const popularity_histogram &threads = treelets.threads();
+  int top_treelet = popularity_histogram::NO_TREELET;
+  threads.top(top_treelet);
+
+  treelet_request request;
+  request.root = treelets.root_addr(top_treelet);
+  request.num_nodes = VulkanRayTracing::flat_treelet_index.treelet_nodes(request.root).size();
+  request.from_tail = false;
+
+  // The limit study always prefetches the whole most popular treelet
+  bool submit = phase == RT_PREFETCH_TREELET_QUEUE || select(phase, threads, top_treelet, request);
+  if (submit && request.root != nullptr) prefetch_treelet(phase, request);
+
+  if (phase == RT_PREFETCH_STREAMING && m_config->prefetch_next_treelet_when_queue_empty) {
+    prefetch_second_treelet(threads, request.root);
+  }
+}
+
+void treelet_prefetcher::prefetch_treelet(rt_prefetch_phase phase, const treelet_request &request) {
+  // make sure we arent prefetching the same treelet over and over
+  if (request.root == m_last_prefetched_treelet || request.root == m_last_prefetched_second_treelet) return;
+
+  m_stats.treelet_switches++;
+  m_stats.cycles_between_treelet_switches += sim_cycle() - m_timestamp_of_last_treelet;
+  m_timestamp_of_last_treelet = sim_cycle();
+
+  // make sure the treelet wont exceed the max prefetch queue size
+  if (request.num_nodes + queue_size() > m_config->m_max_prefetch_queue_size) return;
+
+  if (m_config->m_flush_prefetch_queue_on_new_treelet && phase != RT_PREFETCH_TREELET_QUEUE) {
+    TOMMY_DPRINTF("Shader %u: Clearing prefetch queue due to new treelet\n", sid());
+    flush_treelet(m_last_prefetched_treelet);
+    flush_treelet(m_last_prefetched_second_treelet);
+  }
+
+  TOMMY_DPRINTF("Shader %u: Add Prefetching for Treelet root %p\n", sid(), request.root);
+  treelet_node_span nodes = VulkanRayTracing::flat_treelet_index.treelet_nodes(request.root);
+  unsigned begin = request.from_tail ? nodes.size() - request.num_nodes : 0;
+  unsigned end = request.from_tail ? nodes.size() : request.num_nodes;
+  for (unsigned j = begin; j < end; j++) {
+    // Load treelet metadata first so the prefetcher knows what nodes to prefetch
+    if (phase == RT_PREFETCH_STREAMING && m_config->load_treelet_metadata) {
+      queue_treelet_metadata(nodes[j].addr, request.root);
+    }
+    queue_node((new_addr_type)nodes[j].addr, nodes[j].size, request.root);
+  }
+
+  TOMMY_DPRINTF("Shader %u: Prefetch queue entries: %u\n", sid(), queue_size());
+  m_last_prefetched_treelet = request.root;
+}
+
+void treelet_prefetcher::prefetch_second_treelet(const popularity_histogram &threads, uint8_t* root) {
+  // Only once the current treelet is fully queued and the queue drained, while there are still rt warps to be processed
+  if (queue_size() != 0 || !has_warps() || threads.distinct() <= 1) return;
+  if (root == nullptr || m_last_prefetched_treelet != root) return;
+
+  int second_treelet = popularity_histogram::NO_TREELET;
+  if (!threads.top(second_treelet, popularity().key_of_root(m_last_prefetched_treelet))) return;
+  uint8_t* second_root = popularity().root_addr(second_treelet);
+  if (second_root == nullptr || second_root == m_last_prefetched_second_treelet) return;
+
+  SECOND_PREFETCH_DPRINTF("Shader %u: Add Prefetching for second treelet root %p at cycle %llu\n", sid(), second_root, sim_cycle());
+  treelet_node_span nodes = VulkanRayTracing::flat_treelet_index.treelet_nodes(second_root);
+  for (unsigned j = 0; j < nodes.size(); j++) {
+    queue_node((new_addr_type)nodes[j].addr, nodes[j].size, second_root);
+  }
+  SECOND_PREFETCH_DPRINTF("Shader %u: Prefetch queue entries: %u\n", sid(), queue_size());
+  m_last_prefetched_second_treelet = second_root;
+}
+
+
+// Heuristic 0: Always prefetch the current most popular treelet amongst all threads
+class treelet_popular_prefetcher : public treelet_prefetcher {
+ public:
+  treelet_popular_prefetcher(rt_unit *unit, const shader_core_config *config, unsigned policy)
+      : treelet_prefetcher(unit, config, policy) {}
+
+ protected:
+  virtual bool select(rt_prefetch_phase phase, const popularity_histogram &threads,
+                      int top_treelet, treelet_request &request) {
+    if (phase == RT_PREFETCH_STREAMING) {
+      // Compare to the hierarical most popular treelet to see how often they match
+      int largest_overall = popularity_histogram::NO_TREELET;
+      popularity().warps().top(largest_overall);
+      if (popularity().root_addr(largest_overall) == request.root) m_stats.matches++;
+      m_stats.comparisons++;
+    }
+    return true;
+  }
+};
+
+// Heuristic 1: Only prefetch if treelet is the most popular above a % threshold
+class treelet_threshold_prefetcher : public treelet_prefetcher {
+ public:
+  treelet_threshold_prefetcher(rt_unit *unit, const shader_core_config *config, unsigned policy)
+      : treelet_prefetcher(unit, config, policy) {}
+
+ protected:
+  virtual bool select(rt_prefetch_phase phase, const popularity_histogram &threads,
+                      int top_treelet, treelet_request &request) {
+    double percentage = share(threads, top_treelet);
+    if (percentage >= m_config->m_treelet_prefetch_threshold) {
+      if (m_last_prefetched_treelet != request.root) {
+        TOMMY_DPRINTF("Shader %u: Cycle: %llu, Treelet root %p exceeds prefetch threshold with %f (%u/%u)\n", sid(), sim_cycle(), request.root, percentage, threads.count(top_treelet), threads.total());
+      }
+      m_last_rejected_treelet = NULL;
+      return true;
+    }
+
+    if (request.root != nullptr && m_last_rejected_treelet != request.root) {
+      TOMMY_DPRINTF("Shader %u: Cycle: %llu, Treelet root %p does not exceed prefetch threshold with %f (%u/%u)\n", sid(), sim_cycle(), request.root, percentage, threads.count(top_treelet), threads.total());
+      m_last_rejected_treelet = request.root;
+    }
+    return false;
+  }
+};
+
+// Heuristic 2: Prefetch a portion of the treelet based on the popularity percentage
+class treelet_partial_prefetcher : public treelet_prefetcher {
+ public:
+  treelet_partial_prefetcher(rt_unit *unit, const shader_core_config *config, unsigned policy)
+      : treelet_prefetcher(unit, config, policy) {}
+
+ protected:
+  virtual bool select(rt_prefetch_phase phase, const popularity_histogram &threads,
+                      int top_treelet, treelet_request &request) {
+    double percentage = share(threads, top_treelet);
+    unsigned num_nodes_in_treelet = request.num_nodes;
+    request.num_nodes = static_cast<unsigned>((static_cast<double>(num_nodes_in_treelet) * percentage) + 0.5); // + 0.5 is for rounding
+    if (request.root != nullptr && m_last_prefetched_treelet != request.root) {
+      TOMMY_DPRINTF("Shader %u: Cycle: %llu, Treelet root %p popularity is %f, prefetching %u/%u nodes\n", sid(), sim_cycle(), request.root, percentage, request.num_nodes, num_nodes_in_treelet);
+    }
+    return true;
+  }
+};
+
+// Heuristic 3: Prefetch the latter part of the treelet since the first part will be handled by demand loads
+class treelet_tail_prefetcher : public treelet_prefetcher {
+ public:
+  treelet_tail_prefetcher(rt_unit *unit, const shader_core_config *config, unsigned policy)
+      : treelet_prefetcher(unit, config, policy) {}
+
+ protected:
+  virtual bool select(rt_prefetch_phase phase, const popularity_histogram &threads,
+                      int top_treelet, treelet_request &request) {
+    // The pipelined queue always prefetches the latter half
+    double percentage = phase == RT_PREFETCH_PIPELINED_QUEUE ? 0.5 : share(threads, top_treelet);
+    request.num_nodes = static_cast<unsigned>((static_cast<double>(request.num_nodes) * percentage) + 0.5); // + 0.5 is for rounding
+    request.from_tail = true;
+    return true;
+  }
+};
+
+
+// Lee MICRO 2010 Prefetcher: per warp stride table (PWS), trained on demand accesses
+class lee_micro10_prefetcher : public rt_prefetcher {
+ public:
+  lee_micro10_prefetcher(rt_unit *unit, const shader_core_config *config, unsigned policy)
+      : rt_prefetcher(unit, config, policy) {}
+
+  virtual void access_issued(warp_inst_t &inst, new_addr_type addr) {
+    // Train the PWS table on the stride from this warp's previous access
+    unsigned warp_id = inst.get_warp_id();
+    std::map<int, unsigned> &strides = m_pws_table[warp_id];
+    auto last = m_pws_last_accessed_addr.find(warp_id);
+    if (last != m_pws_last_accessed_addr.end()) {
+      int stride = addr - last->second;
+      if (strides.size() < 32 || strides.count(stride)) strides[stride]++;
+    }
+    m_pws_last_accessed_addr[warp_id] = addr;
+
+    // Find largest stride for this warp
+    int largest_stride = 0;
+    unsigned largest_stride_count = 0;
+    for (auto warp_stride_table : strides) {
+      if (warp_stride_table.second > largest_stride_count) {
+        largest_stride = warp_stride_table.first;
+        largest_stride_count = warp_stride_table.second;
+      }
+    }
+
+    // Nothing to predict until the warp has a stride
+    if (largest_stride_count == 0) return;
+
+    // Generate Prefetch
+    new_addr_type prefetch_addr = addr + largest_stride;
+
+    // Add to Prefetch Queue
+    if (queue_size() < m_config->m_max_prefetch_queue_size) {
+      for (unsigned i=0; i<2; i++) {
+        queue_chunk((new_addr_type)(prefetch_addr + i * 32), (new_addr_type)prefetch_addr);
+        TOMMY_DPRINTF("0x%llx, ", (new_addr_type)prefetch_addr + i * 32);
+      }
+    }
+  }
+
+ private:
+  std::map<unsigned, std::map<int, unsigned>> m_pws_table; // {warp id, {stride, count}}}
+  std::map<unsigned, new_addr_type> m_pws_last_accessed_addr; // {warp id, last_accessed_addr}
+  std::map<new_addr_type, int> m_gs_table; // {load addr, stride}
+  std::map<unsigned, std::map<new_addr_type, std::map<int, unsigned>>> m_ip_table; // {warp id, {load addr, {stride, count}}}
+};
+
+
+template <class T>
+static rt_prefetcher *create_policy(rt_unit *unit, const shader_core_config *config, unsigned policy) {
+  return new T(unit, config, policy);
+}
+
+// Policies selectable with -rt_prefetcher. To evaluate a new policy, derive
+// from rt_prefetcher (or treelet_prefetcher) and add a line here.
+static const rt_prefetcher_policy rt_prefetcher_policies[] = {
+  {"none", "no RT prefetching", -1, false, NULL},
+  {"treelet_popular", "prefetch the treelet most threads access next (treelet_prefetch_heuristic 0)", 0, false, create_policy<treelet_popular_prefetcher>},
+  {"treelet_threshold", "prefetch the most popular treelet once its share reaches treelet_prefetch_threshold (heuristic 1)", 1, false, create_policy<treelet_threshold_prefetcher>},
+  {"treelet_partial", "prefetch the first part of the most popular treelet, sized by its share (heuristic 2)", 2, false, create_policy<treelet_partial_prefetcher>},
+  {"treelet_tail", "prefetch the last part of the most popular treelet, leaving the head to demand loads (heuristic 3)", 3, false, create_policy<treelet_tail_prefetcher>},
+  {"lee_micro10", "per warp stride prefetcher from Lee et al. MICRO 2010", -1, true, create_policy<lee_micro10_prefetcher>},
+};
+
+unsigned rt_prefetcher::num_policies() {
+  return sizeof(rt_prefetcher_policies) / sizeof(rt_prefetcher_policies[0]);
+}
+
+const rt_prefetcher_policy &rt_prefetcher::policy_info(unsigned policy) {
+  assert(policy < num_policies());
+  return rt_prefetcher_policies[policy];
+}
+
+int rt_prefetcher::find_policy(const char *name) {
+  for (unsigned i = 0; i < num_policies(); i++) {
+    if (strcmp(rt_prefetcher_policies[i].name, name) == 0) return i;
+  }
+  return -1;
+}
+
+void rt_prefetcher::configure(shader_core_config &config) {
+  int policy = find_policy("none");
+
+  if (config.m_rt_prefetcher_name != NULL && config.m_rt_prefetcher_name[0] != '\0') {
+    policy = find_policy(config.m_rt_prefetcher_name);
+    if (policy < 0) {
+      printf("GPGPU-Sim uArch: error: unknown -rt_prefetcher %s, available policies:\n", config.m_rt_prefetcher_name);
+      for (unsigned i = 0; i < num_policies(); i++) {
+        printf("\t%-20s %s\n", rt_prefetcher_policies[i].name, rt_prefetcher_policies[i].description);
+      }
+      abort();
+    }
+  }
+  else if (config.m_treelet_prefetch) {
+    // Legacy -treelet_prefetch / -treelet_prefetch_heuristic
+    policy = -1;
+    for (unsigned i = 0; i < num_policies(); i++) {
+      if (rt_prefetcher_policies[i].treelet_heuristic == (int)config.m_treelet_prefetch_heuristic) policy = i;
+    }
+    if (policy < 0) {
+      printf("GPGPU-Sim uArch: error: unknown -treelet_prefetch_heuristic %u\n", config.m_treelet_prefetch_heuristic);
+      abort();
+    }
+    if (config.m_lee_micro_prefetcher) {
+      printf("GPGPU-Sim uArch: warning: -treelet_prefetch and -m_lee_micro_prefetcher are both set, using %s\n", rt_prefetcher_policies[policy].name);
+    }
+  }
+  else if (config.m_lee_micro_prefetcher) {
+    policy = find_policy("lee_micro10");
+  }
+
+  // Keep the legacy flags consistent, the rest of the RT unit checks them
+  const rt_prefetcher_policy &info = policy_info(policy);
+  config.m_rt_prefetcher_policy = policy;
+  config.m_treelet_prefetch = info.treelet_heuristic >= 0;
+  if (info.treelet_heuristic >= 0) config.m_treelet_prefetch_heuristic = info.treelet_heuristic;
+  config.m_lee_micro_prefetcher = info.lee_micro;
+  printf("GPGPU-Sim uArch: RT prefetcher: %s\n", info.name);
+}
+
+rt_prefetcher *rt_prefetcher::create(rt_unit *unit, const shader_core_config *config) {
+  const rt_prefetcher_policy &info = policy_info(config->m_rt_prefetcher_policy);
+  return info.create ? info.create(unit, config, config->m_rt_prefetcher_policy) : NULL;
+}
@@ -0,0 +1,140 @@
+// Copyright (c) 2022, Mohammadreza Saed, Yuan Hsi Chou, Lufei Liu, Tor M. Aamodt,
+// The University of British Columbia
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+// Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution. Neither the name of
+// The University of British Columbia nor the names of its contributors may be
+// used to endorse or promote products derived from this software without
+// specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef RT_PREFETCHER_INCLUDED
+#define RT_PREFETCHER_INCLUDED
+
+#include "../abstract_hardware_model.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+class rt_unit;
+class rt_prefetcher;
+class shader_core_config;
+class treelet_popularity;
+class mem_fetch;
+
+// Warp buffer organization the RT unit is driving the prefetcher from
+enum rt_prefetch_phase {
+  RT_PREFETCH_STREAMING = 0,    // -keep_accepting_warps
+  RT_PREFETCH_PIPELINED_QUEUE,  // -pipelined_treelet_queue
+  RT_PREFETCH_TREELET_QUEUE,    // -treelet_queue limit study
+};
+
+// One entry of the prefetch policy registry (see rt_prefetcher.cc)
+struct rt_prefetcher_policy {
+  const char *name;
+  const char *description;
+  int treelet_heuristic;  // legacy -treelet_prefetch_heuristic value, -1 if not a treelet policy
+  bool lee_micro;         // legacy -m_lee_micro_prefetcher
+  rt_prefetcher *(*create)(rt_unit *unit, const shader_core_config *config, unsigned policy);
+};
+
+struct rt_prefetcher_stats {
+  unsigned treelet_switches;
+  unsigned cycles_between_treelet_switches;
+  unsigned matches;      // heuristic 0 vs hierarchical (per warp) most popular treelet
+  unsigned comparisons;
+
+  rt_prefetcher_stats() {
+    treelet_switches = 0;
+    cycles_between_treelet_switches = 0;
+    matches = 0;
+    comparisons = 0;
+  }
+};
+
+// Prefetch policy plugged into the RT unit. The RT unit owns the prefetch
+// queue, issues its entries when there is spare bandwidth and tracks every
+// issued prefetch in prefetch_tracker (tagged with policy()), so a
+// policy only decides what to put in the queue from the hooks below.
+class rt_prefetcher {
+ public:
+  rt_prefetcher(rt_unit *unit, const shader_core_config *config, unsigned policy)
+      : m_unit(unit), m_config(config), m_policy(policy) {}
+  virtual ~rt_prefetcher() {}
+
+  // A warp entered the set of warps the RT unit is traversing
+  virtual void warp_arrived(unsigned uid, warp_inst_t &inst) {}
+  // A demand access for addr was created for inst and is about to access the cache
+  virtual void access_issued(warp_inst_t &inst, new_addr_type addr) {}
+  // A read returned from memory and was filled into the RT unit's cache
+  virtual void fill(mem_fetch *mf) {}
+  // A line filled by a prefetch was evicted from the L1
+  virtual void evicted(new_addr_type block_addr) {}
+  // Once per RT unit cycle (subject to -prefetch_delay in the streaming phase)
+  virtual void cycle(rt_prefetch_phase phase) {}
+
+  // Treelet the policy is currently prefetching, used by -treelet_scheduler
+  virtual uint8_t* focus_treelet() const { return NULL; }
+
+  unsigned policy() const { return m_policy; }
+  const char *name() const;
+  const rt_prefetcher_stats &stats() const { return m_stats; }
+
+  // Registry
+  static unsigned num_policies();
+  static const rt_prefetcher_policy &policy_info(unsigned policy);
+  static int find_policy(const char *name);
+  // Resolves -rt_prefetcher (or the legacy prefetch flags) to a policy and
+  // makes the legacy flags agree with it
+  static void configure(shader_core_config &config);
+  // NULL if the configured policy is "none"
+  static rt_prefetcher *create(rt_unit *unit, const shader_core_config *config);
+
+ protected:
+  // RT unit state policies may use
+  unsigned sid() const;
+  unsigned long long sim_cycle() const;  // gpu_sim_cycle
+  unsigned long long tot_cycle() const;  // gpu_sim_cycle + gpu_tot_sim_cycle
+  bool has_warps() const;
+  const treelet_popularity &popularity() const;
+
+  // Entries may be tagged with the treelet root they were queued for so they
+  // can be flushed together. Chunks whose block is already queued are dropped.
+  unsigned queue_size() const;
+  unsigned flush_treelet(uint8_t* treelet);
+  // Queue one 32B chunk (counted in prefetches_added_to_queue)
+  void queue_chunk(new_addr_type addr, new_addr_type base_addr, uint8_t* treelet = NULL);
+  // Queue every 32B chunk of a BVH node
+  void queue_node(new_addr_type addr, unsigned size, uint8_t* treelet = NULL);
+  // Queue the metadata of the treelet holding node_addr (-load_treelet_metadata)
+  void queue_treelet_metadata(uint8_t* node_addr, uint8_t* treelet);
+
+  rt_unit *m_unit;
+  const shader_core_config *m_config;
+  unsigned m_policy;
+  rt_prefetcher_stats m_stats;
+
+ private:
+  bool push_chunk(new_addr_type addr, new_addr_type base_addr, uint8_t* treelet);
+};
+
+#endif
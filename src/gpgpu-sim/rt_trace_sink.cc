@@ -0,0 +1,182 @@
+// Copyright (c) 2022, Mohammadreza Saed, Yuan Hsi Chou, Lufei Liu, Tor M. Aamodt,
+// The University of British Columbia
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+// Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution. Neither the name of
+// The University of British Columbia nor the names of its contributors may be
+// used to endorse or promote products derived from this software without
+// specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "rt_trace_sink.h"
+
+#include <assert.h>
+#include <string.h>
+#include "zlib.h"
+
+#define RT_TRACE_VERSION 1
+// Favour speed, the writer has to keep up with the simulator
+#define RT_TRACE_ZLIB_LEVEL 1
+
+static void put_u32(FILE *fp, uint32_t value) { fwrite(&value, sizeof(value), 1, fp); }
+
+static void put_str(FILE *fp, const char *str) {
+  uint32_t len = strlen(str);
+  put_u32(fp, len);
+  fwrite(str, 1, len, fp);
+}
+
+static void put_varint(std::vector<unsigned char> &out, unsigned long long value) {
+  while (value >= 0x80) {
+    out.push_back((unsigned char)(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back((unsigned char)value);
+}
+
+rt_trace_sink::rt_trace_sink()
+    : m_fp(NULL), m_rows_per_chunk(0), m_rows(0), m_fill(0), m_pending(NULL), m_exit(false),
+      m_bytes_written(0) {}
+
+bool rt_trace_sink::open(const std::string &path, const char *stream, const std::vector<column> &columns,
+                         unsigned rows_per_chunk) {
+  assert(!is_open() && rows_per_chunk > 0 && !columns.empty());
+  m_fp = fopen(path.c_str(), "wb");
+  if (!m_fp) return false;
+
+  m_columns = columns;
+  m_rows_per_chunk = rows_per_chunk;
+  m_rows = 0;
+  for (unsigned i = 0; i < 2; i++) {
+    m_chunks[i].values.assign((size_t)rows_per_chunk * columns.size(), 0);
+    m_chunks[i].rows = 0;
+  }
+  m_fill = 0;
+  m_pending = NULL;
+  m_exit = false;
+
+  fwrite("GPGPURTT", 1, 8, m_fp);
+  put_u32(m_fp, RT_TRACE_VERSION);
+  put_str(m_fp, stream);
+  put_u32(m_fp, columns.size());
+  for (unsigned i = 0; i < columns.size(); i++) {
+    put_u32(m_fp, columns[i].encoding);
+    put_str(m_fp, columns[i].name);
+  }
+  m_bytes_written = ftell(m_fp);
+
+  pthread_mutex_init(&m_lock, NULL);
+  pthread_cond_init(&m_cond, NULL);
+  pthread_create(&m_thread, NULL, writer_main, this);
+  return true;
+}
+
+void rt_trace_sink::submit() {
+  pthread_mutex_lock(&m_lock);
+  while (m_pending) pthread_cond_wait(&m_cond, &m_lock);
+  m_pending = &m_chunks[m_fill];
+  pthread_cond_broadcast(&m_cond);
+  pthread_mutex_unlock(&m_lock);
+
+  m_fill ^= 1;
+  m_chunks[m_fill].rows = 0;
+}
+
+void rt_trace_sink::wait_idle() {
+  pthread_mutex_lock(&m_lock);
+  while (m_pending) pthread_cond_wait(&m_cond, &m_lock);
+  pthread_mutex_unlock(&m_lock);
+}
+
+void rt_trace_sink::flush() {
+  if (!is_open()) return;
+  if (m_chunks[m_fill].rows) submit();
+  wait_idle();
+  fflush(m_fp);
+}
+
+void rt_trace_sink::close() {
+  if (!is_open()) return;
+  flush();
+
+  pthread_mutex_lock(&m_lock);
+  m_exit = true;
+  pthread_cond_broadcast(&m_cond);
+  pthread_mutex_unlock(&m_lock);
+  pthread_join(m_thread, NULL);
+  pthread_cond_destroy(&m_cond);
+  pthread_mutex_destroy(&m_lock);
+
+  fclose(m_fp);
+  m_fp = NULL;
+  m_chunks[0].values.clear();
+  m_chunks[1].values.clear();
+}
+
+void *rt_trace_sink::writer_main(void *arg) {
+  rt_trace_sink *sink = (rt_trace_sink *)arg;
+  pthread_mutex_lock(&sink->m_lock);
+  while (true) {
+    while (!sink->m_pending && !sink->m_exit) pthread_cond_wait(&sink->m_cond, &sink->m_lock);
+    if (!sink->m_pending) break;
+
+    const chunk *c = sink->m_pending;
+    pthread_mutex_unlock(&sink->m_lock);
+    sink->write_chunk(*c);
+    pthread_mutex_lock(&sink->m_lock);
+
+    sink->m_pending = NULL;
+    pthread_cond_broadcast(&sink->m_cond);
+  }
+  pthread_mutex_unlock(&sink->m_lock);
+  return NULL;
+}
+
+void rt_trace_sink::write_chunk(const chunk &c) {
+  m_encoded.clear();
+  for (unsigned col = 0; col < m_columns.size(); col++) {
+    const unsigned long long *values = &c.values[(size_t)col * m_rows_per_chunk];
+    if (m_columns[col].encoding == DELTA) {
+      unsigned long long prev = 0;
+      for (unsigned row = 0; row < c.rows; row++) {
+        long long delta = (long long)(values[row] - prev);
+        put_varint(m_encoded, ((unsigned long long)delta << 1) ^ (unsigned long long)(delta >> 63));
+        prev = values[row];
+      }
+    } else {
+      for (unsigned row = 0; row < c.rows; row++) put_varint(m_encoded, values[row]);
+    }
+  }
+
+  uLongf compressed_size = compressBound(m_encoded.size());
+  m_compressed.resize(compressed_size);
+  int status = compress2(m_compressed.data(), &compressed_size, m_encoded.data(), m_encoded.size(),
+                         RT_TRACE_ZLIB_LEVEL);
+  assert(status == Z_OK);
+  (void)status;
+
+  fwrite("RTCK", 1, 4, m_fp);
+  put_u32(m_fp, c.rows);
+  put_u32(m_fp, m_encoded.size());
+  put_u32(m_fp, compressed_size);
+  fwrite(m_compressed.data(), 1, compressed_size, m_fp);
+  m_bytes_written += 16 + compressed_size;
+}
@@ -0,0 +1,115 @@
+// Copyright (c) 2022, Mohammadreza Saed, Yuan Hsi Chou, Lufei Liu, Tor M. Aamodt,
+// The University of British Columbia
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+// Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution. Neither the name of
+// The University of British Columbia nor the names of its contributors may be
+// used to endorse or promote products derived from this software without
+// specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef RT_TRACE_SINK_INCLUDED
+#define RT_TRACE_SINK_INCLUDED
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+// Streams fixed-width event rows (e.g. RT warp issue cycles) to a binary file
+// instead of keeping them in memory for the whole run. Rows are collected
+// column by column into fixed-size chunks; a full chunk is handed to a writer
+// thread which encodes and compresses it while the next one fills, so memory
+// use is two chunks no matter how long the run is. append() only blocks if
+// the writer falls a whole chunk behind.
+//
+// File layout (little endian, read by scripts/rt_trace_reader.py):
+//   "GPGPURTT" u32 version  str stream  u32 n_columns  {u32 encoding  str name}*
+//   then chunks of  "RTCK" u32 n_rows  u32 raw_bytes  u32 zlib_bytes  data
+// where str is u32 length + bytes, and data inflates to one LEB128 varint
+// stream per column. DELTA columns store zigzag encoded differences to the
+// previous row (starting from 0 in every chunk), RAW columns the values.
+class rt_trace_sink {
+ public:
+  enum column_encoding { RAW = 0, DELTA = 1 };
+  struct column {
+    const char *name;
+    column_encoding encoding;
+  };
+
+  rt_trace_sink();
+  ~rt_trace_sink() { close(); }
+
+  // Creates path and starts the writer thread. Returns false, leaving the
+  // sink closed, if the file cannot be created.
+  bool open(const std::string &path, const char *stream, const std::vector<column> &columns,
+            unsigned rows_per_chunk);
+  bool is_open() const { return m_fp != NULL; }
+
+  // row holds one value per column
+  void append(const unsigned long long *row) {
+    chunk &c = m_chunks[m_fill];
+    for (unsigned i = 0; i < m_columns.size(); i++) c.values[i * m_rows_per_chunk + c.rows] = row[i];
+    if (++c.rows == m_rows_per_chunk) submit();
+    m_rows++;
+  }
+
+  // Writes out the partially filled chunk and waits for the writer
+  void flush();
+  void close();
+
+  unsigned long long rows() const { return m_rows; }
+  unsigned long long bytes_written() const { return m_bytes_written; }
+
+ private:
+  struct chunk {
+    std::vector<unsigned long long> values;  // column major
+    unsigned rows;
+  };
+
+  static void *writer_main(void *arg);
+  void submit();
+  void wait_idle();
+  void write_chunk(const chunk &c);
+
+  FILE *m_fp;
+  std::vector<column> m_columns;
+  unsigned m_rows_per_chunk;
+  unsigned long long m_rows;
+
+  chunk m_chunks[2];
+  unsigned m_fill;  // chunk append() writes to, the other one may be with the writer
+
+  pthread_t m_thread;
+  pthread_mutex_t m_lock;
+  pthread_cond_t m_cond;
+  const chunk *m_pending;  // handed to the writer, NULL once written
+  bool m_exit;
+  std::atomic<unsigned long long> m_bytes_written;
+
+  // Writer thread scratch
+  std::vector<unsigned char> m_encoded;
+  std::vector<unsigned char> m_compressed;
+};
+
+#endif
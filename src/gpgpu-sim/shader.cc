@@ -1947,6 +1947,41 @@ void scheduler_unit::cycle() {
     m_stats->shader_cycle_distro[2]++;  // pipeline stalled
 }
 
+bool scheduler_unit::quiet(bool &valid_inst) {
+  valid_inst = false;
+  if (!stateless_order()) return false;
+  // The warps cycle() would look at, in any order since none can issue
+  for (std::vector<shd_warp_t *>::const_iterator iter =
+           m_supervised_warps.begin();
+       iter != m_supervised_warps.end(); iter++) {
+    if ((*iter) == NULL || (*iter)->done_exit()) continue;
+    shd_warp_t &w = **iter;
+    if (w.waiting() || w.ibuffer_empty()) continue;
+    const warp_inst_t *pI = w.ibuffer_next_inst();
+    if (pI && pI->m_is_cdp && w.m_cdp_latency > 0) return false;
+    unsigned pc, rpc;
+    m_shader->get_pdom_stack_top_info(w.get_warp_id(), pI, &pc, &rpc);
+    if (pI) {
+      // a control hazard flush, or an instruction ready to issue
+      if (pc != pI->pc || !m_scoreboard->checkCollision(w.get_warp_id(), pI))
+        return false;
+      valid_inst = true;
+    } else if (w.ibuffer_next_valid()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void scheduler_unit::skip_cycles(unsigned long long cycles) {
+  bool valid_inst;
+  if (!quiet(valid_inst)) abort();
+  if (!valid_inst)
+    m_stats->shader_cycle_distro[0] += cycles;  // idle or control hazard
+  else
+    m_stats->shader_cycle_distro[1] += cycles;  // waiting for RAW hazards
+}
+
 void scheduler_unit::do_on_warp_issued(
     unsigned warp_id, unsigned num_issued,
     const std::vector<shd_warp_t *>::const_iterator &prioritized_iter) {
@@ -2219,6 +2254,17 @@ void shader_core_ctx::execute() {
     }
   }
 
+  sample_warp_mix(1);
+
+  if (m_config->model == AWARE_RECONVERGENCE) {
+    for (unsigned i = 0; i < m_warp_count; ++i) {
+      AWARE_DPRINTF("Cycling SIMT tables for Shader %d: Warp %d...\n", m_sid, i);
+      m_simt_tables[i]->cycle();
+    }
+  }
+}
+
+void shader_core_ctx::sample_warp_mix(unsigned long long cycles) {
   // Check all the warps in the shader
   unsigned rt_active_warps = m_fu[m_num_function_units-1]->active_warps();
   unsigned empty_warps = 0;
@@ -2234,15 +2280,8 @@ void shader_core_ctx::execute() {
 
   unsigned rt_ratio_bucket = rt_active_warps * 10 / (other_warps + rt_active_warps);
   unsigned active_ratio_bucket = (rt_active_warps + other_warps) * 10 / m_config->max_warps_per_shader;
-  m_stats->rt_warp_dist[rt_ratio_bucket]++;
-  m_stats->empty_warp_dist[active_ratio_bucket]++;
-
-  if (m_config->model == AWARE_RECONVERGENCE) {
-    for (unsigned i = 0; i < m_warp_count; ++i) {
-      AWARE_DPRINTF("Cycling SIMT tables for Shader %d: Warp %d...\n", m_sid, i);
-      m_simt_tables[i]->cycle();
-    }
-  }
+  m_stats->rt_warp_dist[rt_ratio_bucket] += cycles;
+  m_stats->empty_warp_dist[active_ratio_bucket] += cycles;
 }
 
 void ldst_unit::print_cache_stats(FILE *fp, unsigned &dl1_accesses,
@@ -2918,6 +2957,18 @@ void pipelined_simd_unit::cycle() {
   occupied >>= 1;
 }
 
+unsigned long long pipelined_simd_unit::quiet_cycles() {
+  if (m_dispatch_reg->empty() && !active_insts_in_pipeline) return -1;
+  return 0;
+}
+
+void pipelined_simd_unit::skip_cycles(unsigned long long cycles) {
+  if (cycles >= MAX_ALU_LATENCY)
+    occupied.reset();
+  else
+    occupied >>= cycles;
+}
+
 void pipelined_simd_unit::issue(register_set &source_reg) {
   // move_warp(m_dispatch_reg,source_reg);
   bool partition_issue =
@@ -2946,7 +2997,8 @@ rt_unit::rt_unit(mem_fetch_interface *icnt,
                      const shader_core_config *config,
                      shader_core_stats *stats,
                      unsigned sid, unsigned tpc)
-    : pipelined_simd_unit(NULL, config, (unsigned int)1, core, 0) { // rt_unit::cycle() overrides the max latency hard coded here
+    : pipelined_simd_unit(NULL, config, (unsigned int)1, core, 0), // rt_unit::cycle() overrides the max latency hard coded here
+      m_treelet_popularity(VulkanRayTracing::flat_treelet_index) {
     
   // m_memory_config = mem_config;
   m_icnt = icnt;
@@ -2971,6 +3023,10 @@ rt_unit::rt_unit(mem_fetch_interface *icnt,
   coherence_config.warp_size = config->warp_size;
   m_ray_coherence_engine = new ray_coherence_engine(sid, coherence_config, m_stats->rt_coherence_stats[sid], core);
 
+  baseline_cache *rt_cache = m_config->m_rt_use_l1d ? (baseline_cache *)L1D : (baseline_cache *)m_L0_complet;
+  m_prefetch_queue.init(rt_cache->get_cache_config().get_atom_sz(), m_config->m_max_prefetch_queue_size);
+  m_prefetcher = rt_prefetcher::create(this, config);
+
   m_mem_rc = NO_RC_FAIL;
   m_name = "RT_CORE";
   
@@ -3009,8 +3065,15 @@ unsigned rt_unit::active_warps() {
   return warp_ids.size();
 }
 
-void rt_unit::sort_mem_accesses(std::deque<RTMemoryTransactionRecord> &mem_accesses, std::map<uint8_t*, int> node_access_counts_per_treelet) {
-  std::deque<RTMemoryTransactionRecord> sorted_mem_accesses;
+// Picks up next-access changes from responses processed since the last call
+void rt_unit::sync_treelet_popularity() {
+  for (auto it=m_current_warps.begin(); it!=m_current_warps.end(); it++) {
+    m_treelet_popularity.warp_updated(it->first, it->second);
+  }
+}
+
+void rt_unit::sort_mem_accesses(rt_mem_access_log &mem_accesses, const std::map<uint8_t*, int> &node_access_counts_per_treelet) {
+  rt_mem_access_log sorted_mem_accesses;
   // Labels each memory access to what treelet it belongs to
   std::deque< std::pair<new_addr_type, uint8_t*> > root_tags; // pair<memory access, what treelet the mem access belongs to>
   for (auto mem_access : mem_accesses) {
@@ -3043,7 +3106,7 @@ void rt_unit::sort_mem_accesses(std::deque<RTMemoryTransactionRecord> &mem_acces
 
     // Push the mem accesses in each treelet_order to the sorted list, in the order of the treelet, AND not how they came in the RT unit
     for (auto treelet : treelet_order) {
-      for (auto node : VulkanRayTracing::treelet_roots_addr_only[treelet]) {
+      for (auto node : VulkanRayTracing::flat_treelet_index.treelet_nodes(treelet)) {
         // if node is in mem_accesses then add it to sorted_mem_acceses
         if (duplicate_addresses_map.count((new_addr_type)node.addr)) {
           for (auto item : duplicate_addresses_map[(new_addr_type)node.addr]) {
@@ -3085,7 +3148,7 @@ void rt_unit::sort_mem_accesses(std::deque<RTMemoryTransactionRecord> &mem_acces
     }
   }
   assert(mem_accesses.size() == sorted_mem_accesses.size());
-  mem_accesses = sorted_mem_accesses;
+  mem_accesses.swap(sorted_mem_accesses);
 
   // old broken code (pre Oct 20)
   // std::deque<uint8_t*> treelet_traversal_order;
@@ -3191,7 +3254,7 @@ void rt_unit::cycle() {
     //   }
     //   RT_DPRINTF("\n");
     // }
-    GPGPU_Context()->the_gpgpusim->g_the_gpu->issue_cycles.push_back(GPGPU_Context()->the_gpgpusim->g_the_gpu->gpu_sim_cycle);
+    m_core->get_gpu()->rt_warp_issued(m_sid, pipe_reg.get_uid());
     
     pipe_reg.set_start_cycle(current_cycle);
     pipe_reg.set_thread_end_cycle(current_cycle);
@@ -3239,19 +3302,7 @@ void rt_unit::cycle() {
   if (m_config->m_rt_coherence_engine)
     m_ray_coherence_engine->cycle();
 
-  // AerialVision stats
-  m_stats->rt_nwarps[m_sid] = n_warps;
-  m_stats->rt_nthreads[m_sid] = active_threads;
-  m_stats->rt_naccesses[m_sid] = addr_set.size();
-  m_stats->rt_nthreads_intersection[m_sid] = n_threads;
-  unsigned max = 0;
-  for (auto it=addr_set.begin(); it!=addr_set.end(); it++) {
-    if (it->second > max) {
-      max = it->second;
-    }
-  }
-  m_stats->rt_max_coalesce[m_sid] = max;
-  m_stats->rt_mshr_size[m_sid] = L1D->num_mshr_entries();
+  sample_warp_stats(n_threads, active_threads, addr_set);
   
   // Check memory request responses
   if (!m_response_fifo.empty()) {
@@ -3314,36 +3365,17 @@ void rt_unit::cycle() {
               most_recently_loaded_metadata_addr = mf->get_uncoalesced_base_addr();
             }
           }
-
-          // Prefetch fill time
-          if (mf->isprefetch()) {
-            new_addr_type prefetch_addr = mf->get_uncoalesced_addr();
-            new_addr_type mshr_addr = L1D->get_cache_config().mshr_addr(prefetch_addr);
-            unsigned prefetch_issue_time = mf->get_prefetch_issue_cycle();
-            if (prefetch_request_tracker.count(mshr_addr)) {
-              for (auto &prefetch_info : prefetch_request_tracker[mshr_addr]) {
-                if (prefetch_info.m_prefetch_request_addr == prefetch_addr && prefetch_info.prefetch_issue_time == prefetch_issue_time) {
-                  assert(prefetch_info.mf_request_uid == mf->get_request_uid());
-                  prefetch_info.prefetch_fill_time = m_core->get_gpu()->gpu_sim_cycle + m_core->get_gpu()->gpu_tot_sim_cycle;
-                  break;
-                }
-              }
-            }
-
-            // for (auto &prefetch_info : prefetch_request_tracker) {
-            //   if (prefetch_info.m_prefetch_request_addr == prefetch_addr && prefetch_info.prefetch_issue_time == prefetch_issue_time) {
-            //     assert(prefetch_info.mf_request_uid == mf->get_request_uid());
-            //     prefetch_info.prefetch_fill_time = m_core->get_gpu()->gpu_sim_cycle + m_core->get_gpu()->gpu_tot_sim_cycle;
-            //     break;
-            //   }
-            // }
-          }
         }
         else {
           m_L0_complet->fill( mf, m_core->get_gpu()->gpu_sim_cycle +
                             m_core->get_gpu()->gpu_tot_sim_cycle);
         }
       }
+
+      // Prefetch fill time
+      if (mf->isprefetch()) prefetch_returned(mf);
+
+      if (m_prefetcher) m_prefetcher->fill(mf);
       
       if (m_config->m_rt_coherence_engine) {
         std::map<unsigned, warp_inst_t *> m_warp_pointers;
@@ -3365,10 +3397,16 @@ void rt_unit::cycle() {
   
   // Move new warp into collection of warps
   if (m_config->m_pipelined_treelet_queue) {
-    if (!pipe_reg.empty()) m_queued_warps[pipe_reg.get_uid()] = pipe_reg;
+    if (!pipe_reg.empty()) m_queued_warps[pipe_reg.get_uid()] = std::move(pipe_reg);
   }
   else {
-    if (!pipe_reg.empty()) m_current_warps[pipe_reg.get_uid()] = pipe_reg;
+    if (!pipe_reg.empty()) {
+      unsigned uid = pipe_reg.get_uid();
+      warp_inst_t &warp = m_current_warps[uid];
+      warp = std::move(pipe_reg);
+      if (m_config->m_treelet_prefetch) m_treelet_popularity.warp_arrived(uid, warp);
+      if (m_prefetcher) m_prefetcher->warp_arrived(uid, warp);
+    }
   }
   m_dispatch_reg->clear();
 
@@ -3382,16 +3420,17 @@ void rt_unit::cycle() {
           for (int i = 0; i < 32; i++)
           {
             //std::cout << "Sorting SM " << m_sid << " Thd " << i << std::endl;
-            std::deque<RTMemoryTransactionRecord> original_mem_accesses = warp_inst.second.get_thread_info(i).RT_mem_accesses;
-            std::deque<RTMemoryTransactionRecord> sorted_mem_accesses = warp_inst.second.get_thread_info(i).RT_mem_accesses;
+            rt_mem_access_log &mem_accesses = warp_inst.second.get_thread_info(i).RT_mem_accesses;
+            rt_mem_access_log original_mem_accesses;
+            if (THREAD_SORT_DEBUG_PRINT) original_mem_accesses = mem_accesses;
             
             THREAD_SORT_DPRINTF("Inst %d thread %d before: ", warp_inst.first, i);
             for (auto mem : original_mem_accesses) {
               THREAD_SORT_DPRINTF("0x%x, ", mem.address);
             }
 
-            sort_mem_accesses(sorted_mem_accesses); // TODO: need to consider node_access_counts_per_treelet
-            warp_inst.second.get_thread_info(i).RT_mem_accesses = sorted_mem_accesses; // rewrite later by passing it directly into the function
+            sort_mem_accesses(mem_accesses); // TODO: need to consider node_access_counts_per_treelet
+            warp_inst.second.set_rt_front_changed(i);
 
             THREAD_SORT_DPRINTF("\nInst %d thread %d  after: ", warp_inst.first, i);
             for (auto mem : warp_inst.second.get_thread_info(i).RT_mem_accesses) {
@@ -3416,272 +3455,8 @@ void rt_unit::cycle() {
       }
     }
 
-    if (m_config->m_treelet_prefetch && (GPGPU_Context()->the_gpgpusim->g_the_gpu->gpu_sim_cycle%m_config->prefetch_delay == 0)) {
-      uint8_t* prefetched_treelet_root = nullptr;
-      uint8_t* second_prefetched_treelet_root = nullptr;
-
-      // For each threads's first access, find the most popular treelet
-      std::map<uint8_t*, int> treelet_prefetch_priority;
-      for (auto warp_inst : m_current_warps) {
-        for (int i = 0; i < 32; i++) {
-          if (!warp_inst.second.get_thread_info(i).RT_mem_accesses.empty()) {
-            new_addr_type first_address = warp_inst.second.get_thread_info(i).RT_mem_accesses.front().address;
-            uint8_t* treelet_root_bin = VulkanRayTracing::addrToTreeletID((uint8_t*)first_address);
-            treelet_prefetch_priority[treelet_root_bin] += 1;
-          }
-        }
-      }
-
-      // Prefetch Heuristics
-      bool submit_prefetch = false; // default is to not submit any prefetches
-      int num_nodes_to_prefetch = 0;
-      if (m_config->m_treelet_prefetch_heuristic == 0) { // Prefetch Heuristic 0: Always prefetch the current most popular treelet amongst all threads in this queue
-        // Find the most popular treelet
-        int max = -1;
-        for (auto treelet_addr : treelet_prefetch_priority) {
-          if (treelet_addr.second > max) {
-            prefetched_treelet_root = treelet_addr.first;
-            max = treelet_addr.second;
-          }
-        }
-        submit_prefetch = true;
-
-        // Compare to the hierarical most popular treelet to see how often they match
-        std::map <uint8_t*, int> overall_warp_max_treelets;
-        for (auto warp_inst : m_current_warps) {
-          // tally up the treelets in a warp
-          std::map <uint8_t*, int> per_warp_treelets;
-          for (int i = 0; i < 32; i++) {
-            if (!warp_inst.second.get_thread_info(i).RT_mem_accesses.empty()) {
-              new_addr_type first_address = warp_inst.second.get_thread_info(i).RT_mem_accesses.front().address;
-              uint8_t* treelet_root_bin = VulkanRayTracing::addrToTreeletID((uint8_t*)first_address);
-              per_warp_treelets[treelet_root_bin] += 1;
-            }
-          }
-          // find its max
-          int largest = -1;
-          uint8_t* per_war_largest_treelet = nullptr;
-          for (auto treelet_addr : per_warp_treelets) {
-            if (treelet_addr.second > largest) {
-              per_war_largest_treelet = treelet_addr.first;
-              largest = treelet_addr.second;
-            }
-          }
-
-          // insert in overall_warp_max_treelets
-          overall_warp_max_treelets[per_war_largest_treelet] += 1;
-        }
-        // find the max in overall_warp_max_treelets
-        int largest_overall = -1;
-        uint8_t* largest_overall_treelet = nullptr;
-        for (auto treelet_addr : overall_warp_max_treelets) {
-          if (treelet_addr.second > largest_overall) {
-            largest_overall_treelet = treelet_addr.first;
-            largest_overall = treelet_addr.second;
-          }
-        }
-        // printf("largest_overall_treelet: 0x%x, real_largest_treelet: 0x%x\n", largest_overall_treelet, prefetched_treelet_root);
-        if (largest_overall_treelet == prefetched_treelet_root) {
-          matches++;
-        }
-        comparisons++;
-      }
-      else if (m_config->m_treelet_prefetch_heuristic == 1) { // Prefetch Heuristic 1: Only prefetch if treelet is the most popular above a % threshold
-        // Find the most popular treelet and calculate how popular it is
-        int max = -1;
-        unsigned total_threads = 0;
-        double percentage = 0.0;
-        for (auto treelet_addr : treelet_prefetch_priority) {
-          if (treelet_addr.second > max) {
-            prefetched_treelet_root = treelet_addr.first;
-            max = treelet_addr.second;
-          }
-          total_threads += treelet_addr.second;
-        }
-
-        percentage = static_cast<double>(treelet_prefetch_priority[prefetched_treelet_root]) / static_cast<double>(total_threads);
-
-        if (percentage >= m_config->m_treelet_prefetch_threshold) {
-          if (last_prefetched_treelet != prefetched_treelet_root) {
-            TOMMY_DPRINTF("Shader %d: Cycle: %d, Treelet root 0x%x exceeds prefetch threshold with %f (%d/%d)\n", m_sid, GPGPU_Context()->the_gpgpusim->g_the_gpu->gpu_sim_cycle, prefetched_treelet_root, percentage, treelet_prefetch_priority[prefetched_treelet_root], total_threads);
-          }
-          last_rejected_treelet = NULL;
-          submit_prefetch = true;
-        }
-        else {
-          if (prefetched_treelet_root != nullptr && last_rejected_treelet != prefetched_treelet_root) {
-            TOMMY_DPRINTF("Shader %d: Cycle: %d, Treelet root 0x%x does not exceed prefetch threshold with %f (%d/%d)\n", m_sid, GPGPU_Context()->the_gpgpusim->g_the_gpu->gpu_sim_cycle, prefetched_treelet_root, percentage, treelet_prefetch_priority[prefetched_treelet_root], total_threads);
-            last_rejected_treelet = prefetched_treelet_root;
-          }
-          submit_prefetch = false;
-        }
-      }
-      else if (m_config->m_treelet_prefetch_heuristic == 2) { // Prefetch Heuristic 2: Prefetch a portion of the treelet based on the popularity percentage
-        // Find the most popular treelet and calculate how popular it is
-        int max = -1;
-        unsigned total_threads = 0;
-        double percentage = 0.0;
-        for (auto treelet_addr : treelet_prefetch_priority) {
-          if (treelet_addr.second > max) {
-            prefetched_treelet_root = treelet_addr.first;
-            max = treelet_addr.second;
-          }
-          total_threads += treelet_addr.second;
-        }
-
-        percentage = static_cast<double>(treelet_prefetch_priority[prefetched_treelet_root]) / static_cast<double>(total_threads);
-
-        int num_nodes_in_treelet = VulkanRayTracing::treelet_roots_addr_only[prefetched_treelet_root].size();
-        num_nodes_to_prefetch = static_cast<int>((static_cast<double>(num_nodes_in_treelet) * percentage) + 0.5); // + 0.5 is for rounding
-        if (prefetched_treelet_root != nullptr && last_prefetched_treelet != prefetched_treelet_root) {
-          TOMMY_DPRINTF("Shader %d: Cycle: %d, Treelet root 0x%x popularity is %f, prefetching %d/%d nodes\n", m_sid, GPGPU_Context()->the_gpgpusim->g_the_gpu->gpu_sim_cycle, prefetched_treelet_root, percentage, num_nodes_to_prefetch, num_nodes_in_treelet);
-        }
-        submit_prefetch = true;
-      }
-      else if (m_config->m_treelet_prefetch_heuristic == 3) { // Prefetch Heuristic 3: Prefetch the latter half of the tree? Since the first half will be handled by demand loads
-        int max = -1;
-        unsigned total_threads = 0;
-        double percentage = 0.0; // prefetch the latter half
-        for (auto treelet_addr : treelet_prefetch_priority) {
-          if (treelet_addr.second > max) {
-            prefetched_treelet_root = treelet_addr.first;
-            max = treelet_addr.second;
-          }
-          total_threads += treelet_addr.second;
-        }
-
-        percentage = static_cast<double>(treelet_prefetch_priority[prefetched_treelet_root]) / static_cast<double>(total_threads);
-
-        // The main difference is in the next stage where I add prefetches
-        int num_nodes_in_treelet = VulkanRayTracing::treelet_roots_addr_only[prefetched_treelet_root].size();
-        num_nodes_to_prefetch = static_cast<int>((static_cast<double>(num_nodes_in_treelet) * percentage) + 0.5); // + 0.5 is for rounding
-        submit_prefetch = true;
-      }
-      
-      // Push treelet nodes to prefetch queue
-      if (submit_prefetch && prefetched_treelet_root != nullptr) {
-        std::vector<StackEntry> nodes_in_treelet = VulkanRayTracing::treelet_roots_addr_only[prefetched_treelet_root];
-        if (last_prefetched_treelet != prefetched_treelet_root && last_prefetched_second_treelet != prefetched_treelet_root) { // make sure we arent prefetching the same treelet over and over
-          prefetch_treelet_switches++;
-          total_cycles_between_prefetch_treelet_switch += GPGPU_Context()->the_gpgpusim->g_the_gpu->gpu_sim_cycle - timestamp_of_last_treelet;
-          timestamp_of_last_treelet = GPGPU_Context()->the_gpgpusim->g_the_gpu->gpu_sim_cycle;
-
-          int num_prefetch_nodes;
-          if (m_config->m_treelet_prefetch_heuristic == 2 || m_config->m_treelet_prefetch_heuristic == 3) {
-            num_prefetch_nodes = num_nodes_to_prefetch; // prefetch the tree partially
-          }
-          else {
-            num_prefetch_nodes = nodes_in_treelet.size(); // prefetch the whole tree
-          }
-          
-          if (num_prefetch_nodes + prefetch_mem_access_q.size() <= m_config->m_max_prefetch_queue_size) { // make sure the treelet i want to prefetch wont exceed the max prefetch queue size
-            
-            if (m_config->m_flush_prefetch_queue_on_new_treelet) { // flush prefetch queue on when there a new most popular treelet
-              TOMMY_DPRINTF("Shader %d: Clearing prefetch queue due to new treelet\n", m_sid);
-              prefetch_mem_access_q.clear();
-              prefetch_generation_cycles.clear();
-            }
-
-            TOMMY_DPRINTF("Shader %d: Add Prefetching for Treelet root 0x%x\n", m_sid, prefetched_treelet_root);
-            if (m_config->m_treelet_prefetch_heuristic == 3) {
-              for (int j = nodes_in_treelet.size() - num_prefetch_nodes; j < nodes_in_treelet.size(); j++) { // Prefetching from the middle of the treelet
-                TOMMY_DPRINTF("Shader %d: %dB request at 0x%x added chunks at cycle %d ", m_sid, nodes_in_treelet[j].size, (new_addr_type)nodes_in_treelet[j].addr, GPGPU_Context()->the_gpgpusim->g_the_gpu->gpu_sim_cycle);
-                
-                // Load treelet metadata first so the prefetcher knows what nodes to prefetch
-                if (m_config->load_treelet_metadata) {
-                  new_addr_type metadata_offset = (new_addr_type)(VulkanRayTracing::treelet_addr_to_metadata_idx[nodes_in_treelet[j].addr] * VulkanRayTracing::per_treelet_metadata_size);
-                  new_addr_type metadata_addr = (new_addr_type)(VulkanRayTracing::treelet_metadata) + metadata_offset;
-                  // printf("treelet: 0x%x, id: %d, metadata: 0x%x, offset: 0x%x\n", nodes_in_treelet[j].addr, VulkanRayTracing::treelet_addr_to_metadata_idx[nodes_in_treelet[j].addr], metadata_addr, metadata_offset);
-                  prefetch_metadata_added++;
-                  for (unsigned i=0; i<(VulkanRayTracing::per_treelet_metadata_size/32); i++) {
-                    prefetch_mem_access_q.push_back(std::make_pair((new_addr_type)(metadata_addr + i * 32), metadata_addr));
-                    prefetch_generation_cycles.push_back(std::make_pair(m_core->get_gpu()->gpu_sim_cycle + m_core->get_gpu()->gpu_tot_sim_cycle, (new_addr_type)(metadata_addr + i * 32)));
-                  }
-                }
-                
-                // Create the memory chunks and push to mem_access_q
-                for (unsigned i=0; i<((nodes_in_treelet[j].size+31)/32); i++) {
-                  prefetch_mem_access_q.push_back(std::make_pair((new_addr_type)((new_addr_type)nodes_in_treelet[j].addr + (i * 32)), (new_addr_type)nodes_in_treelet[j].addr));
-                  prefetch_generation_cycles.push_back(std::make_pair(m_core->get_gpu()->gpu_sim_cycle + m_core->get_gpu()->gpu_tot_sim_cycle, (new_addr_type)((new_addr_type)nodes_in_treelet[j].addr + (i * 32))));
-                  TOMMY_DPRINTF("0x%x, ", (new_addr_type)nodes_in_treelet[j].addr + (i * 32));
-                  prefetches_added_to_queue++;
-                }
-                TOMMY_DPRINTF("\n");
-              }
-            }
-            else { // Normal prefetching from the beginning of the treelet
-              for (int j = 0; j < num_prefetch_nodes; j++) {
-                // Load treelet metadata first so the prefetcher knows what nodes to prefetch
-                if (m_config->load_treelet_metadata) {
-                  new_addr_type metadata_offset = (new_addr_type)(VulkanRayTracing::treelet_addr_to_metadata_idx[nodes_in_treelet[j].addr] * VulkanRayTracing::per_treelet_metadata_size);
-                  new_addr_type metadata_addr = (new_addr_type)(VulkanRayTracing::treelet_metadata) + metadata_offset;
-                  // printf("treelet: 0x%x, id: %d, metadata: 0x%x, offset: 0x%x\n", nodes_in_treelet[j].addr, VulkanRayTracing::treelet_addr_to_metadata_idx[nodes_in_treelet[j].addr], metadata_addr, metadata_offset);
-                  prefetch_metadata_added++;
-                  for (unsigned i=0; i<(VulkanRayTracing::per_treelet_metadata_size/32); i++) {
-                    prefetch_mem_access_q.push_back(std::make_pair((new_addr_type)(metadata_addr + i * 32), metadata_addr));
-                    prefetch_generation_cycles.push_back(std::make_pair(m_core->get_gpu()->gpu_sim_cycle + m_core->get_gpu()->gpu_tot_sim_cycle, (new_addr_type)(metadata_addr + i * 32)));
-                  }
-                }
-                
-                TOMMY_DPRINTF("Shader %d: %dB request at 0x%x added chunks at cycle %d ", m_sid, nodes_in_treelet[j].size, (new_addr_type)nodes_in_treelet[j].addr, GPGPU_Context()->the_gpgpusim->g_the_gpu->gpu_sim_cycle);
-                // Create the memory chunks and push to mem_access_q
-                for (unsigned i=0; i<((nodes_in_treelet[j].size+31)/32); i++) {
-                  prefetch_mem_access_q.push_back(std::make_pair((new_addr_type)((new_addr_type)nodes_in_treelet[j].addr + (i * 32)), (new_addr_type)nodes_in_treelet[j].addr));
-                  prefetch_generation_cycles.push_back(std::make_pair(m_core->get_gpu()->gpu_sim_cycle + m_core->get_gpu()->gpu_tot_sim_cycle, (new_addr_type)((new_addr_type)nodes_in_treelet[j].addr + (i * 32))));
-                  TOMMY_DPRINTF("0x%x, ", (new_addr_type)nodes_in_treelet[j].addr + (i * 32));
-                  prefetches_added_to_queue++;
-                }
-                TOMMY_DPRINTF("\n");
-              }
-            }
-            
-            TOMMY_DPRINTF("Shader %d: Prefetch queue entries: %d\n", m_sid, prefetch_mem_access_q.size());
-            last_prefetched_treelet = prefetched_treelet_root;
-          }
-        }
-        submit_prefetch = false;
-      }
-
-      // Prefetch the next treelet when the prefetch queue is empty
-      bool submit_second_prefetch = false;
-      if (m_config->prefetch_next_treelet_when_queue_empty) {
-        if (prefetch_mem_access_q.empty() && !m_current_warps.empty() && treelet_prefetch_priority.size() > 1) { // if prefetch queue is empty, but there are still rt warps to be processed
-          if (last_prefetched_treelet == prefetched_treelet_root && prefetched_treelet_root != nullptr) { // if the current prefetched treelet is done prefetching?
-            int max = -1;
-            //unsigned total_threads = 0;
-            //double percentage = 0.0; // prefetch the latter half
-            for (auto treelet_addr : treelet_prefetch_priority) {
-              if (treelet_addr.second > max && treelet_addr.first != last_prefetched_treelet) {
-                second_prefetched_treelet_root = treelet_addr.first;
-                max = treelet_addr.second;
-              }
-              //total_threads += treelet_addr.second;
-            }
-
-            submit_second_prefetch = true;
-          }
-        }
-
-        if (submit_second_prefetch && second_prefetched_treelet_root != nullptr) {
-          if (last_prefetched_second_treelet != second_prefetched_treelet_root) {
-            std::vector<StackEntry> nodes_in_treelet = VulkanRayTracing::treelet_roots_addr_only[second_prefetched_treelet_root];
-            for (int j = 0; j < nodes_in_treelet.size(); j++) {
-              SECOND_PREFETCH_DPRINTF("Shader %d: %dB request at 0x%x added chunks at cycle %d ", m_sid, nodes_in_treelet[j].size, (new_addr_type)nodes_in_treelet[j].addr, GPGPU_Context()->the_gpgpusim->g_the_gpu->gpu_sim_cycle);
-              // Create the memory chunks and push to mem_access_q
-              for (unsigned i=0; i<((nodes_in_treelet[j].size+31)/32); i++) {
-                prefetch_mem_access_q.push_back(std::make_pair((new_addr_type)((new_addr_type)nodes_in_treelet[j].addr + (i * 32)), (new_addr_type)nodes_in_treelet[j].addr));
-                prefetch_generation_cycles.push_back(std::make_pair(m_core->get_gpu()->gpu_sim_cycle + m_core->get_gpu()->gpu_tot_sim_cycle, (new_addr_type)((new_addr_type)nodes_in_treelet[j].addr + (i * 32))));
-                SECOND_PREFETCH_DPRINTF("0x%x, ", (new_addr_type)nodes_in_treelet[j].addr + (i * 32));
-                prefetches_added_to_queue++;
-              }
-              SECOND_PREFETCH_DPRINTF("\n");
-            }
-            SECOND_PREFETCH_DPRINTF("Shader %d: Prefetch queue entries: %d\n", m_sid, prefetch_mem_access_q.size());
-            last_prefetched_second_treelet = second_prefetched_treelet_root;
-          }
-          submit_second_prefetch = false;
-        }
-      }
+    if (m_prefetcher && (GPGPU_Context()->the_gpgpusim->g_the_gpu->gpu_sim_cycle%m_config->prefetch_delay == 0)) {
+      m_prefetcher->cycle(RT_PREFETCH_STREAMING);
     }
   }
 
@@ -3700,8 +3475,18 @@ void rt_unit::cycle() {
     // Transfer warps from queue to rt unit
     if ((n_queued_warps >= m_config->m_rt_max_warps || cycles_without_dispatching >= m_config->m_treelet_queue_wait_cycle) && !executing) { // enough warps are queued up and rt_unit is not current executing the previous batched of queued warps
       assert(m_current_warps.empty());
-      m_current_warps = m_queued_warps; // copy warps from queue to rt unit 
+      m_current_warps.swap(m_queued_warps); // move warps from queue to rt unit
       n_warps = n_queued_warps;
+      if (m_config->m_treelet_prefetch) {
+        for (auto &warp_inst : m_current_warps) {
+          m_treelet_popularity.warp_arrived(warp_inst.first, warp_inst.second);
+        }
+      }
+      if (m_prefetcher) {
+        for (auto &warp_inst : m_current_warps) {
+          m_prefetcher->warp_arrived(warp_inst.first, warp_inst.second);
+        }
+      }
       assert(m_current_warps.size() == n_warps);
       executing = true;
 
@@ -3720,12 +3505,12 @@ void rt_unit::cycle() {
 
       // Tally up all the different memory accesses from all warps
       std::map<uint8_t*, int> node_access_counts_per_treelet;
-      for (auto warp_inst : m_current_warps)
+      for (auto &warp_inst : m_current_warps)
       {
         for (int i = 0; i < 32; i++)
         {
-          warp_inst_t::per_thread_info thread_info = warp_inst.second.get_thread_info(i);
-          for (auto mem_access : thread_info.RT_mem_accesses)
+          const warp_inst_t::per_thread_info &thread_info = warp_inst.second.get_thread_info(i);
+          for (const auto &mem_access : thread_info.RT_mem_accesses)
           {
             // std::cout << mem_access.address << std::endl;
             uint8_t* treelet_root_bin = VulkanRayTracing::addrToTreeletID((uint8_t*)mem_access.address);
@@ -3741,16 +3526,17 @@ void rt_unit::cycle() {
           for (int i = 0; i < 32; i++)
           {
             //std::cout << "Sorting SM " << m_sid << " Thd " << i << std::endl;
-            std::deque<RTMemoryTransactionRecord> original_mem_accesses = warp_inst.second.get_thread_info(i).RT_mem_accesses;
-            std::deque<RTMemoryTransactionRecord> sorted_mem_accesses = warp_inst.second.get_thread_info(i).RT_mem_accesses;
+            rt_mem_access_log &mem_accesses = warp_inst.second.get_thread_info(i).RT_mem_accesses;
+            rt_mem_access_log original_mem_accesses;
+            if (THREAD_SORT_DEBUG_PRINT) original_mem_accesses = mem_accesses;
             
             THREAD_SORT_DPRINTF("Inst %d thread %d before: ", warp_inst.first, i);
             for (auto mem : original_mem_accesses) {
               THREAD_SORT_DPRINTF("0x%x, ", mem.address);
             }
 
-            sort_mem_accesses(sorted_mem_accesses, node_access_counts_per_treelet); // TODO: need to consider node_access_counts_per_treelet
-            warp_inst.second.get_thread_info(i).RT_mem_accesses = sorted_mem_accesses; // rewrite later by passing it directly into the function
+            sort_mem_accesses(mem_accesses, node_access_counts_per_treelet); // TODO: need to consider node_access_counts_per_treelet
+            warp_inst.second.set_rt_front_changed(i);
 
             THREAD_SORT_DPRINTF("\nInst %d thread %d  after: ", warp_inst.first, i);
             for (auto mem : warp_inst.second.get_thread_info(i).RT_mem_accesses) {
@@ -3777,158 +3563,8 @@ void rt_unit::cycle() {
     }
 
     // Generate prefetch requests based on each thread's first request in all warps
-    if (m_config->m_treelet_prefetch && executing) {
-      uint8_t* prefetched_treelet_root = nullptr;
-
-      // For each threads's first access, find the most popular treelet
-      std::map<uint8_t*, int> treelet_prefetch_priority;
-      for (auto warp_inst : m_current_warps) {
-        for (int i = 0; i < 32; i++) {
-          if (!warp_inst.second.get_thread_info(i).RT_mem_accesses.empty()) {
-            new_addr_type first_address = warp_inst.second.get_thread_info(i).RT_mem_accesses.front().address;
-            uint8_t* treelet_root_bin = VulkanRayTracing::addrToTreeletID((uint8_t*)first_address);
-            treelet_prefetch_priority[treelet_root_bin] += 1;
-          }
-        }
-      }
-
-      // Prefetch Heuristics
-      bool submit_prefetch = false; // default is to not submit any prefetches
-      int num_nodes_to_prefetch = 0;
-
-      if (m_config->m_treelet_prefetch_heuristic == 0) { // Prefetch Heuristic 0: Always prefetch the current most popular treelet amongst all threads in this queue
-        // Find the most popular treelet
-        int max = -1;
-        for (auto treelet_addr : treelet_prefetch_priority) {
-          if (treelet_addr.second > max) {
-            prefetched_treelet_root = treelet_addr.first;
-            max = treelet_addr.second;
-          }
-        }
-        submit_prefetch = true;
-      }
-      else if (m_config->m_treelet_prefetch_heuristic == 1) { // Prefetch Heuristic 1: Only prefetch if treelet is the most popular above a % threshold
-        // Find the most popular treelet and calculate how popular it is
-        int max = -1;
-        unsigned total_threads = 0;
-        double percentage = 0.0;
-        for (auto treelet_addr : treelet_prefetch_priority) {
-          if (treelet_addr.second > max) {
-            prefetched_treelet_root = treelet_addr.first;
-            max = treelet_addr.second;
-          }
-          total_threads += treelet_addr.second;
-        }
-
-        percentage = static_cast<double>(treelet_prefetch_priority[prefetched_treelet_root]) / static_cast<double>(total_threads);
-
-        if (percentage >= m_config->m_treelet_prefetch_threshold) {
-          if (last_prefetched_treelet != prefetched_treelet_root) {
-            TOMMY_DPRINTF("Shader %d: Cycle: %d, Treelet root 0x%x exceeds prefetch threshold with %f (%d/%d)\n", m_sid, GPGPU_Context()->the_gpgpusim->g_the_gpu->gpu_sim_cycle, prefetched_treelet_root, percentage, treelet_prefetch_priority[prefetched_treelet_root], total_threads);
-          }
-          last_rejected_treelet = NULL;
-          submit_prefetch = true;
-        }
-        else {
-          if (prefetched_treelet_root != nullptr && last_rejected_treelet != prefetched_treelet_root) {
-            TOMMY_DPRINTF("Shader %d: Cycle: %d, Treelet root 0x%x does not exceed prefetch threshold with %f (%d/%d)\n", m_sid, GPGPU_Context()->the_gpgpusim->g_the_gpu->gpu_sim_cycle, prefetched_treelet_root, percentage, treelet_prefetch_priority[prefetched_treelet_root], total_threads);
-            last_rejected_treelet = prefetched_treelet_root;
-          }
-          submit_prefetch = false;
-        }
-      }
-      else if (m_config->m_treelet_prefetch_heuristic == 2) { // Prefetch Heuristic 2: Prefetch a portion of the treelet based on the popularity percentage
-        // Find the most popular treelet and calculate how popular it is
-        int max = -1;
-        unsigned total_threads = 0;
-        double percentage = 0.0;
-        for (auto treelet_addr : treelet_prefetch_priority) {
-          if (treelet_addr.second > max) {
-            prefetched_treelet_root = treelet_addr.first;
-            max = treelet_addr.second;
-          }
-          total_threads += treelet_addr.second;
-        }
-
-        percentage = static_cast<double>(treelet_prefetch_priority[prefetched_treelet_root]) / static_cast<double>(total_threads);
-
-        int num_nodes_in_treelet = VulkanRayTracing::treelet_roots_addr_only[prefetched_treelet_root].size();
-        num_nodes_to_prefetch = static_cast<int>((static_cast<double>(num_nodes_in_treelet) * percentage) + 0.5); // + 0.5 is for rounding
-        if (prefetched_treelet_root != nullptr && last_prefetched_treelet != prefetched_treelet_root) {
-          TOMMY_DPRINTF("Shader %d: Cycle: %d, Treelet root 0x%x popularity is %f, prefetching %d/%d nodes\n", m_sid, GPGPU_Context()->the_gpgpusim->g_the_gpu->gpu_sim_cycle, prefetched_treelet_root, percentage, num_nodes_to_prefetch, num_nodes_in_treelet);
-        }
-        submit_prefetch = true;
-      }
-      else if (m_config->m_treelet_prefetch_heuristic == 3) { // Prefetch Heuristic 3: Prefetch the latter half of the tree? Since the first half will be handled by demand loads
-        int max = -1;
-        unsigned total_threads = 0;
-        double percentage = 0.5; // prefetch the latter half
-        for (auto treelet_addr : treelet_prefetch_priority) {
-          if (treelet_addr.second > max) {
-            prefetched_treelet_root = treelet_addr.first;
-            max = treelet_addr.second;
-          }
-          total_threads += treelet_addr.second;
-        }
-        // The main difference is in the next stage where I add prefetches
-        int num_nodes_in_treelet = VulkanRayTracing::treelet_roots_addr_only[prefetched_treelet_root].size();
-        num_nodes_to_prefetch = static_cast<int>((static_cast<double>(num_nodes_in_treelet) * percentage) + 0.5); // + 0.5 is for rounding
-        submit_prefetch = true;
-      }
-
-      // Push treelet nodes to prefetch queue
-      if (submit_prefetch && prefetched_treelet_root != nullptr) {
-        std::vector<StackEntry> nodes_in_treelet = VulkanRayTracing::treelet_roots_addr_only[prefetched_treelet_root];
-        if (last_prefetched_treelet != prefetched_treelet_root) { // make sure we arent prefetching the same treelet over and over
-          
-          int num_prefetch_nodes;
-          if (m_config->m_treelet_prefetch_heuristic == 2 || m_config->m_treelet_prefetch_heuristic == 3) {
-            num_prefetch_nodes = num_nodes_to_prefetch; // prefetch the tree partially
-          }
-          else {
-            num_prefetch_nodes = nodes_in_treelet.size(); // prefetch the whole tree
-          }
-          
-          if (num_prefetch_nodes + prefetch_mem_access_q.size() <= m_config->m_max_prefetch_queue_size) { // make sure the treelet i want to prefetch wont exceed the max prefetch queue size
-            
-            if (m_config->m_flush_prefetch_queue_on_new_treelet) { // flush prefetch queue on when there a new most popular treelet
-              TOMMY_DPRINTF("Shader %d: Clearing prefetch queue due to new treelet\n", m_sid);
-              prefetch_mem_access_q.clear();
-              prefetch_generation_cycles.clear();
-            }
-
-            TOMMY_DPRINTF("Shader %d: Add Prefetching for Treelet root 0x%x\n", m_sid, prefetched_treelet_root);
-            if (m_config->m_treelet_prefetch_heuristic == 3) {
-              for (int j = nodes_in_treelet.size() - num_prefetch_nodes; j < nodes_in_treelet.size(); j++) { // Prefetching from the middle of the treelet
-                TOMMY_DPRINTF("Shader %d: %dB request at 0x%x added chunks at cycle %d ", m_sid, nodes_in_treelet[j].size, (new_addr_type)nodes_in_treelet[j].addr, GPGPU_Context()->the_gpgpusim->g_the_gpu->gpu_sim_cycle);
-                // Create the memory chunks and push to mem_access_q
-                for (unsigned i=0; i<((nodes_in_treelet[j].size+31)/32); i++) {
-                  prefetch_mem_access_q.push_back(std::make_pair((new_addr_type)((new_addr_type)nodes_in_treelet[j].addr + (i * 32)), (new_addr_type)nodes_in_treelet[j].addr));
-                  prefetch_generation_cycles.push_back(std::make_pair(m_core->get_gpu()->gpu_sim_cycle + m_core->get_gpu()->gpu_tot_sim_cycle, (new_addr_type)((new_addr_type)nodes_in_treelet[j].addr + (i * 32))));
-                  TOMMY_DPRINTF("0x%x, ", (new_addr_type)nodes_in_treelet[j].addr + (i * 32));
-                }
-                TOMMY_DPRINTF("\n");
-              }
-            }
-            else { // Normal prefetching from the beginning of the treelet
-              for (int j = 0; j < num_prefetch_nodes; j++) {
-                TOMMY_DPRINTF("Shader %d: %dB request at 0x%x added chunks at cycle %d ", m_sid, nodes_in_treelet[j].size, (new_addr_type)nodes_in_treelet[j].addr, GPGPU_Context()->the_gpgpusim->g_the_gpu->gpu_sim_cycle);
-                // Create the memory chunks and push to mem_access_q
-                for (unsigned i=0; i<((nodes_in_treelet[j].size+31)/32); i++) {
-                  prefetch_mem_access_q.push_back(std::make_pair((new_addr_type)((new_addr_type)nodes_in_treelet[j].addr + (i * 32)), (new_addr_type)nodes_in_treelet[j].addr));
-                  prefetch_generation_cycles.push_back(std::make_pair(m_core->get_gpu()->gpu_sim_cycle + m_core->get_gpu()->gpu_tot_sim_cycle, (new_addr_type)((new_addr_type)nodes_in_treelet[j].addr + (i * 32))));
-                  TOMMY_DPRINTF("0x%x, ", (new_addr_type)nodes_in_treelet[j].addr + (i * 32));
-                }
-                TOMMY_DPRINTF("\n");
-              }
-            }
-            
-            TOMMY_DPRINTF("Shader %d: Prefetch queue entries: %d\n", m_sid, prefetch_mem_access_q.size());
-            last_prefetched_treelet = prefetched_treelet_root;
-          }
-        }
-        submit_prefetch = false;
-      }
+    if (m_prefetcher && executing) {
+      m_prefetcher->cycle(RT_PREFETCH_PIPELINED_QUEUE);
     }
   }
 
@@ -3964,12 +3600,12 @@ void rt_unit::cycle() {
 
       // Tally up all the different memory accesses from all warps
       std::map<uint8_t*, int> node_access_counts_per_treelet;
-      for (auto warp_inst : m_current_warps)
+      for (auto &warp_inst : m_current_warps)
       {
         for (int i = 0; i < 32; i++)
         {
-          warp_inst_t::per_thread_info thread_info = warp_inst.second.get_thread_info(i);
-          for (auto mem_access : thread_info.RT_mem_accesses)
+          const warp_inst_t::per_thread_info &thread_info = warp_inst.second.get_thread_info(i);
+          for (const auto &mem_access : thread_info.RT_mem_accesses)
           {
             // std::cout << mem_access.address << std::endl;
             uint8_t* treelet_root_bin = VulkanRayTracing::addrToTreeletID((uint8_t*)mem_access.address);
@@ -3985,16 +3621,17 @@ void rt_unit::cycle() {
           for (int i = 0; i < 32; i++)
           {
             //std::cout << "Sorting SM " << m_sid << " Thd " << i << std::endl;
-            std::deque<RTMemoryTransactionRecord> original_mem_accesses = warp_inst.second.get_thread_info(i).RT_mem_accesses;
-            std::deque<RTMemoryTransactionRecord> sorted_mem_accesses = warp_inst.second.get_thread_info(i).RT_mem_accesses;
+            rt_mem_access_log &mem_accesses = warp_inst.second.get_thread_info(i).RT_mem_accesses;
+            rt_mem_access_log original_mem_accesses;
+            if (WARP_QUEUE_DEBUG_PRINT) original_mem_accesses = mem_accesses;
             
             WARP_QUEUE_DPRINTF("Inst %d thread %d before: ", warp_inst.first, i);
             for (auto mem : original_mem_accesses) {
               WARP_QUEUE_DPRINTF("0x%x, ", mem.address);
             }
 
-            sort_mem_accesses(sorted_mem_accesses, node_access_counts_per_treelet); // TODO: need to consider node_access_counts_per_treelet
-            warp_inst.second.get_thread_info(i).RT_mem_accesses = sorted_mem_accesses; // rewrite later by passing it directly into the function
+            sort_mem_accesses(mem_accesses, node_access_counts_per_treelet); // TODO: need to consider node_access_counts_per_treelet
+            warp_inst.second.set_rt_front_changed(i);
 
             WARP_QUEUE_DPRINTF("\nInst %d thread %d  after: ", warp_inst.first, i);
             for (auto mem : warp_inst.second.get_thread_info(i).RT_mem_accesses) {
@@ -4017,46 +3654,8 @@ void rt_unit::cycle() {
     }
 
     // Generate prefetch requests based on each thread's first request in all warps
-    if (m_config->m_treelet_prefetch) {
-      // For each threads's first access, find the most popular treelet
-      std::map<uint8_t*, int> treelet_prefetch_priority;
-      for (auto warp_inst : m_current_warps) {
-        for (int i = 0; i < 32; i++) {
-          if (!warp_inst.second.get_thread_info(i).RT_mem_accesses.empty()) {
-            new_addr_type first_address = warp_inst.second.get_thread_info(i).RT_mem_accesses.front().address;
-            uint8_t* treelet_root_bin = VulkanRayTracing::addrToTreeletID((uint8_t*)first_address);
-            treelet_prefetch_priority[treelet_root_bin] += 1;
-          }
-        }
-      }
-      int max = -1;
-      uint8_t* treelet_root = nullptr;
-      for (auto treelet_addr : treelet_prefetch_priority) {
-        if (treelet_addr.second > max) {
-          treelet_root = treelet_addr.first;
-          max = treelet_addr.second;
-        }
-      }
-
-      // Push treelet nodes to prefetch queue
-      std::vector<StackEntry> nodes_in_treelet = VulkanRayTracing::treelet_roots_addr_only[treelet_root];
-      if (last_prefetched_treelet != treelet_root) { // make sure we arent prefetching the same treelet over and over
-        if (nodes_in_treelet.size() + prefetch_mem_access_q.size() <= m_config->m_max_prefetch_queue_size) { // make sure the treelet i want to prefetch wont exceed the max prefetch queue size
-          TOMMY_DPRINTF("Shader %d: Add Prefetching for Treelet root 0x%x\n", m_sid, treelet_root);
-          for (int j = 0; j < nodes_in_treelet.size(); j++) {
-            TOMMY_DPRINTF("Shader %d: %dB request at 0x%x added chunks at cycle %d ", m_sid, nodes_in_treelet[j].size, (new_addr_type)nodes_in_treelet[j].addr, GPGPU_Context()->the_gpgpusim->g_the_gpu->gpu_sim_cycle);
-            // Create the memory chunks and push to mem_access_q
-            for (unsigned i=0; i<((nodes_in_treelet[j].size+31)/32); i++) {
-              prefetch_mem_access_q.push_back(std::make_pair((new_addr_type)((new_addr_type)nodes_in_treelet[j].addr + (i * 32)), (new_addr_type)nodes_in_treelet[j].addr));
-              prefetch_generation_cycles.push_back(std::make_pair(m_core->get_gpu()->gpu_sim_cycle + m_core->get_gpu()->gpu_tot_sim_cycle, (new_addr_type)((new_addr_type)nodes_in_treelet[j].addr + (i * 32))));
-              TOMMY_DPRINTF("0x%x, ", (new_addr_type)nodes_in_treelet[j].addr + (i * 32));
-            }
-            TOMMY_DPRINTF("\n");
-          }
-          TOMMY_DPRINTF("Shader %d: Prefetch queue entries: %d\n", m_sid, prefetch_mem_access_q.size());
-          last_prefetched_treelet = treelet_root;
-        }
-      }
+    if (m_prefetcher) {
+      m_prefetcher->cycle(RT_PREFETCH_TREELET_QUEUE);
     }
     
     // Alternatively, prefetch based on node_access_counts_per_treelet if we have oracle info
@@ -4082,8 +3681,7 @@ void rt_unit::cycle() {
     }
     else {
       // Find the appropriate warp
-      rt_inst = m_current_warps[mem_access_q_warp_uid];
-      m_current_warps.erase(mem_access_q_warp_uid);
+      take_warp(m_current_warps.find(mem_access_q_warp_uid), rt_inst);
     }
   }
   else if (mem_store_q.empty() && !m_config->m_rt_coherence_engine) {
@@ -4094,8 +3692,7 @@ void rt_unit::cycle() {
     // Check if active
     if (m_ray_coherence_engine->active()) {
       unsigned warp_uid = m_ray_coherence_engine->schedule_next_warp();
-      rt_inst = m_current_warps[warp_uid];
-      m_current_warps.erase(warp_uid);
+      take_warp(m_current_warps.find(warp_uid), rt_inst);
     }
   }
   
@@ -4107,8 +3704,8 @@ void rt_unit::cycle() {
 
   // Prioritize prefetches
   prefetch_access = false;
-  if (m_config->m_treelet_prefetch && !prefetch_mem_access_q.empty() && !m_current_warps.empty() && m_config->prioritize_prefetches) {
-    warp_inst_t dummy_rt_inst = m_current_warps.begin()->second;
+  if (m_prefetcher && !m_prefetch_queue.empty() && !m_current_warps.empty() && m_config->prioritize_prefetches) {
+    warp_inst_t &dummy_rt_inst = m_current_warps.begin()->second;
     send_prefetch_request(dummy_rt_inst);
   }
 
@@ -4118,24 +3715,18 @@ void rt_unit::cycle() {
   }
 
   // Schedule a prefetch request if nothing was sent in memory_cycle (Prioritize demand loads)
-  if (m_config->m_treelet_prefetch && prefetch_opportunity && !m_current_warps.empty() && !m_config->prioritize_prefetches) {
-    warp_inst_t dummy_rt_inst = m_current_warps.begin()->second;
-    send_prefetch_request(dummy_rt_inst);
-  }
-
-  // Lee MICRO 2010 Prefetcher
-  if (m_config->m_lee_micro_prefetcher && prefetch_opportunity && !m_current_warps.empty() && !m_config->prioritize_prefetches) {
-    warp_inst_t dummy_rt_inst = m_current_warps.begin()->second;
+  if (m_prefetcher && prefetch_opportunity && !m_current_warps.empty() && !m_config->prioritize_prefetches) {
+    warp_inst_t &dummy_rt_inst = m_current_warps.begin()->second;
     send_prefetch_request(dummy_rt_inst);
   }
 
   // Place warp back
-  if (!rt_inst.empty()) m_current_warps[rt_inst.get_uid()] = rt_inst;
+  if (!rt_inst.empty()) put_back_warp(rt_inst);
   
   // Check to see if any warps are complete
   int completed_warp_uid = -1;
   for (auto it=m_current_warps.begin(); it!=m_current_warps.end(); it++) {
-    warp_inst_t debug_inst = it->second;
+    const warp_inst_t &debug_inst = it->second;
     assert(it->first == debug_inst.get_uid());
     RT_DPRINTF("Checking warp inst uid: %d\n", debug_inst.get_uid());
     // A completed warp has no more memory accesses and all the intersection delays are complete and has no pending writes
@@ -4149,7 +3740,7 @@ void rt_unit::cycle() {
         // Track number of warps in RT core
         n_warps--;
         assert(n_warps >= 0 && n_warps <= m_config->m_rt_max_warps);
-        GPGPU_Context()->the_gpgpusim->g_the_gpu->writeback_cycles.push_back(GPGPU_Context()->the_gpgpusim->g_the_gpu->gpu_sim_cycle);
+        m_core->get_gpu()->rt_warp_written_back(m_sid, it->first);
 
         
         // Track completed warp uid
@@ -4198,6 +3789,7 @@ void rt_unit::cycle() {
   // Remove complete warp
   if (completed_warp_uid >= 0) {
     m_current_warps.erase(completed_warp_uid);
+    if (m_config->m_treelet_prefetch) m_treelet_popularity.warp_retired(completed_warp_uid);
 
     if (m_config->m_keep_accepting_warps) {
       if (m_config->m_treelet_sort) {
@@ -4214,9 +3806,8 @@ void rt_unit::cycle() {
       sorted = false;
       executing = false;
       
-      // Clear out the prefetch_mem_access_q so it doesnt clog up the next batch of warps
-      prefetch_mem_access_q.clear();
-      prefetch_generation_cycles.clear();
+      // Clear out the prefetch queue so it doesnt clog up the next batch of warps
+      m_prefetch_queue.clear();
     }
   }
 
@@ -4227,9 +3818,8 @@ void rt_unit::cycle() {
       accept_new_warps = true;
       sorted = false;
       
-      // Clear out the prefetch_mem_access_q so it doesnt clog up the next batch of warps
-      prefetch_mem_access_q.clear();
-      prefetch_generation_cycles.clear();
+      // Clear out the prefetch queue so it doesnt clog up the next batch of warps
+      m_prefetch_queue.clear();
     }
   }
   
@@ -4237,6 +3827,80 @@ void rt_unit::cycle() {
   assert(cacheline_count <= 2);
 }
 
+void rt_unit::sample_warp_stats(unsigned n_threads, unsigned active_threads,
+                                const std::map<new_addr_type, unsigned> &addr_set) {
+  // AerialVision stats
+  m_stats->rt_nwarps[m_sid] = n_warps;
+  m_stats->rt_nthreads[m_sid] = active_threads;
+  m_stats->rt_naccesses[m_sid] = addr_set.size();
+  m_stats->rt_nthreads_intersection[m_sid] = n_threads;
+  unsigned max = 0;
+  for (auto it=addr_set.begin(); it!=addr_set.end(); it++) {
+    if (it->second > max) {
+      max = it->second;
+    }
+  }
+  m_stats->rt_max_coalesce[m_sid] = max;
+  m_stats->rt_mshr_size[m_sid] = L1D->num_mshr_entries();
+}
+
+unsigned long long rt_unit::quiet_cycles() {
+  // Batching, sorting, prefetching and the coherence engine keep their own
+  // per cycle state
+  if (m_config->m_pipelined_treelet_queue || m_config->m_treelet_queue ||
+      m_config->m_rt_coherence_engine || m_prefetcher ||
+      (m_config->m_keep_accepting_warps && m_config->m_treelet_sort))
+    return 0;
+  if (!m_dispatch_reg->empty() || !m_response_fifo.empty()) return 0;
+  if (!mem_access_q.empty() || !mem_store_q.empty()) return 0;
+  if (m_L0_complet->access_ready() || !m_L0_complet->idle()) return 0;
+  if (L1D->access_ready()) return 0;
+
+  // Every warp waits on memory or an intersection test
+  unsigned long long cycles = -1;
+  for (auto it=m_current_warps.begin(); it!=m_current_warps.end(); ++it) {
+    const warp_inst_t &inst = it->second;
+    if (!inst.is_stalled()) return 0;
+    if (inst.rt_mem_accesses_empty() && inst.rt_intersection_delay_done() &&
+        !inst.has_pending_writes())
+      return 0;
+    cycles = std::min(cycles, inst.rt_quiet_cycles());
+  }
+  return cycles;
+}
+
+void rt_unit::skip_cycles(unsigned long long cycles) {
+  cacheline_count = 0;
+  if (cycles >= MAX_ALU_LATENCY)
+    occupied.reset();
+  else
+    occupied >>= cycles;
+
+  if (n_warps > 0) {
+    m_stats->rt_total_cycles[m_sid] += cycles;
+    m_stats->rt_total_cycles_sum += cycles;
+  }
+
+  unsigned n_threads = 0;
+  unsigned active_threads = 0;
+  std::map<new_addr_type, unsigned> addr_set;
+  for (auto it=m_current_warps.begin(); it!=m_current_warps.end(); ++it) {
+    n_threads += (it->second).rt_skip_cycles(cycles);
+    active_threads += (it->second).get_rt_active_threads();
+    (it->second).num_unique_mem_access(addr_set);
+  }
+  m_stats->rt_total_intersection_stages[m_sid] += n_threads * cycles;
+  sample_warp_stats(n_threads, active_threads, addr_set);
+
+  m_L0_complet->cycle_idle(cycles);
+  prev_n_warps = n_warps;
+  prev_n_queued_warps = n_queued_warps;
+
+  // Sets the flags an idle memory_cycle() would
+  warp_inst_t rt_inst;
+  memory_cycle(rt_inst);
+}
+
 void rt_unit::process_memory_response(mem_fetch* mf, warp_inst_t &pipe_reg) {
                     
   // If more than 1 warp in RT unit:
@@ -4307,24 +3971,27 @@ void rt_unit::process_memory_response(mem_fetch* mf, warp_inst_t &pipe_reg) {
 void rt_unit::schedule_next_warp(warp_inst_t &inst) {
   // Return if there are no warps in the RT unit
   if (m_current_warps.empty()) return;
+
+  uint8_t* focus_treelet = m_prefetcher ? m_prefetcher->focus_treelet() : NULL;
+  auto chosen = m_current_warps.end();
   
-  else if (m_config->m_treelet_scheduler == 1 && m_config->m_treelet_prefetch == 1) // If the warp has a thread whos access falls in the last_prefetched_treelet, then issue it
+  if (m_config->m_treelet_scheduler == 1 && m_config->m_treelet_prefetch == 1) // If the warp has a thread whos access falls in the focus_treelet, then issue it
   {
-    // Prioritize warps with an access from the most popular treelet. Its saved in rt_unit::last_prefetched_treelet
+    // Prioritize warps with an access from the most popular treelet. It's the prefetcher's focus_treelet()
     bool found = false;
     for (auto it=m_current_warps.begin(); it!=m_current_warps.end(); ++it) {
       if (!((it->second).is_stalled())) { 
         for (int i = 0; i < 32; i++) {
           if (!it->second.get_thread_info(i).RT_mem_accesses.empty()) {
-            if (VulkanRayTracing::addrToTreeletID((uint8_t*)(it->second.get_thread_info(i).RT_mem_accesses.front().address)) == last_prefetched_treelet) {
-              inst = it->second;
+            if (VulkanRayTracing::addrToTreeletID((uint8_t*)(it->second.get_thread_info(i).RT_mem_accesses.front().address)) == focus_treelet) {
+              chosen = it;
               found = true;
               break;
             }
           }
         }
         if (found) {
-          RT_SCHEDULER_DPRINTF("Shader %d: RT scheduler found warp inst %d that matches the current prefetched treelet, Cycle %d\n", m_sid, inst.get_uid(), GPGPU_Context()->the_gpgpusim->g_the_gpu->gpu_sim_cycle, inst.get_uid());
+          RT_SCHEDULER_DPRINTF("Shader %d: RT scheduler found warp inst %d that matches the current prefetched treelet, Cycle %d\n", m_sid, chosen->first, GPGPU_Context()->the_gpgpusim->g_the_gpu->gpu_sim_cycle, chosen->first);
           break;
         }
       }
@@ -4332,63 +3999,73 @@ void rt_unit::schedule_next_warp(warp_inst_t &inst) {
     if (!found) { // if not found, then revert to normal scheduling
       for (auto it=m_current_warps.begin(); it!=m_current_warps.end(); ++it) {
         if (!((it->second).is_stalled())) { 
-          inst = it->second;
+          chosen = it;
           RT_SCHEDULER_DPRINTF("Shader %d: RT scheduler reverts to normal scheduling since no warp insts matches the current prefetched treelet, Cycle %d\n", m_sid, GPGPU_Context()->the_gpgpusim->g_the_gpu->gpu_sim_cycle);
           break;
         }
       }
     }
-    if (!inst.empty()) m_current_warps.erase(inst.get_uid());
   }
-  else if (m_config->m_treelet_scheduler == 2 && m_config->m_treelet_prefetch == 1) // If the warp with the most threads matching with the last_prefetched_treelet and issue it
+  else if (m_config->m_treelet_scheduler == 2 && m_config->m_treelet_prefetch == 1) // If the warp with the most threads matching with the focus_treelet and issue it
   {
-    // Prioritize warps with an access from the most popular treelet. Its saved in rt_unit::last_prefetched_treelet
+    // Prioritize warps with an access from the most popular treelet. It's the prefetcher's focus_treelet()
     bool found = false;
     int max_inst_count = 0;
-    warp_inst_t max_inst;
+    auto max_inst = m_current_warps.end();
     for (auto it=m_current_warps.begin(); it!=m_current_warps.end(); ++it) {
       int current_inst_count = 0;
       if (!((it->second).is_stalled())) { 
         for (int i = 0; i < 32; i++) {
           if (!it->second.get_thread_info(i).RT_mem_accesses.empty()) {
-            if (VulkanRayTracing::addrToTreeletID((uint8_t*)(it->second.get_thread_info(i).RT_mem_accesses.front().address)) == last_prefetched_treelet) {
+            if (VulkanRayTracing::addrToTreeletID((uint8_t*)(it->second.get_thread_info(i).RT_mem_accesses.front().address)) == focus_treelet) {
               current_inst_count++;
             }
           }
         }
         if (current_inst_count > max_inst_count) {
           found = true;
-          max_inst = it->second;
+          max_inst = it;
           max_inst_count = current_inst_count;
         }
       }
     }
     if (found) {
-      inst = max_inst;
-      RT_SCHEDULER_DPRINTF("Shader %d: RT scheduler found warp inst %d that matches the current prefetched treelet with %d threads, Cycle %d\n", m_sid, inst.get_uid(), max_inst_count, GPGPU_Context()->the_gpgpusim->g_the_gpu->gpu_sim_cycle, inst.get_uid());
+      chosen = max_inst;
+      RT_SCHEDULER_DPRINTF("Shader %d: RT scheduler found warp inst %d that matches the current prefetched treelet with %d threads, Cycle %d\n", m_sid, chosen->first, max_inst_count, GPGPU_Context()->the_gpgpusim->g_the_gpu->gpu_sim_cycle, chosen->first);
     }
     else { // if not found, then revert to normal scheduling
       for (auto it=m_current_warps.begin(); it!=m_current_warps.end(); ++it) {
         if (!((it->second).is_stalled())) { 
-          inst = it->second;
+          chosen = it;
           RT_SCHEDULER_DPRINTF("Shader %d: RT scheduler reverts to normal scheduling since no warp insts matches the current prefetched treelet, Cycle %d\n", m_sid, GPGPU_Context()->the_gpgpusim->g_the_gpu->gpu_sim_cycle);
           break;
         }
       }
     }
-    if (!inst.empty()) m_current_warps.erase(inst.get_uid());
   }
 
   // Otherwise, find the first non-stalled warp (treelet_scheduler 0)
   else {
     for (auto it=m_current_warps.begin(); it!=m_current_warps.end(); ++it) {
       if (!((it->second).is_stalled())) { 
-        inst = it->second;
+        chosen = it;
         break;
       }
     }
-    if (!inst.empty()) m_current_warps.erase(inst.get_uid());
   }
+
+  if (chosen != m_current_warps.end()) take_warp(chosen, inst);
+}
+
+void rt_unit::take_warp(std::map<unsigned, warp_inst_t>::iterator it, warp_inst_t &inst) {
+  assert(it != m_current_warps.end());
+  inst = std::move(it->second);
+  m_current_warps.erase(it);
+}
+
+void rt_unit::put_back_warp(warp_inst_t &inst) {
+  m_current_warps[inst.get_uid()] = std::move(inst);
+  inst.clear();
 }
 
 void rt_unit::memory_cycle(warp_inst_t &inst) {
@@ -4411,8 +4088,7 @@ void rt_unit::memory_cycle(warp_inst_t &inst) {
     assert(inst.empty());
     RT_DPRINTF("Shader %d: Prioritizing stores\n", m_sid);
     mf = process_memory_stores();
-    inst = mf->get_inst();
-    m_current_warps.erase(inst.get_uid());
+    take_warp(m_current_warps.find(mf->get_inst().get_uid()), inst);
     mem_access_q_type = static_cast<int>(TransactionType::UNDEFINED);
     if (mf) process_cache_access(L1D, inst, mf);
   }
@@ -4453,11 +4129,21 @@ void rt_unit::memory_cycle(warp_inst_t &inst) {
 void rt_unit::send_prefetch_request(warp_inst_t &inst) {
   mem_fetch *mf;
 
-  if (!prefetch_mem_access_q.empty()) {
+  // Skip prefetches the cache already has or is already fetching
+  if (m_config->m_rt_prefetch_drop_resident) {
+    baseline_cache *cache = m_config->m_rt_use_l1d ? (baseline_cache *)L1D : (baseline_cache *)m_L0_complet;
+    while (!m_prefetch_queue.empty() && cache->sector_present(m_prefetch_queue.front().addr)) {
+      TOMMY_DPRINTF("Shader %d: Dropping prefetch for 0x%x, already in cache or MSHR\n", m_sid, m_prefetch_queue.front().addr);
+      m_prefetch_queue.pop_front();
+      prefetches_dropped_resident++;
+    }
+  }
+
+  if (!m_prefetch_queue.empty()) {
     if (m_config->wait_for_metadata_load) {
       // If prefetch addr falls in metadata addrs then go ahead and send it
-      bool is_treelet_metadata = prefetch_mem_access_q.front().second >= (new_addr_type)VulkanRayTracing::treelet_metadata && 
-                                 prefetch_mem_access_q.front().second <= ((new_addr_type)VulkanRayTracing::treelet_metadata + VulkanRayTracing::treelet_roots_addr_only.size() * VulkanRayTracing::per_treelet_metadata_size);
+      bool is_treelet_metadata = m_prefetch_queue.front().base_addr >= (new_addr_type)VulkanRayTracing::treelet_metadata && 
+                                 m_prefetch_queue.front().base_addr <= ((new_addr_type)VulkanRayTracing::treelet_metadata + VulkanRayTracing::treelet_roots_addr_only.size() * VulkanRayTracing::per_treelet_metadata_size);
       if (is_treelet_metadata) {
         //TOMMY_DPRINTF("Sending prefetch request\n");
         prefetch_access = true;
@@ -4469,7 +4155,7 @@ void rt_unit::send_prefetch_request(warp_inst_t &inst) {
       }
       else { // Regular Prefetch Request
         // If prefetch addr is not metadata, check to see if metadata is loaded
-        uint8_t* current_treelet = VulkanRayTracing::addrToTreeletID((uint8_t*)prefetch_mem_access_q.front().second);
+        uint8_t* current_treelet = VulkanRayTracing::addrToTreeletID((uint8_t*)m_prefetch_queue.front().base_addr);
         new_addr_type metadata_offset = (new_addr_type)(VulkanRayTracing::treelet_addr_to_metadata_idx[current_treelet] * VulkanRayTracing::per_treelet_metadata_size);
         new_addr_type metadata_addr = (new_addr_type)(VulkanRayTracing::treelet_metadata) + metadata_offset;
         if (most_recently_loaded_metadata_addr == metadata_addr) {
@@ -4506,6 +4192,7 @@ void rt_unit::writeback() {
   while (m_L0_complet->access_ready()) {
     mem_fetch *mf = m_L0_complet->next_access();
     // m_next_wb = mf->get_inst();
+    if (mf->isprefetch()) prefetch_returned(mf);
     delete mf;
     // serviced_client = next_client;
   }
@@ -4513,11 +4200,18 @@ void rt_unit::writeback() {
   while (L1D->access_ready() && L1D->next_access_rt()) {
     mem_fetch *mf = L1D->next_access();
     // m_next_wb = mf->get_inst();
+    // Prefetches merged into another MSHR entry return here
+    if (mf->isprefetch()) prefetch_returned(mf);
     delete mf;
     // serviced_client = next_client;
   }
 }
 
+void rt_unit::prefetch_returned(mem_fetch *mf) {
+  prefetch_tracker.filled(mf->get_request_uid(), mf->get_uncoalesced_addr(), mf->get_prefetch_issue_cycle(),
+                          m_core->get_gpu()->gpu_sim_cycle + m_core->get_gpu()->gpu_tot_sim_cycle);
+}
+
 
 mem_access_t rt_unit::create_mem_access(new_addr_type addr) {
   // RT-CORE NOTE Temporary hard coded values
@@ -4549,14 +4243,14 @@ mem_access_t rt_unit::create_mem_access(new_addr_type addr) {
 
 
 mem_fetch* rt_unit::process_prefetch_queue(warp_inst_t &inst) {
-  assert(!prefetch_mem_access_q.empty());
+  assert(!m_prefetch_queue.empty());
 
-  new_addr_type next_addr = prefetch_mem_access_q.front().first;
-  new_addr_type base_addr = prefetch_mem_access_q.front().second;
-  unsigned prefetch_generation_cycle = prefetch_generation_cycles.front().first;
+  m_issued_prefetch = m_prefetch_queue.front();
+  new_addr_type next_addr = m_issued_prefetch.addr;
+  new_addr_type base_addr = m_issued_prefetch.base_addr;
+  unsigned prefetch_generation_cycle = m_issued_prefetch.generation_cycle;
   //new_addr_type base_addr = mem_access_q_base_addr;
-  prefetch_mem_access_q.pop_front();
-  prefetch_generation_cycles.pop_front();
+  m_prefetch_queue.pop_front();
 
   // Create the mem_access_t
   mem_access_t access = create_mem_access(next_addr);
@@ -4564,7 +4258,7 @@ mem_fetch* rt_unit::process_prefetch_queue(warp_inst_t &inst) {
   TOMMY_DPRINTF("Shader %d: Prefetching mem_access_t created for 0x%x (block address 0x%x, base address 0x%x, Cycle: %d)\n", m_sid, next_addr, access.get_addr(), base_addr, GPGPU_Context()->the_gpgpusim->g_the_gpu->gpu_sim_cycle);
   
   // Create mf
-  mem_fetch *mf = m_mf_allocator->alloc(
+  mem_fetch *mf = m_mf_allocator->alloc_rt(
     inst, access, m_core->get_gpu()->gpu_sim_cycle + m_core->get_gpu()->gpu_tot_sim_cycle
   ); 
   mf->set_raytrace();
@@ -4580,7 +4274,8 @@ mem_fetch* rt_unit::process_prefetch_queue(warp_inst_t &inst) {
   prefetch_info.m_block_addr = L1D->get_cache_config().mshr_addr(next_addr); // should I use the mshr_addr or the cacheline address? probably mshr_addr since we are working with a sector cache
   prefetch_info.prefetch_generation_time = prefetch_generation_cycle;
   prefetch_info.prefetch_issue_time = m_core->get_gpu()->gpu_sim_cycle + m_core->get_gpu()->gpu_tot_sim_cycle;
-  prefetch_request_tracker[prefetch_info.m_block_addr].push_back(prefetch_info);
+  prefetch_info.policy = m_prefetcher ? m_prefetcher->policy() : 0;
+  prefetch_tracker.issued(prefetch_info);
 
   if (VulkanRayTracing::isTreeletRoot((uint8_t*)next_addr)) {
     prefetch_generate_issue_cycle_difference += prefetch_info.prefetch_issue_time - prefetch_info.prefetch_generation_time;
@@ -4625,7 +4320,7 @@ mem_fetch* rt_unit::process_memory_stores() {
   RT_DPRINTF("Shader %d: store mem_access_t created for 0x%x\n", m_sid, access.get_addr());
   
   // Create mf
-  mem_fetch *mf = m_mf_allocator->alloc(
+  mem_fetch *mf = m_mf_allocator->alloc_rt(
     m_current_warps[warp_uid], access, m_core->get_gpu()->gpu_sim_cycle + m_core->get_gpu()->gpu_tot_sim_cycle
   ); 
   mf->set_raytrace();
@@ -4648,36 +4343,16 @@ mem_fetch* rt_unit::process_memory_chunks(warp_inst_t &inst) {
   RT_DPRINTF("Shader %d: mem_access_t created for 0x%x (block address 0x%x, base address 0x%x)\n", m_sid, next_addr, access.get_addr(), base_addr);
   
   // Create mf
-  mem_fetch *mf = m_mf_allocator->alloc(
+  mem_fetch *mf = m_mf_allocator->alloc_rt(
     inst, access, m_core->get_gpu()->gpu_sim_cycle + m_core->get_gpu()->gpu_tot_sim_cycle
   ); 
   mf->set_raytrace();
   m_stats->gpgpu_n_rt_mem[mem_access_q_type]++;
 
   // Remove duplicate entries from prefetch queue
-  if (m_config->m_treelet_prefetch) {
-    for (int idx = 0; idx < prefetch_mem_access_q.size(); idx++) {
-      if (next_addr == prefetch_mem_access_q[idx].first) {
-        assert(prefetch_mem_access_q[idx].first == prefetch_generation_cycles[idx].second);
-        prefetch_mem_access_q.erase(prefetch_mem_access_q.begin() + idx);
-        prefetch_generation_cycles.erase(prefetch_generation_cycles.begin() + idx);
-        TOMMY_DPRINTF("Shader %d: Removing address 0x%x from prefetch queue due to demand load\n", m_sid, next_addr);
-        prefetches_removed_from_queue++;
-      }
-    }
-  }
-
-  // Remove duplicate entries from prefetch queue (Lee MICRO 2010)
-  if (m_config->m_lee_micro_prefetcher) {
-    for (int idx = 0; idx < prefetch_mem_access_q.size(); idx++) {
-      if (next_addr == prefetch_mem_access_q[idx].first) {
-        assert(prefetch_mem_access_q[idx].first == prefetch_generation_cycles[idx].second);
-        prefetch_mem_access_q.erase(prefetch_mem_access_q.begin() + idx);
-        prefetch_generation_cycles.erase(prefetch_generation_cycles.begin() + idx);
-        TOMMY_DPRINTF("Shader %d: Removing address 0x%x from prefetch queue due to demand load\n", m_sid, next_addr);
-        prefetches_removed_from_queue++;
-      }
-    }
+  if (m_prefetcher && m_prefetch_queue.cancel(next_addr)) {
+    TOMMY_DPRINTF("Shader %d: Removing address 0x%x from prefetch queue due to demand load\n", m_sid, next_addr);
+    prefetches_removed_from_queue++;
   }
 
   return mf;
@@ -4694,42 +4369,23 @@ mem_fetch* rt_unit::process_memory_access_queue(warp_inst_t &inst) {
     next_access = inst.get_next_rt_mem_transaction();
   }
 
-  // // Tor's suggestion for the map from treelet ID to sequence ID
-  // std::map <new_addr_type, unsigned> &treeletIDToRayIDMap = GPGPU_Context()->the_gpgpusim->g_the_gpu->treeletIDToRayIDMap;
-  // std::map <new_addr_type, std::map <unsigned, unsigned>> &per_treelet_difference_histogram = GPGPU_Context()->the_gpgpusim->g_the_gpu->per_treelet_difference_histogram;
-
-  // new_addr_type next_access_treelet = (new_addr_type)VulkanRayTracing::addrToTreeletID((uint8_t*)next_access.address);
-  // for (unsigned i=0; i<m_config->warp_size; i++) {
-  //   if (!inst.get_RT_mem_accesses(i).empty()) {
-  //     if (inst.get_RT_mem_accesses(i).front().address == next_access.address) {
-  //       assert(inst.get_rt_ray_properties(i).rayid > 0);
-  //       if (treeletIDToRayIDMap.count(next_access_treelet) == 0) { // new treelet, add to map along with ray id
-  //         treeletIDToRayIDMap[next_access_treelet] = inst.get_rt_ray_properties(i).rayid;
-  //       }
-  //       else {
-  //         unsigned difference = inst.get_rt_ray_properties(i).rayid - treeletIDToRayIDMap[next_access_treelet]; // find difference between current ray id and previous ray id and add to histogram
-  //         per_treelet_difference_histogram[next_access_treelet][difference]++;
-  //         treeletIDToRayIDMap[next_access_treelet] = inst.get_rt_ray_properties(i).rayid; // update with new ray id
-  //       }
-  //     }
-  //   }
-  // }
+  // Treelet / ray ID sequence study (Tor's suggestion), post-processed from the trace
+  if (m_core->get_gpu()->rt_access_tracing()) {
+    unsigned next_access_treelet = VulkanRayTracing::flat_treelet_index.node_treelet((uint8_t*)next_access.address);
+    for (unsigned i=0; i<m_config->warp_size; i++) {
+      if (!inst.rt_mem_accesses_empty(i) && inst.get_thread_info(i).RT_mem_accesses.front().address == next_access.address) {
+        assert(inst.get_rt_ray_properties(i).rayid > 0);
+        m_core->get_gpu()->rt_treelet_ray_access(m_sid, next_access_treelet, inst.get_rt_ray_properties(i).rayid);
+      }
+    }
+  }
 
   new_addr_type next_addr = next_access.address;
   new_addr_type base_addr = next_access.address;
   
   // Stats for Treelet limit study
-  // std::map<new_addr_type, unsigned long long> address_cycle_pair;
-  // address_cycle_pair[next_addr] = GPGPU_Context()->the_gpgpusim->g_the_gpu->gpu_sim_cycle;
-  // GPGPU_Context()->the_gpgpusim->g_the_gpu->rt_address_cycle_pair.push_back(address_cycle_pair);
-
-  // uint8_t* treelet_root = VulkanRayTracing::addrToTreeletID((uint8_t*)next_addr);
-  // std::vector<StackEntry> nodes_in_treelet = VulkanRayTracing::treelet_roots_addr_only[treelet_root];
-
-  // std::ofstream memoryTransactionsFile;
-  // memoryTransactionsFile.open("addr_issue_cycle.txt", std::ios_base::app);
-  // //memoryTransactionsFile << "address,cycle,,size,warpid" << std::endl;
-  // memoryTransactionsFile << (void *)next_access.address << "," << GPGPU_Context()->the_gpgpusim->g_the_gpu->gpu_sim_cycle << "," << next_access.size << "," << inst.get_warp_id() << std::endl;
+  m_core->get_gpu()->rt_access_issued(m_sid, inst.get_uid(), next_access.address, next_access.size,
+                                      static_cast<unsigned>(next_access.type));
 
   // Track memory access type stats
   mem_access_q_type = static_cast<int>(next_access.type);
@@ -4756,76 +4412,21 @@ mem_fetch* rt_unit::process_memory_access_queue(warp_inst_t &inst) {
   RT_DPRINTF("Shader %d: mem_access_t created for 0x%x (block address 0x%x, base address 0x%x)\n", m_sid, next_addr, access.get_addr(), base_addr);
   
   // Create mf
-  mem_fetch *mf = m_mf_allocator->alloc(
+  mem_fetch *mf = m_mf_allocator->alloc_rt(
     inst, access, m_core->get_gpu()->gpu_sim_cycle + m_core->get_gpu()->gpu_tot_sim_cycle
   ); 
   mf->set_raytrace();
   m_stats->gpgpu_n_rt_mem[mem_access_q_type]++;
 
   // Remove duplicate entries from prefetch queue
-  if (m_config->m_treelet_prefetch) {
-    for (int idx = 0; idx < prefetch_mem_access_q.size(); idx++) {
-      if (next_addr == prefetch_mem_access_q[idx].first) {
-        assert(prefetch_mem_access_q[idx].first == prefetch_generation_cycles[idx].second);
-        prefetch_mem_access_q.erase(prefetch_mem_access_q.begin() + idx);
-        prefetch_generation_cycles.erase(prefetch_generation_cycles.begin() + idx);
-        TOMMY_DPRINTF("Shader %d: Removing address 0x%x from prefetch queue due to demand load\n", m_sid, next_addr);
-        prefetches_removed_from_queue++;
-      }
-    }
+  if (m_prefetcher && m_prefetch_queue.cancel(next_addr)) {
+    TOMMY_DPRINTF("Shader %d: Removing address 0x%x from prefetch queue due to demand load\n", m_sid, next_addr);
+    prefetches_removed_from_queue++;
   }
 
-  // Remove duplicate entries from prefetch queue
-  if (m_config->m_lee_micro_prefetcher) {
-    for (int idx = 0; idx < prefetch_mem_access_q.size(); idx++) {
-      if (next_addr == prefetch_mem_access_q[idx].first) {
-        assert(prefetch_mem_access_q[idx].first == prefetch_generation_cycles[idx].second);
-        prefetch_mem_access_q.erase(prefetch_mem_access_q.begin() + idx);
-        prefetch_generation_cycles.erase(prefetch_generation_cycles.begin() + idx);
-        TOMMY_DPRINTF("Shader %d: Removing address 0x%x from prefetch queue due to demand load\n", m_sid, next_addr);
-        prefetches_removed_from_queue++;
-      }
-    }
-  }
 
-
-  // Lee MICRO 2010 Prefetcher
-  if (m_config->m_lee_micro_prefetcher) {
-    // Train
-    // PWS table 
-    if (pws_table.count(inst.get_warp_id()) == 0) { // If a warp has no accesses previously
-      pws_last_accessed_addr[inst.get_warp_id()] = next_addr;
-    }
-    else {
-      if (pws_table[inst.get_warp_id()].size() <= 32) {
-        int stride = next_addr - pws_last_accessed_addr[inst.get_warp_id()];
-        pws_table[inst.get_warp_id()][stride]++;
-      }
-    }
-
-    // Find largest stride for this warp
-    int largest_stride = 0;
-    int largest_stride_count = 0;
-    for (auto warp_stride_table : pws_table[inst.get_warp_id()]) {
-      if (warp_stride_table.second > largest_stride_count) {
-        largest_stride = warp_stride_table.first;
-        largest_stride_count = warp_stride_table.second;
-      }
-    }
-
-    // Generate Prefetch
-    new_addr_type prefetch_addr = next_addr + largest_stride;
-
-    // Add to Prefetch Queue
-    if (m_config->m_max_prefetch_queue_size <= prefetch_mem_access_q.size()) {
-      for (unsigned i=0; i<2; i++) {
-        prefetch_mem_access_q.push_back(std::make_pair((new_addr_type)(prefetch_addr + i * 32), (new_addr_type)prefetch_addr));
-        prefetch_generation_cycles.push_back(std::make_pair(m_core->get_gpu()->gpu_sim_cycle + m_core->get_gpu()->gpu_tot_sim_cycle, (new_addr_type)(prefetch_addr + i * 32)));
-        TOMMY_DPRINTF("0x%x, ", (new_addr_type)prefetch_addr + i * 32);
-        prefetches_added_to_queue++;
-      }
-    }
-  }
+  // Train the prefetcher on demand accesses
+  if (m_prefetcher) m_prefetcher->access_issued(inst, next_addr);
 
   // Treelet Prefetching
   // if (m_config->m_treelet_prefetch && nodes_in_treelet.size() + prefetch_mem_access_q.size() <= 1000) {
@@ -4898,7 +4499,7 @@ void rt_unit::process_cache_access(baseline_cache *cache, warp_inst_t &inst, mem
         m_warp_pointers[it->first] = &it->second;
       }
       m_ray_coherence_engine->process_response(mf, m_warp_pointers, &inst);
-      if (!inst.empty()) m_current_warps[inst.get_uid()] = inst;
+      if (!inst.empty()) put_back_warp(inst);
       inst.clear();
     }
     else {
@@ -5009,9 +4610,9 @@ void rt_unit::process_cache_access(baseline_cache *cache, warp_inst_t &inst, mem
       else {
         RT_DPRINTF("Shader %d: Reservation fail, undoing request for 0x%x (base 0x%x)\n", m_sid, mf->get_uncoalesced_addr(), mf->get_uncoalesced_base_addr());
         if (prefetch_access) {
-          prefetch_mem_access_q.push_front(std::make_pair(mf->get_uncoalesced_addr(), mf->get_uncoalesced_base_addr()));
-          prefetch_generation_cycles.push_front(std::make_pair(mf->get_prefetch_generation_cycle(), mf->get_uncoalesced_addr()));
-          prefetch_request_tracker[cache->get_cache_config().mshr_addr(mf->get_uncoalesced_addr())].pop_back();
+          assert(m_issued_prefetch.addr == mf->get_uncoalesced_addr());
+          m_prefetch_queue.push_front(m_issued_prefetch);
+          prefetch_tracker.discard_last(cache->get_cache_config().mshr_addr(mf->get_uncoalesced_addr()));
           prefetches_readded_to_queue++;
         }
         else {
@@ -5029,9 +4630,9 @@ void rt_unit::process_cache_access(baseline_cache *cache, warp_inst_t &inst, mem
     else {
       RT_DPRINTF("Shader %d: Reservation fail, undoing request for 0x%x (base 0x%x)\n", m_sid, mf->get_uncoalesced_addr(), mf->get_uncoalesced_base_addr());
       if (prefetch_access) {
-        prefetch_mem_access_q.push_front(std::make_pair(mf->get_uncoalesced_addr(), mf->get_uncoalesced_base_addr()));
-        prefetch_generation_cycles.push_front(std::make_pair(mf->get_prefetch_generation_cycle(), mf->get_uncoalesced_addr()));
-        prefetch_request_tracker[cache->get_cache_config().mshr_addr(mf->get_uncoalesced_addr())].pop_back();
+        assert(m_issued_prefetch.addr == mf->get_uncoalesced_addr());
+        m_prefetch_queue.push_front(m_issued_prefetch);
+        prefetch_tracker.discard_last(cache->get_cache_config().mshr_addr(mf->get_uncoalesced_addr()));
         prefetches_readded_to_queue++;
       }
       else {
@@ -5067,7 +4668,7 @@ void rt_unit::process_cache_access(baseline_cache *cache, warp_inst_t &inst, mem
         m_warp_pointers[it->first] = &it->second;
       }
       m_ray_coherence_engine->process_response(mf, m_warp_pointers, &inst);
-      if (!inst.empty()) m_current_warps[inst.get_uid()] = inst;
+      if (!inst.empty()) put_back_warp(inst);
       inst.clear();
     }
     else {
@@ -5086,6 +4687,8 @@ void rt_unit::process_cache_access(baseline_cache *cache, warp_inst_t &inst, mem
       }
     }
     
+    // A prefetch that hit never fills a line
+    if (mf->isprefetch()) prefetch_returned(mf);
     if (!mf->is_write()) delete mf;
     
   } else {
@@ -5367,7 +4970,7 @@ inst->space.get_type() != shared_space) { unsigned warp_id = inst->warp_id();
    pipelined_simd_unit::issue(reg_set);
 }
 */
-void ldst_unit::cycle() {
+void ldst_unit::sample_l1d_stats() {
   // Collect aerialvision stats
   unsigned total_access, total_misses, total_hit_res, total_res_fail;
   m_L1D->get_stats(total_access, total_misses, total_hit_res, total_res_fail);
@@ -5376,6 +4979,36 @@ void ldst_unit::cycle() {
   m_stats->l1d_hit_res[m_sid] = total_hit_res;
   m_stats->l1d_res_fail[m_sid] = total_res_fail;
   m_stats->l1d_missrate[m_sid] = (float)total_misses / total_access;
+}
+
+unsigned long long ldst_unit::quiet_cycles() {
+  if (!m_dispatch_reg->empty() || m_dispatch_reg->has_dispatch_delay())
+    return 0;
+  if (!m_next_wb.empty() || m_next_global || !m_response_fifo.empty())
+    return 0;
+  for (unsigned stage = 0; stage < m_pipeline_depth; stage++)
+    if (!m_pipeline_reg[stage]->empty()) return 0;
+  if (m_L1T->access_ready() || !m_L1T->idle()) return 0;
+  if (m_L1C->access_ready() || !m_L1C->idle()) return 0;
+  if (m_L1D) {
+    if (m_L1D->access_ready() || !m_L1D->idle()) return 0;
+    for (unsigned j = 0; j < l1_latency_queue.size(); j++)
+      for (unsigned stage = 0; stage < l1_latency_queue[j].size(); stage++)
+        if (l1_latency_queue[j][stage]) return 0;
+  }
+  // Quiet until a response comes back or an instruction is issued
+  return -1;
+}
+
+void ldst_unit::skip_cycles(unsigned long long cycles) {
+  sample_l1d_stats();
+  m_L1C->cycle_idle(cycles);
+  if (m_L1D) m_L1D->cycle_idle(cycles);
+  m_mem_rc = NO_RC_FAIL;
+}
+
+void ldst_unit::cycle() {
+  sample_l1d_stats();
 
   writeback();
 
@@ -6351,12 +5984,86 @@ void shader_core_ctx::cycle() {
   }
 }
 
+unsigned long long shader_core_ctx::quiet_cycles() {
+  if (!isactive() && get_not_completed() == 0) return -1;
+  if (m_config->model == AWARE_RECONVERGENCE) return 0;
+
+  // decode() and fetch()
+  if (m_inst_fetch_buffer.m_valid) return 0;
+  if (m_L1I->access_ready() || !m_L1I->idle()) return 0;
+  for (unsigned w = 0; w < m_config->max_warps_per_shader; w++) {
+    const shd_warp_t *warp = m_warp[w];
+    if (warp->hardware_done() && !m_scoreboard->pendingWrites(w) &&
+        !warp->done_exit())
+      return 0;
+    if (!warp->functional_done() && !warp->imiss_pending() &&
+        warp->ibuffer_empty())
+      return 0;
+    // the schedulers' waiting() would lift the barrier
+    if (warp->get_membar() && !m_scoreboard->pendingWrites(w)) return 0;
+  }
+
+  // writeback(), read_operands() and issue()
+  if (m_stats->m_num_sim_insn[m_sid] != m_stats->m_last_num_sim_insn[m_sid] ||
+      m_stats->m_num_sim_winsn[m_sid] != m_stats->m_last_num_sim_winsn[m_sid])
+    return 0;
+  for (unsigned i = 0; i < m_pipeline_reg.size(); i++)
+    if (m_pipeline_reg[i].has_ready()) return 0;
+  if (!m_operand_collector.quiet()) return 0;
+  for (unsigned i = 0; i < schedulers.size(); i++) {
+    bool valid_inst;
+    if (!schedulers[i]->quiet(valid_inst)) return 0;
+  }
+
+  // execute(), the units count in their own cycles
+  unsigned long long cycles = -1;
+  for (unsigned n = 0; n < m_num_function_units; n++) {
+    unsigned long long fu_cycles = m_fu[n]->quiet_cycles();
+    if (fu_cycles == (unsigned long long)-1) continue;
+    cycles = std::min(cycles, fu_cycles / m_fu[n]->clock_multiplier());
+    if (!cycles) return 0;
+  }
+  return cycles;
+}
+
+void shader_core_ctx::skip_cycles(unsigned long long cycles) {
+  if (!isactive() && get_not_completed() == 0) return;
+
+  m_stats->shader_cycles[m_sid] += cycles;
+  // writeback() with nothing committed
+  m_stats->m_pipeline_duty_cycle[m_sid] = 0;
+
+  for (unsigned i = 0; i < num_result_bus; i++) {
+    if (cycles >= MAX_ALU_LATENCY)
+      m_result_bus[i]->reset();
+    else
+      *(m_result_bus[i]) >>= cycles;
+  }
+  for (unsigned n = 0; n < m_num_function_units; n++)
+    m_fu[n]->skip_cycles(cycles * m_fu[n]->clock_multiplier());
+  sample_warp_mix(cycles);
+
+  m_operand_collector.skip_steps(cycles * m_config->reg_file_port_throughput);
+  for (unsigned i = 0; i < schedulers.size(); i++)
+    schedulers[i]->skip_cycles(cycles);
+  Issue_Prio = (Issue_Prio + cycles % schedulers.size()) % schedulers.size();
+
+  m_L1I->cycle_idle(cycles * m_config->inst_fetch_throughput);
+}
+
 // Flushes all content of the cache to memory
 
 void shader_core_ctx::cache_flush() { m_ldst_unit->flush(); }
 
 void shader_core_ctx::cache_invalidate() { m_ldst_unit->invalidate(); }
 
+bool opndcoll_rfu_t::quiet() const {
+  if (!m_arbiter.empty()) return false;
+  for (unsigned n = 0; n < m_cu.size(); n++)
+    if (!m_cu[n]->is_free()) return false;
+  return true;
+}
+
 // modifiers
 std::list<opndcoll_rfu_t::op_t> opndcoll_rfu_t::arbiter_t::allocate_reads() {
   std::list<op_t>
@@ -7221,6 +6928,44 @@ void simt_core_cluster::core_cycle() {
   }
 }
 
+unsigned long long simt_core_cluster::quiet_cycles(bool cores_cycled) const {
+  if (!m_response_fifo.empty()) return 0;
+  unsigned long long cycles = -1;
+  if (cores_cycled) {
+    for (unsigned i = 0; i < m_config->n_simt_cores_per_cluster; i++) {
+      cycles = std::min(cycles, m_core[i]->quiet_cycles());
+      if (!cycles) return 0;
+    }
+  }
+  return cycles;
+}
+
+void simt_core_cluster::skip_cycles(unsigned long long cycles,
+                                    bool cores_cycled) {
+  if (!cores_cycled) return;
+  for (unsigned i = 0; i < m_config->n_simt_cores_per_cluster; i++)
+    m_core[i]->skip_cycles(cycles);
+  if (m_config->simt_core_sim_order == 1) {
+    unsigned long long shift = cycles % m_core_sim_order.size();
+    for (unsigned long long i = 0; i < shift; i++)
+      m_core_sim_order.splice(m_core_sim_order.end(), m_core_sim_order,
+                              m_core_sim_order.begin());
+  }
+}
+
+bool simt_core_cluster::cta_quiet(bool selectable) {
+  // Same checks as issue_block2core() without concurrent kernels
+  for (unsigned i = 0; i < m_config->n_simt_cores_per_cluster; i++) {
+    kernel_info_t *kernel = m_core[i]->get_kernel();
+    if (m_gpu->kernel_more_cta_left(kernel)) {
+      if (m_core[i]->can_issue_1block(*kernel)) return false;
+    } else if (m_core[i]->get_not_completed() == 0 && selectable) {
+      return false;
+    }
+  }
+  return true;
+}
+
 void simt_core_cluster::reinit() {
   for (unsigned i = 0; i < m_config->n_simt_cores_per_cluster; i++)
     m_core[i]->reinit(0, m_config->n_thread_per_shader, true);
@@ -56,6 +56,10 @@
 #include "stats.h"
 #include "traffic_breakdown.h"
 #include "ray_coherency_engine.h"
+#include "treelet_popularity.h"
+#include "rt_prefetcher.h"
+#include "rt_prefetch_queue.h"
+#include "prefetch_tracker.h"
 
 #define NO_OP_FLAG 0xFF
 
@@ -413,6 +417,14 @@ class scheduler_unit {  // this can be copied freely, so can be used in std
   // Derived classes can override this function to populate
   // m_supervised_warps with their scheduling policies
   virtual void order_warps() = 0;
+  // True if order_warps() gives the same order every cycle nothing issues
+  virtual bool stateless_order() const { return false; }
+
+  // A cycle() would issue, flush and count down nothing. valid_inst is set if
+  // a warp has a decoded instruction waiting on the scoreboard.
+  bool quiet(bool &valid_inst);
+  // Same as 'cycles' cycle()s while quiet()
+  void skip_cycles(unsigned long long cycles);
 
   int get_schd_id() const { return m_id; }
 
@@ -473,6 +485,7 @@ class lrr_scheduler : public scheduler_unit {
                        mem_out, id) {}
   virtual ~lrr_scheduler() {}
   virtual void order_warps();
+  virtual bool stateless_order() const { return true; }
   virtual void done_adding_supervised_warps() {
     m_last_supervised_issued = m_supervised_warps.end();
   }
@@ -513,6 +526,7 @@ class gto_scheduler : public scheduler_unit {
                        mem_out, id) {}
   virtual ~gto_scheduler() {}
   virtual void order_warps();
+  virtual bool stateless_order() const { return true; }
   virtual void done_adding_supervised_warps() {
     m_last_supervised_issued = m_supervised_warps.begin();
   }
@@ -533,6 +547,7 @@ class oldest_scheduler : public scheduler_unit {
                        mem_out, id) {}
   virtual ~oldest_scheduler() {}
   virtual void order_warps();
+  virtual bool stateless_order() const { return true; }
   virtual void done_adding_supervised_warps() {
     m_last_supervised_issued = m_supervised_warps.begin();
   }
@@ -635,6 +650,12 @@ class opndcoll_rfu_t {  // operand collector based register file unit
     for (unsigned p = 0; p < m_in_ports.size(); p++) allocate_cu(p);
     process_banks();
   }
+  // Nothing to collect, so step() only rotates the read arbiter
+  bool quiet() const;
+  // Same as 'steps' step() calls while quiet()
+  void skip_steps(unsigned long long steps) {
+    m_arbiter.skip_allocations(steps);
+  }
 
   void dump(FILE *fp) const {
     fprintf(fp, "\n");
@@ -847,9 +868,18 @@ class opndcoll_rfu_t {  // operand collector based register file unit
       }
       fprintf(fp, "\n");
     }
+    bool empty() const {
+      for (unsigned b = 0; b < m_num_banks; b++)
+        if (!m_queue[b].empty()) return false;
+      return true;
+    }
 
     // modifiers
     std::list<op_t> allocate_reads();
+    // 'n' allocate_reads() calls while empty()
+    void skip_allocations(unsigned long long n) {
+      m_last_cu = (m_last_cu + n % m_num_collectors) % m_num_collectors;
+    }
 
     void add_read_requests(collector_unit_t *cu) {
       const op_t *src = cu->get_operands();
@@ -943,7 +973,7 @@ class opndcoll_rfu_t {  // operand collector based register file unit
     unsigned get_num_operands() const { return m_warp->get_num_operands(); }
     unsigned get_num_regs() const { return m_warp->get_num_regs(); }
     void dispatch();
-    bool is_free() { return m_free; }
+    bool is_free() const { return m_free; }
 
    private:
     bool m_free;
@@ -1139,6 +1169,11 @@ class simd_function_unit {
   virtual void cycle() = 0;
   virtual void active_lanes_in_pipeline() = 0;
   virtual unsigned active_warps() { return 0; }
+  // cycle()s from now on that only count down and add to per-cycle stats,
+  // -1 if that lasts until something is issued or returned to the unit
+  virtual unsigned long long quiet_cycles() { return 0; }
+  // Same as 'cycles' cycle()s within quiet_cycles()
+  virtual void skip_cycles(unsigned long long cycles) {}
 
   // accessors
   virtual unsigned clock_multiplier() const { return 1; }
@@ -1172,6 +1207,8 @@ class pipelined_simd_unit : public simd_function_unit {
   virtual void cycle();
   virtual void issue(register_set &source_reg);
   virtual unsigned get_active_lanes_in_pipeline();
+  virtual unsigned long long quiet_cycles();
+  virtual void skip_cycles(unsigned long long cycles);
 
   virtual void active_lanes_in_pipeline() = 0;
   /*
@@ -1375,6 +1412,8 @@ class rt_unit : public pipelined_simd_unit {
         virtual void issue(register_set &source_reg);
         virtual bool is_issue_partitioned() { return false; }
         virtual void cycle();
+        virtual unsigned long long quiet_cycles();
+        virtual void skip_cycles(unsigned long long cycles);
         void print(FILE *fout) const;
         virtual bool stallable() const { return true; }
         
@@ -1387,16 +1426,20 @@ class rt_unit : public pipelined_simd_unit {
 
         unsigned active_warps();
 
+        // Called by the L1 when it evicts a line a prefetch filled
+        void prefetch_evicted(new_addr_type block_addr) { if (m_prefetcher) m_prefetcher->evicted(block_addr); }
+
         // For Treelets
-        void sort_mem_accesses(std::deque<RTMemoryTransactionRecord> &mem_accesses, std::map<uint8_t*, int> node_access_counts_per_treelet = {});
+        void sort_mem_accesses(rt_mem_access_log &mem_accesses, const std::map<uint8_t*, int> &node_access_counts_per_treelet = {});
 
         // Prefetching
         void send_prefetch_request(warp_inst_t &inst);
         mem_fetch* process_prefetch_queue(warp_inst_t &inst);
+        // A prefetch came back from the cache or memory
+        void prefetch_returned(mem_fetch *mf);
 
         // Prefetching stats
-        //std::vector<prefetch_block_info> prefetch_request_tracker;
-        std::map<new_addr_type, std::vector<prefetch_block_info>> prefetch_request_tracker; // mshr_addr, list of prefetches belonging to that addr
+        rt_prefetch_tracker prefetch_tracker; // prefetches in flight or resident in the L1, and the aggregates
         unsigned l1_cache_rt_hits_by_prefetches = 0;
         unsigned l1_cache_rt_hits_by_demand_load = 0;
         unsigned l1_cache_rt_misses = 0;
@@ -1413,27 +1456,40 @@ class rt_unit : public pipelined_simd_unit {
         unsigned get_trace_ray_pending_hits() { return trace_ray_pending_hits; }
         unsigned get_unused_prefetch_opportunity() { return unused_prefetch_opportunity; }
         unsigned get_prefetches_issued() { return prefetches_issued; }
-        unsigned get_prefetch_treelet_switches() { return prefetch_treelet_switches; }
-        unsigned get_total_cycles_between_prefetch_treelet_switch() { return total_cycles_between_prefetch_treelet_switch; }
+        unsigned get_prefetch_treelet_switches() { return m_prefetcher ? m_prefetcher->stats().treelet_switches : 0; }
+        unsigned get_total_cycles_between_prefetch_treelet_switch() { return m_prefetcher ? m_prefetcher->stats().cycles_between_treelet_switches : 0; }
         unsigned get_prefetches_added_to_queue() { return prefetches_added_to_queue; }
         unsigned get_prefetches_removed_from_queue() { return prefetches_removed_from_queue; }
         unsigned get_prefetches_readded_to_queue() { return prefetches_readded_to_queue; }
+        unsigned get_prefetches_deduplicated() { return m_prefetch_queue.duplicates(); }
+        unsigned get_prefetches_dropped_queue_full() { return m_prefetch_queue.dropped(); }
+        unsigned get_prefetches_dropped_resident() { return prefetches_dropped_resident; }
+        unsigned get_max_prefetch_queue_occupancy() { return m_prefetch_queue.max_size(); }
         unsigned get_total_demand_load_mf_lat() { return total_demand_load_mf_lat; }
         unsigned get_total_demand_load_mfs() { return total_demand_load_mfs; }
         unsigned get_prefetch_metadata_added() { return prefetch_metadata_added; }
         unsigned get_prefetch_generate_issue_cycle_difference() { return prefetch_generate_issue_cycle_difference; }
         unsigned get_tracked_counts() { return tracked_counts; }
 
-        unsigned get_matches() { return matches; }
-        unsigned get_comparisons() { return comparisons; }
+        unsigned get_matches() { return m_prefetcher ? m_prefetcher->stats().matches : 0; }
+        unsigned get_comparisons() { return m_prefetcher ? m_prefetcher->stats().comparisons : 0; }
+        const rt_prefetcher *get_prefetcher() const { return m_prefetcher; }
         
     protected:
+      friend class rt_prefetcher;
+
       void process_memory_response(mem_fetch* mf, warp_inst_t &pipe_reg);
       mem_fetch* process_memory_stores();
       mem_fetch* process_memory_chunks(warp_inst_t &inst);
       mem_fetch* process_memory_access_queue(warp_inst_t &inst);
       void schedule_next_warp(warp_inst_t &inst);
+      // Move a warp out of m_current_warps for this cycle, and back in
+      void take_warp(std::map<unsigned, warp_inst_t>::iterator it, warp_inst_t &inst);
+      void put_back_warp(warp_inst_t &inst);
       void memory_cycle(warp_inst_t &inst);
+      // AerialVision stats of the warps in the unit
+      void sample_warp_stats(unsigned n_threads, unsigned active_threads,
+                             const std::map<new_addr_type, unsigned> &addr_set);
                           
       virtual void process_cache_access(
             baseline_cache *cache, warp_inst_t &inst, mem_fetch *mf);
@@ -1507,21 +1563,19 @@ class rt_unit : public pipelined_simd_unit {
       std::map<unsigned, bool> sorted_warp_insts; // <warp inst id, sorted or unosrted>, tracks if a warp inst is sorted or not
 
       // Prefetching
-      uint8_t* last_prefetched_treelet = NULL;
-      uint8_t* last_prefetched_second_treelet = NULL;
-      unsigned prefetch_treelet_switches = 0;
-      unsigned timestamp_of_last_treelet = 0;
-      unsigned total_cycles_between_prefetch_treelet_switch = 0;
-      uint8_t* last_rejected_treelet = NULL;
+      treelet_popularity m_treelet_popularity; // treelet of each thread's next access, kept up to date on warp events
+      void sync_treelet_popularity();
+      rt_prefetcher *m_prefetcher; // NULL when -rt_prefetcher is none
       bool prefetch_opportunity = false;
-      std::deque<std::pair<new_addr_type, new_addr_type>> prefetch_mem_access_q; // chunk addr, base addr
-      std::deque<std::pair<unsigned, new_addr_type>> prefetch_generation_cycles; // used to record prefetch req generation cycles so it can be added to the mem_fetch later, chunk addr
+      rt_prefetch_queue m_prefetch_queue;
+      rt_prefetch_entry m_issued_prefetch; // last entry popped by process_prefetch_queue, put back if the cache rejects it
       bool prefetch_access = false;
       unsigned unused_prefetch_opportunity = 0;
       unsigned prefetches_issued = 0;
       unsigned prefetches_added_to_queue = 0;
       unsigned prefetches_removed_from_queue = 0;
       unsigned prefetches_readded_to_queue = 0;
+      unsigned prefetches_dropped_resident = 0;
       unsigned prefetch_metadata_added = 0;
 
       unsigned prefetch_generate_issue_cycle_difference = 0;
@@ -1531,16 +1585,7 @@ class rt_unit : public pipelined_simd_unit {
       unsigned total_demand_load_mf_lat = 0;
       unsigned total_demand_load_mfs = 0;
 
-      unsigned matches = 0;
-      unsigned comparisons = 0;
-
       new_addr_type most_recently_loaded_metadata_addr = NULL;
-
-      // Lee MICRO 2010 implementation
-      std::map<unsigned, std::map<int, unsigned>> pws_table; // {warp id, {stride, count}}}
-      std::map<unsigned, new_addr_type> pws_last_accessed_addr; // {warp id, last_accessed_addr}
-      std::map<new_addr_type, int> gs_table; // {load addr, stride}
-      std::map<unsigned, std::map<new_addr_type, std::map<int, unsigned>>> ip_table; // {warp id, {load addr, {stride, count}}}
 };
 
 class ldst_unit : public pipelined_simd_unit {
@@ -1556,6 +1601,8 @@ class ldst_unit : public pipelined_simd_unit {
   virtual void issue(register_set &inst);
   bool is_issue_partitioned() { return false; }
   virtual void cycle();
+  virtual unsigned long long quiet_cycles();
+  virtual void skip_cycles(unsigned long long cycles);
 
   void fill(mem_fetch *mf);
   void flush();
@@ -1668,6 +1715,7 @@ class ldst_unit : public pipelined_simd_unit {
 
   std::vector<std::deque<mem_fetch *>> l1_latency_queue;
   void L1_latency_queue_cycle();
+  void sample_l1d_stats();
 };
 
 enum pipeline_stage_name_t {
@@ -1804,6 +1852,9 @@ class shader_core_config : public core_config {
       &m_rt_intersection_latency[TransactionType::BVH_QUAD_LEAF_HIT],
       &m_rt_intersection_latency[TransactionType::BVH_PROCEDURAL_LEAF]);
     m_rt_intersection_latency[TransactionType::Intersection_Table_Load] = 1;
+
+    // Pick the RT prefetch policy
+    rt_prefetcher::configure(*this);
     
     sscanf(m_rt_coherence_engine_config_str, "%u,%u,%u,%c,%u,%u,%u,%f", 
       &m_rt_coherence_engine_config.max_cycles,
@@ -1992,15 +2043,27 @@ class shader_core_config : public core_config {
   bool m_treelet_queue;
   unsigned m_treelet_queue_wait_cycle;
   unsigned m_max_prefetch_queue_size;
+  bool m_rt_prefetch_drop_resident;
   bool m_treelet_sort;
   unsigned m_sort_method;
   bool m_lee_micro_prefetcher;
+  char *m_rt_prefetcher_name;
+  unsigned m_rt_prefetcher_policy; // index into the rt_prefetcher registry
   bool load_treelet_metadata;
   bool wait_for_metadata_load;
   bool early_metadata_load;
   bool remap_to_treelet_layout;
   unsigned treelet_remap_stride;
+  char *treelet_layout_name;
+  char *treelet_layout_report;
   unsigned prefetch_delay;
+  bool treelet_index_benchmark;
+  unsigned treelet_build_threads;
+  bool treelet_build_benchmark;
+  unsigned rt_trace_threads;
+  char *treelet_cache_dir;
+  int rt_simd_isa;
+  bool rt_simd_check;
 };
 
 struct shader_core_stats_pod {
@@ -2456,13 +2519,22 @@ class shader_core_mem_fetch_allocator : public mem_fetch_allocator {
                    unsigned sid, unsigned tpc, mem_fetch *original_mf) const;
   mem_fetch *alloc(const warp_inst_t &inst, const mem_access_t &access,
                    unsigned long long cycle) const {
-    warp_inst_t inst_copy = inst;
     mem_fetch *mf = new mem_fetch(
-        access, &inst_copy,
+        access, &inst,
         access.is_write() ? WRITE_PACKET_SIZE : READ_PACKET_SIZE,
         inst.warp_id(), m_core_id, m_cluster_id, m_memory_config, cycle);
     return mf;
   }
+  // RT unit requests only use the instruction to identify the warp, so their
+  // copy leaves out the per-thread state (and its RT transaction logs)
+  mem_fetch *alloc_rt(warp_inst_t &inst, const mem_access_t &access,
+                      unsigned long long cycle) const {
+    std::vector<warp_inst_t::per_thread_info> thread_info;
+    inst.swap_thread_info(thread_info);
+    mem_fetch *mf = alloc(inst, access, cycle);
+    inst.swap_thread_info(thread_info);
+    return mf;
+  }
 
  private:
   unsigned m_core_id;
@@ -2481,6 +2553,10 @@ class shader_core_ctx : public core_t {
   // used by simt_core_cluster:
   // modifiers
   void cycle();
+  // cycle()s from now on that only count down and add to per-cycle stats, -1
+  // if that lasts until a response or a CTA arrives
+  unsigned long long quiet_cycles();
+  void skip_cycles(unsigned long long cycles);  // within quiet_cycles()
   void reinit(unsigned start_thread, unsigned end_thread,
               bool reset_not_completed);
   void issue_block2core(class kernel_info_t &kernel);
@@ -2892,6 +2968,7 @@ class shader_core_ctx : public core_t {
   void read_operands();
 
   void execute();
+  void sample_warp_mix(unsigned long long cycles);
 
   void writeback();
 
@@ -3028,6 +3105,16 @@ class simt_core_cluster {
   void core_cycle();
   void icnt_cycle();
 
+  // icnt_cycle()s, and core_cycle()s if cores_cycled (the cluster has work),
+  // from now on that only count down and add to per-cycle stats, -1 if that
+  // lasts until a response or a CTA arrives
+  unsigned long long quiet_cycles(bool cores_cycled) const;
+  // Same as 'cycles' of them within quiet_cycles()
+  void skip_cycles(unsigned long long cycles, bool cores_cycled);
+  // No core would be given a CTA or select a kernel this cycle, selectable
+  // if select_kernel() would hand out a kernel
+  bool cta_quiet(bool selectable);
+
   void reinit();
   unsigned issue_block2core();
   void cache_flush();
@@ -0,0 +1,112 @@
+// Copyright (c) 2022, Mohammadreza Saed, Yuan Hsi Chou, Lufei Liu, Tor M. Aamodt,
+// The University of British Columbia
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+// Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution. Neither the name of
+// The University of British Columbia nor the names of its contributors may be
+// used to endorse or promote products derived from this software without
+// specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "sim_thread_pool.h"
+
+#include <assert.h>
+#include <sched.h>
+#include <unistd.h>
+
+// Idle workers spin this many times on a new phase before yielding the CPU,
+// and start sleeping once idle for SIM_THREAD_POOL_SLEEP spins (e.g. while
+// the simulator is waiting on the host between kernels)
+#define SIM_THREAD_POOL_SPIN 4096
+#define SIM_THREAD_POOL_SLEEP (1 << 20)
+#define SIM_THREAD_POOL_SLEEP_US 50
+
+sim_thread_pool::sim_thread_pool(unsigned n_workers)
+    : m_n_workers(n_workers ? n_workers : 1),
+      m_task(NULL),
+      m_n_tasks(0),
+      m_generation(0),
+      m_pending(0),
+      m_exit(false) {
+  m_args.resize(m_n_workers);
+  m_threads.resize(m_n_workers);
+  for (unsigned w = 1; w < m_n_workers; w++) {
+    m_args[w].pool = this;
+    m_args[w].worker = w;
+    pthread_create(&m_threads[w], NULL, worker_main, &m_args[w]);
+  }
+}
+
+sim_thread_pool::~sim_thread_pool() {
+  m_exit.store(true, std::memory_order_release);
+  m_generation.fetch_add(1, std::memory_order_acq_rel);
+  for (unsigned w = 1; w < m_n_workers; w++) pthread_join(m_threads[w], NULL);
+}
+
+void sim_thread_pool::run_stripe(unsigned worker) {
+  for (unsigned t = worker; t < m_n_tasks; t += m_n_workers) (*m_task)(t);
+}
+
+void sim_thread_pool::run(unsigned n_tasks,
+                          const std::function<void(unsigned)> &task) {
+  if (m_n_workers == 1 || n_tasks <= 1) {
+    for (unsigned t = 0; t < n_tasks; t++) task(t);
+    return;
+  }
+
+  m_task = &task;
+  m_n_tasks = n_tasks;
+  m_pending.store(m_n_workers - 1, std::memory_order_relaxed);
+  m_generation.fetch_add(1, std::memory_order_release);
+
+  run_stripe(0);
+
+  unsigned spins = 0;
+  while (m_pending.load(std::memory_order_acquire) != 0) {
+    if (++spins > SIM_THREAD_POOL_SPIN) sched_yield();
+  }
+  m_task = NULL;
+}
+
+void *sim_thread_pool::worker_main(void *arg) {
+  worker_arg *wa = (worker_arg *)arg;
+  sim_thread_pool *pool = wa->pool;
+  unsigned long long seen = 0;
+
+  while (true) {
+    unsigned spins = 0;
+    unsigned long long generation;
+    while ((generation = pool->m_generation.load(std::memory_order_acquire)) ==
+           seen) {
+      spins++;
+      if (spins > SIM_THREAD_POOL_SLEEP)
+        usleep(SIM_THREAD_POOL_SLEEP_US);
+      else if (spins > SIM_THREAD_POOL_SPIN)
+        sched_yield();
+    }
+    seen = generation;
+    if (pool->m_exit.load(std::memory_order_acquire)) break;
+
+    pool->run_stripe(wa->worker);
+    pool->m_pending.fetch_sub(1, std::memory_order_acq_rel);
+  }
+  return NULL;
+}
@@ -0,0 +1,71 @@
+// Copyright (c) 2022, Mohammadreza Saed, Yuan Hsi Chou, Lufei Liu, Tor M. Aamodt,
+// The University of British Columbia
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+// Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution. Neither the name of
+// The University of British Columbia nor the names of its contributors may be
+// used to endorse or promote products derived from this software without
+// specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SIM_THREAD_POOL_INCLUDED
+#define SIM_THREAD_POOL_INCLUDED
+
+#include <pthread.h>
+#include <atomic>
+#include <functional>
+#include <vector>
+
+// Persistent worker threads for independent tasks, e.g. the BVH walks of a
+// warp's trace_ray lanes. Task t always runs on worker t % size(), and run()
+// only returns once every task is done, so each phase ends in a barrier and
+// a task's state is only ever touched by one thread. The calling thread acts
+// as worker 0.
+class sim_thread_pool {
+ public:
+  sim_thread_pool(unsigned n_workers);
+  ~sim_thread_pool();
+
+  unsigned size() const { return m_n_workers; }
+  void run(unsigned n_tasks, const std::function<void(unsigned)> &task);
+
+ private:
+  static void *worker_main(void *arg);
+  void run_stripe(unsigned worker);
+
+  struct worker_arg {
+    sim_thread_pool *pool;
+    unsigned worker;
+  };
+
+  unsigned m_n_workers;
+  std::vector<pthread_t> m_threads;
+  std::vector<worker_arg> m_args;
+
+  // Current phase
+  const std::function<void(unsigned)> *m_task;
+  unsigned m_n_tasks;
+  std::atomic<unsigned long long> m_generation;
+  std::atomic<unsigned> m_pending;
+  std::atomic<bool> m_exit;
+};
+
+#endif
@@ -40,6 +40,7 @@ std::string traffic_breakdown::classify_memfetch(class mem_fetch* mf) {
     case L2_WRBK_ACC:
     case L1_WR_ALLOC_R:
     case L2_WR_ALLOC_R:
+    case L2_PREFETCH_R:
     case BRU_ST_SPILL:
     case BRU_ST_FILL:
     case BRU_RT_SPILL:
@@ -0,0 +1,185 @@
+// Copyright (c) 2022, Mohammadreza Saed, Yuan Hsi Chou, Lufei Liu, Tor M. Aamodt,
+// The University of British Columbia
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+// Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution. Neither the name of
+// The University of British Columbia nor the names of its contributors may be
+// used to endorse or promote products derived from this software without
+// specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "treelet_popularity.h"
+
+const int popularity_histogram::NO_TREELET;
+
+void popularity_histogram::clear() {
+  m_counts.clear();
+  m_ranked.clear();
+  m_total = 0;
+}
+
+unsigned popularity_histogram::count(int key) const {
+  unsigned idx = key + 1;
+  return idx < m_counts.size() ? m_counts[idx] : 0;
+}
+
+void popularity_histogram::set_count(int key, unsigned new_count) {
+  unsigned idx = key + 1;
+  if (idx >= m_counts.size()) m_counts.resize(idx + 1, 0);
+
+  unsigned old_count = m_counts[idx];
+  if (old_count > 0) m_ranked.erase(rank_t(-(long long)old_count, key));
+  if (new_count > 0) m_ranked.insert(rank_t(-(long long)new_count, key));
+  m_counts[idx] = new_count;
+}
+
+void popularity_histogram::add(int key) {
+  assert(key >= NO_TREELET);
+  set_count(key, count(key) + 1);
+  m_total++;
+}
+
+void popularity_histogram::remove(int key) {
+  assert(count(key) > 0);
+  set_count(key, count(key) - 1);
+  m_total--;
+}
+
+bool popularity_histogram::top(int &key, int exclude) const {
+  for (auto it = m_ranked.begin(); it != m_ranked.end(); ++it) {
+    if (it->second != exclude) {
+      key = it->second;
+      return true;
+    }
+  }
+  return false;
+}
+
+void popularity_histogram::top_k(unsigned k, std::vector<std::pair<int, unsigned> > &result) const {
+  result.clear();
+  for (auto it = m_ranked.begin(); it != m_ranked.end() && result.size() < k; ++it) {
+    result.push_back(std::make_pair(it->second, (unsigned)(-it->first)));
+  }
+}
+
+
+int treelet_popularity::key_of_root(uint8_t* root) const {
+  if (root == nullptr) return popularity_histogram::NO_TREELET;
+  unsigned treelet = m_index.root_treelet(root);
+  return treelet == treelet_index::INVALID_ID ? popularity_histogram::NO_TREELET : (int)treelet;
+}
+
+int treelet_popularity::front_treelet(warp_inst_t &inst, unsigned tid) const {
+  if (inst.rt_mem_accesses_empty(tid)) return popularity_histogram::NO_TREELET;
+  new_addr_type address = inst.get_thread_info(tid).RT_mem_accesses.front().address;
+  unsigned treelet = m_index.node_treelet((uint8_t*)address);
+  assert(treelet != treelet_index::INVALID_ID);
+  return (int)treelet;
+}
+
+void treelet_popularity::set_thread(warp_entry &entry, unsigned tid, int treelet) {
+  int old_treelet = entry.thread_treelet[tid];
+  if (old_treelet == treelet) return;
+  if (old_treelet != popularity_histogram::NO_TREELET) m_threads.remove(old_treelet);
+  if (treelet != popularity_histogram::NO_TREELET) m_threads.add(treelet);
+  entry.thread_treelet[tid] = treelet;
+}
+
+void treelet_popularity::update_warp_top(warp_entry &entry) {
+  // Most popular treelet among this warp's threads, lowest treelet wins ties
+  int top = popularity_histogram::NO_TREELET;
+  unsigned top_count = 0;
+  for (unsigned i = 0; i < entry.thread_treelet.size(); i++) {
+    int treelet = entry.thread_treelet[i];
+    if (treelet == popularity_histogram::NO_TREELET) continue;
+    if (top_count > 0 && treelet == top) continue;
+
+    unsigned treelet_count = 0;
+    for (unsigned j = 0; j < entry.thread_treelet.size(); j++) {
+      if (entry.thread_treelet[j] == treelet) treelet_count++;
+    }
+    if (treelet_count > top_count || (treelet_count == top_count && treelet < top)) {
+      top = treelet;
+      top_count = treelet_count;
+    }
+  }
+
+  if (top != entry.top_treelet) {
+    m_warps.remove(entry.top_treelet);
+    m_warps.add(top);
+    entry.top_treelet = top;
+  }
+}
+
+void treelet_popularity::warp_arrived(unsigned uid, warp_inst_t &inst) {
+  if (m_warp_entries.find(uid) == m_warp_entries.end()) {
+    warp_entry &entry = m_warp_entries[uid];
+    entry.thread_treelet.assign(inst.warp_size(), popularity_histogram::NO_TREELET);
+    entry.top_treelet = popularity_histogram::NO_TREELET;
+    m_warps.add(entry.top_treelet);
+  }
+  warp_refresh(uid, inst);
+}
+
+void treelet_popularity::warp_refresh(unsigned uid, warp_inst_t &inst) {
+  auto it = m_warp_entries.find(uid);
+  assert(it != m_warp_entries.end());
+  warp_entry &entry = it->second;
+
+  for (unsigned i = 0; i < entry.thread_treelet.size(); i++) {
+    set_thread(entry, i, front_treelet(inst, i));
+  }
+  update_warp_top(entry);
+  inst.clear_rt_front_changed();
+}
+
+void treelet_popularity::warp_updated(unsigned uid, warp_inst_t &inst) {
+  const active_mask_t &changed = inst.get_rt_front_changed();
+  if (changed.none()) return;
+
+  auto it = m_warp_entries.find(uid);
+  assert(it != m_warp_entries.end());
+  warp_entry &entry = it->second;
+
+  for (unsigned i = 0; i < entry.thread_treelet.size(); i++) {
+    if (changed.test(i)) set_thread(entry, i, front_treelet(inst, i));
+  }
+  update_warp_top(entry);
+  inst.clear_rt_front_changed();
+}
+
+void treelet_popularity::warp_retired(unsigned uid) {
+  auto it = m_warp_entries.find(uid);
+  if (it == m_warp_entries.end()) return;
+  warp_entry &entry = it->second;
+
+  for (unsigned i = 0; i < entry.thread_treelet.size(); i++) {
+    set_thread(entry, i, popularity_histogram::NO_TREELET);
+  }
+  m_warps.remove(entry.top_treelet);
+  m_warp_entries.erase(it);
+}
+
+void treelet_popularity::clear() {
+  m_threads.clear();
+  m_warps.clear();
+  m_warp_entries.clear();
+}
@@ -0,0 +1,111 @@
+// Copyright (c) 2022, Mohammadreza Saed, Yuan Hsi Chou, Lufei Liu, Tor M. Aamodt,
+// The University of British Columbia
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+// Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution. Neither the name of
+// The University of British Columbia nor the names of its contributors may be
+// used to endorse or promote products derived from this software without
+// specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef TREELET_POPULARITY_INCLUDED
+#define TREELET_POPULARITY_INCLUDED
+
+#include "../abstract_hardware_model.h"
+#include "../cuda-sim/treelet_index.h"
+
+#include <map>
+#include <set>
+#include <vector>
+
+// Counts per key, ranked by (count descending, key ascending) so the top entry
+// matches what a scan over a std::map<root addr, count> with a strict '>' picks.
+// Key -1 stands for "no treelet" and ranks ahead of every real treelet on ties.
+class popularity_histogram {
+  public:
+    static const int NO_TREELET = -1;
+
+    popularity_histogram() : m_total(0) {}
+
+    void clear();
+    void add(int key);
+    void remove(int key);
+
+    unsigned count(int key) const;
+    unsigned total() const { return m_total; }
+    unsigned distinct() const { return m_ranked.size(); }
+    bool empty() const { return m_ranked.empty(); }
+
+    // Most popular key, skipping 'exclude'. Returns false if there is none.
+    bool top(int &key, int exclude) const;
+    bool top(int &key) const { return top(key, NO_TREELET - 1); }
+    void top_k(unsigned k, std::vector<std::pair<int, unsigned> > &result) const;
+
+  private:
+    // Ranked on (-count, key)
+    typedef std::pair<long long, int> rank_t;
+    void set_count(int key, unsigned new_count);
+
+    std::vector<unsigned> m_counts; // indexed by key + 1
+    std::set<rank_t> m_ranked;      // only keys with a non-zero count
+    unsigned m_total;
+};
+
+// Per RT unit tally of which treelet each thread's next BVH access falls in.
+// Updated when a warp enters the unit, when threads' next accesses change
+// (process_returned_mem_access pops them, sorting rewrites them) and when a
+// warp retires, instead of rescanning every thread of every warp each cycle.
+class treelet_popularity {
+  public:
+    treelet_popularity(const treelet_index &index) : m_index(index) {}
+
+    void warp_arrived(unsigned uid, warp_inst_t &inst);
+    void warp_updated(unsigned uid, warp_inst_t &inst);  // only threads flagged in get_rt_front_changed()
+    void warp_refresh(unsigned uid, warp_inst_t &inst);  // every thread
+    void warp_retired(unsigned uid);
+    void clear();
+
+    // Threads' next accesses, per treelet
+    const popularity_histogram &threads() const { return m_threads; }
+    // Each warp's most popular treelet, per treelet
+    const popularity_histogram &warps() const { return m_warps; }
+
+    // Helpers to move between histogram keys and treelet root addresses
+    uint8_t* root_addr(int key) const { return key == popularity_histogram::NO_TREELET ? nullptr : m_index.root_addr(key); }
+    int key_of_root(uint8_t* root) const;
+
+  private:
+    struct warp_entry {
+      std::vector<int> thread_treelet;
+      int top_treelet;
+    };
+
+    int front_treelet(warp_inst_t &inst, unsigned tid) const;
+    void set_thread(warp_entry &entry, unsigned tid, int treelet);
+    void update_warp_top(warp_entry &entry);
+
+    const treelet_index &m_index;
+    popularity_histogram m_threads;
+    popularity_histogram m_warps;
+    std::map<unsigned, warp_entry> m_warp_entries; // {warp inst uid, entry}
+};
+
+#endif
@@ -0,0 +1,403 @@
+// Copyright (c) 2022, Mohammadreza Saed, Yuan Hsi Chou, Lufei Liu, Tor M. Aamodt,
+// The University of British Columbia
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+// Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution. Neither the name of
+// The University of British Columbia nor the names of its contributors may be
+// used to endorse or promote products derived from this software without
+// specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "abstract_hardware_model.h"
+
+#include <atomic>
+#include <utility>
+
+#define RT_LOG_STATUS_BITS 2
+#define RT_LOG_CHUNKS_SHIFT 2
+#define RT_LOG_TYPE_SHIFT 6
+#define RT_LOG_SIZE_SHIFT 10
+#define RT_LOG_DELTA_SHIFT 20
+#define RT_LOG_MAX_SIZE ((1u << (RT_LOG_DELTA_SHIFT - RT_LOG_SIZE_SHIFT)) - 1)
+#define RT_LOG_MAX_DELTA ((int64_t)1 << (63 - RT_LOG_DELTA_SHIFT))
+// Type field value marking a side table index in the delta field
+#define RT_LOG_WIDE_TYPE 0xfu
+
+const unsigned rt_mem_access_log::CHUNK_WORDS;
+thread_local rt_mem_access_log::chunk_cache rt_mem_access_log::s_chunk_cache = {NULL};
+
+static std::atomic<unsigned long long> s_packed(0);
+static std::atomic<unsigned long long> s_wide(0);
+static std::atomic<unsigned long long> s_live_chunks(0);
+static std::atomic<unsigned long long> s_high_water_chunks(0);
+static std::atomic<unsigned long long> s_heap_chunks(0);
+
+
+rt_mem_access_log::chunk_cache::~chunk_cache() {
+  while (free) {
+    chunk *c = free;
+    free = c->next;
+    delete c;
+    s_heap_chunks--;
+  }
+}
+
+rt_mem_access_log::chunk *rt_mem_access_log::alloc_chunk() {
+  chunk *c = s_chunk_cache.free;
+  if (c) {
+    s_chunk_cache.free = c->next;
+  } else {
+    c = new chunk;
+    s_heap_chunks++;
+  }
+  c->next = NULL;
+
+  unsigned long long live = ++s_live_chunks;
+  unsigned long long high_water = s_high_water_chunks.load(std::memory_order_relaxed);
+  while (live > high_water &&
+         !s_high_water_chunks.compare_exchange_weak(high_water, live, std::memory_order_relaxed))
+    ;
+  return c;
+}
+
+void rt_mem_access_log::free_chunk(chunk *c) {
+  c->next = s_chunk_cache.free;
+  s_chunk_cache.free = c;
+  s_live_chunks--;
+}
+
+
+rt_mem_access_log::rt_mem_access_log()
+    : m_head(NULL), m_tail(NULL), m_head_pos(0), m_tail_pos(0), m_size(0), m_base(0), m_wide(NULL) {}
+
+rt_mem_access_log::rt_mem_access_log(const rt_mem_access_log &other)
+    : m_head(NULL), m_tail(NULL), m_head_pos(0), m_tail_pos(0), m_size(0), m_base(0), m_wide(NULL) {
+  // Repacks, so records left behind in the other log's side table are dropped
+  for (const_iterator it = other.begin(); it != other.end(); ++it) push_back(*it);
+}
+
+rt_mem_access_log::rt_mem_access_log(rt_mem_access_log &&other)
+    : m_head(NULL), m_tail(NULL), m_head_pos(0), m_tail_pos(0), m_size(0), m_base(0), m_wide(NULL) {
+  swap(other);
+}
+
+void rt_mem_access_log::swap(rt_mem_access_log &other) {
+  std::swap(m_front, other.m_front);
+  std::swap(m_head, other.m_head);
+  std::swap(m_tail, other.m_tail);
+  std::swap(m_head_pos, other.m_head_pos);
+  std::swap(m_tail_pos, other.m_tail_pos);
+  std::swap(m_size, other.m_size);
+  std::swap(m_base, other.m_base);
+  std::swap(m_wide, other.m_wide);
+}
+
+
+uint64_t rt_mem_access_log::encode(const RTMemoryTransactionRecord &record) {
+  int64_t delta = (int64_t)(record.address - m_base);
+  unsigned type = (unsigned)record.type;
+  if (delta >= -RT_LOG_MAX_DELTA && delta < RT_LOG_MAX_DELTA && record.size <= RT_LOG_MAX_SIZE &&
+      type < RT_LOG_WIDE_TYPE) {
+    s_packed++;
+    return ((uint64_t)delta << RT_LOG_DELTA_SHIFT) | ((uint64_t)record.size << RT_LOG_SIZE_SHIFT) |
+           ((uint64_t)type << RT_LOG_TYPE_SHIFT) | ((uint64_t)record.mem_chunks.to_ulong() << RT_LOG_CHUNKS_SHIFT) |
+           (uint64_t)record.status;
+  }
+
+  if (!m_wide) m_wide = new std::vector<RTMemoryTransactionRecord>;
+  m_wide->push_back(record);
+  s_wide++;
+  return ((uint64_t)(m_wide->size() - 1) << RT_LOG_DELTA_SHIFT) | ((uint64_t)RT_LOG_WIDE_TYPE << RT_LOG_TYPE_SHIFT);
+}
+
+RTMemoryTransactionRecord rt_mem_access_log::decode(uint64_t word) const {
+  unsigned type = (word >> RT_LOG_TYPE_SHIFT) & 0xf;
+  if (type == RT_LOG_WIDE_TYPE) {
+    assert(m_wide);
+    return (*m_wide)[word >> RT_LOG_DELTA_SHIFT];
+  }
+
+  RTMemoryTransactionRecord record;
+  record.address = m_base + (new_addr_type)((int64_t)word >> RT_LOG_DELTA_SHIFT);
+  record.size = (word >> RT_LOG_SIZE_SHIFT) & RT_LOG_MAX_SIZE;
+  record.type = (TransactionType)type;
+  record.mem_chunks = std::bitset<4>((word >> RT_LOG_CHUNKS_SHIFT) & 0xf);
+  record.status = (RTMemStatus)(word & ((1u << RT_LOG_STATUS_BITS) - 1));
+  return record;
+}
+
+
+void rt_mem_access_log::push_back(const RTMemoryTransactionRecord &record) {
+  if (m_size == 0) {
+    m_front = record;
+    m_size = 1;
+    return;
+  }
+
+  if (!m_tail) {
+    m_base = record.address;
+    m_head = m_tail = alloc_chunk();
+    m_head_pos = m_tail_pos = 0;
+  } else if (m_tail_pos == CHUNK_WORDS) {
+    m_tail->next = alloc_chunk();
+    m_tail = m_tail->next;
+    m_tail_pos = 0;
+  }
+  m_tail->words[m_tail_pos++] = encode(record);
+  m_size++;
+}
+
+void rt_mem_access_log::pop_front() {
+  assert(m_size);
+  if (m_size == 1) {
+    m_size = 0;
+    return;
+  }
+
+  if (m_head_pos == CHUNK_WORDS) {
+    chunk *done = m_head;
+    m_head = m_head->next;
+    m_head_pos = 0;
+    free_chunk(done);
+  }
+  m_front = decode(m_head->words[m_head_pos++]);
+  m_size--;
+
+  // Front is a decoded copy, nothing refers to the packed words any more
+  if (m_size == 1) release_storage();
+}
+
+void rt_mem_access_log::release_storage() {
+  while (m_head) {
+    chunk *done = m_head;
+    m_head = m_head->next;
+    free_chunk(done);
+  }
+  m_tail = NULL;
+  m_head_pos = m_tail_pos = 0;
+  m_base = 0;
+  delete m_wide;
+  m_wide = NULL;
+}
+
+void rt_mem_access_log::clear() {
+  release_storage();
+  m_size = 0;
+}
+
+
+RTMemoryTransactionRecord rt_mem_access_log::operator[](size_t i) const {
+  assert(i < m_size);
+  const_iterator it = begin();
+  while (i--) ++it;
+  return *it;
+}
+
+bool rt_mem_access_log::operator==(const rt_mem_access_log &o) const {
+  if (m_size != o.m_size) return false;
+  for (const_iterator a = begin(), b = o.begin(); a != end(); ++a, ++b) {
+    if (!(*a == *b)) return false;
+  }
+  return true;
+}
+
+
+rt_mem_access_log::const_iterator::const_iterator(const rt_mem_access_log *log, size_t index)
+    : m_log(log), m_chunk(log->m_head), m_pos(log->m_head_pos), m_index(index) {
+  if (index == 0 && log->m_size) m_record = log->m_front;
+}
+
+rt_mem_access_log::const_iterator &rt_mem_access_log::const_iterator::operator++() {
+  m_index++;
+  if (m_index < m_log->m_size) {
+    if (m_pos == CHUNK_WORDS) {
+      m_chunk = m_chunk->next;
+      m_pos = 0;
+    }
+    m_record = m_log->decode(m_chunk->words[m_pos++]);
+  }
+  return *this;
+}
+
+
+void rt_mem_access_log::get_stats(stats &total) {
+  total.packed = s_packed;
+  total.wide = s_wide;
+  total.live_chunks = s_live_chunks;
+  total.high_water_chunks = s_high_water_chunks;
+  total.reserved_bytes = s_heap_chunks * sizeof(chunk);
+}
+
+void rt_mem_access_log::print_stats(FILE *fp) {
+  stats total;
+  get_stats(total);
+  fprintf(fp, "rt_mem_log_packed_records = %llu\n", total.packed);
+  fprintf(fp, "rt_mem_log_wide_records = %llu\n", total.wide);
+  fprintf(fp, "rt_mem_log_live_chunks = %llu\n", total.live_chunks);
+  fprintf(fp, "rt_mem_log_high_water_chunks = %llu\n", total.high_water_chunks);
+  fprintf(fp, "rt_mem_log_reserved_bytes = %llu\n", total.reserved_bytes);
+}
+
+#ifdef UNIT_TEST
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <deque>
+
+// Checks rt_mem_access_log against the std::deque it replaced on random push,
+// pop and front updates, then compares the peak RSS of both holding the logs
+// of every thread resident on an RTX 3070 class GPU.
+
+static unsigned long long s_seed = 1;
+static unsigned next_random() {
+  s_seed = s_seed * 6364136223846793005ULL + 1442695040888963407ULL;
+  return (unsigned)(s_seed >> 33);
+}
+
+// A BVH fetch near addr, now and then one that has to go to the side table
+static RTMemoryTransactionRecord random_record(new_addr_type addr) {
+  static const uint32_t sizes[] = {32, 64, 64, 128};
+  unsigned r = next_random() % 64;
+  if (r == 0) addr += (new_addr_type)1 << 50;
+  uint32_t size = sizes[next_random() % 4];
+  TransactionType type = (TransactionType)(next_random() % 9);
+  RTMemoryTransactionRecord record(addr + (next_random() % 4096) * 64, size,
+                                   type);
+  // Too large for the packed size field, chunks are left as constructed
+  if (r == 1) record.size = 2048;
+  // Marked or partly fetched, as a copied log can hold
+  if (r % 8 == 2) {
+    record.status = (RTMemStatus)(next_random() % 3);
+    record.mem_chunks = std::bitset<4>(next_random() % 16);
+  }
+  return record;
+}
+
+static bool same_record(const RTMemoryTransactionRecord &a,
+                        const RTMemoryTransactionRecord &b) {
+  return a.address == b.address && a.size == b.size && a.type == b.type &&
+         a.mem_chunks == b.mem_chunks && a.status == b.status;
+}
+
+// Returns the number of differences
+static unsigned check_against_deque(unsigned steps) {
+  rt_mem_access_log log;
+  std::deque<RTMemoryTransactionRecord> ref;
+  new_addr_type base = 0x7f0000000000ULL;
+  unsigned errors = 0;
+  for (unsigned step = 0; step < steps && errors < 10; step++) {
+    unsigned op = next_random() % 8;
+    if (op < 4) {
+      RTMemoryTransactionRecord record = random_record(base);
+      log.push_back(record);
+      ref.push_back(record);
+    } else if (op < 6 && !ref.empty()) {
+      log.pop_front();
+      ref.pop_front();
+    } else if (op == 6 && !ref.empty()) {
+      RTMemStatus status = (RTMemStatus)(next_random() % 3);
+      std::bitset<4> chunks(next_random() % 16);
+      log.front().status = status;
+      log.front().mem_chunks = chunks;
+      ref.front().status = status;
+      ref.front().mem_chunks = chunks;
+    } else if (op == 7 && next_random() % 64 == 0) {
+      rt_mem_access_log log_copy(log);
+      std::deque<RTMemoryTransactionRecord> ref_copy(ref);
+      log.clear();
+      ref.clear();
+      if (next_random() % 2) {
+        log = log_copy;
+        ref = ref_copy;
+      }
+    }
+
+    bool same = log.size() == ref.size();
+    if (same && !ref.empty()) same = same_record(log.front(), ref.front());
+    if (same && step % 16 == 0) {
+      size_t i = 0;
+      for (rt_mem_access_log::const_iterator it = log.begin();
+           same && it != log.end(); ++it, ++i) {
+        if (i == 0) continue;  // the front was checked above
+        same = same_record(*it, ref[i]) && same_record(log[i], ref[i]);
+      }
+    }
+    if (!same) {
+      if (!errors)
+        printf("step %u: log differs from the deque (%zu vs %zu records)\n",
+               step, log.size(), ref.size());
+      errors++;
+    }
+  }
+  return errors;
+}
+
+// Fills the logs of n_threads threads, between 1 and max_records records
+// each as traceRay would, and returns the peak RSS in KB of a child process
+// doing so
+template <class LOG>
+static long fill_logs_peak_rss(unsigned n_threads, unsigned max_records) {
+  pid_t pid = fork();
+  if (pid == 0) {
+    std::vector<LOG> logs(n_threads);
+    s_seed = 1;
+    for (unsigned t = 0; t < n_threads; t++) {
+      new_addr_type base = 0x7f0000000000ULL + (next_random() % 1024) * 65536;
+      for (unsigned n = 1 + next_random() % max_records; n > 0; n--)
+        logs[t].push_back(random_record(base));
+    }
+    _exit(0);
+  }
+  int status;
+  struct rusage usage;
+  if (pid < 0 || wait4(pid, &status, 0, &usage) != pid || status != 0)
+    return -1;
+  return usage.ru_maxrss;
+}
+
+int main() {
+  unsigned errors = check_against_deque(2000000);
+  printf("rt_mem_access_log vs std::deque: %u differences\n", errors);
+
+  // 46 SMs x 32 resident warps x 32 threads
+  const unsigned n_threads = 46 * 32 * 32;
+  const unsigned max_records[] = {1, 32, 128, 512};
+  long empty = fill_logs_peak_rss<rt_mem_access_log>(0, 1);
+  printf("peak RSS of %u thread logs (KB, %ld KB with no logs):\n", n_threads,
+         empty);
+  for (unsigned m = 0; m < sizeof(max_records) / sizeof(max_records[0]); m++) {
+    long deque_kb = fill_logs_peak_rss<std::deque<RTMemoryTransactionRecord> >(
+        n_threads, max_records[m]);
+    long log_kb =
+        fill_logs_peak_rss<rt_mem_access_log>(n_threads, max_records[m]);
+    printf("  %3u records per thread at most: std::deque %7ld, "
+           "rt_mem_access_log %7ld\n",
+           max_records[m], deque_kb, log_kb);
+  }
+
+  printf("%s\n", errors ? "FAILED" : "PASSED");
+  return errors ? 1 : 0;
+}
+
+#endif
@@ -0,0 +1,171 @@
+// Copyright (c) 2022, Mohammadreza Saed, Yuan Hsi Chou, Lufei Liu, Tor M. Aamodt,
+// The University of British Columbia
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+// Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution. Neither the name of
+// The University of British Columbia nor the names of its contributors may be
+// used to endorse or promote products derived from this software without
+// specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef RT_MEM_ACCESS_LOG_INCLUDED
+#define RT_MEM_ACCESS_LOG_INCLUDED
+
+// Included from abstract_hardware_model.h once RTMemoryTransactionRecord is
+// defined, include that instead.
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <iterator>
+#include <vector>
+
+// Per-thread log of the BVH fetches recorded by the functional traceRay and
+// replayed by the RT unit. Supports the subset of std::deque the timing model
+// uses (front, pop_front, push_back, forward iteration) but only the front
+// record is kept decoded, the rest are packed into one 64-bit word each:
+//
+//   [63:20] address - log base (signed)  [19:10] size in bytes
+//   [9:6]   TransactionType              [5:2]   mem_chunks  [1:0] status
+//
+// The log base is the address of the first packed record; a thread's fetches
+// all fall within one BVH so the deltas are small. Words are stored in fixed
+// size chunks recycled through a per host thread free list, and a log with a
+// single record allocates nothing. Records that do not fit a word (far away
+// addresses, sizes over 1023B, ...) are kept whole in a side table.
+class rt_mem_access_log {
+  struct chunk;
+
+ public:
+  struct stats {
+    unsigned long long packed;          // records pushed as packed words
+    unsigned long long wide;            // ... as side table entries
+    unsigned long long live_chunks;
+    unsigned long long high_water_chunks;
+    unsigned long long reserved_bytes;  // chunks taken from the heap
+  };
+
+  class const_iterator {
+   public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef RTMemoryTransactionRecord value_type;
+    typedef ptrdiff_t difference_type;
+    typedef const RTMemoryTransactionRecord *pointer;
+    typedef const RTMemoryTransactionRecord &reference;
+
+    const_iterator() : m_log(NULL), m_chunk(NULL), m_pos(0), m_index(0) {}
+
+    // Decoded copy, valid until the iterator moves
+    reference operator*() const { return m_record; }
+    pointer operator->() const { return &m_record; }
+    const_iterator &operator++();
+    const_iterator operator++(int) {
+      const_iterator old = *this;
+      ++*this;
+      return old;
+    }
+    bool operator==(const const_iterator &o) const { return m_index == o.m_index; }
+    bool operator!=(const const_iterator &o) const { return m_index != o.m_index; }
+
+   private:
+    friend class rt_mem_access_log;
+    const_iterator(const rt_mem_access_log *log, size_t index);
+
+    const rt_mem_access_log *m_log;
+    const chunk *m_chunk;
+    unsigned m_pos;
+    size_t m_index;
+    RTMemoryTransactionRecord m_record;
+  };
+
+  rt_mem_access_log();
+  rt_mem_access_log(const rt_mem_access_log &other);
+  rt_mem_access_log(rt_mem_access_log &&other);
+  rt_mem_access_log &operator=(rt_mem_access_log other) {
+    swap(other);
+    return *this;
+  }
+  ~rt_mem_access_log() { clear(); }
+
+  bool empty() const { return m_size == 0; }
+  size_t size() const { return m_size; }
+
+  // Only the front record can be modified in place (status, mem_chunks)
+  RTMemoryTransactionRecord &front() {
+    assert(m_size);
+    return m_front;
+  }
+  const RTMemoryTransactionRecord &front() const {
+    assert(m_size);
+    return m_front;
+  }
+  // Walks the chunks, meant for debug output
+  RTMemoryTransactionRecord operator[](size_t i) const;
+
+  const_iterator begin() const { return const_iterator(this, 0); }
+  const_iterator end() const { return const_iterator(this, m_size); }
+
+  void push_back(const RTMemoryTransactionRecord &record);
+  void pop_front();
+  void clear();
+  void swap(rt_mem_access_log &other);
+
+  // Same records in the same order (RTMemoryTransactionRecord::operator==)
+  bool operator==(const rt_mem_access_log &o) const;
+  bool operator!=(const rt_mem_access_log &o) const { return !(*this == o); }
+
+  // Totals over every log. Only call between parallel phases.
+  static void get_stats(stats &total);
+  static void print_stats(FILE *fp);
+
+ private:
+  static const unsigned CHUNK_WORDS = 31;  // 256B with the link
+
+  struct chunk {
+    chunk *next;
+    uint64_t words[CHUNK_WORDS];
+  };
+  struct chunk_cache {
+    chunk *free;
+    ~chunk_cache();
+  };
+
+  uint64_t encode(const RTMemoryTransactionRecord &record);
+  RTMemoryTransactionRecord decode(uint64_t word) const;
+  void release_storage();
+
+  static chunk *alloc_chunk();
+  static void free_chunk(chunk *c);
+
+  RTMemoryTransactionRecord m_front;
+  chunk *m_head;  // NULL until a second record is pushed
+  chunk *m_tail;
+  unsigned m_head_pos;  // next word to read from m_head
+  unsigned m_tail_pos;  // next word to write in m_tail
+  size_t m_size;        // including m_front
+  new_addr_type m_base;
+  std::vector<RTMemoryTransactionRecord> *m_wide;  // allocated on first use
+
+  static thread_local chunk_cache s_chunk_cache;
+};
+
+#endif
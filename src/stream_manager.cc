@@ -435,6 +435,18 @@ bool stream_manager::empty() {
   return result;
 }
 
+bool stream_manager::has_ready_operation() {
+  bool result = false;
+  pthread_mutex_lock(&m_lock);
+  if (!m_stream_zero.empty() && !m_stream_zero.busy()) result = true;
+  std::list<struct CUstream_st *>::iterator s;
+  for (s = m_streams.begin(); !result && s != m_streams.end(); ++s) {
+    if (!(*s)->empty() && !(*s)->busy()) result = true;
+  }
+  pthread_mutex_unlock(&m_lock);
+  return result;
+}
+
 void stream_manager::print(FILE *fp) {
   pthread_mutex_lock(&m_lock);
   print_impl(fp);
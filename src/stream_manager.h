@@ -260,6 +260,8 @@ class stream_manager {
   bool concurrent_streams_empty();
   bool empty_protected();
   bool empty();
+  // an operation that operation() would try to start is waiting in a stream
+  bool has_ready_operation();
   void print(FILE *fp);
   void push(stream_operation op);
   void pushCudaStreamWaitEventToAllStreams(CUevent_st *e, unsigned int flags);